@@ -110,7 +110,7 @@ be32dec_vect(uint32_t *dst, const unsigned char *src, size_t len)
  * the 512-bit input block to produce a new state.
  */
 static void
-SHA256_Transform(uint32_t * state, const unsigned char block[64])
+SHA256_Transform1(uint32_t * state, const unsigned char block[64])
 {
 	uint32_t W[64];
 	uint32_t S[8];
@@ -196,6 +196,179 @@ SHA256_Transform(uint32_t * state, const unsigned char block[64])
 		state[i] += S[i];
 }
 
+static void
+SHA256_Transform_c(uint32_t *state, const unsigned char *blocks, size_t n)
+{
+
+	for (; n != 0; n--, blocks += 64)
+		SHA256_Transform1(state, blocks);
+}
+
+#ifdef HAVE_SHA_NI
+#include <cpuid.h>
+#include <immintrin.h>
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/*
+ * The x86 SHA extensions do two rounds per sha256rnds2 with the state
+ * held as ABEF and CDGH, and sha256msg1/2 build the message schedule
+ * four words at a time.
+ */
+__attribute__((target("sha,sse4.1")))
+static void
+SHA256_Transform_shani(uint32_t *state, const unsigned char *blocks, size_t n)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	    0x0405060700010203ULL);
+	__m128i st0, st1, abef, cdgh, msg, t, w[4];
+	int i;
+
+	t = _mm_loadu_si128((const __m128i *)(const void *)&state[0]);
+	st1 = _mm_loadu_si128((const __m128i *)(const void *)&state[4]);
+	t = _mm_shuffle_epi32(t, 0xb1);			/* CDAB */
+	st1 = _mm_shuffle_epi32(st1, 0x1b);		/* EFGH */
+	st0 = _mm_alignr_epi8(t, st1, 8);		/* ABEF */
+	st1 = _mm_blend_epi16(st1, t, 0xf0);		/* CDGH */
+
+	for (; n != 0; n--, blocks += 64) {
+		abef = st0;
+		cdgh = st1;
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				msg = _mm_loadu_si128(
+				    (const __m128i *)(const void *)
+				    (blocks + i * 16));
+				w[i] = _mm_shuffle_epi8(msg, bswap);
+			} else {
+				t = _mm_sha256msg1_epu32(w[i & 3],
+				    w[(i + 1) & 3]);
+				t = _mm_add_epi32(t, _mm_alignr_epi8(
+				    w[(i + 3) & 3], w[(i + 2) & 3], 4));
+				w[i & 3] = _mm_sha256msg2_epu32(t,
+				    w[(i + 3) & 3]);
+			}
+			msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128(
+			    (const __m128i *)(const void *)&K[i * 4]));
+			st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+		}
+		st0 = _mm_add_epi32(st0, abef);
+		st1 = _mm_add_epi32(st1, cdgh);
+	}
+
+	t = _mm_shuffle_epi32(st0, 0x1b);		/* FEBA */
+	st1 = _mm_shuffle_epi32(st1, 0xb1);		/* DCHG */
+	st0 = _mm_blend_epi16(t, st1, 0xf0);		/* DCBA */
+	st1 = _mm_alignr_epi8(st1, t, 8);		/* HGFE */
+	_mm_storeu_si128((__m128i *)(void *)&state[0], st0);
+	_mm_storeu_si128((__m128i *)(void *)&state[4], st1);
+}
+
+static int
+SHA256_HaveSHANI(void)
+{
+	unsigned int a, b, c, d;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid(1, a, b, c, d);
+	if (!(c & bit_SSE4_1) || !(c & bit_SSSE3))
+		return 0;
+	__cpuid_count(7, 0, a, b, c, d);
+	return b & bit_SHA ? 1 : 0;
+}
+#endif
+
+/* Block transforms compiled in, best first. */
+static const struct sha256_backend {
+	const char *name;
+	void (*transform)(uint32_t *, const unsigned char *, size_t);
+	int (*supported)(void);
+} sha256_backends[] = {
+#ifdef HAVE_SHA_NI
+	{ "sha-ni", SHA256_Transform_shani, SHA256_HaveSHANI },
+#endif
+	{ "c", SHA256_Transform_c, NULL },
+};
+
+static const struct sha256_backend *sha256_backend;
+
+static void
+SHA256_Select(void)
+{
+	const struct sha256_backend *b;
+
+	/* The last one is always supported. */
+	for (b = sha256_backends; ; b++) {
+		if (b->supported == NULL || b->supported())
+			break;
+	}
+	sha256_backend = b;
+}
+
+static void
+SHA256_Transform(uint32_t *state, const unsigned char *blocks, size_t n)
+{
+
+	if (sha256_backend == NULL)
+		SHA256_Select();
+	sha256_backend->transform(state, blocks, n);
+}
+
+/* Returns the name of the block transform in use. */
+const char *
+SHA256_Backend(void)
+{
+
+	if (sha256_backend == NULL)
+		SHA256_Select();
+	return sha256_backend->name;
+}
+
+/* Use the named block transform, NULL for the best the CPU supports. */
+int
+SHA256_SetBackend(const char *name)
+{
+	const struct sha256_backend *b;
+	size_t i;
+
+	if (name == NULL) {
+		sha256_backend = NULL;
+		return 0;
+	}
+	for (i = 0; i < sizeof(sha256_backends) / sizeof(sha256_backends[0]);
+	    i++)
+	{
+		b = &sha256_backends[i];
+		if (strcmp(b->name, name) != 0)
+			continue;
+		if (b->supported != NULL && !b->supported())
+			return -1;
+		sha256_backend = b;
+		return 0;
+	}
+	return -1;
+}
+
 static unsigned char PAD[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -269,15 +442,15 @@ SHA256_Update(SHA256_CTX * ctx, const void *in, size_t len)
 
 	/* Finish the current block */
 	memcpy(&ctx->buf[r], src, 64 - r);
-	SHA256_Transform(ctx->state, ctx->buf);
+	SHA256_Transform(ctx->state, ctx->buf, 1);
 	src += 64 - r;
 	len -= 64 - r;
 
 	/* Perform complete blocks */
-	while (len >= 64) {
-		SHA256_Transform(ctx->state, src);
-		src += 64;
-		len -= 64;
+	if (len >= 64) {
+		SHA256_Transform(ctx->state, src, len / 64);
+		src += len & ~(size_t)0x3f;
+		len &= 0x3f;
 	}
 
 	/* Copy left over data into buffer */
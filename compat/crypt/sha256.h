@@ -43,4 +43,9 @@ void	SHA256_Init(SHA256_CTX *);
 void	SHA256_Update(SHA256_CTX *, const void *, size_t);
 void	SHA256_Final(unsigned char [32], SHA256_CTX *);
 
+/* The best block transform the CPU supports is picked at runtime. */
+#define	SHA256_BACKENDS
+const char *SHA256_Backend(void);
+int	SHA256_SetBackend(const char *);
+
 #endif
@@ -36,6 +36,7 @@
 #include <netinet/if_ether.h>
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -106,13 +107,14 @@ arp_request(const struct arp_state *astate,
 	ZERO(ifp->hwlen);
 	APPEND(&tip->s_addr, sizeof(tip->s_addr));
 
+	IF_STAT(astate->iface, IFS_ARP, tx);
 #ifdef PRIVSEP
 	if (ifp->ctx->options & DHCPCD_PRIVSEP)
 		return ps_bpf_sendarp(ifp, tip, arp_buffer, len);
 #endif
 	/* Note that well formed ethernet will add extra padding
 	 * to ensure that the packet is at least 60 bytes (64 including FCS). */
-	return bpf_send(astate->bpf, ETHERTYPE_ARP, arp_buffer, len);
+	return bpf_send(ARP_CSTATE(ifp)->bpf, ETHERTYPE_ARP, arp_buffer, len);
 
 eexit:
 	errno = ENOBUFS;
@@ -145,6 +147,41 @@ arp_report_conflicted(const struct arp_state *astate,
 	    inet_ntoa(astate->addr));
 }
 
+static int
+arp_cmpaddr(__unused void *context, const void *node, const void *key)
+{
+	const struct arp_state *astate = node;
+	const struct in_addr *addr = key;
+
+	if (ntohl(astate->addr.s_addr) < ntohl(addr->s_addr))
+		return -1;
+	if (ntohl(astate->addr.s_addr) > ntohl(addr->s_addr))
+		return 1;
+	return 0;
+}
+
+static int
+arp_cmpaddrnode(void *context, const void *node1, const void *node2)
+{
+	const struct arp_state *a2 = node2;
+
+	return arp_cmpaddr(context, node1, &a2->addr);
+}
+
+static const rb_tree_ops_t arp_addr_ops = {
+	.rbto_compare_nodes = arp_cmpaddrnode,
+	.rbto_compare_key = arp_cmpaddr,
+	.rbto_node_offset = offsetof(struct arp_state, tree),
+	.rbto_context = NULL
+};
+
+static struct arp_state *
+arp_lookup(struct iarp_state *state, const struct in_addr *addr)
+{
+
+	return rb_tree_find_node(&state->arp_addrs, addr);
+}
+
 static void
 arp_found(struct arp_state *astate, const struct arp_msg *amsg)
 {
@@ -157,9 +194,10 @@ arp_found(struct arp_state *astate, const struct arp_msg *amsg)
 	arp_report_conflicted(astate, amsg);
 	ifp = astate->iface;
 
-	/* If we haven't added the address we're doing a probe. */
+	/* If we haven't added the address we're doing a probe.
+	 * An optimistic bind adds it whilst still probing. */
 	ia = ipv4_iffindaddr(ifp, &astate->addr, NULL);
-	if (ia == NULL) {
+	if (ia == NULL || astate->probing) {
 		if (astate->found_cb != NULL)
 			astate->found_cb(astate, amsg);
 		return;
@@ -229,10 +267,11 @@ arp_packet(struct interface *ifp, uint8_t *data, size_t len,
 	const struct interface *ifn;
 	struct arphdr ar;
 	struct arp_msg arm;
-	const struct iarp_state *state;
-	struct arp_state *astate, *astaten;
+	struct iarp_state *state;
+	struct arp_state *astate;
 	uint8_t *hw_s, *hw_t;
 
+	IF_STAT(ifp, IFS_ARP, rx);
 	/* Copy the frame header source and destination out */
 	memset(&arm, 0, sizeof(arm));
 	if (fl != 0) {
@@ -250,14 +289,14 @@ arp_packet(struct interface *ifp, uint8_t *data, size_t len,
 
 	/* We must have a full ARP header */
 	if (len < sizeof(ar))
-		return;
+		goto drop;
 	memcpy(&ar, data, sizeof(ar));
 
 	if (!arp_validate(ifp, &ar)) {
 #ifdef BPF_DEBUG
 		logerrx("%s: ARP BPF validation failure", ifp->name);
 #endif
-		return;
+		goto drop;
 	}
 
 	/* Get pointers to the hardware addresses */
@@ -265,7 +304,7 @@ arp_packet(struct interface *ifp, uint8_t *data, size_t len,
 	hw_t = hw_s + ar.ar_hln + ar.ar_pln;
 	/* Ensure we got all the data */
 	if ((size_t)((hw_t + ar.ar_hln + ar.ar_pln) - data) > len)
-		return;
+		goto drop;
 	/* Ignore messages from ourself */
 	TAILQ_FOREACH(ifn, ifp->ctx->ifaces, next) {
 		if (ar.ar_hln == ifn->hwlen &&
@@ -276,7 +315,7 @@ arp_packet(struct interface *ifp, uint8_t *data, size_t len,
 #ifdef ARP_DEBUG
 		logdebugx("%s: ignoring ARP from self", ifp->name);
 #endif
-		return;
+		goto drop;
 	}
 	/* Copy out the HW and IP addresses */
 	memcpy(&arm.sha, hw_s, ar.ar_hln);
@@ -286,27 +325,29 @@ arp_packet(struct interface *ifp, uint8_t *data, size_t len,
 
 	/* Match the ARP probe to our states.
 	 * Ignore Unicast Poll, RFC1122. */
-	state = ARP_CSTATE(ifp);
+	state = ARP_STATE(ifp);
 	if (state == NULL)
-		return;
-	TAILQ_FOREACH_SAFE(astate, &state->arp_states, next, astaten) {
-		if (IN_ARE_ADDR_EQUAL(&arm.sip, &astate->addr) ||
-		    (IN_IS_ADDR_UNSPECIFIED(&arm.sip) &&
-		    IN_ARE_ADDR_EQUAL(&arm.tip, &astate->addr) &&
-		    bpf_flags & BPF_BCAST))
-			arp_found(astate, &arm);
-	}
+		goto drop;
+	astate = arp_lookup(state, &arm.sip);
+	if (astate == NULL && IN_IS_ADDR_UNSPECIFIED(&arm.sip) &&
+	    bpf_flags & BPF_BCAST)
+		astate = arp_lookup(state, &arm.tip);
+	if (astate != NULL)
+		arp_found(astate, &arm);
+	return;
+
+drop:
+	IF_STAT(ifp, IFS_ARP, drop);
 }
 
 static void
 arp_read(void *arg, unsigned short events)
 {
-	struct arp_state *astate = arg;
-	struct bpf *bpf = astate->bpf;
-	struct interface *ifp = astate->iface;
+	struct interface *ifp = arg;
+	struct iarp_state *state = ARP_STATE(ifp);
+	struct bpf *bpf = state->bpf;
 	uint8_t buf[ARP_LEN];
 	ssize_t bytes;
-	struct in_addr addr = astate->addr;
 
 	if (events != ELE_READ)
 		logerrx("%s: unexpected event 0x%04x", __func__, events);
@@ -319,24 +360,58 @@ arp_read(void *arg, unsigned short events)
 		bytes = bpf_read(bpf, buf, sizeof(buf));
 		if (bytes == -1) {
 			logerr("%s: %s", __func__, ifp->name);
-			arp_free(astate);
+			arp_drop(ifp);
 			return;
 		}
-		arp_packet(ifp, buf, (size_t)bytes, bpf->bpf_flags);
-		/* Check we still have a state after processing. */
-		if ((astate = arp_find(ifp, &addr)) == NULL)
+		if (bytes == 0)
 			break;
-		if ((bpf = astate->bpf) == NULL)
+		arp_packet(ifp, buf, (size_t)bytes, bpf->bpf_flags);
+		/* Check we still have the socket after processing. */
+		if ((state = ARP_STATE(ifp)) == NULL || state->bpf != bpf)
 			break;
 	}
 }
 
+/*
+ * One socket serves all the addresses on the interface,
+ * so when they change only the filter needs updating.
+ */
+static int
+arp_open(struct interface *ifp)
+{
+	struct iarp_state *state = ARP_STATE(ifp);
+
+	if (state->bpf != NULL)
+		return bpf_setfilter(state->bpf, NULL);
+
+	state->bpf = bpf_open(ifp, bpf_arp, NULL);
+	if (state->bpf == NULL)
+		return -1;
+	if (eloop_p_event_add(ifp->ctx->eloop, ELOOP_PRIO_HIGH,
+	    state->bpf->bpf_fd, ELE_READ, arp_read, ifp) == -1)
+		logerr("%s: eloop_event_add", __func__);
+	return 0;
+}
+
+static void
+arp_close(struct interface *ifp)
+{
+	struct iarp_state *state = ARP_STATE(ifp);
+
+	if (state->bpf == NULL)
+		return;
+	eloop_event_delete(ifp->ctx->eloop, state->bpf->bpf_fd);
+	bpf_close(state->bpf);
+	state->bpf = NULL;
+}
+
 static void
 arp_probed(void *arg)
 {
 	struct arp_state *astate = arg;
 
 	timespecclear(&astate->defend);
+	astate->probing = false;
 	astate->not_found_cb(astate);
 }
 
@@ -369,6 +444,7 @@ arp_probe(struct arp_state *astate)
 {
 
 	astate->probes = 0;
+	astate->probing = true;
 	logdebugx("%s: probing for %s",
 	    astate->iface->name, inet_ntoa(astate->addr));
 	arp_probe1(astate);
@@ -381,13 +457,9 @@ arp_find(struct interface *ifp, const struct in_addr *addr)
 	struct iarp_state *state;
 	struct arp_state *astate;
 
-	if ((state = ARP_STATE(ifp)) == NULL)
-		goto out;
-	TAILQ_FOREACH(astate, &state->arp_states, next) {
-		if (astate->addr.s_addr == addr->s_addr && astate->iface == ifp)
-			return astate;
-	}
-out:
+	if ((state = ARP_STATE(ifp)) != NULL &&
+	    (astate = arp_lookup(state, addr)) != NULL)
+		return astate;
 	errno = ESRCH;
 	return NULL;
 }
@@ -459,23 +531,18 @@ arp_announce(struct arp_state *astate)
 		state = ARP_STATE(ifp);
 		if (state == NULL)
 			continue;
-		TAILQ_FOREACH(a2, &state->arp_states, next) {
-			if (astate == a2 ||
-			    a2->addr.s_addr != astate->addr.s_addr)
-				continue;
-			r = eloop_timeout_delete(a2->iface->ctx->eloop,
-			    a2->claims < ANNOUNCE_NUM
-			    ? arp_announce1 : arp_announced,
-			    a2);
-			if (r == -1)
-				logerr(__func__);
-			else if (r != 0) {
-				logdebugx("%s: ARP announcement "
-				    "of %s cancelled",
-				    a2->iface->name,
-				    inet_ntoa(a2->addr));
-				arp_announced(a2);
-			}
+		a2 = arp_lookup(state, &astate->addr);
+		if (a2 == NULL || a2 == astate)
+			continue;
+		r = eloop_timeout_delete(a2->iface->ctx->eloop,
+		    a2->claims < ANNOUNCE_NUM ? arp_announce1 : arp_announced,
+		    a2);
+		if (r == -1)
+			logerr(__func__);
+		else if (r != 0) {
+			logdebugx("%s: ARP announcement of %s cancelled",
+			    a2->iface->name, inet_ntoa(a2->addr));
+			arp_announced(a2);
 		}
 	}
 
@@ -498,7 +565,9 @@ arp_ifannounceaddr(struct interface *ifp, const struct in_addr *ia)
 			return NULL;
 		astate->announced_cb = arp_free;
 	}
-	arp_announce(astate);
+	/* Announced when the probe is done. */
+	if (!astate->probing)
+		arp_announce(astate);
 	return astate;
 }
 
@@ -542,6 +611,8 @@ arp_new(struct interface *ifp, const struct in_addr *addr)
 			return NULL;
 		}
 		TAILQ_INIT(&state->arp_states);
+		rb_tree_init(&state->arp_addrs, &arp_addr_ops);
+		state->bpf = NULL;
 	} else {
 		if ((astate = arp_find(ifp, addr)) != NULL)
 			return astate;
@@ -554,31 +625,26 @@ arp_new(struct interface *ifp, const struct in_addr *addr)
 	astate->iface = ifp;
 	astate->addr = *addr;
 
+	/* The filter is built from arp_states, so add it first. */
+	TAILQ_INSERT_TAIL(&state->arp_states, astate, next);
+	rb_tree_insert_node(&state->arp_addrs, astate);
+
 #ifdef PRIVSEP
 	if (IN_PRIVSEP(ifp->ctx)) {
-		if (ps_bpf_openarp(ifp, addr) == -1) {
-			logerr(__func__);
-			free(astate);
-			return NULL;
-		}
+		if (ps_bpf_openarp(ifp, addr) == -1)
+			goto eexit;
 	} else
 #endif
-	{
-		astate->bpf = bpf_open(ifp, bpf_arp, addr);
-		if (astate->bpf == NULL) {
-			logerr(__func__);
-			free(astate);
-			return NULL;
-		}
-		if (eloop_event_add(ifp->ctx->eloop, astate->bpf->bpf_fd, ELE_READ,
-		    arp_read, astate) == -1)
-			logerr("%s: eloop_event_add", __func__);
-	}
-
-
-	state = ARP_STATE(ifp);
-	TAILQ_INSERT_TAIL(&state->arp_states, astate, next);
+	if (arp_open(ifp) == -1)
+		goto eexit;
 	return astate;
+
+eexit:
+	logerr(__func__);
+	TAILQ_REMOVE(&state->arp_states, astate, next);
+	rb_tree_remove_node(&state->arp_addrs, astate);
+	free(astate);
+	return NULL;
 }
 
 void
@@ -597,6 +663,7 @@ arp_free(struct arp_state *astate)
 
 	state =	ARP_STATE(ifp);
 	TAILQ_REMOVE(&state->arp_states, astate, next);
+	rb_tree_remove_node(&state->arp_addrs, astate);
 	if (astate->free_cb)
 		astate->free_cb(astate);
 
@@ -604,17 +671,14 @@ arp_free(struct arp_state *astate)
 	if (IN_PRIVSEP(ctx) && ps_bpf_closearp(ifp, &astate->addr) == -1)
 		logerr(__func__);
 #endif
-	if (astate->bpf != NULL) {
-		eloop_event_delete(ctx->eloop, astate->bpf->bpf_fd);
-		bpf_close(astate->bpf);
-	}
-
 	free(astate);
 
 	if (TAILQ_FIRST(&state->arp_states) == NULL) {
+		arp_close(ifp);
 		free(state);
 		ifp->if_data[IF_DATA_ARP] = NULL;
-	}
+	} else if (state->bpf != NULL && bpf_setfilter(state->bpf, NULL) == -1)
+		logerr("%s: %s", __func__, ifp->name);
 }
 
 void
@@ -636,3 +700,16 @@ arp_drop(struct interface *ifp)
 	    (astate = TAILQ_FIRST(&state->arp_states)) != NULL)
 		arp_free(astate);
 }
+
+/* The filters skip frames from our hardware address, so keep it current. */
+void
+arp_refilter(struct interface *ifp)
+{
+	struct iarp_state *state = ARP_STATE(ifp);
+
+	/* Under privsep the BPF processes have their own filters. */
+	if (state == NULL || state->bpf == NULL)
+		return;
+	if (bpf_setfilter(state->bpf, NULL) == -1)
+		logerr("%s: %s", __func__, ifp->name);
+}
@@ -67,11 +67,12 @@ struct arp_msg {
 
 struct arp_state {
 	TAILQ_ENTRY(arp_state) next;
+	rb_node_t tree;		/* in iarp_state addrs, by addr */
 	struct interface *iface;
 	struct in_addr addr;
-	struct bpf *bpf;
 
 	int probes;
+	bool probing;
 	int claims;
 	struct timespec defend;
 
@@ -85,6 +86,8 @@ TAILQ_HEAD(arp_statehead, arp_state);
 
 struct iarp_state {
 	struct arp_statehead arp_states;
+	rb_tree_t arp_addrs;	/* arp_states by address */
+	struct bpf *bpf;	/* shared by arp_states, unless privsep */
 };
 
 #define ARP_STATE(ifp)							       \
@@ -102,5 +105,6 @@ struct arp_state * arp_find(struct interface *, const struct in_addr *);
 void arp_free(struct arp_state *);
 void arp_freeaddr(struct interface *, const struct in_addr *);
 void arp_drop(struct interface *);
+void arp_refilter(struct interface *);
 #endif /* ARP */
 #endif /* ARP_H */
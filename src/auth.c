@@ -46,10 +46,6 @@
 #include "dhcpcd.h"
 #include "privsep-root.h"
 
-#ifdef HAVE_HMAC_H
-#include <hmac.h>
-#endif
-
 #ifdef __sun
 #define htonll
 #define ntohll
@@ -94,6 +90,59 @@ dhcp_auth_reset(struct authstate *state)
 	}
 }
 
+#define	HMAC_BLOCK_LENGTH	64
+#define	HMAC_IPAD		0x36
+#define	HMAC_OPAD		0x5c
+
+/*
+ * Hash the HMAC-MD5 inner and outer key pads once, RFC 2104,
+ * so each message then only needs hashing itself.
+ * Call this whenever the key of a token changes.
+ */
+void
+dhcp_auth_setkey(struct token *t)
+{
+	uint8_t ipad[HMAC_BLOCK_LENGTH], opad[HMAC_BLOCK_LENGTH];
+	uint8_t d[MD5_DIGEST_LENGTH];
+	const uint8_t *k = t->key;
+	size_t klen = t->key_len, i;
+	MD5_CTX ctx;
+
+	if (klen > HMAC_BLOCK_LENGTH) {
+		MD5Init(&ctx);
+		MD5Update(&ctx, k, (unsigned int)klen);
+		MD5Final(d, &ctx);
+		k = d;
+		klen = sizeof(d);
+	}
+
+	for (i = 0; i < sizeof(ipad); i++) {
+		ipad[i] = (i < klen ? k[i] : 0) ^ HMAC_IPAD;
+		opad[i] = (i < klen ? k[i] : 0) ^ HMAC_OPAD;
+	}
+
+	MD5Init(&t->hmac_ipad);
+	MD5Update(&t->hmac_ipad, ipad, sizeof(ipad));
+	MD5Init(&t->hmac_opad);
+	MD5Update(&t->hmac_opad, opad, sizeof(opad));
+}
+
+static void
+dhcp_auth_hmac_md5(const struct token *t, const uint8_t *m, size_t mlen,
+    uint8_t *digest)
+{
+	uint8_t d[MD5_DIGEST_LENGTH];
+	MD5_CTX ctx;
+
+	ctx = t->hmac_ipad;
+	MD5Update(&ctx, m, (unsigned int)mlen);
+	MD5Final(d, &ctx);
+
+	ctx = t->hmac_opad;
+	MD5Update(&ctx, d, sizeof(d));
+	MD5Final(digest, &ctx);
+}
+
 /*
  * Authenticate a DHCP message.
  * m and mlen refer to the whole message.
@@ -258,6 +307,7 @@ dhcp_auth_validate(struct authstate *state, const struct auth *auth,
 					state->reconf->key_len = 16;
 				}
 				memcpy(state->reconf->key, d, 16);
+				dhcp_auth_setkey(state->reconf);
 			} else {
 				errno = EINVAL;
 				return NULL;
@@ -353,8 +403,7 @@ gottoken:
 	memset(hmac_code, 0, sizeof(hmac_code));
 	switch (algorithm) {
 	case AUTH_ALG_HMAC_MD5:
-		hmac("md5", t->key, t->key_len, mm, mlen,
-		     hmac_code, sizeof(hmac_code));
+		dhcp_auth_hmac_md5(t, mm, mlen, hmac_code);
 		break;
 	default:
 		errno = ENOSYS;
@@ -381,6 +430,8 @@ finish:
 			if (state->token->key) {
 				state->token->key_len = t->key_len;
 				memcpy(state->token->key, t->key, t->key_len);
+				state->token->hmac_ipad = t->hmac_ipad;
+				state->token->hmac_opad = t->hmac_opad;
 			} else {
 				free(state->token);
 				state->token = NULL;
@@ -719,8 +770,7 @@ dhcp_auth_encode(struct dhcpcd_ctx *ctx, struct auth *auth,
 	/* Create our hash and write it out */
 	switch(auth->algorithm) {
 	case AUTH_ALG_HMAC_MD5:
-		hmac("md5", t->key, t->key_len, m, mlen,
-		     hmac_code, sizeof(hmac_code));
+		dhcp_auth_hmac_md5(t, m, mlen, hmac_code);
 		memcpy(data, hmac_code, sizeof(hmac_code));
 		break;
 	}
@@ -35,6 +35,10 @@
 #include <sys/queue.h>
 #endif
 
+#ifdef HAVE_MD5_H
+#include <md5.h>
+#endif
+
 #define DHCPCD_AUTH_SEND	(1 << 0)
 #define DHCPCD_AUTH_REQUIRE	(1 << 1)
 #define DHCPCD_AUTH_RDM_COUNTER	(1 << 2)
@@ -59,6 +63,8 @@ struct token {
 	size_t key_len;
 	unsigned char *key;
 	time_t expire;
+	MD5_CTX hmac_ipad;	/* HMAC-MD5 state after the key pads */
+	MD5_CTX hmac_opad;
 };
 
 TAILQ_HEAD(token_head, token);
@@ -84,6 +90,7 @@ struct authstate {
 };
 
 void dhcp_auth_reset(struct authstate *);
+void dhcp_auth_setkey(struct token *);
 
 const struct token * dhcp_auth_validate(struct authstate *,
     const struct auth *,
@@ -146,6 +146,31 @@ bpf_frame_bcast(const struct interface *ifp, const void *frame)
 
 const char *bpf_name = "Berkley Packet Filter";
 
+/* Wrap an already open and filtered BPF descriptor,
+ * such as one passed from another process. */
+struct bpf *
+bpf_fdopen(const struct interface *ifp, int fd, size_t size)
+{
+	struct bpf *bpf;
+
+	if (size == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	bpf = calloc(1, sizeof(*bpf));
+	if (bpf == NULL)
+		return NULL;
+	bpf->bpf_ifp = ifp;
+	bpf->bpf_fd = fd;
+	bpf->bpf_size = size;
+	bpf->bpf_buffer = malloc(bpf->bpf_size);
+	if (bpf->bpf_buffer == NULL) {
+		free(bpf);
+		return NULL;
+	}
+	return bpf;
+}
+
 struct bpf *
 bpf_open(const struct interface *ifp,
     int (*filter)(const struct bpf *, const struct in_addr *),
@@ -166,6 +191,9 @@ bpf_open(const struct interface *ifp,
 	if (bpf == NULL)
 		return NULL;
 	bpf->bpf_ifp = ifp;
+	bpf->bpf_filter = filter;
+	if (ia != NULL)
+		bpf->bpf_addr = *ia;
 
 #ifdef _PATH_BPF
 	bpf->bpf_fd = open(_PATH_BPF, O_RDWR | O_NONBLOCK
@@ -234,9 +262,9 @@ eexit:
 }
 
 /* BPF requires that we read the entire buffer.
- * So we pass the buffer in the API so we can loop on >1 packet. */
+ * So we return each frame from it so we can loop on >1 packet. */
 ssize_t
-bpf_read(struct bpf *bpf, void *data, size_t len)
+bpf_readframe(struct bpf *bpf, const void **data)
 {
 	ssize_t bytes;
 	struct bpf_hdr packet;
@@ -267,15 +295,12 @@ bpf_read(struct bpf *bpf, void *data, size_t len)
 		    bpf->bpf_len)
 			goto next; /* Packet beyond buffer, drop. */
 		payload += packet.bh_hdrlen;
-		if (packet.bh_caplen > len)
-			bytes = (ssize_t)len;
-		else
-			bytes = (ssize_t)packet.bh_caplen;
+		bytes = (ssize_t)packet.bh_caplen;
 		if (bpf_frame_bcast(bpf->bpf_ifp, payload) == 0)
 			bpf->bpf_flags |= BPF_BCAST;
 		else
 			bpf->bpf_flags &= ~BPF_BCAST;
-		memcpy(data, payload, (size_t)bytes);
+		*data = payload;
 next:
 		bpf->bpf_pos += BPF_WORDALIGN(packet.bh_hdrlen +
 		    packet.bh_caplen);
@@ -309,8 +334,56 @@ bpf_wattach(int fd, void *filter, unsigned int filter_len)
 	return ioctl(fd, BIOCSETWF, &pf);
 }
 #endif
+
+/* Once locked the filters cannot be changed, even if we are compromised. */
+int
+bpf_lock(struct bpf *bpf)
+{
+
+#ifdef BIOCSETWF
+	if (ioctl(bpf->bpf_fd, BIOCLOCK) == -1)
+		return -1;
+#endif
+	bpf->bpf_flags |= BPF_LOCKED;
+	return 0;
+}
 #endif
 
+/*
+ * Rebuild the filter from the interface and swap it in place,
+ * so no reopen is needed when say the hardware address changes.
+ * ia replaces the address the filter was opened for if not NULL.
+ */
+int
+bpf_setfilter(struct bpf *bpf, const struct in_addr *ia)
+{
+
+	if (bpf->bpf_flags & BPF_LOCKED || bpf->bpf_filter == NULL) {
+		errno = EPERM;
+		return -1;
+	}
+	if (ia != NULL)
+		bpf->bpf_addr = *ia;
+	return bpf->bpf_filter(bpf,
+	    bpf->bpf_addr.s_addr == INADDR_ANY ? NULL : &bpf->bpf_addr);
+}
+
+/* As bpf_readframe, but copy the frame to data. */
+ssize_t
+bpf_read(struct bpf *bpf, void *data, size_t len)
+{
+	const void *frame;
+	ssize_t bytes;
+
+	bytes = bpf_readframe(bpf, &frame);
+	if (bytes == -1 || bytes == 0)
+		return bytes;
+	if ((size_t)bytes > len)
+		bytes = (ssize_t)len;
+	memcpy(data, frame, (size_t)bytes);
+	return bytes;
+}
+
 #ifndef __sun
 /* SunOS is special too - sending via BPF goes nowhere. */
 ssize_t
@@ -340,6 +413,7 @@ bpf_send(const struct bpf *bpf, uint16_t protocol,
 }
 #endif
 
+#ifndef __linux__
 void
 bpf_close(struct bpf *bpf)
 {
@@ -349,6 +423,26 @@ bpf_close(struct bpf *bpf)
 	free(bpf);
 }
 
+size_t
+bpf_ringsize(void)
+{
+
+	return 0;
+}
+#endif
+
+size_t
+bpf_memsize(const struct bpf *bpf)
+{
+	size_t size = sizeof(*bpf) + bpf->bpf_size;
+
+#ifdef __linux__
+	/* The receive ring is mapped from the kernel. */
+	size += bpf->bpf_ringlen;
+#endif
+	return size;
+}
+
 #ifdef ARP
 #define BPF_CMP_HWADDR_LEN	((((HWADDR_LEN / 4) + 2) * 2) + 1)
 static unsigned int
@@ -479,12 +573,45 @@ static const struct bpf_insn bpf_arp_filter [] = {
 #define BPF_ARP_FILTER_LEN	__arraycount(bpf_arp_filter)
 
 /* One address is two checks of two statements. */
-#define BPF_NADDRS		1
+#define BPF_NADDRS		8
 #define BPF_ARP_ADDRS_LEN	5 + ((BPF_NADDRS * 2) * 2)
 
 #define BPF_ARP_LEN		BPF_ARP_ETHER_LEN + BPF_ARP_FILTER_LEN + \
 				BPF_CMP_HWADDR_LEN + BPF_ARP_ADDRS_LEN
 
+/*
+ * Accept the frame if the loaded address is ia, or if ia is NULL
+ * any address ARP is tracking on the interface.
+ */
+static unsigned int
+bpf_arp_cmpaddrs(struct bpf_insn *bpf, const struct interface *ifp,
+    const struct in_addr *ia, uint16_t arp_len)
+{
+	struct bpf_insn *bp = bpf;
+	const struct iarp_state *state;
+	const struct arp_state *astate;
+
+	if (ia != NULL) {
+		BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K,
+		    htonl(ia->s_addr), 0, 1);
+		bp++;
+		BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
+		bp++;
+		return (unsigned int)(bp - bpf);
+	}
+
+	if ((state = ARP_CSTATE(ifp)) == NULL)
+		return 0;
+	TAILQ_FOREACH(astate, &state->arp_states, next) {
+		BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K,
+		    htonl(astate->addr.s_addr), 0, 1);
+		bp++;
+		BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
+		bp++;
+	}
+	return (unsigned int)(bp - bpf);
+}
+
 static int
 bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
 {
@@ -492,6 +619,9 @@ bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
 	struct bpf_insn buf[BPF_ARP_LEN + 1];
 	struct bpf_insn *bp;
 	uint16_t arp_len;
+	const struct iarp_state *state;
+	const struct arp_state *astate;
+	size_t naddrs;
 
 	bp = buf;
 	/* Check frame header. */
@@ -514,14 +644,24 @@ bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
 	bp += bpf_cmp_hwaddr(bp, BPF_CMP_HWADDR_LEN, sizeof(struct arphdr),
 	                     !recv, ifp->hwaddr, ifp->hwlen);
 
+	/* If there are too many addresses to match,
+	 * accept them all and let arp_packet find them. */
+	if (ia == NULL && (state = ARP_CSTATE(ifp)) != NULL) {
+		naddrs = 0;
+		TAILQ_FOREACH(astate, &state->arp_states, next)
+			naddrs++;
+		if (naddrs > BPF_NADDRS) {
+			BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
+			bp++;
+			goto attach;
+		}
+	}
+
 	/* Match sender protocol address */
 	BPF_SET_STMT(bp, BPF_LD + BPF_W + BPF_IND,
 	    sizeof(struct arphdr) + ifp->hwlen);
 	bp++;
-	BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K, htonl(ia->s_addr), 0, 1);
-	bp++;
-	BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
-	bp++;
+	bp += bpf_arp_cmpaddrs(bp, ifp, ia, arp_len);
 
 	/* If we didn't match sender, then we're only interested in
 	 * ARP probes to us, so check the null host sender. */
@@ -534,15 +674,13 @@ bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
 	BPF_SET_STMT(bp, BPF_LD + BPF_W + BPF_IND, (sizeof(struct arphdr) +
 	    (size_t)(ifp->hwlen * 2) + sizeof(in_addr_t)));
 	bp++;
-	BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K, htonl(ia->s_addr), 0, 1);
-	bp++;
-	BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
-	bp++;
+	bp += bpf_arp_cmpaddrs(bp, ifp, ia, arp_len);
 
 	/* No match, drop it */
 	BPF_SET_STMT(bp, BPF_RET + BPF_K, 0);
 	bp++;
 
+attach:
 #ifdef BIOCSETWF
 	if (!recv)
 		return bpf_wattach(bpf->bpf_fd, buf, (unsigned int)(bp - buf));
@@ -557,8 +695,7 @@ bpf_arp(const struct bpf *bpf, const struct in_addr *ia)
 
 #ifdef BIOCSETWF
 	if (bpf_arp_rw(bpf, ia, true) == -1 ||
-	    bpf_arp_rw(bpf, ia, false) == -1 ||
-	    ioctl(bpf->bpf_fd, BIOCLOCK) == -1)
+	    bpf_arp_rw(bpf, ia, false) == -1)
 		return -1;
 	return 0;
 #else
@@ -695,8 +832,7 @@ bpf_bootp(const struct bpf *bpf, __unused const struct in_addr *ia)
 
 #ifdef BIOCSETWF
 	if (bpf_bootp_rw(bpf, true) == -1 ||
-	    bpf_bootp_rw(bpf, false) == -1 ||
-	    ioctl(bpf->bpf_fd, BIOCLOCK) == -1)
+	    bpf_bootp_rw(bpf, false) == -1)
 		return -1;
 	return 0;
 #else
@@ -32,6 +32,8 @@
 #define	BPF_EOF			0x01U
 #define	BPF_PARTIALCSUM		0x02U
 #define	BPF_BCAST		0x04U
+#define	BPF_CSUMVALID		0x08U
+#define	BPF_LOCKED		0x10U
 
 /*
  * Even though we program the BPF filter should we trust it?
@@ -58,10 +60,21 @@ struct bpf {
 	const struct interface *bpf_ifp;
 	int bpf_fd;
 	unsigned int bpf_flags;
+	int (*bpf_filter)(const struct bpf *, const struct in_addr *);
+	struct in_addr bpf_addr;	/* given to bpf_filter */
 	void *bpf_buffer;
 	size_t bpf_size;
 	size_t bpf_len;
 	size_t bpf_pos;
+#ifdef __linux__
+	void *bpf_ring;		/* TPACKET_V3 receive ring */
+	size_t bpf_ringlen;
+	size_t bpf_blocklen;
+	unsigned int bpf_nblocks;
+	unsigned int bpf_block;	/* block being read */
+	unsigned int bpf_npkts;	/* frames left in it */
+	char *bpf_pkt;		/* next frame, NULL if we hold no block */
+#endif
 };
 
 extern const char *bpf_name;
@@ -72,9 +85,16 @@ int bpf_frame_bcast(const struct interface *, const void *);
 struct bpf * bpf_open(const struct interface *,
     int (*)(const struct bpf *, const struct in_addr *),
     const struct in_addr *);
+struct bpf * bpf_fdopen(const struct interface *, int, size_t);
 void bpf_close(struct bpf *);
+size_t bpf_memsize(const struct bpf *);
+size_t bpf_ringsize(void);
 int bpf_attach(int, void *, unsigned int);
+int bpf_lock(struct bpf *);
+int bpf_setfilter(struct bpf *, const struct in_addr *);
 ssize_t bpf_send(const struct bpf *, uint16_t, const void *, size_t);
+/* The frame is only valid until the next read. */
+ssize_t bpf_readframe(struct bpf *, const void **);
 ssize_t bpf_read(struct bpf *, void *, size_t);
 int bpf_arp(const struct bpf *, const struct in_addr *);
 int bpf_bootp(const struct bpf *, const struct in_addr *);
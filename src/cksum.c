@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cksum.h"
+
+/*
+ * RFC 1071 Internet checksum.
+ * The one's complement sum of 16-bit words is the same whichever
+ * byte order it's done in and is the sum of 32-bit words folded,
+ * so we add 32-bit words into 64 bits and fold once at the end.
+ * memcpy keeps the loads safe from alignment and gets optimised into
+ * plain loads. We don't need SIMD for DHCP sized packets.
+ * If isum is given, it carries a partial sum in and out, like
+ * in_cksum(pseudo header) then in_cksum(packet).
+ */
+uint16_t
+in_cksum(const void *data, size_t len, uint32_t *isum)
+{
+	const uint8_t *p = data;
+	uint64_t sum = isum != NULL ? *isum : 0;
+	uint32_t w[4];
+	uint16_t h;
+
+	for (; len >= sizeof(w); len -= sizeof(w), p += sizeof(w)) {
+		memcpy(w, p, sizeof(w));
+		sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+	}
+	for (; len >= sizeof(w[0]); len -= sizeof(w[0]), p += sizeof(w[0])) {
+		memcpy(w, p, sizeof(w[0]));
+		sum += w[0];
+	}
+	if (len >= sizeof(h)) {
+		memcpy(&h, p, sizeof(h));
+		sum += h;
+		len -= sizeof(h);
+		p += sizeof(h);
+	}
+	if (len == 1) {
+		/* Pad the odd byte with zero. */
+		h = 0;
+		memcpy(&h, p, 1);
+		sum += h;
+	}
+
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	if (isum != NULL)
+		*isum = (uint32_t)sum;
+
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+
+	return (uint16_t)~sum;
+}
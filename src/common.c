@@ -32,9 +32,11 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "dhcpcd.h"
@@ -137,6 +139,52 @@ writefile(const char *file, mode_t mode, const void *data, size_t len)
 	return bytes;
 }
 
+/*
+ * Write to a temporary file and rename it over the old one so that
+ * readers, or a crash, see either the old or the new contents.
+ * If mtime is not zero it is set on the new file.
+ */
+ssize_t
+writefile_atomic(const char *file, mode_t mode, const void *data, size_t len,
+    time_t mtime)
+{
+	char tmp[PATH_MAX];
+	int fd, serrno;
+	ssize_t bytes;
+
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.new", file) >= sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+	if (fd == -1)
+		return -1;
+	bytes = write(fd, data, len);
+	if (bytes != -1 && (size_t)bytes != len) {
+		errno = EIO;
+		bytes = -1;
+	}
+	if (bytes != -1 && mtime != 0) {
+		struct timespec ts[2] = {
+			{ .tv_nsec = UTIME_OMIT },
+			{ .tv_sec = mtime },
+		};
+
+		if (futimens(fd, ts) == -1)
+			bytes = -1;
+	}
+	if (bytes != -1 && fsync(fd) == -1)
+		bytes = -1;
+	close(fd);
+	if (bytes == -1 || rename(tmp, file) == -1) {
+		serrno = errno;
+		unlink(tmp);
+		errno = serrno;
+		return -1;
+	}
+	return bytes;
+}
+
 int
 filemtime(const char *file, time_t *time)
 {
@@ -68,6 +68,18 @@
 #define timespecclear(tsp)      (tsp)->tv_sec = (time_t)((tsp)->tv_nsec = 0L)
 #define timespecisset(tsp)      ((tsp)->tv_sec || (tsp)->tv_nsec)
 #endif
+#ifndef timespeccmp
+#define timespeccmp(tsp, usp, cmp)					\
+	(((tsp)->tv_sec == (usp)->tv_sec) ?				\
+	    ((tsp)->tv_nsec cmp (usp)->tv_nsec) :			\
+	    ((tsp)->tv_sec cmp (usp)->tv_sec))
+#endif
+
+/* POSIX.1-2008 names the stat(2) timespecs st_mtim and st_ctim. */
+#ifdef __APPLE__
+#define	st_mtim			st_mtimespec
+#define	st_ctim			st_ctimespec
+#endif
 
 #if __GNUC__ > 2 || defined(__INTEL_COMPILER)
 # ifndef __packed
@@ -151,6 +163,8 @@ const char *hwaddr_ntoa(const void *, size_t, char *, size_t);
 size_t hwaddr_aton(uint8_t *, const char *);
 ssize_t readfile(const char *, void *, size_t);
 ssize_t writefile(const char *, mode_t, const void *, size_t);
+ssize_t writefile_atomic(const char *, mode_t, const void *, size_t,
+    time_t);
 int filemtime(const char *, time_t *);
 char *get_line(char ** __restrict, ssize_t * __restrict);
 int is_root_local(void);
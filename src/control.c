@@ -31,8 +31,11 @@
 #include <sys/uio.h>
 #include <sys/un.h>
 
+#include <arpa/inet.h>
+
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -54,6 +57,7 @@
 #endif
 
 static void control_handle_data(void *, unsigned short);
+static void control_buf_free(struct fd_buf *);
 
 static void
 control_queue_free(struct fd_list *fd)
@@ -62,10 +66,12 @@ control_queue_free(struct fd_list *fd)
 
 	while ((fdp = TAILQ_FIRST(&fd->queue))) {
 		TAILQ_REMOVE(&fd->queue, fdp, next);
+		control_buf_free(fdp->data_buf);
 		if (fdp->data_size != 0)
 			free(fdp->data);
 		free(fdp);
 	}
+	fd->queue_len = fd->queue_bytes = 0;
 
 #ifdef CTL_FREE_LIST
 	while ((fdp = TAILQ_FIRST(&fd->free_queue))) {
@@ -90,6 +96,8 @@ control_free(struct fd_list *fd)
 	close(fd->fd);
 	TAILQ_REMOVE(&fd->ctx->control_fds, fd, next);
 	control_queue_free(fd);
+	free(fd->listen_ifnames);
+	free(fd->listen_reasons);
 	free(fd);
 }
 
@@ -136,23 +144,46 @@ control_handle_read(struct fd_list *fd)
 	control_recvdata(fd, buffer, (size_t)bytes);
 }
 
+static void
+control_dequeue(struct fd_list *fd, struct fd_data *data)
+{
+
+	TAILQ_REMOVE(&fd->queue, data, next);
+	fd->queue_len--;
+	fd->queue_bytes -= data->data_len;
+	control_buf_free(data->data_buf);
+	data->data_buf = NULL;
+#ifdef CTL_FREE_LIST
+	TAILQ_INSERT_TAIL(&fd->free_queue, data, next);
+#else
+	if (data->data_size != 0)
+		free(data->data);
+	free(data);
+#endif
+}
+
 static void
 control_handle_write(struct fd_list *fd)
 {
 	struct iovec iov[2];
 	int iov_len;
 	struct fd_data *data;
+	void *buf;
 
 	data = TAILQ_FIRST(&fd->queue);
+	if (data->data_buf != NULL)
+		buf = data->data_buf->fb_data;
+	else
+		buf = data->data;
 
 	if (data->data_flags & FD_SENDLEN) {
 		iov[0].iov_base = &data->data_len;
 		iov[0].iov_len = sizeof(size_t);
-		iov[1].iov_base = data->data;
+		iov[1].iov_base = buf;
 		iov[1].iov_len = data->data_len;
 		iov_len = 2;
 	} else {
-		iov[0].iov_base = data->data;
+		iov[0].iov_base = buf;
 		iov[0].iov_len = data->data_len;
 		iov_len = 1;
 	}
@@ -163,14 +194,7 @@ control_handle_write(struct fd_list *fd)
 		return;
 	}
 
-	TAILQ_REMOVE(&fd->queue, data, next);
-#ifdef CTL_FREE_LIST
-	TAILQ_INSERT_TAIL(&fd->free_queue, data, next);
-#else
-	if (data->data_size != 0)
-		free(data->data);
-	free(data);
-#endif
+	control_dequeue(fd, data);
 
 	if (TAILQ_FIRST(&fd->queue) != NULL)
 		return;
@@ -183,8 +207,8 @@ control_handle_write(struct fd_list *fd)
 #endif
 
 	/* Done sending data, stop watching write to fd */
-	if (eloop_event_add(fd->ctx->eloop, fd->fd, ELE_READ,
-	    control_handle_data, fd) == -1)
+	if (eloop_p_event_add(fd->ctx->eloop, ELOOP_PRIO_LOW, fd->fd,
+	    ELE_READ, control_handle_data, fd) == -1)
 		logerr("%s: eloop_event_add", __func__);
 }
 
@@ -274,6 +298,9 @@ control_new(struct dhcpcd_ctx *ctx, int fd, unsigned int flags)
 #ifdef CTL_FREE_LIST
 	TAILQ_INIT(&l->free_queue);
 #endif
+	l->queue_len = l->queue_bytes = 0;
+	l->listen_ifnames = NULL;
+	l->listen_reasons = NULL;
 	TAILQ_INSERT_TAIL(&ctx->control_fds, l, next);
 	return l;
 }
@@ -311,7 +338,7 @@ control_handle1(struct dhcpcd_ctx *ctx, int lfd, unsigned int fd_flags,
 	if (l == NULL)
 		goto error;
 
-	if (eloop_event_add(ctx->eloop, l->fd, ELE_READ,
+	if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_LOW, l->fd, ELE_READ,
 	    control_handle_data, l) == -1)
 		logerr("%s: eloop_event_add", __func__);
 	return;
@@ -444,13 +471,13 @@ control_start(struct dhcpcd_ctx *ctx, const char *ifname, sa_family_t family)
 		return -1;
 
 	ctx->control_fd = fd;
-	if (eloop_event_add(ctx->eloop, fd, ELE_READ,
+	if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_LOW, fd, ELE_READ,
 	    control_handle, ctx) == -1)
 		logerr("%s: eloop_event_add", __func__);
 
 	if ((fd = control_start1(ctx, ifname, family, S_UNPRIV)) != -1) {
 		ctx->control_unpriv_fd = fd;
-		if (eloop_event_add(ctx->eloop, fd, ELE_READ,
+		if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_LOW, fd, ELE_READ,
 		    control_handle_unpriv, ctx) == -1)
 			logerr("%s: eloop_event_add", __func__);
 	}
@@ -557,16 +584,10 @@ control_send(struct dhcpcd_ctx *ctx, int argc, char * const *argv)
 	return write(ctx->control_fd, buffer, len);
 }
 
-int
-control_queue(struct fd_list *fd, void *data, size_t data_len)
+static struct fd_data *
+control_getdata(struct fd_list *fd, size_t data_len)
 {
 	struct fd_data *d;
-	unsigned short events;
-
-	if (data_len == 0) {
-		errno = EINVAL;
-		return -1;
-	}
 
 #ifdef CTL_FREE_LIST
 	struct fd_data *df;
@@ -579,16 +600,49 @@ control_queue(struct fd_list *fd, void *data, size_t data_len)
 				break;
 		}
 	}
-	if (d != NULL)
+	if (d != NULL) {
 		TAILQ_REMOVE(&fd->free_queue, d, next);
-	else
+		return d;
+	}
+#else
+	UNUSED(fd);
+	UNUSED(data_len);
 #endif
-	{
-		d = calloc(1, sizeof(*d));
-		if (d == NULL)
-			return -1;
+
+	return calloc(1, sizeof(*d));
+}
+
+static int
+control_queuedata(struct fd_list *fd, struct fd_data *d,
+    unsigned int data_flags)
+{
+	unsigned short events;
+
+	d->data_flags = (fd->flags & FD_SENDLEN) | data_flags;
+	TAILQ_INSERT_TAIL(&fd->queue, d, next);
+	fd->queue_len++;
+	fd->queue_bytes += d->data_len;
+	events = ELE_WRITE;
+	if (fd->flags & FD_LISTEN)
+		events |= ELE_READ;
+	return eloop_p_event_add(fd->ctx->eloop, ELOOP_PRIO_LOW, fd->fd,
+	    events, control_handle_data, fd);
+}
+
+int
+control_queue(struct fd_list *fd, void *data, size_t data_len)
+{
+	struct fd_data *d;
+
+	if (data_len == 0) {
+		errno = EINVAL;
+		return -1;
 	}
 
+	d = control_getdata(fd, data_len);
+	if (d == NULL)
+		return -1;
+
 	if (d->data_size == 0)
 		d->data = NULL;
 	if (d->data_size < data_len) {
@@ -603,12 +657,317 @@ control_queue(struct fd_list *fd, void *data, size_t data_len)
 	}
 	memcpy(d->data, data, data_len);
 	d->data_len = data_len;
-	d->data_flags = fd->flags & FD_SENDLEN;
+	return control_queuedata(fd, d, 0);
+}
 
-	TAILQ_INSERT_TAIL(&fd->queue, d, next);
-	events = ELE_WRITE;
-	if (fd->flags & FD_LISTEN)
-		events |= ELE_READ;
-	return eloop_event_add(fd->ctx->eloop, fd->fd, events,
-	    control_handle_data, fd);
+/* The data follows the fd_buf and is filled in by the caller. */
+static struct fd_buf *
+control_buf_new(size_t len)
+{
+	struct fd_buf *fb;
+
+	fb = malloc(sizeof(*fb) + len);
+	if (fb == NULL)
+		return NULL;
+	fb->fb_refs = 1;
+	fb->fb_len = len;
+	fb->fb_data = fb + 1;
+	fb->fb_ifname[0] = '\0';
+	return fb;
+}
+
+static void
+control_buf_free(struct fd_buf *fb)
+{
+
+	if (fb != NULL && --fb->fb_refs == 0)
+		free(fb);
+}
+
+/* Queue fb without copying it; it's freed once the last queue is sent. */
+static int
+control_queue_buf(struct fd_list *fd, struct fd_buf *fb,
+    unsigned int data_flags)
+{
+	struct fd_data *d;
+
+	if (fb->fb_len == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	d = control_getdata(fd, 0);
+	if (d == NULL)
+		return -1;
+	fb->fb_refs++;
+	d->data_buf = fb;
+	d->data_len = fb->fb_len;
+	return control_queuedata(fd, d, data_flags);
+}
+
+
+/* Copy the strings, split on sep if set, into one NULL terminated list. */
+static char **
+control_strv(int argc, char **argv, int sep)
+{
+	size_t n = 0, len = 0;
+	char **strv, **sp, *p, *e;
+	int i;
+
+	for (i = 0; i < argc; i++) {
+		n++;
+		len += strlen(argv[i]) + 1;
+		if (sep == '\0')
+			continue;
+		for (p = argv[i]; (p = strchr(p, sep)) != NULL; p++)
+			n++;
+	}
+
+	strv = malloc(sizeof(*strv) * (n + 1) + len);
+	if (strv == NULL)
+		return NULL;
+	sp = strv;
+	p = (char *)(strv + n + 1);
+	for (i = 0; i < argc; i++) {
+		len = strlen(argv[i]) + 1;
+		memcpy(p, argv[i], len);
+		for (;;) {
+			if (sep != '\0' && (e = strchr(p, sep)) != NULL)
+				*e++ = '\0';
+			else
+				e = NULL;
+			if (*p != '\0')
+				*sp++ = p;
+			if (e == NULL)
+				break;
+			p = e;
+		}
+		p += strlen(p) + 1;
+	}
+	*sp = NULL;
+	return strv;
+}
+
+int
+control_listen(struct fd_list *fd, int argc, char **argv)
+{
+	char **ifnames = NULL, **reasons = NULL;
+	unsigned int flags = FD_LISTEN;
+	int i;
+
+	for (i = 0; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+		if (strcmp(argv[i], "--tlv") == 0)
+			flags |= FD_LISTEN_TLV;
+		else if (strncmp(argv[i], "--reasons=",
+		    strlen("--reasons=")) == 0)
+		{
+			char *r = argv[i] + strlen("--reasons=");
+
+			free(reasons);
+			reasons = control_strv(1, &r, ',');
+			if (reasons == NULL)
+				return -1;
+		} else {
+			free(reasons);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (i < argc) {
+		ifnames = control_strv(argc - i, argv + i, '\0');
+		if (ifnames == NULL) {
+			free(reasons);
+			return -1;
+		}
+	}
+
+	free(fd->listen_ifnames);
+	free(fd->listen_reasons);
+	fd->listen_ifnames = ifnames;
+	fd->listen_reasons = reasons;
+	fd->flags &= ~FD_LISTEN_TLV;
+	fd->flags |= flags;
+	return 0;
+}
+
+static const char *
+control_envget(const char *env, size_t len, const char *var)
+{
+	const char *ep = env + len;
+	size_t varlen = strlen(var);
+
+	for (; env < ep; env += strlen(env) + 1) {
+		if (strncmp(env, var, varlen) == 0)
+			return env + varlen;
+	}
+	return NULL;
+}
+
+static struct fd_buf *
+control_tlv_buf(const char *env, size_t len)
+{
+	static const struct {
+		const char *var;
+		uint16_t type;
+	} vars[] = {
+		{ "interface=", CONTROL_TLV_IFNAME },
+		{ "reason=", CONTROL_TLV_REASON },
+		{ "protocol=", CONTROL_TLV_PROTOCOL },
+	};
+	struct control_event ce = {
+		.ce_version = CONTROL_EVENT_VERSION,
+		.ce_type = CONTROL_EVENT_SCRIPT,
+	};
+	struct control_tlv ct;
+	const char *ep = env + len, *e, *v;
+	size_t i, vlen, tlen = 0;
+	struct fd_buf *fb;
+	char *bp;
+
+	/* Each string is at least two bytes so at most len / 2 TLVs. */
+	fb = control_buf_new(sizeof(ce) + len / 2 * sizeof(ct) + len);
+	if (fb == NULL)
+		return NULL;
+	bp = (char *)fb->fb_data + sizeof(ce);
+
+	for (e = env; e < ep; e += strlen(e) + 1) {
+		v = e;
+		ct.ct_type = htons(CONTROL_TLV_VAR);
+		for (i = 0; i < __arraycount(vars); i++) {
+			vlen = strlen(vars[i].var);
+			if (strncmp(e, vars[i].var, vlen) == 0) {
+				ct.ct_type = htons(vars[i].type);
+				v += vlen;
+				break;
+			}
+		}
+		vlen = strlen(v);
+		if (*e == '\0' || vlen > UINT16_MAX)
+			continue;
+		ct.ct_len = htons((uint16_t)vlen);
+		memcpy(bp, &ct, sizeof(ct));
+		bp += sizeof(ct);
+		memcpy(bp, v, vlen);
+		bp += vlen;
+		tlen += sizeof(ct) + vlen;
+	}
+
+	ce.ce_len = htonl((uint32_t)tlen);
+	memcpy(fb->fb_data, &ce, sizeof(ce));
+	fb->fb_len = sizeof(ce) + tlen;
+	return fb;
+}
+
+static bool
+control_queue_full(const struct fd_list *fd, size_t len)
+{
+
+	if (fd->ctx->control_queue_max == 0)
+		return false;
+	return fd->queue_len >= fd->ctx->control_queue_max ||
+	    fd->queue_bytes + len > CONTROL_QUEUE_BYTES;
+}
+
+/*
+ * Drop the events still queued for ifname as the new one has the
+ * latest state.
+ * The first one in the queue is left alone as it could be being sent.
+ */
+static void
+control_coalesce(struct fd_list *fd, const char *ifname)
+{
+	struct fd_data *d, *dn;
+
+	if (*ifname == '\0')
+		return;
+	d = TAILQ_FIRST(&fd->queue);
+	if (d == NULL)
+		return;
+	for (d = TAILQ_NEXT(d, next); d != NULL; d = dn) {
+		dn = TAILQ_NEXT(d, next);
+		if (d->data_buf == NULL ||
+		    strcmp(d->data_buf->fb_ifname, ifname) != 0)
+			continue;
+		control_dequeue(fd, d);
+		fd->ctx->control_coalesced++;
+	}
+}
+
+/*
+ * Returns 0 if the event was queued, 1 if the listener filtered it out
+ * or was disconnected for not reading what it was sent.
+ * Each format is built once and shared by every listener that wants it.
+ */
+int
+control_queue_event(struct fd_list *fd, struct fd_event *fe)
+{
+	const char *val;
+	char **sp;
+	struct fd_buf **fbp;
+
+	if (fd->listen_ifnames != NULL) {
+		val = control_envget(fe->fe_env, fe->fe_len, "interface=");
+		for (sp = fd->listen_ifnames; *sp != NULL; sp++) {
+			if (val != NULL && fnmatch(*sp, val, 0) == 0)
+				break;
+		}
+		if (*sp == NULL)
+			return 1;
+	}
+	if (fd->listen_reasons != NULL) {
+		val = control_envget(fe->fe_env, fe->fe_len, "reason=");
+		for (sp = fd->listen_reasons; *sp != NULL; sp++) {
+			if (val != NULL && strcmp(*sp, val) == 0)
+				break;
+		}
+		if (*sp == NULL)
+			return 1;
+	}
+
+	if (fd->flags & FD_LISTEN_TLV) {
+		fbp = &fe->fe_tlv_buf;
+		if (*fbp == NULL)
+			*fbp = control_tlv_buf(fe->fe_env, fe->fe_len);
+	} else {
+		fbp = &fe->fe_env_buf;
+		if (*fbp == NULL) {
+			*fbp = control_buf_new(fe->fe_len);
+			if (*fbp != NULL)
+				memcpy((*fbp)->fb_data, fe->fe_env, fe->fe_len);
+		}
+	}
+	if (*fbp == NULL)
+		return -1;
+	if ((*fbp)->fb_ifname[0] == '\0' &&
+	    (val = control_envget(fe->fe_env, fe->fe_len,
+	    "interface=")) != NULL)
+		strlcpy((*fbp)->fb_ifname, val, sizeof((*fbp)->fb_ifname));
+
+#ifdef PRIVSEP
+	/* The control proxy applies the limits to its own listeners. */
+	if (fd == fd->ctx->ps_control)
+		return control_queue_buf(fd, *fbp, fe->fe_flags);
+#endif
+
+	if (control_queue_full(fd, (*fbp)->fb_len)) {
+		control_coalesce(fd, (*fbp)->fb_ifname);
+		if (control_queue_full(fd, (*fbp)->fb_len)) {
+			logwarnx("control: disconnecting listener, "
+			    "%zu events queued", fd->queue_len);
+			fd->ctx->control_slow++;
+			control_free(fd);
+			return 1;
+		}
+	}
+
+	return control_queue_buf(fd, *fbp, fe->fe_flags);
+}
+
+void
+control_event_free(struct fd_event *fe)
+{
+
+	control_buf_free(fe->fe_env_buf);
+	control_buf_free(fe->fe_tlv_buf);
+	fe->fe_env_buf = fe->fe_tlv_buf = NULL;
 }
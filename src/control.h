@@ -30,6 +30,7 @@
 #define CONTROL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "dhcpcd.h"
 
@@ -39,8 +40,17 @@
 #undef	CTL_FREE_LIST
 #endif
 
-/* Limit queue size per fd */
+/* Limit queue size per listener, control_queue sets the events */
 #define CONTROL_QUEUE_MAX	100
+#define CONTROL_QUEUE_BYTES	(1024 * 1024)
+
+/* An event shared by the queues of all the listeners sent it. */
+struct fd_buf {
+	unsigned int fb_refs;
+	size_t fb_len;
+	void *fb_data;
+	char fb_ifname[IF_NAMESIZE];
+};
 
 struct fd_data {
 	TAILQ_ENTRY(fd_data) next;
@@ -48,6 +58,7 @@ struct fd_data {
 	size_t data_size;
 	size_t data_len;
 	unsigned int data_flags;
+	struct fd_buf *data_buf;	/* sent instead of data if set */
 };
 TAILQ_HEAD(fd_data_head, fd_data);
 
@@ -57,15 +68,56 @@ struct fd_list {
 	int fd;
 	unsigned int flags;
 	struct fd_data_head queue;
+	size_t queue_len;
+	size_t queue_bytes;
 #ifdef CTL_FREE_LIST
 	struct fd_data_head free_queue;
 #endif
+	char **listen_ifnames;
+	char **listen_reasons;
 };
 TAILQ_HEAD(fd_list_head, fd_list);
 
 #define	FD_LISTEN	0x01U
 #define	FD_UNPRIV	0x02U
 #define	FD_SENDLEN	0x04U
+#define	FD_LISTEN_TLV	0x08U
+
+/*
+ * --listen [--tlv] [--reasons=REASON,...] [interface ...]
+ * Listeners only get events for the matching interfaces and reasons.
+ * With --tlv each event is sent as a control_event header followed
+ * by TLVs instead of the NUL separated environment.
+ * Everything is in network byte order.
+ */
+#define	CONTROL_EVENT_VERSION	1
+#define	CONTROL_EVENT_SCRIPT	1
+
+struct control_event {
+	uint8_t ce_version;
+	uint8_t ce_type;
+	uint16_t ce_reserved;
+	uint32_t ce_len;		/* length of the TLVs that follow */
+};
+
+struct control_tlv {
+	uint16_t ct_type;
+	uint16_t ct_len;		/* length of the value that follows */
+};
+
+#define	CONTROL_TLV_IFNAME	1
+#define	CONTROL_TLV_REASON	2
+#define	CONTROL_TLV_PROTOCOL	3
+#define	CONTROL_TLV_VAR		4	/* name=value */
+
+/* One event being sent to many listeners, in each format asked for. */
+struct fd_event {
+	const char *fe_env;
+	size_t fe_len;
+	struct fd_buf *fe_env_buf;
+	struct fd_buf *fe_tlv_buf;
+	unsigned int fe_flags;		/* FD_SENDLEN if not set on the fds */
+};
 
 int control_start(struct dhcpcd_ctx *, const char *, sa_family_t);
 int control_stop(struct dhcpcd_ctx *);
@@ -75,5 +127,8 @@ struct fd_list *control_new(struct dhcpcd_ctx *, int, unsigned int);
 void control_free(struct fd_list *);
 void control_delete(struct fd_list *);
 int control_queue(struct fd_list *, void *, size_t);
+int control_listen(struct fd_list *, int, char **);
+int control_queue_event(struct fd_list *, struct fd_event *);
+void control_event_free(struct fd_event *);
 void control_recvdata(struct fd_list *fd, char *, size_t);
 #endif
@@ -41,6 +41,12 @@
 #ifndef SCRIPT
 # define SCRIPT			LIBEXECDIR "/" PACKAGE "-run-hooks"
 #endif
+#ifndef HOOKDIR
+# define HOOKDIR		LIBEXECDIR "/" PACKAGE "-hooks"
+#endif
+#ifndef DEFAULT_HOSTNAME
+# define DEFAULT_HOSTNAME	""
+#endif
 #ifndef DEVDIR
 # define DEVDIR			LIBDIR "/" PACKAGE "/dev"
 #endif
@@ -56,6 +62,9 @@
 #ifndef LEASEFILE6
 # define LEASEFILE6		LEASEFILE "6"
 #endif
+#ifndef IPV4LLFILE
+# define IPV4LLFILE		DBDIR "/%s%s.ipv4ll"
+#endif
 #ifndef PIDFILE
 # define PIDFILE		RUNDIR "/%s%s%spid"
 #endif
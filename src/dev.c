@@ -68,10 +68,21 @@ dev_listening(struct dhcpcd_ctx *ctx)
 	return ctx->dev->listening();
 }
 
+static void
+dev_freeadded(struct dhcpcd_ctx *ctx)
+{
+
+	while (ctx->dev_nadded != 0)
+		free(ctx->dev_added[--ctx->dev_nadded]);
+	free(ctx->dev_added);
+	ctx->dev_added = NULL;
+}
+
 static void
 dev_stop1(struct dhcpcd_ctx *ctx, int stop)
 {
 
+	dev_freeadded(ctx);
 	if (ctx->dev) {
 		if (stop)
 			logdebugx("dev: unloaded %s", ctx->dev->name);
@@ -166,6 +177,50 @@ dev_start1(struct dhcpcd_ctx *ctx, const struct dev_dhcpcd *dev_dhcpcd)
 	return r;
 }
 
+/*
+ * Interfaces the plugin adds are held until it has read all it can,
+ * so a coldplug of many interfaces is discovered in one pass.
+ * Anything else is passed on straight away.
+ */
+static int
+dev_handle_interface(void *arg, int action, const char *ifname)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	char **added;
+	int i;
+
+	for (i = 0; i < ctx->dev_nadded; i++) {
+		if (strcmp(ctx->dev_added[i], ifname) == 0)
+			break;
+	}
+
+	if (action == 1) {
+		if (i != ctx->dev_nadded)
+			return 1;
+		added = reallocarray(ctx->dev_added,
+		    (size_t)ctx->dev_nadded + 1, sizeof(*added));
+		if (added == NULL) {
+			logerr(__func__);
+			return -1;
+		}
+		ctx->dev_added = added;
+		if ((added[ctx->dev_nadded] = strdup(ifname)) == NULL) {
+			logerr(__func__);
+			return -1;
+		}
+		ctx->dev_nadded++;
+		return 1;
+	}
+
+	if (i != ctx->dev_nadded) {
+		free(ctx->dev_added[i]);
+		ctx->dev_nadded--;
+		memmove(&ctx->dev_added[i], &ctx->dev_added[i + 1],
+		    (size_t)(ctx->dev_nadded - i) * sizeof(*ctx->dev_added));
+	}
+	return ctx->dev_handler(ctx, action, ifname);
+}
+
 static void
 dev_handle_data(void *arg, unsigned short events)
 {
@@ -178,13 +233,21 @@ dev_handle_data(void *arg, unsigned short events)
 	if (ctx->dev->handle_device(arg) == -1) {
 		/* XXX: an error occured. should we restart dev? */
 	}
+
+	if (ctx->dev_nadded != 0) {
+		if (ctx->dev_addhandler(ctx, ctx->dev_nadded,
+		    ctx->dev_added) == -1)
+			logerr(__func__);
+		dev_freeadded(ctx);
+	}
 }
 
 int
-dev_start(struct dhcpcd_ctx *ctx, int (*handler)(void *, int, const char *))
+dev_start(struct dhcpcd_ctx *ctx, int (*handler)(void *, int, const char *),
+    int (*addhandler)(void *, int, char * const *))
 {
-	struct dev_dhcpcd dev_dhcpcd = {
-		.handle_interface = handler,
+	static const struct dev_dhcpcd dev_dhcpcd = {
+		.handle_interface = dev_handle_interface,
 	};
 
 	if (ctx->dev_fd != -1) {
@@ -192,6 +255,8 @@ dev_start(struct dhcpcd_ctx *ctx, int (*handler)(void *, int, const char *))
 		return ctx->dev_fd;
 	}
 
+	ctx->dev_handler = handler;
+	ctx->dev_addhandler = addhandler;
 	ctx->dev_fd = dev_start1(ctx, &dev_dhcpcd);
 	if (ctx->dev_fd != -1) {
 		if (eloop_event_add(ctx->eloop, ctx->dev_fd, ELE_READ,
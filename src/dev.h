@@ -49,7 +49,8 @@ int dev_init(struct dev *, const struct dev_dhcpcd *);
 #include "dhcpcd.h"
 int dev_initialised(struct dhcpcd_ctx *, const char *);
 int dev_listening(struct dhcpcd_ctx *);
-int dev_start(struct dhcpcd_ctx *, int (*)(void *, int, const char *));
+int dev_start(struct dhcpcd_ctx *, int (*)(void *, int, const char *),
+    int (*)(void *, int, char * const *));
 void dev_stop(struct dhcpcd_ctx *);
 #endif
 
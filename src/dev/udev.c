@@ -74,18 +74,14 @@ udev_initialised(const char *ifname)
 	return r;
 }
 
-static int
-udev_handle_device(void *ctx)
+/* Devices read from the monitor in one go, such as a coldplug burst */
+#define	UDEV_BATCH	1024
+
+static void
+udev_handle_device1(void *ctx, struct udev_device *device)
 {
-	struct udev_device *device;
 	const char *subsystem, *ifname, *action;
 
-	device = udev_monitor_receive_device(monitor);
-	if (device == NULL) {
-		logerrx("libudev: received NULL device");
-		return -1;
-	}
-
 	subsystem = udev_device_get_subsystem(device);
 	ifname = udev_device_get_sysname(device);
 	action = udev_device_get_action(device);
@@ -100,6 +96,25 @@ udev_handle_device(void *ctx)
 	}
 
 	udev_device_unref(device);
+}
+
+static int
+udev_handle_device(void *ctx)
+{
+	struct udev_device *device;
+	int n;
+
+	/* The monitor does not block, so read all that is waiting. */
+	for (n = 0; n < UDEV_BATCH; n++) {
+		device = udev_monitor_receive_device(monitor);
+		if (device == NULL)
+			break;
+		udev_handle_device1(ctx, device);
+	}
+	if (n == 0) {
+		logerrx("libudev: received NULL device");
+		return -1;
+	}
 	return 1;
 }
 
@@ -32,6 +32,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -41,8 +42,10 @@
 #include "common.h"
 #include "dhcp-common.h"
 #include "dhcp.h"
+#include "eloop.h"
 #include "if.h"
 #include "ipv6.h"
+#include "leasedb.h"
 #include "logerr.h"
 #include "script.h"
 
@@ -157,6 +160,44 @@ vivso_find(uint32_t iana_en, const void *arg)
 	return NULL;
 }
 
+/*
+ * Map option codes directly to their definitions.
+ * Codes are at most 16 bits, so the map is small.
+ * If memory runs out the map is empty and nothing is found.
+ */
+void
+dhcp_optmap_build(struct dhcp_optmap *om, struct dhcp_opt *opts, size_t len)
+{
+	struct dhcp_opt *opt;
+	size_t i, n = 0;
+
+	dhcp_optmap_free(om);
+	for (i = 0, opt = opts; i < len; i++, opt++) {
+		if (opt->option >= n)
+			n = (size_t)opt->option + 1;
+	}
+	if (n == 0 || n > UINT16_MAX + 1)
+		return;
+	if ((om->om_opts = calloc(n, sizeof(*om->om_opts))) == NULL) {
+		logerr(__func__);
+		return;
+	}
+	om->om_len = n;
+	for (i = 0, opt = opts; i < len; i++, opt++) {
+		if (om->om_opts[opt->option] == NULL)
+			om->om_opts[opt->option] = opt;
+	}
+}
+
+void
+dhcp_optmap_free(struct dhcp_optmap *om)
+{
+
+	free(om->om_opts);
+	om->om_opts = NULL;
+	om->om_len = 0;
+}
+
 ssize_t
 dhcp_vendor(char *str, size_t len)
 {
@@ -780,11 +821,24 @@ err:
 	return -1;
 }
 
+/* The SSID part of a per interface file name, empty unless wireless. */
+void
+dhcp_set_ssidfile(char *ssid, size_t len, const struct interface *ifp)
+{
+
+	if (ifp->wireless) {
+		ssid[0] = '-';
+		print_string(ssid + 1, len - 1, OT_ESCFILE,
+		    (const uint8_t *)ifp->ssid, ifp->ssid_len);
+	} else
+		ssid[0] = '\0';
+}
+
 int
 dhcp_set_leasefile(char *leasefile, size_t len, int family,
     const struct interface *ifp)
 {
-	char ssid[1 + (IF_SSIDLEN * 4) + 1]; /* - prefix and NUL terminated. */
+	char ssid[DHCP_SSIDFILE_LEN];
 
 	if (ifp->name[0] == '\0') {
 		strlcpy(leasefile, ifp->ctx->pidfile, len);
@@ -800,13 +854,7 @@ dhcp_set_leasefile(char *leasefile, size_t len, int family,
 		return -1;
 	}
 
-	if (ifp->wireless) {
-		ssid[0] = '-';
-		print_string(ssid + 1, sizeof(ssid) - 1,
-		    OT_ESCFILE,
-		    (const uint8_t *)ifp->ssid, ifp->ssid_len);
-	} else
-		ssid[0] = '\0';
+	dhcp_set_ssidfile(ssid, sizeof(ssid), ifp);
 	return snprintf(leasefile, len,
 	    family == AF_INET ? LEASEFILE : LEASEFILE6,
 	    ifp->name, ssid);
@@ -945,21 +993,241 @@ dhcp_zero_index(struct dhcp_opt *opt)
 		dhcp_zero_index(o);
 }
 
+/*
+ * Lease files are written on every bind and renewal.
+ * When lease_write_delay is set, each write is held back for up to that
+ * many seconds so a later write to the same file replaces it.
+ * Everything held back is then written together, through privsep in
+ * one message, each file replaced atomically.
+ */
+struct dhcp_lease_file {
+	rb_node_t dlf_tree;
+	char *dlf_path;
+	mode_t dlf_mode;
+	time_t dlf_mtime;
+	void *dlf_data;
+	size_t dlf_len;
+};
+
+static int
+dhcp_cmpleasefile(__unused void *context, const void *node, const void *key)
+{
+	const struct dhcp_lease_file *dlf = node;
+
+	return strcmp(dlf->dlf_path, key);
+}
+
+static int
+dhcp_cmpleasefilenode(void *context, const void *node1, const void *node2)
+{
+	const struct dhcp_lease_file *dlf2 = node2;
+
+	return dhcp_cmpleasefile(context, node1, dlf2->dlf_path);
+}
+
+static const rb_tree_ops_t dhcp_lease_file_ops = {
+	.rbto_compare_nodes = dhcp_cmpleasefilenode,
+	.rbto_compare_key = dhcp_cmpleasefile,
+	.rbto_node_offset = offsetof(struct dhcp_lease_file, dlf_tree),
+	.rbto_context = NULL
+};
+
+void
+dhcp_initleases(struct dhcpcd_ctx *ctx)
+{
+
+	rb_tree_init(&ctx->leases, &dhcp_lease_file_ops);
+}
+
+static void
+dhcp_freeleasefile(struct dhcpcd_ctx *ctx, struct dhcp_lease_file *dlf)
+{
+
+	rb_tree_remove_node(&ctx->leases, dlf);
+	free(dlf->dlf_path);
+	free(dlf->dlf_data);
+	free(dlf);
+}
+
+static ssize_t
+dhcp_writefile_atomic(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
+    const void *data, size_t len, time_t mtime)
+{
+
+#ifdef PRIVSEP
+	if (ctx->options & DHCPCD_PRIVSEP &&
+	    !(ctx->options & DHCPCD_PRIVSEPROOT))
+		return ps_root_writefile_atomic(ctx, file, mode,
+		    data, len, mtime);
+#endif
+
+	if (leasedb_match(ctx, file))
+		return leasedb_write(ctx, file, data, len, mtime);
+	return writefile_atomic(file, mode, data, len, mtime);
+}
+
+#ifdef PRIVSEP
+/* Batch results come back in the order the files were written. */
+struct dhcp_flushlease {
+	struct dhcpcd_ctx *ctx;
+	struct dhcp_lease_file *dlf;
+};
+
+static void
+dhcp_flushleasecb(void *arg, ssize_t result)
+{
+	struct dhcp_flushlease *dfl = arg;
+
+	if (dfl->dlf == NULL)
+		return;
+	if (result == -1)
+		logerr("%s: %s", __func__, dfl->dlf->dlf_path);
+	dfl->dlf = rb_tree_iterate(&dfl->ctx->leases, dfl->dlf, RB_DIR_RIGHT);
+}
+#endif
+
+void
+dhcp_flushleases(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct dhcp_lease_file *dlf;
+#ifdef PRIVSEP
+	struct dhcp_flushlease dfl = { .ctx = ctx };
+	bool batch = false;
+#endif
+
+	eloop_timeout_delete(ctx->eloop, dhcp_flushleases, ctx);
+	if (RB_TREE_MIN(&ctx->leases) == NULL)
+		return;
+
+#ifdef PRIVSEP
+	if (IN_PRIVSEP_SE(ctx)) {
+		dfl.dlf = RB_TREE_MIN(&ctx->leases);
+		if (ps_root_batch_start(ctx, dhcp_flushleasecb, &dfl) == -1)
+			logerr("%s: ps_root_batch_start", __func__);
+		else
+			batch = true;
+	}
+#endif
+
+	RB_TREE_FOREACH(dlf, &ctx->leases) {
+		if (dhcp_writefile_atomic(ctx, dlf->dlf_path, dlf->dlf_mode,
+		    dlf->dlf_data, dlf->dlf_len, dlf->dlf_mtime) == -1)
+			logerr("%s: %s", __func__, dlf->dlf_path);
+	}
+
+#ifdef PRIVSEP
+	if (batch && ps_root_batch_end(ctx) == -1)
+		logerr("%s: ps_root_batch_end", __func__);
+#endif
+
+	while ((dlf = RB_TREE_MIN(&ctx->leases)) != NULL)
+		dhcp_freeleasefile(ctx, dlf);
+}
+
+ssize_t
+dhcp_writelease(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
+    const void *data, size_t len)
+{
+	struct dhcp_lease_file *dlf;
+	void *ndata;
+
+	if (ctx->lease_write_delay == 0)
+		return dhcp_writefile_atomic(ctx, file, mode, data, len, 0);
+
+	if ((ndata = malloc(len)) == NULL)
+		return -1;
+	memcpy(ndata, data, len);
+
+	dlf = rb_tree_find_node(&ctx->leases, file);
+	if (dlf == NULL) {
+		dlf = malloc(sizeof(*dlf));
+		if (dlf == NULL || (dlf->dlf_path = strdup(file)) == NULL) {
+			free(dlf);
+			free(ndata);
+			return -1;
+		}
+		dlf->dlf_data = NULL;
+		if (RB_TREE_MIN(&ctx->leases) == NULL)
+			eloop_timeout_add_sec(ctx->eloop,
+			    ctx->lease_write_delay, dhcp_flushleases, ctx);
+		rb_tree_insert_node(&ctx->leases, dlf);
+	}
+	free(dlf->dlf_data);
+	dlf->dlf_data = ndata;
+	dlf->dlf_len = len;
+	dlf->dlf_mode = mode;
+	dlf->dlf_mtime = time(NULL);
+	return (ssize_t)len;
+}
+
 ssize_t
 dhcp_readfile(struct dhcpcd_ctx *ctx, const char *file, void *data, size_t len)
 {
+	struct dhcp_lease_file *dlf;
+
+	dlf = rb_tree_find_node(&ctx->leases, file);
+	if (dlf != NULL) {
+		/* Fail as readfile does rather than truncate. */
+		if (dlf->dlf_len >= len) {
+			errno = ENOBUFS;
+			return -1;
+		}
+		len = dlf->dlf_len;
+		memcpy(data, dlf->dlf_data, len);
+		return (ssize_t)len;
+	}
 
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP &&
 	    !(ctx->options & DHCPCD_PRIVSEPROOT))
 		return ps_root_readfile(ctx, file, data, len);
-#else
-	UNUSED(ctx);
 #endif
 
+	if (leasedb_match(ctx, file))
+		return leasedb_read(ctx, file, data, len);
 	return readfile(file, data, len);
 }
 
+/* A lease and its mtime in one go, one round trip under privsep. */
+ssize_t
+dhcp_readlease(struct dhcpcd_ctx *ctx, const char *file, void *data,
+    size_t len, time_t *mtime)
+{
+	struct dhcp_lease_file *dlf;
+	ssize_t bytes;
+
+	dlf = rb_tree_find_node(&ctx->leases, file);
+	if (dlf != NULL) {
+		/* Fail as readfile does rather than truncate. */
+		if (dlf->dlf_len >= len) {
+			errno = ENOBUFS;
+			return -1;
+		}
+		len = dlf->dlf_len;
+		memcpy(data, dlf->dlf_data, len);
+		*mtime = dlf->dlf_mtime;
+		return (ssize_t)len;
+	}
+
+#ifdef PRIVSEP
+	if (ctx->options & DHCPCD_PRIVSEP &&
+	    !(ctx->options & DHCPCD_PRIVSEPROOT))
+		return ps_root_readlease(ctx, file, data, len, mtime);
+#endif
+
+	if (leasedb_match(ctx, file)) {
+		bytes = leasedb_read(ctx, file, data, len);
+		if (bytes != -1 && leasedb_mtime(ctx, file, mtime) == -1)
+			return -1;
+		return bytes;
+	}
+	bytes = readfile(file, data, len);
+	if (bytes != -1 && filemtime(file, mtime) == -1)
+		return -1;
+	return bytes;
+}
+
 ssize_t
 dhcp_writefile(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
     const void *data, size_t len)
@@ -979,30 +1247,43 @@ dhcp_writefile(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
 int
 dhcp_filemtime(struct dhcpcd_ctx *ctx, const char *file, time_t *time)
 {
+	struct dhcp_lease_file *dlf;
+
+	dlf = rb_tree_find_node(&ctx->leases, file);
+	if (dlf != NULL) {
+		*time = dlf->dlf_mtime;
+		return 0;
+	}
 
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP &&
 	    !(ctx->options & DHCPCD_PRIVSEPROOT))
 		return (int)ps_root_filemtime(ctx, file, time);
-#else
-	UNUSED(ctx);
 #endif
 
+	if (leasedb_match(ctx, file))
+		return leasedb_mtime(ctx, file, time);
 	return filemtime(file, time);
 }
 
 int
 dhcp_unlink(struct dhcpcd_ctx *ctx, const char *file)
 {
+	struct dhcp_lease_file *dlf;
+
+	/* Don't write it back later. */
+	dlf = rb_tree_find_node(&ctx->leases, file);
+	if (dlf != NULL)
+		dhcp_freeleasefile(ctx, dlf);
 
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP &&
 	    !(ctx->options & DHCPCD_PRIVSEPROOT))
 		return (int)ps_root_unlink(ctx, file);
-#else
-	UNUSED(ctx);
 #endif
 
+	if (leasedb_match(ctx, file))
+		return leasedb_unlink(ctx, file);
 	return unlink(file);
 }
 
@@ -110,6 +110,16 @@ struct dhcp_opt {
 
 const char *dhcp_get_hostname(char *, size_t, const struct if_options *);
 struct dhcp_opt *vivso_find(uint32_t, const void *);
+void dhcp_optmap_build(struct dhcp_optmap *, struct dhcp_opt *, size_t);
+void dhcp_optmap_free(struct dhcp_optmap *);
+
+/* The first definition of a code, as a scan of the array would find. */
+static inline struct dhcp_opt *
+dhcp_optmap_find(const struct dhcp_optmap *om, unsigned int code)
+{
+
+	return code < om->om_len ? om->om_opts[code] : NULL;
+}
 
 ssize_t dhcp_vendor(char *, size_t);
 
@@ -118,8 +128,15 @@ void dhcp_print_option_encoding(const struct dhcp_opt *opt, int cols);
 	((var)[(val) >> 3] = (uint8_t)((var)[(val) >> 3] | 1 << ((val) & 7)))
 #define	del_option_mask(var, val) \
 	((var)[(val) >> 3] = (uint8_t)((var)[(val) >> 3] & ~(1 << ((val) & 7))))
-#define	has_option_mask(var, val) \
-	((var)[(val) >> 3] & (uint8_t)(1 << ((val) & 7)))
+
+/* The mask may be NULL, as DHCPv6 masks are only allocated when used. */
+static inline bool
+has_option_mask(const uint8_t *mask, unsigned int val)
+{
+
+	return mask != NULL && mask[val >> 3] & (uint8_t)(1 << (val & 7));
+}
+
 int make_option_mask(const struct dhcp_opt *, size_t,
     const struct dhcp_opt *, size_t,
     uint8_t *, const char *, int);
@@ -127,6 +144,9 @@ int make_option_mask(const struct dhcp_opt *, size_t,
 size_t encode_rfc1035(const char *src, uint8_t *dst);
 ssize_t decode_rfc1035(char *, size_t, const uint8_t *, size_t);
 ssize_t print_string(char *, size_t, int, const uint8_t *, size_t);
+/* - prefix and NUL terminated. */
+#define	DHCP_SSIDFILE_LEN	(1 + (IF_SSIDLEN * 4) + 1)
+void dhcp_set_ssidfile(char *, size_t, const struct interface *);
 int dhcp_set_leasefile(char *, size_t, int, const struct interface *);
 
 void dhcp_envoption(struct dhcpcd_ctx *,
@@ -138,9 +158,15 @@ void dhcp_envoption(struct dhcpcd_ctx *,
 void dhcp_zero_index(struct dhcp_opt *);
 
 ssize_t dhcp_readfile(struct dhcpcd_ctx *, const char *, void *, size_t);
+ssize_t dhcp_readlease(struct dhcpcd_ctx *, const char *, void *, size_t,
+    time_t *);
 ssize_t dhcp_writefile(struct dhcpcd_ctx *, const char *, mode_t,
     const void *, size_t);
 int dhcp_filemtime(struct dhcpcd_ctx *, const char *, time_t *);
 int dhcp_unlink(struct dhcpcd_ctx *, const char *);
+void dhcp_initleases(struct dhcpcd_ctx *);
+ssize_t dhcp_writelease(struct dhcpcd_ctx *, const char *, mode_t,
+    const void *, size_t);
+void dhcp_flushleases(void *);
 size_t dhcp_read_hwaddr_aton(struct dhcpcd_ctx *, uint8_t **, const char *);
 #endif
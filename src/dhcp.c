@@ -61,17 +61,21 @@
 #include "config.h"
 #include "arp.h"
 #include "bpf.h"
+#include "cksum.h"
 #include "common.h"
 #include "dhcp.h"
 #include "dhcpcd.h"
 #include "dhcp-common.h"
 #include "duid.h"
 #include "eloop.h"
+#include "handoff.h"
 #include "if.h"
 #include "ipv4.h"
 #include "ipv4ll.h"
 #include "logerr.h"
+#include "pace.h"
 #include "privsep.h"
+#include "probe.h"
 #include "sa.h"
 #include "script.h"
 
@@ -132,6 +136,7 @@ static const char * const dhcp_params[] = {
 
 static int dhcp_openbpf(struct interface *);
 static void dhcp_start1(void *);
+static void dhcp_unbind(struct interface *, const char *);
 #if defined(ARP) && (!defined(KERNEL_RFC5227) || defined(ARPING))
 static void dhcp_arp_found(struct arp_state *, const struct arp_msg *);
 #endif
@@ -167,6 +172,183 @@ dhcp_printoptions(const struct dhcpcd_ctx *ctx,
 	}
 }
 
+/*
+ * dhcp_env and get_lease look up dozens of options in one message,
+ * so they index where each one is first.
+ * The index is only used between dhcp_indexoptions and
+ * dhcp_unindexoptions and only for that message, otherwise
+ * get_option walks the options as normal.
+ */
+struct dhcp_optent {
+	uint16_t off;		/* option data from the start of bootp */
+	uint8_t len;
+	uint16_t next;		/* 1 + next part of a split option */
+};
+
+struct dhcp_optindex {
+	const struct bootp *bootp;
+	size_t bootp_len;
+	int error;		/* errno for every lookup */
+	uint16_t first[UINT8_MAX + 1];	/* 1 + first part, 0 if none */
+	uint16_t last[UINT8_MAX + 1];
+	size_t len[UINT8_MAX + 1];	/* length of all parts */
+	struct dhcp_optent *ent;
+	size_t nent;
+	size_t ent_len;
+};
+
+static int
+dhcp_indexoption(struct dhcp_optindex *oi, const struct bootp *bootp,
+    uint8_t o, const uint8_t *p, uint8_t l)
+{
+	struct dhcp_optent *ent;
+
+	if (oi->nent == oi->ent_len) {
+		size_t n = oi->ent_len == 0 ? 64 : oi->ent_len * 2;
+
+		ent = realloc(oi->ent, n * sizeof(*ent));
+		if (ent == NULL)
+			return -1;
+		oi->ent = ent;
+		oi->ent_len = n;
+	}
+	ent = &oi->ent[oi->nent++];
+	ent->off = (uint16_t)(p - (const uint8_t *)bootp);
+	ent->len = l;
+	ent->next = 0;
+	if (oi->first[o] == 0)
+		oi->first[o] = (uint16_t)oi->nent;
+	else
+		oi->ent[oi->last[o] - 1].next = (uint16_t)oi->nent;
+	oi->last[o] = (uint16_t)oi->nent;
+	oi->len[o] += l;
+	return 0;
+}
+
+/* This walks the options just as get_option does. */
+static void
+dhcp_indexoptions(struct dhcpcd_ctx *ctx,
+    const struct bootp *bootp, size_t bootp_len)
+{
+	struct dhcp_optindex *oi = ctx->opt_index;
+	const uint8_t *p, *e;
+	uint8_t l, o, overl;
+
+	if (oi == NULL) {
+		oi = ctx->opt_index = calloc(1, sizeof(*oi));
+		if (oi == NULL) {
+			logerr(__func__);
+			return;
+		}
+	}
+	oi->bootp = NULL;
+	/* Offsets are 16 bits. */
+	if (bootp == NULL || bootp_len > UINT16_MAX)
+		return;
+
+	memset(oi->first, 0, sizeof(oi->first));
+	memset(oi->len, 0, sizeof(oi->len));
+	oi->nent = 0;
+	oi->error = 0;
+	if (bootp_len < DHCP_MIN_LEN) {
+		oi->error = EINVAL;
+		goto out;
+	}
+	if (!IS_DHCP(bootp)) {
+		oi->error = ENOTSUP;
+		goto out;
+	}
+
+	p = bootp->vend + 4; /* options after the 4 byte cookie */
+	e = (const uint8_t *)bootp + bootp_len;
+	overl = 0;
+	while (p < e) {
+		o = *p++;
+		switch (o) {
+		case DHO_PAD:
+			continue;
+		case DHO_END:
+			if (overl & 1) {
+				overl = (uint8_t)(overl & ~1);
+				p = bootp->file;
+				e = p + sizeof(bootp->file);
+			} else if (overl & 2) {
+				overl = (uint8_t)(overl & ~2);
+				p = bootp->sname;
+				e = p + sizeof(bootp->sname);
+			} else
+				goto out;
+			continue;
+		}
+
+		if (p == e || p + 1 + *p > e) {
+			oi->error = EINVAL;
+			goto out;
+		}
+		l = *p++;
+		if (o == DHO_OPTSOVERLOADED && l == 1 && !overl)
+			overl = 0x80 | p[0];
+		if (dhcp_indexoption(oi, bootp, o, p, l) == -1) {
+			logerr(__func__);
+			return;
+		}
+		p += l;
+	}
+
+out:
+	oi->bootp = bootp;
+	oi->bootp_len = bootp_len;
+}
+
+static void
+dhcp_unindexoptions(struct dhcpcd_ctx *ctx)
+{
+
+	if (ctx->opt_index != NULL)
+		ctx->opt_index->bootp = NULL;
+}
+
+static const uint8_t *
+get_option_index(struct dhcpcd_ctx *ctx, const struct dhcp_optindex *oi,
+    unsigned int opt, size_t *opt_len)
+{
+	const struct dhcp_optent *ent;
+	uint8_t *bp;
+
+	if (oi->error != 0) {
+		errno = oi->error;
+		return NULL;
+	}
+	if (opt > UINT8_MAX || oi->first[opt] == 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	ent = &oi->ent[oi->first[opt] - 1];
+	if (opt_len)
+		*opt_len = oi->len[opt];
+	if (ent->next == 0)
+		return (const uint8_t *)oi->bootp + ent->off;
+
+	/* We must concatonate the options. */
+	if (oi->len[opt] > ctx->opt_buffer_len) {
+		bp = realloc(ctx->opt_buffer, oi->len[opt]);
+		if (bp == NULL)
+			return NULL;
+		ctx->opt_buffer = bp;
+		ctx->opt_buffer_len = oi->len[opt];
+	}
+	bp = ctx->opt_buffer;
+	for (;;) {
+		memcpy(bp, (const uint8_t *)oi->bootp + ent->off, ent->len);
+		bp += ent->len;
+		if (ent->next == 0)
+			break;
+		ent = &oi->ent[ent->next - 1];
+	}
+	return (const uint8_t *)ctx->opt_buffer;
+}
+
 static const uint8_t *
 get_option(struct dhcpcd_ctx *ctx,
     const struct bootp *bootp, size_t bootp_len,
@@ -177,6 +359,11 @@ get_option(struct dhcpcd_ctx *ctx,
 	const uint8_t *op;
 	size_t bl;
 
+	if (bootp != NULL && ctx->opt_index != NULL &&
+	    ctx->opt_index->bootp == bootp &&
+	    ctx->opt_index->bootp_len == bootp_len)
+		return get_option_index(ctx, ctx->opt_index, opt, opt_len);
+
 	if (bootp == NULL || bootp_len < DHCP_MIN_LEN) {
 		errno = EINVAL;
 		return NULL;
@@ -733,52 +920,156 @@ dhcp_message_add_addr(struct bootp *bootp,
 	return 0;
 }
 
+/* The parameter request list only changes with the options,
+ * so build it once and rebuild it when dhcp_init is called again. */
+static void
+dhcp_makeprl(struct interface *ifp)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+	const struct if_options *ifo = ifp->options;
+	const struct dhcp_opt *opt;
+	uint8_t *p, *lp, *e;
+	size_t i;
+
+	p = state->prl;
+	e = p + sizeof(state->prl);
+	for (i = 0, opt = ifp->ctx->dhcp_opts;
+	    i < ifp->ctx->dhcp_opts_len && p < e;
+	    i++, opt++)
+	{
+		if (!DHC_REQOPT(opt, ifo->requestmask, ifo->nomask))
+			continue;
+		*p++ = (uint8_t)opt->option;
+	}
+	for (i = 0, opt = ifo->dhcp_override;
+	    i < ifo->dhcp_override_len && p < e;
+	    i++, opt++)
+	{
+		/* Check if added above */
+		for (lp = state->prl; lp < p; lp++)
+			if (*lp == (uint8_t)opt->option)
+				break;
+		if (lp < p)
+			continue;
+		if (!DHC_REQOPT(opt, ifo->requestmask, ifo->nomask))
+			continue;
+		*p++ = (uint8_t)opt->option;
+	}
+	state->prl_len = (size_t)(p - state->prl);
+	state->prl_valid = true;
+}
+
+/* Returns the transmit buffer, growing it to hold len bytes of BOOTP. */
+static struct bootp *
+dhcp_txbuf(struct interface *ifp, size_t len)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+	struct bootp_pkt *pkt;
+
+	if (len < sizeof(struct bootp))
+		len = sizeof(struct bootp);
+	if (len > state->txbuf_len) {
+		pkt = realloc(state->txbuf,
+		    offsetof(struct bootp_pkt, bootp) + len);
+		if (pkt == NULL)
+			return NULL;
+		state->txbuf = pkt;
+		state->txbuf_len = len;
+	}
+	memset(&state->txbuf->bootp, 0, len);
+	return &state->txbuf->bootp;
+}
+
+static uint16_t
+dhcp_secs(const struct dhcp_state *state)
+{
+	struct timespec tv;
+	unsigned long long secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+	secs = eloop_timespec_diff(&tv, &state->started, NULL);
+	if (secs > UINT16_MAX)
+		return htons((uint16_t)UINT16_MAX);
+	return htons((uint16_t)secs);
+}
+
+/* The address we already have, if the message may claim it. */
+static in_addr_t
+dhcp_ciaddr(const struct interface *ifp, uint8_t type)
+{
+	const struct dhcp_state *state = D_CSTATE(ifp);
+
+	if (state->addr != NULL &&
+	    (type == DHCP_INFORM || type == DHCP_RELEASE ||
+	    (type == DHCP_REQUEST &&
+	    state->addr->mask.s_addr == state->lease.mask.s_addr &&
+	    (state->new == NULL || IS_DHCP(state->new)) &&
+	    !(state->added & (STATE_FAKE | STATE_EXPIRED)))))
+		return state->addr->addr.s_addr;
+	return INADDR_ANY;
+}
+
+/* Does the message ask for the leased address? */
+static bool
+dhcp_putip(const struct interface *ifp, uint8_t type)
+{
+	const struct dhcp_state *state = D_CSTATE(ifp);
+	const struct dhcp_lease *lease = &state->lease;
+
+	if (lease->addr.s_addr == INADDR_ANY ||
+	    lease->cookie != htonl(MAGIC_COOKIE))
+		return false;
+	return type == DHCP_DECLINE ||
+	    (type == DHCP_REQUEST &&
+	    (state->addr == NULL ||
+	    state->added & (STATE_FAKE | STATE_EXPIRED) ||
+	    lease->addr.s_addr != state->addr->addr.s_addr));
+}
+
+/* Does the message name the server of the lease? */
+static bool
+dhcp_putserver(const struct interface *ifp, uint8_t type)
+{
+	const struct dhcp_lease *lease = &D_CSTATE(ifp)->lease;
+
+	if (lease->server.s_addr == INADDR_ANY)
+		return false;
+	return dhcp_putip(ifp, type) ||
+	    (type == DHCP_RELEASE && lease->addr.s_addr != INADDR_ANY &&
+	    lease->cookie == htonl(MAGIC_COOKIE));
+}
+
 static ssize_t
-make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
+make_message1(struct bootp **bootpm, struct interface *ifp, uint8_t type,
+    int mtu)
 {
 	struct bootp *bootp;
 	uint8_t *lp, *p, *e;
-	uint8_t *n_params = NULL;
 	uint32_t ul;
 	uint16_t sz;
 	size_t len, i;
-	const struct dhcp_opt *opt;
 	struct if_options *ifo = ifp->options;
-	const struct dhcp_state *state = D_CSTATE(ifp);
+	struct dhcp_state *state = D_STATE(ifp);
 	const struct dhcp_lease *lease = &state->lease;
 	char hbuf[HOSTNAME_MAX_LEN + 1];
 	const char *hostname;
 	const struct vivco *vivco;
-	int mtu;
 #ifdef AUTH
 	uint8_t *auth, auth_len;
 #endif
 
-	if ((mtu = if_getmtu(ifp)) == -1)
-		logerr("%s: if_getmtu", ifp->name);
-	else if (mtu < MTU_MIN) {
-		if (if_setmtu(ifp, MTU_MIN) == -1)
-			logerr("%s: if_setmtu", ifp->name);
-		mtu = MTU_MIN;
-	}
-
 	if (ifo->options & DHCPCD_BOOTP)
-		bootp = calloc(1, sizeof (*bootp));
+		len = sizeof(*bootp);
 	else
 		/* Make the maximal message we could send */
-		bootp = calloc(1, (size_t)(mtu - IP_UDP_SIZE));
+		len = (size_t)((mtu == -1 ? MTU_MIN : mtu) - IP_UDP_SIZE);
+	bootp = dhcp_txbuf(ifp, len);
 
 	if (bootp == NULL)
 		return -1;
 	*bootpm = bootp;
 
-	if (state->addr != NULL &&
-	    (type == DHCP_INFORM || type == DHCP_RELEASE ||
-	    (type == DHCP_REQUEST &&
-	    state->addr->mask.s_addr == lease->mask.s_addr &&
-	    (state->new == NULL || IS_DHCP(state->new)) &&
-	    !(state->added & (STATE_FAKE | STATE_EXPIRED)))))
-		bootp->ciaddr = state->addr->addr.s_addr;
+	bootp->ciaddr = dhcp_ciaddr(ifp, type);
 
 	bootp->op = BOOTREQUEST;
 	bootp->htype = (uint8_t)ifp->hwtype;
@@ -793,17 +1084,8 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 	    type != DHCP_RELEASE)
 		bootp->flags = htons(BROADCAST_FLAG);
 
-	if (type != DHCP_DECLINE && type != DHCP_RELEASE) {
-		struct timespec tv;
-		unsigned long long secs;
-
-		clock_gettime(CLOCK_MONOTONIC, &tv);
-		secs = eloop_timespec_diff(&tv, &state->started, NULL);
-		if (secs > UINT16_MAX)
-			bootp->secs = htons((uint16_t)UINT16_MAX);
-		else
-			bootp->secs = htons((uint16_t)secs);
-	}
+	if (type != DHCP_DECLINE && type != DHCP_RELEASE)
+		bootp->secs = dhcp_secs(state);
 
 	bootp->xid = htonl(state->xid);
 
@@ -811,7 +1093,7 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 		return sizeof(*bootp);
 
 	p = bootp->vend;
-	e = (uint8_t *)bootp + (mtu - IP_UDP_SIZE) - 1; /* -1 for DHO_END */
+	e = (uint8_t *)bootp + len - 1; /* -1 for DHO_END */
 
 	ul = htonl(MAGIC_COOKIE);
 	memcpy(p, &ul, sizeof(ul));
@@ -831,30 +1113,16 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 	/* Options are listed in numerical order as per RFC 7844 Section 3.1
 	 * XXX: They should be randomised. */
 
-	bool putip = false;
-	if (lease->addr.s_addr && lease->cookie == htonl(MAGIC_COOKIE)) {
-		if (type == DHCP_DECLINE ||
-		    (type == DHCP_REQUEST &&
-		    (state->addr == NULL ||
-		    state->added & (STATE_FAKE | STATE_EXPIRED) ||
-		    lease->addr.s_addr != state->addr->addr.s_addr)))
-		{
-			putip = true;
-			PUT_ADDR(DHO_IPADDRESS, &lease->addr);
-		}
-	}
+	if (dhcp_putip(ifp, type))
+		PUT_ADDR(DHO_IPADDRESS, &lease->addr);
 
 	AREA_CHECK(3);
 	*p++ = DHO_MESSAGETYPE;
 	*p++ = 1;
 	*p++ = type;
 
-	if (lease->addr.s_addr && lease->cookie == htonl(MAGIC_COOKIE)) {
-		if (type == DHCP_RELEASE || putip) {
-			if (lease->server.s_addr)
-				PUT_ADDR(DHO_SERVERID, &lease->server);
-		}
-	}
+	if (dhcp_putserver(ifp, type))
+		PUT_ADDR(DHO_SERVERID, &lease->server);
 
 	if (type == DHCP_DECLINE) {
 		len = strlen(DAD);
@@ -894,43 +1162,23 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 			}
 		}
 
-		AREA_CHECK(0);
+		if (!state->prl_valid)
+			dhcp_makeprl(ifp);
+		AREA_CHECK(state->prl_len);
 		*p++ = DHO_PARAMETERREQUESTLIST;
-		n_params = p;
-		*p++ = 0;
-		for (i = 0, opt = ifp->ctx->dhcp_opts;
-		    i < ifp->ctx->dhcp_opts_len;
-		    i++, opt++)
-		{
-			if (!DHC_REQOPT(opt, ifo->requestmask, ifo->nomask))
-				continue;
-			if (type == DHCP_INFORM &&
-			    (opt->option == DHO_RENEWALTIME ||
-				opt->option == DHO_REBINDTIME))
-				continue;
-			AREA_FIT(1);
-			*p++ = (uint8_t)opt->option;
-		}
-		for (i = 0, opt = ifo->dhcp_override;
-		    i < ifo->dhcp_override_len;
-		    i++, opt++)
-		{
-			/* Check if added above */
-			for (lp = n_params + 1; lp < p; lp++)
-				if (*lp == (uint8_t)opt->option)
-					break;
-			if (lp < p)
-				continue;
-			if (!DHC_REQOPT(opt, ifo->requestmask, ifo->nomask))
-				continue;
-			if (type == DHCP_INFORM &&
-			    (opt->option == DHO_RENEWALTIME ||
-				opt->option == DHO_REBINDTIME))
-				continue;
-			AREA_FIT(1);
-			*p++ = (uint8_t)opt->option;
+		lp = p++;
+		if (type == DHCP_INFORM) {
+			for (i = 0; i < state->prl_len; i++) {
+				if (state->prl[i] == DHO_RENEWALTIME ||
+				    state->prl[i] == DHO_REBINDTIME)
+					continue;
+				*p++ = state->prl[i];
+			}
+		} else {
+			memcpy(p, state->prl, state->prl_len);
+			p += state->prl_len;
 		}
-		*n_params = (uint8_t)(p - n_params - 1);
+		*lp = (uint8_t)(p - lp - 1);
 
 		if (mtu != -1 &&
 		    !(has_option_mask(ifo->nomask, DHO_MAXMESSAGESIZE)))
@@ -1090,7 +1338,6 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 				if (vivco->len + 2 + *lp > 255) {
 					logerrx("%s: VIVCO option too big",
 					    ifp->name);
-					free(bootp);
 					return -1;
 				}
 				*p++ = (uint8_t)vivco->len;
@@ -1137,10 +1384,93 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 
 toobig:
 	logerrx("%s: DHCP message too big", ifp->name);
-	free(bootp);
 	return -1;
 }
 
+/*
+ * A retransmission normally only differs from the last message
+ * in the secs field, so it is patched rather than built again.
+ * Along with the xid, state and MTU, check what can change within
+ * a transaction: the hardware and client addresses, the address and
+ * server asked for, and the hostname which can change under us at
+ * any time. Changing the options calls dhcp_init or
+ * dhcp_reboot_newopts which discard the message.
+ */
+static bool
+dhcp_txcached(const struct interface *ifp, uint8_t type, int mtu,
+    in_addr_t reqaddr, in_addr_t server, const char *hostname)
+{
+	const struct dhcp_state *state = D_CSTATE(ifp);
+	const struct bootp *bootp;
+	uint8_t hlen;
+
+	if (state->tx_len == 0 ||
+	    state->tx_type != type ||
+	    state->tx_state != state->state ||
+	    state->tx_xid != state->xid ||
+	    state->tx_mtu != mtu ||
+	    state->tx_reqaddr != reqaddr ||
+	    state->tx_server != server ||
+	    strcmp(state->tx_hostname, hostname) != 0)
+		return false;
+
+	bootp = &state->txbuf->bootp;
+	if (ifp->hwlen != 0 && ifp->hwlen < sizeof(bootp->chaddr))
+		hlen = (uint8_t)ifp->hwlen;
+	else
+		hlen = 0;
+	return bootp->hlen == hlen &&
+	    memcmp(bootp->chaddr, ifp->hwaddr, hlen) == 0 &&
+	    bootp->ciaddr == dhcp_ciaddr(ifp, type);
+}
+
+static ssize_t
+make_message(struct bootp **bootpm, struct interface *ifp, uint8_t type)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+	ssize_t len;
+	int mtu;
+	in_addr_t reqaddr, server;
+	char hbuf[HOSTNAME_MAX_LEN + 1];
+
+	if ((mtu = if_getmtu(ifp)) == -1)
+		logerr("%s: if_getmtu", ifp->name);
+	else if (mtu < MTU_MIN) {
+		if (if_setmtu(ifp, MTU_MIN) == -1)
+			logerr("%s: if_setmtu", ifp->name);
+		mtu = MTU_MIN;
+	}
+
+	reqaddr = dhcp_putip(ifp, type) ? state->lease.addr.s_addr : 0;
+	server = dhcp_putserver(ifp, type) ? state->lease.server.s_addr : 0;
+	if (dhcp_get_hostname(hbuf, sizeof(hbuf), ifp->options) == NULL)
+		hbuf[0] = '\0';
+	if (dhcp_txcached(ifp, type, mtu, reqaddr, server, hbuf)) {
+		*bootpm = &state->txbuf->bootp;
+		(*bootpm)->secs = dhcp_secs(state);
+		return (ssize_t)state->tx_len;
+	}
+
+	state->tx_len = 0;
+	len = make_message1(bootpm, ifp, type, mtu);
+	if (len == -1 || !DHCP_DIR(type))
+		return len;
+#ifdef AUTH
+	/* The authentication covers the secs field. */
+	if (ifp->options->auth.options & DHCPCD_AUTH_SEND)
+		return len;
+#endif
+	state->tx_len = (size_t)len;
+	state->tx_type = type;
+	state->tx_state = state->state;
+	state->tx_xid = state->xid;
+	state->tx_mtu = mtu;
+	state->tx_reqaddr = reqaddr;
+	state->tx_server = server;
+	strlcpy(state->tx_hostname, hbuf, sizeof(state->tx_hostname));
+	return len;
+}
+
 static size_t
 read_lease(struct interface *ifp, struct bootp **bootp)
 {
@@ -1231,17 +1561,8 @@ out:
 static const struct dhcp_opt *
 dhcp_getoverride(const struct if_options *ifo, unsigned int o)
 {
-	size_t i;
-	const struct dhcp_opt *opt;
 
-	for (i = 0, opt = ifo->dhcp_override;
-	    i < ifo->dhcp_override_len;
-	    i++, opt++)
-	{
-		if (opt->option == o)
-			return opt;
-	}
-	return NULL;
+	return dhcp_optmap_find(&ifo->dhcp_override_map, o);
 }
 
 static const uint8_t *
@@ -1249,8 +1570,6 @@ dhcp_getoption(struct dhcpcd_ctx *ctx,
     size_t *os, unsigned int *code, size_t *len,
     const uint8_t *od, size_t ol, struct dhcp_opt **oopt)
 {
-	size_t i;
-	struct dhcp_opt *opt;
 
 	if (od) {
 		if (ol < 2) {
@@ -1266,19 +1585,12 @@ dhcp_getoption(struct dhcpcd_ctx *ctx,
 		}
 	}
 
-	*oopt = NULL;
-	for (i = 0, opt = ctx->dhcp_opts; i < ctx->dhcp_opts_len; i++, opt++) {
-		if (opt->option == *code) {
-			*oopt = opt;
-			break;
-		}
-	}
-
+	*oopt = dhcp_optmap_find(&ctx->dhcp_optmap, *code);
 	return od;
 }
 
-ssize_t
-dhcp_env(FILE *fenv, const char *prefix, const struct interface *ifp,
+static ssize_t
+dhcp_env1(FILE *fenv, const char *prefix, const struct interface *ifp,
     const struct bootp *bootp, size_t bootp_len)
 {
 	const struct if_options *ifo;
@@ -1399,6 +1711,18 @@ dhcp_env(FILE *fenv, const char *prefix, const struct interface *ifp,
 	return 1;
 }
 
+ssize_t
+dhcp_env(FILE *fenv, const char *prefix, const struct interface *ifp,
+    const struct bootp *bootp, size_t bootp_len)
+{
+	ssize_t r;
+
+	dhcp_indexoptions(ifp->ctx, bootp, bootp_len);
+	r = dhcp_env1(fenv, prefix, ifp, bootp, bootp_len);
+	dhcp_unindexoptions(ifp->ctx);
+	return r;
+}
+
 static void
 get_lease(struct interface *ifp,
     struct dhcp_lease *lease, const struct bootp *bootp, size_t len)
@@ -1411,6 +1735,7 @@ get_lease(struct interface *ifp,
 	/* BOOTP does not set yiaddr for replies when ciaddr is set. */
 	lease->addr.s_addr = bootp->yiaddr ? bootp->yiaddr : bootp->ciaddr;
 	ctx = ifp->ctx;
+	dhcp_indexoptions(ctx, bootp, len);
 	if (ifp->options->options & (DHCPCD_STATIC | DHCPCD_INFORM)) {
 		if (ifp->options->req_addr.s_addr != INADDR_ANY) {
 			lease->mask = ifp->options->req_mask;
@@ -1448,6 +1773,7 @@ get_lease(struct interface *ifp,
 		lease->rebindtime = 0;
 	if (get_option_addr(ctx, &lease->server, bootp, len, DHO_SERVERID) != 0)
 		lease->server.s_addr = INADDR_ANY;
+	dhcp_unindexoptions(ctx);
 }
 
 static const char *
@@ -1471,14 +1797,57 @@ dhcp_fallback(void *arg)
 	dhcpcd_startinterface(iface);
 }
 
+static int
+dhcp_cmpxid(__unused void *context, const void *node, const void *key)
+{
+	const struct dhcp_state *state = node;
+	uint32_t xid = *(const uint32_t *)key;
+
+	if (state->xid < xid)
+		return -1;
+	return state->xid > xid ? 1 : 0;
+}
+
+static int
+dhcp_cmpxidnode(void *context, const void *node1, const void *node2)
+{
+	const struct dhcp_state *state2 = node2;
+
+	return dhcp_cmpxid(context, node1, &state2->xid);
+}
+
+static const rb_tree_ops_t dhcp_xid_ops = {
+	.rbto_compare_nodes = dhcp_cmpxidnode,
+	.rbto_compare_key = dhcp_cmpxid,
+	.rbto_node_offset = offsetof(struct dhcp_state, xid_tree),
+	.rbto_context = NULL
+};
+
+void
+dhcp_initxids(struct dhcpcd_ctx *ctx)
+{
+
+	rb_tree_init(&ctx->dhcp_xids, &dhcp_xid_ops);
+}
+
+static void
+dhcp_freexid(struct interface *ifp)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+
+	if (state->xid_indexed) {
+		rb_tree_remove_node(&ifp->ctx->dhcp_xids, state);
+		state->xid_indexed = false;
+	}
+}
+
 static void
 dhcp_new_xid(struct interface *ifp)
 {
-	struct dhcp_state *state;
-	const struct interface *ifp1;
-	const struct dhcp_state *state1;
+	struct dhcp_state *state, *state1;
 
 	state = D_STATE(ifp);
+	dhcp_freexid(ifp);
 	if (ifp->options->options & DHCPCD_XID_HWADDR &&
 	    ifp->hwlen >= sizeof(state->xid))
 		/* The lower bits are probably more unique on the network */
@@ -1491,24 +1860,19 @@ again:
 	}
 
 	/* Ensure it's unique */
-	TAILQ_FOREACH(ifp1, ifp->ctx->ifaces, next) {
-		if (ifp == ifp1)
-			continue;
-		if ((state1 = D_CSTATE(ifp1)) == NULL)
-			continue;
-		if (state1->xid == state->xid)
-			break;
-	}
-	if (ifp1 != NULL) {
+	state1 = rb_tree_insert_node(&ifp->ctx->dhcp_xids, state);
+	if (state1 != state) {
 		if (ifp->options->options & DHCPCD_XID_HWADDR &&
 		    ifp->hwlen >= sizeof(state->xid))
 		{
 			logerrx("%s: duplicate xid on %s",
-			    ifp->name, ifp1->name);
+			    ifp->name, state1->xid_ifp->name);
 			    return;
 		}
 		goto again;
 	}
+	state->xid_ifp = ifp;
+	state->xid_indexed = true;
 
 	/* We can't do this when sharing leases across interfaes */
 #if 0
@@ -1570,6 +1934,7 @@ dhcp_close(struct interface *ifp)
 	dhcp_closeinet(ifp);
 
 	state->interval = 0;
+	state->tx_len = 0;
 }
 
 int
@@ -1612,42 +1977,19 @@ errexit:
 	return -1;
 }
 
-static uint16_t
-in_cksum(const void *data, size_t len, uint32_t *isum)
-{
-	const uint16_t *word = data;
-	uint32_t sum = isum != NULL ? *isum : 0;
-
-	for (; len > 1; len -= sizeof(*word))
-		sum += *word++;
-
-	if (len == 1)
-		sum += htons((uint16_t)(*(const uint8_t *)word << 8));
-
-	if (isum != NULL)
-		*isum = sum;
-
-	sum = (sum >> 16) + (sum & 0xffff);
-	sum += (sum >> 16);
-
-	return (uint16_t)~sum;
-}
-
-static struct bootp_pkt *
-dhcp_makeudppacket(size_t *sz, const uint8_t *data, size_t length,
+/* The BOOTP message is already in place after the headers. */
+static size_t
+dhcp_makeudppacket(struct bootp_pkt *udpp, size_t length,
 	struct in_addr source, struct in_addr dest)
 {
-	struct bootp_pkt *udpp;
-	struct ip *ip;
-	struct udphdr *udp;
+	struct ip *ip = &udpp->ip;
+	struct udphdr *udp = &udpp->udp;
 
-	if ((udpp = calloc(1, sizeof(*ip) + sizeof(*udp) + length)) == NULL)
-		return NULL;
-	ip = &udpp->ip;
-	udp = &udpp->udp;
+	memset(ip, 0, sizeof(*ip));
+	memset(udp, 0, sizeof(*udp));
 
 	/* OK, this is important :)
-	 * We copy the data to our packet and then create a small part of the
+	 * We create a small part of the
 	 * ip structure and an invalid ip_len (basically udp length).
 	 * We then fill the udp structure and put the checksum
 	 * of the whole packet into the udp checksum.
@@ -1655,8 +1997,6 @@ dhcp_makeudppacket(size_t *sz, const uint8_t *data, size_t length,
 	 * If we don't do the ordering like so then the udp checksum will be
 	 * broken, so find another way of doing it! */
 
-	memcpy(&udpp->bootp, data, length);
-
 	ip->ip_p = IPPROTO_UDP;
 	ip->ip_src.s_addr = source.s_addr;
 	if (dest.s_addr == 0)
@@ -1679,8 +2019,7 @@ dhcp_makeudppacket(size_t *sz, const uint8_t *data, size_t length,
 	if (ip->ip_sum == 0)
 		ip->ip_sum = 0xffff; /* RFC 768 */
 
-	*sz = sizeof(*ip) + sizeof(*udp) + length;
-	return udpp;
+	return sizeof(*ip) + sizeof(*udp) + length;
 }
 
 static ssize_t
@@ -1718,6 +2057,157 @@ dhcp_sendudp(struct interface *ifp, struct in_addr *to, void *data, size_t len)
 	return sendmsg(ctx->udp_wfd, &msg, 0);
 }
 
+#ifdef HAVE_SENDMMSG
+/*
+ * Unicast messages from every interface go out of the same socket.
+ * When many interfaces renew on the same tick, queue them and send
+ * them with one sendmmsg once the eloop has run everything else due.
+ * BPF sockets are per interface so there is nothing to batch there.
+ */
+#define	DHCP_TXQ_LEN	16
+
+struct dhcp_txent {
+	struct interface *ifp;
+	struct in_addr from;
+	struct sockaddr_in sin;
+	struct udphdr udp;
+	size_t len;
+	uint8_t data[MTU_MAX];
+};
+
+struct dhcp_txq {
+	struct dhcp_txent ent[DHCP_TXQ_LEN];
+	struct iovec iov[DHCP_TXQ_LEN][2];
+	struct mmsghdr msg[DHCP_TXQ_LEN];
+	unsigned int len;
+};
+
+/* Like send_message, fall back to BPF if we cannot unicast. */
+static void
+dhcp_txfallback(const struct dhcp_txent *te)
+{
+	struct interface *ifp = te->ifp;
+	struct dhcp_state *state = D_STATE(ifp);
+	struct bootp *bootp;
+	size_t ulen;
+
+	logerr("%s: dhcp_sendudp", ifp->name);
+	if ((bootp = dhcp_txbuf(ifp, te->len)) == NULL) {
+		logerr(__func__);
+		return;
+	}
+	memcpy(bootp, te->data, te->len);
+	state->tx_len = 0;
+	if (dhcp_openbpf(ifp) == -1)
+		return;
+	ulen = dhcp_makeudppacket(state->txbuf, te->len,
+	    te->from, te->sin.sin_addr);
+	if (bpf_send(state->bpf, ETHERTYPE_IP, state->txbuf, ulen) == -1)
+		logerr("%s: bpf_send", ifp->name);
+}
+
+static void
+dhcp_txflush(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct dhcp_txq *q = ctx->dhcp_txq;
+	struct dhcp_txent *te;
+	unsigned int i, n;
+	int r;
+
+	if (q == NULL || q->len == 0)
+		return;
+
+	for (i = 0; i < q->len; i++) {
+		te = &q->ent[i];
+		q->iov[i][0].iov_base = &te->udp;
+		q->iov[i][0].iov_len = sizeof(te->udp);
+		q->iov[i][1].iov_base = te->data;
+		q->iov[i][1].iov_len = te->len;
+		q->msg[i].msg_hdr = (struct msghdr){
+			.msg_name = (void *)&te->sin,
+			.msg_namelen = sizeof(te->sin),
+			.msg_iov = q->iov[i],
+			.msg_iovlen = __arraycount(q->iov[i]),
+		};
+	}
+
+	/* sendmmsg stops at the first message which fails. */
+	n = q->len;
+	q->len = 0;
+	for (i = 0; i < n; ) {
+		r = sendmmsg(ctx->udp_wfd, &q->msg[i], n - i, 0);
+		if (r <= 0) {
+			dhcp_txfallback(&q->ent[i]);
+			i++;
+		} else
+			i += (unsigned int)r;
+	}
+}
+
+static ssize_t
+dhcp_queueudp(struct interface *ifp, struct in_addr *from,
+    struct in_addr *to, void *data, size_t len)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct dhcp_txq *q = ctx->dhcp_txq;
+	struct dhcp_txent *te;
+
+	if (IN_PRIVSEP(ctx) || len > sizeof(te->data))
+		return dhcp_sendudp(ifp, to, data, len);
+
+	if (q == NULL) {
+		q = malloc(sizeof(*q));
+		if (q == NULL)
+			return dhcp_sendudp(ifp, to, data, len);
+		q->len = 0;
+		ctx->dhcp_txq = q;
+	} else if (q->len == DHCP_TXQ_LEN)
+		dhcp_txflush(ctx);
+
+	te = &q->ent[q->len];
+	te->ifp = ifp;
+	te->from = *from;
+	te->sin = (struct sockaddr_in){
+		.sin_family = AF_INET,
+		.sin_addr = *to,
+		.sin_port = htons(BOOTPS),
+#ifdef HAVE_SA_LEN
+		.sin_len = sizeof(te->sin),
+#endif
+	};
+	te->udp = (struct udphdr){
+		.uh_sport = htons(BOOTPC),
+		.uh_dport = htons(BOOTPS),
+		.uh_ulen = htons((uint16_t)(sizeof(te->udp) + len)),
+	};
+	memcpy(te->data, data, len);
+	te->len = len;
+	if (q->len++ == 0)
+		eloop_timeout_add_msec(ctx->eloop, 0, dhcp_txflush, ctx);
+	return (ssize_t)len;
+}
+
+/* Forget anything queued for an interface which is going away. */
+static void
+dhcp_txdrop(struct interface *ifp)
+{
+	struct dhcp_txq *q = ifp->ctx->dhcp_txq;
+	unsigned int i, n;
+
+	if (q == NULL)
+		return;
+	for (i = n = 0; i < q->len; i++) {
+		if (q->ent[i].ifp == ifp)
+			continue;
+		if (i != n)
+			q->ent[n] = q->ent[i];
+		n++;
+	}
+	q->len = n;
+}
+#endif
+
 static void
 send_message(struct interface *ifp, uint8_t type,
     void (*callback)(void *))
@@ -1725,11 +2215,11 @@ send_message(struct interface *ifp, uint8_t type,
 	struct dhcp_state *state = D_STATE(ifp);
 	struct if_options *ifo = ifp->options;
 	struct bootp *bootp;
-	struct bootp_pkt *udp;
 	size_t len, ulen;
 	ssize_t r;
 	struct in_addr from, to;
 	unsigned int RT;
+	bool resend = false;
 
 	if (callback == NULL) {
 		/* No carrier? Don't bother sending the packet. */
@@ -1741,19 +2231,23 @@ send_message(struct interface *ifp, uint8_t type,
 		    state->xid);
 		RT = 0; /* bogus gcc warning */
 	} else {
-		if (state->interval == 0)
+		if (state->interval == 0) {
 			state->interval = 4;
-		else {
+#ifndef SMALL
+			clock_gettime(CLOCK_MONOTONIC, &state->tx_first);
+#endif
+		} else {
 			state->interval *= 2;
 			if (state->interval > 64)
 				state->interval = 64;
+			resend = true;
 		}
 		RT = (state->interval * MSEC_PER_SEC) +
 		    (arc4random_uniform(MSEC_PER_SEC * 2) - MSEC_PER_SEC);
 		/* No carrier? Don't bother sending the packet.
 		 * However, we do need to advance the timeout. */
 		if (!if_is_link_up(ifp))
-			goto fail;
+			goto out;
 		logdebugx("%s: sending %s (xid 0x%x), next in %0.1f seconds",
 		    ifp->name,
 		    ifo->options & DHCPCD_BOOTP ? "BOOTP" : get_dhcp_op(type),
@@ -1763,7 +2257,7 @@ send_message(struct interface *ifp, uint8_t type,
 
 	r = make_message(&bootp, ifp, type);
 	if (r == -1)
-		goto fail;
+		goto out;
 	len = (size_t)r;
 
 	if (!(state->added & (STATE_FAKE | STATE_EXPIRED)) &&
@@ -1792,27 +2286,30 @@ send_message(struct interface *ifp, uint8_t type,
 	 * interface via IP_PKTINFO unlike for IPv6.
 	 */
 	if (to.s_addr != INADDR_BROADCAST) {
-		if (dhcp_sendudp(ifp, &to, bootp, len) != -1)
-			goto out;
+#ifdef HAVE_SENDMMSG
+		/* A RELEASE is sent as we drop the interface or exit,
+		 * which would discard it from the queue. */
+		if (callback != NULL &&
+		    !(ifp->ctx->options & DHCPCD_EXITING))
+			r = dhcp_queueudp(ifp, &from, &to, bootp, len);
+		else
+#endif
+			r = dhcp_sendudp(ifp, &to, bootp, len);
+		if (r != -1)
+			goto sent;
 		logerr("%s: dhcp_sendudp", ifp->name);
 	}
 
 	if (dhcp_openbpf(ifp) == -1)
 		goto out;
 
-	udp = dhcp_makeudppacket(&ulen, (uint8_t *)bootp, len, from, to);
-	if (udp == NULL) {
-		logerr("%s: dhcp_makeudppacket", ifp->name);
-		r = 0;
+	ulen = dhcp_makeudppacket(state->txbuf, len, from, to);
 #ifdef PRIVSEP
-	} else if (ifp->ctx->options & DHCPCD_PRIVSEP) {
-		r = ps_bpf_sendbootp(ifp, udp, ulen);
-		free(udp);
+	if (ifp->ctx->options & DHCPCD_PRIVSEP)
+		r = ps_bpf_sendbootp(ifp, state->txbuf, ulen);
+	else
 #endif
-	} else {
-		r = bpf_send(state->bpf, ETHERTYPE_IP, udp, ulen);
-		free(udp);
-	}
+		r = bpf_send(state->bpf, ETHERTYPE_IP, state->txbuf, ulen);
 	/* If we failed to send a raw packet this normally means
 	 * we don't have the ability to work beneath the IP layer
 	 * for this interface.
@@ -1833,12 +2330,14 @@ send_message(struct interface *ifp, uint8_t type,
 			    NULL, ifp);
 			callback = NULL;
 		}
+		goto out;
 	}
 
+sent:
+	IF_STAT(ifp, IFS_BOOTP, tx);
+	if (resend)
+		IF_STAT(ifp, IFS_BOOTP, retrans);
 out:
-	free(bootp);
-
-fail:
 	/* Even if we fail to send a packet we should continue as we are
 	 * as our failure timeouts will change out codepath when needed. */
 	if (callback != NULL)
@@ -2005,6 +2504,22 @@ dhcp_finish_dad(struct interface *ifp, struct in_addr *ia)
 {
 	struct dhcp_state *state = D_STATE(ifp);
 
+#ifndef IN_IFF_NOTUSEABLE
+	/* An optimistic bind can now be announced. */
+	if (state->state == DHS_BOUND &&
+	    IN_ARE_ADDR_EQUAL(ia, &state->lease.addr))
+	{
+		logdebugx("%s: DAD completed for %s",
+		    ifp->name, inet_ntoa(*ia));
+		arp_ifannounceaddr(ifp, ia);
+#ifdef IPV4LL
+		if (!IN_LINKLOCAL(ntohl(ia->s_addr)))
+			ipv4ll_drop(ifp);
+#endif
+		return;
+	}
+#endif
+
 	if (state->state != DHS_PROBE)
 		return;
 	if (state->offer == NULL || state->offer->yiaddr != ia->s_addr)
@@ -2064,6 +2579,12 @@ dhcp_addr_duplicated(struct interface *ifp, struct in_addr *ia)
 		ipv4_deladdr(iap, 0);
 		deleted = true;
 	}
+#else
+	/* Undo an optimistic bind. */
+	if (state->state == DHS_BOUND) {
+		dhcp_unbind(ifp, "EXPIRE");
+		deleted = true;
+	}
 #endif
 	eloop_timeout_delete(ctx->eloop, NULL, ifp);
 	if (opts & (DHCPCD_STATIC | DHCPCD_INFORM)) {
@@ -2220,6 +2741,27 @@ dhcp_arp_found(struct arp_state *astate, const struct arp_msg *amsg)
 
 #endif /* ARP */
 
+/* Take off the time a lease has run since it was issued. */
+static void
+dhcp_leaseage(struct dhcp_lease *lease, time_t issued)
+{
+	time_t now;
+	uint32_t age;
+
+	now = time(NULL);
+	if (now == -1 || now <= issued)
+		return;
+	if (now - issued >= (time_t)lease->leasetime)
+		age = lease->leasetime;
+	else
+		age = (uint32_t)(now - issued);
+	lease->leasetime -= age;
+	lease->rebindtime = lease->rebindtime > age ?
+	    lease->rebindtime - age : 0;
+	lease->renewaltime = lease->renewaltime > age ?
+	    lease->renewaltime - age : 0;
+}
+
 void
 dhcp_bind(struct interface *ifp)
 {
@@ -2288,6 +2830,8 @@ dhcp_bind(struct interface *ifp)
 				    "rebind time, forcing to %"PRIu32" seconds",
 				    ifp->name, lease->renewaltime);
 			}
+			if (state->resumed != 0)
+				dhcp_leaseage(lease, state->resumed);
 			if (state->state == DHS_RENEW && state->addr &&
 			    lease->addr.s_addr == state->addr->addr.s_addr &&
 			    !(state->added & STATE_FAKE))
@@ -2324,10 +2868,10 @@ dhcp_bind(struct interface *ifp)
 	if (lease->leasetime == DHCP_INFINITE_LIFETIME)
 		lease->renewaltime = lease->rebindtime = lease->leasetime;
 	else {
-		eloop_timeout_add_sec(ctx->eloop,
-		    lease->renewaltime, dhcp_startrenew, ifp);
-		eloop_timeout_add_sec(ctx->eloop,
-		    lease->rebindtime, dhcp_rebind, ifp);
+		eloop_timeout_add_slack(ctx->eloop,
+		    lease->renewaltime, DHCP_RENEW_SLACK, dhcp_startrenew, ifp);
+		eloop_timeout_add_slack(ctx->eloop,
+		    lease->rebindtime, DHCP_RENEW_SLACK, dhcp_rebind, ifp);
 		eloop_timeout_add_sec(ctx->eloop,
 		    lease->leasetime, dhcp_expire, ifp);
 		logdebugx("%s: renew in %"PRIu32" seconds, rebind in %"PRIu32
@@ -2335,14 +2879,18 @@ dhcp_bind(struct interface *ifp)
 		    ifp->name, lease->renewaltime, lease->rebindtime);
 	}
 	state->state = DHS_BOUND;
-	if (!state->lease.frominfo &&
+	clock_gettime(CLOCK_MONOTONIC, &state->bound);
+	/* A handed over lease is already written,
+	 * and its mtime says when it was issued. */
+	if (!state->lease.frominfo && state->resumed == 0 &&
 	    !(ifo->options & (DHCPCD_INFORM | DHCPCD_STATIC))) {
 		logdebugx("%s: writing lease: %s",
 		    ifp->name, state->leasefile);
-		if (dhcp_writefile(ifp->ctx, state->leasefile, 0640,
+		if (dhcp_writelease(ifp->ctx, state->leasefile, 0640,
 		    state->new, state->new_len) == -1)
-			logerr("dhcp_writefile: %s", state->leasefile);
+			logerr("dhcp_writelease: %s", state->leasefile);
 	}
+	state->resumed = 0;
 
 	old_state = state->added;
 
@@ -2407,8 +2955,8 @@ openudp:
 		dhcp_openbpf(ifp);
 		return;
 	}
-	if (eloop_event_add(ctx->eloop, state->udp_rfd, ELE_READ,
-	    dhcp_handleifudp, ifp) == -1)
+	if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH, state->udp_rfd,
+	    ELE_READ, dhcp_handleifudp, ifp) == -1)
 		logerr("%s: eloop_event_add", __func__);
 }
 
@@ -2486,8 +3034,19 @@ dhcp_arp_address(struct interface *ifp)
 			return -1;
 
 		if (ia == NULL) {
-			state->state = DHS_PROBE;
 			get_lease(ifp, &l, state->offer, state->offer_len);
+			/* Bind now and undo it if the probe finds a conflict. */
+			if (ifp->options->arp_optimistic &&
+			    !(ifp->options->options &
+			    (DHCPCD_STATIC | DHCPCD_INFORM)))
+			{
+				loginfox("%s: optimistically binding %s/%d",
+				    ifp->name, inet_ntoa(l.addr),
+				    inet_ntocidr(l.mask));
+				arp_probe(astate);
+				return 1;
+			}
+			state->state = DHS_PROBE;
 			loginfox("%s: probing address %s/%d",
 			    ifp->name, inet_ntoa(l.addr), inet_ntocidr(l.mask));
 			/* We need to handle DAD. */
@@ -2629,7 +3188,12 @@ dhcp_reboot_newopts(struct interface *ifp, unsigned long long oldopts)
 	struct if_options *ifo;
 	struct dhcp_state *state = D_STATE(ifp);
 
-	if (state == NULL || state->state == DHS_NONE)
+	if (state == NULL)
+		return;
+	/* The cached message and request list are built from the options. */
+	state->prl_valid = false;
+	state->tx_len = 0;
+	if (state->state == DHS_NONE)
 		return;
 	ifo = ifp->options;
 	if ((ifo->options & (DHCPCD_INFORM | DHCPCD_STATIC) &&
@@ -2760,6 +3324,7 @@ dhcp_drop(struct interface *ifp, const char *reason)
 	struct timespec ts;
 #endif
 
+	pace_delete(ifp, dhcp_start1);
 	state = D_STATE(ifp);
 	/* dhcp_start may just have been called and we don't yet have a state
 	 * but we do have a timeout, so punt it. */
@@ -2823,6 +3388,14 @@ dhcp_drop(struct interface *ifp, const char *reason)
 	/* Close DHCP ports so a changed interface family is picked
 	 * up by a new BPF state. */
 	dhcp_close(ifp);
+	dhcp_unbind(ifp, reason);
+}
+
+/* Forget the lease and remove what was configured from it. */
+static void
+dhcp_unbind(struct interface *ifp, const char *reason)
+{
+	struct dhcp_state *state = D_STATE(ifp);
 
 	state->state = DHS_NONE;
 	free(state->offer);
@@ -2887,6 +3460,9 @@ log_dhcp(int loglevel, const char *msg,
 	int r;
 	uint8_t overl;
 
+	if (loglevel == LOG_DEBUG && !logdebugenabled())
+		return;
+
 	if (strcmp(msg, "NAK:") == 0) {
 		a = get_option_string(ifp->ctx, bootp, bootp_len, DHO_MESSAGE);
 		if (a) {
@@ -2973,6 +3549,54 @@ dhcp_redirect_dhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 	}
 }
 
+#ifndef SMALL
+/* Note how long from first sending until from answered. */
+static void
+dhcp_responded(struct interface *ifp, const struct in_addr *from,
+    uint8_t type)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+	struct dhcp_responder *dr, *odr = NULL;
+	struct timespec now;
+	unsigned long long secs;
+	unsigned int nsecs, ms;
+	size_t i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = eloop_timespec_diff(&now, &state->tx_first, &nsecs);
+	if (secs >= UINT_MAX / MSEC_PER_SEC)
+		ms = UINT_MAX;
+	else
+		ms = (unsigned int)secs * MSEC_PER_SEC + nsecs / NSEC_PER_MSEC;
+
+	for (i = 0, dr = state->responders; i < DHCP_RESPONDERS; i++, dr++) {
+		if (dr->dr_addr.s_addr == from->s_addr)
+			break;
+		if (odr == NULL || dr->dr_seen < odr->dr_seen)
+			odr = dr;
+	}
+	if (i == DHCP_RESPONDERS) {
+		dr = odr;
+		memset(dr, 0, sizeof(*dr));
+		dr->dr_addr = *from;
+		dr->dr_offer_ms_min = dr->dr_ack_ms_min = UINT_MAX;
+	}
+	dr->dr_seen = ++state->responders_seen;
+
+	if (type == DHCP_OFFER) {
+		dr->dr_offers++;
+		dr->dr_offer_ms = ms;
+		if (ms < dr->dr_offer_ms_min)
+			dr->dr_offer_ms_min = ms;
+	} else {
+		dr->dr_acks++;
+		dr->dr_ack_ms = ms;
+		if (ms < dr->dr_ack_ms_min)
+			dr->dr_ack_ms_min = ms;
+	}
+}
+#endif
+
 static void
 dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
     const struct in_addr *from)
@@ -3003,14 +3627,17 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 #define IS_STATE_ACTIVE(s) ((s)-state != DHS_NONE && \
 	(s)->state != DHS_INIT && (s)->state != DHS_BOUND)
 
+	PROBE3(dhcp_handledhcp, ifp->name, ntohl(bootp->xid), state->state);
 	if (bootp->op != BOOTREPLY) {
 		if (IS_STATE_ACTIVE(state))
 			logdebugx("%s: op (%d) is not BOOTREPLY",
 			    ifp->name, bootp->op);
+		IF_STAT(ifp, IFS_BOOTP, drop);
 		return;
 	}
 
 	if (state->xid != ntohl(bootp->xid)) {
+		IF_STAT(ifp, IFS_BOOTP, xid);
 		if (IS_STATE_ACTIVE(state))
 			logdebugx("%s: wrong xid 0x%x (expecting 0x%x) from %s",
 			    ifp->name, ntohl(bootp->xid), state->xid,
@@ -3030,6 +3657,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 			    hwaddr_ntoa(bootp->chaddr, sizeof(bootp->chaddr),
 				    buf, sizeof(buf)));
 		}
+		IF_STAT(ifp, IFS_BOOTP, drop);
 		dhcp_redirect_dhcp(ifp, bootp, bootp_len, from);
 		return;
 	}
@@ -3159,6 +3787,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		}
 
 		/* We should restart on a NAK */
+		IF_STAT(ifp, IFS_BOOTP, nak);
 		LOGDHCP(LOG_WARNING, "NAK:");
 		if ((msg = get_option_string(ifp->ctx,
 		    bootp, bootp_len, DHO_MESSAGE)))
@@ -3316,6 +3945,10 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		}
 
 		LOGDHCP(LOG_INFO, "offered");
+#ifndef SMALL
+		if (type == DHCP_OFFER)
+			dhcp_responded(ifp, from, type);
+#endif
 		if (state->offer_len < bootp_len) {
 			free(state->offer);
 			if ((state->offer = malloc(bootp_len)) == NULL) {
@@ -3381,6 +4014,9 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		}
 
 rapidcommit:
+#ifndef SMALL
+		dhcp_responded(ifp, from, DHCP_ACK);
+#endif
 		if (!(ifo->options & DHCPCD_INFORM))
 			LOGDHCP(LOG_DEBUG, "acknowledged");
 		else
@@ -3467,6 +4103,55 @@ is_packet_udp_bootp(void *packet, size_t plen)
 	return true;
 }
 
+/* Why is_packet_for_us rejected a frame. */
+enum dhcp_forus {
+	DHCP_FORUS,
+	DHCP_NOTUS_XID,		/* no transaction has the xid */
+	DHCP_NOTUS_CHADDR,	/* the xid is ours but chaddr is not */
+};
+
+/*
+ * On a shared segment most replies are for other clients.
+ * Check the reply is for us, or one dhcp_redirect_dhcp would pass it to,
+ * before paying for the checksums.
+ * Lengths have already been checked.
+ */
+static enum dhcp_forus
+is_packet_for_us(const struct interface *ifp, void *packet)
+{
+	const struct ip *ip = packet;
+	const struct bootp *bootp;
+	const struct interface *ifn;
+	const struct dhcp_state *state;
+	uint32_t xid;
+	enum dhcp_forus forus = DHCP_NOTUS_XID;
+
+	bootp = (const void *)((char *)packet + (size_t)ip->ip_hl * 4 +
+	    sizeof(struct udphdr));
+	memcpy(&xid, &bootp->xid, sizeof(xid));
+	xid = ntohl(xid);
+
+	/* Most likely it's for the interface it arrived on. */
+	state = D_CSTATE(ifp);
+	if (state != NULL && state->xid == xid) {
+		if (ifp->hwlen > sizeof(bootp->chaddr) ||
+		    memcmp(bootp->chaddr, ifp->hwaddr, ifp->hwlen) == 0)
+			return DHCP_FORUS;
+		forus = DHCP_NOTUS_CHADDR;
+	}
+
+	state = rb_tree_find_node(&ifp->ctx->dhcp_xids, &xid);
+	if (state == NULL || state->state == DHS_NONE)
+		return forus;
+	ifn = state->xid_ifp;
+	if (ifn == ifp)
+		return forus;
+	if (ifn->hwlen <= sizeof(bootp->chaddr) &&
+	    memcmp(bootp->chaddr, ifn->hwaddr, ifn->hwlen))
+		return DHCP_NOTUS_CHADDR;
+	return DHCP_FORUS;
+}
+
 /* Lengths have already been checked. */
 static bool
 checksums_valid(void *packet,
@@ -3495,7 +4180,9 @@ checksums_valid(void *packet,
 	if (in_cksum(ip, ip_hlen, NULL) != 0)
 		return false;
 
-	if (flags & BPF_PARTIALCSUM)
+	/* The UDP checksum is either yet to be computed because the
+	 * packet came from this host, or the NIC has already verified it. */
+	if (flags & (BPF_PARTIALCSUM | BPF_CSUMVALID))
 		return true;
 
 	udpp = (char *)ip + ip_hlen;
@@ -3533,6 +4220,7 @@ dhcp_handlebootp(struct interface *ifp, struct bootp *bootp, size_t len,
 	if (len < offsetof(struct bootp, vend)) {
 		logerrx("%s: truncated packet (%zu) from %s",
 		    ifp->name, len, inet_ntoa(*from));
+		IF_STAT(ifp, IFS_BOOTP, drop);
 		return;
 	}
 
@@ -3540,6 +4228,7 @@ dhcp_handlebootp(struct interface *ifp, struct bootp *bootp, size_t len,
 	if (len > FRAMELEN_MAX) {
 		logerrx("%s: packet exceeded frame length (%zu) from %s",
 		    ifp->name, len, inet_ntoa(*from));
+		IF_STAT(ifp, IFS_BOOTP, drop);
 		return;
 	}
 
@@ -3587,11 +4276,14 @@ dhcp_packet(struct interface *ifp, uint8_t *data, size_t len,
 	}
 #endif
 
+	IF_STAT(ifp, IFS_BOOTP, rx);
+
 	/* Trim frame header */
 	if (fl != 0) {
 		if (len < fl) {
 			logerrx("%s: %s: short frame header %zu",
 			    __func__, ifp->name, len);
+			IF_STAT(ifp, IFS_BOOTP, drop);
 			return;
 		}
 		len -= fl;
@@ -3604,12 +4296,26 @@ dhcp_packet(struct interface *ifp, uint8_t *data, size_t len,
 #ifdef BPF_DEBUG
 		logerrx("%s: DHCP BPF validation failure", ifp->name);
 #endif
+		IF_STAT(ifp, IFS_BOOTP, drop);
+		return;
+	}
+
+	switch (is_packet_for_us(ifp, data)) {
+	case DHCP_FORUS:
+		break;
+	case DHCP_NOTUS_XID:
+		IF_STAT(ifp, IFS_BOOTP, xid);
+		/* FALLTHROUGH */
+	default:
+		IF_STAT(ifp, IFS_BOOTP, drop);
 		return;
 	}
 
 	if (!checksums_valid(data, &from, bpf_flags)) {
 		logerrx("%s: checksum failure from %s",
 		    ifp->name, inet_ntoa(from));
+		IF_STAT(ifp, IFS_BOOTP, cksum);
+		IF_STAT(ifp, IFS_BOOTP, drop);
 		return;
 	}
 
@@ -3646,6 +4352,8 @@ dhcp_readbpf(void *arg, unsigned short events)
 			}
 			break;
 		}
+		if (bytes == 0)
+			break;
 		dhcp_packet(ifp, buf, (size_t)bytes, bpf->bpf_flags);
 		/* Check we still have a state after processing. */
 		if ((state = D_STATE(ifp)) == NULL)
@@ -3694,6 +4402,7 @@ dhcp_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg)
 	}
 #endif
 
+	IF_STAT(ifp, IFS_BOOTP, rx);
 	dhcp_handlebootp(ifp, iov->iov_base, iov->iov_len,
 	    &from->sin_addr);
 }
@@ -3795,8 +4504,8 @@ dhcp_openbpf(struct interface *ifp)
 		return -1;
 	}
 
-	if (eloop_event_add(ifp->ctx->eloop, state->bpf->bpf_fd, ELE_READ,
-	    dhcp_readbpf, ifp) == -1)
+	if (eloop_p_event_add(ifp->ctx->eloop, ELOOP_PRIO_HIGH,
+	    state->bpf->bpf_fd, ELE_READ, dhcp_readbpf, ifp) == -1)
 		logerr("%s: eloop_event_add", __func__);
 	return 0;
 }
@@ -3810,13 +4519,19 @@ dhcp_free(struct interface *ifp)
 	dhcp_close(ifp);
 #ifdef ARP
 	arp_drop(ifp);
+#endif
+#ifdef HAVE_SENDMMSG
+	dhcp_txdrop(ifp);
 #endif
 	if (state) {
+		dhcp_freexid(ifp);
 		state->state = DHS_NONE;
 		free(state->old);
 		free(state->new);
 		free(state->offer);
 		free(state->clientid);
+		free(state->txbuf);
+		script_freeenvcache(state->envcache, ENVCACHE_LEN);
 		free(state);
 	}
 
@@ -3840,9 +4555,19 @@ dhcp_free(struct interface *ifp)
 			close(ctx->udp_wfd);
 			ctx->udp_wfd = -1;
 		}
+#ifdef HAVE_SENDMMSG
+		eloop_timeout_delete(ctx->eloop, dhcp_txflush, ctx);
+		free(ctx->dhcp_txq);
+		ctx->dhcp_txq = NULL;
+#endif
 
 		free(ctx->opt_buffer);
 		ctx->opt_buffer = NULL;
+		if (ctx->opt_index != NULL) {
+			free(ctx->opt_index->ent);
+			free(ctx->opt_index);
+			ctx->opt_index = NULL;
+		}
 	}
 }
 
@@ -3895,6 +4620,8 @@ dhcp_init(struct interface *ifp)
 
 	free(state->clientid);
 	state->clientid = NULL;
+	state->prl_valid = false;
+	state->tx_len = 0;
 
 	if (ifo->options & DHCPCD_ANONYMOUS) {
 		/* Removing the option could show that we want anonymous.
@@ -3948,6 +4675,52 @@ eexit:
 	return -1;
 }
 
+/*
+ * A restart handed the lease over with its address and routes still
+ * configured, so bind it again without asking the server
+ * unless it is time to renew.
+ */
+static bool
+dhcp_resume(struct interface *ifp)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+	struct dhcp_lease lease;
+	time_t mtime, now;
+	uint32_t renewaltime;
+
+	if (!handoff_take(ifp, AF_INET, &state->lease.addr))
+		return false;
+
+	/* dhcp_start1 only fakes the add if the address is there. */
+	if (state->new == NULL || !(state->added & STATE_FAKE))
+		return false;
+#ifdef IN_IFF_NOTUSEABLE
+	if (state->addr->addr_flags & IN_IFF_NOTUSEABLE)
+		return false;
+#endif
+
+	if (dhcp_filemtime(ifp->ctx, state->leasefile, &mtime) == -1 ||
+	    (now = time(NULL)) == -1 || now < mtime)
+		return false;
+	/* state->lease has been offset already, so go back to the lease. */
+	get_lease(ifp, &lease, state->offer, state->offer_len);
+	if (lease.leasetime != DHCP_INFINITE_LIFETIME) {
+		renewaltime = lease.renewaltime;
+		if (renewaltime == 0)
+			renewaltime = (uint32_t)(lease.leasetime * T1);
+		if (now - mtime >= (time_t)renewaltime)
+			return false;
+	}
+
+	loginfox("%s: resuming lease of %s",
+	    ifp->name, inet_ntoa(state->lease.addr));
+	state->resumed = mtime;
+	state->lease.frominfo = 0;
+	state->state = DHS_REBOOT;
+	dhcp_bind(ifp);
+	return true;
+}
+
 static void
 dhcp_start1(void *arg)
 {
@@ -3960,6 +4733,8 @@ dhcp_start1(void *arg)
 
 	if (!(ifo->options & DHCPCD_IPV4))
 		return;
+	if (!pace_start(ifp, dhcp_start1))
+		return;
 
 	/* Listen on *.*.*.*:bootpc so that the kernel never sends an
 	 * ICMP port unreachable message back to the DHCP server.
@@ -3973,8 +4748,8 @@ dhcp_start1(void *arg)
 			logerr(__func__);
 			return;
 		}
-		if (eloop_event_add(ctx->eloop, ctx->udp_rfd, ELE_READ,
-		    dhcp_handleudp, ctx) == -1)
+		if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH,
+		    ctx->udp_rfd, ELE_READ, dhcp_handleudp, ctx) == -1)
 			logerr("%s: eloop_event_add", __func__);
 	}
 	if (!IN_PRIVSEP(ctx) && ctx->udp_wfd == -1) {
@@ -4124,7 +4899,7 @@ dhcp_start1(void *arg)
 	    !IS_DHCP(state->offer) ||
 	    ifo->options & DHCPCD_ANONYMOUS)
 		dhcp_discover(ifp);
-	else
+	else if (!dhcp_resume(ifp))
 		dhcp_reboot(ifp);
 }
 
@@ -4206,6 +4981,7 @@ dhcp_abort(struct interface *ifp)
 #endif
 
 	eloop_timeout_delete(ifp->ctx->eloop, dhcp_start1, ifp);
+	pace_delete(ifp, dhcp_start1);
 
 	if (state != NULL && state->added) {
 		rt_build(ifp->ctx, AF_INET);
@@ -4298,7 +5074,7 @@ dhcp_handleifa(int cmd, struct ipv4_addr *ia, pid_t pid)
 	}
 
 	state->reason = "STATIC";
-	rt_build(ifp->ctx, AF_INET);
+	rt_schedule(ifp->ctx, AF_INET);
 	script_runreason(ifp, state->reason);
 
 	return ia;
@@ -4323,4 +5099,17 @@ dhcp_dump(struct interface *ifp)
 	state->reason = "DUMP";
 	return script_runreason(ifp, state->reason);
 }
+
+static const char * const dhcp_statenames[] = {
+	"none", "init", "discover", "request", "probe", "bound", "renew",
+	"rebind", "reboot", "inform", "renew_requested", "release",
+};
+
+const char *
+dhcp_statename(enum DHS s)
+{
+
+	return (size_t)s < __arraycount(dhcp_statenames) ?
+	    dhcp_statenames[s] : "unknown";
+}
 #endif
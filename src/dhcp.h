@@ -38,6 +38,7 @@
 #undef __FAVOR_BSD
 
 #include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "arp.h"
@@ -74,6 +75,8 @@
 #define DHCP_MAX		64
 #define DHCP_RAND_MIN		-1
 #define DHCP_RAND_MAX		1
+/* For the renew and rebind timers, see eloop_q_timeout_add_slack. */
+#define DHCP_RENEW_SLACK	1000	/* msec */
 
 #ifdef RFC2131_STRICT
 /* Be strictly conformant for section 4.1.1 */
@@ -208,6 +211,21 @@ enum DHS {
 	DHS_RELEASE
 };
 
+#ifndef SMALL
+/* How quickly a server, or the relay in front of it, answers us. */
+struct dhcp_responder {
+	struct in_addr dr_addr;
+	unsigned long long dr_seen;	/* for replacing the oldest */
+	unsigned long long dr_offers;
+	unsigned long long dr_acks;
+	unsigned int dr_offer_ms;	/* last */
+	unsigned int dr_offer_ms_min;
+	unsigned int dr_ack_ms;		/* last */
+	unsigned int dr_ack_ms_min;
+};
+#define	DHCP_RESPONDERS		4
+#endif
+
 struct dhcp_state {
 	enum DHS state;
 	struct bootp *sent;
@@ -218,11 +236,17 @@ struct dhcp_state {
 	size_t new_len;
 	struct bootp *old;
 	size_t old_len;
+	struct script_envcache *envcache;	/* rendered old and new */
 	struct dhcp_lease lease;
+	struct timespec bound;		/* when lease was last bound */
+	time_t resumed;			/* when a handed over lease was issued */
 	const char *reason;
 	unsigned int interval;
 	unsigned int nakoff;
 	uint32_t xid;
+	rb_node_t xid_tree;	/* in ctx->dhcp_xids if xid_indexed */
+	struct interface *xid_ifp;
+	bool xid_indexed;
 	int socket;
 
 	struct bpf *bpf;
@@ -233,6 +257,24 @@ struct dhcp_state {
 	char leasefile[sizeof(LEASEFILE) + IF_NAMESIZE + (IF_SSIDLEN * 4)];
 	struct timespec started;
 	unsigned char *clientid;
+	struct bootp_pkt *txbuf;	/* messages are built and sent from here */
+	size_t txbuf_len;
+	uint8_t prl[UINT8_MAX];		/* cached parameter request list */
+	size_t prl_len;
+	bool prl_valid;
+	size_t tx_len;			/* txbuf holds a message to resend */
+	uint8_t tx_type;
+	enum DHS tx_state;
+	uint32_t tx_xid;
+	int tx_mtu;
+	in_addr_t tx_reqaddr;		/* DHO_IPADDRESS, if sent */
+	in_addr_t tx_server;		/* DHO_SERVERID, if sent */
+	char tx_hostname[HOSTNAME_MAX_LEN + 1];
+#ifndef SMALL
+	struct timespec tx_first;	/* first send of this exchange */
+	struct dhcp_responder responders[DHCP_RESPONDERS];
+	unsigned long long responders_seen;
+#endif
 	struct authstate auth;
 #ifdef ARPING
 	ssize_t arping_index;
@@ -258,6 +300,7 @@ struct dhcp_state {
 ssize_t print_rfc3361(FILE *, const uint8_t *, size_t);
 ssize_t print_rfc3442(FILE *, const uint8_t *, size_t);
 
+void dhcp_initxids(struct dhcpcd_ctx *);
 int dhcp_openudp(struct in_addr *);
 void dhcp_packet(struct interface *, uint8_t *, size_t, unsigned int);
 void dhcp_recvmsg(struct dhcpcd_ctx *, struct msghdr *);
@@ -280,6 +323,9 @@ void dhcp_reboot_newopts(struct interface *, unsigned long long);
 void dhcp_close(struct interface *);
 void dhcp_free(struct interface *);
 int dhcp_dump(struct interface *);
+#ifndef SMALL
+const char *dhcp_statename(enum DHS);
+#endif
 #endif /* INET */
 
 #endif /* DHCP_H */
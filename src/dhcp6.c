@@ -52,11 +52,14 @@
 #include "dhcp6.h"
 #include "duid.h"
 #include "eloop.h"
+#include "handoff.h"
 #include "if.h"
 #include "if-options.h"
 #include "ipv6nd.h"
 #include "logerr.h"
+#include "pace.h"
 #include "privsep.h"
+#include "probe.h"
 #include "script.h"
 
 #ifdef HAVE_SYS_BITOPS_H
@@ -84,7 +87,7 @@ struct dhcp6_message {
 	uint8_t xid[3];
 	/* followed by options */
 };
-__CTASSERT(sizeof(struct dhcp6_message) == 4);
+__CTASSERT(sizeof(struct dhcp6_message) == DHCP6_HDR_LEN);
 
 struct dhcp6_option {
 	uint16_t code;
@@ -175,6 +178,7 @@ static void dhcp6_bind(struct interface *, const char *, const char *);
 static void dhcp6_failinform(void *);
 static void dhcp6_recvaddr(void *, unsigned short);
 static void dhcp6_startdecline(struct interface *);
+static const char *dhcp6_get_op(uint16_t);
 
 #ifdef SMALL
 #define dhcp6_hasprefixdelegation(a)	(0)
@@ -368,14 +372,197 @@ dhcp6_findmoption(void *data, size_t data_len, uint16_t code,
 	return dhcp6_findoption(d, data_len, code, len);
 }
 
+/*
+ * A reply can hold hundreds of IA_PD prefixes and each consumer used
+ * to walk the raw option buffer again for every lookup.
+ * Walk it once instead, recording each option along with the options
+ * nested in IA_NA, IA_TA, IA_PD, IA_ADDR and IAPREFIX.
+ * Nested options follow their parent and end is the index just past
+ * the last of them, so siblings are found by jumping from end to end.
+ */
+struct dhcp6_optent {
+	uint8_t *data;
+	size_t end;
+	uint16_t code;
+	uint16_t len;
+};
+
+#define	D6_OPTINDEX_INLINE	32
+
+struct dhcp6_optindex {
+	struct dhcp6_optent *ent;
+	size_t len;
+	size_t size;
+	bool truncated;
+	struct dhcp6_optent ent_inline[D6_OPTINDEX_INLINE];
+};
+
+static size_t
+dhcp6_optnested(uint16_t code, unsigned int depth)
+{
+
+	switch (depth) {
+	case 0:
+		switch (code) {
+		case D6_OPTION_IA_NA:
+		case D6_OPTION_IA_PD:
+			return sizeof(struct dhcp6_ia_na);
+		case D6_OPTION_IA_TA:
+			return sizeof(struct dhcp6_ia_ta);
+		}
+		break;
+	case 1:
+		switch (code) {
+		case D6_OPTION_IA_ADDR:
+			return sizeof(struct dhcp6_ia_addr);
+		case D6_OPTION_IAPREFIX:
+			return sizeof(struct dhcp6_pd_addr);
+		}
+		break;
+	}
+	return 0;
+}
+
+static int
+dhcp6_optindex_grow(struct dhcp6_optindex *idx)
+{
+	struct dhcp6_optent *ent;
+	size_t size = idx->size * 2;
+
+	if (idx->ent == idx->ent_inline) {
+		ent = reallocarray(NULL, size, sizeof(*ent));
+		if (ent != NULL)
+			memcpy(ent, idx->ent, idx->len * sizeof(*ent));
+	} else
+		ent = reallocarray(idx->ent, size, sizeof(*ent));
+	if (ent == NULL)
+		return -1;
+	idx->ent = ent;
+	idx->size = size;
+	return 0;
+}
+
+static int
+dhcp6_optindex_add(struct dhcp6_optindex *idx, uint8_t *d, size_t l,
+    unsigned int depth)
+{
+	struct dhcp6_option o;
+	struct dhcp6_optent *oe;
+	size_t i, hl;
+
+	while (l != 0) {
+		if (l < sizeof(o)) {
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(&o, d, sizeof(o));
+		d += sizeof(o);
+		l -= sizeof(o);
+		o.len = ntohs(o.len);
+		if (l < o.len) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (idx->len == idx->size && dhcp6_optindex_grow(idx) == -1)
+			return -1;
+		i = idx->len++;
+		oe = &idx->ent[i];
+		oe->data = d;
+		oe->code = ntohs(o.code);
+		oe->len = o.len;
+		hl = dhcp6_optnested(oe->code, depth);
+		/* Like dhcp6_findoption, a bad nested option only hides
+		 * the options after it. */
+		if (hl != 0 && o.len >= hl &&
+		    dhcp6_optindex_add(idx, d + hl, o.len - hl, depth + 1) == -1 &&
+		    errno != EINVAL)
+			return -1;
+		idx->ent[i].end = idx->len;
+		d += o.len;
+		l -= o.len;
+	}
+	return 0;
+}
+
+static int
+dhcp6_optindex_init(struct dhcp6_optindex *idx, struct dhcp6_message *m,
+    size_t len)
+{
+
+	idx->ent = idx->ent_inline;
+	idx->len = 0;
+	idx->size = __arraycount(idx->ent_inline);
+	idx->truncated = false;
+	if (len < sizeof(*m)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (dhcp6_optindex_add(idx, (uint8_t *)m + sizeof(*m),
+	    len - sizeof(*m), 0) == -1)
+	{
+		if (errno != EINVAL) {
+			if (idx->ent != idx->ent_inline)
+				free(idx->ent);
+			return -1;
+		}
+		idx->truncated = true;
+	}
+	return 0;
+}
+
+static void
+dhcp6_optindex_free(struct dhcp6_optindex *idx)
+{
+
+	if (idx->ent != idx->ent_inline)
+		free(idx->ent);
+}
+
+/* Find the next option with code nested in parent, or in the message
+ * itself if parent is NULL, after prev or from the start if NULL.
+ * A code of 0 matches any option. */
+static struct dhcp6_optent *
+dhcp6_optnext(const struct dhcp6_optindex *idx,
+    const struct dhcp6_optent *parent, const struct dhcp6_optent *prev,
+    uint16_t code)
+{
+	size_t i, end;
+
+	if (prev != NULL)
+		i = prev->end;
+	else if (parent != NULL)
+		i = (size_t)(parent - idx->ent) + 1;
+	else
+		i = 0;
+	end = parent != NULL ? parent->end : idx->len;
+	for (; i < end; i = idx->ent[i].end) {
+		if (code == 0 || idx->ent[i].code == code)
+			return &idx->ent[i];
+	}
+	errno = ENOENT;
+	return NULL;
+}
+
+static void *
+dhcp6_optfind(const struct dhcp6_optindex *idx,
+    const struct dhcp6_optent *parent, uint16_t code, uint16_t *len)
+{
+	struct dhcp6_optent *oe;
+
+	oe = dhcp6_optnext(idx, parent, NULL, code);
+	if (oe == NULL)
+		return NULL;
+	if (len != NULL)
+		*len = oe->len;
+	return oe->data;
+}
+
 static const uint8_t *
 dhcp6_getoption(struct dhcpcd_ctx *ctx,
     size_t *os, unsigned int *code, size_t *len,
     const uint8_t *od, size_t ol, struct dhcp_opt **oopt)
 {
 	struct dhcp6_option o;
-	size_t i;
-	struct dhcp_opt *opt;
 
 	if (od != NULL) {
 		*os = sizeof(o);
@@ -392,40 +579,28 @@ dhcp6_getoption(struct dhcpcd_ctx *ctx,
 		*code = ntohs(o.code);
 	}
 
-	*oopt = NULL;
-	for (i = 0, opt = ctx->dhcp6_opts;
-	    i < ctx->dhcp6_opts_len; i++, opt++)
-	{
-		if (opt->option == *code) {
-			*oopt = opt;
-			break;
-		}
-	}
-
+	*oopt = dhcp_optmap_find(&ctx->dhcp6_optmap, *code);
 	if (od != NULL)
 		return od + sizeof(o);
 	return NULL;
 }
 
+/* dhcp6_makemessage records where the Elapsed Time option is
+ * so retransmissions can patch it without parsing the message. */
 static bool
-dhcp6_updateelapsed(struct interface *ifp, struct dhcp6_message *m, size_t len)
+dhcp6_updateelapsed(struct interface *ifp)
 {
-	uint8_t *opt;
-	uint16_t opt_len;
 	struct dhcp6_state *state;
 	struct timespec tv;
 	unsigned long long hsec;
 	uint16_t sec;
 
-	opt = dhcp6_findmoption(m, len, D6_OPTION_ELAPSED, &opt_len);
-	if (opt == NULL)
-		return false;
-	if (opt_len != sizeof(sec)) {
-		errno = EINVAL;
+	state = D6_STATE(ifp);
+	if (state->send_elapsed == 0) {
+		errno = ENOENT;
 		return false;
 	}
 
-	state = D6_STATE(ifp);
 	clock_gettime(CLOCK_MONOTONIC, &tv);
 	if (state->RTC == 0) {
 		/* An RTC of zero means we're the first message
@@ -449,17 +624,74 @@ dhcp6_updateelapsed(struct interface *ifp, struct dhcp6_message *m, size_t len)
 		}
 	}
 	sec = htons((uint16_t)hsec);
-	memcpy(opt, &sec, sizeof(sec));
+	memcpy((uint8_t *)state->send + state->send_elapsed, &sec, sizeof(sec));
 	return true;
 }
 
+/*
+ * Every transaction in flight is indexed by xid so a reply arriving
+ * on the shared socket finds its interface without a walk.
+ */
+static uint32_t
+dhcp6_msgxid(const struct dhcp6_message *m)
+{
+
+	return (uint32_t)m->xid[0] << 16 | (uint32_t)m->xid[1] << 8 |
+	    (uint32_t)m->xid[2];
+}
+
+static int
+dhcp6_cmpxid(__unused void *context, const void *node, const void *key)
+{
+	const struct dhcp6_state *state = node;
+	uint32_t xid = *(const uint32_t *)key;
+
+	if (state->xid < xid)
+		return -1;
+	return state->xid > xid ? 1 : 0;
+}
+
+static int
+dhcp6_cmpxidnode(void *context, const void *node1, const void *node2)
+{
+	const struct dhcp6_state *state2 = node2;
+
+	return dhcp6_cmpxid(context, node1, &state2->xid);
+}
+
+static const rb_tree_ops_t dhcp6_xid_ops = {
+	.rbto_compare_nodes = dhcp6_cmpxidnode,
+	.rbto_compare_key = dhcp6_cmpxid,
+	.rbto_node_offset = offsetof(struct dhcp6_state, xid_tree),
+	.rbto_context = NULL
+};
+
+void
+dhcp6_initxids(struct dhcpcd_ctx *ctx)
+{
+
+	rb_tree_init(&ctx->dhcp6_xids, &dhcp6_xid_ops);
+}
+
+static void
+dhcp6_freexid(struct interface *ifp)
+{
+	struct dhcp6_state *state = D6_STATE(ifp);
+
+	if (state->xid_indexed) {
+		rb_tree_remove_node(&ifp->ctx->dhcp6_xids, state);
+		state->xid_indexed = false;
+	}
+}
+
 static void
-dhcp6_newxid(const struct interface *ifp, struct dhcp6_message *m)
+dhcp6_newxid(struct interface *ifp, struct dhcp6_message *m)
 {
-	const struct interface *ifp1;
-	const struct dhcp6_state *state1;
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct dhcp6_state *state = D6_STATE(ifp), *state1;
 	uint32_t xid;
 
+	dhcp6_freexid(ifp);
 	if (ifp->options->options & DHCPCD_XID_HWADDR &&
 	    ifp->hwlen >= sizeof(xid))
 		/* The lower bits are probably more unique on the network */
@@ -475,28 +707,20 @@ again:
 	m->xid[2] = xid & 0xff;
 
 	/* Ensure it's unique */
-	TAILQ_FOREACH(ifp1, ifp->ctx->ifaces, next) {
-		if (ifp == ifp1)
-			continue;
-		if ((state1 = D6_CSTATE(ifp1)) == NULL)
-			continue;
-		if (state1->send != NULL &&
-		    state1->send->xid[0] == m->xid[0] &&
-		    state1->send->xid[1] == m->xid[1] &&
-		    state1->send->xid[2] == m->xid[2])
-			break;
-	}
-
-	if (ifp1 != NULL) {
+	state->xid = dhcp6_msgxid(m);
+	state1 = rb_tree_insert_node(&ctx->dhcp6_xids, state);
+	if (state1 != state) {
 		if (ifp->options->options & DHCPCD_XID_HWADDR &&
 		    ifp->hwlen >= sizeof(xid))
 		{
 			logerrx("%s: duplicate xid on %s",
-			    ifp->name, ifp1->name);
+			    ifp->name, state1->xid_ifp->name);
 			    return;
 		}
 		goto again;
 	}
+	state->xid_ifp = ifp;
+	state->xid_indexed = true;
 }
 
 #ifndef SMALL
@@ -626,6 +850,91 @@ dhcp6_delegateaddr(struct in6_addr *addr, struct interface *ifp,
 }
 #endif
 
+/* Is the address sent in the IA for this message? */
+static bool
+dhcp6_sendaddr(const struct dhcp6_state *state, const struct ipv6_addr *ap)
+{
+
+	if (ap->flags & IPV6_AF_STALE)
+		return false;
+	if (!(ap->flags & IPV6_AF_REQUEST) &&
+	    (ap->prefix_vltime == 0 ||
+	    state->state == DH6S_DISCOVER))
+		return false;
+	if (DECLINE_IA(ap) && state->state != DH6S_DECLINE)
+		return false;
+	return true;
+}
+
+/* Length of the IA_ADDR or IAPREFIX option for the address. */
+static size_t
+dhcp6_addrlen(const struct ipv6_addr *ap)
+{
+	size_t len;
+
+	if (ap->ia_type != D6_OPTION_IA_PD)
+		return sizeof(struct dhcp6_option) +
+		    sizeof(struct dhcp6_ia_addr);
+#ifndef SMALL
+	len = sizeof(struct dhcp6_option) + sizeof(struct dhcp6_pd_addr);
+	if (ap->prefix_exclude_len)
+		len += sizeof(struct dhcp6_option) + 1 +
+		    (uint8_t)((ap->prefix_exclude_len -
+		    ap->prefix_len - 1) / NBBY) + 1;
+#else
+	len = 0;
+#endif
+	return len;
+}
+
+/*
+ * A SOLICIT with many IAs and hints can grow past the link MTU and
+ * fragment.  Hints are only suggestions, so drop them from the last
+ * IA backwards until it fits.  IAs after *nhints are sent without them.
+ * Any other message has to carry its addresses and may still fragment.
+ */
+static size_t
+dhcp6_fitmessage(struct interface *ifp, size_t len, uint8_t type,
+    size_t *nhints)
+{
+	struct dhcp6_state *state = D6_STATE(ifp);
+	const struct if_options *ifo = ifp->options;
+	const struct if_ia *ifia;
+	const struct ipv6_addr *ap;
+	size_t max, olen = len;
+	int mtu;
+
+	*nhints = ifo->ia_len;
+	if ((mtu = if_getmtu(ifp)) == -1 ||
+	    (size_t)mtu <= sizeof(struct ip6_hdr) + sizeof(struct udphdr))
+		return len;
+	max = (size_t)mtu - sizeof(struct ip6_hdr) - sizeof(struct udphdr);
+	if (len <= max)
+		return len;
+
+	if (type == DHCP6_SOLICIT) {
+		while (*nhints > 0 && len > max) {
+			ifia = &ifo->ia[--*nhints];
+			TAILQ_FOREACH(ap, &state->addrs, next) {
+				if (ap->ia_type != ifia->ia_type ||
+				    memcmp(ap->iaid, ifia->iaid,
+				    sizeof(ap->iaid)) ||
+				    !dhcp6_sendaddr(state, ap))
+					continue;
+				len -= dhcp6_addrlen(ap);
+			}
+		}
+		if (len != olen)
+			logwarnx("%s: SOLICIT6 is %zu bytes, MTU allows %zu,"
+			    " sending hints for %zu of %zu IAs",
+			    ifp->name, olen, max, *nhints, ifo->ia_len);
+	}
+	if (len > max)
+		logwarnx("%s: %s is %zu bytes and will fragment (MTU %d)",
+		    ifp->name, dhcp6_get_op(type), len, mtu);
+	return len;
+}
+
 static int
 dhcp6_makemessage(struct interface *ifp)
 {
@@ -633,12 +942,15 @@ dhcp6_makemessage(struct interface *ifp)
 	struct dhcp6_message *m;
 	struct dhcp6_option o;
 	uint8_t *p, *si, *unicast, IA;
-	size_t n, l, len, ml, hl;
+	size_t l, len, ml, hl, nhints;
+#ifndef SMALL
+	size_t n;
+#endif
 	uint8_t type;
 	uint16_t si_len, uni_len, n_options;
 	uint8_t *o_lenp;
 	struct if_options *ifo = ifp->options;
-	const struct dhcp_opt *opt, *opt2;
+	const struct dhcp_opt *opt;
 	const struct ipv6_addr *ap;
 	char hbuf[HOSTNAME_MAX_LEN + 1];
 	const char *hostname;
@@ -654,6 +966,7 @@ dhcp6_makemessage(struct interface *ifp)
 
 	state = D6_STATE(ifp);
 	if (state->send) {
+		dhcp6_freexid(ifp);
 		free(state->send);
 		state->send = NULL;
 	}
@@ -724,14 +1037,8 @@ dhcp6_makemessage(struct interface *ifp)
 		    l < ifp->ctx->dhcp6_opts_len;
 		    l++, opt++)
 		{
-			for (n = 0, opt2 = ifo->dhcp6_override;
-			    n < ifo->dhcp6_override_len;
-			    n++, opt2++)
-			{
-				if (opt->option == opt2->option)
-					break;
-			}
-			if (n < ifo->dhcp6_override_len)
+			if (dhcp_optmap_find(&ifo->dhcp6_override_map,
+			    opt->option) != NULL)
 				continue;
 			if (!DHC_REQOPT(opt, ifo->requestmask6, ifo->nomask6))
 				continue;
@@ -821,24 +1128,8 @@ dhcp6_makemessage(struct interface *ifp)
 			ml = state->new_len;
 		}
 		TAILQ_FOREACH(ap, &state->addrs, next) {
-			if (ap->flags & IPV6_AF_STALE)
-				continue;
-			if (!(ap->flags & IPV6_AF_REQUEST) &&
-			    (ap->prefix_vltime == 0 ||
-			    state->state == DH6S_DISCOVER))
-				continue;
-			if (DECLINE_IA(ap) && state->state != DH6S_DECLINE)
-				continue;
-			if (ap->ia_type == D6_OPTION_IA_PD) {
-#ifndef SMALL
-				len += sizeof(o) + sizeof(struct dhcp6_pd_addr);
-				if (ap->prefix_exclude_len)
-					len += sizeof(o) + 1 +
-					    (uint8_t)((ap->prefix_exclude_len -
-					    ap->prefix_len - 1) / NBBY) + 1;
-#endif
-			} else
-				len += sizeof(o) + sizeof(struct dhcp6_ia_addr);
+			if (dhcp6_sendaddr(state, ap))
+				len += dhcp6_addrlen(ap);
 		}
 		/* FALLTHROUGH */
 	case DH6S_INIT:
@@ -906,6 +1197,11 @@ dhcp6_makemessage(struct interface *ifp)
 	}
 #endif
 
+	if (IA)
+		len = dhcp6_fitmessage(ifp, len, type, &nhints);
+	else
+		nhints = 0;
+
 	state->send = malloc(len);
 	if (state->send == NULL)
 		return -1;
@@ -966,13 +1262,9 @@ dhcp6_makemessage(struct interface *ifp)
 		ia_na.t2 = 0;
 		COPYIN(ifia->ia_type, &ia_na, ia_na_len);
 		TAILQ_FOREACH(ap, &state->addrs, next) {
-			if (ap->flags & IPV6_AF_STALE)
-				continue;
-			if (!(ap->flags & IPV6_AF_REQUEST) &&
-			    (ap->prefix_vltime == 0 ||
-			    state->state == DH6S_DISCOVER))
-				continue;
-			if (DECLINE_IA(ap) && state->state != DH6S_DECLINE)
+			if (l >= nhints)
+				break;
+			if (!dhcp6_sendaddr(state, ap))
 				continue;
 			if (ap->ia_type != ifia->ia_type)
 				continue;
@@ -1047,15 +1339,9 @@ dhcp6_makemessage(struct interface *ifp)
 		    l++, opt++)
 		{
 #ifndef SMALL
-			for (n = 0, opt2 = ifo->dhcp6_override;
-			    n < ifo->dhcp6_override_len;
-			    n++, opt2++)
-			{
-				if (opt->option == opt2->option)
-					break;
-			}
-			if (n < ifo->dhcp6_override_len)
-			    continue;
+			if (dhcp_optmap_find(&ifo->dhcp6_override_map,
+			    opt->option) != NULL)
+				continue;
 #endif
 			if (!DHC_REQOPT(opt, ifo->requestmask6, ifo->nomask6))
 				continue;
@@ -1088,6 +1374,7 @@ dhcp6_makemessage(struct interface *ifp)
 	}
 
 	si_len = 0;
+	state->send_elapsed = (size_t)(p - (uint8_t *)state->send) + sizeof(o);
 	COPYIN(D6_OPTION_ELAPSED, &si_len, sizeof(si_len));
 
 	if (state->state == DH6S_DISCOVER &&
@@ -1145,9 +1432,12 @@ dhcp6_makemessage(struct interface *ifp)
 
 #ifdef AUTH
 	/* This has to be the last option */
+	state->send_auth = 0;
 	if (ifo->auth.options & DHCPCD_AUTH_SEND && auth_len != 0) {
 		COPYIN1(D6_OPTION_AUTH, auth_len);
 		/* data will be filled at send message time */
+		state->send_auth = (size_t)(p - (uint8_t *)state->send);
+		state->send_auth_len = auth_len;
 	}
 #endif
 
@@ -1195,20 +1485,152 @@ static void dhcp6_delete_delegates(struct interface *ifp)
 
 #ifdef AUTH
 static ssize_t
-dhcp6_update_auth(struct interface *ifp, struct dhcp6_message *m, size_t len)
+dhcp6_update_auth(struct interface *ifp)
 {
 	struct dhcp6_state *state;
-	uint8_t *opt;
-	uint16_t opt_len;
 
-	opt = dhcp6_findmoption(m, len, D6_OPTION_AUTH, &opt_len);
-	if (opt == NULL)
+	state = D6_STATE(ifp);
+	if (state->send_auth == 0) {
+		errno = ENOENT;
 		return -1;
+	}
 
-	state = D6_STATE(ifp);
 	return dhcp_auth_encode(ifp->ctx, &ifp->options->auth,
 	    state->auth.token, (uint8_t *)state->send, state->send_len, 6,
-	    state->send->type, opt, opt_len);
+	    state->send->type, (uint8_t *)state->send + state->send_auth,
+	    state->send_auth_len);
+}
+#endif
+
+#ifdef HAVE_SENDMMSG
+/*
+ * Like dhcp_queueudp, retransmissions from many interfaces which fall
+ * due on the same tick are queued and sent with one sendmmsg once the
+ * eloop has run everything else due.
+ * Messages sent without a callback, such as RELEASE on exit, go out
+ * straight away as the eloop may not run again.
+ */
+#define	DHCP6_TXQ_LEN	16
+#define	DHCP6_TXQ_DATA	\
+	(1500 - sizeof(struct ip6_hdr) - sizeof(struct udphdr))
+
+struct dhcp6_txent {
+	struct interface *ifp;
+	struct sockaddr_in6 dst;
+	struct udphdr udp;
+	union {
+		struct cmsghdr hdr;
+		uint8_t buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	} cmsgbuf;
+	size_t controllen;
+	size_t len;
+	uint8_t data[DHCP6_TXQ_DATA];
+};
+
+struct dhcp6_txq {
+	struct dhcp6_txent ent[DHCP6_TXQ_LEN];
+	struct iovec iov[DHCP6_TXQ_LEN][2];
+	struct mmsghdr msg[DHCP6_TXQ_LEN];
+	unsigned int len;
+};
+
+static void
+dhcp6_txflush(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct dhcp6_txq *q = ctx->dhcp6_txq;
+	struct dhcp6_txent *te;
+	unsigned int i, n;
+	int r;
+
+	if (q == NULL || q->len == 0)
+		return;
+
+	for (i = 0; i < q->len; i++) {
+		te = &q->ent[i];
+		q->iov[i][0].iov_base = &te->udp;
+		q->iov[i][0].iov_len = sizeof(te->udp);
+		q->iov[i][1].iov_base = te->data;
+		q->iov[i][1].iov_len = te->len;
+		q->msg[i].msg_hdr = (struct msghdr){
+			.msg_name = (void *)&te->dst,
+			.msg_namelen = sizeof(te->dst),
+			.msg_iov = q->iov[i],
+			.msg_iovlen = __arraycount(q->iov[i]),
+			.msg_control = te->controllen ? te->cmsgbuf.buf : NULL,
+			.msg_controllen = te->controllen,
+		};
+	}
+
+	/* sendmmsg stops at the first message which fails.
+	 * As with sendmsg, the protocol retransmits anyway. */
+	n = q->len;
+	q->len = 0;
+	for (i = 0; i < n; ) {
+		r = sendmmsg(ctx->dhcp6_wfd, &q->msg[i], n - i, 0);
+		if (r <= 0) {
+			logerr("%s: %s: sendmmsg", __func__,
+			    q->ent[i].ifp->name);
+			i++;
+		} else
+			i += (unsigned int)r;
+	}
+}
+
+static int
+dhcp6_queuemsg(struct interface *ifp, const struct msghdr *msg)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct dhcp6_txq *q = ctx->dhcp6_txq;
+	struct dhcp6_txent *te;
+
+	if (msg->msg_iov[1].iov_len > sizeof(te->data) ||
+	    msg->msg_controllen > sizeof(te->cmsgbuf))
+	{
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	if (q == NULL) {
+		q = malloc(sizeof(*q));
+		if (q == NULL)
+			return -1;
+		q->len = 0;
+		ctx->dhcp6_txq = q;
+	} else if (q->len == DHCP6_TXQ_LEN)
+		dhcp6_txflush(ctx);
+
+	te = &q->ent[q->len];
+	te->ifp = ifp;
+	memcpy(&te->dst, msg->msg_name, sizeof(te->dst));
+	memcpy(&te->udp, msg->msg_iov[0].iov_base, sizeof(te->udp));
+	te->len = msg->msg_iov[1].iov_len;
+	memcpy(te->data, msg->msg_iov[1].iov_base, te->len);
+	te->controllen = msg->msg_controllen;
+	if (te->controllen != 0)
+		memcpy(te->cmsgbuf.buf, msg->msg_control, te->controllen);
+	if (q->len++ == 0)
+		eloop_timeout_add_msec(ctx->eloop, 0, dhcp6_txflush, ctx);
+	return 0;
+}
+
+/* Forget anything queued for an interface which is going away. */
+static void
+dhcp6_txdrop(struct interface *ifp)
+{
+	struct dhcp6_txq *q = ifp->ctx->dhcp6_txq;
+	unsigned int i, n;
+
+	if (q == NULL)
+		return;
+	for (i = n = 0; i < q->len; i++) {
+		if (q->ent[i].ifp == ifp)
+			continue;
+		if (i != n)
+			q->ent[n] = q->ent[i];
+		n++;
+	}
+	q->len = n;
 }
 #endif
 
@@ -1283,7 +1705,10 @@ dhcp6_sendmessage(struct interface *ifp, void (*callback)(void *))
 		    !(ifp->options->options & DHCPCD_INITIAL_DELAY))
 			state->IMD = 0;
 		if (state->IMD) {
-			state->RT = state->IMD * MSEC_PER_SEC;
+			/* RFC 8415 section 18.2 wants a random delay
+			 * between 0 and IMD so hosts which start together,
+			 * say after a power cut, do not send together. */
+			state->RT = arc4random_uniform(state->IMD * MSEC_PER_SEC);
 			/* Some buggy PPP servers close the link too early
 			 * after sending an invalid status in their reply
 			 * which means this host won't see it.
@@ -1301,13 +1726,19 @@ dhcp6_sendmessage(struct interface *ifp, void (*callback)(void *))
 		}
 
 		/* Add -.1 to .1 * RT randomness as per RFC8415 section 15 */
-		uint32_t lru = arc4random_uniform(
-		    state->RTC == 0 ? DHCP6_RAND_MAX
-		    : DHCP6_RAND_MAX - DHCP6_RAND_MIN);
-		int lr = (int)lru - (state->RTC == 0 ? 0 : DHCP6_RAND_MAX);
-		RT = state->RT
-		    + (unsigned int)((float)state->RT
-		    * ((float)lr / DHCP6_RAND_DIV));
+		if (state->IMD != 0)
+			RT = state->RT;
+		else {
+			uint32_t lru = arc4random_uniform(
+			    state->RTC == 0 ? DHCP6_RAND_MAX
+			    : DHCP6_RAND_MAX - DHCP6_RAND_MIN);
+			int lr = (int)lru -
+			    (state->RTC == 0 ? 0 : DHCP6_RAND_MAX);
+
+			RT = state->RT
+			    + (unsigned int)((float)state->RT
+			    * ((float)lr / DHCP6_RAND_DIV));
+		}
 
 		if (if_is_link_up(ifp))
 			logdebugx("%s: %s %s (xid 0x%02x%02x%02x)%s%s,"
@@ -1335,10 +1766,10 @@ dhcp6_sendmessage(struct interface *ifp, void (*callback)(void *))
 		return 0;
 
 	/* Update the elapsed time */
-	dhcp6_updateelapsed(ifp, state->send, state->send_len);
+	dhcp6_updateelapsed(ifp);
 #ifdef AUTH
 	if (ifp->options->auth.options & DHCPCD_AUTH_SEND &&
-	    dhcp6_update_auth(ifp, state->send, state->send_len) == -1)
+	    dhcp6_update_auth(ifp) == -1)
 	{
 		logerr("%s: %s: dhcp6_updateauth", __func__, ifp->name);
 		if (errno != ESRCH)
@@ -1371,6 +1802,11 @@ dhcp6_sendmessage(struct interface *ifp, void (*callback)(void *))
 	}
 #endif
 
+#ifdef HAVE_SENDMMSG
+	if (callback != NULL && dhcp6_queuemsg(ifp, &msg) == 0)
+		goto sent;
+#endif
+
 	if (sendmsg(ctx->dhcp6_wfd, &msg, 0) == -1) {
 		logerr("%s: %s: sendmsg", __func__, ifp->name);
 		/* Allow DHCPv6 to continue .... the errors
@@ -1379,9 +1815,12 @@ dhcp6_sendmessage(struct interface *ifp, void (*callback)(void *))
 		 * associate with an access point. */
 	}
 
-#ifdef PRIVSEP
+#if defined(PRIVSEP) || defined(HAVE_SENDMMSG)
 sent:
 #endif
+	IF_STAT(ifp, IFS_DHCP6, tx);
+	if (state->RTC != 0)
+		IF_STAT(ifp, IFS_DHCP6, retrans);
 	state->RTC++;
 	if (callback) {
 		state->RT = RT * 2;
@@ -1490,22 +1929,51 @@ dhcp6_startrenew(void *arg)
 void dhcp6_renew(struct interface *ifp)
 {
 
-	dhcp6_startrenew(ifp);
+	dhcp6_startrenew(ifp);
+}
+
+/*
+ * Addresses still waiting on DAD are counted as they are added,
+ * so each DAD result is O(1) rather than a walk of every address.
+ */
+static void
+dhcp6_dadstart(struct interface *ifp)
+{
+	struct dhcp6_state *state = D6_STATE(ifp);
+	struct ipv6_addr *ap;
+
+	if (state->dad_pending == 0)
+		state->dad_duplicated = false;
+	TAILQ_FOREACH(ap, &state->addrs, next) {
+		if ((ap->flags & (IPV6_AF_ADDED | IPV6_AF_DADCOMPLETED |
+		    IPV6_AF_DADPENDING)) != IPV6_AF_ADDED)
+			continue;
+		ap->flags |= IPV6_AF_DADPENDING;
+		state->dad_pending++;
+	}
+}
+
+/* The address is done with DAD, or will never finish it. */
+void
+dhcp6_dadforget(struct ipv6_addr *ia)
+{
+	struct dhcp6_state *state;
+
+	if (!(ia->flags & IPV6_AF_DADPENDING))
+		return;
+	ia->flags &= ~IPV6_AF_DADPENDING;
+	state = D6_STATE(ia->iface);
+	if (state != NULL && state->dad_pending != 0)
+		state->dad_pending--;
 }
 
 bool
 dhcp6_dadcompleted(const struct interface *ifp)
 {
 	const struct dhcp6_state *state;
-	const struct ipv6_addr *ap;
 
 	state = D6_CSTATE(ifp);
-	TAILQ_FOREACH(ap, &state->addrs, next) {
-		if (ap->flags & IPV6_AF_ADDED &&
-		    !(ap->flags & IPV6_AF_DADCOMPLETED))
-			return false;
-	}
-	return true;
+	return state->dad_pending == 0;
 }
 
 static void
@@ -1514,11 +1982,17 @@ dhcp6_dadcallback(void *arg)
 	struct ipv6_addr *ia = arg;
 	struct interface *ifp;
 	struct dhcp6_state *state;
-	struct ipv6_addr *ia2;
-	bool completed, valid, oneduplicated;
+	bool completed, valid;
 
 	completed = (ia->flags & IPV6_AF_DADCOMPLETED);
 	ia->flags |= IPV6_AF_DADCOMPLETED;
+	ifp = ia->iface;
+	state = D6_STATE(ifp);
+	if (ia->flags & IPV6_AF_DADPENDING) {
+		dhcp6_dadforget(ia);
+		if (DECLINE_IA(ia))
+			state->dad_duplicated = true;
+	}
 	if (ia->addr_flags & IN6_IFF_DUPLICATED)
 		logwarnx("%s: DAD detected %s", ia->iface->name, ia->saddr);
 
@@ -1529,34 +2003,20 @@ dhcp6_dadcallback(void *arg)
 	if (completed)
 		return;
 
-	ifp = ia->iface;
-	state = D6_STATE(ifp);
 	if (state->state != DH6S_BOUND && state->state != DH6S_DELEGATED)
 		return;
+	if (state->dad_pending != 0)
+		return;
 
 #ifdef SMALL
 	valid = true;
 #else
 	valid = (ia->delegating_prefix == NULL);
 #endif
-	completed = true;
-	oneduplicated = false;
-	TAILQ_FOREACH(ia2, &state->addrs, next) {
-		if (ia2->flags & IPV6_AF_ADDED &&
-		    !(ia2->flags & IPV6_AF_DADCOMPLETED))
-		{
-			completed = false;
-			break;
-		}
-		if (DECLINE_IA(ia))
-			oneduplicated = true;
-	}
-	if (!completed)
-		return;
 
 	logdebugx("%s: DHCPv6 DAD completed", ifp->name);
 
-	if (oneduplicated && state->state == DH6S_BOUND) {
+	if (state->dad_duplicated && state->state == DH6S_BOUND) {
 		dhcp6_startdecline(ifp);
 		return;
 	}
@@ -2009,25 +2469,20 @@ dhcp6_startrelease(struct interface *ifp)
 }
 
 static int
-dhcp6_checkstatusok(const struct interface *ifp,
-    struct dhcp6_message *m, uint8_t *p, size_t len)
+dhcp6_checkstatusok(struct interface *ifp,
+    const struct dhcp6_optindex *idx, const struct dhcp6_optent *parent)
 {
 	struct dhcp6_state *state;
 	uint8_t *opt;
 	uint16_t opt_len, code;
 	size_t mlen;
-	void * (*f)(void *, size_t, uint16_t, uint16_t *), *farg;
 	char buf[32], *sbuf;
 	const char *status;
 	int loglevel;
 
 	state = D6_STATE(ifp);
-	f = p ? dhcp6_findoption : dhcp6_findmoption;
-	if (p)
-		farg = p;
-	else
-		farg = m;
-	if ((opt = f(farg, len, D6_OPTION_STATUS_CODE, &opt_len)) == NULL) {
+	opt = dhcp6_optfind(idx, parent, D6_OPTION_STATUS_CODE, &opt_len);
+	if (opt == NULL) {
 		//logdebugx("%s: no status", ifp->name);
 		state->lerror = 0;
 		errno = ESRCH;
@@ -2074,6 +2529,7 @@ dhcp6_checkstatusok(const struct interface *ifp,
 	logmessage(loglevel, "%s: DHCPv6 REPLY: %s", ifp->name, status);
 	free(sbuf);
 	state->lerror = code;
+	IF_STAT(ifp, IFS_DHCP6, nak);
 	errno = 0;
 
 	/* code cannot be D6_STATUS_OK, so there is a failure */
@@ -2120,28 +2576,27 @@ dhcp6_findaddr(struct dhcpcd_ctx *ctx, const struct in6_addr *addr,
 
 static int
 dhcp6_findna(struct interface *ifp, uint16_t ot, const uint8_t *iaid,
-    uint8_t *d, size_t l, const struct timespec *acquired)
+    const struct dhcp6_optindex *idx, const struct dhcp6_optent *ioe,
+    const struct timespec *acquired)
 {
 	struct dhcp6_state *state;
-	uint8_t *o, *nd;
-	uint16_t ol;
+	struct dhcp6_optent *oe;
 	struct ipv6_addr *a;
 	int i;
 	struct dhcp6_ia_addr ia;
 
 	i = 0;
 	state = D6_STATE(ifp);
-	while ((o = dhcp6_findoption(d, l, D6_OPTION_IA_ADDR, &ol))) {
-		/* Set d and l first to ensure we find the next option. */
-		nd = o + ol;
-		l -= (size_t)(nd - d);
-		d = nd;
-		if (ol < sizeof(ia)) {
+	for (oe = dhcp6_optnext(idx, ioe, NULL, D6_OPTION_IA_ADDR);
+	    oe != NULL;
+	    oe = dhcp6_optnext(idx, ioe, oe, D6_OPTION_IA_ADDR))
+	{
+		if (oe->len < sizeof(ia)) {
 			errno = EINVAL;
 			logerrx("%s: IA Address option truncated", ifp->name);
 			continue;
 		}
-		memcpy(&ia, o, sizeof(ia));
+		memcpy(&ia, oe->data, sizeof(ia));
 		ia.pltime = ntohl(ia.pltime);
 		ia.vltime = ntohl(ia.vltime);
 		/* RFC 3315 22.6 */
@@ -2194,10 +2649,12 @@ dhcp6_findna(struct interface *ifp, uint16_t ot, const uint8_t *iaid,
 #ifndef SMALL
 static int
 dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
-    uint8_t *d, size_t l, const struct timespec *acquired)
+    const struct dhcp6_optindex *idx, const struct dhcp6_optent *ioe,
+    const struct timespec *acquired)
 {
 	struct dhcp6_state *state;
-	uint8_t *o, *nd;
+	struct dhcp6_optent *oe;
+	uint8_t *o;
 	struct ipv6_addr *a;
 	int i;
 	uint8_t nb, *pw;
@@ -2207,18 +2664,17 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 
 	i = 0;
 	state = D6_STATE(ifp);
-	while ((o = dhcp6_findoption(d, l, D6_OPTION_IAPREFIX, &ol))) {
-		/* Set d and l first to ensure we find the next option. */
-		nd = o + ol;
-		l -= (size_t)(nd - d);
-		d = nd;
-		if (ol < sizeof(pdp)) {
+	for (oe = dhcp6_optnext(idx, ioe, NULL, D6_OPTION_IAPREFIX);
+	    oe != NULL;
+	    oe = dhcp6_optnext(idx, ioe, oe, D6_OPTION_IAPREFIX))
+	{
+		if (oe->len < sizeof(pdp)) {
 			errno = EINVAL;
 			logerrx("%s: IA Prefix option truncated", ifp->name);
 			continue;
 		}
 
-		memcpy(&pdp, o, sizeof(pdp));
+		memcpy(&pdp, oe->data, sizeof(pdp));
 		pdp.pltime = ntohl(pdp.pltime);
 		pdp.vltime = ntohl(pdp.vltime);
 		/* RFC 3315 22.6 */
@@ -2230,9 +2686,6 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 			continue;
 		}
 
-		o += sizeof(pdp);
-		ol = (uint16_t)(ol - sizeof(pdp));
-
 		/* pdp.prefix is not aligned so copy it out. */
 		memcpy(&pdp_prefix, &pdp.prefix, sizeof(pdp_prefix));
 		TAILQ_FOREACH(a, &state->addrs, next) {
@@ -2272,7 +2725,7 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 
 		a->prefix_exclude_len = 0;
 		memset(&a->prefix_exclude, 0, sizeof(a->prefix_exclude));
-		o = dhcp6_findoption(o, ol, D6_OPTION_PD_EXCLUDE, &ol);
+		o = dhcp6_optfind(idx, oe, D6_OPTION_PD_EXCLUDE, &ol);
 		if (o == NULL)
 			continue;
 
@@ -2316,13 +2769,12 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 #endif
 
 static int
-dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
+dhcp6_findia(struct interface *ifp, const struct dhcp6_optindex *idx,
     const char *sfrom, const struct timespec *acquired)
 {
 	struct dhcp6_state *state;
 	const struct if_options *ifo;
-	struct dhcp6_option o;
-	uint8_t *d, *p;
+	struct dhcp6_optent *oe;
 	struct dhcp6_ia_na ia;
 	int i, e, error;
 	size_t j;
@@ -2332,13 +2784,6 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 	struct ipv6_addr *ap;
 	struct if_ia *ifia;
 
-	if (l < sizeof(*m)) {
-		/* Should be impossible with guards at packet in
-		 * and reading leases */
-		errno = EINVAL;
-		return -1;
-	}
-
 	ifo = ifp->options;
 	i = e = 0;
 	state = D6_STATE(ifp);
@@ -2347,22 +2792,16 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			ap->flags |= IPV6_AF_STALE;
 	}
 
-	d = (uint8_t *)m + sizeof(*m);
-	l -= sizeof(*m);
-	while (l > sizeof(o)) {
-		memcpy(&o, d, sizeof(o));
-		o.len = ntohs(o.len);
-		if (o.len > l || sizeof(o) + o.len > l) {
-			errno = EINVAL;
-			logerrx("%s: option overflow", ifp->name);
-			break;
-		}
-		p = d + sizeof(o);
-		d = p + o.len;
-		l -= sizeof(o) + o.len;
+	if (idx->truncated) {
+		errno = EINVAL;
+		logerrx("%s: option overflow", ifp->name);
+	}
 
-		o.code = ntohs(o.code);
-		switch(o.code) {
+	for (oe = dhcp6_optnext(idx, NULL, NULL, 0);
+	    oe != NULL;
+	    oe = dhcp6_optnext(idx, NULL, oe, 0))
+	{
+		switch(oe->code) {
 		case D6_OPTION_IA_TA:
 			nl = 4;
 			break;
@@ -2373,19 +2812,17 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 		default:
 			continue;
 		}
-		if (o.len < nl) {
+		if (oe->len < nl) {
 			errno = EINVAL;
 			logerrx("%s: IA option truncated", ifp->name);
 			continue;
 		}
 
-		memcpy(&ia, p, nl);
-		p += nl;
-		o.len = (uint16_t)(o.len - nl);
+		memcpy(&ia, oe->data, nl);
 
 		for (j = 0; j < ifo->ia_len; j++) {
 			ifia = &ifo->ia[j];
-			if (ifia->ia_type == o.code &&
+			if (ifia->ia_type == oe->code &&
 			    memcmp(ifia->iaid, ia.iaid, sizeof(ia.iaid)) == 0)
 				break;
 		}
@@ -2399,7 +2836,7 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			continue;
 		}
 
-		if (o.code != D6_OPTION_IA_TA) {
+		if (oe->code != D6_OPTION_IA_TA) {
 			ia.t1 = ntohl(ia.t1);
 			ia.t2 = ntohl(ia.t2);
 			/* RFC 3315 22.4 */
@@ -2413,15 +2850,15 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			}
 		} else
 			ia.t1 = ia.t2 = 0; /* appease gcc */
-		if ((error = dhcp6_checkstatusok(ifp, NULL, p, o.len)) != 0) {
+		if ((error = dhcp6_checkstatusok(ifp, idx, oe)) != 0) {
 			if (error == D6_STATUS_NOBINDING)
 				state->has_no_binding = true;
 			e = 1;
 			continue;
 		}
-		if (o.code == D6_OPTION_IA_PD) {
+		if (oe->code == D6_OPTION_IA_PD) {
 #ifndef SMALL
-			if (dhcp6_findpd(ifp, ia.iaid, p, o.len,
+			if (dhcp6_findpd(ifp, ia.iaid, idx, oe,
 					 acquired) == 0)
 			{
 				logwarnx("%s: %s: DHCPv6 REPLY missing Prefix",
@@ -2430,7 +2867,7 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			}
 #endif
 		} else {
-			if (dhcp6_findna(ifp, o.code, ia.iaid, p, o.len,
+			if (dhcp6_findna(ifp, oe->code, ia.iaid, idx, oe,
 					 acquired) == 0)
 			{
 				logwarnx("%s: %s: DHCPv6 REPLY missing "
@@ -2439,7 +2876,7 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 				continue;
 			}
 		}
-		if (o.code != D6_OPTION_IA_TA) {
+		if (oe->code != D6_OPTION_IA_TA) {
 			if (ia.t1 != 0 &&
 			    (ia.t1 < state->renew || state->renew == 0))
 				state->renew = ia.t1;
@@ -2539,10 +2976,11 @@ dhcp6_deprecateaddrs(struct ipv6_addrhead *addrs)
 
 static int
 dhcp6_validatelease(struct interface *ifp,
-    struct dhcp6_message *m, size_t len,
+    struct dhcp6_message *m, size_t len, const struct dhcp6_optindex *idx,
     const char *sfrom, const struct timespec *acquired)
 {
 	struct dhcp6_state *state;
+	struct dhcp6_optindex lidx;
 	int nia, ok_errno;
 	struct timespec aq;
 
@@ -2551,9 +2989,19 @@ dhcp6_validatelease(struct interface *ifp,
 		return -1;
 	}
 
+	if (idx == NULL) {
+		if (dhcp6_optindex_init(&lidx, m, len) == -1) {
+			logerr(__func__);
+			return -1;
+		}
+		nia = dhcp6_validatelease(ifp, m, len, &lidx, sfrom, acquired);
+		dhcp6_optindex_free(&lidx);
+		return nia;
+	}
+
 	state = D6_STATE(ifp);
 	errno = 0;
-	if (dhcp6_checkstatusok(ifp, m, NULL, len) != 0)
+	if (dhcp6_checkstatusok(ifp, idx, NULL) != 0)
 		return -1;
 	ok_errno = errno;
 
@@ -2564,7 +3012,7 @@ dhcp6_validatelease(struct interface *ifp,
 		acquired = &aq;
 	}
 	state->has_no_binding = false;
-	nia = dhcp6_findia(ifp, m, len, sfrom, acquired);
+	nia = dhcp6_findia(ifp, idx, sfrom, acquired);
 	if (nia == 0) {
 		if (state->state != DH6S_CONFIRM && ok_errno != 0) {
 			logerrx("%s: no useable IA found in lease", ifp->name);
@@ -2576,9 +3024,15 @@ dhcp6_validatelease(struct interface *ifp,
 		 * IA's must have existed here otherwise we would
 		 * have rejected it earlier. */
 		assert(state->new != NULL && state->new_len != 0);
+		if (dhcp6_optindex_init(&lidx, state->new,
+		    state->new_len) == -1)
+		{
+			logerr(__func__);
+			return -1;
+		}
 		state->has_no_binding = false;
-		nia = dhcp6_findia(ifp, state->new, state->new_len,
-		    sfrom, acquired);
+		nia = dhcp6_findia(ifp, &lidx, sfrom, acquired);
+		dhcp6_optindex_free(&lidx);
 	}
 	return nia;
 }
@@ -2606,8 +3060,8 @@ dhcp6_readlease(struct interface *ifp, int validate)
 	} else {
 		logdebugx("%s: reading lease: %s",
 		    ifp->name, state->leasefile);
-		bytes = dhcp_readfile(ifp->ctx, state->leasefile,
-		    buf.buf, sizeof(buf.buf));
+		bytes = dhcp_readlease(ifp->ctx, state->leasefile,
+		    buf.buf, sizeof(buf.buf), &mtime);
 	}
 	if (bytes == -1)
 		goto ex;
@@ -2623,15 +3077,13 @@ dhcp6_readlease(struct interface *ifp, int validate)
 	if (!validate)
 		goto auth;
 
-	if (dhcp_filemtime(ifp->ctx, state->leasefile, &mtime) == -1)
-		goto ex;
 	clock_gettime(CLOCK_MONOTONIC, &state->acquired);
 	if ((now = time(NULL)) == -1)
 		goto ex;
 	state->acquired.tv_sec -= now - mtime;
 
 	/* Check to see if the lease is still valid */
-	fd = dhcp6_validatelease(ifp, &buf.dhcp6, (size_t)bytes, NULL,
+	fd = dhcp6_validatelease(ifp, &buf.dhcp6, (size_t)bytes, NULL, NULL,
 	    &state->acquired);
 	if (fd == -1)
 		goto ex;
@@ -2692,6 +3144,42 @@ ex:
 	return bytes == 0 ? 0 : -1;
 }
 
+/*
+ * A restart handed the lease over with its addresses still configured,
+ * so bind it again without a confirm unless it is time to renew.
+ */
+static bool
+dhcp6_resume(struct interface *ifp)
+{
+	struct dhcp6_state *state = D6_STATE(ifp);
+	struct ipv6_addr *ia;
+	struct timespec now;
+	uint32_t renew;
+
+	if (!handoff_take(ifp, AF_INET6, NULL))
+		return false;
+
+	renew = state->renew;
+	if (renew == 0 && state->lowpl != ND6_INFINITE_LIFETIME)
+		renew = (uint32_t)(state->lowpl * 0.5);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (renew != 0 && renew != ND6_INFINITE_LIFETIME &&
+	    eloop_timespec_diff(&now, &state->acquired, NULL) >= renew)
+		return false;
+
+	TAILQ_FOREACH(ia, &state->addrs, next) {
+		if (ia->flags & (IPV6_AF_STALE | IPV6_AF_DELEGATEDPFX))
+			continue;
+		if (ipv6_iffindaddr(ifp, &ia->addr, IN6_IFF_NOTUSEABLE) == NULL)
+			return false;
+	}
+
+	loginfox("%s: resuming DHCPv6 lease", ifp->name);
+	state->state = DH6S_CONFIRM;
+	dhcp6_bind(ifp, "handoff", NULL);
+	return true;
+}
+
 static void
 dhcp6_startinit(struct interface *ifp)
 {
@@ -2704,6 +3192,9 @@ dhcp6_startinit(struct interface *ifp)
 	state->state = DH6S_INIT;
 	state->expire = ND6_INFINITE_LIFETIME;
 	state->lowpl = ND6_INFINITE_LIFETIME;
+#ifndef SMALL
+	clock_gettime(CLOCK_MONOTONIC, &state->start_time);
+#endif
 
 	dhcp6_addrequestedaddrs(ifp);
 	has_ta = has_non_ta = 0;
@@ -2728,6 +3219,8 @@ dhcp6_startinit(struct interface *ifp)
 		} else if (r != 0 &&
 		    !(ifp->options->options & DHCPCD_ANONYMOUS))
 		{
+			if (dhcp6_resume(ifp))
+				return;
 			/* RFC 3633 section 12.1 */
 #ifndef SMALL
 			if (dhcp6_hasprefixdelegation(ifp))
@@ -2841,7 +3334,10 @@ dhcp6_script_try_run(struct interface *ifp, int delegated)
 			if (!(ap->flags & IPV6_AF_DADCOMPLETED) &&
 			    ipv6_iffindaddr(ap->iface, &ap->addr,
 					    IN6_IFF_TENTATIVE))
+			{
 				ap->flags |= IPV6_AF_DADCOMPLETED;
+				dhcp6_dadforget(ap);
+			}
 			if ((ap->flags & IPV6_AF_DADCOMPLETED) == 0
 #ifndef SMALL
 			    && ((delegated && ap->delegating_prefix) ||
@@ -2870,104 +3366,147 @@ dhcp6_find_delegates(__unused struct interface *ifp)
 	return 0;
 }
 #else
+/*
+ * Downstream interfaces are looked up by name for each SLA rather than
+ * every interface being matched against every prefix, IA and SLA.
+ * Addresses are then added to each of them once they are all found.
+ */
+struct dhcp6_delegate {
+	rb_node_t dd_tree;
+	struct interface *dd_ifp;
+	size_t dd_naddrs;
+	bool dd_nocarrier;
+};
+
+static int
+dhcp6_cmpdelegate(__unused void *context, const void *node, const void *key)
+{
+	const struct dhcp6_delegate *dd = node;
+
+	return strcmp(dd->dd_ifp->name, key);
+}
+
+static int
+dhcp6_cmpdelegatenode(void *context, const void *node1, const void *node2)
+{
+	const struct dhcp6_delegate *dd2 = node2;
+
+	return dhcp6_cmpdelegate(context, node1, dd2->dd_ifp->name);
+}
+
+static const rb_tree_ops_t dhcp6_delegate_ops = {
+	.rbto_compare_nodes = dhcp6_cmpdelegatenode,
+	.rbto_compare_key = dhcp6_cmpdelegate,
+	.rbto_node_offset = offsetof(struct dhcp6_delegate, dd_tree),
+	.rbto_context = NULL
+};
+
+static void
+dhcp6_delegate_addr(struct dhcp6_delegate *dd, struct ipv6_addr *prefix,
+    const struct if_sla *sla, struct if_ia *ia)
+{
+
+	if (dd->dd_nocarrier)
+		return;
+	if (!if_is_link_up(dd->dd_ifp)) {
+		logdebugx("%s: has no carrier, cannot delegate addresses",
+		    dd->dd_ifp->name);
+		dd->dd_nocarrier = true;
+		return;
+	}
+	if (dhcp6_ifdelegateaddr(dd->dd_ifp, prefix, sla, ia))
+		dd->dd_naddrs++;
+}
+
 static void
 dhcp6_delegate_prefix(struct interface *ifp)
 {
+	struct dhcpcd_ctx *ctx = ifp->ctx;
 	struct if_options *ifo;
 	struct dhcp6_state *state;
 	struct ipv6_addr *ap;
-	size_t i, j, k;
+	size_t i, j, n, nd;
 	struct if_ia *ia;
 	struct if_sla *sla;
 	struct interface *ifd;
-	bool carrier_warned;
+	struct dhcp6_delegate *dds, *dd;
+	rb_tree_t tree;
+	int loglevel;
 
 	ifo = ifp->options;
 	state = D6_STATE(ifp);
 
-	/* Clear the logged flag. */
-	TAILQ_FOREACH(ap, &state->addrs, next) {
-		ap->flags &= ~IPV6_AF_DELEGATEDLOG;
+	nd = 0;
+	TAILQ_FOREACH(ifd, ctx->ifaces, next) {
+		nd++;
 	}
-
-	TAILQ_FOREACH(ifd, ifp->ctx->ifaces, next) {
+	if ((dds = reallocarray(NULL, nd, sizeof(*dds))) == NULL) {
+		logerr(__func__);
+		return;
+	}
+	rb_tree_init(&tree, &dhcp6_delegate_ops);
+	nd = 0;
+	TAILQ_FOREACH(ifd, ctx->ifaces, next) {
 		if (!ifd->active)
 			continue;
 		if (!(ifd->options->options & DHCPCD_CONFIGURE))
 			continue;
-		k = 0;
-		carrier_warned = false;
-		TAILQ_FOREACH(ap, &state->addrs, next) {
-			if (!(ap->flags & IPV6_AF_DELEGATEDPFX))
-				continue;
-			if (!(ap->flags & IPV6_AF_DELEGATEDLOG)) {
-				int loglevel;
+		dd = &dds[nd++];
+		dd->dd_ifp = ifd;
+		dd->dd_naddrs = 0;
+		dd->dd_nocarrier = false;
+		rb_tree_insert_node(&tree, dd);
+	}
 
-				if (ap->flags & IPV6_AF_NEW)
-					loglevel = LOG_INFO;
-				else
-					loglevel = LOG_DEBUG;
-				/* We only want to log this the once as we loop
-				 * through many interfaces first. */
-				ap->flags |= IPV6_AF_DELEGATEDLOG;
-				logmessage(loglevel, "%s: delegated prefix %s",
-				    ifp->name, ap->saddr);
-				ap->flags &= ~IPV6_AF_NEW;
+	TAILQ_FOREACH(ap, &state->addrs, next) {
+		if (!(ap->flags & IPV6_AF_DELEGATEDPFX))
+			continue;
+		loglevel = ap->flags & IPV6_AF_NEW ? LOG_INFO : LOG_DEBUG;
+		logmessage(loglevel, "%s: delegated prefix %s",
+		    ifp->name, ap->saddr);
+		ap->flags &= ~IPV6_AF_NEW;
+
+		for (i = 0; i < ifo->ia_len; i++) {
+			ia = &ifo->ia[i];
+			if (ia->ia_type != D6_OPTION_IA_PD)
+				continue;
+			if (memcmp(ia->iaid, ap->iaid, sizeof(ia->iaid)))
+				continue;
+			/* No SLA configured, so lets automate it. */
+			if (ia->sla_len == 0) {
+				for (n = 0; n < nd; n++)
+					dhcp6_delegate_addr(&dds[n], ap,
+					    NULL, ia);
+				continue;
 			}
-			for (i = 0; i < ifo->ia_len; i++) {
-				ia = &ifo->ia[i];
-				if (ia->ia_type != D6_OPTION_IA_PD)
-					continue;
-				if (memcmp(ia->iaid, ap->iaid,
-				    sizeof(ia->iaid)))
-					continue;
-				if (ia->sla_len == 0) {
-					/* no SLA configured, so lets
-					 * automate it */
-					if (!if_is_link_up(ifd)) {
-						logdebugx(
-						    "%s: has no carrier, cannot"
-						    " delegate addresses",
-						    ifd->name);
-						carrier_warned = true;
-						break;
-					}
-					if (dhcp6_ifdelegateaddr(ifd, ap,
-					    NULL, ia))
-						k++;
-				}
-				for (j = 0; j < ia->sla_len; j++) {
-					sla = &ia->sla[j];
-					if (strcmp(ifd->name, sla->ifname))
-						continue;
-					if (!if_is_link_up(ifd)) {
-						logdebugx(
-						    "%s: has no carrier, cannot"
-						    " delegate addresses",
-						    ifd->name);
-						carrier_warned = true;
-						break;
-					}
-					if (dhcp6_ifdelegateaddr(ifd, ap,
-					    sla, ia))
-						k++;
-				}
-				if (carrier_warned)
-					break;
+			for (j = 0; j < ia->sla_len; j++) {
+				sla = &ia->sla[j];
+				dd = rb_tree_find_node(&tree, sla->ifname);
+				if (dd != NULL)
+					dhcp6_delegate_addr(dd, ap, sla, ia);
 			}
-			if (carrier_warned)
-				break;
 		}
-		if (k && !carrier_warned) {
-			struct dhcp6_state *s = D6_STATE(ifd);
+	}
 
-			ipv6_addaddrs(&s->addrs);
-			dhcp6_script_try_run(ifd, 1);
+	/* ipv6_addaddrs batches each interface so it can be rolled back. */
+	for (n = 0; n < nd; n++) {
+		dd = &dds[n];
+		if (dd->dd_naddrs != 0 && !dd->dd_nocarrier)
+		{
+			ipv6_addaddrs(&D6_STATE(dd->dd_ifp)->addrs);
+			dhcp6_dadstart(dd->dd_ifp);
 		}
 	}
 
+	for (n = 0; n < nd; n++) {
+		dd = &dds[n];
+		if (dd->dd_naddrs != 0 && !dd->dd_nocarrier)
+			dhcp6_script_try_run(dd->dd_ifp, 1);
+	}
+	free(dds);
+
 	/* Now all addresses have been added, rebuild the routing table. */
-	rt_build(ifp->ctx, AF_INET6);
+	rt_schedule(ctx, AF_INET6);
 }
 
 static void
@@ -2992,25 +3531,26 @@ dhcp6_find_delegates(struct interface *ifp)
 	    !(ifp->options->options & DHCPCD_CONFIGURE))
 		return 0;
 
+	/* Find the SLAs naming us before looking at any prefixes. */
 	k = 0;
 	TAILQ_FOREACH(ifd, ifp->ctx->ifaces, next) {
 		ifo = ifd->options;
 		state = D6_STATE(ifd);
 		if (state == NULL || state->state != DH6S_BOUND)
 			continue;
-		TAILQ_FOREACH(ap, &state->addrs, next) {
-			if (!(ap->flags & IPV6_AF_DELEGATEDPFX))
+		for (i = 0; i < ifo->ia_len; i++) {
+			ia = &ifo->ia[i];
+			if (ia->ia_type != D6_OPTION_IA_PD)
 				continue;
-			for (i = 0; i < ifo->ia_len; i++) {
-				ia = &ifo->ia[i];
-				if (ia->ia_type != D6_OPTION_IA_PD)
+			for (j = 0; j < ia->sla_len; j++) {
+				sla = &ia->sla[j];
+				if (strcmp(ifp->name, sla->ifname))
 					continue;
-				if (memcmp(ia->iaid, ap->iaid,
-				    sizeof(ia->iaid)))
-					continue;
-				for (j = 0; j < ia->sla_len; j++) {
-					sla = &ia->sla[j];
-					if (strcmp(ifp->name, sla->ifname))
+				TAILQ_FOREACH(ap, &state->addrs, next) {
+					if (!(ap->flags & IPV6_AF_DELEGATEDPFX))
+						continue;
+					if (memcmp(ia->iaid, ap->iaid,
+					    sizeof(ia->iaid)))
 						continue;
 					if (ipv6_linklocal(ifp) == NULL) {
 						logdebugx(
@@ -3035,7 +3575,8 @@ dhcp6_find_delegates(struct interface *ifp)
 		state = D6_STATE(ifp);
 		state->state = DH6S_DELEGATED;
 		ipv6_addaddrs(&state->addrs);
-		rt_build(ifp->ctx, AF_INET6);
+		dhcp6_dadstart(ifp);
+		rt_schedule(ifp->ctx, AF_INET6);
 		dhcp6_script_try_run(ifp, 1);
 	}
 	return k;
@@ -3066,8 +3607,9 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 	state->new_start = false;
 
 	if (!timedout) {
-		logmessage(loglevel, "%s: %s received from %s",
-		    ifp->name, op, sfrom);
+		if (sfrom != NULL)
+			logmessage(loglevel, "%s: %s received from %s",
+			    ifp->name, op, sfrom);
 #ifndef SMALL
 		/* If we delegated from an unconfirmed lease we MUST drop
 		 * them now. Hopefully we have new delegations. */
@@ -3213,19 +3755,21 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 		state->failed = false;
 
 		if (state->renew && state->renew != ND6_INFINITE_LIFETIME)
-			eloop_timeout_add_sec(ifp->ctx->eloop,
-			    state->renew,
+			eloop_timeout_add_slack(ifp->ctx->eloop,
+			    state->renew, DHCP6_RENEW_SLACK,
 			    state->state == DH6S_INFORMED ?
 			    dhcp6_startinform : dhcp6_startrenew, ifp);
 		if (state->rebind && state->rebind != ND6_INFINITE_LIFETIME)
-			eloop_timeout_add_sec(ifp->ctx->eloop,
-			    state->rebind, dhcp6_startrebind, ifp);
+			eloop_timeout_add_slack(ifp->ctx->eloop,
+			    state->rebind, DHCP6_RENEW_SLACK,
+			    dhcp6_startrebind, ifp);
 		if (state->expire != ND6_INFINITE_LIFETIME)
 			eloop_timeout_add_sec(ifp->ctx->eloop,
 			    state->expire, dhcp6_startexpire, ifp);
 
 		if (ifp->options->options & DHCPCD_CONFIGURE) {
 			ipv6_addaddrs(&state->addrs);
+			dhcp6_dadstart(ifp);
 			if (!timedout)
 				dhcp6_deprecateaddrs(&state->addrs);
 		}
@@ -3247,13 +3791,13 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 		else
 			logmessage(loglevel, "%s: expire in %"PRIu32" seconds",
 			    ifp->name, state->expire);
-		rt_build(ifp->ctx, AF_INET6);
+		rt_schedule(ifp->ctx, AF_INET6);
 		if (!confirmed && !timedout) {
 			logdebugx("%s: writing lease: %s",
 			    ifp->name, state->leasefile);
-			if (dhcp_writefile(ifp->ctx, state->leasefile, 0640,
+			if (dhcp_writelease(ifp->ctx, state->leasefile, 0640,
 			    state->new, state->new_len) == -1)
-				logerr("dhcp_writefile: %s",state->leasefile);
+				logerr("dhcp_writelease: %s",state->leasefile);
 		}
 #ifndef SMALL
 		dhcp6_delegate_prefix(ifp);
@@ -3269,9 +3813,116 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 	}
 }
 
+#ifndef SMALL
+static const char * const dhcp6_timingnames[DH6T_MAX] = {
+	"solicit", "request", "confirm", "renew", "rebind", "inform", "bound",
+};
+
+const char *
+dhcp6_timingname(unsigned int t)
+{
+
+	return t < DH6T_MAX ? dhcp6_timingnames[t] : NULL;
+}
+
+static const char * const dhcp6_statenames[] = {
+	"init", "discover", "request", "bound", "renew", "rebind", "confirm",
+	"inform", "informed", "renew_requested", "probe", "decline",
+	"delegated", "release", "released",
+};
+
+const char *
+dhcp6_statename(enum DH6S s)
+{
+
+	return (size_t)s < __arraycount(dhcp6_statenames) ?
+	    dhcp6_statenames[s] : "unknown";
+}
+
+static void
+dhcp6_timed(struct dhcp6_state *state, enum DH6T t,
+    const struct timespec *from)
+{
+	struct dhcp6_timing *dt = &state->timings[t];
+	struct timespec now;
+	unsigned long long secs;
+	unsigned int nsecs, ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = eloop_timespec_diff(&now, from, &nsecs);
+	if (secs >= UINT_MAX / MSEC_PER_SEC)
+		ms = UINT_MAX;
+	else
+		ms = (unsigned int)secs * MSEC_PER_SEC + nsecs / NSEC_PER_MSEC;
+	dt->dt_ms[dt->dt_n++ % DHCP6_TIMINGS] = ms;
+}
+
+/* Note how long the exchange being answered took. */
+static void
+dhcp6_timereply(struct dhcp6_state *state)
+{
+	enum DH6T t;
+
+	switch (state->send->type) {
+	case DHCP6_SOLICIT:
+		t = DH6T_SOLICIT;
+		break;
+	case DHCP6_REQUEST:
+		t = DH6T_REQUEST;
+		break;
+	case DHCP6_CONFIRM:
+		t = DH6T_CONFIRM;
+		break;
+	case DHCP6_RENEW:
+		t = DH6T_RENEW;
+		break;
+	case DHCP6_REBIND:
+		t = DH6T_REBIND;
+		break;
+	case DHCP6_INFORMATION_REQ:
+		t = DH6T_INFORM;
+		break;
+	default:
+		return;
+	}
+	dhcp6_timed(state, t, &state->started);
+}
+
+static int
+dhcp6_cmpms(const void *a, const void *b)
+{
+	unsigned int ma = *(const unsigned int *)a;
+	unsigned int mb = *(const unsigned int *)b;
+
+	if (ma < mb)
+		return -1;
+	return ma > mb ? 1 : 0;
+}
+
+/* Nearest rank percentiles of the times kept. */
+void
+dhcp6_timingstats(const struct dhcp6_timing *dt, unsigned int *p50,
+    unsigned int *p90, unsigned int *max)
+{
+	unsigned int ms[DHCP6_TIMINGS];
+	size_t n;
+
+	n = dt->dt_n < DHCP6_TIMINGS ? (size_t)dt->dt_n : DHCP6_TIMINGS;
+	if (n == 0) {
+		*p50 = *p90 = *max = 0;
+		return;
+	}
+	memcpy(ms, dt->dt_ms, n * sizeof(ms[0]));
+	qsort(ms, n, sizeof(ms[0]), dhcp6_cmpms);
+	*p50 = ms[(n + 1) / 2 - 1];
+	*p90 = ms[(n * 9 + 9) / 10 - 1];
+	*max = ms[n - 1];
+}
+#endif
+
 static void
 dhcp6_recvif(struct interface *ifp, const char *sfrom,
-    struct dhcp6_message *r, size_t len)
+    struct dhcp6_message *r, size_t len, const struct dhcp6_optindex *idx)
 {
 	struct dhcpcd_ctx *ctx;
 	size_t i;
@@ -3305,7 +3956,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 		return;
 	}
 
-	if (dhcp6_findmoption(r, len, D6_OPTION_SERVERID, NULL) == NULL) {
+	if (dhcp6_optfind(idx, NULL, D6_OPTION_SERVERID, NULL) == NULL) {
 		logdebugx("%s: no DHCPv6 server ID from %s", ifp->name, sfrom);
 		return;
 	}
@@ -3316,14 +3967,14 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 	    i++, opt++)
 	{
 		if (has_option_mask(ifo->requiremask6, opt->option) &&
-		    !dhcp6_findmoption(r, len, (uint16_t)opt->option, NULL))
+		    !dhcp6_optfind(idx, NULL, (uint16_t)opt->option, NULL))
 		{
 			logwarnx("%s: reject DHCPv6 (no option %s) from %s",
 			    ifp->name, opt->var, sfrom);
 			return;
 		}
 		if (has_option_mask(ifo->rejectmask6, opt->option) &&
-		    dhcp6_findmoption(r, len, (uint16_t)opt->option, NULL))
+		    dhcp6_optfind(idx, NULL, (uint16_t)opt->option, NULL))
 		{
 			logwarnx("%s: reject DHCPv6 (option %s) from %s",
 			    ifp->name, opt->var, sfrom);
@@ -3333,7 +3984,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 
 #ifdef AUTH
 	/* Authenticate the message */
-	auth = dhcp6_findmoption(r, len, D6_OPTION_AUTH, &auth_len);
+	auth = dhcp6_optfind(idx, NULL, D6_OPTION_AUTH, &auth_len);
 	if (auth != NULL) {
 		if (dhcp_auth_validate(&state->auth, &ifo->auth,
 		    (uint8_t *)r, len, 6, r->type, auth, auth_len) == NULL)
@@ -3363,11 +4014,12 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 	case DHCP6_REPLY:
 		switch(state->state) {
 		case DH6S_INFORM:
-			if (dhcp6_checkstatusok(ifp, r, NULL, len) != 0)
+			if (dhcp6_checkstatusok(ifp, idx, NULL) != 0)
 				return;
 			break;
 		case DH6S_CONFIRM:
-			if (dhcp6_validatelease(ifp, r, len, sfrom, NULL) == -1)
+			if (dhcp6_validatelease(ifp, r, len, idx,
+			    sfrom, NULL) == -1)
 			{
 				dhcp6_startdiscoinform(ifp);
 				return;
@@ -3378,8 +4030,8 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 			 * Normally we get an ADVERTISE for a DISCOVER. */
 			if (!has_option_mask(ifo->requestmask6,
 			    D6_OPTION_RAPID_COMMIT) ||
-			    !dhcp6_findmoption(r, len, D6_OPTION_RAPID_COMMIT,
-					      NULL))
+			    !dhcp6_optfind(idx, NULL, D6_OPTION_RAPID_COMMIT,
+					  NULL))
 			{
 				valid_op = false;
 				break;
@@ -3389,7 +4041,8 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 		case DH6S_REQUEST: /* FALLTHROUGH */
 		case DH6S_RENEW: /* FALLTHROUGH */
 		case DH6S_REBIND:
-			if (dhcp6_validatelease(ifp, r, len, sfrom, NULL) == -1)
+			if (dhcp6_validatelease(ifp, r, len, idx,
+			    sfrom, NULL) == -1)
 			{
 				/*
 				 * If we can't use the lease, fallback to
@@ -3440,7 +4093,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 			break;
 		}
 		/* RFC7083 */
-		o = dhcp6_findmoption(r, len, D6_OPTION_SOL_MAX_RT, &ol);
+		o = dhcp6_optfind(idx, NULL, D6_OPTION_SOL_MAX_RT, &ol);
 		if (o && ol == sizeof(uint32_t)) {
 			uint32_t max_rt;
 
@@ -3456,7 +4109,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 				logerr("%s: invalid SOL_MAX_RT %u",
 				    ifp->name, max_rt);
 		}
-		o = dhcp6_findmoption(r, len, D6_OPTION_INF_MAX_RT, &ol);
+		o = dhcp6_optfind(idx, NULL, D6_OPTION_INF_MAX_RT, &ol);
 		if (o && ol == sizeof(uint32_t)) {
 			uint32_t max_rt;
 
@@ -3472,7 +4125,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 				logerrx("%s: invalid INF_MAX_RT %u",
 				    ifp->name, max_rt);
 		}
-		if (dhcp6_validatelease(ifp, r, len, sfrom, NULL) == -1)
+		if (dhcp6_validatelease(ifp, r, len, idx, sfrom, NULL) == -1)
 			return;
 		break;
 	case DHCP6_RECONFIGURE:
@@ -3486,7 +4139,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 #ifdef AUTH
 		}
 		loginfox("%s: %s from %s", ifp->name, op, sfrom);
-		o = dhcp6_findmoption(r, len, D6_OPTION_RECONF_MSG, &ol);
+		o = dhcp6_optfind(idx, NULL, D6_OPTION_RECONF_MSG, &ol);
 		if (o == NULL) {
 			logerrx("%s: missing Reconfigure Message option",
 			    ifp->name);
@@ -3564,11 +4217,21 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 		else
 			loginfox("%s: ADV %s from %s",
 			    ifp->name, ia->saddr, sfrom);
+#ifndef SMALL
+		dhcp6_timereply(state);
+#endif
 		dhcp6_startrequest(ifp);
 		return;
 	}
 
 bind:
+#ifndef SMALL
+	dhcp6_timereply(state);
+	if (timespecisset(&state->start_time)) {
+		dhcp6_timed(state, DH6T_BOUND, &state->start_time);
+		timespecclear(&state->start_time);
+	}
+#endif
 	dhcp6_bind(ifp, op, sfrom);
 }
 
@@ -3581,8 +4244,10 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 	struct interface *ifp;
 	struct dhcp6_message *r;
 	const struct dhcp6_state *state;
+	struct dhcp6_optindex idx;
 	uint8_t *o;
 	uint16_t ol;
+	uint32_t xid;
 
 	inet_ntop(AF_INET6, &from->sin6_addr, sfrom, sizeof(sfrom));
 	if (len < sizeof(struct dhcp6_message)) {
@@ -3590,8 +4255,14 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 		return;
 	}
 
+	r = (struct dhcp6_message *)msg->msg_iov[0].iov_base;
+	xid = dhcp6_msgxid(r);
 	if (ia != NULL)
 		ifp = ia->iface;
+	else if (r->type != DHCP6_RECONFIGURE &&
+	    (state = rb_tree_find_node(&ctx->dhcp6_xids, &xid)) != NULL)
+		/* A shared socket, the xid tells us who is waiting. */
+		ifp = state->xid_ifp;
 	else {
 		ifp = if_findifpfromcmsg(ctx, msg, NULL);
 		if (ifp == NULL) {
@@ -3600,11 +4271,17 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 		}
 	}
 
-	r = (struct dhcp6_message *)msg->msg_iov[0].iov_base;
+	IF_STAT(ifp, IFS_DHCP6, rx);
+	PROBE3(dhcp6_recvmsg, ifp->name, r->type, xid);
+	if (dhcp6_optindex_init(&idx, r, len) == -1) {
+		logerr(__func__);
+		IF_STAT(ifp, IFS_DHCP6, drop);
+		return;
+	}
 
 	uint8_t duid[DUID_LEN], *dp;
 	size_t duid_len;
-	o = dhcp6_findmoption(r, len, D6_OPTION_CLIENTID, &ol);
+	o = dhcp6_optfind(&idx, NULL, D6_OPTION_CLIENTID, &ol);
 	if (ifp->options->options & DHCPCD_ANONYMOUS) {
 		duid_len = duid_make(duid, ifp, DUID_LL);
 		dp = duid;
@@ -3615,46 +4292,37 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 	if (o == NULL || ol != duid_len || memcmp(o, dp, ol) != 0) {
 		logdebugx("%s: incorrect client ID from %s",
 		    ifp->name, sfrom);
-		return;
+		goto drop;
 	}
 
-	if (dhcp6_findmoption(r, len, D6_OPTION_SERVERID, NULL) == NULL) {
+	if (dhcp6_optfind(&idx, NULL, D6_OPTION_SERVERID, NULL) == NULL) {
 		logdebugx("%s: no DHCPv6 server ID from %s",
 		    ifp->name, sfrom);
-		return;
+		goto drop;
 	}
 
 	if (r->type == DHCP6_RECONFIGURE) {
 		if (!IN6_IS_ADDR_LINKLOCAL(&from->sin6_addr)) {
 			logerrx("%s: RECONFIGURE6 recv from %s, not LL",
 			    ifp->name, sfrom);
-			return;
+			goto drop;
 		}
 		goto recvif;
 	}
 
 	state = D6_CSTATE(ifp);
-	if (state == NULL ||
+	if (state == NULL || state->send == NULL ||
 	    r->xid[0] != state->send->xid[0] ||
 	    r->xid[1] != state->send->xid[1] ||
 	    r->xid[2] != state->send->xid[2])
 	{
-		struct interface *ifp1;
 		const struct dhcp6_state *state1;
 
-		/* Find an interface with a matching xid. */
-		TAILQ_FOREACH(ifp1, ctx->ifaces, next) {
-			state1 = D6_CSTATE(ifp1);
-			if (state1 == NULL || state1->send == NULL)
-				continue;
-			if (r->xid[0] == state1->send->xid[0] &&
-			    r->xid[1] == state1->send->xid[1] &&
-			    r->xid[2] == state1->send->xid[2])
-				break;
-		}
-
-		if (ifp1 == NULL) {
-			if (state != NULL)
+		/* Find the interface with a matching xid. */
+		state1 = rb_tree_find_node(&ctx->dhcp6_xids, &xid);
+		if (state1 == NULL) {
+			IF_STAT(ifp, IFS_DHCP6, xid);
+			if (state != NULL && state->send != NULL)
 				logdebugx("%s: wrong xid 0x%02x%02x%02x"
 				    " (expecting 0x%02x%02x%02x) from %s",
 				    ifp->name,
@@ -3663,11 +4331,11 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 				    state->send->xid[1],
 				    state->send->xid[2],
 				    sfrom);
-			return;
+			goto drop;
 		}
 		logdebugx("%s: redirecting DHCP6 message to %s",
-		    ifp->name, ifp1->name);
-		ifp = ifp1;
+		    ifp->name, state1->xid_ifp->name);
+		ifp = state1->xid_ifp;
 	}
 
 #if 0
@@ -3689,7 +4357,7 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 	fd = open(fname, O_RDONLY, 0);
 	if (fd == -1) {
 		logerr("%s: open: %s", __func__, fname);
-		return;
+		goto out;
 	}
 	tlen = read(fd, tbuf, sizeof(tbuf));
 	if (tlen == -1)
@@ -3704,10 +4372,20 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 		memcpy(si2, si1, si_len2);
 	r = (struct dhcp6_message *)tbuf;
 	len = (size_t)tlen;
+	dhcp6_optindex_free(&idx);
+	if (dhcp6_optindex_init(&idx, r, len) == -1) {
+		logerr(__func__);
+		return;
+	}
 #endif
 
 recvif:
-	dhcp6_recvif(ifp, sfrom, r, len);
+	dhcp6_recvif(ifp, sfrom, r, len, &idx);
+	goto out;
+drop:
+	IF_STAT(ifp, IFS_DHCP6, drop);
+out:
+	dhcp6_optindex_free(&idx);
 }
 
 static void
@@ -3874,6 +4552,9 @@ dhcp6_start1(void *arg)
 	size_t i;
 	const struct dhcp_compat *dhc;
 
+	if (!pace_start(ifp, dhcp6_start1))
+		return;
+
 	if ((ctx->options & (DHCPCD_MANAGER|DHCPCD_PRIVSEP)) == DHCPCD_MANAGER &&
 	    ctx->dhcp6_rfd == -1)
 	{
@@ -3882,8 +4563,8 @@ dhcp6_start1(void *arg)
 			logerr(__func__);
 			return;
 		}
-		if (eloop_event_add(ctx->eloop, ctx->dhcp6_rfd, ELE_READ,
-		    dhcp6_recvctx, ctx) == -1)
+		if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH,
+		    ctx->dhcp6_rfd, ELE_READ, dhcp6_recvctx, ctx) == -1)
 			logerr("%s: eloop_event_add", __func__);
 	}
 
@@ -3895,14 +4576,19 @@ dhcp6_start1(void *arg)
 		}
 	}
 
+	if (if_optionmask6(&ifo->requestmask6) == NULL) {
+		logerr(__func__);
+		return;
+	}
+
 	state = D6_STATE(ifp);
 	/* If no DHCPv6 options are configured,
 	   match configured DHCPv4 options to DHCPv6 equivalents. */
-	for (i = 0; i < sizeof(ifo->requestmask6); i++) {
+	for (i = 0; i < OPTION_MASK6_LEN; i++) {
 		if (ifo->requestmask6[i] != '\0')
 			break;
 	}
-	if (i == sizeof(ifo->requestmask6)) {
+	if (i == OPTION_MASK6_LEN) {
 		for (dhc = dhcp_compats; dhc->dhcp_opt; dhc++) {
 			if (DHC_REQ(ifo->requestmask, ifo->nomask, dhc->dhcp_opt))
 				add_option_mask(ifo->requestmask6,
@@ -4052,6 +4738,7 @@ dhcp6_freedrop(struct interface *ifp, int drop, const char *reason)
 
 	if (ifp->ctx->eloop)
 		eloop_timeout_delete(ifp->ctx->eloop, NULL, ifp);
+	pace_delete(ifp, dhcp6_start1);
 
 #ifndef SMALL
 	/* If we're dropping the lease, drop delegated addresses.
@@ -4109,11 +4796,16 @@ dhcp6_freedrop(struct interface *ifp, int drop, const char *reason)
 			script_runreason(ifp, reason);
 		}
 		free(state->old);
+		dhcp6_freexid(ifp);
 		free(state->send);
 		free(state->recv);
+		script_freeenvcache(state->envcache, ENVCACHE_LEN);
 		free(state);
 		ifp->if_data[IF_DATA_DHCP6] = NULL;
 	}
+#ifdef HAVE_SENDMMSG
+	dhcp6_txdrop(ifp);
+#endif
 
 	/* If we don't have any more DHCP6 enabled interfaces,
 	 * close the global socket and release resources */
@@ -4129,6 +4821,13 @@ dhcp6_freedrop(struct interface *ifp, int drop, const char *reason)
 		close(ctx->dhcp6_rfd);
 		ctx->dhcp6_rfd = -1;
 	}
+#ifdef HAVE_SENDMMSG
+	if (ifp == NULL) {
+		eloop_timeout_delete(ctx->eloop, dhcp6_txflush, ctx);
+		free(ctx->dhcp6_txq);
+		ctx->dhcp6_txq = NULL;
+	}
+#endif
 }
 
 void
@@ -4204,8 +4903,9 @@ dhcp6_handleifa(int cmd, struct ipv6_addr *ia, pid_t pid)
 				ia->dhcp6_fd = dhcp6_openudp(ia->iface->index,
 				    &ia->addr);
 			if (ia->dhcp6_fd != -1 &&
-			    eloop_event_add(ia->iface->ctx->eloop,
-			    ia->dhcp6_fd, ELE_READ, dhcp6_recvaddr, ia) == -1)
+			    eloop_p_event_add(ia->iface->ctx->eloop,
+			    ELOOP_PRIO_HIGH, ia->dhcp6_fd, ELE_READ,
+			    dhcp6_recvaddr, ia) == -1)
 				logerr("%s: eloop_event_add", __func__);
 		}
 	}
@@ -4215,7 +4915,7 @@ dhcp6_handleifa(int cmd, struct ipv6_addr *ia, pid_t pid)
 }
 
 ssize_t
-dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
+dhcp6_envopts(FILE *fp, const char *prefix, const struct interface *ifp,
     const struct dhcp6_message *m, size_t len)
 {
 	const struct if_options *ifo;
@@ -4226,13 +4926,6 @@ dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
 	char *pfx;
 	uint32_t en;
 	const struct dhcpcd_ctx *ctx;
-#ifndef SMALL
-	const struct dhcp6_state *state;
-	const struct ipv6_addr *ap;
-#endif
-
-	if (m == NULL)
-		goto delegated;
 
 	if (len < sizeof(*m)) {
 		/* Should be impossible with guards at packet in
@@ -4280,12 +4973,8 @@ dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
 		o.code = ntohs(o.code);
 		if (has_option_mask(ifo->nomask6, o.code))
 			continue;
-		for (i = 0, opt = ifo->dhcp6_override;
-		    i < ifo->dhcp6_override_len;
-		    i++, opt++)
-			if (opt->option == o.code)
-				break;
-		if (i == ifo->dhcp6_override_len &&
+		opt = dhcp_optmap_find(&ifo->dhcp6_override_map, o.code);
+		if (opt == NULL &&
 		    o.code == D6_OPTION_VENDOR_OPTS &&
 		    o.len > sizeof(en))
 		{
@@ -4294,15 +4983,8 @@ dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
 			vo = vivso_find(en, ifp);
 		} else
 			vo = NULL;
-		if (i == ifo->dhcp6_override_len) {
-			for (i = 0, opt = ctx->dhcp6_opts;
-			    i < ctx->dhcp6_opts_len;
-			    i++, opt++)
-				if (opt->option == o.code)
-					break;
-			if (i == ctx->dhcp6_opts_len)
-				opt = NULL;
-		}
+		if (opt == NULL)
+			opt = dhcp_optmap_find(&ctx->dhcp6_optmap, o.code);
 		if (opt) {
 			dhcp_envoption(ifp->ctx,
 			    fp, pfx, ifp->name,
@@ -4318,9 +5000,17 @@ dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
 	}
 	free(pfx);
 
-delegated:
+	return 1;
+}
+
+/* Needed for Delegated Prefixes */
+ssize_t
+dhcp6_envdelegated(FILE *fp, const char *prefix, const struct interface *ifp)
+{
 #ifndef SMALL
-	/* Needed for Delegated Prefixes */
+	const struct dhcp6_state *state;
+	const struct ipv6_addr *ap;
+
 	state = D6_CSTATE(ifp);
 	TAILQ_FOREACH(ap, &state->addrs, next) {
 		if (ap->delegating_prefix)
@@ -4342,10 +5032,24 @@ delegated:
 	}
 	if (fputc('\0', fp) == EOF)
 		return -1;
+#else
+	UNUSED(fp);
+	UNUSED(prefix);
+	UNUSED(ifp);
 #endif
 
 	return 1;
 }
+
+ssize_t
+dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
+    const struct dhcp6_message *m, size_t len)
+{
+
+	if (m != NULL && dhcp6_envopts(fp, prefix, ifp, m, len) == -1)
+		return -1;
+	return dhcp6_envdelegated(fp, prefix, ifp);
+}
 #endif
 
 #ifndef SMALL
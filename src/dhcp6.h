@@ -151,11 +151,17 @@
 #define IRT_DEFAULT		86400
 #define IRT_MINIMUM		600
 
+/* For the renew and rebind timers, see eloop_q_timeout_add_slack. */
+#define	DHCP6_RENEW_SLACK	1000	/* msec */
+
 /* These should give -.1 to .1 randomness */
 #define	DHCP6_RAND_MIN		-100
 #define	DHCP6_RAND_MAX		100
 #define	DHCP6_RAND_DIV		1000.0f
 
+/* A message starts with the type and xid, then options. */
+#define	DHCP6_HDR_LEN		4
+
 enum DH6S {
 	DH6S_INIT,
 	DH6S_DISCOVER,
@@ -174,6 +180,26 @@ enum DH6S {
 	DH6S_RELEASED,
 };
 
+#ifndef SMALL
+/* The last few exchange times in milliseconds, for --dumpstats. */
+enum DH6T {
+	DH6T_SOLICIT,
+	DH6T_REQUEST,
+	DH6T_CONFIRM,
+	DH6T_RENEW,
+	DH6T_REBIND,
+	DH6T_INFORM,
+	DH6T_BOUND,	/* from starting until first bound */
+	DH6T_MAX
+};
+#define	DHCP6_TIMINGS		32
+
+struct dhcp6_timing {
+	unsigned long long dt_n;
+	unsigned int dt_ms[DHCP6_TIMINGS];
+};
+#endif
+
 struct dhcp6_state {
 	enum DH6S state;
 	struct timespec started;
@@ -193,12 +219,22 @@ struct dhcp6_state {
 
 	struct dhcp6_message *send;
 	size_t send_len;
+	size_t send_elapsed;	/* offset of the Elapsed Time data */
+#ifdef AUTH
+	size_t send_auth;	/* offset of the Authentication data */
+	uint16_t send_auth_len;
+#endif
+	rb_node_t xid_tree;	/* in ctx->dhcp6_xids while send is set */
+	struct interface *xid_ifp;
+	uint32_t xid;
+	bool xid_indexed;
 	struct dhcp6_message *recv;
 	size_t recv_len;
 	struct dhcp6_message *new;
 	size_t new_len;
 	struct dhcp6_message *old;
 	size_t old_len;
+	struct script_envcache *envcache;	/* rendered old and new */
 
 	struct timespec acquired;
 	uint32_t renew;
@@ -206,6 +242,8 @@ struct dhcp6_state {
 	uint32_t expire;
 	struct in6_addr unicast;
 	struct ipv6_addrhead addrs;
+	size_t dad_pending;	/* addresses waiting on DAD */
+	bool dad_duplicated;
 	uint32_t lowpl;
 	/* The +3 is for the possible .pd extension for prefix delegation */
 	char leasefile[sizeof(LEASEFILE6) + IF_NAMESIZE + (IF_SSIDLEN * 4) +3];
@@ -217,6 +255,10 @@ struct dhcp6_state {
 #ifdef AUTH
 	struct authstate auth;
 #endif
+#ifndef SMALL
+	struct timespec start_time;	/* for DH6T_BOUND */
+	struct dhcp6_timing timings[DH6T_MAX];
+#endif
 };
 
 #define D6_STATE(ifp)							       \
@@ -227,6 +269,7 @@ struct dhcp6_state {
 	(D6_CSTATE((ifp)) &&						       \
 	D6_CSTATE((ifp))->reason && dhcp6_dadcompleted((ifp)))
 
+void dhcp6_initxids(struct dhcpcd_ctx *);
 int dhcp6_openraw(void);
 int dhcp6_openudp(unsigned int, struct in6_addr *);
 void dhcp6_recvmsg(struct dhcpcd_ctx *, struct msghdr *, struct ipv6_addr *);
@@ -242,12 +285,22 @@ void dhcp6_reboot(struct interface *);
 void dhcp6_renew(struct interface *);
 ssize_t dhcp6_env(FILE *, const char *, const struct interface *,
     const struct dhcp6_message *, size_t);
+ssize_t dhcp6_envopts(FILE *, const char *, const struct interface *,
+    const struct dhcp6_message *, size_t);
+ssize_t dhcp6_envdelegated(FILE *, const char *, const struct interface *);
 void dhcp6_free(struct interface *);
 void dhcp6_handleifa(int, struct ipv6_addr *, pid_t);
 bool dhcp6_dadcompleted(const struct interface *);
+void dhcp6_dadforget(struct ipv6_addr *);
 void dhcp6_abort(struct interface *);
 void dhcp6_drop(struct interface *, const char *);
 int dhcp6_dump(struct interface *);
+#ifndef SMALL
+const char *dhcp6_timingname(unsigned int);
+const char *dhcp6_statename(enum DH6S);
+void dhcp6_timingstats(const struct dhcp6_timing *, unsigned int *,
+    unsigned int *, unsigned int *);
+#endif
 #endif /* DHCP6 */
 
 #endif /* DHCP6_H */
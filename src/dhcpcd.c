@@ -44,6 +44,7 @@ static const char dhcpcd_copyright[] = "Copyright (c) 2006-2021 Roy Marples";
 #include <limits.h>
 #include <paths.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -62,13 +63,17 @@ static const char dhcpcd_copyright[] = "Copyright (c) 2006-2021 Roy Marples";
 #include "dhcp6.h"
 #include "duid.h"
 #include "eloop.h"
+#include "handoff.h"
+#include "hooks.h"
 #include "if.h"
 #include "if-options.h"
 #include "ipv4.h"
 #include "ipv4ll.h"
 #include "ipv6.h"
 #include "ipv6nd.h"
+#include "leasedb.h"
 #include "logerr.h"
+#include "pace.h"
 #include "privsep.h"
 #include "script.h"
 
@@ -78,6 +83,9 @@ static const char dhcpcd_copyright[] = "Copyright (c) 2006-2021 Roy Marples";
 #ifdef HAVE_UTIL_H
 #include <util.h>
 #endif
+#ifdef HAVE_DLADDR
+#include <dlfcn.h>
+#endif
 
 #ifdef USE_SIGNALS
 const int dhcpcd_signals[] = {
@@ -121,6 +129,10 @@ printf("usage: "PACKAGE"\t[-146ABbDdEGgHJKLMNPpqTV]\n"
 	"       "PACKAGE"\t-n, --rebind [interface]\n"
 	"       "PACKAGE"\t-k, --release [interface]\n"
 	"       "PACKAGE"\t-U, --dumplease interface\n"
+	"       "PACKAGE"\t--dumpstats\n"
+	"       "PACKAGE"\t--dumpstate [interface]\n"
+	"       "PACKAGE"\t--dumpmem [interface]\n"
+	"       "PACKAGE"\t--restart\n"
 	"       "PACKAGE"\t--version\n"
 	"       "PACKAGE"\t-x, --exit [interface]\n");
 }
@@ -128,7 +140,9 @@ printf("usage: "PACKAGE"\t[-146ABbDdEGgHJKLMNPpqTV]\n"
 static void
 free_globals(struct dhcpcd_ctx *ctx)
 {
+#ifdef EMBEDDED_CONFIG
 	struct dhcp_opt *opt;
+#endif
 
 	if (ctx->ifac) {
 		for (; ctx->ifac > 0; ctx->ifac--)
@@ -149,7 +163,27 @@ free_globals(struct dhcpcd_ctx *ctx)
 		ctx->ifcv = NULL;
 	}
 
+#ifndef EMBEDDED_CONFIG
+	/* The embedded definitions are static tables */
+#ifdef INET
+	dhcp_optmap_free(&ctx->dhcp_optmap);
+	ctx->dhcp_opts = NULL;
+	ctx->dhcp_opts_len = 0;
+#endif
+#ifdef INET6
+	ctx->nd_opts = NULL;
+	ctx->nd_opts_len = 0;
+#ifdef DHCP6
+	dhcp_optmap_free(&ctx->dhcp6_optmap);
+	ctx->dhcp6_opts = NULL;
+	ctx->dhcp6_opts_len = 0;
+#endif
+#endif
+	ctx->vivso = NULL;
+	ctx->vivso_len = 0;
+#else
 #ifdef INET
+	dhcp_optmap_free(&ctx->dhcp_optmap);
 	if (ctx->dhcp_opts) {
 		for (opt = ctx->dhcp_opts;
 		    ctx->dhcp_opts_len > 0;
@@ -169,6 +203,7 @@ free_globals(struct dhcpcd_ctx *ctx)
 		ctx->nd_opts = NULL;
 	}
 #ifdef DHCP6
+	dhcp_optmap_free(&ctx->dhcp6_optmap);
 	if (ctx->dhcp6_opts) {
 		for (opt = ctx->dhcp6_opts;
 		    ctx->dhcp6_opts_len > 0;
@@ -187,6 +222,7 @@ free_globals(struct dhcpcd_ctx *ctx)
 		free(ctx->vivso);
 		ctx->vivso = NULL;
 	}
+#endif
 }
 
 static void
@@ -393,6 +429,8 @@ dhcpcd_drop(struct interface *ifp, int stop)
 #ifdef INET6
 	ipv6nd_drop(ifp);
 	ipv6_drop(ifp);
+	if (stop)
+		if_restore_inet6(ifp);
 #endif
 #ifdef IPV4LL
 	ipv4ll_drop(ifp);
@@ -420,8 +458,9 @@ stop_interface(struct interface *ifp, const char *reason)
 	dhcpcd_drop(ifp, 1);
 	script_runreason(ifp, reason == NULL ? "STOPPED" : reason);
 
-	/* Delete all timeouts for the interfaces */
+	/* Delete all timeouts and queued starts for the interface */
 	eloop_q_timeout_delete(ctx->eloop, ELOOP_QUEUE_ALL, NULL, ifp);
+	pace_delete(ifp, NULL);
 
 	/* De-activate the interface */
 	ifp->active = IF_INACTIVE;
@@ -452,8 +491,11 @@ configure_interface1(struct interface *ifp)
 			ifo->options |= DHCPCD_STATIC;
 	}
 
-	if (ifo->metric != -1)
+	/* The metric is part of the kernel route key. */
+	if (ifo->metric != -1 && ifp->metric != (unsigned int)ifo->metric) {
 		ifp->metric = (unsigned int)ifo->metric;
+		rt_invalidate(ifp->ctx);
+	}
 
 #ifdef INET6
 	/* We want to setup INET6 on the interface as soon as possible. */
@@ -569,6 +611,10 @@ configure_interface1(struct interface *ifp)
 	}
 #endif
 
+	/* Index the IAIDs so conflicts can be found without a scan. */
+	if (if_setiaids(ifp) == -1)
+		logerr(__func__);
+
 	/* If root is network mounted, we don't want to kill the connection
 	 * if the DHCP server goes the way of the dodo OR dhcpcd is rebooting
 	 * and the lease file has expired. */
@@ -824,32 +870,10 @@ static void
 warn_iaid_conflict(struct interface *ifp, uint16_t ia_type, uint8_t *iaid)
 {
 	struct interface *ifn;
-#ifdef INET6
-	size_t i;
-	struct if_ia *ia;
-#endif
-
-	TAILQ_FOREACH(ifn, ifp->ctx->ifaces, next) {
-		if (ifn == ifp || !ifn->active)
-			continue;
-		if (ifn->options->options & DHCPCD_ANONYMOUS)
-			continue;
-		if (ia_type == 0 &&
-		    memcmp(ifn->options->iaid, iaid,
-		    sizeof(ifn->options->iaid)) == 0)
-			break;
-#ifdef INET6
-		for (i = 0; i < ifn->options->ia_len; i++) {
-			ia = &ifn->options->ia[i];
-			if (ia->ia_type == ia_type &&
-			    memcmp(ia->iaid, iaid, sizeof(ia->iaid)) == 0)
-				break;
-		}
-#endif
-	}
 
 	/* This is only a problem if the interfaces are on the same network. */
-	if (ifn)
+	ifn = if_findiaid(ifp, ia_type, iaid);
+	if (ifn != NULL)
 		logerrx("%s: IAID conflicts with one assigned to %s",
 		    ifp->name, ifn->name);
 }
@@ -1029,15 +1053,99 @@ dhcpcd_activateinterface(struct interface *ifp, unsigned long long options)
 	dhcpcd_prestartinterface(ifp);
 }
 
+/*
+ * Discovers the interfaces in argv in one pass and adds or updates them.
+ * Returns the number found.
+ */
+static int
+dhcpcd_addinterfaces(struct dhcpcd_ctx *ctx, int action,
+    int argc, char * const *argv)
+{
+	struct ifaddrs *ifaddrs;
+	struct if_head *ifs;
+	struct interface *ifp, *iff, **iffs;
+	int i, n;
+
+	if ((iffs = calloc((size_t)argc, sizeof(*iffs))) == NULL) {
+		logerr(__func__);
+		return -1;
+	}
+
+	ifs = if_discover(ctx, &ifaddrs, -argc, argv);
+	if (ifs == NULL) {
+		logerr(__func__);
+		free(iffs);
+		return -1;
+	}
+
+	n = 0;
+	for (i = 0; i < argc; i++) {
+		ifp = if_find(ifs, argv[i]);
+		if (ifp == NULL) {
+			/* This can happen if an interface is quickly added
+			 * and then removed. */
+			continue;
+		}
+		n++;
+
+		/* Check if we already have the interface */
+		iff = if_find(ctx->ifaces, ifp->name);
+
+		if (iff != NULL) {
+			if (iff->active)
+				logdebugx("%s: interface updated", iff->name);
+			/* The flags and hwaddr could have changed */
+			iff->flags = ifp->flags;
+			iff->hwlen = ifp->hwlen;
+			if (ifp->hwlen != 0)
+				memcpy(iff->hwaddr, ifp->hwaddr, iff->hwlen);
+		} else {
+			TAILQ_REMOVE(ifs, ifp, next);
+			if_insert(ifp);
+			/* We didn't keep any routes it already had. */
+			rt_invalidate(ctx);
+			if (ifp->active) {
+				logdebugx("%s: interface added", ifp->name);
+				dhcpcd_initstate(ifp, 0);
+				run_preinit(ifp);
+			}
+			iff = ifp;
+		}
+		iffs[i] = iff;
+	}
+
+	if (n != 0 && action > 0) {
+		if_learnaddrs(ctx, ifs, &ifaddrs);
+		for (i = 0; i < argc; i++) {
+			if (iffs[i] == NULL || !iffs[i]->active)
+				continue;
+			if (argc == 1)
+				dhcpcd_prestartinterface(iffs[i]);
+			else
+				pace_queuestart(iffs[i],
+				    dhcpcd_prestartinterface);
+		}
+	}
+
+	if_freeifaddrs(ctx, &ifaddrs);
+	/* Free our discovered list */
+	while ((ifp = TAILQ_FIRST(ifs))) {
+		TAILQ_REMOVE(ifs, ifp, next);
+		if_free(ifp);
+	}
+	free(ifs);
+	free(iffs);
+
+	return n;
+}
+
 int
 dhcpcd_handleinterface(void *arg, int action, const char *ifname)
 {
 	struct dhcpcd_ctx *ctx = arg;
-	struct ifaddrs *ifaddrs;
-	struct if_head *ifs;
-	struct interface *ifp, *iff;
-	const char * const argv[] = { ifname };
-	int e;
+	struct interface *ifp;
+	char * const argv[] = { UNCONST(ifname) };
+	int n;
 
 	if (action == -1) {
 		ifp = if_find(ctx->ifaces, ifname);
@@ -1049,65 +1157,50 @@ dhcpcd_handleinterface(void *arg, int action, const char *ifname)
 			logdebugx("%s: interface departed", ifp->name);
 			stop_interface(ifp, "DEPARTED");
 		}
-		TAILQ_REMOVE(ctx->ifaces, ifp, next);
+		if_remove(ifp);
 		if_free(ifp);
 		return 0;
 	}
 
-	ifs = if_discover(ctx, &ifaddrs, -1, UNCONST(argv));
-	if (ifs == NULL) {
-		logerr(__func__);
-		return -1;
-	}
-
-	ifp = if_find(ifs, ifname);
-	if (ifp == NULL) {
-		/* This can happen if an interface is quickly added
-		 * and then removed. */
+	n = dhcpcd_addinterfaces(ctx, action, 1, argv);
+	if (n == 0) {
 		errno = ENOENT;
-		e = -1;
-		goto out;
+		return -1;
 	}
-	e = 1;
+	return n;
+}
 
-	/* Check if we already have the interface */
-	iff = if_find(ctx->ifaces, ifp->name);
+/* Adds a batch of new interfaces, such as a device manager coldplug. */
+int
+dhcpcd_handleinterfaces(void *arg, int argc, char * const *argv)
+{
 
-	if (iff != NULL) {
-		if (iff->active)
-			logdebugx("%s: interface updated", iff->name);
-		/* The flags and hwaddr could have changed */
-		iff->flags = ifp->flags;
-		iff->hwlen = ifp->hwlen;
-		if (ifp->hwlen != 0)
-			memcpy(iff->hwaddr, ifp->hwaddr, iff->hwlen);
-	} else {
-		TAILQ_REMOVE(ifs, ifp, next);
-		TAILQ_INSERT_TAIL(ctx->ifaces, ifp, next);
-		if (ifp->active) {
-			logdebugx("%s: interface added", ifp->name);
-			dhcpcd_initstate(ifp, 0);
-			run_preinit(ifp);
-		}
-		iff = ifp;
-	}
+	if (argc == 0)
+		return 0;
+	return dhcpcd_addinterfaces(arg, 1, argc, argv);
+}
 
-	if (action > 0) {
-		if_learnaddrs(ctx, ifs, &ifaddrs);
-		if (iff->active)
-			dhcpcd_prestartinterface(iff);
-	}
+#ifndef SMALL
+/* Roll the messages per second window forward to now. */
+static void
+dhcpcd_linkrate(struct dhcpcd_ctx *ctx)
+{
+	struct timespec now;
 
-out:
-	/* Free our discovered list */
-	while ((ifp = TAILQ_FIRST(ifs))) {
-		TAILQ_REMOVE(ifs, ifp, next);
-		if_free(ifp);
-	}
-	free(ifs);
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1 ||
+	    now.tv_sec == ctx->link_rate_sec)
+		return;
 
-	return e;
+	/* Everything since link_rate_sec was read in that second. */
+	ctx->link_rate = ctx->link_msgs - ctx->link_rate_msgs;
+	if (ctx->link_rate > ctx->link_rate_max)
+		ctx->link_rate_max = ctx->link_rate;
+	if (now.tv_sec != ctx->link_rate_sec + 1)
+		ctx->link_rate = 0;
+	ctx->link_rate_sec = now.tv_sec;
+	ctx->link_rate_msgs = ctx->link_msgs;
 }
+#endif
 
 static void
 dhcpcd_handlelink(void *arg, unsigned short events)
@@ -1117,6 +1210,9 @@ dhcpcd_handlelink(void *arg, unsigned short events)
 	if (events != ELE_READ)
 		logerrx("%s: unexpected event 0x%04x", __func__, events);
 
+#ifndef SMALL
+	dhcpcd_linkrate(ctx);
+#endif
 	if (if_handlelink(ctx) == -1) {
 		if (errno == ENOBUFS || errno == ENOMEM) {
 			dhcpcd_linkoverflow(ctx);
@@ -1141,21 +1237,37 @@ dhcpcd_checkcarrier(void *arg)
 }
 
 #ifndef SMALL
-static void
-dhcpcd_setlinkrcvbuf(struct dhcpcd_ctx *ctx)
+static int
+dhcpcd_setlinkrcvbuf(struct dhcpcd_ctx *ctx, int rcvbuf)
 {
-	socklen_t socklen;
-
-	if (ctx->link_rcvbuf == 0)
-		return;
+	socklen_t socklen = sizeof(rcvbuf);
 
 	logdebugx("setting route socket receive buffer size to %d bytes",
-	    ctx->link_rcvbuf);
+	    rcvbuf);
 
-	socklen = sizeof(ctx->link_rcvbuf);
+#if defined(PRIVSEP) && defined(__linux__)
+	/* The sandbox does not allow it, and as root it can go past
+	 * net.core.rmem_max. */
+	if (IN_PRIVSEP(ctx)) {
+		if (ps_root_setlinkrcvbuf(ctx, rcvbuf) == -1) {
+			logerr(__func__);
+			return -1;
+		}
+		return 0;
+	}
+#endif
+#ifdef SO_RCVBUFFORCE
+	/* Root can go past net.core.rmem_max. */
+	if (setsockopt(ctx->link_fd, SOL_SOCKET,
+	    SO_RCVBUFFORCE, &rcvbuf, socklen) == 0)
+		return 0;
+#endif
 	if (setsockopt(ctx->link_fd, SOL_SOCKET,
-	    SO_RCVBUF, &ctx->link_rcvbuf, socklen) == -1)
+	    SO_RCVBUF, &rcvbuf, socklen) == -1) {
 		logerr(__func__);
+		return -1;
+	}
+	return 0;
 }
 #endif
 
@@ -1205,6 +1317,24 @@ dhcpcd_linkoverflow(struct dhcpcd_ctx *ctx)
 	if (rcnt % 1000 != 0)
 		logwarnx("drained %zu messages", rcnt);
 
+#ifndef SMALL
+	ctx->link_overflows++;
+	/* Grow the buffer so we are less likely to overflow again. */
+	if (rcvbuflen > 0 && rcvbuflen < ctx->link_rcvbuf_max) {
+		if (rcvbuflen > ctx->link_rcvbuf_max / 2)
+			rcvbuflen = ctx->link_rcvbuf_max;
+		else
+			rcvbuflen *= 2;
+		dhcpcd_setlinkrcvbuf(ctx, rcvbuflen);
+	}
+#endif
+
+	/* Ask the kernel for what we missed if we can. */
+	if (if_resync(ctx) == 0)
+		goto routes;
+	if (errno != ENOTSUP)
+		logerr("%s: if_resync", __func__);
+
 	/* Work out the current interfaces. */
 	ifaces = if_discover(ctx, &ifaddrs, ctx->ifc, ctx->ifv);
 	if (ifaces == NULL) {
@@ -1231,11 +1361,10 @@ dhcpcd_linkoverflow(struct dhcpcd_ctx *ctx)
 			    dhcpcd_checkcarrier, ifp);
 			continue;
 		}
-		TAILQ_INSERT_TAIL(ctx->ifaces, ifp, next);
+		if_insert(ifp);
 		if (ifp->active) {
 			dhcpcd_initstate(ifp, 0);
-			eloop_timeout_add_sec(ctx->eloop, 0,
-			    dhcpcd_runprestartinterface, ifp);
+			pace_queuestart(ifp, dhcpcd_runprestartinterface);
 		}
 	}
 	free(ifaces);
@@ -1244,6 +1373,9 @@ dhcpcd_linkoverflow(struct dhcpcd_ctx *ctx)
 	if_markaddrsstale(ctx->ifaces);
 	if_learnaddrs(ctx, ctx->ifaces, &ifaddrs);
 	if_deletestaleaddrs(ctx->ifaces);
+
+routes:
+	rt_resync(ctx);
 }
 
 void
@@ -1281,6 +1413,9 @@ dhcpcd_handlehwaddr(struct interface *ifp,
 	ifp->hwlen = hwlen;
 	if (hwaddr != NULL)
 		memcpy(ifp->hwaddr, hwaddr, hwlen);
+#ifdef ARP
+	arp_refilter(ifp);
+#endif
 }
 
 static void
@@ -1322,6 +1457,9 @@ reload_config(struct dhcpcd_ctx *ctx)
 		ifo->options |= DHCPCD_PRIVSEP;
 	ctx->options = ifo->options;
 	free_options(ctx, ifo);
+#ifndef SMALL
+	eloop_set_cbstats(ctx->eloop, ctx->cbstats);
+#endif
 }
 
 static void
@@ -1374,6 +1512,42 @@ stop_all_interfaces(struct dhcpcd_ctx *ctx, unsigned long long opts)
 	}
 }
 
+/* Stop for the next dhcpcd, leaving what is configured and handing
+ * the bound leases over so it can carry on with them. */
+static int
+dhcpcd_restart(struct dhcpcd_ctx *ctx)
+{
+	struct interface *ifp;
+
+	/* The launcher has to hear from us first. */
+	if (ctx->options & DHCPCD_DAEMONISE &&
+	    !(ctx->options & DHCPCD_DAEMONISED))
+	{
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (handoff_write(ctx) == -1)
+		return -1;
+#ifdef PRIVSEP
+	if (IN_PRIVSEP(ctx))
+		loginfox("restarting, " PACKAGE " needs starting again "
+		    "to pick up the handoff");
+	else
+#endif
+		loginfox("restarting");
+
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		if (ifp->active)
+			ifp->options->options &= ~DHCPCD_RELEASE;
+	}
+	/* The next dhcpcd runs the scripts when it binds. */
+	ctx->restarting = true;
+	stop_all_interfaces(ctx, DHCPCD_EXITING | DHCPCD_PERSISTENT);
+	eloop_exit(ctx->eloop, EXIT_SUCCESS);
+	return 0;
+}
+
 static void
 dhcpcd_ifrenew(struct interface *ifp)
 {
@@ -1415,6 +1589,10 @@ dhcpcd_signal_cb(int sig, void *arg)
 	struct dhcpcd_ctx *ctx = arg;
 	unsigned long long opts;
 	int exit_code;
+#ifndef PRIVSEP
+	int status;
+	pid_t pid;
+#endif
 
 	if (ctx->options & DHCPCD_DUMPLEASE) {
 		eloop_exit(ctx->eloop, EXIT_FAILURE);
@@ -1428,6 +1606,10 @@ dhcpcd_signal_cb(int sig, void *arg)
 		return;
 	}
 
+	/* Whatever we are about to do, get held back leases on disk. */
+	if (sig != SIGCHLD)
+		dhcp_flushleases(ctx);
+
 	opts = 0;
 	exit_code = EXIT_FAILURE;
 	switch (sig) {
@@ -1471,8 +1653,8 @@ dhcpcd_signal_cb(int sig, void *arg)
 #ifdef PRIVSEP
 		ps_root_signalcb(sig, ctx);
 #else
-		while (waitpid(-1, NULL, WNOHANG) > 0)
-			;
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+			script_reaped(ctx, pid, status);
 #endif
 		return;
 	default:
@@ -1487,13 +1669,621 @@ dhcpcd_signal_cb(int sig, void *arg)
 }
 #endif
 
+#ifndef SMALL
+__printflike(3, 4) static int
+dhcpcd_statsline(char **buf, size_t *len, const char *fmt, ...)
+{
+	va_list va;
+	int l;
+	char *nbuf;
+
+	va_start(va, fmt);
+	l = vsnprintf(NULL, 0, fmt, va);
+	va_end(va);
+	if (l == -1)
+		return -1;
+	nbuf = realloc(*buf, *len + (size_t)l + 1);
+	if (nbuf == NULL)
+		return -1;
+	*buf = nbuf;
+	va_start(va, fmt);
+	vsnprintf(*buf + *len, (size_t)l + 1, fmt, va);
+	va_end(va);
+	*len += (size_t)l + 1;
+	return l;
+}
+
+static int
+dhcpcd_cbstats_cmp(const void *a, const void *b)
+{
+	const struct eloop_cbstats *ca = a, *cb = b;
+
+	if (ca->total_ns == cb->total_ns)
+		return 0;
+	return ca->total_ns < cb->total_ns ? 1 : -1;
+}
+
+static void
+dhcpcd_cbname(char *buf, size_t len, const struct eloop_cbstats *cs)
+{
+	union {
+		void (*event_cb)(void *, unsigned short);
+		void (*timeout_cb)(void *);
+		void *addr;
+	} fn;
+
+	if (cs->event_cb != NULL)
+		fn.event_cb = cs->event_cb;
+	else
+		fn.timeout_cb = cs->timeout_cb;
+
+#ifdef HAVE_DLADDR
+	Dl_info dli, self;
+	const char *obj;
+
+	/* Static functions are not in the dynamic symbol table,
+	 * so give an offset which addr2line(1) understands.
+	 * Our own dli_fname is argv[0] which setproctitle clobbers. */
+	if (dladdr(fn.addr, &dli) != 0) {
+		if (dli.dli_sname != NULL && dli.dli_saddr == fn.addr) {
+			strlcpy(buf, dli.dli_sname, len);
+			return;
+		}
+		if (dladdr((void *)dhcpcd_cbname, &self) != 0 &&
+		    self.dli_fbase == dli.dli_fbase)
+			obj = PACKAGE;
+		else
+			obj = dli.dli_fname;
+		if (obj != NULL) {
+			snprintf(buf, len, "%s+0x%tx", obj,
+			    (char *)fn.addr - (char *)dli.dli_fbase);
+			return;
+		}
+	}
+#endif
+	snprintf(buf, len, "%p", fn.addr);
+}
+
+static const char * const dhcpcd_ifstatnames[IFS_MAX] = {
+	"bootp", "dhcp6", "ra", "arp",
+};
+
+/* Reply to --dumpstats in the same way as --dumplease
+ * with a count of one followed by NUL separated lines. */
+static int
+dhcpcd_dumpstats(struct dhcpcd_ctx *ctx, struct fd_list *fd)
+{
+	const struct eloop_stats *es = eloop_stats(ctx->eloop);
+	const struct eloop_cbstats *ecs;
+	struct eloop_cbstats *cbs = NULL, *cs;
+	const struct interface *ifp;
+	size_t ncbs, i, len = 0, nh, one = 1;
+	char *buf = NULL, name[256], hist[ELOOP_CBHIST * 21], *hp;
+	socklen_t socklen;
+	int rcvbuflen, err = -1;
+
+	if (dhcpcd_statsline(&buf, &len, "poll=%s",
+	    eloop_backend(ctx->eloop)) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "wakeups=%llu", es->wakeups) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "rounds=%llu", es->rounds) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "events=%llu", es->events) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "events_max=%llu",
+	    es->events_max) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "timeouts=%llu", es->timeouts) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "callback_ns=%llu",
+	    es->callback_ns) == -1)
+		goto out;
+
+	dhcpcd_linkrate(ctx);
+#ifdef PRIVSEP
+	if (ctx->options & DHCPCD_PRIVSEP && ps_root_scriptstats(ctx) == -1)
+		logerr("%s: ps_root_scriptstats", __func__);
+#endif
+	socklen = sizeof(rcvbuflen);
+	if (getsockopt(ctx->link_fd, SOL_SOCKET,
+	    SO_RCVBUF, &rcvbuflen, &socklen) == -1)
+		rcvbuflen = 0;
+#ifdef __linux__
+	else
+		rcvbuflen /= 2;
+#endif
+	if (dhcpcd_statsline(&buf, &len, "link_rcvbuf=%d", rcvbuflen) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "link_rcvbuf_max=%d",
+	    ctx->link_rcvbuf_max) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "link_msgs=%llu",
+	    ctx->link_msgs) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "link_msgs_sec=%llu",
+	    ctx->link_rate) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "link_msgs_sec_max=%llu",
+	    ctx->link_rate_max) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "link_overflows=%llu",
+	    ctx->link_overflows) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "control_coalesced=%llu",
+	    ctx->control_coalesced) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "control_slow=%llu",
+	    ctx->control_slow) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "script_runs=%llu",
+	    ctx->script_runs) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "script_ns=%llu",
+	    ctx->script_ns) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "script_ns_max=%llu",
+	    ctx->script_ns_max) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "rt_builds=%llu",
+	    ctx->rt_builds) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "rt_build_ns=%llu",
+	    ctx->rt_build_ns) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "rt_build_ns_max=%llu",
+	    ctx->rt_build_ns_max) == -1)
+		goto out;
+#ifdef PRIVSEP
+	if (dhcpcd_statsline(&buf, &len, "ps_root_sync=%llu",
+	    ctx->ps_root_sync) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "ps_root_sync_ns=%llu",
+	    ctx->ps_root_sync_ns) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "ps_root_sync_ns_max=%llu",
+	    ctx->ps_root_sync_ns_max) == -1 ||
+	    dhcpcd_statsline(&buf, &len, "ps_root_async=%llu",
+	    ctx->ps_root_async) == -1)
+		goto out;
+#endif
+
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		const struct if_stats *is;
+
+		for (i = 0, is = ifp->stats; i < IFS_MAX; i++, is++) {
+			if (is->rx == 0 && is->tx == 0)
+				continue;
+			if (dhcpcd_statsline(&buf, &len,
+			    "if_stats %s %s rx=%llu tx=%llu drop=%llu "
+			    "cksum=%llu xid=%llu retrans=%llu nak=%llu",
+			    ifp->name, dhcpcd_ifstatnames[i],
+			    is->rx, is->tx, is->drop, is->cksum, is->xid,
+			    is->retrans, is->nak) == -1)
+				goto out;
+		}
+	}
+
+#ifdef INET
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		const struct dhcp_state *state = D_CSTATE(ifp);
+		const struct dhcp_responder *dr;
+
+		if (state == NULL)
+			continue;
+		for (i = 0, dr = state->responders;
+		    i < DHCP_RESPONDERS;
+		    i++, dr++)
+		{
+			if (dr->dr_seen == 0)
+				continue;
+			if (dhcpcd_statsline(&buf, &len,
+			    "dhcp_responder %s %s offers=%llu offer_ms=%u "
+			    "offer_ms_min=%u acks=%llu ack_ms=%u ack_ms_min=%u",
+			    ifp->name, inet_ntoa(dr->dr_addr),
+			    dr->dr_offers, dr->dr_offer_ms,
+			    dr->dr_offers != 0 ? dr->dr_offer_ms_min : 0,
+			    dr->dr_acks, dr->dr_ack_ms,
+			    dr->dr_acks != 0 ? dr->dr_ack_ms_min : 0) == -1)
+				goto out;
+		}
+	}
+#endif
+
+#ifdef DHCP6
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		const struct dhcp6_state *state = D6_CSTATE(ifp);
+		const struct dhcp6_timing *dt;
+		unsigned int p50, p90, max;
+
+		if (state == NULL)
+			continue;
+		for (i = 0, dt = state->timings; i < DH6T_MAX; i++, dt++) {
+			if (dt->dt_n == 0)
+				continue;
+			dhcp6_timingstats(dt, &p50, &p90, &max);
+			if (dhcpcd_statsline(&buf, &len,
+			    "dhcp6_exchange %s %s count=%llu last_ms=%u "
+			    "p50_ms=%u p90_ms=%u max_ms=%u",
+			    ifp->name, dhcp6_timingname((unsigned int)i),
+			    dt->dt_n,
+			    dt->dt_ms[(dt->dt_n - 1) % DHCP6_TIMINGS],
+			    p50, p90, max) == -1)
+				goto out;
+		}
+	}
+#endif
+
+	/* Busiest callbacks first. */
+	ecs = eloop_cbstats(ctx->eloop, &ncbs);
+	if (ncbs != 0) {
+		cbs = malloc(ncbs * sizeof(*cbs));
+		if (cbs == NULL)
+			goto out;
+		memcpy(cbs, ecs, ncbs * sizeof(*cbs));
+		qsort(cbs, ncbs, sizeof(*cbs), dhcpcd_cbstats_cmp);
+	}
+
+	for (i = 0, cs = cbs; i < ncbs; i++, cs++) {
+		/* Trailing empty buckets are not shown. */
+		for (nh = ELOOP_CBHIST; nh > 1 && cs->hist[nh - 1] == 0; nh--)
+			;
+		hp = hist;
+		for (size_t h = 0; h < nh; h++)
+			hp += snprintf(hp, sizeof(hist) - (size_t)(hp - hist),
+			    "%s%llu", h == 0 ? "" : ",", cs->hist[h]);
+		dhcpcd_cbname(name, sizeof(name), cs);
+		if (dhcpcd_statsline(&buf, &len,
+		    "callback %s %s calls=%llu total_ns=%llu max_ns=%llu "
+		    "hist_usec_log2=%s",
+		    cs->event_cb != NULL ? "fd" : "timeout", name,
+		    cs->calls, cs->total_ns, cs->max_ns, hist) == -1)
+			goto out;
+	}
+
+	if (write(fd->fd, &one, sizeof(one)) != sizeof(one))
+		goto out;
+	err = control_queue(fd, buf, len);
+
+out:
+	free(cbs);
+	free(buf);
+	return err;
+}
+
+/* Seconds left of lifetime since acquired. */
+static const char *
+dhcpcd_timeleft(char *buf, size_t len, const struct timespec *now,
+    const struct timespec *acquired, uint32_t lifetime)
+{
+	time_t elapsed;
+
+	if (lifetime == UINT32_MAX)
+		return "infinite";
+	elapsed = now->tv_sec - acquired->tv_sec;
+	if (elapsed < 0)
+		elapsed = 0;
+	snprintf(buf, len, "%lld", (unsigned long long)elapsed >= lifetime ?
+	    0LL : (long long)lifetime - (long long)elapsed);
+	return buf;
+}
+
+static int
+dhcpcd_dumpstate1(char **buf, size_t *len, const struct interface *ifp,
+    const struct timespec *now)
+{
+	char t1[24], t2[24], t3[24];
+
+	if (dhcpcd_statsline(buf, len, "%s link carrier=%s", ifp->name,
+	    ifp->carrier == LINK_UP ? "up" :
+	    ifp->carrier == LINK_DOWN ? "down" : "unknown") == -1)
+		return -1;
+
+#ifdef INET
+	const struct dhcp_state *state = D_CSTATE(ifp);
+
+	if (state != NULL && D_STATE_RUNNING(ifp)) {
+		const struct dhcp_lease *l = &state->lease;
+		char sa[INET_ADDRSTRLEN], ss[INET_ADDRSTRLEN];
+
+		inet_ntop(AF_INET, &l->addr, sa, sizeof(sa));
+		inet_ntop(AF_INET, &l->server, ss, sizeof(ss));
+		if (dhcpcd_statsline(buf, len,
+		    "%s dhcp state=%s reason=%s addr=%s/%d server=%s "
+		    "renew=%s rebind=%s expire=%s",
+		    ifp->name, dhcp_statename(state->state), state->reason,
+		    sa, inet_ntocidr(l->mask), ss,
+		    dhcpcd_timeleft(t1, sizeof(t1), now, &state->bound,
+		    l->renewaltime),
+		    dhcpcd_timeleft(t2, sizeof(t2), now, &state->bound,
+		    l->rebindtime),
+		    dhcpcd_timeleft(t3, sizeof(t3), now, &state->bound,
+		    l->leasetime)) == -1)
+			return -1;
+	} else if (state != NULL) {
+		if (dhcpcd_statsline(buf, len, "%s dhcp state=%s",
+		    ifp->name, dhcp_statename(state->state)) == -1)
+			return -1;
+	}
+#endif
+
+#ifdef DHCP6
+	const struct dhcp6_state *state6 = D6_CSTATE(ifp);
+	const struct ipv6_addr *ia;
+
+	if (state6 != NULL && state6->new != NULL && state6->reason != NULL) {
+		if (dhcpcd_statsline(buf, len,
+		    "%s dhcp6 state=%s reason=%s renew=%s rebind=%s expire=%s",
+		    ifp->name, dhcp6_statename(state6->state), state6->reason,
+		    dhcpcd_timeleft(t1, sizeof(t1), now, &state6->acquired,
+		    state6->renew),
+		    dhcpcd_timeleft(t2, sizeof(t2), now, &state6->acquired,
+		    state6->rebind),
+		    dhcpcd_timeleft(t3, sizeof(t3), now, &state6->acquired,
+		    state6->expire)) == -1)
+			return -1;
+		TAILQ_FOREACH(ia, &state6->addrs, next) {
+			if (ia->flags & IPV6_AF_STALE)
+				continue;
+			if (dhcpcd_statsline(buf, len,
+			    "%s dhcp6 %s=%s vltime=%s pltime=%s",
+			    ifp->name,
+			    ia->ia_type == D6_OPTION_IA_PD ? "prefix" : "addr",
+			    ia->saddr,
+			    dhcpcd_timeleft(t1, sizeof(t1), now, &ia->acquired,
+			    ia->prefix_vltime),
+			    dhcpcd_timeleft(t2, sizeof(t2), now, &ia->acquired,
+			    ia->prefix_pltime)) == -1)
+				return -1;
+		}
+	} else if (state6 != NULL) {
+		if (dhcpcd_statsline(buf, len, "%s dhcp6 state=%s",
+		    ifp->name, dhcp6_statename(state6->state)) == -1)
+			return -1;
+	}
+#endif
+
+#ifdef INET6
+	const struct ra *rap;
+	const struct ipv6_addr *rapia;
+
+	if (ifp->ctx->ra_routers == NULL)
+		return 0;
+	TAILQ_FOREACH(rap, ifp->ctx->ra_routers, next) {
+		if (rap->iface != ifp || rap->expired)
+			continue;
+		if (dhcpcd_statsline(buf, len, "%s ra from=%s lifetime=%s",
+		    ifp->name, rap->sfrom,
+		    dhcpcd_timeleft(t1, sizeof(t1), now, &rap->acquired,
+		    rap->lifetime)) == -1)
+			return -1;
+		TAILQ_FOREACH(rapia, &rap->addrs, next) {
+			if (!(rapia->flags & IPV6_AF_AUTOCONF) ||
+			    rapia->flags & IPV6_AF_STALE)
+				continue;
+			if (dhcpcd_statsline(buf, len,
+			    "%s ra addr=%s vltime=%s pltime=%s",
+			    ifp->name, rapia->saddr,
+			    dhcpcd_timeleft(t1, sizeof(t1), now,
+			    &rapia->acquired, rapia->prefix_vltime),
+			    dhcpcd_timeleft(t2, sizeof(t2), now,
+			    &rapia->acquired, rapia->prefix_pltime)) == -1)
+				return -1;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+/* Reply to --dumpstate like --dumpstats with the bound state of each
+ * interface, taken from what we already hold and not the script env. */
+static int
+dhcpcd_dumpstate(struct dhcpcd_ctx *ctx, struct fd_list *fd,
+    int argc, char **argv)
+{
+	const struct interface *ifp;
+	struct timespec now;
+	size_t len = 0, n;
+	char *buf = NULL;
+	int oi, err = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		if (!ifp->active)
+			continue;
+		for (oi = optind; oi < argc; oi++) {
+			if (strcmp(ifp->name, argv[oi]) == 0)
+				break;
+		}
+		if (optind != argc && oi == argc)
+			continue;
+		if (dhcpcd_dumpstate1(&buf, &len, ifp, &now) == -1)
+			goto out;
+	}
+
+	n = len == 0 ? 0 : 1;
+	if (write(fd->fd, &n, sizeof(n)) != sizeof(n))
+		goto out;
+	err = n == 0 ? 0 : control_queue(fd, buf, len);
+
+out:
+	free(buf);
+	return err;
+}
+
+enum dhcpcd_mem {
+	DM_INTERFACE,
+	DM_OPTIONS,
+	DM_IPV4,
+	DM_ARP,
+	DM_IPV4LL,
+	DM_DHCP,
+	DM_IPV6,
+	DM_RA,
+	DM_DHCP6,
+	DM_MAX
+};
+
+/* Add what each subsystem holds for ifp to mem. */
+static void
+dhcpcd_memsize(struct interface *ifp, size_t *mem)
+{
+
+	mem[DM_INTERFACE] += sizeof(*ifp) + if_iaids_memsize(ifp);
+	if (ifp->options != NULL)
+		mem[DM_OPTIONS] += if_options_memsize(ifp->options);
+
+#ifdef INET
+	const struct ipv4_state *istate = IPV4_CSTATE(ifp);
+	const struct ipv4_addr *ia;
+
+	if (istate != NULL) {
+		mem[DM_IPV4] += sizeof(*istate);
+		TAILQ_FOREACH(ia, &istate->addrs, next) {
+			mem[DM_IPV4] += sizeof(*ia);
+		}
+	}
+
+#ifdef ARP
+	const struct iarp_state *astate = ARP_CSTATE(ifp);
+	const struct arp_state *as;
+
+	if (astate != NULL) {
+		mem[DM_ARP] += sizeof(*astate);
+		TAILQ_FOREACH(as, &astate->arp_states, next) {
+			mem[DM_ARP] += sizeof(*as);
+		}
+		if (astate->bpf != NULL)
+			mem[DM_ARP] += bpf_memsize(astate->bpf);
+	}
+#endif
+
+#ifdef IPV4LL
+	if (IPV4LL_CSTATE(ifp) != NULL)
+		mem[DM_IPV4LL] += sizeof(struct ipv4ll_state);
+#endif
+
+	const struct dhcp_state *state = D_CSTATE(ifp);
+
+	if (state != NULL) {
+		mem[DM_DHCP] += sizeof(*state) + state->sent_len +
+		    state->offer_len + state->new_len + state->old_len +
+		    state->txbuf_len;
+		if (state->clientid != NULL)
+			mem[DM_DHCP] += (size_t)state->clientid[0] + 1;
+		mem[DM_DHCP] += script_envcache_memsize(state->envcache,
+		    ENVCACHE_LEN);
+		if (state->bpf != NULL)
+			mem[DM_DHCP] += bpf_memsize(state->bpf);
+	}
+#endif
+
+#ifdef INET6
+	const struct ipv6_state *i6state = IPV6_CSTATE(ifp);
+	const struct ipv6_addr *ia6;
+	const struct ll_callback *cb;
+
+	if (i6state != NULL) {
+		mem[DM_IPV6] += sizeof(*i6state);
+		TAILQ_FOREACH(ia6, &i6state->addrs, next) {
+			mem[DM_IPV6] += sizeof(*ia6);
+		}
+		TAILQ_FOREACH(cb, &i6state->ll_callbacks, next) {
+			mem[DM_IPV6] += sizeof(*cb);
+		}
+	}
+
+	const struct rs_state *rstate = RS_CSTATE(ifp);
+	const struct ra *rap;
+
+	if (rstate != NULL)
+		mem[DM_RA] += sizeof(*rstate) + rstate->rslen;
+	if (ifp->ctx->ra_routers != NULL) {
+		TAILQ_FOREACH(rap, ifp->ctx->ra_routers, next) {
+			if (rap->iface != ifp)
+				continue;
+			mem[DM_RA] += sizeof(*rap) + rap->data_len;
+			TAILQ_FOREACH(ia6, &rap->addrs, next) {
+				mem[DM_RA] += sizeof(*ia6);
+			}
+		}
+	}
+#endif
+
+#ifdef DHCP6
+	const struct dhcp6_state *state6 = D6_CSTATE(ifp);
+
+	if (state6 != NULL) {
+		mem[DM_DHCP6] += sizeof(*state6) + state6->send_len +
+		    state6->recv_len + state6->new_len + state6->old_len;
+		TAILQ_FOREACH(ia6, &state6->addrs, next) {
+			mem[DM_DHCP6] += sizeof(*ia6);
+		}
+		mem[DM_DHCP6] += script_envcache_memsize(state6->envcache,
+		    ENVCACHE_LEN);
+	}
+#endif
+}
+
+static int
+dhcpcd_memline(char **buf, size_t *len, const char *name, const size_t *mem)
+{
+	size_t i, total = 0;
+
+	for (i = 0; i < DM_MAX; i++)
+		total += mem[i];
+	return dhcpcd_statsline(buf, len,
+	    "%s mem interface=%zu options=%zu ipv4=%zu arp=%zu ipv4ll=%zu "
+	    "dhcp=%zu ipv6=%zu ra=%zu dhcp6=%zu total=%zu",
+	    name, mem[DM_INTERFACE], mem[DM_OPTIONS], mem[DM_IPV4],
+	    mem[DM_ARP], mem[DM_IPV4LL], mem[DM_DHCP], mem[DM_IPV6],
+	    mem[DM_RA], mem[DM_DHCP6], total);
+}
+
+/* Reply to --dumpmem like --dumpstats with the bytes each subsystem
+ * holds for each interface, then the sum of them and what is shared. */
+static int
+dhcpcd_dumpmem(struct dhcpcd_ctx *ctx, struct fd_list *fd,
+    int argc, char **argv)
+{
+	struct interface *ifp;
+	size_t len = 0, n, nifaces = 0;
+	size_t mem[DM_MAX], sum[DM_MAX] = { 0 };
+	char *buf = NULL;
+	int oi, err = -1;
+
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		for (oi = optind; oi < argc; oi++) {
+			if (strcmp(ifp->name, argv[oi]) == 0)
+				break;
+		}
+		if (optind != argc && oi == argc)
+			continue;
+		memset(mem, 0, sizeof(mem));
+		dhcpcd_memsize(ifp, mem);
+		if (dhcpcd_memline(&buf, &len, ifp->name, mem) == -1)
+			goto out;
+		for (n = 0; n < DM_MAX; n++)
+			sum[n] += mem[n];
+		nifaces++;
+	}
+
+	if (optind == argc) {
+		if (dhcpcd_statsline(&buf, &len, "interfaces=%zu",
+		    nifaces) == -1 ||
+		    dhcpcd_memline(&buf, &len, "all", sum) == -1 ||
+		    dhcpcd_statsline(&buf, &len, "routes=%zu",
+		    rt_memsize(ctx)) == -1)
+			goto out;
+#ifdef INET
+		/* Under privsep the BPF sockets, and so their rings,
+		 * are held by other processes. */
+		if (dhcpcd_statsline(&buf, &len, "bpf_ring=%zu",
+		    bpf_ringsize()) == -1)
+			goto out;
+#endif
+	}
+
+	n = len == 0 ? 0 : 1;
+	if (write(fd->fd, &n, sizeof(n)) != sizeof(n))
+		goto out;
+	err = n == 0 ? 0 : control_queue(fd, buf, len);
+
+out:
+	free(buf);
+	return err;
+}
+#endif
+
 int
 dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
     int argc, char **argv)
 {
 	struct interface *ifp;
 	unsigned long long opts;
-	int opt, oi, do_reboot, do_renew, af = AF_UNSPEC;
+	int opt, oi, do_reboot, do_renew, do_dumpstats, do_dumpstate;
+	int do_dumpmem, do_restart;
+	int af = AF_UNSPEC;
 	size_t len, l, nifaces;
 	char *tmp, *p;
 
@@ -1512,8 +2302,7 @@ dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
 		optind = argc = 0;
 		goto dumplease;
 	} else if (strcmp(*argv, "--listen") == 0) {
-		fd->flags |= FD_LISTEN;
-		return 0;
+		return control_listen(fd, argc - 1, argv + 1);
 	}
 
 	/* Log the command */
@@ -1538,10 +2327,23 @@ dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
 	optind = 0;
 	oi = 0;
 	opts = 0;
-	do_reboot = do_renew = 0;
+	do_reboot = do_renew = do_dumpstats = do_dumpstate = do_dumpmem = 0;
+	do_restart = 0;
 	while ((opt = getopt_long(argc, argv, IF_OPTS, cf_options, &oi)) != -1)
 	{
 		switch (opt) {
+		case O_DUMPSTATS:
+			do_dumpstats = 1;
+			break;
+		case O_DUMPSTATE:
+			do_dumpstate = 1;
+			break;
+		case O_DUMPMEM:
+			do_dumpmem = 1;
+			break;
+		case O_RESTART:
+			do_restart = 1;
+			break;
 		case 'g':
 			/* Assumed if below not set */
 			break;
@@ -1572,6 +2374,33 @@ dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
 		}
 	}
 
+	if (do_dumpstats) {
+#ifdef SMALL
+		errno = ENOTSUP;
+		return -1;
+#else
+		return dhcpcd_dumpstats(ctx, fd);
+#endif
+	}
+
+	if (do_dumpstate) {
+#ifdef SMALL
+		errno = ENOTSUP;
+		return -1;
+#else
+		return dhcpcd_dumpstate(ctx, fd, argc, argv);
+#endif
+	}
+
+	if (do_dumpmem) {
+#ifdef SMALL
+		errno = ENOTSUP;
+		return -1;
+#else
+		return dhcpcd_dumpmem(ctx, fd, argc, argv);
+#endif
+	}
+
 	if (opts & DHCPCD_DUMPLEASE) {
 		ctx->options |= DHCPCD_DUMPLEASE;
 dumplease:
@@ -1617,6 +2446,9 @@ dumperr:
 		return -1;
 	}
 
+	if (do_restart)
+		return dhcpcd_restart(ctx);
+
 	if (opts & (DHCPCD_EXITING | DHCPCD_RELEASE)) {
 		if (optind == argc) {
 			stop_all_interfaces(ctx, opts);
@@ -1782,6 +2614,14 @@ dhcpcd_readdump(struct dhcpcd_ctx *ctx)
 	    dhcpcd_readdump0, ctx);
 }
 
+/* Log lines are written out once per loop iteration. */
+static void
+dhcpcd_idle_cb(__unused void *arg)
+{
+
+	logflush();
+}
+
 static void
 dhcpcd_fork_cb(void *arg, unsigned short events)
 {
@@ -1828,6 +2668,65 @@ dhcpcd_stderr_cb(void *arg, unsigned short events)
 	fprintf(stderr, "%s", log);
 }
 
+/* Sets up a context as main does before any options are parsed. */
+void
+dhcpcd_initctx(struct dhcpcd_ctx *ctx)
+{
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->cffile = CONFIG;
+	ctx->script = UNCONST(dhcpcd_default_script);
+	ctx->control_fd = ctx->control_unpriv_fd = ctx->link_fd = -1;
+	ctx->pf_inet_fd = -1;
+	ctx->script_worker_fd = -1;
+	TAILQ_INIT(&ctx->script_jobs);
+	ctx->script_jobs_max = 1;
+	TAILQ_INIT(&ctx->hook_resolv);
+#ifdef PF_LINK
+	ctx->pf_link_fd = -1;
+#endif
+
+	TAILQ_INIT(&ctx->control_fds);
+#ifdef USE_SIGNALS
+	ctx->fork_fd = -1;
+#endif
+#ifdef PLUGIN_DEV
+	ctx->dev_fd = -1;
+#endif
+#ifdef INET
+	ctx->udp_rfd = -1;
+	ctx->udp_wfd = -1;
+#endif
+#if defined(INET6) && !defined(__sun)
+	ctx->nd_fd = -1;
+#endif
+#ifdef DHCP6
+	ctx->dhcp6_rfd = -1;
+	ctx->dhcp6_wfd = -1;
+#endif
+#ifdef PRIVSEP
+	ctx->ps_log_fd = -1;
+	ps_initprocesses(ctx);
+	TAILQ_INIT(&ctx->ps_root_reqs);
+#endif
+	dhcp_initleases(ctx);
+	TAILQ_INIT(&ctx->pace_queue);
+	TAILQ_INIT(&ctx->start_queue);
+	handoff_init(ctx);
+	ctx->start_jobs = START_JOBS;
+	ctx->control_queue_max = CONTROL_QUEUE_MAX;
+	if_initifaces(ctx);
+#ifdef INET
+	dhcp_initxids(ctx);
+#endif
+#ifdef INET6
+	ipv6_initaddrs(ctx);
+#endif
+#ifdef DHCP6
+	dhcp6_initxids(ctx);
+#endif
+}
+
 int
 main(int argc, char **argv, char **envp)
 {
@@ -1839,6 +2738,10 @@ main(int argc, char **argv, char **envp)
 	int opt, oi = 0, i;
 	unsigned int logopts, t;
 	ssize_t len;
+	size_t pi;
+	const char *poll;
+	bool dumpstats = false;
+	char *argv0;
 #if defined(USE_SIGNALS) || !defined(THERE_IS_NO_FORK)
 	pid_t pid;
 	int fork_fd[2], stderr_fd[2];
@@ -1849,6 +2752,13 @@ main(int argc, char **argv, char **envp)
 	size_t si;
 #endif
 
+	/* --restart execs this, which setproctitle clobbers and
+	 * chdir would break if relative. */
+	if (strchr(argv[0], '/') != NULL)
+		argv0 = realpath(argv[0], NULL);
+	else
+		argv0 = strdup(argv[0]);
+
 #ifdef SETPROCTITLE_H
 	setproctitle_init(argc, argv, envp);
 #else
@@ -1859,6 +2769,7 @@ main(int argc, char **argv, char **envp)
 	if (argc > 1) {
 		if (strcmp(argv[1], "--help") == 0) {
 			usage();
+			free(argv0);
 			return EXIT_SUCCESS;
 		} else if (strcmp(argv[1], "--version") == 0) {
 			printf(""PACKAGE" "VERSION"\n%s\n", dhcpcd_copyright);
@@ -1888,43 +2799,18 @@ main(int argc, char **argv, char **envp)
 			" PRIVSEP"
 #endif
 			"\n");
+			printf("Polling mechanisms:");
+			pi = 0;
+			while ((poll = eloop_backend_name(pi++)) != NULL)
+				printf(" %s", poll);
+			printf("\n");
+			free(argv0);
 			return EXIT_SUCCESS;
 		}
 	}
 
-	memset(&ctx, 0, sizeof(ctx));
-
+	dhcpcd_initctx(&ctx);
 	ifo = NULL;
-	ctx.cffile = CONFIG;
-	ctx.script = UNCONST(dhcpcd_default_script);
-	ctx.control_fd = ctx.control_unpriv_fd = ctx.link_fd = -1;
-	ctx.pf_inet_fd = -1;
-#ifdef PF_LINK
-	ctx.pf_link_fd = -1;
-#endif
-
-	TAILQ_INIT(&ctx.control_fds);
-#ifdef USE_SIGNALS
-	ctx.fork_fd = -1;
-#endif
-#ifdef PLUGIN_DEV
-	ctx.dev_fd = -1;
-#endif
-#ifdef INET
-	ctx.udp_rfd = -1;
-	ctx.udp_wfd = -1;
-#endif
-#if defined(INET6) && !defined(__sun)
-	ctx.nd_fd = -1;
-#endif
-#ifdef DHCP6
-	ctx.dhcp6_rfd = -1;
-	ctx.dhcp6_wfd = -1;
-#endif
-#ifdef PRIVSEP
-	ctx.ps_log_fd = -1;
-	TAILQ_INIT(&ctx.ps_processes);
-#endif
 
 	/* Check our streams for validity */
 	ctx.stdin_valid =  fcntl(STDIN_FILENO,  F_GETFD) != -1;
@@ -1966,6 +2852,7 @@ main(int argc, char **argv, char **envp)
 			break;
 		case 'g':
 		case 'p':
+		case O_RESTART:
 			/* Force going via command socket as we're
 			 * out of user definable signals. */
 			i = 4;
@@ -2000,6 +2887,12 @@ main(int argc, char **argv, char **envp)
 		case 'U':
 			i = 3;
 			break;
+		case O_DUMPSTATS:	/* FALLTHROUGH */
+		case O_DUMPSTATE:	/* FALLTHROUGH */
+		case O_DUMPMEM:
+			dumpstats = true;
+			i = 3;
+			break;
 		case 'V':
 			i = 2;
 			break;
@@ -2017,6 +2910,14 @@ main(int argc, char **argv, char **envp)
 	logsetopts(logopts);
 	logopen(ctx.logfile);
 
+#ifdef SMALL
+	if (dumpstats) {
+		logerrx("--dumpstats, --dumpstate and --dumpmem are not "
+		    "supported in this build");
+		goto exit_failure;
+	}
+#endif
+
 	ctx.argv = argv;
 	ctx.argc = argc;
 	ctx.ifc = argc - optind;
@@ -2135,6 +3036,14 @@ printpidfile:
 		logerr("%s: eloop_init", __func__);
 		goto exit_failure;
 	}
+#ifndef SMALL
+	/* For --dumpstats */
+	eloop_set_cbstats(ctx.eloop, ctx.cbstats);
+#endif
+	eloop_idle_set_cb(ctx.eloop, dhcpcd_idle_cb, NULL);
+	logsetopts(loggetopts() | LOGERR_BUFFER);
+	if (ctx.poll != NULL && eloop_set_backend(ctx.eloop, ctx.poll) == -1)
+		logerr("%s: eloop_set_backend: %s", __func__, ctx.poll);
 
 #ifdef USE_SIGNALS
 	for (si = 0; si < dhcpcd_signals_ignore_len; si++)
@@ -2188,7 +3097,7 @@ printpidfile:
 #endif
 
 #ifndef SMALL
-	if (ctx.options & DHCPCD_DUMPLEASE &&
+	if (ctx.options & DHCPCD_DUMPLEASE && !dumpstats &&
 	    ioctl(fileno(stdin), FIONREAD, &i, sizeof(i)) == 0 &&
 	    i > 0)
 	{
@@ -2300,6 +3209,14 @@ printpidfile:
 				    pid, ctx.pidfile);
 			goto exit_failure;
 		}
+		/* If a restart exec'd us then we are already a daemon. */
+		if (handoff_read(&ctx) == getpid() &&
+		    ctx.options & DHCPCD_DAEMONISE)
+		{
+			ctx.options |= DHCPCD_DAEMONISED;
+			logopts &= ~LOGERR_ERR;
+			logsetopts(logopts);
+		}
 	}
 
 	loginfox(PACKAGE "-" VERSION " starting");
@@ -2307,7 +3224,8 @@ printpidfile:
 		logwarn("freopen stdin");
 
 #if defined(USE_SIGNALS) && !defined(THERE_IS_NO_FORK)
-	if (!(ctx.options & DHCPCD_DAEMONISE))
+	if (!(ctx.options & DHCPCD_DAEMONISE) ||
+	    ctx.options & DHCPCD_DAEMONISED)
 		goto start_manager;
 
 	if (xsocketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CXNB, 0, fork_fd) == -1 ||
@@ -2317,6 +3235,7 @@ printpidfile:
 		logerr("socketpair");
 		goto exit_failure;
 	}
+	logflush();
 	switch (pid = fork()) {
 	case -1:
 		logerr("fork");
@@ -2356,6 +3275,7 @@ printpidfile:
 			goto exit_failure;
 		}
 		/* Ensure we can never get a controlling terminal */
+		logflush();
 		switch (pid = fork()) {
 		case -1:
 			logerr("fork");
@@ -2452,7 +3372,8 @@ start_manager:
 	if (!IN_PRIVSEP(&ctx) &&
 	    (ctx.options & (DHCPCD_MANAGER | DHCPCD_DEV)) ==
 	    (DHCPCD_MANAGER | DHCPCD_DEV))
-		dev_start(&ctx, dhcpcd_handleinterface);
+		dev_start(&ctx, dhcpcd_handleinterface,
+		    dhcpcd_handleinterfaces);
 #endif
 
 	setproctitle("%s%s%s",
@@ -2465,7 +3386,8 @@ start_manager:
 		goto exit_failure;
 	}
 #ifndef SMALL
-	dhcpcd_setlinkrcvbuf(&ctx);
+	if (ctx.link_rcvbuf != 0)
+		dhcpcd_setlinkrcvbuf(&ctx, ctx.link_rcvbuf);
 #endif
 
 	/* Try and create DUID from the machine UUID. */
@@ -2477,8 +3399,8 @@ start_manager:
 
 	/* Start handling kernel messages for interfaces, addresses and
 	 * routes. */
-	if (eloop_event_add(ctx.eloop, ctx.link_fd, ELE_READ,
-	    dhcpcd_handlelink, &ctx) == -1)
+	if (eloop_p_event_add(ctx.eloop, ELOOP_PRIO_HIGH, ctx.link_fd,
+	    ELE_READ, dhcpcd_handlelink, &ctx) == -1)
 		logerr("%s: eloop_event_add", __func__);
 
 #ifdef PRIVSEP
@@ -2496,6 +3418,7 @@ start_manager:
 		logerr("%s: if_discover", __func__);
 		goto exit_failure;
 	}
+	if_indexifaces(&ctx);
 	for (i = 0; i < ctx.ifc; i++) {
 		if ((ifp = if_find(ctx.ifaces, ctx.ifv[i])) == NULL)
 			logerrx("%s: interface not found",
@@ -2535,11 +3458,8 @@ start_manager:
 
 	opt = 0;
 	TAILQ_FOREACH(ifp, ctx.ifaces, next) {
-		if (ifp->active) {
-			run_preinit(ifp);
-			if (if_is_link_up(ifp))
-				opt = 1;
-		}
+		if (ifp->active && if_is_link_up(ifp))
+			opt = 1;
 	}
 
 	if (!(ctx.options & DHCPCD_BACKGROUND)) {
@@ -2565,6 +3485,7 @@ start_manager:
 			logmessage(loglevel, "no interfaces have a carrier");
 			dhcpcd_daemonise(&ctx);
 		} else if (t > 0 &&
+		    !(ctx.options & DHCPCD_DAEMONISED) &&
 		    /* Test mode removes the daemonise bit, so check for both */
 		    ctx.options & (DHCPCD_DAEMONISE | DHCPCD_TEST))
 		{
@@ -2575,10 +3496,11 @@ start_manager:
 	free_options(&ctx, ifo);
 	ifo = NULL;
 
+	/* PREINIT and the start of each interface are run a few at a time
+	 * from the event loop so the first ones can make progress. */
 	TAILQ_FOREACH(ifp, ctx.ifaces, next) {
 		if (ifp->active)
-			eloop_timeout_add_sec(ctx.eloop, 0,
-			    dhcpcd_prestartinterface, ifp);
+			pace_queuestart(ifp, dhcpcd_runprestartinterface);
 	}
 
 run_loop:
@@ -2599,31 +3521,31 @@ exit_failure:
 exit1:
 	if (!(ctx.options & DHCPCD_TEST) && control_stop(&ctx) == -1)
 		logerr("%s: control_stop", __func__);
-	if (ifaddrs != NULL) {
-#ifdef PRIVSEP_GETIFADDRS
-		if (IN_PRIVSEP(&ctx))
-			free(ifaddrs);
-		else
-#endif
-			freeifaddrs(ifaddrs);
-	}
+	if_freeifaddrs(&ctx, &ifaddrs);
+	dhcp_flushleases(&ctx);
+	leasedb_close(&ctx);
+	script_drain(&ctx);
+	hooks_free(&ctx);
 #ifdef PRIVSEP
 	ps_stop(&ctx);
 #endif
 	/* Free memory and close fd's */
 	if (ctx.ifaces) {
 		while ((ifp = TAILQ_FIRST(ctx.ifaces))) {
-			TAILQ_REMOVE(ctx.ifaces, ifp, next);
+			if_remove(ifp);
 			if_free(ifp);
 		}
 		free(ctx.ifaces);
 		ctx.ifaces = NULL;
 	}
+	pace_free(&ctx);
+	handoff_free(&ctx);
 	free_options(&ctx, ifo);
 #ifdef HAVE_OPEN_MEMSTREAM
 	if (ctx.script_fp)
 		fclose(ctx.script_fp);
 #endif
+	script_worker_stop(&ctx);
 	free(ctx.script_buf);
 	free(ctx.script_env);
 	rt_dispose(&ctx);
@@ -2642,12 +3564,14 @@ exit1:
 #endif
 	if (ctx.script != dhcpcd_default_script)
 		free(ctx.script);
+	free(ctx.poll);
 #ifdef PRIVSEP
 	if (ps_stopwait(&ctx) != EXIT_SUCCESS)
 		i = EXIT_FAILURE;
 #endif
 	if (ctx.options & DHCPCD_STARTED && !(ctx.options & DHCPCD_FORKED)) {
 		loginfox(PACKAGE " exited");
+		logflush();
 
 #ifdef PRIVSEP
 		/* Sleep some for the exited log entry to be written. */
@@ -2659,8 +3583,25 @@ exit1:
 	if (ps_root_stop(&ctx) == -1)
 		i = EXIT_FAILURE;
 	eloop_free(ctx.ps_eloop);
+	free(ctx.ps_control_buf);
 #endif
 	eloop_free(ctx.eloop);
+	free_config_cache(&ctx);
+	/* When privilege separated we are chrooted, so whatever
+	 * started us has to start the next dhcpcd. */
+	if (ctx.restarting && i == EXIT_SUCCESS && !IN_PRIVSEP(&ctx) &&
+	    argv0 != NULL)
+	{
+#ifdef USE_SIGNALS
+		sigprocmask(SIG_SETMASK, &ctx.sigset, NULL);
+#endif
+		logflush();
+		ctx.argv[0] = argv0;
+		execvp(argv0, ctx.argv);
+		logerr("%s: execvp: %s", __func__, argv0);
+		i = EXIT_FAILURE;
+	}
+	free(argv0);
 	logclose();
 	free(ctx.logfile);
 	free(ctx.ctl_buf);
@@ -65,14 +65,43 @@
 #define IF_DATA_DHCP6	6
 #define IF_DATA_MAX	7
 
+#ifndef SMALL
+/* Packet counters for --dumpstats.
+ * Each protocol keeps its own to a cache line. */
+enum if_statproto {
+	IFS_BOOTP,
+	IFS_DHCP6,
+	IFS_RA,
+	IFS_ARP,
+	IFS_MAX
+};
+
+struct if_stats {
+	unsigned long long rx;
+	unsigned long long tx;
+	unsigned long long drop;	/* invalid or not for us */
+	unsigned long long cksum;	/* bad checksum */
+	unsigned long long xid;		/* transaction id mismatch */
+	unsigned long long retrans;
+	unsigned long long nak;		/* NAK or a failure status */
+};
+#define IF_STAT(ifp, p, f)	((ifp)->stats[(p)].f++)
+#else
+#define IF_STAT(ifp, p, f)	((void)0)
+#endif
+
 #ifdef __QNX__
 /* QNX carries defines for, but does not actually support PF_LINK */
 #undef IFLR_ACTIVE
 #endif
 
+struct if_iaid;
+
 struct interface {
 	struct dhcpcd_ctx *ctx;
 	TAILQ_ENTRY(interface) next;
+	rb_node_t name_tree;	/* in ctx->if_names */
+	rb_node_t index_tree;	/* in ctx->if_indexes */
 	char name[IF_NAMESIZE];
 	unsigned int index;
 	unsigned int active;
@@ -83,13 +112,19 @@ struct interface {
 	unsigned short vlanid;
 	unsigned int metric;
 	int carrier;
+	unsigned int linkgen;	/* last if_resync which saw us */
 	bool wireless;
 	uint8_t ssid[IF_SSIDLEN];
 	unsigned int ssid_len;
 
 	char profile[PROFILE_LEN];
 	struct if_options *options;
+	struct if_iaid *iaids;	/* in ctx->if_iaids */
+	size_t iaids_len;
 	void *if_data[IF_DATA_MAX];
+#ifndef SMALL
+	struct if_stats stats[IFS_MAX];
+#endif
 };
 TAILQ_HEAD(if_head, interface);
 
@@ -138,6 +173,10 @@ struct dhcpcd_ctx {
 	unsigned char *duid;
 	size_t duid_len;
 	struct if_head *ifaces;
+	rb_tree_t if_names;	/* ifaces by name */
+	rb_tree_t if_indexes;	/* ifaces by index */
+	rb_tree_t if_iaids;	/* IAIDs of configured ifaces */
+	unsigned int ifaces_gen;	/* bumped as ifaces changes */
 
 	char *ctl_buf;
 	size_t ctl_buflen;
@@ -145,10 +184,38 @@ struct dhcpcd_ctx {
 	size_t ctl_extra;
 
 	rb_tree_t routes;	/* our routes */
+	rb_tree_t kroutes;	/* kernel routes, kept by route events */
+	bool kroutes_valid;	/* kroutes is in step with the kernel */
 #ifdef RT_FREE_ROUTE_TABLE
-	rb_tree_t froutes;	/* free routes for re-use */
+	struct rt_slab *rt_slabs;	/* routes are carved from these */
+	struct rt_freeslot *rt_free;	/* free routes for re-use */
 #endif
 	size_t rt_order;	/* route order storage */
+	unsigned int rt_pending;	/* families waiting for rt_flush */
+	unsigned int route_delay;	/* msec rt_schedule waits */
+#ifndef SMALL
+	unsigned long long rt_builds;
+	unsigned long long rt_build_ns;		/* total time rt_build took */
+	unsigned long long rt_build_ns_max;
+#endif
+
+	rb_tree_t leases;		/* lease files waiting to be written */
+	unsigned int lease_write_delay;
+	bool lease_database;		/* keep leases in LEASEDB */
+	bool cbstats;			/* time callbacks for --dumpstats */
+	unsigned int config_gen;	/* bumped as options are read */
+	struct cf_cache *cf_cache;	/* dhcpcd.conf split into lines */
+	struct leasedb *leasedb;
+	rb_tree_t handoff;		/* leases handed over by a restart */
+	bool restarting;		/* stopping for --restart */
+
+	unsigned int start_rate;	/* interface starts per second */
+	TAILQ_HEAD(pace_head, pace) pace_queue;
+	unsigned long long pace_tat;	/* when the next start is due */
+	struct interface *pace_ifp;	/* start let through by pace_run */
+	void (*pace_cb)(void *);
+	unsigned int start_jobs;	/* interfaces started per loop pass */
+	struct pace_head start_queue;
 
 	int pf_inet_fd;
 #ifdef PF_LINK
@@ -158,6 +225,13 @@ struct dhcpcd_ctx {
 	int link_fd;
 #ifndef SMALL
 	int link_rcvbuf;
+	int link_rcvbuf_max;	/* grow link_rcvbuf up to this on overflow */
+	unsigned long long link_msgs;		/* messages read */
+	unsigned long long link_overflows;
+	unsigned long long link_rate;		/* messages last second */
+	unsigned long long link_rate_max;	/* most messages in a second */
+	unsigned long long link_rate_msgs;	/* link_msgs at link_rate_sec */
+	time_t link_rate_sec;
 #endif
 	int seq;	/* route message sequence no */
 	int sseq;	/* successful seq no sent */
@@ -166,6 +240,7 @@ struct dhcpcd_ctx {
 	sigset_t sigset;
 #endif
 	struct eloop *eloop;
+	char *poll;	/* polling mechanism for eloop */
 
 	char *script;
 #ifdef HAVE_OPEN_MEMSTREAM
@@ -175,6 +250,23 @@ struct dhcpcd_ctx {
 	size_t script_buflen;
 	char **script_env;
 	size_t script_envlen;
+	int script_worker_fd;
+	pid_t script_worker_pid;
+	char script_worker_env[sizeof(RUNDIR) + 32];
+	TAILQ_HEAD(script_jobq, script_job) script_jobs;
+	unsigned int script_jobs_max;	/* scripts run at once */
+	unsigned int script_jobs_running;
+#ifndef SMALL
+	unsigned long long script_runs;
+	unsigned long long script_ns;		/* total time scripts ran */
+	unsigned long long script_ns_max;
+#endif
+	TAILQ_HEAD(hook_resolv_head, hook_resolv) hook_resolv;
+	bool hook_resolv_written;
+	uint32_t hook_resolv_sum;	/* of the resolv.conf written */
+	time_t hook_resolv_mtime;
+	struct hook_table *hook_table;	/* hooks the script runs */
+	char *hook_skip;		/* skip_hooks for this event */
 
 	int control_fd;
 	int control_unpriv_fd;
@@ -182,6 +274,9 @@ struct dhcpcd_ctx {
 	char control_sock[sizeof(CONTROLSOCKET) + IF_NAMESIZE];
 	char control_sock_unpriv[sizeof(CONTROLSOCKET) + IF_NAMESIZE + 7];
 	gid_t control_group;
+	size_t control_queue_max;	/* events queued per listener */
+	unsigned long long control_coalesced;	/* events dropped for a newer */
+	unsigned long long control_slow;	/* listeners disconnected */
 
 	/* DHCP Enterprise options, RFC3925 */
 	struct dhcp_opt *vivso;
@@ -199,20 +294,48 @@ struct dhcpcd_ctx {
 #ifdef PRIVSEP
 	struct passwd *ps_user;	/* struct passwd for privsep user */
 	struct ps_process_head ps_processes;	/* List of spawned processes */
+	rb_tree_t ps_processids;	/* spawned processes by ps_id */
+	rb_tree_t ps_processpids;	/* spawned processes by pid */
 	struct ps_process *ps_root;
+	struct psr_req_head ps_root_reqs;	/* async requests to ps_root */
+	uint16_t ps_root_seq;	/* last request sent to ps_root */
+#ifndef SMALL
+	unsigned long long ps_root_sync;	/* requests waited for */
+	unsigned long long ps_root_sync_ns;
+	unsigned long long ps_root_sync_ns_max;
+	unsigned long long ps_root_async;
+#endif
+	struct ps_batch *ps_root_batch;	/* open batch for ps_root */
+	struct ipv6_batch *ipv6_batch;	/* addresses in ps_root_batch */
+	rb_tree_t ps_root_files;	/* files cached by ps_root */
+	TAILQ_HEAD(psr_file_head, psr_file) ps_root_filelru;
+	size_t ps_root_nfiles;
 	struct ps_process *ps_inet;
 	struct ps_process *ps_ctl;
+#ifdef INET
+	struct ps_process_head ps_bpf_pool;	/* BPF processes not in use */
+	unsigned int ps_bpf_npool;
+	unsigned int ps_bpf_poolsize;	/* how many to keep forked */
+	unsigned int ps_bpf_poolid;	/* last id given to the pool */
+	bool ps_bpf_shared;		/* one process for all BPF */
+	struct ps_process *ps_bpf;	/* the shared BPF process */
+	rb_tree_t ps_bpf_ents;		/* BPF open in ps_bpf */
+#endif
 	int ps_data_fd;		/* data returned from processes */
 	int ps_log_fd;		/* chroot logging */
 	int ps_log_root_fd;	/* outside chroot log reader */
 	struct eloop *ps_eloop;	/* eloop for polling root data */
 	struct fd_list *ps_control;		/* Queue for the above */
 	struct fd_list *ps_control_client;	/* Queue for the above */
+	char *ps_control_buf;		/* partial events from ps_control */
+	size_t ps_control_buflen;
+	size_t ps_control_bufsize;
 #endif
 
 #ifdef INET
 	struct dhcp_opt *dhcp_opts;
 	size_t dhcp_opts_len;
+	struct dhcp_optmap dhcp_optmap;
 
 	int udp_rfd;
 	int udp_wfd;
@@ -222,15 +345,24 @@ struct dhcpcd_ctx {
 	 * practically never. See RFC3396 for details. */
 	uint8_t *opt_buffer;
 	size_t opt_buffer_len;
+	struct dhcp_optindex *opt_index;	/* see dhcp_indexoptions */
+	rb_tree_t dhcp_xids;			/* transactions by xid */
+#ifdef HAVE_SENDMMSG
+	struct dhcp_txq *dhcp_txq;		/* see dhcp_queueudp */
+#endif
 #endif
 #ifdef INET6
 	uint8_t *secret;
 	size_t secret_len;
+	rb_tree_t stableprivate;	/* ipv6_makestableprivate results */
+	size_t stableprivate_len;
+	rb_tree_t ipv6_addrs;		/* interface addresses by addr, iface */
 
 #ifndef __sun
 	int nd_fd;
 #endif
 	struct ra_head *ra_routers;
+	rb_tree_t ra_tree;		/* ra_routers by iface and from */
 
 	struct dhcp_opt *nd_opts;
 	size_t nd_opts_len;
@@ -239,6 +371,11 @@ struct dhcpcd_ctx {
 	int dhcp6_wfd;
 	struct dhcp_opt *dhcp6_opts;
 	size_t dhcp6_opts_len;
+	struct dhcp_optmap dhcp6_optmap;
+	rb_tree_t dhcp6_xids;			/* transactions in flight */
+#ifdef HAVE_SENDMMSG
+	struct dhcp6_txq *dhcp6_txq;		/* see dhcp6_queuemsg */
+#endif
 #endif
 
 #ifndef __linux__
@@ -251,6 +388,10 @@ struct dhcpcd_ctx {
 	int dev_fd;
 	struct dev *dev;
 	void *dev_handle;
+	int (*dev_handler)(void *, int, const char *);
+	int (*dev_addhandler)(void *, int, char * const *);
+	char **dev_added;	/* interfaces added since the last batch */
+	int dev_nadded;
 #endif
 };
 
@@ -265,6 +406,7 @@ extern const char *dhcpcd_default_script;
 
 int dhcpcd_ifafwaiting(const struct interface *);
 int dhcpcd_afwaiting(const struct dhcpcd_ctx *);
+void dhcpcd_initctx(struct dhcpcd_ctx *);
 void dhcpcd_daemonise(struct dhcpcd_ctx *);
 
 void dhcpcd_signal_cb(int, void *);
@@ -273,6 +415,7 @@ void dhcpcd_linkoverflow(struct dhcpcd_ctx *);
 int dhcpcd_handleargs(struct dhcpcd_ctx *, struct fd_list *, int, char **);
 void dhcpcd_handlecarrier(struct interface *, int, unsigned int);
 int dhcpcd_handleinterface(void *, int, const char *);
+int dhcpcd_handleinterfaces(void *, int, char * const *);
 void dhcpcd_handlehwaddr(struct interface *, uint16_t, const void *, uint8_t);
 void dhcpcd_dropinterface(struct interface *, const char *);
 int dhcpcd_selectprofile(struct interface *, const char *);
@@ -53,6 +53,21 @@
  * but it's yet another fd to use.
  *
  * Taking this all into account, ppoll(2) is the default mechanism used here.
+ *
+ * io_uring(7) can be used on Linux 5.11 and newer. Like epoll it needs an
+ * extra fd per process, but the interest list is managed by submitting
+ * poll requests which are batched into the wait syscall, so registering
+ * fds and re-arming them after each event costs no extra syscalls.
+ * Only removing an fd needs one, the same as epoll.
+ * The ring is restricted to poll requests so it cannot be used to get
+ * around the privsep sandbox.
+ * It is only the default when configure is told to use it.
+ *
+ * Every mechanism config.h says is available is compiled in and one is
+ * picked for each eloop at runtime with eloop_set_backend(), so they can
+ * be compared without rebuilding.
+ * ELOOP_DEFAULT can name the default, otherwise it's the first found of
+ * ppoll, kqueue, epoll, io_uring and pselect.
  */
 
 #if (defined(__unix__) || defined(unix)) && !defined(USG)
@@ -77,24 +92,13 @@
 #include "config.h"
 #endif
 
-/* Prioritise which mechanism we want to use.*/
-#if defined(HAVE_PPOLL)
-#undef HAVE_EPOLL
-#undef HAVE_KQUEUE
-#undef HAVE_PSELECT
-#elif defined(HAVE_POLLTS)
+/* pollts(2) is ppoll(2) with a different name. */
+#if defined(HAVE_POLLTS)
 #define HAVE_PPOLL
 #define ppoll pollts
-#undef HAVE_EPOLL
-#undef HAVE_KQUEUE
-#undef HAVE_PSELECT
-#elif defined(HAVE_KQUEUE)
-#undef HAVE_EPOLL
-#undef HAVE_PSELECT
-#elif defined(HAVE_EPOLL)
-#undef HAVE_KQUEUE
-#undef HAVE_PSELECT
-#elif !defined(HAVE_PSELECT)
+#endif
+#if !defined(HAVE_PPOLL) && !defined(HAVE_KQUEUE) && \
+    !defined(HAVE_EPOLL) && !defined(HAVE_IO_URING) && !defined(HAVE_PSELECT)
 #define HAVE_PPOLL
 #endif
 
@@ -106,18 +110,24 @@
 #else
 #define	_kevent kevent
 #endif
-#define NFD 2
-#elif defined(HAVE_EPOLL)
+#endif
+#if defined(HAVE_EPOLL)
 #include <sys/epoll.h>
-#define	NFD 1
-#elif defined(HAVE_PPOLL)
+#endif
+#if defined(HAVE_IO_URING)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#if defined(HAVE_PPOLL) || defined(HAVE_IO_URING)
 #include <poll.h>
-#define NFD 1
-#elif defined(HAVE_PSELECT)
+#endif
+#if defined(HAVE_PSELECT)
 #include <sys/select.h>
 #endif
 
 #include "eloop.h"
+#include "probe.h"
 
 #ifndef UNUSED
 #define UNUSED(a) (void)((a))
@@ -180,48 +190,159 @@ struct eloop_event {
 	void (*cb)(void *, unsigned short);
 	void *cb_arg;
 	unsigned short events;
+	int prio;
 #ifdef HAVE_PPOLL
 	struct pollfd *pollfd;
 #endif
+#ifdef HAVE_IO_URING
+	uint32_t gen;
+#endif
 };
 
+/*
+ * Timeouts are kept in a binary min-heap ordered by expiry so that the
+ * next one to fire is always at the root.
+ * They are also hashed by their argument in a handle table so that
+ * re-arming or deleting a timeout for an object does not need to walk
+ * every pending timeout.
+ * next is used to chain the hash bucket or the free list.
+ *
+ * Expiry is an absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * 64 bits of nanoseconds covers UINT_MAX seconds from now for
+ * well over a hundred years of uptime, so we don't need to care about
+ * time_t wrapping as we only ever read the monotonic clock.
+ */
 struct eloop_timeout {
 	TAILQ_ENTRY(eloop_timeout) next;
-	unsigned int seconds;
-	unsigned int nseconds;
+	unsigned long long when;	/* CLOCK_MONOTONIC nanoseconds */
+	unsigned long long order;
+	size_t heap;
 	void (*callback)(void *);
 	void *arg;
 	int queue;
 };
 
+/* Initial size of the timeout handle table, must be a power of two. */
+#define ELOOP_TIMEOUT_HASH	64
+
+#ifdef HAVE_IO_URING
+/*
+ * Requests are queued here and only copied into the submission ring
+ * when we next wait or remove an fd. The ring memory is shared with our
+ * parent after fork(2) until eloop_forked(), so it must not be written
+ * before then.
+ */
+struct eloop_uring_req {
+	uint8_t opcode;
+	int fd;
+	uint32_t events;
+	uint64_t addr;
+	uint64_t user_data;
+};
+
+struct eloop_uring {
+	void *sq_ring;
+	size_t sq_ring_len;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+
+	void *cq_ring;
+	size_t cq_ring_len;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct eloop_uring_req *reqs;
+	size_t nreqs;
+	size_t reqs_len;
+	uint32_t gen;
+
+	struct eloop_uring_cqe *ready;
+	size_t ready_len;
+};
+
+/* A completion copied out of the ring, with the priority of its event
+ * when it was reaped as callbacks can change that. */
+struct eloop_uring_cqe {
+	uint64_t user_data;
+	int32_t res;
+	int prio;
+};
+
+#define	ELOOP_URING_SQ		128
+#define	ELOOP_URING_CQ		4096
+/* user_data for requests we don't want a completion for */
+#define	ELOOP_URING_IGNORE	UINT64_MAX
+#define	ELOOP_URING_UD(e)	(((uint64_t)(e)->gen << 32) | (uint32_t)(e)->fd)
+#endif
+
+/*
+ * A polling mechanism.
+ * event_add is given the events wanted, e->events is what is currently
+ * registered which is 0 for a new event.
+ * Each event needs nfd elements of fdsize in eloop->fds.
+ * If signal_set is given, signals are delivered by the mechanism itself
+ * rather than by our signal handler.
+ */
+struct eloop_backend {
+	const char *name;
+	size_t nfd;
+	size_t fdsize;
+	int (*open)(struct eloop *);
+	void (*close)(struct eloop *);
+	int (*event_add)(struct eloop *, struct eloop_event *, unsigned short,
+	    bool);
+	int (*event_delete)(struct eloop *, struct eloop_event *);
+	int (*signal_set)(struct eloop *, bool);
+	void (*setup)(struct eloop *);
+	int (*run)(struct eloop *, const struct timespec *, const sigset_t *);
+};
+
 struct eloop {
 	TAILQ_HEAD (event_head, eloop_event) events;
 	size_t nevents;
 	struct event_head free_events;
-
-	struct timespec now;
-	TAILQ_HEAD (timeout_head, eloop_timeout) timeouts;
+	struct eloop_event **event_fds;	/* indexed by fd */
+	size_t event_fds_len;
+
+	unsigned long long now;
+	unsigned long long woke;	/* callbacks are timed from here */
+	struct eloop_timeout **timeouts;
+	size_t ntimeouts;
+	size_t timeouts_len;
+	unsigned long long timeouts_order;
+	TAILQ_HEAD (timeout_head, eloop_timeout) *timeout_hash;
+	size_t timeout_hashlen;
 	struct timeout_head free_timeouts;
 
 	const int *signals;
 	size_t nsignals;
 	void (*signal_cb)(int, void *);
 	void *signal_cb_ctx;
+	void (*idle_cb)(void *);
+	void *idle_cb_ctx;
 
-#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
-	int fd;
-#endif
-#if defined(HAVE_KQUEUE)
-	struct kevent *fds;
-#elif defined(HAVE_EPOLL)
-	struct epoll_event *fds;
-#elif defined(HAVE_PPOLL)
-	struct pollfd *fds;
-#endif
-#if !defined(HAVE_PSELECT)
+	const struct eloop_backend *backend;
+	int fd;			/* kqueue, epoll or io_uring */
+	void *fds;		/* kevent, epoll_event or pollfd array */
 	size_t nfds;
+#if defined(HAVE_IO_URING)
+	struct eloop_uring uring;
 #endif
 
+	unsigned int batch;
+	struct eloop_stats stats;
+	bool cbstats_on;
+	struct eloop_cbstats *cbstats;
+	size_t ncbstats;
+	size_t cbstats_len;
+
 	int exitcode;
 	bool exitnow;
 	bool events_need_setup;
@@ -246,59 +367,72 @@ eloop_realloca(void *ptr, size_t n, size_t size)
 }
 #endif
 
-
 static int
 eloop_event_setup_fds(struct eloop *eloop)
 {
+	const struct eloop_backend *b = eloop->backend;
 	struct eloop_event *e, *ne;
-#if defined(HAVE_KQUEUE)
-	struct kevent *pfd;
-	size_t nfds = eloop->nsignals;
-#elif defined(HAVE_EPOLL)
-	struct epoll_event *pfd;
-	size_t nfds = 0;
-#elif defined(HAVE_PPOLL)
-	struct pollfd *pfd;
-	size_t nfds = 0;
-#endif
-
-#ifndef HAVE_PSELECT
-	nfds += eloop->nevents * NFD;
-	if (eloop->nfds < nfds) {
-		pfd = eloop_realloca(eloop->fds, nfds, sizeof(*pfd));
-		if (pfd == NULL)
-			return -1;
-		eloop->fds = pfd;
-		eloop->nfds = nfds;
+	size_t nfds;
+	void *pfd;
+
+	if (b->nfd != 0) {
+		nfds = eloop->nevents * b->nfd;
+		if (b->signal_set != NULL)
+			nfds += eloop->nsignals;
+		if (eloop->nfds < nfds) {
+			pfd = eloop_realloca(eloop->fds, nfds, b->fdsize);
+			if (pfd == NULL)
+				return -1;
+			eloop->fds = pfd;
+			eloop->nfds = nfds;
+		}
 	}
-#endif
 
-#ifdef HAVE_PPOLL
-	pfd = eloop->fds;
-#endif
 	TAILQ_FOREACH_SAFE(e, &eloop->events, next, ne) {
 		if (e->fd == -1) {
 			TAILQ_REMOVE(&eloop->events, e, next);
 			TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
-			continue;
 		}
-#ifdef HAVE_PPOLL
-		e->pollfd = pfd;
-		pfd->fd = e->fd;
-		pfd->events = 0;
-		if (e->events & ELE_READ)
-			pfd->events |= POLLIN;
-		if (e->events & ELE_WRITE)
-			pfd->events |= POLLOUT;
-		pfd->revents = 0;
-		pfd++;
-#endif
 	}
 
+	if (b->setup != NULL)
+		b->setup(eloop);
 	eloop->events_need_setup = false;
 	return 0;
 }
 
+static struct eloop_event *
+eloop_event_find(const struct eloop *eloop, int fd)
+{
+
+	if ((size_t)fd >= eloop->event_fds_len)
+		return NULL;
+	return eloop->event_fds[fd];
+}
+
+static int
+eloop_event_setfd(struct eloop *eloop, int fd, struct eloop_event *e)
+{
+
+	if ((size_t)fd >= eloop->event_fds_len) {
+		struct eloop_event **efds;
+		size_t len = eloop->event_fds_len == 0 ?
+		    64 : eloop->event_fds_len;
+
+		while (len <= (size_t)fd)
+			len *= 2;
+		efds = eloop_realloca(eloop->event_fds, len, sizeof(*efds));
+		if (efds == NULL)
+			return -1;
+		memset(efds + eloop->event_fds_len, 0,
+		    (len - eloop->event_fds_len) * sizeof(*efds));
+		eloop->event_fds = efds;
+		eloop->event_fds_len = len;
+	}
+	eloop->event_fds[fd] = e;
+	return 0;
+}
+
 size_t
 eloop_event_count(const struct eloop *eloop)
 {
@@ -307,31 +441,22 @@ eloop_event_count(const struct eloop *eloop)
 }
 
 int
-eloop_event_add(struct eloop *eloop, int fd, unsigned short events,
-    void (*cb)(void *, unsigned short), void *cb_arg)
+eloop_p_event_add(struct eloop *eloop, int prio, int fd,
+    unsigned short events, void (*cb)(void *, unsigned short), void *cb_arg)
 {
 	struct eloop_event *e;
 	bool added;
-#if defined(HAVE_KQUEUE)
-	struct kevent ke[2], *kep = &ke[0];
-	size_t n;
-#elif defined(HAVE_EPOLL)
-	struct epoll_event epe;
-	int op;
-#endif
 
 	assert(eloop != NULL);
 	assert(cb != NULL && cb_arg != NULL);
-	if (fd == -1 || !(events & (ELE_READ | ELE_WRITE | ELE_HANGUP))) {
+	if (fd < 0 || !(events & (ELE_READ | ELE_WRITE | ELE_HANGUP)) ||
+	    prio < 0 || prio >= ELOOP_NPRIO)
+	{
 		errno = EINVAL;
 		return -1;
 	}
 
-	TAILQ_FOREACH(e, &eloop->events, next) {
-		if (e->fd == fd)
-			break;
-	}
-
+	e = eloop_event_find(eloop, fd);
 	if (e == NULL) {
 		added = true;
 		e = TAILQ_FIRST(&eloop->free_events);
@@ -343,6 +468,10 @@ eloop_event_add(struct eloop *eloop, int fd, unsigned short events,
 				return -1;
 			}
 		}
+		if (eloop_event_setfd(eloop, fd, e) == -1) {
+			TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
+			return -1;
+		}
 		TAILQ_INSERT_HEAD(&eloop->events, e, next);
 		eloop->nevents++;
 		e->fd = fd;
@@ -352,56 +481,19 @@ eloop_event_add(struct eloop *eloop, int fd, unsigned short events,
 
 	e->cb = cb;
 	e->cb_arg = cb_arg;
+	e->prio = prio;
 
-#if defined(HAVE_KQUEUE)
-	n = 2;
-	if (events & ELE_READ && !(e->events & ELE_READ))
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_READ, EV_ADD, 0, 0, e);
-	else if (!(events & ELE_READ) && e->events & ELE_READ)
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_READ, EV_DELETE, 0, 0, e);
-	else
-		n--;
-	if (events & ELE_WRITE && !(e->events & ELE_WRITE))
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_WRITE, EV_ADD, 0, 0, e);
-	else if (!(events & ELE_WRITE) && e->events & ELE_WRITE)
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_WRITE, EV_DELETE, 0, 0, e);
-	else
-		n--;
-#ifdef EVFILT_PROCDESC
-	if (events & ELE_HANGUP)
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_PROCDESC, EV_ADD,
-		    NOTE_EXIT, 0, e);
-	else
-		n--;
-#endif
-	if (n != 0 && _kevent(eloop->fd, ke, n, NULL, 0, NULL) == -1) {
-		if (added) {
-			TAILQ_REMOVE(&eloop->events, e, next);
-			TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
-		}
-		return -1;
-	}
-#elif defined(HAVE_EPOLL)
-	memset(&epe, 0, sizeof(epe));
-	epe.data.ptr = e;
-	if (events & ELE_READ)
-		epe.events |= EPOLLIN;
-	if (events & ELE_WRITE)
-		epe.events |= EPOLLOUT;
-	op = added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
-	if (epe.events != 0 && epoll_ctl(eloop->fd, op, fd, &epe) == -1) {
+	if (eloop->backend->event_add != NULL &&
+	    eloop->backend->event_add(eloop, e, events, added) == -1)
+	{
 		if (added) {
+			eloop->event_fds[fd] = NULL;
+			eloop->nevents--;
 			TAILQ_REMOVE(&eloop->events, e, next);
 			TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
 		}
 		return -1;
 	}
-#elif defined(HAVE_PPOLL)
-	e->pollfd = NULL;
-	UNUSED(added);
-#else
-	UNUSED(added);
-#endif
 	e->events = events;
 	eloop->events_need_setup = true;
 	return 0;
@@ -411,42 +503,23 @@ int
 eloop_event_delete(struct eloop *eloop, int fd)
 {
 	struct eloop_event *e;
-#if defined(HAVE_KQUEUE)
-	struct kevent ke[2], *kep = &ke[0];
-	size_t n;
-#endif
 
 	assert(eloop != NULL);
-	if (fd == -1) {
+	if (fd < 0) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	TAILQ_FOREACH(e, &eloop->events, next) {
-		if (e->fd == fd)
-			break;
-	}
+	e = eloop_event_find(eloop, fd);
 	if (e == NULL) {
 		errno = ENOENT;
 		return -1;
 	}
 
-#if defined(HAVE_KQUEUE)
-	n = 0;
-	if (e->events & ELE_READ) {
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_READ, EV_DELETE, 0, 0, e);
-		n++;
-	}
-	if (e->events & ELE_WRITE) {
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_WRITE, EV_DELETE, 0, 0, e);
-		n++;
-	}
-	if (n != 0 && _kevent(eloop->fd, ke, n, NULL, 0, NULL) == -1)
+	if (eloop->backend->event_delete != NULL &&
+	    eloop->backend->event_delete(eloop, e) == -1)
 		return -1;
-#elif defined(HAVE_EPOLL)
-	if (epoll_ctl(eloop->fd, EPOLL_CTL_DEL, fd, NULL) == -1)
-		return -1;
-#endif
+	eloop->event_fds[fd] = NULL;
 	e->fd = -1;
 	eloop->nevents--;
 	eloop->events_need_setup = true;
@@ -488,62 +561,329 @@ eloop_timespec_diff(const struct timespec *tsp, const struct timespec *usp,
 	return secs;
 }
 
+static int
+eloop_getnow(struct eloop *eloop)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return -1;
+	eloop->now = (unsigned long long)ts.tv_sec * NSEC_PER_SEC +
+	    (unsigned long long)ts.tv_nsec;
+	return 0;
+}
+
+/* Callbacks can move eloop->now on, so the backends also note here
+ * when they woke with events. */
 static void
-eloop_reduce_timers(struct eloop *eloop)
+eloop_getwoke(struct eloop *eloop)
 {
-	struct timespec now;
-	unsigned long long secs;
-	unsigned int nsecs;
-	struct eloop_timeout *t;
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	secs = eloop_timespec_diff(&now, &eloop->now, &nsecs);
+	if (eloop_getnow(eloop) == 0)
+		eloop->woke = eloop->now;
+}
 
-	TAILQ_FOREACH(t, &eloop->timeouts, next) {
-		if (secs > t->seconds) {
-			t->seconds = 0;
-			t->nseconds = 0;
-		} else {
-			t->seconds -= (unsigned int)secs;
-			if (nsecs > t->nseconds) {
-				if (t->seconds == 0)
-					t->nseconds = 0;
-				else {
-					t->seconds--;
-					t->nseconds = NSEC_PER_SEC
-					    - (nsecs - t->nseconds);
-				}
-			} else
-				t->nseconds -= nsecs;
+/*
+ * Callback statistics are found by a linear search.
+ * A program only has a few dozen distinct callbacks and this is only
+ * done when they are enabled.
+ */
+static struct eloop_cbstats *
+eloop_cbstats_find(struct eloop *eloop,
+    void (*event_cb)(void *, unsigned short), void (*timeout_cb)(void *))
+{
+	struct eloop_cbstats *cs;
+	size_t i;
+
+	for (i = 0, cs = eloop->cbstats; i < eloop->ncbstats; i++, cs++) {
+		if (cs->event_cb == event_cb && cs->timeout_cb == timeout_cb)
+			return cs;
+	}
+
+	if (eloop->ncbstats == eloop->cbstats_len) {
+		size_t len = eloop->cbstats_len == 0 ?
+		    16 : eloop->cbstats_len * 2;
+
+		cs = eloop_realloca(eloop->cbstats, len, sizeof(*cs));
+		if (cs == NULL)
+			return NULL;
+		eloop->cbstats = cs;
+		eloop->cbstats_len = len;
+	}
+	cs = &eloop->cbstats[eloop->ncbstats++];
+	memset(cs, 0, sizeof(*cs));
+	cs->event_cb = event_cb;
+	cs->timeout_cb = timeout_cb;
+	return cs;
+}
+
+static void
+eloop_cbstats_add(struct eloop *eloop, size_t idx,
+    const struct timespec *start)
+{
+	struct eloop_cbstats *cs = &eloop->cbstats[idx];
+	struct timespec end;
+	unsigned long long ns, us;
+	size_t b;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+		return;
+	ns = (unsigned long long)(end.tv_sec - start->tv_sec) * NSEC_PER_SEC +
+	    (unsigned long long)end.tv_nsec - (unsigned long long)start->tv_nsec;
+
+	for (b = 0, us = ns / 1000; us != 0 && b < ELOOP_CBHIST - 1; b++)
+		us >>= 1;
+	cs->calls++;
+	cs->total_ns += ns;
+	if (ns > cs->max_ns)
+		cs->max_ns = ns;
+	cs->hist[b]++;
+}
+
+/*
+ * The callback may clear the eloop which frees the event or
+ * grow cbstats, so only the index is held over the call.
+ */
+static void
+eloop_event_dispatch(struct eloop *eloop, struct eloop_event *e,
+    unsigned short events)
+{
+	void (*cb)(void *, unsigned short) = e->cb;
+	struct eloop_cbstats *cs;
+	struct timespec start;
+	size_t idx = SIZE_MAX;
+
+	if (eloop->cbstats_on &&
+	    (cs = eloop_cbstats_find(eloop, cb, NULL)) != NULL &&
+	    clock_gettime(CLOCK_MONOTONIC, &start) == 0)
+		idx = (size_t)(cs - eloop->cbstats);
+	PROBE3(eloop_event, cb, e->fd, events);
+	cb(e->cb_arg, events);
+	PROBE1(eloop_event_done, cb);
+	if (idx != SIZE_MAX)
+		eloop_cbstats_add(eloop, idx, &start);
+}
+
+static void
+eloop_timeout_dispatch(struct eloop *eloop, struct eloop_timeout *t)
+{
+	void (*cb)(void *) = t->callback;
+	struct eloop_cbstats *cs;
+	struct timespec start;
+	size_t idx = SIZE_MAX;
+
+	if (eloop->cbstats_on &&
+	    (cs = eloop_cbstats_find(eloop, NULL, cb)) != NULL &&
+	    clock_gettime(CLOCK_MONOTONIC, &start) == 0)
+		idx = (size_t)(cs - eloop->cbstats);
+	PROBE1(eloop_timeout, cb);
+	cb(t->arg);
+	PROBE1(eloop_timeout_done, cb);
+	if (idx != SIZE_MAX)
+		eloop_cbstats_add(eloop, idx, &start);
+}
+
+/*
+ * Low priority events ready along with others wait if a timeout fell due
+ * while dispatching, so one is late by a low priority callback at most.
+ * Every mechanism is level triggered, so they are just reported again
+ * once the timeouts have run.
+ * The clock is read here rather than updating eloop->now as that
+ * is used to time the callbacks.
+ */
+static bool
+eloop_event_defer(const struct eloop *eloop, int prio)
+{
+	struct timespec ts;
+
+	if (prio != ELOOP_PRIO_LOW || eloop->ntimeouts == 0 ||
+	    clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return false;
+	return eloop->timeouts[0]->when <=
+	    (unsigned long long)ts.tv_sec * NSEC_PER_SEC +
+	    (unsigned long long)ts.tv_nsec;
+}
+
+/* Timeouts expiring at the same time fire in the order they were added. */
+static bool
+eloop_timeout_before(const struct eloop_timeout *a,
+    const struct eloop_timeout *b)
+{
+
+	if (a->when != b->when)
+		return a->when < b->when;
+	return a->order < b->order;
+}
+
+static void
+eloop_heap_set(struct eloop *eloop, size_t i, struct eloop_timeout *t)
+{
+
+	eloop->timeouts[i] = t;
+	t->heap = i;
+}
+
+static void
+eloop_heap_up(struct eloop *eloop, size_t i)
+{
+	struct eloop_timeout *t = eloop->timeouts[i];
+	size_t parent;
+
+	while (i != 0) {
+		parent = (i - 1) / 2;
+		if (!eloop_timeout_before(t, eloop->timeouts[parent]))
+			break;
+		eloop_heap_set(eloop, i, eloop->timeouts[parent]);
+		i = parent;
+	}
+	eloop_heap_set(eloop, i, t);
+}
+
+static void
+eloop_heap_down(struct eloop *eloop, size_t i)
+{
+	struct eloop_timeout *t = eloop->timeouts[i];
+	size_t child;
+
+	for (;;) {
+		child = (i * 2) + 1;
+		if (child >= eloop->ntimeouts)
+			break;
+		if (child + 1 < eloop->ntimeouts &&
+		    eloop_timeout_before(eloop->timeouts[child + 1],
+		    eloop->timeouts[child]))
+			child++;
+		if (!eloop_timeout_before(eloop->timeouts[child], t))
+			break;
+		eloop_heap_set(eloop, i, eloop->timeouts[child]);
+		i = child;
+	}
+	eloop_heap_set(eloop, i, t);
+}
+
+static void
+eloop_heap_fix(struct eloop *eloop, size_t i)
+{
+
+	if (i != 0 &&
+	    eloop_timeout_before(eloop->timeouts[i],
+	    eloop->timeouts[(i - 1) / 2]))
+		eloop_heap_up(eloop, i);
+	else
+		eloop_heap_down(eloop, i);
+}
+
+static int
+eloop_heap_insert(struct eloop *eloop, struct eloop_timeout *t)
+{
+
+	if (eloop->ntimeouts == eloop->timeouts_len) {
+		struct eloop_timeout **nt;
+		size_t len;
+
+		len = eloop->timeouts_len == 0 ? 16 : eloop->timeouts_len * 2;
+		nt = eloop_realloca(eloop->timeouts, len, sizeof(*nt));
+		if (nt == NULL)
+			return -1;
+		eloop->timeouts = nt;
+		eloop->timeouts_len = len;
+	}
+
+	eloop_heap_set(eloop, eloop->ntimeouts++, t);
+	eloop_heap_up(eloop, t->heap);
+	return 0;
+}
+
+static void
+eloop_heap_remove(struct eloop *eloop, struct eloop_timeout *t)
+{
+	size_t i = t->heap;
+
+	assert(i < eloop->ntimeouts && eloop->timeouts[i] == t);
+	if (--eloop->ntimeouts == i)
+		return;
+	eloop_heap_set(eloop, i, eloop->timeouts[eloop->ntimeouts]);
+	eloop_heap_fix(eloop, i);
+}
+
+static struct timeout_head *
+eloop_timeout_bucket(const struct eloop *eloop, const void *arg)
+{
+	uintptr_t h = (uintptr_t)arg;
+
+	/* Pointers are aligned, so mix the high bits into the low ones. */
+	h ^= h >> 16;
+	h *= 0x45d9f3bU;
+	h ^= h >> 16;
+	return &eloop->timeout_hash[h & (eloop->timeout_hashlen - 1)];
+}
+
+static int
+eloop_timeout_hash_grow(struct eloop *eloop)
+{
+	struct timeout_head *ohash = eloop->timeout_hash, *nhash;
+	size_t i, olen = eloop->timeout_hashlen, nlen;
+	struct eloop_timeout *t;
+
+	nlen = olen == 0 ? ELOOP_TIMEOUT_HASH : olen * 2;
+	nhash = eloop_realloca(NULL, nlen, sizeof(*nhash));
+	if (nhash == NULL)
+		return -1;
+	for (i = 0; i < nlen; i++)
+		TAILQ_INIT(&nhash[i]);
+
+	eloop->timeout_hash = nhash;
+	eloop->timeout_hashlen = nlen;
+	for (i = 0; i < olen; i++) {
+		while ((t = TAILQ_FIRST(&ohash[i])) != NULL) {
+			TAILQ_REMOVE(&ohash[i], t, next);
+			TAILQ_INSERT_TAIL(eloop_timeout_bucket(eloop, t->arg),
+			    t, next);
 		}
 	}
+	free(ohash);
+	return 0;
+}
+
+static void
+eloop_timeout_remove(struct eloop *eloop, struct eloop_timeout *t)
+{
 
-	eloop->now = now;
+	TAILQ_REMOVE(eloop_timeout_bucket(eloop, t->arg), t, next);
+	eloop_heap_remove(eloop, t);
 }
 
 /*
  * This implementation should cope with UINT_MAX seconds on a system
- * where time_t is INT32_MAX. It should also cope with the monotonic timer
- * wrapping, although this is highly unlikely.
+ * where time_t is INT32_MAX as the deadline is not stored as a time_t.
  * unsigned int should match or be greater than any on wire specified timeout.
+ *
+ * If slack is given, the deadline is rounded up to the next multiple of it.
+ * Timeouts with the same slack expiring close to each other then share the
+ * exact same deadline and are all serviced from one wakeup.
  */
 static int
 eloop_q_timeout_add(struct eloop *eloop, int queue,
-    unsigned int seconds, unsigned int nseconds,
+    unsigned int seconds, unsigned int nseconds, unsigned long long slack,
     void (*callback)(void *), void *arg)
 {
-	struct eloop_timeout *t, *tt = NULL;
+	struct timeout_head *bucket;
+	struct eloop_timeout *t;
+	bool added;
 
 	assert(eloop != NULL);
 	assert(callback != NULL);
 	assert(nseconds <= NSEC_PER_SEC);
 
-	/* Remove existing timeout if present. */
-	TAILQ_FOREACH(t, &eloop->timeouts, next) {
-		if (t->callback == callback && t->arg == arg) {
-			TAILQ_REMOVE(&eloop->timeouts, t, next);
+	if (eloop->ntimeouts >= eloop->timeout_hashlen &&
+	    eloop_timeout_hash_grow(eloop) == -1)
+		return -1;
+
+	/* Find an existing timeout to re-arm. */
+	bucket = eloop_timeout_bucket(eloop, arg);
+	TAILQ_FOREACH(t, bucket, next) {
+		if (t->callback == callback && t->arg == arg)
 			break;
-		}
 	}
 
 	if (t == NULL) {
@@ -554,27 +894,30 @@ eloop_q_timeout_add(struct eloop *eloop, int queue,
 			if ((t = malloc(sizeof(*t))) == NULL)
 				return -1;
 		}
-	}
-
-	eloop_reduce_timers(eloop);
+		added = true;
+	} else
+		added = false;
 
-	t->seconds = seconds;
-	t->nseconds = nseconds;
+	eloop_getnow(eloop);
+	t->when = eloop->now +
+	    (unsigned long long)seconds * NSEC_PER_SEC + nseconds;
+	if (slack != 0)
+		t->when = ((t->when + slack - 1) / slack) * slack;
+	t->order = eloop->timeouts_order++;
 	t->callback = callback;
 	t->arg = arg;
 	t->queue = queue;
 
-	/* The timeout list should be in chronological order,
-	 * soonest first. */
-	TAILQ_FOREACH(tt, &eloop->timeouts, next) {
-		if (t->seconds < tt->seconds ||
-		    (t->seconds == tt->seconds && t->nseconds < tt->nseconds))
-		{
-			TAILQ_INSERT_BEFORE(tt, t, next);
-			return 0;
-		}
+	if (!added) {
+		eloop_heap_fix(eloop, t->heap);
+		return 0;
+	}
+
+	if (eloop_heap_insert(eloop, t) == -1) {
+		TAILQ_INSERT_TAIL(&eloop->free_timeouts, t, next);
+		return -1;
 	}
-	TAILQ_INSERT_TAIL(&eloop->timeouts, t, next);
+	TAILQ_INSERT_TAIL(bucket, t, next);
 	return 0;
 }
 
@@ -593,7 +936,7 @@ eloop_q_timeout_add_tv(struct eloop *eloop, int queue,
 	}
 
 	return eloop_q_timeout_add(eloop, queue,
-	    (unsigned int)when->tv_sec, (unsigned int)when->tv_sec,
+	    (unsigned int)when->tv_sec, (unsigned int)when->tv_nsec, 0,
 	    callback, arg);
 }
 
@@ -602,7 +945,16 @@ eloop_q_timeout_add_sec(struct eloop *eloop, int queue, unsigned int seconds,
     void (*callback)(void *), void *arg)
 {
 
-	return eloop_q_timeout_add(eloop, queue, seconds, 0, callback, arg);
+	return eloop_q_timeout_add(eloop, queue, seconds, 0, 0, callback, arg);
+}
+
+int
+eloop_q_timeout_add_slack(struct eloop *eloop, int queue, unsigned int seconds,
+    unsigned int slack, void (*callback)(void *), void *arg)
+{
+
+	return eloop_q_timeout_add(eloop, queue, seconds, 0,
+	    (unsigned long long)slack * NSEC_PER_MSEC, callback, arg);
 }
 
 int
@@ -619,7 +971,7 @@ eloop_q_timeout_add_msec(struct eloop *eloop, int queue, unsigned long when,
 
 	nseconds = (when % MSEC_PER_SEC) * NSEC_PER_MSEC;
 	return eloop_q_timeout_add(eloop, queue,
-		(unsigned int)seconds, (unsigned int)nseconds, callback, arg);
+		(unsigned int)seconds, (unsigned int)nseconds, 0, callback, arg);
 }
 
 int
@@ -632,12 +984,14 @@ eloop_q_timeout_delete(struct eloop *eloop, int queue,
 	assert(eloop != NULL);
 
 	n = 0;
-	TAILQ_FOREACH_SAFE(t, &eloop->timeouts, next, tt) {
+	if (eloop->timeout_hashlen == 0)
+		return n;
+	TAILQ_FOREACH_SAFE(t, eloop_timeout_bucket(eloop, arg), next, tt) {
 		if ((queue == 0 || t->queue == queue) &&
 		    t->arg == arg &&
 		    (!callback || t->callback == callback))
 		{
-			TAILQ_REMOVE(&eloop->timeouts, t, next);
+			eloop_timeout_remove(eloop, t);
 			TAILQ_INSERT_TAIL(&eloop->free_timeouts, t, next);
 			n++;
 		}
@@ -664,109 +1018,63 @@ eloop_enter(struct eloop *eloop)
 	eloop->exitnow = false;
 }
 
-/* Must be called after fork(2) */
-int
-eloop_forked(struct eloop *eloop)
+/* Register everything with a freshly opened backend. */
+static int
+eloop_reopen(struct eloop *eloop)
 {
-#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
+	const struct eloop_backend *b = eloop->backend;
 	struct eloop_event *e;
-#if defined(HAVE_KQUEUE)
-	struct kevent *pfds, *pfd;
-	size_t i;
-#elif defined(HAVE_EPOLL)
-	struct epoll_event epe = { .events = 0 };
-#endif
+	unsigned short events;
+	int error;
 
-	assert(eloop != NULL);
-#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
-	if (eloop->fd != -1)
-		close(eloop->fd);
-	if (eloop_open(eloop) == -1)
+	if (b->open != NULL && b->open(eloop) == -1)
 		return -1;
-#endif
 
-#ifdef HAVE_KQUEUE
-	pfds = malloc((eloop->nsignals + (eloop->nevents * NFD)) * sizeof(*pfds));
-	pfd = pfds;
+	free(eloop->fds);
+	eloop->fds = NULL;
+	eloop->nfds = 0;
+	eloop->events_need_setup = true;
 
-	if (eloop->signal_cb != NULL) {
-		for (i = 0; i < eloop->nsignals; i++) {
-			EV_SET(pfd++, (uintptr_t)eloop->signals[i],
-			    EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
-		}
-	} else
-		i = 0;
-#endif
+	if (b->signal_set != NULL && eloop->signal_cb != NULL &&
+	    b->signal_set(eloop, true) == -1)
+		return -1;
 
+	if (b->event_add == NULL)
+		return 0;
 	TAILQ_FOREACH(e, &eloop->events, next) {
 		if (e->fd == -1)
 			continue;
-#if defined(HAVE_KQUEUE)
-		if (e->events & ELE_READ) {
-			EV_SET(pfd++, (uintptr_t)e->fd,
-			    EVFILT_READ, EV_ADD, 0, 0, e);
-			i++;
-		}
-		if (e->events & ELE_WRITE) {
-			EV_SET(pfd++, (uintptr_t)e->fd,
-			    EVFILT_WRITE, EV_ADD, 0, 0, e);
-			i++;
-		}
-#elif defined(HAVE_EPOLL)
-		memset(&epe, 0, sizeof(epe));
-		epe.data.ptr = e;
-		if (e->events & ELE_READ)
-			epe.events |= EPOLLIN;
-		if (e->events & ELE_WRITE)
-			epe.events |= EPOLLOUT;
-		if (epoll_ctl(eloop->fd, EPOLL_CTL_ADD, e->fd, &epe) == -1)
+		events = e->events;
+		e->events = 0;
+		error = b->event_add(eloop, e, events, true);
+		e->events = events;
+		if (error == -1)
 			return -1;
-#endif
 	}
-
-#if defined(HAVE_KQUEUE)
-	if (i == 0)
-		return 0;
-	return _kevent(eloop->fd, pfds, i, NULL, 0, NULL);
-#else
-	return 0;
-#endif
-#else
-	UNUSED(eloop);
 	return 0;
-#endif
 }
 
+/* Must be called after fork(2) */
 int
-eloop_open(struct eloop *eloop)
+eloop_forked(struct eloop *eloop)
 {
-#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
-	int fd;
 
 	assert(eloop != NULL);
-#if defined(HAVE_KQUEUE1)
-	fd = kqueue1(O_CLOEXEC);
-#elif defined(HAVE_KQUEUE)
-	int flags;
 
-	fd = kqueue();
-	flags = fcntl(fd, F_GETFD, 0);
-	if (!(flags != -1 && !(flags & FD_CLOEXEC) &&
-	    fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == 0))
-	{
-		close(fd);
-		return -1;
-	}
-#elif defined(HAVE_EPOLL)
-	fd = epoll_create1(EPOLL_CLOEXEC);
-#endif
+	/* Some mechanisms are shared with our parent, so don't touch it. */
+	if (eloop->backend->close != NULL)
+		eloop->backend->close(eloop);
+	return eloop_reopen(eloop);
+}
 
-	eloop->fd = fd;
-	return fd;
-#else
-	UNUSED(eloop);
-	return 0;
-#endif
+int
+eloop_open(struct eloop *eloop)
+{
+
+	assert(eloop != NULL);
+	if (eloop->backend->open == NULL)
+		return 0;
+	return eloop->backend->open(eloop);
 }
 
 int
@@ -774,51 +1082,37 @@ eloop_signal_set_cb(struct eloop *eloop,
     const int *signals, size_t nsignals,
     void (*signal_cb)(int, void *), void *signal_cb_ctx)
 {
-#ifdef HAVE_KQUEUE
-	size_t i;
-	struct kevent *ke, *kes;
-#endif
-	int error = 0;
+	const struct eloop_backend *b;
 
 	assert(eloop != NULL);
 
-#ifdef HAVE_KQUEUE
-	ke = kes = malloc(MAX(eloop->nsignals, nsignals) * sizeof(*kes));
-	if (kes == NULL)
+	b = eloop->backend;
+	if (b->signal_set != NULL && eloop->signal_cb != NULL &&
+	    b->signal_set(eloop, false) == -1)
 		return -1;
-	for (i = 0; i < eloop->nsignals; i++) {
-		EV_SET(ke++, (uintptr_t)eloop->signals[i],
-		    EVFILT_SIGNAL, EV_DELETE, 0, 0, NULL);
-	}
-	if (i != 0 && _kevent(eloop->fd, kes, i, NULL, 0, NULL) == -1) {
-		error = -1;
-		goto out;
-	}
-#endif
 
 	eloop->signals = signals;
 	eloop->nsignals = nsignals;
 	eloop->signal_cb = signal_cb;
 	eloop->signal_cb_ctx = signal_cb_ctx;
 
-#ifdef HAVE_KQUEUE
-	if (signal_cb == NULL)
-		goto out;
-	ke = kes;
-	for (i = 0; i < eloop->nsignals; i++) {
-		EV_SET(ke++, (uintptr_t)eloop->signals[i],
-		    EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
-	}
-	if (i != 0 && _kevent(eloop->fd, kes, i, NULL, 0, NULL) == -1)
-		error = -1;
-out:
-	free(kes);
-#endif
+	if (b->signal_set != NULL && signal_cb != NULL &&
+	    b->signal_set(eloop, true) == -1)
+		return -1;
+	eloop->events_need_setup = true;
+	return 0;
+}
 
-	return error;
+void
+eloop_idle_set_cb(struct eloop *eloop, void (*idle_cb)(void *),
+    void *idle_cb_ctx)
+{
+
+	assert(eloop != NULL);
+	eloop->idle_cb = idle_cb;
+	eloop->idle_cb_ctx = idle_cb_ctx;
 }
 
-#ifndef HAVE_KQUEUE
 static volatile int _eloop_sig[ELOOP_NSIGNALS];
 static volatile size_t _eloop_nsig;
 
@@ -836,19 +1130,21 @@ eloop_signal3(int sig, __unused siginfo_t *siginfo, __unused void *arg)
 
 	_eloop_sig[_eloop_nsig++] = sig;
 }
-#endif
 
+/*
+ * Our handler is installed even if the backend delivers signals itself
+ * because the backend can be changed later.
+ * Signals stay blocked while such a backend waits, so it never runs.
+ */
 int
 eloop_signal_mask(struct eloop *eloop, sigset_t *oldset)
 {
 	sigset_t newset;
 	size_t i;
-#ifndef HAVE_KQUEUE
 	struct sigaction sa = {
 	    .sa_sigaction = eloop_signal3,
 	    .sa_flags = SA_SIGINFO,
 	};
-#endif
 
 	assert(eloop != NULL);
 
@@ -858,49 +1154,16 @@ eloop_signal_mask(struct eloop *eloop, sigset_t *oldset)
 	if (sigprocmask(SIG_SETMASK, &newset, oldset) == -1)
 		return -1;
 
-#ifndef HAVE_KQUEUE
 	sigemptyset(&sa.sa_mask);
 
 	for (i = 0; i < eloop->nsignals; i++) {
 		if (sigaction(eloop->signals[i], &sa, NULL) == -1)
 			return -1;
 	}
-#endif
 
 	return 0;
 }
 
-struct eloop *
-eloop_new(void)
-{
-	struct eloop *eloop;
-
-	eloop = calloc(1, sizeof(*eloop));
-	if (eloop == NULL)
-		return NULL;
-
-	/* Check we have a working monotonic clock. */
-	if (clock_gettime(CLOCK_MONOTONIC, &eloop->now) == -1) {
-		free(eloop);
-		return NULL;
-	}
-
-	TAILQ_INIT(&eloop->events);
-	TAILQ_INIT(&eloop->free_events);
-	TAILQ_INIT(&eloop->timeouts);
-	TAILQ_INIT(&eloop->free_timeouts);
-	eloop->exitcode = EXIT_FAILURE;
-
-#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
-	if (eloop_open(eloop) == -1) {
-		eloop_free(eloop);
-		return NULL;
-	}
-#endif
-
-	return eloop;
-}
-
 void
 eloop_clear(struct eloop *eloop, ...)
 {
@@ -923,6 +1186,7 @@ eloop_clear(struct eloop *eloop, ...)
 			continue;
 		TAILQ_REMOVE(&eloop->events, e, next);
 		if (e->fd != -1) {
+			eloop->event_fds[e->fd] = NULL;
 			close(e->fd);
 			eloop->nevents--;
 		}
@@ -930,7 +1194,6 @@ eloop_clear(struct eloop *eloop, ...)
 	}
 	va_end(va1);
 
-#if !defined(HAVE_PSELECT)
 	/* Free the pollfd buffer and ensure it's re-created before
 	 * the next run. This allows us to shrink it incase we use a lot less
 	 * signals and fds to respond to after forking. */
@@ -938,16 +1201,19 @@ eloop_clear(struct eloop *eloop, ...)
 	eloop->fds = NULL;
 	eloop->nfds = 0;
 	eloop->events_need_setup = true;
-#endif
 
 	while ((e = TAILQ_FIRST(&eloop->free_events))) {
 		TAILQ_REMOVE(&eloop->free_events, e, next);
 		free(e);
 	}
-	while ((t = TAILQ_FIRST(&eloop->timeouts))) {
-		TAILQ_REMOVE(&eloop->timeouts, t, next);
-		free(t);
-	}
+	while (eloop->ntimeouts != 0)
+		free(eloop->timeouts[--eloop->ntimeouts]);
+	free(eloop->timeouts);
+	eloop->timeouts = NULL;
+	eloop->timeouts_len = 0;
+	free(eloop->timeout_hash);
+	eloop->timeout_hash = NULL;
+	eloop->timeout_hashlen = 0;
 	while ((t = TAILQ_FIRST(&eloop->free_timeouts))) {
 		TAILQ_REMOVE(&eloop->free_timeouts, t, next);
 		free(t);
@@ -960,66 +1226,230 @@ eloop_free(struct eloop *eloop)
 {
 
 	eloop_clear(eloop, -1);
+	if (eloop == NULL)
+		return;
+	if (eloop->backend != NULL && eloop->backend->close != NULL)
+		eloop->backend->close(eloop);
+#ifdef HAVE_IO_URING
+	free(eloop->uring.reqs);
+	free(eloop->uring.ready);
+#endif
+	free(eloop->cbstats);
+	free(eloop->event_fds);
+	free(eloop);
+}
+
 #if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
-	if (eloop != NULL && eloop->fd != -1)
+static void
+eloop_fd_close(struct eloop *eloop)
+{
+
+	if (eloop->fd != -1) {
 		close(eloop->fd);
+		eloop->fd = -1;
+	}
+}
 #endif
-	free(eloop);
+
+#ifdef HAVE_KQUEUE
+static int
+eloop_kqueue_open(struct eloop *eloop)
+{
+	int fd;
+
+#if defined(HAVE_KQUEUE1)
+	fd = kqueue1(O_CLOEXEC);
+#else
+	int flags;
+
+	fd = kqueue();
+	flags = fcntl(fd, F_GETFD, 0);
+	if (!(flags != -1 && !(flags & FD_CLOEXEC) &&
+	    fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == 0))
+	{
+		close(fd);
+		return -1;
+	}
+#endif
+
+	eloop->fd = fd;
+	return fd;
 }
 
-#if defined(HAVE_KQUEUE)
 static int
-eloop_run_kqueue(struct eloop *eloop, const struct timespec *ts)
+eloop_kqueue_event_add(struct eloop *eloop, struct eloop_event *e,
+    unsigned short events, __unused bool added)
 {
-	int n, nn;
+	struct kevent ke[3], *kep = &ke[0];
+	uintptr_t fd = (uintptr_t)e->fd;
+
+	if (events & ELE_READ && !(e->events & ELE_READ))
+		EV_SET(kep++, fd, EVFILT_READ, EV_ADD, 0, 0, e);
+	else if (!(events & ELE_READ) && e->events & ELE_READ)
+		EV_SET(kep++, fd, EVFILT_READ, EV_DELETE, 0, 0, e);
+	if (events & ELE_WRITE && !(e->events & ELE_WRITE))
+		EV_SET(kep++, fd, EVFILT_WRITE, EV_ADD, 0, 0, e);
+	else if (!(events & ELE_WRITE) && e->events & ELE_WRITE)
+		EV_SET(kep++, fd, EVFILT_WRITE, EV_DELETE, 0, 0, e);
+#ifdef EVFILT_PROCDESC
+	if (events & ELE_HANGUP)
+		EV_SET(kep++, fd, EVFILT_PROCDESC, EV_ADD, NOTE_EXIT, 0, e);
+#endif
+	if (kep != ke &&
+	    _kevent(eloop->fd, ke, (size_t)(kep - ke), NULL, 0, NULL) == -1)
+		return -1;
+	return 0;
+}
+
+static int
+eloop_kqueue_event_delete(struct eloop *eloop, struct eloop_event *e)
+{
+	struct kevent ke[2], *kep = &ke[0];
+	uintptr_t fd = (uintptr_t)e->fd;
+
+	if (e->events & ELE_READ)
+		EV_SET(kep++, fd, EVFILT_READ, EV_DELETE, 0, 0, e);
+	if (e->events & ELE_WRITE)
+		EV_SET(kep++, fd, EVFILT_WRITE, EV_DELETE, 0, 0, e);
+	if (kep != ke &&
+	    _kevent(eloop->fd, ke, (size_t)(kep - ke), NULL, 0, NULL) == -1)
+		return -1;
+	return 0;
+}
+
+static int
+eloop_kqueue_signal_set(struct eloop *eloop, bool add)
+{
+	struct kevent *ke, *kes;
+	size_t i;
+	int error = 0;
+
+	if (eloop->nsignals == 0)
+		return 0;
+	ke = kes = malloc(eloop->nsignals * sizeof(*kes));
+	if (kes == NULL)
+		return -1;
+	for (i = 0; i < eloop->nsignals; i++) {
+		EV_SET(ke++, (uintptr_t)eloop->signals[i],
+		    EVFILT_SIGNAL, add ? EV_ADD : EV_DELETE, 0, 0, NULL);
+	}
+	if (_kevent(eloop->fd, kes, i, NULL, 0, NULL) == -1)
+		error = -1;
+	free(kes);
+	return error;
+}
+
+static int
+eloop_run_kqueue(struct eloop *eloop,
+    const struct timespec *ts, __unused const sigset_t *signals)
+{
+	struct kevent *kes = eloop->fds;
+	int n, nn, prio;
 	struct kevent *ke;
 	struct eloop_event *e;
 	unsigned short events;
 
-	n = _kevent(eloop->fd, NULL, 0, eloop->fds, eloop->nevents, ts);
+	n = _kevent(eloop->fd, NULL, 0, kes, eloop->nfds, ts);
 	if (n == -1)
 		return -1;
-
-	for (nn = n, ke = eloop->fds; nn != 0; nn--, ke++) {
-		if (eloop->cleared || eloop->exitnow)
-			break;
-		e = (struct eloop_event *)ke->udata;
-		if (ke->filter == EVFILT_SIGNAL) {
-			eloop->signal_cb((int)ke->ident,
-			    eloop->signal_cb_ctx);
-			continue;
-		}
-		if (ke->filter == EVFILT_READ)
-			events = ELE_READ;
-		else if (ke->filter == EVFILT_WRITE)
-			events = ELE_WRITE;
+	if (n != 0)
+		eloop_getwoke(eloop);
+
+	for (prio = 0; prio < ELOOP_NPRIO; prio++) {
+		for (nn = n, ke = kes; nn != 0; nn--, ke++) {
+			if (eloop->cleared || eloop->exitnow)
+				return n;
+			if (ke->filter == EVFILT_SIGNAL) {
+				if (prio == ELOOP_PRIO_HIGH)
+					eloop->signal_cb((int)ke->ident,
+					    eloop->signal_cb_ctx);
+				continue;
+			}
+			e = (struct eloop_event *)ke->udata;
+			/* Deleted by an earlier callback in this pass. */
+			if (e->fd == -1 || e->prio != prio)
+				continue;
+			if (eloop_event_defer(eloop, prio))
+				return n;
+			if (ke->filter == EVFILT_READ)
+				events = ELE_READ;
+			else if (ke->filter == EVFILT_WRITE)
+				events = ELE_WRITE;
 #ifdef EVFILT_PROCDESC
-		else if (ke->filter == EVFILT_PROCDESC &&
-		    ke->fflags & NOTE_EXIT)
-			/* exit status is in ke->data.
-			 * As we default to using ppoll anyway
-			 * we don't have to do anything with it right now. */
-			events = ELE_HANGUP;
+			else if (ke->filter == EVFILT_PROCDESC &&
+			    ke->fflags & NOTE_EXIT)
+				/* exit status is in ke->data.
+				 * As we default to using ppoll anyway
+				 * we don't have to do anything with it
+				 * right now. */
+				events = ELE_HANGUP;
 #endif
-		else
-			continue; /* assert? */
-		if (ke->flags & EV_EOF)
-			events |= ELE_HANGUP;
-		if (ke->flags & EV_ERROR)
-			events |= ELE_ERROR;
-		e->cb(e->cb_arg, events);
+			else
+				continue; /* assert? */
+			if (ke->flags & EV_EOF)
+				events |= ELE_HANGUP;
+			if (ke->flags & EV_ERROR)
+				events |= ELE_ERROR;
+			eloop_event_dispatch(eloop, e, events);
+		}
 	}
 	return n;
 }
 
-#elif defined(HAVE_EPOLL)
+static const struct eloop_backend eloop_backend_kqueue = {
+	.name = "kqueue",
+	.nfd = 2,
+	.fdsize = sizeof(struct kevent),
+	.open = eloop_kqueue_open,
+	.close = eloop_fd_close,
+	.event_add = eloop_kqueue_event_add,
+	.event_delete = eloop_kqueue_event_delete,
+	.signal_set = eloop_kqueue_signal_set,
+	.run = eloop_run_kqueue,
+};
+#endif
+
+#ifdef HAVE_EPOLL
+static int
+eloop_epoll_open(struct eloop *eloop)
+{
+
+	eloop->fd = epoll_create1(EPOLL_CLOEXEC);
+	return eloop->fd;
+}
+
+static int
+eloop_epoll_event_add(struct eloop *eloop, struct eloop_event *e,
+    unsigned short events, bool added)
+{
+	struct epoll_event epe;
+	int op;
+
+	memset(&epe, 0, sizeof(epe));
+	epe.data.ptr = e;
+	if (events & ELE_READ)
+		epe.events |= EPOLLIN;
+	if (events & ELE_WRITE)
+		epe.events |= EPOLLOUT;
+	op = added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+	if (epe.events != 0 && epoll_ctl(eloop->fd, op, e->fd, &epe) == -1)
+		return -1;
+	return 0;
+}
+
+static int
+eloop_epoll_event_delete(struct eloop *eloop, struct eloop_event *e)
+{
+
+	return epoll_ctl(eloop->fd, EPOLL_CTL_DEL, e->fd, NULL);
+}
 
 static int
 eloop_run_epoll(struct eloop *eloop,
     const struct timespec *ts, const sigset_t *signals)
 {
-	int timeout, n, nn;
-	struct epoll_event *epe;
+	int timeout, maxevents, n, nn, prio;
+	struct epoll_event *epes = eloop->fds, epe0, *epe;
 	struct eloop_event *e;
 	unsigned short events;
 
@@ -1034,36 +1464,492 @@ eloop_run_epoll(struct eloop *eloop,
 	} else
 		timeout = -1;
 
+	/* epoll_wait(2) fails with EINVAL unless there is room for
+	 * at least one event, which we won't have to wait on timeouts
+	 * or signals alone. */
+	if (eloop->nevents == 0) {
+		epes = &epe0;
+		maxevents = 1;
+	} else
+		maxevents = (int)eloop->nevents;
+
 	if (signals != NULL)
-		n = epoll_pwait(eloop->fd, eloop->fds,
-		    (int)eloop->nevents, timeout, signals);
+		n = epoll_pwait(eloop->fd, epes, maxevents, timeout, signals);
 	else
-		n = epoll_wait(eloop->fd, eloop->fds,
-		    (int)eloop->nevents, timeout);
+		n = epoll_wait(eloop->fd, epes, maxevents, timeout);
 	if (n == -1)
 		return -1;
+	if (n != 0)
+		eloop_getwoke(eloop);
+
+	for (prio = 0; prio < ELOOP_NPRIO; prio++) {
+		for (nn = n, epe = epes; nn != 0; nn--, epe++) {
+			if (eloop->cleared || eloop->exitnow)
+				return n;
+			e = (struct eloop_event *)epe->data.ptr;
+			if (e->fd == -1 || e->prio != prio)
+				continue;
+			if (eloop_event_defer(eloop, prio))
+				return n;
+			events = 0;
+			if (epe->events & EPOLLIN)
+				events |= ELE_READ;
+			if (epe->events & EPOLLOUT)
+				events |= ELE_WRITE;
+			if (epe->events & EPOLLHUP)
+				events |= ELE_HANGUP;
+			if (epe->events & EPOLLERR)
+				events |= ELE_ERROR;
+			eloop_event_dispatch(eloop, e, events);
+		}
+	}
+	return n;
+}
 
-	for (nn = n, epe = eloop->fds; nn != 0; nn--, epe++) {
-		if (eloop->cleared || eloop->exitnow)
-			break;
-		e = (struct eloop_event *)epe->data.ptr;
-		if (e->fd == -1)
-			continue;
-		events = 0;
-		if (epe->events & EPOLLIN)
-			events |= ELE_READ;
-		if (epe->events & EPOLLOUT)
-			events |= ELE_WRITE;
-		if (epe->events & EPOLLHUP)
-			events |= ELE_HANGUP;
-		if (epe->events & EPOLLERR)
-			events |= ELE_ERROR;
-		e->cb(e->cb_arg, events);
+static const struct eloop_backend eloop_backend_epoll = {
+	.name = "epoll",
+	.nfd = 1,
+	.fdsize = sizeof(struct epoll_event),
+	.open = eloop_epoll_open,
+	.close = eloop_fd_close,
+	.event_add = eloop_epoll_event_add,
+	.event_delete = eloop_epoll_event_delete,
+	.run = eloop_run_epoll,
+};
+#endif
+
+#ifdef HAVE_IO_URING
+static int
+eloop_uring_queue(struct eloop *eloop, uint8_t opcode, int fd,
+    uint32_t events, uint64_t addr, uint64_t user_data)
+{
+	struct eloop_uring *u = &eloop->uring;
+	struct eloop_uring_req *req;
+
+	if (u->nreqs == u->reqs_len) {
+		size_t len = u->reqs_len == 0 ? ELOOP_URING_SQ : u->reqs_len * 2;
+
+		req = eloop_realloca(u->reqs, len, sizeof(*req));
+		if (req == NULL)
+			return -1;
+		u->reqs = req;
+		u->reqs_len = len;
+	}
+
+	req = &u->reqs[u->nreqs++];
+	req->opcode = opcode;
+	req->fd = fd;
+	req->events = events;
+	req->addr = addr;
+	req->user_data = user_data;
+	return 0;
+}
+
+static int
+eloop_uring_poll_add(struct eloop *eloop, struct eloop_event *e,
+    unsigned short events)
+{
+	uint32_t pevents = 0;
+
+	if (events & ELE_READ)
+		pevents |= POLLIN;
+	if (events & ELE_WRITE)
+		pevents |= POLLOUT;
+	if (pevents == 0)
+		return 0;
+	return eloop_uring_queue(eloop, IORING_OP_POLL_ADD, e->fd, pevents,
+	    0, ELOOP_URING_UD(e));
+}
+
+static int
+eloop_uring_poll_remove(struct eloop *eloop, struct eloop_event *e)
+{
+
+	if (!(e->events & (ELE_READ | ELE_WRITE)))
+		return 0;
+	return eloop_uring_queue(eloop, IORING_OP_POLL_REMOVE, -1, 0,
+	    ELOOP_URING_UD(e), ELOOP_URING_IGNORE);
+}
+
+/* Copy as many queued requests as will fit into the submission ring.
+ * Returns the number of entries waiting to be submitted. */
+static unsigned int
+eloop_uring_fill(struct eloop *eloop)
+{
+	struct eloop_uring *u = &eloop->uring;
+	struct eloop_uring_req *req;
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, idx;
+	size_t i;
+
+	head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	tail = *u->sq_tail;
+	for (i = 0; i < u->nreqs && tail - head < u->sq_entries; i++) {
+		req = &u->reqs[i];
+		idx = tail & u->sq_mask;
+		sqe = &u->sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = req->opcode;
+		sqe->fd = req->fd;
+		sqe->addr = req->addr;
+		sqe->user_data = req->user_data;
+		if (req->opcode == IORING_OP_POLL_ADD) {
+#if BYTE_ORDER == BIG_ENDIAN
+			sqe->poll32_events =
+			    (req->events << 16) | (req->events >> 16);
+#else
+			sqe->poll32_events = req->events;
+#endif
+		}
+		u->sq_array[idx] = idx;
+		tail++;
+	}
+	__atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+
+	if (i != 0) {
+		u->nreqs -= i;
+		memmove(u->reqs, u->reqs + i, u->nreqs * sizeof(*u->reqs));
+	}
+	return tail - head;
+}
+
+static int
+eloop_uring_enter(struct eloop *eloop, unsigned int to_submit,
+    unsigned int min_complete, unsigned int flags, void *arg, size_t argsz)
+{
+
+	return (int)syscall(__NR_io_uring_enter, eloop->fd,
+	    to_submit, min_complete, flags, arg, argsz);
+}
+
+/* Submit everything queued without waiting for completions. */
+static int
+eloop_uring_submit(struct eloop *eloop)
+{
+	unsigned int pending;
+
+	do {
+		pending = eloop_uring_fill(eloop);
+		if (pending != 0 &&
+		    eloop_uring_enter(eloop, pending, 0, 0, NULL, 0) == -1)
+			return -1;
+	} while (eloop->uring.nreqs != 0);
+	return 0;
+}
+
+static void
+eloop_uring_close(struct eloop *eloop)
+{
+	struct eloop_uring *u = &eloop->uring;
+
+	if (u->sqes != NULL)
+		munmap(u->sqes, u->sqes_len);
+	if (u->cq_ring != NULL)
+		munmap(u->cq_ring, u->cq_ring_len);
+	if (u->sq_ring != NULL)
+		munmap(u->sq_ring, u->sq_ring_len);
+	u->sqes = NULL;
+	u->cq_ring = NULL;
+	u->sq_ring = NULL;
+	u->nreqs = 0;
+	if (eloop->fd != -1) {
+		close(eloop->fd);
+		eloop->fd = -1;
+	}
+}
+
+static int
+eloop_uring_open(struct eloop *eloop)
+{
+	struct eloop_uring *u = &eloop->uring;
+	struct io_uring_params p = {
+		.flags = IORING_SETUP_CQSIZE | IORING_SETUP_R_DISABLED,
+		.cq_entries = ELOOP_URING_CQ,
+	};
+	struct io_uring_restriction res[] = {
+		{ .opcode = IORING_RESTRICTION_SQE_OP,
+		  .sqe_op = IORING_OP_POLL_ADD },
+		{ .opcode = IORING_RESTRICTION_SQE_OP,
+		  .sqe_op = IORING_OP_POLL_REMOVE },
+		{ .opcode = IORING_RESTRICTION_SQE_OP,
+		  .sqe_op = IORING_OP_ASYNC_CANCEL },
+	};
+	uint8_t *ring;
+	int serrno;
+
+	eloop->fd = (int)syscall(__NR_io_uring_setup, ELOOP_URING_SQ, &p);
+	if (eloop->fd == -1)
+		return -1;
+
+	/* We need to wait with a timeout and a signal mask
+	 * and not lose completions if the ring overflows. */
+	if ((p.features & (IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP)) !=
+	    (IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP))
+	{
+		errno = ENOTSUP;
+		goto err;
+	}
+
+	/* SQEs are run by the kernel without going through seccomp,
+	 * so limit the ring to the polling we need before it's enabled.
+	 * Otherwise a sandboxed process could open files or send
+	 * packets just by submitting them. */
+	if (syscall(__NR_io_uring_register, eloop->fd,
+	    IORING_REGISTER_RESTRICTIONS, res, __arraycount(res)) == -1 ||
+	    syscall(__NR_io_uring_register, eloop->fd,
+	    IORING_REGISTER_ENABLE_RINGS, NULL, 0) == -1)
+		goto err;
+
+	u->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, eloop->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED) {
+		u->sq_ring = NULL;
+		goto err;
+	}
+	ring = u->sq_ring;
+	u->sq_head = (unsigned int *)(void *)(ring + p.sq_off.head);
+	u->sq_tail = (unsigned int *)(void *)(ring + p.sq_off.tail);
+	u->sq_mask = *(unsigned int *)(void *)(ring + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->sq_array = (unsigned int *)(void *)(ring + p.sq_off.array);
+
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, eloop->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		goto err;
+	}
+
+	u->cq_ring_len = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	u->cq_ring = mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, eloop->fd, IORING_OFF_CQ_RING);
+	if (u->cq_ring == MAP_FAILED) {
+		u->cq_ring = NULL;
+		goto err;
+	}
+	ring = u->cq_ring;
+	u->cq_head = (unsigned int *)(void *)(ring + p.cq_off.head);
+	u->cq_tail = (unsigned int *)(void *)(ring + p.cq_off.tail);
+	u->cq_mask = *(unsigned int *)(void *)(ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(void *)(ring + p.cq_off.cqes);
+	return eloop->fd;
+
+err:
+	serrno = errno;
+	eloop_uring_close(eloop);
+	errno = serrno;
+	return -1;
+}
+
+static int
+eloop_uring_event_add(struct eloop *eloop, struct eloop_event *e,
+    unsigned short events, bool added)
+{
+
+	/* Changing what we poll for means a new request. */
+	if (!added) {
+		if (e->events == events)
+			return 0;
+		if (eloop_uring_poll_remove(eloop, e) == -1)
+			return -1;
+	}
+	e->gen = ++eloop->uring.gen;
+	return eloop_uring_poll_add(eloop, e, events);
+}
+
+static int
+eloop_uring_event_delete(struct eloop *eloop, struct eloop_event *e)
+{
+
+	/* A poll holds a reference to the file, so it must be removed
+	 * now otherwise closing fd will not close the file. */
+	if (eloop_uring_poll_remove(eloop, e) == -1 ||
+	    eloop_uring_submit(eloop) == -1)
+		return -1;
+	return 0;
+}
+
+/* The event a completion is for, unless it has been deleted or changed. */
+static struct eloop_event *
+eloop_uring_find(const struct eloop *eloop, uint64_t user_data)
+{
+	struct eloop_event *e;
+
+	e = eloop_event_find(eloop, (int)(uint32_t)user_data);
+	if (e == NULL || e->gen != (uint32_t)(user_data >> 32))
+		return NULL;
+	return e;
+}
+
+static int
+eloop_run_uring(struct eloop *eloop,
+    const struct timespec *ts, const sigset_t *signals)
+{
+	struct eloop_uring *u = &eloop->uring;
+	struct __kernel_timespec kts;
+	struct io_uring_getevents_arg arg = { .sigmask_sz = _NSIG / 8 };
+	struct io_uring_cqe *cqe;
+	struct eloop_uring_cqe *rc;
+	struct eloop_event *e;
+	unsigned int pending, head, tail, wait, nready, i;
+	unsigned short events;
+	int n, prio;
+	bool defer;
+
+	/* Submit anything which won't fit in the ring before we wait. */
+	pending = eloop_uring_fill(eloop);
+	while (u->nreqs != 0) {
+		if (eloop_uring_enter(eloop, pending, 0, 0, NULL, 0) == -1)
+			return -1;
+		pending = eloop_uring_fill(eloop);
+	}
+
+	if (ts != NULL) {
+		kts.tv_sec = ts->tv_sec;
+		kts.tv_nsec = ts->tv_nsec;
+		arg.ts = (uint64_t)(uintptr_t)&kts;
+	}
+	if (signals != NULL)
+		arg.sigmask = (uint64_t)(uintptr_t)signals;
+
+	head = *u->cq_head;
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	wait = head == tail ? 1 : 0;
+	if (eloop_uring_enter(eloop, pending, wait,
+	    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+	    &arg, sizeof(arg)) == -1 && errno != ETIME)
+		return -1;
+
+	/* Only reap what is there now, callbacks can generate more
+	 * completions and timeouts need to run as well.
+	 * Copy the entries out so the kernel can reuse the slots
+	 * while we run the callbacks. */
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	nready = tail - head;
+	if (nready > u->ready_len) {
+		struct eloop_uring_cqe *ready;
+
+		ready = eloop_realloca(u->ready, nready, sizeof(*ready));
+		if (ready == NULL)
+			return -1;
+		u->ready = ready;
+		u->ready_len = nready;
+	}
+	for (i = 0; head != tail; head++) {
+		cqe = &u->cqes[head & u->cq_mask];
+		if (cqe->user_data == ELOOP_URING_IGNORE ||
+		    cqe->res == -ECANCELED)
+			continue;
+		if ((e = eloop_uring_find(eloop, cqe->user_data)) == NULL)
+			continue;
+		u->ready[i].user_data = cqe->user_data;
+		u->ready[i].res = cqe->res;
+		u->ready[i].prio = e->prio;
+		i++;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	nready = i;
+
+	n = 0;
+	defer = false;
+	for (prio = 0; prio < ELOOP_NPRIO; prio++) {
+		for (i = 0; i < nready; i++) {
+			rc = &u->ready[i];
+			if (rc->prio != prio)
+				continue;
+			e = eloop_uring_find(eloop, rc->user_data);
+			if (e == NULL)
+				continue;
+			if (!defer)
+				defer = eloop_event_defer(eloop, prio);
+
+			/* Polls are oneshot, so what is not dispatched now
+			 * is polled for again to be reported next time. */
+			if (!defer && !eloop->cleared && !eloop->exitnow) {
+				events = 0;
+				if (rc->res < 0) {
+					if (rc->res == -EBADF)
+						events |= ELE_NVAL;
+					else
+						events |= ELE_ERROR;
+				} else {
+					if (rc->res & POLLIN)
+						events |= ELE_READ;
+					if (rc->res & POLLOUT)
+						events |= ELE_WRITE;
+					if (rc->res & POLLHUP)
+						events |= ELE_HANGUP;
+					if (rc->res & POLLERR)
+						events |= ELE_ERROR;
+					if (rc->res & POLLNVAL)
+						events |= ELE_NVAL;
+				}
+				if (n++ == 0)
+					eloop_getwoke(eloop);
+				eloop_event_dispatch(eloop, e, events);
+				e = eloop_uring_find(eloop, rc->user_data);
+				if (e == NULL)
+					continue;
+			}
+
+			/* Re-arming only now gives us the same level
+			 * triggered behaviour as the other mechanisms. */
+			if (rc->res >= 0 &&
+			    eloop_uring_poll_add(eloop, e, e->events) == -1)
+				return -1;
+		}
 	}
 	return n;
 }
 
-#elif defined(HAVE_PPOLL)
+static const struct eloop_backend eloop_backend_uring = {
+	.name = "io_uring",
+	.open = eloop_uring_open,
+	.close = eloop_uring_close,
+	.event_add = eloop_uring_event_add,
+	.event_delete = eloop_uring_event_delete,
+	.run = eloop_run_uring,
+};
+#endif
+
+#ifdef HAVE_PPOLL
+static int
+eloop_ppoll_event_add(__unused struct eloop *eloop, struct eloop_event *e,
+    __unused unsigned short events, __unused bool added)
+{
+
+	/* Skip it until the pollfd array is rebuilt. */
+	e->pollfd = NULL;
+	return 0;
+}
+
+/* The pollfd array is in priority order, so is dispatched in order. */
+static void
+eloop_ppoll_setup(struct eloop *eloop)
+{
+	struct eloop_event *e;
+	struct pollfd *pfd = eloop->fds;
+	int prio;
+
+	for (prio = 0; prio < ELOOP_NPRIO; prio++) {
+		TAILQ_FOREACH(e, &eloop->events, next) {
+			if (e->prio != prio)
+				continue;
+			e->pollfd = pfd;
+			pfd->fd = e->fd;
+			pfd->events = 0;
+			if (e->events & ELE_READ)
+				pfd->events |= POLLIN;
+			if (e->events & ELE_WRITE)
+				pfd->events |= POLLOUT;
+			pfd->revents = 0;
+			pfd++;
+		}
+	}
+}
 
 static int
 eloop_run_ppoll(struct eloop *eloop,
@@ -1071,50 +1957,67 @@ eloop_run_ppoll(struct eloop *eloop,
 {
 	int n, nn;
 	struct eloop_event *e;
-	struct pollfd *pfd;
+	struct pollfd *pfd, *pfd_end;
 	unsigned short events;
 
 	n = ppoll(eloop->fds, (nfds_t)eloop->nevents, ts, signals);
 	if (n == -1 || n == 0)
 		return n;
+	eloop_getwoke(eloop);
 
 	nn = n;
-	TAILQ_FOREACH(e, &eloop->events, next) {
+	pfd_end = (struct pollfd *)eloop->fds + eloop->nevents;
+	for (pfd = eloop->fds; nn != 0 && pfd != pfd_end; pfd++) {
 		if (eloop->cleared || eloop->exitnow)
 			break;
-		/* Skip freshly added events */
-		if ((pfd = e->pollfd) == NULL)
+		if (pfd->revents == 0)
 			continue;
-		if (e->pollfd->revents) {
-			nn--;
-			events = 0;
-			if (pfd->revents & POLLIN)
-				events |= ELE_READ;
-			if (pfd->revents & POLLOUT)
-				events |= ELE_WRITE;
-			if (pfd->revents & POLLHUP)
-				events |= ELE_HANGUP;
-			if (pfd->revents & POLLERR)
-				events |= ELE_ERROR;
-			if (pfd->revents & POLLNVAL)
-				events |= ELE_NVAL;
-			if (events)
-				e->cb(e->cb_arg, events);
-		}
-		if (nn == 0)
+		nn--;
+		/* Skip freshly added events and those deleted
+		 * by an earlier callback in this pass. */
+		e = eloop_event_find(eloop, pfd->fd);
+		if (e == NULL || e->pollfd != pfd)
+			continue;
+		if (eloop_event_defer(eloop, e->prio))
 			break;
+		events = 0;
+		if (pfd->revents & POLLIN)
+			events |= ELE_READ;
+		if (pfd->revents & POLLOUT)
+			events |= ELE_WRITE;
+		if (pfd->revents & POLLHUP)
+			events |= ELE_HANGUP;
+		if (pfd->revents & POLLERR)
+			events |= ELE_ERROR;
+		if (pfd->revents & POLLNVAL)
+			events |= ELE_NVAL;
+		if (events)
+			eloop_event_dispatch(eloop, e, events);
 	}
 	return n;
 }
 
-#elif defined(HAVE_PSELECT)
+static const struct eloop_backend eloop_backend_ppoll = {
+#ifdef HAVE_POLLTS
+	.name = "pollts",
+#else
+	.name = "ppoll",
+#endif
+	.nfd = 1,
+	.fdsize = sizeof(struct pollfd),
+	.event_add = eloop_ppoll_event_add,
+	.setup = eloop_ppoll_setup,
+	.run = eloop_run_ppoll,
+};
+#endif
 
+#ifdef HAVE_PSELECT
 static int
 eloop_run_pselect(struct eloop *eloop,
     const struct timespec *ts, const sigset_t *sigmask)
 {
 	fd_set read_fds, write_fds;
-	int maxfd, n;
+	int maxfd, n, prio;
 	struct eloop_event *e;
 	unsigned short events;
 
@@ -1140,42 +2043,225 @@ eloop_run_pselect(struct eloop *eloop,
 	n = pselect(maxfd + 1, &read_fds, &write_fds, NULL, ts, sigmask);
 	if (n == -1 || n == 0)
 		return n;
+	eloop_getwoke(eloop);
 
-	TAILQ_FOREACH(e, &eloop->events, next) {
-		if (eloop->cleared || eloop->exitnow)
-			break;
-		if (e->fd == -1)
-			continue;
-		events = 0;
-		if (FD_ISSET(e->fd, &read_fds))
-			events |= ELE_READ;
-		if (FD_ISSET(e->fd, &write_fds))
-			events |= ELE_WRITE;
-		if (events)
-			e->cb(e->cb_arg, events);
+	for (prio = 0; prio < ELOOP_NPRIO; prio++) {
+		TAILQ_FOREACH(e, &eloop->events, next) {
+			if (eloop->cleared || eloop->exitnow)
+				return n;
+			if (e->fd == -1 || e->prio != prio)
+				continue;
+			events = 0;
+			if (FD_ISSET(e->fd, &read_fds))
+				events |= ELE_READ;
+			if (FD_ISSET(e->fd, &write_fds))
+				events |= ELE_WRITE;
+			if (events == 0)
+				continue;
+			if (eloop_event_defer(eloop, prio))
+				return n;
+			/* Each fd is only dispatched once a pass. */
+			FD_CLR(e->fd, &read_fds);
+			FD_CLR(e->fd, &write_fds);
+			eloop_event_dispatch(eloop, e, events);
+		}
 	}
 
 	return n;
 }
+
+static const struct eloop_backend eloop_backend_pselect = {
+	.name = "pselect",
+	.run = eloop_run_pselect,
+};
+#endif
+
+/* In order of preference for the default. */
+static const struct eloop_backend *eloop_backends[] = {
+#ifdef HAVE_PPOLL
+	&eloop_backend_ppoll,
+#endif
+#ifdef HAVE_KQUEUE
+	&eloop_backend_kqueue,
+#endif
+#ifdef HAVE_EPOLL
+	&eloop_backend_epoll,
+#endif
+#ifdef HAVE_IO_URING
+	&eloop_backend_uring,
+#endif
+#ifdef HAVE_PSELECT
+	&eloop_backend_pselect,
+#endif
+};
+
+static const struct eloop_backend *
+eloop_backend_find(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < __arraycount(eloop_backends); i++) {
+		if (strcmp(eloop_backends[i]->name, name) == 0)
+			return eloop_backends[i];
+	}
+	return NULL;
+}
+
+const char *
+eloop_backend_name(size_t i)
+{
+
+	if (i >= __arraycount(eloop_backends))
+		return NULL;
+	return eloop_backends[i]->name;
+}
+
+const char *
+eloop_backend(const struct eloop *eloop)
+{
+
+	assert(eloop != NULL);
+	return eloop->backend->name;
+}
+
+int
+eloop_set_backend(struct eloop *eloop, const char *name)
+{
+	const struct eloop_backend *b, *ob;
+	int serrno;
+
+	assert(eloop != NULL);
+	b = eloop_backend_find(name);
+	if (b == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	ob = eloop->backend;
+	if (b == ob)
+		return 0;
+
+	if (ob->close != NULL)
+		ob->close(eloop);
+	eloop->backend = b;
+	if (eloop_reopen(eloop) == 0)
+		return 0;
+
+	/* Put things back as they were. */
+	serrno = errno;
+	if (b->close != NULL)
+		b->close(eloop);
+	eloop->backend = ob;
+	eloop_reopen(eloop);
+	errno = serrno;
+	return -1;
+}
+
+struct eloop *
+eloop_new(void)
+{
+	struct eloop *eloop;
+
+	eloop = calloc(1, sizeof(*eloop));
+	if (eloop == NULL)
+		return NULL;
+
+	/* Check we have a working monotonic clock. */
+	if (eloop_getnow(eloop) == -1) {
+		free(eloop);
+		return NULL;
+	}
+
+	TAILQ_INIT(&eloop->events);
+	TAILQ_INIT(&eloop->free_events);
+	TAILQ_INIT(&eloop->free_timeouts);
+	eloop->exitcode = EXIT_FAILURE;
+	eloop->fd = -1;
+
+#ifdef ELOOP_DEFAULT
+	eloop->backend = eloop_backend_find(ELOOP_DEFAULT);
+	if (eloop->backend == NULL)
 #endif
+	eloop->backend = eloop_backends[0];
+
+	if (eloop_open(eloop) == -1) {
+		eloop_free(eloop);
+		return NULL;
+	}
+
+	return eloop;
+}
+
+/* Wait for and dispatch events.
+ * The backends set eloop->woke when they wakeup with events
+ * so we can work out how long was spent in the callbacks. */
+static int
+eloop_run(struct eloop *eloop, const struct timespec *tsp, sigset_t *signals)
+{
+	int n;
+
+	if (eloop->events_need_setup)
+		eloop_event_setup_fds(eloop);
+
+	n = eloop->backend->run(eloop, tsp, signals);
+	eloop->stats.rounds++;
+	if (n <= 0)
+		return n;
+
+	if (eloop_getnow(eloop) == 0 && eloop->now > eloop->woke)
+		eloop->stats.callback_ns += eloop->now - eloop->woke;
+	return n;
+}
+
+void
+eloop_set_batch(struct eloop *eloop, unsigned int rounds)
+{
+
+	assert(eloop != NULL);
+	eloop->batch = rounds;
+}
+
+const struct eloop_stats *
+eloop_stats(const struct eloop *eloop)
+{
+
+	assert(eloop != NULL);
+	return &eloop->stats;
+}
+
+void
+eloop_set_cbstats(struct eloop *eloop, bool on)
+{
+
+	assert(eloop != NULL);
+	eloop->cbstats_on = on;
+}
+
+const struct eloop_cbstats *
+eloop_cbstats(const struct eloop *eloop, size_t *n)
+{
+
+	assert(eloop != NULL);
+	*n = eloop->ncbstats;
+	return eloop->cbstats;
+}
 
 int
 eloop_start(struct eloop *eloop, sigset_t *signals)
 {
 	int error;
+	unsigned int round;
+	unsigned long long nevents;
 	struct eloop_timeout *t;
-	struct timespec ts, *tsp;
+	struct timespec ts;
+	const struct timespec *tsp;
+	static const struct timespec zero;
 
 	assert(eloop != NULL);
-#ifdef HAVE_KQUEUE
-	UNUSED(signals);
-#endif
 
 	for (;;) {
 		if (eloop->exitnow)
 			break;
 
-#ifndef HAVE_KQUEUE
 		if (_eloop_nsig != 0) {
 			int n = _eloop_sig[--_eloop_nsig];
 
@@ -1183,50 +2269,67 @@ eloop_start(struct eloop *eloop, sigset_t *signals)
 				eloop->signal_cb(n, eloop->signal_cb_ctx);
 			continue;
 		}
-#endif
 
-		t = TAILQ_FIRST(&eloop->timeouts);
+		t = eloop->ntimeouts != 0 ? eloop->timeouts[0] : NULL;
 		if (t == NULL && eloop->nevents == 0)
 			break;
 
+		/* One clock read per iteration, not one per timeout. */
 		if (t != NULL)
-			eloop_reduce_timers(eloop);
+			eloop_getnow(eloop);
 
-		if (t != NULL && t->seconds == 0 && t->nseconds == 0) {
-			TAILQ_REMOVE(&eloop->timeouts, t, next);
-			t->callback(t->arg);
+		if (t != NULL && t->when <= eloop->now) {
+			eloop_timeout_remove(eloop, t);
+			eloop->stats.timeouts++;
+			eloop_timeout_dispatch(eloop, t);
 			TAILQ_INSERT_TAIL(&eloop->free_timeouts, t, next);
 			continue;
 		}
 
 		if (t != NULL) {
-			if (t->seconds > INT_MAX) {
+			unsigned long long wait = t->when - eloop->now;
+
+			if (wait / NSEC_PER_SEC > INT_MAX) {
 				ts.tv_sec = (time_t)INT_MAX;
 				ts.tv_nsec = 0;
 			} else {
-				ts.tv_sec = (time_t)t->seconds;
-				ts.tv_nsec = (long)t->nseconds;
+				ts.tv_sec = (time_t)(wait / NSEC_PER_SEC);
+				ts.tv_nsec = (long)(wait % NSEC_PER_SEC);
 			}
 			tsp = &ts;
 		} else
 			tsp = NULL;
 
-		eloop->cleared = false;
-		if (eloop->events_need_setup)
-			eloop_event_setup_fds(eloop);
+		if (eloop->idle_cb != NULL)
+			eloop->idle_cb(eloop->idle_cb_ctx);
 
-#if defined(HAVE_KQUEUE)
-		UNUSED(signals);
-		error = eloop_run_kqueue(eloop, tsp);
-#elif defined(HAVE_EPOLL)
-		error = eloop_run_epoll(eloop, tsp, signals);
-#elif defined(HAVE_PPOLL)
-		error = eloop_run_ppoll(eloop, tsp, signals);
-#elif defined(HAVE_PSELECT)
-		error = eloop_run_pselect(eloop, tsp, signals);
-#else
-#error no polling mechanism to run!
-#endif
+		/* In batch mode keep polling without waiting while there
+		 * are events to process before going back to check
+		 * for signals and timeouts. */
+		eloop->cleared = false;
+		nevents = 0;
+		for (round = 0;;) {
+			error = eloop_run(eloop, tsp, signals);
+			if (error <= 0)
+				break;
+			nevents += (unsigned long long)error;
+			if (++round >= eloop->batch ||
+			    eloop->cleared || eloop->exitnow)
+				break;
+			if (_eloop_nsig != 0)
+				break;
+			/* eloop_run has just read the clock. */
+			if (eloop->ntimeouts != 0 &&
+			    eloop->timeouts[0]->when <= eloop->now)
+				break;
+			tsp = &zero;
+		}
+		if (nevents != 0) {
+			eloop->stats.wakeups++;
+			eloop->stats.events += nevents;
+			if (nevents > eloop->stats.events_max)
+				eloop->stats.events_max = nevents;
+		}
 		if (error == -1) {
 			if (errno == EINTR)
 				continue;
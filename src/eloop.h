@@ -29,6 +29,7 @@
 #ifndef ELOOP_H
 #define ELOOP_H
 
+#include <stdbool.h>
 #include <time.h>
 
 /* Handy macros to create subsecond timeouts */
@@ -58,8 +59,20 @@ struct eloop;
 #define	ELE_HANGUP	0x0200
 #define	ELE_NVAL	0x0400
 
+/*
+ * Events ready at the same time are dispatched by priority, most urgent
+ * first. Low priority events also wait for any timeout which fell due
+ * meanwhile so housekeeping cannot make a protocol deadline late.
+ */
+#define	ELOOP_PRIO_HIGH		0	/* protocol packets, kernel messages */
+#define	ELOOP_PRIO_NORMAL	1
+#define	ELOOP_PRIO_LOW		2	/* control clients, housekeeping */
+#define	ELOOP_NPRIO		3
+
 size_t eloop_event_count(const struct eloop  *);
-int eloop_event_add(struct eloop *, int, unsigned short,
+#define eloop_event_add(eloop, fd, events, cb, ctx) \
+    eloop_p_event_add((eloop), ELOOP_PRIO_NORMAL, (fd), (events), (cb), (ctx))
+int eloop_p_event_add(struct eloop *, int, int, unsigned short,
     void (*)(void *, unsigned short), void *);
 int eloop_event_delete(struct eloop *, int);
 
@@ -71,6 +84,8 @@ unsigned long long eloop_timespec_diff(const struct timespec *tsp,
     eloop_q_timeout_add_sec((eloop), ELOOP_QUEUE, (tv), (cb), (ctx))
 #define eloop_timeout_add_msec(eloop, ms, cb, ctx) \
     eloop_q_timeout_add_msec((eloop), ELOOP_QUEUE, (ms), (cb), (ctx))
+#define eloop_timeout_add_slack(eloop, tv, slack, cb, ctx) \
+    eloop_q_timeout_add_slack((eloop), ELOOP_QUEUE, (tv), (slack), (cb), (ctx))
 #define eloop_timeout_delete(eloop, cb, ctx) \
     eloop_q_timeout_delete((eloop), ELOOP_QUEUE, (cb), (ctx))
 int eloop_q_timeout_add_tv(struct eloop *, int,
@@ -79,12 +94,58 @@ int eloop_q_timeout_add_sec(struct eloop *, int,
     unsigned int, void (*)(void *), void *);
 int eloop_q_timeout_add_msec(struct eloop *, int,
     unsigned long, void (*)(void *), void *);
+/* Like eloop_q_timeout_add_sec, but may fire up to slack msec late
+ * so that timeouts expiring near each other share one wakeup. */
+int eloop_q_timeout_add_slack(struct eloop *, int,
+    unsigned int, unsigned int, void (*)(void *), void *);
 int eloop_q_timeout_delete(struct eloop *, int, void (*)(void *), void *);
 
 int eloop_signal_set_cb(struct eloop *, const int *, size_t,
     void (*)(int, void *), void *);
 int eloop_signal_mask(struct eloop *, sigset_t *oldset);
 
+/* Called each time before polling, so work can be batched per wakeup. */
+void eloop_idle_set_cb(struct eloop *, void (*)(void *), void *);
+
+/* Counters to help tune the loop under load. */
+struct eloop_stats {
+	unsigned long long wakeups;	/* wakeups with events to process */
+	unsigned long long rounds;	/* calls to the polling mechanism */
+	unsigned long long events;	/* events dispatched */
+	unsigned long long events_max;	/* most events in one wakeup */
+	unsigned long long timeouts;	/* timeouts dispatched */
+	unsigned long long callback_ns;	/* time spent in event callbacks */
+};
+
+/* Poll up to rounds times without waiting per wakeup. */
+void eloop_set_batch(struct eloop *, unsigned int);
+const struct eloop_stats *eloop_stats(const struct eloop *);
+
+/*
+ * Time spent in each callback, keyed by function.
+ * Only one of event_cb or timeout_cb is set.
+ * hist[0] counts calls under 1 usec, hist[i] calls under 2^i usec
+ * and the last bucket counts anything longer.
+ */
+#define	ELOOP_CBHIST	24
+struct eloop_cbstats {
+	void (*event_cb)(void *, unsigned short);
+	void (*timeout_cb)(void *);
+	unsigned long long calls;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long long hist[ELOOP_CBHIST];
+};
+
+/* Off by default as it costs two clock reads per callback. */
+void eloop_set_cbstats(struct eloop *, bool);
+const struct eloop_cbstats *eloop_cbstats(const struct eloop *, size_t *);
+
+/* Polling mechanisms compiled in, by name. */
+const char *eloop_backend_name(size_t);
+const char *eloop_backend(const struct eloop *);
+int eloop_set_backend(struct eloop *, const char *);
+
 struct eloop * eloop_new(void);
 void eloop_clear(struct eloop *, ...);
 void eloop_free(struct eloop *);
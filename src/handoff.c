@@ -0,0 +1,309 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcp-common.h"
+#include "dhcpcd.h"
+#include "dhcp.h"
+#include "dhcp6.h"
+#include "eloop.h"
+#include "handoff.h"
+#include "logerr.h"
+
+/*
+ * dhcpcd --restart stops with the addresses and routes left configured
+ * and writes HANDOFF, naming the leases it had bound.
+ * The lease files already hold those leases and when they were issued,
+ * so the handoff only says which of them can be trusted.
+ * The next dhcpcd binds each of these again without asking the server
+ * if it is not yet due to renew and its addresses are still there.
+ */
+struct handoff {
+	rb_node_t ho_tree;
+	char ho_ifname[IF_NAMESIZE];
+	unsigned int ho_flags;
+	struct in_addr ho_addr;
+};
+
+#define	HO_INET		(1U << 0)
+#define	HO_INET6	(1U << 1)
+
+static int
+handoff_cmp(__unused void *context, const void *node, const void *key)
+{
+	const struct handoff *ho = node;
+
+	return strcmp(ho->ho_ifname, key);
+}
+
+static int
+handoff_cmpnode(void *context, const void *node1, const void *node2)
+{
+	const struct handoff *ho2 = node2;
+
+	return handoff_cmp(context, node1, ho2->ho_ifname);
+}
+
+static const rb_tree_ops_t handoff_ops = {
+	.rbto_compare_nodes = handoff_cmpnode,
+	.rbto_compare_key = handoff_cmp,
+	.rbto_node_offset = offsetof(struct handoff, ho_tree),
+	.rbto_context = NULL
+};
+
+void
+handoff_init(struct dhcpcd_ctx *ctx)
+{
+
+	rb_tree_init(&ctx->handoff, &handoff_ops);
+}
+
+__printflike(3, 4) static int
+handoff_line(char **buf, size_t *len, const char *fmt, ...)
+{
+	va_list va;
+	int l;
+	char *nbuf;
+
+	va_start(va, fmt);
+	l = vsnprintf(NULL, 0, fmt, va);
+	va_end(va);
+	if (l == -1)
+		return -1;
+	nbuf = realloc(*buf, *len + (size_t)l + 1);
+	if (nbuf == NULL)
+		return -1;
+	*buf = nbuf;
+	va_start(va, fmt);
+	vsnprintf(*buf + *len, (size_t)l + 1, fmt, va);
+	va_end(va);
+	*len += (size_t)l;
+	return 0;
+}
+
+int
+handoff_write(struct dhcpcd_ctx *ctx)
+{
+	const struct interface *ifp;
+	char *buf = NULL;
+	size_t len = 0;
+	int err = -1;
+
+	if (handoff_line(&buf, &len, "pid %d\n", (int)getpid()) == -1)
+		goto out;
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		if (!ifp->active)
+			continue;
+
+#ifdef INET
+		const struct dhcp_state *state = D_CSTATE(ifp);
+
+		/* Leases not confirmed by a server are left to reboot. */
+		if (state != NULL && state->state == DHS_BOUND &&
+		    state->new != NULL && state->addr != NULL &&
+		    !state->lease.frominfo &&
+		    !(ifp->options->options & (DHCPCD_STATIC | DHCPCD_INFORM)) &&
+		    handoff_line(&buf, &len, "inet %s %s\n", ifp->name,
+		    inet_ntoa(state->lease.addr)) == -1)
+			goto out;
+#endif
+
+#ifdef DHCP6
+		const struct dhcp6_state *state6 = D6_CSTATE(ifp);
+
+		if (state6 != NULL && state6->state == DH6S_BOUND &&
+		    state6->new != NULL && state6->reason != NULL &&
+		    strcmp(state6->reason, "TIMEOUT6") != 0 &&
+		    handoff_line(&buf, &len, "inet6 %s\n", ifp->name) == -1)
+			goto out;
+#endif
+	}
+
+	if (dhcp_writefile(ctx, HANDOFF, 0640, buf, len) == -1)
+		goto out;
+	err = 0;
+
+out:
+	free(buf);
+	return err;
+}
+
+static void
+handoff_expire(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+
+	if (RB_TREE_MIN(&ctx->handoff) != NULL)
+		logdebugx("handoff expired");
+	handoff_free(ctx);
+}
+
+static int
+handoff_add(struct dhcpcd_ctx *ctx, const char *ifname, unsigned int flag,
+    const char *addr)
+{
+	struct handoff *ho;
+	struct in_addr ia;
+
+	if (addr != NULL && inet_pton(AF_INET, addr, &ia) != 1)
+		return 0;
+
+	ho = rb_tree_find_node(&ctx->handoff, ifname);
+	if (ho == NULL) {
+		if ((ho = calloc(1, sizeof(*ho))) == NULL)
+			return -1;
+		strlcpy(ho->ho_ifname, ifname, sizeof(ho->ho_ifname));
+		rb_tree_insert_node(&ctx->handoff, ho);
+	}
+	if (addr != NULL)
+		ho->ho_addr = ia;
+	ho->ho_flags |= flag;
+	return 0;
+}
+
+/*
+ * Reads the handoff left by a restart, which is only good for this start.
+ * Returns the PID which wrote it, which is ours if it exec'd us.
+ */
+pid_t
+handoff_read(struct dhcpcd_ctx *ctx)
+{
+	FILE *fp;
+	struct stat st;
+	char *line = NULL, ifname[IF_NAMESIZE + 1], addr[INET_ADDRSTRLEN + 1];
+	size_t len = 0;
+	time_t now;
+	int pid = 0;
+
+	if ((fp = fopen(HANDOFF, "r")) == NULL) {
+		if (errno != ENOENT)
+			logerr("%s: %s", __func__, HANDOFF);
+		return 0;
+	}
+	if (unlink(HANDOFF) == -1)
+		logerr("%s: unlink: %s", __func__, HANDOFF);
+	if (fstat(fileno(fp), &st) == -1 || (now = time(NULL)) == -1) {
+		logerr("%s: %s", __func__, HANDOFF);
+		goto out;
+	}
+	if (now < st.st_mtime || now - st.st_mtime >= HANDOFF_TIMEOUT) {
+		logwarnx("%s: ignoring stale handoff", HANDOFF);
+		goto out;
+	}
+
+	while (getline(&line, &len, fp) != -1) {
+		/* inet6 first as inet would match it. */
+		if (sscanf(line, "inet6 %"TOSTRING(IF_NAMESIZE)"s",
+		    ifname) == 1)
+		{
+			if (handoff_add(ctx, ifname, HO_INET6, NULL) == -1)
+				goto err;
+		} else if (sscanf(line, "inet %"TOSTRING(IF_NAMESIZE)"s "
+		    "%"TOSTRING(INET_ADDRSTRLEN)"s", ifname, addr) == 2)
+		{
+			if (handoff_add(ctx, ifname, HO_INET, addr) == -1)
+				goto err;
+		} else
+			(void)sscanf(line, "pid %d", &pid);
+	}
+
+	if (RB_TREE_MIN(&ctx->handoff) != NULL &&
+	    eloop_timeout_add_sec(ctx->eloop,
+	    (unsigned int)(HANDOFF_TIMEOUT - (now - st.st_mtime)),
+	    handoff_expire, ctx) == -1)
+		goto err;
+	goto out;
+
+err:
+	logerr(__func__);
+	handoff_free(ctx);
+out:
+	free(line);
+	fclose(fp);
+	return (pid_t)pid;
+}
+
+/*
+ * Returns true if the interface was handed over bound for the family,
+ * with the address for AF_INET.
+ * Either way it is not offered again.
+ */
+bool
+handoff_take(struct interface *ifp, int family, const void *addr)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct handoff *ho;
+	unsigned int flag;
+	bool taken;
+
+	ho = rb_tree_find_node(&ctx->handoff, ifp->name);
+	if (ho == NULL)
+		return false;
+
+	flag = family == AF_INET ? HO_INET : HO_INET6;
+	taken = ho->ho_flags & flag;
+	if (taken && family == AF_INET)
+		taken = memcmp(&ho->ho_addr, addr, sizeof(ho->ho_addr)) == 0;
+
+	ho->ho_flags &= ~flag;
+	if (ho->ho_flags == 0) {
+		rb_tree_remove_node(&ctx->handoff, ho);
+		free(ho);
+	}
+	if (taken)
+		logdebugx("%s: taking %s handoff", ifp->name,
+		    family == AF_INET ? "inet" : "inet6");
+	return taken;
+}
+
+void
+handoff_free(struct dhcpcd_ctx *ctx)
+{
+	struct handoff *ho;
+
+	while ((ho = RB_TREE_MIN(&ctx->handoff)) != NULL) {
+		rb_tree_remove_node(&ctx->handoff, ho);
+		free(ho);
+	}
+	if (ctx->eloop != NULL)
+		eloop_timeout_delete(ctx->eloop, handoff_expire, ctx);
+}
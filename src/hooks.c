@@ -0,0 +1,1141 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "dhcpcd.h"
+#include "hooks.h"
+#include "logerr.h"
+
+/*
+ * C versions of the 20-resolv.conf and 30-hostname hooks.
+ * They read the same environment the script gets and are run just
+ * before it, in the process that runs scripts.
+ * The script hooks are skipped through skip_hooks and the script
+ * is not started at all unless there are other hooks for it to run.
+ * Unlike the script, resolvconf(8) is not used and the per interface
+ * resolv.conf state is only kept in memory.
+ */
+
+#define	RESOLV_CONF		"/etc/resolv.conf"
+#define	RESOLV_CONF_HEAD	RESOLV_CONF ".head"
+#define	RESOLV_CONF_TAIL	RESOLV_CONF ".tail"
+#define	SIGNATURE_BASE		"# Generated by dhcpcd"
+
+#define	HOOK_REASONS		"# dhcpcd-reasons:"
+#define	HOOK_PROTOCOLS		"# dhcpcd-protocols:"
+
+/* Interface name with the protocol, veth0.dhcp6 */
+#define	HOOK_IFNAMESIZE		(IF_NAMESIZE + 16)
+
+static const struct {
+	const char *name;
+	unsigned int hook;
+} hooks_builtin[] = {
+	{ "resolv.conf",	HOOK_RESOLV_CONF },
+	{ "hostname",		HOOK_HOSTNAME },
+	{ NULL,			0 }
+};
+
+struct hook_resolv {
+	TAILQ_ENTRY(hook_resolv) hr_next;
+	char *hr_ifname;
+	char *hr_domain;
+	char *hr_search;
+	char *hr_servers;
+};
+
+struct hook_stamp {
+	time_t hs_mtime;
+	time_t hs_ctime;
+	off_t hs_size;
+	bool hs_exists;
+};
+
+struct hook_entry {
+	TAILQ_ENTRY(hook_entry) he_next;
+	const char *he_dir;
+	char *he_name;
+	char *he_reasons;	/* NULL for all reasons */
+	char *he_protocols;	/* NULL for all protocols */
+	struct hook_stamp he_stamp;	/* when the header was read */
+};
+
+#define	HOOK_NPATHS	3
+struct hook_table {
+	TAILQ_HEAD(, hook_entry) ht_hooks;
+	struct hook_stamp ht_stamps[HOOK_NPATHS];
+};
+
+struct hook_buf {
+	char *hb_buf;
+	size_t hb_len;
+	size_t hb_size;
+};
+
+unsigned int
+hooks_find(const char *name)
+{
+	size_t i;
+
+	for (i = 0; hooks_builtin[i].name != NULL; i++) {
+		if (strcmp(hooks_builtin[i].name, name) == 0)
+			return hooks_builtin[i].hook;
+	}
+	return 0;
+}
+
+static const char *
+hooks_getenv(char *const *env, const char *var)
+{
+	size_t len = strlen(var);
+
+	for (; *env != NULL; env++) {
+		if (strncmp(*env, var, len) == 0 && (*env)[len] == '=')
+			return *env + len + 1;
+	}
+	return NULL;
+}
+
+/* As the script sees it, unset and empty are the same. */
+static const char *
+hooks_getenvs(char *const *env, const char *var)
+{
+	const char *val = hooks_getenv(env, var);
+
+	return val == NULL ? "" : val;
+}
+
+static bool
+hooks_istrue(const char *val)
+{
+
+	return strcasecmp(val, "yes") == 0 ||
+	    strcasecmp(val, "true") == 0 ||
+	    strcmp(val, "1") == 0;
+}
+
+static bool
+hooks_isreason6(const char *reason)
+{
+
+	return strcmp(reason, "BOUND6") == 0 ||
+	    strcmp(reason, "RENEW6") == 0 ||
+	    strcmp(reason, "REBIND6") == 0 ||
+	    strcmp(reason, "REBOOT6") == 0 ||
+	    strcmp(reason, "INFORM6") == 0;
+}
+
+/* Check for a valid name as per RFC952 and RFC1123 section 2.1 */
+static bool
+hooks_validdomain(const char *name)
+{
+	const char *p;
+	size_t len;
+
+	if (*name == '\0' || strlen(name) > 255)
+		return false;
+
+	while (*name != '\0') {
+		for (p = name; *p != '\0' && *p != '.'; p++) {
+			if (!isalnum((unsigned char)*p) &&
+			    *p != '-' && *p != '_')
+				return false;
+		}
+		len = (size_t)(p - name);
+		if (len == 0 || len > 63)
+			return false;
+		if (*name == '-' || *name == '_' ||
+		    p[-1] == '-' || p[-1] == '_')
+			return false;
+		name = *p == '.' ? p + 1 : p;
+	}
+	return true;
+}
+
+static int
+hooks_add(struct hook_buf *hb, const char *data, size_t len)
+{
+	char *nbuf;
+	size_t nsize;
+
+	if (hb->hb_len + len + 1 > hb->hb_size) {
+		nsize = hb->hb_size == 0 ? 256 : hb->hb_size;
+		while (nsize < hb->hb_len + len + 1)
+			nsize *= 2;
+		if ((nbuf = realloc(hb->hb_buf, nsize)) == NULL)
+			return -1;
+		hb->hb_buf = nbuf;
+		hb->hb_size = nsize;
+	}
+	memcpy(hb->hb_buf + hb->hb_len, data, len);
+	hb->hb_len += len;
+	hb->hb_buf[hb->hb_len] = '\0';
+	return 0;
+}
+
+static int
+hooks_adds(struct hook_buf *hb, const char *s)
+{
+
+	return hooks_add(hb, s, strlen(s));
+}
+
+static bool
+hooks_hasword(const struct hook_buf *hb, const char *word, size_t len)
+{
+	const char *p, *ep;
+
+	if (hb->hb_len == 0)
+		return false;
+	for (p = hb->hb_buf; *p != '\0'; p = ep) {
+		ep = strchr(p, ' ');
+		if (ep == NULL)
+			ep = p + strlen(p);
+		if ((size_t)(ep - p) == len && strncmp(p, word, len) == 0)
+			return true;
+		if (*ep == ' ')
+			ep++;
+	}
+	return false;
+}
+
+/* Append the words we don't already have, like uniqify. */
+static int
+hooks_addwords(struct hook_buf *hb, const char *s)
+{
+	const char *ep;
+	size_t len;
+
+	if (s == NULL)
+		return 0;
+	for (;;) {
+		s += strspn(s, " \t\n");
+		if (*s == '\0')
+			return 0;
+		len = strcspn(s, " \t\n");
+		ep = s + len;
+		if (!hooks_hasword(hb, s, len) &&
+		    ((hb->hb_len != 0 && hooks_add(hb, " ", 1) == -1) ||
+		    hooks_add(hb, s, len) == -1))
+			return -1;
+		s = ep;
+	}
+}
+
+static bool
+hooks_validdomains(const char *s)
+{
+	char word[256];
+	size_t len;
+
+	for (;;) {
+		s += strspn(s, " ");
+		if (*s == '\0')
+			return true;
+		len = strcspn(s, " ");
+		if (len >= sizeof(word))
+			return false;
+		memcpy(word, s, len);
+		word[len] = '\0';
+		if (!hooks_validdomain(word))
+			return false;
+		s += len;
+	}
+}
+
+static void
+hooks_ifname(char *const *env, char *buf, size_t len)
+{
+	const char *protocol = hooks_getenv(env, "protocol");
+
+	snprintf(buf, len, "%s%s%s", hooks_getenvs(env, "interface"),
+	    protocol != NULL ? "." : "", protocol != NULL ? protocol : "");
+}
+
+__printflike(2, 3) static long long
+hooks_getnum(char *const *env, const char *fmt, ...)
+{
+	char var[64];
+	va_list va;
+	const char *val;
+
+	va_start(va, fmt);
+	vsnprintf(var, sizeof(var), fmt, va);
+	va_end(va);
+	val = hooks_getenv(env, var);
+	if (val == NULL || *val == '\0')
+		return -1;
+	return strtoll(val, NULL, 10);
+}
+
+__printflike(2, 3) static const char *
+hooks_getvar(char *const *env, const char *fmt, ...)
+{
+	char var[64];
+	va_list va;
+
+	va_start(va, fmt);
+	vsnprintf(var, sizeof(var), fmt, va);
+	va_end(va);
+	return hooks_getenv(env, var);
+}
+
+static void
+hooks_freeresolv(struct dhcpcd_ctx *ctx, struct hook_resolv *hr)
+{
+
+	TAILQ_REMOVE(&ctx->hook_resolv, hr, hr_next);
+	free(hr->hr_ifname);
+	free(hr->hr_domain);
+	free(hr->hr_search);
+	free(hr->hr_servers);
+	free(hr);
+}
+
+static struct hook_resolv *
+hooks_findresolv(struct dhcpcd_ctx *ctx, const char *ifname)
+{
+	struct hook_resolv *hr;
+
+	TAILQ_FOREACH(hr, &ctx->hook_resolv, hr_next) {
+		if (strcmp(hr->hr_ifname, ifname) == 0)
+			return hr;
+	}
+	return NULL;
+}
+
+/* FNV-1a, so an unchanged resolv.conf need not be read back. */
+static uint32_t
+hooks_sum(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t sum = 2166136261U;
+
+	while (len-- != 0) {
+		sum ^= *p++;
+		sum *= 16777619U;
+	}
+	return sum;
+}
+
+static bool
+hooks_resolvsame(struct dhcpcd_ctx *ctx, const char *file,
+    const struct hook_buf *hb, uint32_t sum)
+{
+	struct stat st;
+	char *buf;
+	bool same;
+
+	if (stat(file, &st) == -1 || (size_t)st.st_size != hb->hb_len)
+		return false;
+	if (ctx->hook_resolv_written && ctx->hook_resolv_sum == sum &&
+	    st.st_mtime == ctx->hook_resolv_mtime)
+		return true;
+	/* Changed underneath us or not written by us yet. */
+	if ((buf = malloc(hb->hb_len + 1)) == NULL)
+		return false;
+	same = readfile(file, buf, hb->hb_len + 1) == (ssize_t)hb->hb_len &&
+	    memcmp(buf, hb->hb_buf, hb->hb_len) == 0;
+	free(buf);
+	return same;
+}
+
+static int
+hooks_addfile(struct hook_buf *hb, const char *file, const char *comment)
+{
+	char buf[BUFSIZ];
+	FILE *fp;
+	size_t len;
+	int err = 0;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		return hooks_adds(hb, comment);
+	while ((len = fread(buf, 1, sizeof(buf), fp)) != 0) {
+		if (hooks_add(hb, buf, len) == -1) {
+			err = -1;
+			break;
+		}
+	}
+	fclose(fp);
+	return err;
+}
+
+static int
+hooks_buildresolv(struct dhcpcd_ctx *ctx, const char *order)
+{
+	struct hook_buf hb = { NULL, 0, 0 }, ifaces = { NULL, 0, 0 };
+	struct hook_buf domains = { NULL, 0, 0 }, search = { NULL, 0, 0 };
+	struct hook_buf servers = { NULL, 0, 0 };
+	struct hook_resolv *hr;
+	const char *o, *domain;
+	char file[PATH_MAX], word[HOOK_IFNAMESIZE];
+	size_t len, ndomains = 0;
+	uint32_t sum;
+	struct stat st;
+	int err = -1;
+
+	/* Interfaces in interface_order go first. */
+	for (o = order; o != NULL && *o != '\0'; o += len) {
+		o += strspn(o, " ");
+		len = strcspn(o, " ");
+		if (len == 0 || len >= sizeof(word))
+			continue;
+		memcpy(word, o, len);
+		word[len] = '\0';
+		TAILQ_FOREACH(hr, &ctx->hook_resolv, hr_next) {
+			if (strncmp(hr->hr_ifname, word, len) == 0 &&
+			    hr->hr_ifname[len] == '.' &&
+			    hooks_addwords(&ifaces, hr->hr_ifname) == -1)
+				goto out;
+		}
+	}
+	TAILQ_FOREACH(hr, &ctx->hook_resolv, hr_next) {
+		if (hooks_addwords(&ifaces, hr->hr_ifname) == -1)
+			goto out;
+	}
+
+	if (hooks_adds(&hb, SIGNATURE_BASE) == -1)
+		goto out;
+	if (ifaces.hb_len != 0) {
+		if (hooks_adds(&hb, " from ") == -1)
+			goto out;
+		for (o = ifaces.hb_buf; *o != '\0'; o += len) {
+			if (*o == ' ') {
+				if (hooks_adds(&hb, ", ") == -1)
+					goto out;
+				o++;
+			}
+			len = strcspn(o, " ");
+			snprintf(word, sizeof(word), "%.*s", (int)len, o);
+			hr = hooks_findresolv(ctx, word);
+			if (hooks_add(&hb, o, len) == -1 ||
+			    (hr->hr_domain != NULL &&
+			    hooks_adds(&domains, " ") == -1) ||
+			    (hr->hr_domain != NULL &&
+			    hooks_adds(&domains, hr->hr_domain) == -1) ||
+			    hooks_addwords(&search, hr->hr_search) == -1 ||
+			    hooks_addwords(&servers, hr->hr_servers) == -1)
+				goto out;
+			if (hr->hr_domain != NULL)
+				ndomains++;
+		}
+	}
+	if (hooks_adds(&hb, "\n") == -1)
+		goto out;
+	if (hooks_addfile(&hb, RESOLV_CONF_HEAD,
+	    "# " RESOLV_CONF_HEAD " can replace this line\n") == -1)
+		goto out;
+
+	/* The first domain is the domain, any others are searched. */
+	domain = NULL;
+	if (ndomains != 0) {
+		domain = domains.hb_buf + 1;
+		if (ndomains > 1 &&
+		    hooks_addwords(&search, domains.hb_buf) == -1)
+			goto out;
+		domains.hb_buf[1 + strcspn(domain, " ")] = '\0';
+		if (search.hb_len != 0 && strcmp(domain, search.hb_buf) == 0)
+			search.hb_len = 0;
+	}
+	if (domain != NULL && (hooks_adds(&hb, "domain ") == -1 ||
+	    hooks_adds(&hb, domain) == -1 || hooks_adds(&hb, "\n") == -1))
+		goto out;
+	if (search.hb_len != 0 && (hooks_adds(&hb, "search ") == -1 ||
+	    hooks_adds(&hb, search.hb_buf) == -1 ||
+	    hooks_adds(&hb, "\n") == -1))
+		goto out;
+	for (o = servers.hb_buf; servers.hb_len != 0 && *o != '\0'; o += len) {
+		if (*o == ' ')
+			o++;
+		len = strcspn(o, " ");
+		if (hooks_adds(&hb, "nameserver ") == -1 ||
+		    hooks_add(&hb, o, len) == -1 || hooks_adds(&hb, "\n") == -1)
+			goto out;
+	}
+	if (hooks_addfile(&hb, RESOLV_CONF_TAIL,
+	    "# " RESOLV_CONF_TAIL " can replace this line\n") == -1)
+		goto out;
+
+	/* Write through a symlink to where it points. */
+	if (realpath(RESOLV_CONF, file) == NULL)
+		strlcpy(file, RESOLV_CONF, sizeof(file));
+	sum = hooks_sum(hb.hb_buf, hb.hb_len);
+	if (hooks_resolvsame(ctx, file, &hb, sum)) {
+		err = 0;
+		goto out;
+	}
+	if (writefile_atomic(file, 0644, hb.hb_buf, hb.hb_len, 0) == -1) {
+		/* A bind mount, as in a container, cannot be renamed over. */
+		if (errno != EBUSY && errno != EXDEV)
+			goto out;
+		if (writefile(file, 0644, hb.hb_buf, hb.hb_len) == -1)
+			goto out;
+	}
+	ctx->hook_resolv_written = true;
+	ctx->hook_resolv_sum = sum;
+	ctx->hook_resolv_mtime = stat(file, &st) == 0 ? st.st_mtime : 0;
+	err = 0;
+
+out:
+	free(hb.hb_buf);
+	free(ifaces.hb_buf);
+	free(domains.hb_buf);
+	free(search.hb_buf);
+	free(servers.hb_buf);
+	return err;
+}
+
+static int
+hooks_removeresolv(struct dhcpcd_ctx *ctx, char *const *env,
+    const char *ifname)
+{
+	struct hook_resolv *hr;
+
+	if ((hr = hooks_findresolv(ctx, ifname)) != NULL)
+		hooks_freeresolv(ctx, hr);
+	return hooks_buildresolv(ctx, hooks_getenv(env, "interface_order"));
+}
+
+static int
+hooks_addresolv(struct dhcpcd_ctx *ctx, char *const *env,
+    const char *ifname, const char *reason)
+{
+	struct hook_buf servers = { NULL, 0, 0 }, search = { NULL, 0, 0 };
+	struct hook_resolv *hr, *hrp;
+	const char *name, *fqdn, *val, *p;
+	char domain[256];
+	long long now, acquired, lifetime;
+	unsigned int i, j;
+
+	if (hooks_isreason6(reason)) {
+		if (hooks_addwords(&servers,
+		    hooks_getenv(env, "new_dhcp6_name_servers")) == -1 ||
+		    hooks_addwords(&search,
+		    hooks_getenv(env, "new_dhcp6_domain_search")) == -1)
+			goto err;
+	} else {
+		if (hooks_addwords(&servers,
+		    hooks_getenv(env, "new_domain_name_servers")) == -1 ||
+		    hooks_addwords(&search,
+		    hooks_getenv(env, "new_domain_search")) == -1)
+			goto err;
+	}
+
+	/* Add the ND DNS options that have not expired. */
+	for (i = 1; ; i++) {
+		acquired = hooks_getnum(env, "nd%u_acquired", i);
+		now = hooks_getnum(env, "nd%u_now", i);
+		if (acquired == -1 || now == -1)
+			break;
+		for (j = 1; ; j++) {
+			lifetime = hooks_getnum(env, "nd%u_rdnss%u_lifetime",
+			    i, j);
+			if (lifetime == -1)
+				break;
+			if (lifetime - (now - acquired) > 0 &&
+			    hooks_addwords(&servers, hooks_getvar(env,
+			    "nd%u_rdnss%u_servers", i, j)) == -1)
+				goto err;
+			lifetime = hooks_getnum(env, "nd%u_dnssl%u_lifetime",
+			    i, j);
+			if (lifetime == -1)
+				break;
+			if (lifetime - (now - acquired) > 0 &&
+			    hooks_addwords(&search, hooks_getvar(env,
+			    "nd%u_dnssl%u_search", i, j)) == -1)
+				goto err;
+		}
+	}
+
+	/* Derive a domain from our various hostname options. */
+	name = hooks_getenvs(env, "new_domain_name");
+	if (*name == '\0') {
+		fqdn = hooks_getenvs(env, "new_dhcp6_fqdn");
+		if ((p = strchr(fqdn, '.')) == NULL) {
+			fqdn = hooks_getenvs(env, "new_fqdn");
+			if ((p = strchr(fqdn, '.')) == NULL) {
+				fqdn = hooks_getenvs(env, "new_host_name");
+				p = strchr(fqdn, '.');
+			}
+		}
+		if (p != NULL)
+			name = p + 1;
+	}
+
+	if (servers.hb_len == 0 && *name == '\0' && search.hb_len == 0) {
+		free(servers.hb_buf);
+		free(search.hb_buf);
+		return hooks_removeresolv(ctx, env, ifname);
+	}
+
+	if ((hr = calloc(1, sizeof(*hr))) == NULL ||
+	    (hr->hr_ifname = strdup(ifname)) == NULL)
+	{
+		free(hr);
+		goto err;
+	}
+
+	domain[0] = '\0';
+	if (*name != '\0') {
+		val = name + strspn(name, " \t\n");
+		snprintf(domain, sizeof(domain), "%.*s",
+		    (int)strcspn(val, " \t\n"), val);
+		if (!hooks_validdomain(domain)) {
+			logerrx("%s: invalid domain name: %s",
+			    hooks_getenvs(env, "interface"), domain);
+			domain[0] = '\0';
+		}
+		/* If there is no search, make this one. */
+		if (search.hb_len == 0 && hooks_addwords(&search, name) == -1)
+			goto errhr;
+	}
+	if (domain[0] != '\0' && (hr->hr_domain = strdup(domain)) == NULL)
+		goto errhr;
+	if (search.hb_len != 0 && hooks_validdomains(search.hb_buf))
+		hr->hr_search = search.hb_buf;
+	else
+		free(search.hb_buf);
+	search.hb_buf = NULL;
+	hr->hr_servers = servers.hb_buf;
+	servers.hb_buf = NULL;
+
+	if ((hrp = hooks_findresolv(ctx, ifname)) != NULL)
+		hooks_freeresolv(ctx, hrp);
+	/* Sorted, as the script lists its state directory. */
+	TAILQ_FOREACH(hrp, &ctx->hook_resolv, hr_next) {
+		if (strcmp(hrp->hr_ifname, ifname) > 0)
+			break;
+	}
+	if (hrp != NULL)
+		TAILQ_INSERT_BEFORE(hrp, hr, hr_next);
+	else
+		TAILQ_INSERT_TAIL(&ctx->hook_resolv, hr, hr_next);
+	return hooks_buildresolv(ctx, hooks_getenv(env, "interface_order"));
+
+errhr:
+	free(hr->hr_domain);
+	free(hr->hr_ifname);
+	free(hr);
+err:
+	free(servers.hb_buf);
+	free(search.hb_buf);
+	return -1;
+}
+
+static void
+hooks_resolv(struct dhcpcd_ctx *ctx, char *const *env, const char *reason)
+{
+	char ifname[HOOK_IFNAMESIZE];
+	int err;
+
+	hooks_ifname(env, ifname, sizeof(ifname));
+	if (hooks_istrue(hooks_getenvs(env, "if_up")) ||
+	    strcmp(reason, "ROUTERADVERT") == 0)
+		err = hooks_addresolv(ctx, env, ifname, reason);
+	else if (hooks_istrue(hooks_getenvs(env, "if_down")))
+		err = hooks_removeresolv(ctx, env, ifname);
+	else
+		err = 0;
+	if (err == -1)
+		logerr("%s: %s", hooks_getenvs(env, "interface"), RESOLV_CONF);
+}
+
+static bool
+hooks_isdefaulthost(const char *name, const char *def)
+{
+
+	return *name == '\0' || strcmp(name, def) == 0 ||
+	    strcmp(name, "localhost") == 0 ||
+	    strcmp(name, "localhost.localdomain") == 0;
+}
+
+/* Returns true if the hostname is one we set, so can change it. */
+static bool
+hooks_needhostname(char *const *env, const char *hostname, const char *def,
+    bool hfqdn, bool hshort, const char *old_fqdn)
+{
+	const char *old_host, *old_domain;
+	size_t len;
+
+	if (hooks_isdefaulthost(hostname, def))
+		return true;
+	if (hooks_istrue(hooks_getenvs(env, "force_hostname")))
+		return true;
+
+	if (*old_fqdn != '\0') {
+		if (hfqdn || !hshort)
+			return strcmp(hostname, old_fqdn) == 0;
+		len = strcspn(old_fqdn, ".");
+		return strlen(hostname) == len &&
+		    strncmp(hostname, old_fqdn, len) == 0;
+	}
+
+	old_host = hooks_getenvs(env, "old_host_name");
+	if (*old_host == '\0')
+		return false;
+	if (hfqdn) {
+		old_domain = hooks_getenvs(env, "old_domain_name");
+		if (*old_domain != '\0' && strchr(old_host, '.') == NULL) {
+			len = strlen(old_host);
+			return strncmp(hostname, old_host, len) == 0 &&
+			    hostname[len] == '.' &&
+			    strcmp(hostname + len + 1, old_domain) == 0;
+		}
+		return strcmp(hostname, old_host) == 0;
+	}
+	if (hshort) {
+		len = strcspn(old_host, ".");
+		return strlen(hostname) == len &&
+		    strncmp(hostname, old_host, len) == 0;
+	}
+	return strcmp(hostname, old_host) == 0;
+}
+
+static void
+hooks_sethostname(char *const *env, const char *hostname, const char *name,
+    size_t len)
+{
+	char buf[256];
+	const char *ifname = hooks_getenvs(env, "interface");
+
+	snprintf(buf, sizeof(buf), "%.*s", (int)len, name);
+	if (strcmp(hostname, buf) == 0)
+		return;
+	if (!hooks_validdomain(buf)) {
+		logerrx("%s: invalid hostname: %s", ifname, buf);
+		return;
+	}
+	loginfox("%s: setting hostname: %s", ifname, buf);
+	if (sethostname(buf, strlen(buf)) == -1)
+		logerr("%s: sethostname", ifname);
+}
+
+static void
+hooks_hostname(char *const *env, const char *reason)
+{
+	const char *mode, *def, *new_fqdn, *old_fqdn, *new_host, *new_domain;
+	char hostname[256], buf[256];
+	bool hfqdn = false, hshort = false;
+
+	if (!hooks_istrue(hooks_getenvs(env, "if_up")) ||
+	    strcmp(reason, "ROUTERADVERT") == 0)
+		return;
+
+	mode = hooks_getenvs(env, "hostname_fqdn");
+	if (*mode == '\0' || hooks_istrue(mode))
+		hfqdn = true;
+	else if (strcasecmp(mode, "server") != 0)
+		hshort = true;
+	if ((def = hooks_getenv(env, "hostname_default")) == NULL)
+		def = DEFAULT_HOSTNAME;
+
+	if (hooks_isreason6(reason)) {
+		new_fqdn = hooks_getenvs(env, "new_dhcp6_fqdn");
+		old_fqdn = hooks_getenvs(env, "old_dhcp6_fqdn");
+	} else {
+		new_fqdn = hooks_getenvs(env, "new_fqdn");
+		old_fqdn = hooks_getenvs(env, "old_fqdn");
+	}
+
+	if (gethostname(hostname, sizeof(hostname)) == -1)
+		hostname[0] = '\0';
+	hostname[sizeof(hostname) - 1] = '\0';
+	if (!hooks_needhostname(env, hostname, def, hfqdn, hshort, old_fqdn))
+		return;
+
+	new_host = hooks_getenvs(env, "new_host_name");
+	if (*new_fqdn != '\0') {
+		if (hfqdn || !hshort)
+			hooks_sethostname(env, hostname,
+			    new_fqdn, strlen(new_fqdn));
+		else
+			hooks_sethostname(env, hostname,
+			    new_fqdn, strcspn(new_fqdn, "."));
+	} else if (*new_host != '\0') {
+		new_domain = hooks_getenvs(env, "new_domain_name");
+		if (hfqdn && *new_domain != '\0' &&
+		    strchr(new_host, '.') == NULL)
+		{
+			snprintf(buf, sizeof(buf), "%s.%s",
+			    new_host, new_domain);
+			hooks_sethostname(env, hostname, buf, strlen(buf));
+		} else if (!hfqdn && hshort)
+			hooks_sethostname(env, hostname,
+			    new_host, strcspn(new_host, "."));
+		else
+			hooks_sethostname(env, hostname,
+			    new_host, strlen(new_host));
+	} else if (!hooks_isdefaulthost(hostname, def))
+		hooks_sethostname(env, hostname, def, strlen(def));
+}
+
+/* Matches the skip_hooks patterns dhcpcd-run-hooks uses. */
+static bool
+hooks_skipped(const char *hook, const char *skip)
+{
+	size_t len, hlen = strlen(hook);
+
+	if (hlen != 0 && hook[hlen - 1] == '~')
+		return true;
+	for (;;) {
+		skip += strspn(skip, " ");
+		if (*skip == '\0')
+			return false;
+		len = strcspn(skip, " ");
+		if ((hlen == len && strncmp(hook, skip, len) == 0) ||
+		    (isdigit((unsigned char)hook[0]) &&
+		    isdigit((unsigned char)hook[1]) && hook[2] == '-' &&
+		    strncmp(hook + 3, skip, len) == 0 &&
+		    (hlen == len + 3 ||
+		    (hlen == len + 6 && strcmp(hook + 3 + len, ".sh") == 0))))
+			return true;
+		skip += len;
+	}
+}
+
+/* The hook says which events it wants in its header comment. */
+static int
+hooks_readheader(struct hook_entry *he, const char *path)
+{
+	FILE *fp;
+	char *line = NULL, *p, **list;
+	size_t len = 0;
+	ssize_t n;
+	int err = 0;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return errno == ENOENT ? 0 : -1;
+	while ((n = getline(&line, &len, fp)) != -1) {
+		if (line[0] != '#' && line[0] != '\n')
+			break;
+		if (strncmp(line, HOOK_REASONS, strlen(HOOK_REASONS)) == 0) {
+			p = line + strlen(HOOK_REASONS);
+			list = &he->he_reasons;
+		} else if (strncmp(line, HOOK_PROTOCOLS,
+		    strlen(HOOK_PROTOCOLS)) == 0)
+		{
+			p = line + strlen(HOOK_PROTOCOLS);
+			list = &he->he_protocols;
+		} else
+			continue;
+		p[strcspn(p, "\n")] = '\0';
+		free(*list);
+		if ((*list = strdup(p)) == NULL) {
+			err = -1;
+			break;
+		}
+	}
+	free(line);
+	fclose(fp);
+	return err;
+}
+
+static void
+hooks_stamp(struct hook_stamp *hs, const struct stat *st)
+{
+
+	memset(hs, 0, sizeof(*hs));
+	hs->hs_mtime = st->st_mtime;
+	hs->hs_ctime = st->st_ctime;
+	hs->hs_size = st->st_size;
+	hs->hs_exists = true;
+}
+
+static int
+hooks_addentry(struct hook_table *ht, const char *dir, const char *name)
+{
+	struct hook_entry *he;
+	char path[PATH_MAX];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	/* The script only runs regular files. */
+	if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+		return 0;
+	if ((he = calloc(1, sizeof(*he))) == NULL ||
+	    (he->he_name = strdup(name)) == NULL)
+	{
+		free(he);
+		return -1;
+	}
+	he->he_dir = dir;
+	hooks_stamp(&he->he_stamp, &st);
+	TAILQ_INSERT_TAIL(&ht->ht_hooks, he, he_next);
+	return hooks_readheader(he, path);
+}
+
+/* A hook edited in place doesn't change its directory. */
+static bool
+hooks_changed(const struct hook_table *ht)
+{
+	const struct hook_entry *he;
+	char path[PATH_MAX];
+	struct stat st;
+	struct hook_stamp hs;
+
+	TAILQ_FOREACH(he, &ht->ht_hooks, he_next) {
+		snprintf(path, sizeof(path), "%s/%s", he->he_dir, he->he_name);
+		if (stat(path, &st) == -1)
+			return true;
+		hooks_stamp(&hs, &st);
+		if (memcmp(&hs, &he->he_stamp, sizeof(hs)) != 0)
+			return true;
+	}
+	return false;
+}
+
+static void
+hooks_freetable(struct hook_table *ht)
+{
+	struct hook_entry *he;
+
+	if (ht == NULL)
+		return;
+	while ((he = TAILQ_FIRST(&ht->ht_hooks)) != NULL) {
+		TAILQ_REMOVE(&ht->ht_hooks, he, he_next);
+		free(he->he_name);
+		free(he->he_reasons);
+		free(he->he_protocols);
+		free(he);
+	}
+	free(ht);
+}
+
+/* The order dhcpcd-run-hooks sources them in. */
+static const char *const hooks_paths[HOOK_NPATHS] = {
+	SYSCONFDIR "/dhcpcd.enter-hook",
+	HOOKDIR,
+	SYSCONFDIR "/dhcpcd.exit-hook",
+};
+
+/*
+ * Build the table of hooks the script would run.
+ * It's rebuilt when a hook is added or removed, which changes the
+ * directory, or when any hook changes.
+ */
+static struct hook_table *
+hooks_loadtable(struct dhcpcd_ctx *ctx)
+{
+	struct hook_table *ht;
+	struct hook_stamp stamps[HOOK_NPATHS];
+	struct stat st;
+	DIR *dp;
+	struct dirent *d;
+	size_t i;
+	int err = 0;
+
+	memset(stamps, 0, sizeof(stamps));
+	for (i = 0; i < HOOK_NPATHS; i++) {
+		if (stat(hooks_paths[i], &st) == 0)
+			hooks_stamp(&stamps[i], &st);
+	}
+	if (ctx->hook_table != NULL &&
+	    memcmp(stamps, ctx->hook_table->ht_stamps, sizeof(stamps)) == 0 &&
+	    !hooks_changed(ctx->hook_table))
+		return ctx->hook_table;
+
+	hooks_freetable(ctx->hook_table);
+	if ((ctx->hook_table = ht = calloc(1, sizeof(*ht))) == NULL)
+		return NULL;
+	TAILQ_INIT(&ht->ht_hooks);
+	for (i = 0; i < HOOK_NPATHS && err != -1; i++) {
+		if (!stamps[i].hs_exists)
+			continue;
+		if (strcmp(hooks_paths[i], HOOKDIR) != 0) {
+			err = hooks_addentry(ht, SYSCONFDIR,
+			    strrchr(hooks_paths[i], '/') + 1);
+			continue;
+		}
+		if ((dp = opendir(HOOKDIR)) == NULL) {
+			err = -1;
+			break;
+		}
+		while (err != -1 && (d = readdir(dp)) != NULL) {
+			if (d->d_name[0] != '.')
+				err = hooks_addentry(ht, HOOKDIR, d->d_name);
+		}
+		closedir(dp);
+	}
+	if (err == -1) {
+		hooks_freetable(ht);
+		ctx->hook_table = NULL;
+		return NULL;
+	}
+	memcpy(ht->ht_stamps, stamps, sizeof(stamps));
+	return ht;
+}
+
+/*
+ * A hook with a reasons list only runs for those reasons, or for any
+ * reason but those prefixed with !.
+ * Likewise for protocols.
+ */
+static bool
+hooks_wants(const char *list, const char *word)
+{
+	size_t len, wlen;
+	bool not, include = false, match = false;
+
+	if (list == NULL)
+		return true;
+	wlen = strlen(word);
+	for (;;) {
+		list += strspn(list, " \t");
+		if (*list == '\0')
+			break;
+		not = *list == '!';
+		if (not)
+			list++;
+		else
+			include = true;
+		len = strcspn(list, " \t");
+		if (len == wlen && strncmp(list, word, len) == 0) {
+			if (not)
+				return false;
+			match = true;
+		}
+		list += len;
+	}
+	return match || !include;
+}
+
+/*
+ * Returns true if the script has any hooks left to run.
+ * Hooks that don't want the event are added to skip_hooks
+ * so the script doesn't even source them.
+ */
+static bool
+hooks_dispatch(struct dhcpcd_ctx *ctx, char *const *env,
+    const char *reason)
+{
+	struct hook_table *ht;
+	struct hook_entry *he;
+	struct hook_buf skip = { NULL, 0, 0 };
+	const char *skip_hooks, *protocol;
+	bool need = false, extra = false;
+
+	free(ctx->hook_skip);
+	ctx->hook_skip = NULL;
+
+	if (strcmp(ctx->script, SCRIPT) != 0)
+		return true;
+	if ((ht = hooks_loadtable(ctx)) == NULL) {
+		logerr("%s: %s", __func__, HOOKDIR);
+		return true;
+	}
+
+	skip_hooks = hooks_getenvs(env, "skip_hooks");
+	protocol = hooks_getenvs(env, "protocol");
+	if (hooks_adds(&skip, "skip_hooks=") == -1 ||
+	    hooks_adds(&skip, skip_hooks) == -1)
+		goto err;
+	TAILQ_FOREACH(he, &ht->ht_hooks, he_next) {
+		if (hooks_skipped(he->he_name, skip_hooks))
+			continue;
+		if (hooks_wants(he->he_reasons, reason) &&
+		    hooks_wants(he->he_protocols, protocol))
+		{
+			need = true;
+			continue;
+		}
+		if ((*skip_hooks != '\0' || extra) &&
+		    hooks_adds(&skip, " ") == -1)
+			goto err;
+		if (hooks_adds(&skip, he->he_name) == -1)
+			goto err;
+		extra = true;
+	}
+
+	if (need && extra)
+		ctx->hook_skip = skip.hb_buf;
+	else
+		free(skip.hb_buf);
+	return need;
+
+err:
+	logerr(__func__);
+	free(skip.hb_buf);
+	return true;
+}
+
+/* builtin_hooks is set for each interface along with skip_hooks. */
+static unsigned int
+hooks_builtins(char *const *env)
+{
+	const char *list = hooks_getenvs(env, "builtin_hooks");
+	size_t i;
+	unsigned int hooks = 0;
+
+	for (i = 0; hooks_builtin[i].name != NULL; i++) {
+		if (hooks_skipped(hooks_builtin[i].name, list))
+			hooks |= hooks_builtin[i].hook;
+	}
+	return hooks;
+}
+
+bool
+hooks_run(struct dhcpcd_ctx *ctx, char *const *env)
+{
+	const char *reason = hooks_getenvs(env, "reason");
+	unsigned int hooks;
+
+	if (hooks_istrue(hooks_getenvs(env, "if_configured"))) {
+		hooks = hooks_builtins(env);
+		if (hooks & HOOK_RESOLV_CONF)
+			hooks_resolv(ctx, env, reason);
+		if (hooks & HOOK_HOSTNAME)
+			hooks_hostname(env, reason);
+	}
+	return hooks_dispatch(ctx, env, reason);
+}
+
+void
+hooks_free(struct dhcpcd_ctx *ctx)
+{
+	struct hook_resolv *hr;
+
+	while ((hr = TAILQ_FIRST(&ctx->hook_resolv)) != NULL)
+		hooks_freeresolv(ctx, hr);
+	hooks_freetable(ctx->hook_table);
+	ctx->hook_table = NULL;
+	free(ctx->hook_skip);
+	ctx->hook_skip = NULL;
+}
@@ -895,6 +895,7 @@ if_copyrt(struct dhcpcd_ctx *ctx, struct rt *rt, const struct rt_msghdr *rtm)
 		if_copysa(&rt->rt_ifa, rti_info[RTAX_IFA]);
 
 	rt->rt_mtu = (unsigned int)rtm->rtm_rmx.rmx_mtu;
+	rt_setkey(rt);
 
 	if (rtm->rtm_index)
 		rt->rt_ifp = if_findindex(ctx->ifaces, rtm->rtm_index);
@@ -965,6 +966,15 @@ if_initrt(struct dhcpcd_ctx *ctx, rb_tree_t *kroutes, int af)
 	return p == end ? 0 : -1;
 }
 
+/* dhcpcd_linkoverflow will learn everything again. */
+int
+if_resync(__unused struct dhcpcd_ctx *ctx)
+{
+
+	errno = ENOTSUP;
+	return -1;
+}
+
 #ifdef INET
 int
 if_address(unsigned char cmd, const struct ipv4_addr *ia)
@@ -1602,6 +1612,9 @@ if_handlelink(struct dhcpcd_ctx *ctx)
 		return -1;
 	if (len == 0)
 		return 0;
+#ifndef SMALL
+	ctx->link_msgs++;
+#endif
 	if ((size_t)len < sizeof(rtm.hdr.rtm_msglen) ||
 	    len != rtm.hdr.rtm_msglen)
 	{
@@ -1914,5 +1927,11 @@ if_setup_inet6(const struct interface *ifp)
 #endif
 	}
 #endif
+}
+
+void
+if_restore_inet6(__unused const struct interface *ifp)
+{
+
 }
 #endif
@@ -32,6 +32,7 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/param.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <linux/icmpv6.h>
@@ -77,6 +78,7 @@
 #include "common.h"
 #include "dev.h"
 #include "dhcp.h"
+#include "eloop.h"
 #include "if.h"
 #include "ipv4.h"
 #include "ipv4ll.h"
@@ -90,6 +92,9 @@
 #ifdef HAVE_NL80211_H
 #include <linux/genetlink.h>
 #include <linux/nl80211.h>
+static void if_nl80211_open(struct dhcpcd_ctx *);
+static void if_nl80211_close(struct dhcpcd_ctx *);
+static void if_nl80211_forget(struct dhcpcd_ctx *, unsigned int);
 #else
 int if_getssid_wext(const char *ifname, uint8_t *ssid);
 #endif
@@ -140,11 +145,61 @@ int if_getssid_wext(const char *ifname, uint8_t *ssid);
 #define RTA_NEXT(rta, attrlen)	((attrlen) -= RTA_ALIGN((rta)->rta_len), \
 	(struct rtattr *)(void *)(((char *)(rta)) \
 	+ RTA_ALIGN((rta)->rta_len)))
+#undef RTNH_ALIGNTO
+#undef RTNH_ALIGN
+#undef RTNH_OK
+#undef RTNH_NEXT
+#define RTNH_ALIGNTO		4U
+#define RTNH_ALIGN(len)		(((len) + RTNH_ALIGNTO - 1) & ~(RTNH_ALIGNTO - 1))
+#define RTNH_OK(rtnh, len)	((rtnh)->rtnh_len >= sizeof(struct rtnexthop) \
+	&& ((size_t)(rtnh)->rtnh_len) <= (len))
+#define RTNH_NEXT(rtnh)		((struct rtnexthop *)(void *)(((char *)(rtnh)) \
+	+ RTNH_ALIGN((rtnh)->rtnh_len)))
+
+/* More interfaces than this and we don't filter by ifindex. */
+#define	LF_MAXIFACES	64
+
+#ifdef HAVE_NL80211_H
+/* The last if_getssid result for an interface. */
+struct if_ssid {
+	TAILQ_ENTRY(if_ssid) next;
+	unsigned int ifindex;
+	int result;
+	int error;
+	uint8_t ssid[IF_SSIDLEN];
+	unsigned int ssid_len;
+};
+TAILQ_HEAD(if_ssid_head, if_ssid);
+#endif
+
+#ifdef IFA_F_MANAGETEMPADDR
+/* use_tempaddr as it was before we enabled it. */
+struct if_tempaddr {
+	TAILQ_ENTRY(if_tempaddr) next;
+	char ifname[IF_NAMESIZE];
+	unsigned int value;
+};
+TAILQ_HEAD(if_tempaddr_head, if_tempaddr);
+#endif
 
 struct priv {
 	int route_fd;
 	int generic_fd;
 	uint32_t route_pid;
+	bool route_strict;	/* route_fd dumps can be filtered */
+#ifdef HAVE_NL80211_H
+	int nl80211_family;	/* 0 until known */
+	int nl80211_fd;		/* nl80211 events, -1 if none */
+	struct if_ssid_head ssids;	/* valid while nl80211_fd is open */
+#endif
+	unsigned int resync_gen;	/* last if_resync */
+	bool lf_attached;
+	unsigned int lf_ifaces_gen;	/* ctx->ifaces_gen when attached */
+	size_t lf_nifindex;
+	unsigned int lf_ifindex[LF_MAXIFACES];	/* in the link_fd filter */
+#ifdef IFA_F_MANAGETEMPADDR
+	struct if_tempaddr_head tempaddrs;	/* to restore on stop */
+#endif
 };
 
 /* We need this to send a broadcast for InfiniBand.
@@ -442,7 +497,7 @@ if_opensockets_os(struct dhcpcd_ctx *ctx)
 	struct priv *priv;
 	struct sockaddr_nl snl;
 	socklen_t len;
-#ifdef NETLINK_BROADCAST_ERROR
+#if defined(NETLINK_BROADCAST_ERROR) || defined(NETLINK_GET_STRICT_CHK)
 	int on = 1;
 #endif
 
@@ -472,6 +527,13 @@ if_opensockets_os(struct dhcpcd_ctx *ctx)
 		return -1;
 
 	ctx->priv = priv;
+#ifdef HAVE_NL80211_H
+	priv->nl80211_fd = -1;
+	TAILQ_INIT(&priv->ssids);
+#endif
+#ifdef IFA_F_MANAGETEMPADDR
+	TAILQ_INIT(&priv->tempaddrs);
+#endif
 	memset(&snl, 0, sizeof(snl));
 	priv->route_fd = if_linksocket(&snl, NETLINK_ROUTE, 0);
 	if (priv->route_fd == -1)
@@ -480,12 +542,24 @@ if_opensockets_os(struct dhcpcd_ctx *ctx)
 	if (getsockname(priv->route_fd, (struct sockaddr *)&snl, &len) == -1)
 		return -1;
 	priv->route_pid = snl.nl_pid;
+#ifdef NETLINK_GET_STRICT_CHK
+	/* Makes the kernel honour the filters in our dump requests. */
+	if (setsockopt(priv->route_fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
+	    &on, sizeof(on)) == 0)
+		priv->route_strict = true;
+	else if (errno != ENOPROTOOPT)
+		logerr("%s: NETLINK_GET_STRICT_CHK", __func__);
+#endif
 
 	memset(&snl, 0, sizeof(snl));
 	priv->generic_fd = if_linksocket(&snl, NETLINK_GENERIC, 0);
 	if (priv->generic_fd == -1)
 		return -1;
 
+#ifdef HAVE_NL80211_H
+	if_nl80211_open(ctx);
+#endif
+
 	return 0;
 }
 
@@ -493,11 +567,23 @@ void
 if_closesockets_os(struct dhcpcd_ctx *ctx)
 {
 	struct priv *priv;
+#ifdef IFA_F_MANAGETEMPADDR
+	struct if_tempaddr *ita;
+#endif
 
 	if (ctx->priv != NULL) {
 		priv = (struct priv *)ctx->priv;
 		close(priv->route_fd);
 		close(priv->generic_fd);
+#ifdef HAVE_NL80211_H
+		if_nl80211_close(ctx);
+#endif
+#ifdef IFA_F_MANAGETEMPADDR
+		while ((ita = TAILQ_FIRST(&priv->tempaddrs)) != NULL) {
+			TAILQ_REMOVE(&priv->tempaddrs, ita, next);
+			free(ita);
+		}
+#endif
 	}
 }
 
@@ -579,6 +665,10 @@ recv_again:
 		again = (nlm->nlmsg_flags & NLM_F_MULTI);
 		if (nlm->nlmsg_type == NLMSG_NOOP)
 			continue;
+#ifndef SMALL
+		if (ctx != NULL && fd == ctx->link_fd)
+			ctx->link_msgs++;
+#endif
 
 		if (nlm->nlmsg_type == NLMSG_ERROR) {
 			struct nlmsgerr *err;
@@ -616,6 +706,51 @@ recv_again:
 	return r;
 }
 
+#ifdef HAVE_ROUTE_MULTIPATH
+/* Only the next hops on the interface of the first one are kept. */
+static void
+if_copymultipath(struct dhcpcd_ctx *ctx, struct rt *rt, int family,
+    struct rtattr *mp)
+{
+	struct rtnexthop *rtnh;
+	struct rtattr *rta;
+	size_t len, l2;
+	union sa_ss gw;
+	bool first = true;
+
+	rtnh = (struct rtnexthop *)RTA_DATA(mp);
+	len = RTA_PAYLOAD(mp);
+	for (; RTNH_OK(rtnh, len);
+	    len -= RTNH_ALIGN(rtnh->rtnh_len), rtnh = RTNH_NEXT(rtnh))
+	{
+		if (rt->rt_ifp == NULL)
+			rt->rt_ifp = if_findindex(ctx->ifaces,
+			    (unsigned int)rtnh->rtnh_ifindex);
+		if (rt->rt_ifp == NULL ||
+		    rt->rt_ifp->index != (unsigned int)rtnh->rtnh_ifindex)
+			continue;
+
+		memset(&gw, 0, sizeof(gw));
+		gw.sa.sa_family = (sa_family_t)family;
+		rta = RTNH_DATA(rtnh);
+		l2 = (size_t)rtnh->rtnh_len - sizeof(*rtnh);
+		for (; RTA_OK(rta, l2); rta = RTA_NEXT(rta, l2)) {
+			if (rta->rta_type != RTA_GATEWAY)
+				continue;
+			memcpy((char *)&gw + sa_addroffset(&gw.sa),
+			    RTA_DATA(rta),
+			    MIN(sa_addrlen(&gw.sa), RTA_PAYLOAD(rta)));
+		}
+
+		if (first) {
+			memcpy(&rt->rt_ss_gateway, &gw, sizeof(gw));
+			first = false;
+		} else if (rt_addpath(rt, &gw.sa) == -1)
+			break;
+	}
+}
+#endif
+
 static int
 if_copyrt(struct dhcpcd_ctx *ctx, struct rt *rt, struct nlmsghdr *nlm)
 {
@@ -659,6 +794,11 @@ if_copyrt(struct dhcpcd_ctx *ctx, struct rt *rt, struct nlmsghdr *nlm)
 		case RTA_PRIORITY:
 			rt->rt_metric = *(unsigned int *)RTA_DATA(rta);
 			break;
+#ifdef HAVE_ROUTE_MULTIPATH
+		case RTA_MULTIPATH:
+			if_copymultipath(ctx, rt, rtm->rtm_family, rta);
+			break;
+#endif
 		case RTA_METRICS:
 		{
 			struct rtattr *r2;
@@ -697,6 +837,7 @@ if_copyrt(struct dhcpcd_ctx *ctx, struct rt *rt, struct nlmsghdr *nlm)
 	sa_fromprefix(&rt->rt_netmask, rtm->rtm_dst_len);
 	if (sa_is_allones(&rt->rt_netmask))
 		rt->rt_flags |= RTF_HOST;
+	rt_setkey(rt);
 
 	#if 0
 	if (rt->rtp_ifp == NULL && rt->src.s_addr != INADDR_ANY) {
@@ -753,8 +894,12 @@ link_route(struct dhcpcd_ctx *ctx, __unused struct interface *ifp,
 	if (nlm->nlmsg_pid == priv->route_pid)
 		return 0;
 
-	if (if_copyrt(ctx, &rt, nlm) == 0)
+	if (if_copyrt(ctx, &rt, nlm) == 0) {
 		rt_recvrt(cmd, &rt, (pid_t)nlm->nlmsg_pid);
+#ifdef HAVE_ROUTE_MULTIPATH
+		rt_freepath(&rt);
+#endif
+	}
 
 	return 0;
 }
@@ -830,8 +975,12 @@ link_addr(struct dhcpcd_ctx *ctx, struct interface *ifp, struct nlmsghdr *nlm)
 		}
 
 		/* Validate RTM_DELADDR really means address deleted
-		 * and anything else really means address exists. */
-		ret = if_addressexists(ifp, &addr);
+		 * and anything else really means address exists.
+		 * A dump is what exists. */
+		if (nlm->nlmsg_flags & NLM_F_MULTI)
+			ret = 1;
+		else
+			ret = if_addressexists(ifp, &addr);
 		if (ret == -1) {
 			logerr("if_addressexists: %s", inet_ntoa(addr));
 			break;
@@ -860,8 +1009,12 @@ link_addr(struct dhcpcd_ctx *ctx, struct interface *ifp, struct nlmsghdr *nlm)
 		}
 
 		/* Validate RTM_DELADDR really means address deleted
-		 * and anything else really means address exists. */
-		flags = if_addrflags6(ifp, &addr6, NULL);
+		 * and anything else really means address exists.
+		 * A dump is what exists. */
+		if (nlm->nlmsg_flags & NLM_F_MULTI)
+			flags = 0;
+		else
+			flags = if_addrflags6(ifp, &addr6, NULL);
 		if (nlm->nlmsg_type == RTM_DELADDR) {
 			if (flags != -1)
 				break;
@@ -937,6 +1090,175 @@ link_neigh(struct dhcpcd_ctx *ctx, __unused struct interface *ifp,
 }
 #endif
 
+static int
+if_cmpindex(const void *a, const void *b)
+{
+	unsigned int ia = *(const unsigned int *)a;
+	unsigned int ib = *(const unsigned int *)b;
+
+	return ia < ib ? -1 : ia > ib ? 1 : 0;
+}
+
+/* Routing daemons use protocols above RTPROT_STATIC.
+ * This must match the route part of if_linkfilter. */
+static bool
+if_linkrtprotocol(unsigned char protocol)
+{
+
+	if (protocol <= RTPROT_STATIC)
+		return true;
+#ifdef RTPROT_RA
+	if (protocol == RTPROT_RA)
+		return true;
+#endif
+#ifdef RTPROT_DHCP
+	if (protocol == RTPROT_DHCP)
+		return true;
+#endif
+	return false;
+}
+
+/*
+ * Drop link_fd messages in the kernel that link_netlink would ignore:
+ * routes outside the main table or from routing daemons,
+ * IPv4 neighbours and addresses or neighbours on interfaces we
+ * don't know about.
+ * newindex is an interface we are about to learn, so it is in the
+ * filter before we ask the kernel what addresses it has.
+ */
+static int
+if_linkfilter(struct dhcpcd_ctx *ctx, unsigned int newindex)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	unsigned int ifindex[LF_MAXIFACES];
+	size_t n = 0, i;
+	struct interface *ifp;
+	struct sock_filter buf[32 + LF_MAXIFACES * 2], *bp;
+	unsigned int jaddr, jroute;
+	struct sock_fprog pf;
+
+	/* Only rebuild it when the interfaces change or for one
+	 * it does not pass yet. */
+	if (priv->lf_attached && priv->lf_ifaces_gen == ctx->ifaces_gen &&
+	    (newindex == 0 || priv->lf_nifindex == 0 ||
+	    bsearch(&newindex, priv->lf_ifindex, priv->lf_nifindex,
+	    sizeof(priv->lf_ifindex[0]), if_cmpindex) != NULL))
+		return 0;
+
+	if (ctx->ifaces != NULL) {
+		TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+			if (n == LF_MAXIFACES)
+				break;
+			ifindex[n++] = ifp->index;
+		}
+		if (ifp != NULL)
+			n = 0;
+	}
+	if (newindex != 0 && n != 0) {
+		for (i = 0; i < n; i++) {
+			if (ifindex[i] == newindex)
+				break;
+		}
+		if (i == n) {
+			if (n == LF_MAXIFACES)
+				n = 0;
+			else
+				ifindex[n++] = newindex;
+		}
+	}
+	qsort(ifindex, n, sizeof(ifindex[0]), if_cmpindex);
+
+	/* Don't try again until the interfaces change. */
+	priv->lf_ifaces_gen = ctx->ifaces_gen;
+	if (priv->lf_attached && n == priv->lf_nifindex &&
+	    memcmp(ifindex, priv->lf_ifindex, n * sizeof(ifindex[0])) == 0)
+		return 0;
+	priv->lf_attached = true;
+	priv->lf_nifindex = n;
+	memcpy(priv->lf_ifindex, ifindex, n * sizeof(ifindex[0]));
+
+	/* Address and neighbour filter, then the route filter. */
+	jaddr = 3;
+	jroute = jaddr + (n == 0 ? 1 : 2 + (unsigned int)n * 2);
+
+	__CTASSERT(offsetof(struct ndmsg, ndm_ifindex) ==
+	    offsetof(struct ifaddrmsg, ifa_index));
+	struct sock_filter head[] = {
+		BPF_STMT(BPF_LD + BPF_H + BPF_ABS,
+		    offsetof(struct nlmsghdr, nlmsg_type)),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, htons(RTM_NEWNEIGH), 6, 0),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, htons(RTM_DELNEIGH), 5, 0),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, htons(RTM_NEWADDR),
+		    (uint8_t)(4 + jaddr), 0),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, htons(RTM_DELADDR),
+		    (uint8_t)(3 + jaddr), 0),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, htons(RTM_NEWROUTE),
+		    (uint8_t)(2 + jroute), 0),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, htons(RTM_DELROUTE),
+		    (uint8_t)(1 + jroute), 0),
+		BPF_STMT(BPF_RET + BPF_K, (unsigned int)-1),
+
+		/* We only care about IPv6 neighbours. */
+		BPF_STMT(BPF_LD + BPF_B + BPF_ABS,
+		    NLMSG_HDRLEN + offsetof(struct ndmsg, ndm_family)),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, AF_INET6, 1, 0),
+		BPF_STMT(BPF_RET + BPF_K, 0),
+	};
+
+	bp = buf;
+	memcpy(bp, head, sizeof(head));
+	bp += __arraycount(head);
+
+	if (n == 0) {
+		*bp++ = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K,
+		    (unsigned int)-1);
+	} else {
+		/* Netlink is host byte order, BPF loads are network. */
+		*bp++ = (struct sock_filter)BPF_STMT(BPF_LD + BPF_W + BPF_ABS,
+		    NLMSG_HDRLEN + offsetof(struct ifaddrmsg, ifa_index));
+		for (i = 0; i < n; i++) {
+			*bp++ = (struct sock_filter)BPF_JUMP(BPF_JMP + BPF_JEQ +
+			    BPF_K, htonl(ifindex[i]), 0, 1);
+			*bp++ = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K,
+			    (unsigned int)-1);
+		}
+		*bp++ = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, 0);
+	}
+
+	/* Like if_copyrt, only the main table. */
+	*bp++ = (struct sock_filter)BPF_STMT(BPF_LD + BPF_B + BPF_ABS,
+	    NLMSG_HDRLEN + offsetof(struct rtmsg, rtm_table));
+	*bp++ = (struct sock_filter)BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+	    RT_TABLE_MAIN, 1, 0);
+	*bp++ = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, 0);
+	/* Like if_linkrtprotocol. */
+	*bp++ = (struct sock_filter)BPF_STMT(BPF_LD + BPF_B + BPF_ABS,
+	    NLMSG_HDRLEN + offsetof(struct rtmsg, rtm_protocol));
+	*bp++ = (struct sock_filter)BPF_JUMP(BPF_JMP + BPF_JGT + BPF_K,
+	    RTPROT_STATIC, 1, 0);
+	*bp++ = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, (unsigned int)-1);
+#ifdef RTPROT_RA
+	*bp++ = (struct sock_filter)BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+	    RTPROT_RA, 0, 1);
+	*bp++ = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, (unsigned int)-1);
+#endif
+#ifdef RTPROT_DHCP
+	*bp++ = (struct sock_filter)BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+	    RTPROT_DHCP, 0, 1);
+	*bp++ = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, (unsigned int)-1);
+#endif
+	*bp++ = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, 0);
+
+#ifdef PRIVSEP
+	if (IN_PRIVSEP(ctx))
+		return (int)ps_root_setlinkfilter(ctx, buf, (size_t)(bp - buf));
+#endif
+	pf.len = (unsigned short)(bp - buf);
+	pf.filter = buf;
+	return setsockopt(ctx->link_fd, SOL_SOCKET, SO_ATTACH_FILTER,
+	    &pf, sizeof(pf));
+}
+
 static int
 link_netlink(struct dhcpcd_ctx *ctx, void *arg, struct nlmsghdr *nlm)
 {
@@ -992,6 +1314,9 @@ link_netlink(struct dhcpcd_ctx *ctx, void *arg, struct nlmsghdr *nlm)
 	}
 
 	if (nlm->nlmsg_type == RTM_DELLINK) {
+#ifdef HAVE_NL80211_H
+		if_nl80211_forget(ctx, (unsigned int)ifi->ifi_index);
+#endif
 #ifdef PLUGIN_DEV
 		/* If are listening to a dev manager, let that remove
 		 * the interface rather than the kernel. */
@@ -1013,6 +1338,8 @@ link_netlink(struct dhcpcd_ctx *ctx, void *arg, struct nlmsghdr *nlm)
 	/* Check for a new interface */
 	ifp = if_findindex(ctx->ifaces, (unsigned int)ifi->ifi_index);
 	if (ifp == NULL) {
+		if (if_linkfilter(ctx, (unsigned int)ifi->ifi_index) == -1)
+			logerr("%s: if_linkfilter", __func__);
 #ifdef PLUGIN_DEV
 		/* If are listening to a dev manager, let that announce
 		 * the interface rather than the kernel. */
@@ -1054,6 +1381,9 @@ if_handlelink(struct dhcpcd_ctx *ctx)
 		.iov_len = sizeof(buf),
 	};
 
+	if (if_linkfilter(ctx, 0) == -1)
+		logerr("%s: if_linkfilter", __func__);
+
 	return if_getnetlink(ctx, &iov, ctx->link_fd, MSG_DONTWAIT,
 	    &link_netlink, NULL);
 }
@@ -1114,17 +1444,6 @@ if_sendnetlink(struct dhcpcd_ctx *ctx, int protocol, struct nlmsghdr *hdr,
 		break;
 	case NETLINK_GENERIC:
 		s = priv->generic_fd;
-#if 0
-#ifdef NETLINK_GET_STRICT_CHK
-		if (hdr->nlmsg_type == RTM_GETADDR) {
-			int on = 1;
-
-			if (setsockopt(s, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
-			    &on, sizeof(on)) == -1 && errno != ENOPROTOOPT)
-				logerr("%s: NETLINK_GET_STRICT_CHK", __func__);
-		}
-#endif
-#endif
 		break;
 	default:
 		errno = EINVAL;
@@ -1313,25 +1632,60 @@ genl_parse(struct nlmsghdr *nlm, struct nlattr *tb[], int maxtype)
 	return nla_parse(tb, head, len, maxtype);
 }
 
+/* Multicast group ids to find, terminated by a NULL name. */
+struct gnl_mcast {
+	const char *name;
+	uint32_t id;
+};
+
+static void
+gnl_getmcast(struct nlattr *groups, struct gnl_mcast *mcast)
+{
+	struct nlattr *grp, *tb[CTRL_ATTR_MCAST_GRP_ID + 1];
+	struct gnl_mcast *m;
+	size_t rem;
+
+	NLA_FOR_EACH_ATTR(grp, (struct nlattr *)NLA_DATA(groups),
+	    NLA_LEN(groups), rem)
+	{
+		nla_parse(tb, NLA_DATA(grp), NLA_LEN(grp),
+		    CTRL_ATTR_MCAST_GRP_ID);
+		if (tb[CTRL_ATTR_MCAST_GRP_NAME] == NULL ||
+		    tb[CTRL_ATTR_MCAST_GRP_ID] == NULL)
+			continue;
+		for (m = mcast; m->name != NULL; m++) {
+			if (strncmp(m->name,
+			    NLA_DATA(tb[CTRL_ATTR_MCAST_GRP_NAME]),
+			    NLA_LEN(tb[CTRL_ATTR_MCAST_GRP_NAME])) == 0)
+				memcpy(&m->id,
+				    NLA_DATA(tb[CTRL_ATTR_MCAST_GRP_ID]),
+				    sizeof(m->id));
+		}
+	}
+}
+
 static int
-_gnl_getfamily(__unused struct dhcpcd_ctx *ctx, __unused void *arg,
+_gnl_getfamily(__unused struct dhcpcd_ctx *ctx, void *arg,
     struct nlmsghdr *nlm)
 {
-	struct nlattr *tb[CTRL_ATTR_FAMILY_ID + 1];
+	struct nlattr *tb[CTRL_ATTR_MCAST_GROUPS + 1];
 	uint16_t family;
 
-	if (genl_parse(nlm, tb, CTRL_ATTR_FAMILY_ID) == -1)
+	if (genl_parse(nlm, tb, CTRL_ATTR_MCAST_GROUPS) == -1)
 		return -1;
 	if (tb[CTRL_ATTR_FAMILY_ID] == NULL) {
 		errno = ENOENT;
 		return -1;
 	}
 	memcpy(&family, NLA_DATA(tb[CTRL_ATTR_FAMILY_ID]), sizeof(family));
+	if (arg != NULL && tb[CTRL_ATTR_MCAST_GROUPS] != NULL)
+		gnl_getmcast(tb[CTRL_ATTR_MCAST_GROUPS], arg);
 	return (int)family;
 }
 
 static int
-gnl_getfamily(struct dhcpcd_ctx *ctx, const char *name)
+gnl_getfamily(struct dhcpcd_ctx *ctx, const char *name,
+    struct gnl_mcast *mcast)
 {
 	struct nlmg nlm;
 
@@ -1345,7 +1699,7 @@ gnl_getfamily(struct dhcpcd_ctx *ctx, const char *name)
 	    CTRL_ATTR_FAMILY_NAME, name) == -1)
 		return -1;
 	return if_sendnetlink(ctx, NETLINK_GENERIC, &nlm.hdr,
-	    &_gnl_getfamily, NULL);
+	    &_gnl_getfamily, mcast);
 }
 
 static int
@@ -1405,13 +1759,20 @@ _if_getssid_nl80211(__unused struct dhcpcd_ctx *ctx, void *arg,
 static int
 if_getssid_nl80211(struct interface *ifp)
 {
+	struct priv *priv = (struct priv *)ifp->ctx->priv;
 	int family;
 	struct nlmg nlm;
 
 	errno = 0;
-	family = gnl_getfamily(ifp->ctx, "nl80211");
-	if (family == -1)
-		return -1;
+	if (priv->nl80211_family != 0)
+		family = priv->nl80211_family;
+	else {
+		family = gnl_getfamily(ifp->ctx, "nl80211", NULL);
+		if (family == -1)
+			return -1;
+		/* The id is fixed once the module has loaded. */
+		priv->nl80211_family = family;
+	}
 
 	/* Is this a wireless interface? */
 	memset(&nlm, 0, sizeof(nlm));
@@ -1436,6 +1797,174 @@ if_getssid_nl80211(struct interface *ifp)
 	return if_sendnetlink(ifp->ctx, NETLINK_GENERIC, &nlm.hdr,
 	    &_if_getssid_nl80211, ifp);
 }
+
+/*
+ * When we can hear nl80211 events, the SSID of each interface
+ * is cached until an event for that interface says it might have
+ * changed.
+ */
+static void
+if_nl80211_forget(struct dhcpcd_ctx *ctx, unsigned int ifindex)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct if_ssid *iss, *issn;
+
+	if (priv == NULL)
+		return;
+	TAILQ_FOREACH_SAFE(iss, &priv->ssids, next, issn) {
+		if (ifindex != 0 && iss->ifindex != ifindex)
+			continue;
+		TAILQ_REMOVE(&priv->ssids, iss, next);
+		free(iss);
+	}
+}
+
+static void
+if_nl80211_event(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	unsigned char buf[8 * 1024];
+	struct nlattr *tb[NL80211_ATTR_IFINDEX + 1];
+	struct nlmsghdr *nlm;
+	ssize_t len;
+	uint32_t ifindex;
+
+	for (;;) {
+		len = recv(priv->nl80211_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len == -1) {
+			/* We missed events, so forget everything. */
+			if (errno == ENOBUFS)
+				if_nl80211_forget(ctx, 0);
+			else if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			else if (errno != EINTR) {
+				logerr(__func__);
+				return;
+			}
+			continue;
+		}
+
+		for (nlm = (struct nlmsghdr *)buf;
+		     NLMSG_OK(nlm, (size_t)len);
+		     nlm = NLMSG_NEXT(nlm, len))
+		{
+			if (nlm->nlmsg_type != priv->nl80211_family ||
+			    nlm->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+				continue;
+			genl_parse(nlm, tb, NL80211_ATTR_IFINDEX);
+			if (tb[NL80211_ATTR_IFINDEX] == NULL) {
+				if_nl80211_forget(ctx, 0);
+				continue;
+			}
+			memcpy(&ifindex, NLA_DATA(tb[NL80211_ATTR_IFINDEX]),
+			    sizeof(ifindex));
+			if_nl80211_forget(ctx, ifindex);
+		}
+	}
+}
+
+static void
+if_nl80211_handleevent(void *arg, unsigned short events)
+{
+
+	if (events != ELE_READ)
+		logerrx("%s: unexpected event 0x%04x", __func__, events);
+	if_nl80211_event(arg);
+}
+
+/* Listen for connection and interface changes if nl80211 is loaded. */
+static void
+if_nl80211_open(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
+	struct gnl_mcast mcast[] = {
+		{ .name = NL80211_MULTICAST_GROUP_CONFIG },
+		{ .name = NL80211_MULTICAST_GROUP_MLME },
+		{ .name = NULL },
+	};
+	struct gnl_mcast *m;
+	int family;
+
+	family = gnl_getfamily(ctx, "nl80211", mcast);
+	if (family == -1)
+		return;
+	priv->nl80211_family = family;
+
+	priv->nl80211_fd = if_linksocket(&snl, NETLINK_GENERIC, SOCK_NONBLOCK);
+	if (priv->nl80211_fd == -1)
+		goto err;
+	for (m = mcast; m->name != NULL; m++) {
+		if (m->id == 0 ||
+		    setsockopt(priv->nl80211_fd, SOL_NETLINK,
+		    NETLINK_ADD_MEMBERSHIP, &m->id, sizeof(m->id)) == -1)
+			goto err;
+	}
+	if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH, priv->nl80211_fd,
+	    ELE_READ, if_nl80211_handleevent, ctx) == -1)
+		goto err;
+	return;
+
+err:
+	logerr(__func__);
+	if (priv->nl80211_fd != -1) {
+		close(priv->nl80211_fd);
+		priv->nl80211_fd = -1;
+	}
+}
+
+static void
+if_nl80211_close(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+
+	if (priv->nl80211_fd == -1)
+		return;
+	eloop_event_delete(ctx->eloop, priv->nl80211_fd);
+	close(priv->nl80211_fd);
+	priv->nl80211_fd = -1;
+	if_nl80211_forget(ctx, 0);
+}
+
+static int
+if_getssid_nl80211_cached(struct interface *ifp)
+{
+	struct priv *priv = (struct priv *)ifp->ctx->priv;
+	struct if_ssid *iss;
+	int r;
+
+	if (priv->nl80211_fd == -1)
+		return if_getssid_nl80211(ifp);
+
+	/* Apply anything the kernel has told us first. */
+	if_nl80211_event(ifp->ctx);
+
+	TAILQ_FOREACH(iss, &priv->ssids, next) {
+		if (iss->ifindex == ifp->index) {
+			ifp->ssid_len = iss->ssid_len;
+			memcpy(ifp->ssid, iss->ssid, iss->ssid_len);
+			errno = iss->error;
+			return iss->result;
+		}
+	}
+
+	r = if_getssid_nl80211(ifp);
+	/* ENODEV means not wireless, anything else might be transient. */
+	if (r == -1 && errno != ENODEV)
+		return r;
+
+	iss = malloc(sizeof(*iss));
+	if (iss == NULL)
+		return r;
+	iss->ifindex = ifp->index;
+	iss->result = r;
+	iss->error = r == -1 ? errno : 0;
+	iss->ssid_len = ifp->ssid_len;
+	memcpy(iss->ssid, ifp->ssid, ifp->ssid_len);
+	TAILQ_INSERT_TAIL(&priv->ssids, iss, next);
+	errno = iss->error;
+	return r;
+}
 #endif
 
 int
@@ -1444,7 +1973,7 @@ if_getssid(struct interface *ifp)
 	int r;
 
 #ifdef HAVE_NL80211_H
-	r = if_getssid_nl80211(ifp);
+	r = if_getssid_nl80211_cached(ifp);
 	if (r == -1)
 		ifp->ssid_len = 0;
 #else
@@ -1464,6 +1993,13 @@ struct nlma
 	char buffer[64];
 };
 
+struct nlml
+{
+	struct nlmsghdr hdr;
+	struct ifinfomsg i;
+	char buffer[32];
+};
+
 #ifdef INET
 struct ifiaddr
 {
@@ -1533,6 +2069,38 @@ struct nlmr
 	char buffer[256];
 };
 
+#ifdef HAVE_ROUTE_MULTIPATH
+static int
+if_route_multipath(struct nlmr *nlm, const struct rt *rt)
+{
+	char buf[(sizeof(struct rtnexthop) +
+	    RTA_SPACE(sizeof(struct in6_addr))) * (RT_MAXPATH + 1)];
+	struct rtnexthop *rtnh;
+	struct rtattr *rta;
+	const struct sockaddr *gw;
+	socklen_t alen;
+	size_t i, len = 0;
+
+	for (i = 0; i <= rt->rt_npath; i++) {
+		gw = i == 0 ? &rt->rt_gateway : &rt->rt_ss_mpath[i - 1].sa;
+		alen = sa_addrlen(gw);
+		rtnh = (struct rtnexthop *)(void *)(buf + len);
+		memset(rtnh, 0, sizeof(*rtnh));
+		rtnh->rtnh_len = (unsigned short)
+		    (sizeof(*rtnh) + RTA_SPACE(alen));
+		rtnh->rtnh_ifindex = (int)rt->rt_ifp->index;
+		rta = RTNH_DATA(rtnh);
+		rta->rta_type = RTA_GATEWAY;
+		rta->rta_len = (unsigned short)RTA_LENGTH(alen);
+		memcpy(RTA_DATA(rta), (const char *)gw + sa_addroffset(gw),
+		    alen);
+		len += RTNH_ALIGN(rtnh->rtnh_len);
+	}
+	return add_attr_l(&nlm->hdr, sizeof(*nlm), RTA_MULTIPATH,
+	    buf, (unsigned short)len);
+}
+#endif
+
 int
 if_route(unsigned char cmd, const struct rt *rt)
 {
@@ -1602,6 +2170,12 @@ if_route(unsigned char cmd, const struct rt *rt)
 	/* coverity[overrun-buffer-arg] */
 	ADDSA(RTA_DST, &rt->rt_dest);
 	if (cmd == RTM_ADD || cmd == RTM_CHANGE) {
+#ifdef HAVE_ROUTE_MULTIPATH
+		if (rt->rt_npath != 0) {
+			if (if_route_multipath(&nlm, rt) == -1)
+				return -1;
+		} else
+#endif
 		if (!gateway_unspec) {
 			/* coverity[overrun-buffer-arg] */
 			ADDSA(RTA_GATEWAY, &rt->rt_gateway);
@@ -1664,21 +2238,35 @@ _if_initrt(struct dhcpcd_ctx *ctx, void *arg,
 {
 	struct rt rt, *rtn;
 	rb_tree_t *kroutes = arg;
+	struct rtmsg *rtm;
 
 	if (if_copyrt(ctx, &rt, nlm) != 0)
 		return 0;
+	/* Keep only routes the link filter lets us hear about,
+	 * otherwise ctx->kroutes would not see them go. */
+	rtm = NLMSG_DATA(nlm);
+	if (!if_linkrtprotocol(rtm->rtm_protocol))
+		goto out;
 	if ((rtn = rt_new(rt.rt_ifp)) == NULL) {
 		logerr(__func__);
-		return 0;
+		goto out;
 	}
+	/* rtn takes over the next hops of rt. */
 	memcpy(rtn, &rt, sizeof(*rtn));
 	if (rb_tree_insert_node(kroutes, rtn) != rtn)
 		rt_free(rtn);
 	return 0;
+
+out:
+#ifdef HAVE_ROUTE_MULTIPATH
+	rt_freepath(&rt);
+#endif
+	return 0;
 }
 
-int
-if_initrt(struct dhcpcd_ctx *ctx, rb_tree_t *kroutes, int af)
+static int
+if_initrt_oif(struct dhcpcd_ctx *ctx, rb_tree_t *kroutes, int af,
+    unsigned int oif)
 {
 	struct nlmr nlm = {
 	    .hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg)),
@@ -1688,50 +2276,511 @@ if_initrt(struct dhcpcd_ctx *ctx, rb_tree_t *kroutes, int af)
 	    .rt.rtm_family = (unsigned char)af,
 	};
 
+	if (oif != 0 &&
+	    add_attr_32(&nlm.hdr, sizeof(nlm), RTA_OIF, oif) == -1)
+		return -1;
 	return if_sendnetlink(ctx, NETLINK_ROUTE, &nlm.hdr,
 	    &_if_initrt, kroutes);
 }
 
-#ifdef INET
-/* Linux is a special snowflake when it comes to BPF. */
-const char *bpf_name = "Packet Socket";
-
-/* Linux is a special snowflake for opening BPF. */
-struct bpf *
-bpf_open(const struct interface *ifp,
-    int (*filter)(const struct bpf *, const struct in_addr *),
-    const struct in_addr *ia)
+int
+if_initrt(struct dhcpcd_ctx *ctx, rb_tree_t *kroutes, int af)
 {
-	struct bpf *bpf;
-	union sockunion {
-		struct sockaddr sa;
-		struct sockaddr_ll sll;
-		struct sockaddr_storage ss;
-	} su = {
-		.sll = {
-			.sll_family = PF_PACKET,
-			.sll_protocol = htons(ETH_P_ALL),
-			.sll_ifindex = (int)ifp->index,
-		}
-	};
-#ifdef PACKET_AUXDATA
-	int n;
-#endif
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct interface *ifp;
 
-	bpf = calloc(1, sizeof(*bpf));
-	if (bpf == NULL)
-		return NULL;
-	bpf->bpf_ifp = ifp;
+	if (!priv->route_strict || ctx->ifaces == NULL)
+		return if_initrt_oif(ctx, kroutes, af, 0);
 
-	/* Allocate a suitably large buffer for a single packet. */
-	bpf->bpf_size = ETH_DATA_LEN;
-	bpf->bpf_buffer = malloc(bpf->bpf_size);
-	if (bpf->bpf_buffer == NULL)
-		goto eexit;
+	/*
+	 * if_copyrt only keeps routes on our interfaces, so ask the kernel
+	 * for just those rather than the whole of a big main table.
+	 * There are several protocols we keep, so _if_initrt checks them.
+	 */
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		if (if_initrt_oif(ctx, kroutes, af, ifp->index) == -1 &&
+		    errno != ENODEV)
+			return -1;
+	}
+	return 0;
+}
 
-	bpf->bpf_fd = xsocket(PF_PACKET, SOCK_RAW|SOCK_CXNB,htons(ETH_P_ALL));
-	if (bpf->bpf_fd == -1)
+/*
+ * Re-learn links and addresses after the link socket overflowed.
+ * Each is dumped in turn and fed to link_netlink as if it had been
+ * read from the link socket, so only what changed is acted on.
+ * If the kernel says a dump was interrupted by a change, it's done
+ * again.
+ */
+#define	IF_RESYNC_TRIES	3
+
+struct if_resync {
+	unsigned int gen;
+	bool intr;
+};
+
+static int
+if_resync_cb(struct dhcpcd_ctx *ctx, void *arg, struct nlmsghdr *nlm)
+{
+	struct if_resync *rs = arg;
+	struct ifinfomsg *ifi;
+	struct interface *ifp;
+
+#ifdef NLM_F_DUMP_INTR
+	if (nlm->nlmsg_flags & NLM_F_DUMP_INTR)
+		rs->intr = true;
+#endif
+	if (link_netlink(ctx, NULL, nlm) == -1)
+		logerr(__func__);
+
+	/* Mark the interface as still here. */
+	if (nlm->nlmsg_type == RTM_NEWLINK &&
+	    nlm->nlmsg_len >= NLMSG_LENGTH(sizeof(*ifi)))
+	{
+		ifi = NLMSG_DATA(nlm);
+		ifp = if_findindex(ctx->ifaces, (unsigned int)ifi->ifi_index);
+		if (ifp != NULL)
+			ifp->linkgen = rs->gen;
+	}
+	return 0;
+}
+
+static int
+if_resync_dump(struct dhcpcd_ctx *ctx, uint16_t type, struct if_resync *rs)
+{
+	struct nlma nlm = {
+	    .hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg)),
+	    .hdr.nlmsg_type = type,
+	    .hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+	    .ifa.ifa_family = AF_UNSPEC,
+	};
+
+	/* ifinfomsg and ifaddrmsg both start with the family. */
+	if (type == RTM_GETLINK)
+		nlm.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	rs->intr = false;
+	return if_sendnetlink(ctx, NETLINK_ROUTE, &nlm.hdr, if_resync_cb, rs);
+}
+
+int
+if_resync(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct if_resync rs = { .gen = ++priv->resync_gen };
+	struct interface *ifp, *ifn;
+	int tries;
+
+	for (tries = 0; tries < IF_RESYNC_TRIES; tries++) {
+		if (if_resync_dump(ctx, RTM_GETLINK, &rs) == -1)
+			return -1;
+		if (!rs.intr)
+			break;
+	}
+	if (rs.intr) {
+		errno = EINTR;
+		return -1;
+	}
+
+	/* Punt departed interfaces */
+	TAILQ_FOREACH_SAFE(ifp, ctx->ifaces, next, ifn) {
+		if (ifp->linkgen != rs.gen)
+			dhcpcd_handleinterface(ctx, -1, ifp->name);
+	}
+
+	for (tries = 0; tries < IF_RESYNC_TRIES; tries++) {
+		if_markaddrsstale(ctx->ifaces);
+		if (if_resync_dump(ctx, RTM_GETADDR, &rs) == -1)
+			return -1;
+		if (!rs.intr)
+			break;
+	}
+	if (rs.intr) {
+		errno = EINTR;
+		return -1;
+	}
+	if_deletestaleaddrs(ctx->ifaces);
+	return 0;
+}
+
+/*
+ * if_discover only needs the links, so build its list from a link
+ * dump, or just the one link, rather than have getifaddrs(3) dump
+ * every link and address.
+ * Addresses are then learned by if_getaddrs as if they had been
+ * read from the link socket.
+ */
+struct if_link {
+	struct ifaddrs ifa;
+	union {
+		struct sockaddr_ll sll;
+		uint8_t buf[offsetof(struct sockaddr_ll, sll_addr) +
+		    HWADDR_LEN];
+	} su;
+	char name[IF_NAMESIZE];
+};
+
+struct if_getlinks {
+	struct ifaddrs **tail;
+	int argc;
+	char * const *argv;
+	int error;
+};
+
+static int
+if_getlinks_cb(__unused struct dhcpcd_ctx *ctx, void *arg,
+    struct nlmsghdr *nlm)
+{
+	struct if_getlinks *gl = arg;
+	struct ifinfomsg *ifi;
+	struct rtattr *rta;
+	struct if_link *ifl;
+	size_t len;
+
+	if (nlm->nlmsg_type != RTM_NEWLINK || gl->error != 0)
+		return 0;
+	if (nlm->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi))) {
+		gl->error = EBADMSG;
+		return -1;
+	}
+	if ((ifl = calloc(1, sizeof(*ifl))) == NULL) {
+		gl->error = errno;
+		return -1;
+	}
+
+	ifi = NLMSG_DATA(nlm);
+	ifl->su.sll.sll_family = AF_PACKET;
+	ifl->su.sll.sll_ifindex = ifi->ifi_index;
+	ifl->su.sll.sll_hatype = ifi->ifi_type;
+	rta = (void *)((char *)ifi + NLMSG_ALIGN(sizeof(*ifi)));
+	len = NLMSG_PAYLOAD(nlm, sizeof(*ifi));
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			memcpy(ifl->name, RTA_DATA(rta),
+			    MIN(RTA_PAYLOAD(rta), sizeof(ifl->name) - 1));
+			break;
+		case IFLA_ADDRESS:
+			if (RTA_PAYLOAD(rta) > HWADDR_LEN)
+				break;
+			ifl->su.sll.sll_halen = (unsigned char)RTA_PAYLOAD(rta);
+			memcpy(ifl->su.buf + offsetof(struct sockaddr_ll,
+			    sll_addr), RTA_DATA(rta), RTA_PAYLOAD(rta));
+			break;
+		}
+	}
+	if (ifl->name[0] == '\0') {
+		free(ifl);
+		return 0;
+	}
+	if (gl->argc > 1) {
+		int i;
+
+		for (i = 0; i < gl->argc; i++) {
+			if (strcmp(gl->argv[i], ifl->name) == 0)
+				break;
+		}
+		if (i == gl->argc) {
+			free(ifl);
+			return 0;
+		}
+	}
+
+	ifl->ifa.ifa_name = ifl->name;
+	ifl->ifa.ifa_flags = ifi->ifi_flags;
+	ifl->ifa.ifa_addr = (struct sockaddr *)(void *)&ifl->su.sll;
+	*gl->tail = &ifl->ifa;
+	gl->tail = &ifl->ifa.ifa_next;
+	return 0;
+}
+
+/* Lists the links named in argv, or every link if argc is zero. */
+int
+if_getlinks(struct dhcpcd_ctx *ctx, struct ifaddrs **ifap,
+    int argc, char * const *argv)
+{
+	struct nlml nlm = {
+	    .hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+	    .hdr.nlmsg_type = RTM_GETLINK,
+	    .hdr.nlmsg_flags = NLM_F_REQUEST,
+	    .i.ifi_family = AF_UNSPEC,
+	};
+	struct if_getlinks gl = {
+	    .tail = ifap, .argc = argc, .argv = argv, .error = 0,
+	};
+	int r;
+
+	*ifap = NULL;
+	if (argc != 1)
+		nlm.hdr.nlmsg_flags |= NLM_F_DUMP;
+	else if (add_attr_l(&nlm.hdr, sizeof(nlm), IFLA_IFNAME,
+	    argv[0], (unsigned short)(strlen(argv[0]) + 1)) == -1)
+		return -1;
+
+	r = if_sendnetlink(ctx, NETLINK_ROUTE, &nlm.hdr, if_getlinks_cb, &gl);
+	if (r != -1 && gl.error != 0) {
+		errno = gl.error;
+		r = -1;
+	}
+	if (r == -1) {
+		if_freeifaddrs(ctx, ifap);
+		/* The link departed before we could ask for it. */
+		if (argc == 1 && errno == ENODEV)
+			return 0;
+		return -1;
+	}
+	return 0;
+}
+
+static int
+if_getaddrs_cb(struct dhcpcd_ctx *ctx, void *arg, struct nlmsghdr *nlm)
+{
+	const struct ifaddrs *links = arg, *link;
+	const struct sockaddr_ll *sll;
+	const struct ifaddrmsg *ifa;
+
+	if (nlm->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
+		return 0;
+	ifa = NLMSG_DATA(nlm);
+	/* Without strict checking the kernel dumps every address. */
+	for (link = links; link != NULL; link = link->ifa_next) {
+		sll = (const void *)link->ifa_addr;
+		if ((unsigned int)sll->sll_ifindex == ifa->ifa_index)
+			break;
+	}
+	if (links != NULL && link == NULL)
+		return 0;
+	if (link_addr(ctx, NULL, nlm) == -1)
+		logerr(__func__);
+	return 0;
+}
+
+/* Learns the addresses on the links from if_getlinks, or on every
+ * interface if NULL. */
+int
+if_getaddrs(struct dhcpcd_ctx *ctx, const struct ifaddrs *links)
+{
+	struct nlma nlm = {
+	    .hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg)),
+	    .hdr.nlmsg_type = RTM_GETADDR,
+	    .hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+	    .ifa.ifa_family = AF_UNSPEC,
+	};
+	const struct sockaddr_ll *sll;
+
+	if (links != NULL && links->ifa_next == NULL) {
+		sll = (const void *)links->ifa_addr;
+		nlm.ifa.ifa_index = (unsigned int)sll->sll_ifindex;
+	}
+	return if_sendnetlink(ctx, NETLINK_ROUTE, &nlm.hdr,
+	    if_getaddrs_cb, UNCONST(links));
+}
+
+#ifdef INET
+/* Linux is a special snowflake when it comes to BPF. */
+const char *bpf_name = "Packet Socket";
+
+#if defined(TPACKET3_HDRLEN) && !defined(BPF_NORING)
+#define	BPF_RING
+#endif
+
+#ifdef BPF_RING
+/*
+ * DHCP and ARP frames are small, so a small TPACKET_V3 ring does.
+ * A block is handed to us when it fills or BPF_RING_TMO msecs after
+ * the first frame lands in it.
+ */
+#define	BPF_RING_BLOCKLEN	(1U << 14)
+#define	BPF_RING_NBLOCKS	8U
+#define	BPF_RING_FRAMELEN	(1U << 11)
+#define	BPF_RING_TMO		10U
+
+static void
+bpf_ringreq(struct tpacket_req3 *req)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+	memset(req, 0, sizeof(*req));
+	req->tp_block_size = BPF_RING_BLOCKLEN;
+	/* Blocks must be page sized. */
+	if (pagesize > 0 && (unsigned int)pagesize > req->tp_block_size)
+		req->tp_block_size = (unsigned int)pagesize;
+	req->tp_block_nr = BPF_RING_NBLOCKS;
+	req->tp_frame_size = BPF_RING_FRAMELEN;
+	req->tp_frame_nr = (req->tp_block_size / req->tp_frame_size) *
+	    req->tp_block_nr;
+	req->tp_retire_blk_tov = BPF_RING_TMO;
+}
+
+size_t
+bpf_ringsize(void)
+{
+	struct tpacket_req3 req;
+
+	bpf_ringreq(&req);
+	return (size_t)req.tp_block_size * req.tp_block_nr;
+}
+
+static int
+bpf_ringmap(struct bpf *bpf)
+{
+	struct tpacket_req3 req;
+	void *ring;
+
+	bpf_ringreq(&req);
+	bpf->bpf_ringlen = bpf_ringsize();
+	ring = mmap(NULL, bpf->bpf_ringlen, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, bpf->bpf_fd, 0);
+	if (ring == MAP_FAILED)
+		return -1;
+	bpf->bpf_ring = ring;
+	bpf->bpf_blocklen = req.tp_block_size;
+	bpf->bpf_nblocks = req.tp_block_nr;
+	bpf->bpf_block = 0;
+	bpf->bpf_npkts = 0;
+	bpf->bpf_pkt = NULL;
+	return 0;
+}
+
+/*
+ * Put a receive ring on the socket so a wakeup can read every frame
+ * that has arrived without a syscall or a copy for each one.
+ * Returns 0 if the kernel can't do this, so we fall back to recvmsg.
+ */
+static int
+bpf_ringopen(struct bpf *bpf)
+{
+	struct tpacket_req3 req;
+	int v = TPACKET_V3;
+
+	if (setsockopt(bpf->bpf_fd, SOL_PACKET, PACKET_VERSION,
+	    &v, sizeof(v)) == -1)
+		return 0;
+	bpf_ringreq(&req);
+	if (setsockopt(bpf->bpf_fd, SOL_PACKET, PACKET_RX_RING,
+	    &req, sizeof(req)) == -1)
+	{
+		v = TPACKET_V1;
+		if (setsockopt(bpf->bpf_fd, SOL_PACKET, PACKET_VERSION,
+		    &v, sizeof(v)) == -1)
+			return -1;
+		return 0;
+	}
+	return bpf_ringmap(bpf);
+}
+
+/* Frames are read in place and the block is only given back to the
+ * kernel once we've moved past its last frame. */
+static ssize_t
+bpf_readring(struct bpf *bpf, const void **data)
+{
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *hdr;
+
+	for (;;) {
+		bd = (struct tpacket_block_desc *)((char *)bpf->bpf_ring +
+		    bpf->bpf_block * bpf->bpf_blocklen);
+		if (bpf->bpf_pkt != NULL && bpf->bpf_npkts == 0) {
+			__atomic_store_n(&bd->hdr.bh1.block_status,
+			    TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+			bpf->bpf_pkt = NULL;
+			bpf->bpf_block = (bpf->bpf_block + 1) %
+			    bpf->bpf_nblocks;
+			continue;
+		}
+		if (bpf->bpf_pkt == NULL) {
+			if (!(__atomic_load_n(&bd->hdr.bh1.block_status,
+			    __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			{
+				bpf->bpf_flags |= BPF_EOF;
+				return 0;
+			}
+			bpf->bpf_npkts = bd->hdr.bh1.num_pkts;
+			bpf->bpf_pkt = (char *)bd +
+			    bd->hdr.bh1.offset_to_first_pkt;
+			continue;
+		}
+
+		hdr = (struct tpacket3_hdr *)(void *)bpf->bpf_pkt;
+		bpf->bpf_pkt += hdr->tp_next_offset;
+		bpf->bpf_npkts--;
+		/* Drop anything which claims to be outside the block. */
+		if ((char *)hdr + hdr->tp_mac + hdr->tp_snaplen >
+		    (char *)bd + bpf->bpf_blocklen)
+			continue;
+
+		*data = (char *)hdr + hdr->tp_mac;
+		if (bpf_frame_bcast(bpf->bpf_ifp, *data) == 0)
+			bpf->bpf_flags |= BPF_BCAST;
+		else
+			bpf->bpf_flags &= ~BPF_BCAST;
+		bpf->bpf_flags &= ~(BPF_PARTIALCSUM | BPF_CSUMVALID);
+		if (hdr->tp_status & TP_STATUS_CSUMNOTREADY)
+			bpf->bpf_flags |= BPF_PARTIALCSUM;
+#ifdef TP_STATUS_CSUM_VALID
+		if (hdr->tp_status & TP_STATUS_CSUM_VALID)
+			bpf->bpf_flags |= BPF_CSUMVALID;
+#endif
+		return (ssize_t)hdr->tp_snaplen;
+	}
+}
+#else
+size_t
+bpf_ringsize(void)
+{
+
+	return 0;
+}
+#endif
+
+/* Linux is a special snowflake for opening BPF. */
+struct bpf *
+bpf_open(const struct interface *ifp,
+    int (*filter)(const struct bpf *, const struct in_addr *),
+    const struct in_addr *ia)
+{
+	struct bpf *bpf;
+	union sockunion {
+		struct sockaddr sa;
+		struct sockaddr_ll sll;
+		struct sockaddr_storage ss;
+	} su = {
+		.sll = {
+			.sll_family = PF_PACKET,
+			.sll_protocol = htons(ETH_P_ALL),
+			.sll_ifindex = (int)ifp->index,
+		}
+	};
+#ifdef PACKET_AUXDATA
+	int n;
+#endif
+
+	bpf = calloc(1, sizeof(*bpf));
+	if (bpf == NULL)
+		return NULL;
+	bpf->bpf_ifp = ifp;
+	bpf->bpf_filter = filter;
+	if (ia != NULL)
+		bpf->bpf_addr = *ia;
+	bpf->bpf_size = ETH_DATA_LEN;
+
+	/* No protocol, so nothing is queued until we bind. */
+	bpf->bpf_fd = xsocket(PF_PACKET, SOCK_RAW | SOCK_CXNB, 0);
+	if (bpf->bpf_fd == -1)
+		goto eexit;
+
+#ifdef BPF_RING
+	/* Before the bind, as frames would otherwise sit on the socket
+	 * queue where we never read them. */
+	if (bpf_ringopen(bpf) == -1)
 		goto eexit;
+	if (bpf->bpf_ring == NULL)
+#endif
+	{
+		/* A suitably large buffer for a single packet. */
+		bpf->bpf_buffer = malloc(bpf->bpf_size);
+		if (bpf->bpf_buffer == NULL)
+			goto eexit;
+	}
 
 	/* We cannot validate the correct interface,
 	 * so we MUST set this first. */
@@ -1764,16 +2813,72 @@ bpf_open(const struct interface *ifp,
 
 eexit:
 	if (bpf->bpf_fd != -1)
-		close(bpf->bpf_fd);
-	free(bpf->bpf_buffer);
+		bpf_close(bpf);
+	else
+		free(bpf);
+	return NULL;
+}
+
+/* Wrap an already open and filtered BPF descriptor,
+ * such as one passed from another process. */
+struct bpf *
+bpf_fdopen(const struct interface *ifp, int fd, size_t size)
+{
+	struct bpf *bpf;
+#ifdef BPF_RING
+	int v;
+	socklen_t vlen = sizeof(v);
+#endif
+
+	if (size == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	bpf = calloc(1, sizeof(*bpf));
+	if (bpf == NULL)
+		return NULL;
+	bpf->bpf_ifp = ifp;
+	bpf->bpf_fd = fd;
+	bpf->bpf_size = size;
+
+#ifdef BPF_RING
+	/* The ring was set up by whoever opened it, but needs
+	 * mapping again here. */
+	if (getsockopt(fd, SOL_PACKET, PACKET_VERSION, &v, &vlen) == 0 &&
+	    v == TPACKET_V3)
+	{
+		if (bpf_ringmap(bpf) == -1)
+			goto eexit;
+		return bpf;
+	}
+#endif
+	bpf->bpf_buffer = malloc(bpf->bpf_size);
+	if (bpf->bpf_buffer == NULL)
+		goto eexit;
+	return bpf;
+
+eexit:
 	free(bpf);
 	return NULL;
 }
 
+void
+bpf_close(struct bpf *bpf)
+{
+
+#ifdef BPF_RING
+	if (bpf->bpf_ring != NULL)
+		munmap(bpf->bpf_ring, bpf->bpf_ringlen);
+#endif
+	close(bpf->bpf_fd);
+	free(bpf->bpf_buffer);
+	free(bpf);
+}
+
 /* BPF requires that we read the entire buffer.
  * So we pass the buffer in the API so we can loop on >1 packet. */
 ssize_t
-bpf_read(struct bpf *bpf, void *data, size_t len)
+bpf_readframe(struct bpf *bpf, const void **data)
 {
 	ssize_t bytes;
 	struct iovec iov = {
@@ -1790,6 +2895,11 @@ bpf_read(struct bpf *bpf, void *data, size_t len)
 	struct tpacket_auxdata *aux;
 #endif
 
+#ifdef BPF_RING
+	if (bpf->bpf_ring != NULL)
+		return bpf_readring(bpf, data);
+#endif
+
 #ifdef PACKET_AUXDATA
 	msg.msg_control = cmsgbuf.buf;
 	msg.msg_controllen = sizeof(cmsgbuf.buf);
@@ -1799,15 +2909,13 @@ bpf_read(struct bpf *bpf, void *data, size_t len)
 	if (bytes == -1)
 		return -1;
 	bpf->bpf_flags |= BPF_EOF; /* We only ever read one packet. */
-	bpf->bpf_flags &= ~BPF_PARTIALCSUM;
+	bpf->bpf_flags &= ~(BPF_PARTIALCSUM | BPF_CSUMVALID);
 	if (bytes) {
 		if (bpf_frame_bcast(bpf->bpf_ifp, bpf->bpf_buffer) == 0)
 			bpf->bpf_flags |= BPF_BCAST;
 		else
 			bpf->bpf_flags &= ~BPF_BCAST;
-		if ((size_t)bytes > len)
-			bytes = (ssize_t)len;
-		memcpy(data, bpf->bpf_buffer, (size_t)bytes);
+		*data = bpf->bpf_buffer;
 #ifdef PACKET_AUXDATA
 		for (cmsg = CMSG_FIRSTHDR(&msg);
 		     cmsg;
@@ -1818,6 +2926,10 @@ bpf_read(struct bpf *bpf, void *data, size_t len)
 				aux = (void *)CMSG_DATA(cmsg);
 				if (aux->tp_status & TP_STATUS_CSUMNOTREADY)
 					bpf->bpf_flags |= BPF_PARTIALCSUM;
+#ifdef TP_STATUS_CSUM_VALID
+				if (aux->tp_status & TP_STATUS_CSUM_VALID)
+					bpf->bpf_flags |= BPF_CSUMVALID;
+#endif
 			}
 		}
 #endif
@@ -1834,16 +2946,22 @@ bpf_attach(int s, void *filter, unsigned int filter_len)
 	};
 
 	/* Install the filter. */
-	if (setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &pf, sizeof(pf)) == -1)
-		return -1;
+	return setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &pf, sizeof(pf));
+}
+
+/* Once locked the filter cannot be changed, even if we are compromised. */
+int
+bpf_lock(struct bpf *bpf)
+{
 
 #ifdef SO_LOCK_FILTER
 	int on = 1;
 
-	if (setsockopt(s, SOL_SOCKET, SO_LOCK_FILTER, &on, sizeof(on)) == -1)
+	if (setsockopt(bpf->bpf_fd, SOL_SOCKET, SO_LOCK_FILTER,
+	    &on, sizeof(on)) == -1)
 		return -1;
 #endif
-
+	bpf->bpf_flags |= BPF_LOCKED;
 	return 0;
 }
 
@@ -2025,13 +3143,6 @@ if_getlifetime6(__unused struct ipv6_addr *ia)
 	return -1;
 }
 
-struct nlml
-{
-	struct nlmsghdr hdr;
-	struct ifinfomsg i;
-	char buffer[32];
-};
-
 #ifdef HAVE_IN6_ADDR_GEN_MODE_NONE
 static struct rtattr *
 add_attr_nest(struct nlmsghdr *n, unsigned short maxlen, unsigned short type)
@@ -2083,6 +3194,82 @@ if_disable_autolinklocal(struct dhcpcd_ctx *ctx, unsigned int ifindex)
 static const char *p_conf = "/proc/sys/net/ipv6/conf";
 static const char *p_neigh = "/proc/sys/net/ipv6/neigh";
 
+#ifdef IFA_F_MANAGETEMPADDR
+static struct if_tempaddr *
+if_findtempaddr(struct dhcpcd_ctx *ctx, const char *ifname)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct if_tempaddr *ita;
+
+	TAILQ_FOREACH(ita, &priv->tempaddrs, next) {
+		if (strcmp(ita->ifname, ifname) == 0)
+			return ita;
+	}
+	return NULL;
+}
+
+static void
+if_settempaddr(const struct interface *ifp)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct if_tempaddr *ita;
+	char path[256];
+	int ra;
+
+	snprintf(path, sizeof(path), "%s/%s/use_tempaddr", p_conf, ifp->name);
+	ra = check_proc_int(ctx, path);
+	if (ra == -1) {
+		if (errno != ENOENT)
+			logerr("%s: %s", __func__, path);
+		return;
+	}
+	if (ra >= 1)
+		return;
+	if (if_writepathuint(ctx, path, 1) == -1) {
+		logerr("%s: %s", __func__, path);
+		return;
+	}
+	if (if_findtempaddr(ctx, ifp->name) != NULL)
+		return;
+	if ((ita = malloc(sizeof(*ita))) == NULL) {
+		logerr(__func__);
+		return;
+	}
+	strlcpy(ita->ifname, ifp->name, sizeof(ita->ifname));
+	ita->value = (unsigned int)ra;
+	TAILQ_INSERT_TAIL(&priv->tempaddrs, ita, next);
+}
+#endif
+
+void
+if_restore_inet6(const struct interface *ifp)
+{
+#ifdef IFA_F_MANAGETEMPADDR
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct if_tempaddr *ita;
+	char path[256];
+
+	if ((ita = if_findtempaddr(ctx, ifp->name)) == NULL)
+		return;
+	TAILQ_REMOVE(&priv->tempaddrs, ita, next);
+	/* Addresses kept at exit keep their temporaries as well. */
+	if ((ifp->options->options & (DHCPCD_EXITING | DHCPCD_PERSISTENT)) !=
+	    (DHCPCD_EXITING | DHCPCD_PERSISTENT))
+	{
+		snprintf(path, sizeof(path), "%s/%s/use_tempaddr",
+		    p_conf, ifp->name);
+		if (if_writepathuint(ctx, path, ita->value) == -1 &&
+		    errno != ENOENT)
+			logerr("%s: %s", __func__, path);
+	}
+	free(ita);
+#else
+	UNUSED(ifp);
+#endif
+}
+
 void
 if_setup_inet6(const struct interface *ifp)
 {
@@ -2122,6 +3309,13 @@ if_setup_inet6(const struct interface *ifp)
 		if (if_writepathuint(ctx, path, 0) == -1)
 			logerr("%s: %s", __func__, path);
 	}
+
+#ifdef IFA_F_MANAGETEMPADDR
+	/* The kernel makes and regenerates temporary addresses from the
+	 * ones we mark with IFA_F_MANAGETEMPADDR, if it's enabled. */
+	if (ifp->options->options & DHCPCD_SLAACTEMP)
+		if_settempaddr(ifp);
+#endif
 }
 
 int
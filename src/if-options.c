@@ -50,12 +50,33 @@
 #include "dhcp6.h"
 #include "dhcpcd-embedded.h"
 #include "duid.h"
+#include "eloop.h"
+#include "hooks.h"
 #include "if.h"
 #include "if-options.h"
 #include "ipv4.h"
 #include "logerr.h"
 #include "sa.h"
 
+/*
+ * dhcpcd.conf is read for each interface, so keep it split into
+ * lines with each option looked up in cf_options.
+ * Parsing modifies the arguments, so it parses a copy of cc_buf.
+ */
+struct cf_line {
+	size_t		 cl_opt;	/* offset of the option in cc_buf */
+	size_t		 cl_arg;	/* offset of the argument or SIZE_MAX */
+	int		 cl_idx;	/* index into cf_options or -1 */
+};
+
+struct cf_cache {
+	char		*cc_buf;
+	size_t		 cc_buflen;
+	struct cf_line	*cc_lines;
+	size_t		 cc_nlines;
+	time_t		 cc_mtime;
+};
+
 #define	IN_CONFIG_BLOCK(ifo)	((ifo)->options & DHCPCD_FORKED)
 #define	SET_CONFIG_BLOCK(ifo)	((ifo)->options |= DHCPCD_FORKED)
 #define	CLEAR_CONFIG_BLOCK(ifo)	((ifo)->options &= ~DHCPCD_FORKED)
@@ -72,6 +93,7 @@ const struct option cf_options[] = {
 	{"hostname",        optional_argument, NULL, 'h'},
 	{"vendorclassid",   optional_argument, NULL, 'i'},
 	{"logfile",         required_argument, NULL, 'j'},
+	{"logratelimit",    required_argument, NULL, O_LOGRATELIMIT},
 	{"release",         no_argument,       NULL, 'k'},
 	{"leasetime",       required_argument, NULL, 'l'},
 	{"metric",          required_argument, NULL, 'm'},
@@ -112,6 +134,10 @@ const struct option cf_options[] = {
 	{"static",          required_argument, NULL, 'S'},
 	{"test",            no_argument,       NULL, 'T'},
 	{"dumplease",       no_argument,       NULL, 'U'},
+	{"dumpstats",       no_argument,       NULL, O_DUMPSTATS},
+	{"dumpstate",       no_argument,       NULL, O_DUMPSTATE},
+	{"dumpmem",         no_argument,       NULL, O_DUMPMEM},
+	{"restart",         no_argument,       NULL, O_RESTART},
 	{"variables",       no_argument,       NULL, 'V'},
 	{"whitelist",       required_argument, NULL, 'W'},
 	{"blacklist",       required_argument, NULL, 'X'},
@@ -122,6 +148,7 @@ const struct option cf_options[] = {
 	{"anonymous",       no_argument,       NULL, O_ANONYMOUS},
 	{"randomise_hwaddr",no_argument,       NULL, O_RANDOMISE_HWADDR},
 	{"arping",          required_argument, NULL, O_ARPING},
+	{"arp_optimistic",  no_argument,       NULL, O_ARP_OPTIMISTIC},
 	{"destination",     required_argument, NULL, O_DESTINATION},
 	{"fallback",        required_argument, NULL, O_FALLBACK},
 	{"ipv6rs",          no_argument,       NULL, O_IPV6RS},
@@ -129,6 +156,7 @@ const struct option cf_options[] = {
 	{"ipv6ra_autoconf", no_argument,       NULL, O_IPV6RA_AUTOCONF},
 	{"ipv6ra_noautoconf", no_argument,     NULL, O_IPV6RA_NOAUTOCONF},
 	{"ipv6ra_fork",     no_argument,       NULL, O_IPV6RA_FORK},
+	{"ipv6ra_multipath", no_argument,      NULL, O_IPV6RA_MULTIPATH},
 	{"ipv4",            no_argument,       NULL, O_IPV4},
 	{"noipv4",          no_argument,       NULL, O_NOIPV4},
 	{"ipv6",            no_argument,       NULL, O_IPV6},
@@ -156,6 +184,7 @@ const struct option cf_options[] = {
 	{"dhcp6",           no_argument,       NULL, O_DHCP6},
 	{"nodhcp6",         no_argument,       NULL, O_NODHCP6},
 	{"controlgroup",    required_argument, NULL, O_CONTROLGRP},
+	{"control_queue",   required_argument, NULL, O_CONTROL_QUEUE},
 	{"slaac",           required_argument, NULL, O_SLAAC},
 	{"gateway",         no_argument,       NULL, O_GATEWAY},
 	{"reject",          required_argument, NULL, O_REJECT},
@@ -166,8 +195,21 @@ const struct option cf_options[] = {
 	{"inactive",        no_argument,       NULL, O_INACTIVE},
 	{"mudurl",          required_argument, NULL, O_MUDURL},
 	{"link_rcvbuf",     required_argument, NULL, O_LINK_RCVBUF},
+	{"link_rcvbuf_max", required_argument, NULL, O_LINK_RCVBUF_MAX},
+	{"lease_write_delay", required_argument, NULL, O_LEASE_WRITE_DELAY},
+	{"lease_database",  no_argument,       NULL, O_LEASE_DATABASE},
+	{"start_rate",      required_argument, NULL, O_START_RATE},
+	{"start_jobs",      required_argument, NULL, O_START_JOBS},
+	{"route_delay",     required_argument, NULL, O_ROUTE_DELAY},
+	{"script_worker",   no_argument,       NULL, O_SCRIPT_WORKER},
+	{"script_jobs",     required_argument, NULL, O_SCRIPT_JOBS},
+	{"builtin_hooks",   required_argument, NULL, O_BUILTIN_HOOKS},
 	{"configure",       no_argument,       NULL, O_CONFIGURE},
 	{"noconfigure",     no_argument,       NULL, O_NOCONFIGURE},
+	{"poll",            required_argument, NULL, O_POLL},
+	{"bpf_pool",        required_argument, NULL, O_BPF_POOL},
+	{"bpf_shared",      no_argument,       NULL, O_BPF_SHARED},
+	{"callback_stats",  no_argument,       NULL, O_CBSTATS},
 	{NULL,              0,                 NULL, '\0'}
 };
 
@@ -491,7 +533,7 @@ parse_addr(__unused struct in_addr *addr, __unused struct in_addr *net,
 }
 #endif
 
-static void
+static int
 set_option_space(struct dhcpcd_ctx *ctx,
     const char *arg,
     const struct dhcp_opt **d, size_t *dl,
@@ -514,7 +556,7 @@ set_option_space(struct dhcpcd_ctx *ctx,
 		*require = ifo->requiremasknd;
 		*no = ifo->nomasknd;
 		*reject = ifo->rejectmasknd;
-		return;
+		return 0;
 	}
 
 #ifdef DHCP6
@@ -523,11 +565,15 @@ set_option_space(struct dhcpcd_ctx *ctx,
 		*dl = ctx->dhcp6_opts_len;
 		*od = ifo->dhcp6_override;
 		*odl = ifo->dhcp6_override_len;
-		*request = ifo->requestmask6;
-		*require = ifo->requiremask6;
-		*no = ifo->nomask6;
-		*reject = ifo->rejectmask6;
-		return;
+		if ((*request = if_optionmask6(&ifo->requestmask6)) == NULL ||
+		    (*require = if_optionmask6(&ifo->requiremask6)) == NULL ||
+		    (*no = if_optionmask6(&ifo->nomask6)) == NULL ||
+		    (*reject = if_optionmask6(&ifo->rejectmask6)) == NULL)
+		{
+			logerr(__func__);
+			return -1;
+		}
+		return 0;
 	}
 #endif
 #else
@@ -549,6 +595,7 @@ set_option_space(struct dhcpcd_ctx *ctx,
 	*require = ifo->requiremask;
 	*no = ifo->nomask;
 	*reject = ifo->rejectmask;
+	return 0;
 }
 
 void
@@ -632,6 +679,7 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 	long l;
 	unsigned long u;
 	char *p = NULL, *bp, *fp, *np;
+	const char *cp;
 	ssize_t s;
 	struct in_addr addr, addr2;
 	in_addr_t *naddr;
@@ -678,6 +726,10 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 	case 'P': /* FALLTHROUGH */
 	case 'T': /* FALLTHROUGH */
 	case 'U': /* FALLTHROUGH */
+	case O_DUMPSTATS: /* FALLTHROUGH */
+	case O_DUMPSTATE: /* FALLTHROUGH */
+	case O_DUMPMEM: /* FALLTHROUGH */
+	case O_RESTART: /* FALLTHROUGH */
 	case 'V': /* We need to handle non interface options */
 		break;
 	case 'b':
@@ -756,7 +808,6 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		/* per interface logging is not supported
 		 * don't want to overide the commandline */
 		if (!IN_CONFIG_BLOCK(ifo) && ctx->logfile == NULL) {
-			logclose();
 			ctx->logfile = strdup(arg);
 			logopen(ctx->logfile);
 		}
@@ -789,8 +840,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		ARG_REQUIRED;
 		if (ctx->options & DHCPCD_PRINT_PIDFILE)
 			break;
-		set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
-		    &request, &require, &no, &reject);
+		if (set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
+		    &request, &require, &no, &reject) == -1)
+			return -1;
 		if (make_option_mask(d, dl, od, odl, request, arg, 1) != 0 ||
 		    make_option_mask(d, dl, od, odl, no, arg, -1) != 0 ||
 		    make_option_mask(d, dl, od, odl, reject, arg, -1) != 0)
@@ -803,8 +855,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		ARG_REQUIRED;
 		if (ctx->options & DHCPCD_PRINT_PIDFILE)
 			break;
-		set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
-		    &request, &require, &no, &reject);
+		if (set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
+		    &request, &require, &no, &reject) == -1)
+			return -1;
 		if (make_option_mask(d, dl, od, odl, reject, arg, 1) != 0 ||
 		    make_option_mask(d, dl, od, odl, request, arg, -1) != 0 ||
 		    make_option_mask(d, dl, od, odl, require, arg, -1) != 0)
@@ -1076,8 +1129,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		ARG_REQUIRED;
 		if (ctx->options & DHCPCD_PRINT_PIDFILE)
 			break;
-		set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
-		    &request, &require, &no, &reject);
+		if (set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
+		    &request, &require, &no, &reject) == -1)
+			return -1;
 		if (make_option_mask(d, dl, od, odl, request, arg, -1) != 0 ||
 		    make_option_mask(d, dl, od, odl, require, arg, -1) != 0 ||
 		    make_option_mask(d, dl, od, odl, no, arg, 1) != 0)
@@ -1090,8 +1144,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		ARG_REQUIRED;
 		if (ctx->options & DHCPCD_PRINT_PIDFILE)
 			break;
-		set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
-		    &request, &require, &no, &reject);
+		if (set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
+		    &request, &require, &no, &reject) == -1)
+			return -1;
 		if (make_option_mask(d, dl, od, odl, require, arg, 1) != 0 ||
 		    make_option_mask(d, dl, od, odl, request, arg, 1) != 0 ||
 		    make_option_mask(d, dl, od, odl, no, arg, -1) != 0 ||
@@ -1282,7 +1337,13 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 
 		/* Block everything */
 		memset(ifo->nomask, 0xff, sizeof(ifo->nomask));
-		memset(ifo->nomask6, 0xff, sizeof(ifo->nomask6));
+#ifdef DHCP6
+		if (if_optionmask6(&ifo->nomask6) == NULL) {
+			logerr(__func__);
+			return -1;
+		}
+		memset(ifo->nomask6, 0xff, OPTION_MASK6_LEN);
+#endif
 
 		/* Allow the bare minimum through */
 #ifdef INET
@@ -1310,6 +1371,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 	case O_RANDOMISE_HWADDR:
 		ifo->randomise_hwaddr = true;
 		break;
+	case O_ARP_OPTIMISTIC:
+		ifo->arp_optimistic = true;
+		break;
 #ifdef INET
 	case O_ARPING:
 		while (arg != NULL) {
@@ -1333,8 +1397,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		ARG_REQUIRED;
 		if (ctx->options & DHCPCD_PRINT_PIDFILE)
 			break;
-		set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
-		    &request, &require, &no, &reject);
+		if (set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
+		    &request, &require, &no, &reject) == -1)
+			return -1;
 		if (make_option_mask(d, dl, od, odl,
 		    ifo->dstmask, arg, 2) != 0)
 		{
@@ -1383,6 +1448,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 	case O_IPV6RA_NOAUTOCONF:
 		ifo->options &= ~DHCPCD_IPV6RA_AUTOCONF;
 		break;
+	case O_IPV6RA_MULTIPATH:
+		ifo->options |= DHCPCD_IPV6RA_MULTIPATH;
+		break;
 	case O_NOALIAS:
 		ifo->options |= DHCPCD_NOALIAS;
 		break;
@@ -1699,7 +1767,14 @@ err_sla:
 				return -1;
 			}
 			*fp++ = '\0';
-			u = (uint32_t)strtou(arg, NULL, 0, 0, UINT32_MAX, &e);
+			/* The option masks only cover codes sent on the wire. */
+			if (opt == O_DEFINE || opt == O_DEFINEND)
+				u = UINT8_MAX;
+			else if (opt == O_DEFINE6)
+				u = UINT16_MAX;
+			else
+				u = UINT32_MAX;
+			u = (uint32_t)strtou(arg, NULL, 0, 0, u, &e);
 			if (e) {
 				logerrx("invalid code: %s", arg);
 				return -1;
@@ -2124,6 +2199,7 @@ err_sla:
 			goto invalid_token;
 		}
 		parse_string((char *)token->key, token->key_len, arg);
+		dhcp_auth_setkey(token);
 		TAILQ_INSERT_TAIL(&ifo->auth.tokens, token, next);
 		break;
 
@@ -2264,12 +2340,169 @@ invalid_token:
 		}
 #endif
 		break;
+	case O_LINK_RCVBUF_MAX:
+#ifndef SMALL
+		ARG_REQUIRED;
+		ctx->link_rcvbuf_max =
+		    (int)strtoi(arg, NULL, 0, 0, INT32_MAX, &e);
+		if (e) {
+			logerrx("failed to convert link_rcvbuf_max %s", arg);
+			return -1;
+		}
+#endif
+		break;
+	case O_LEASE_WRITE_DELAY:
+		ARG_REQUIRED;
+		ctx->lease_write_delay =
+		    (unsigned int)strtou(arg, NULL, 0, 0, UINT_MAX, &e);
+		if (e) {
+			logerrx("failed to convert lease_write_delay %s", arg);
+			return -1;
+		}
+		break;
+	case O_LEASE_DATABASE:
+		ctx->lease_database = true;
+		break;
+	case O_START_RATE:
+		ARG_REQUIRED;
+		ctx->start_rate =
+		    (unsigned int)strtou(arg, NULL, 0, 0, UINT_MAX, &e);
+		if (e) {
+			logerrx("failed to convert start_rate %s", arg);
+			return -1;
+		}
+		break;
+	case O_START_JOBS:
+		ARG_REQUIRED;
+		ctx->start_jobs =
+		    (unsigned int)strtou(arg, NULL, 0, 0, UINT_MAX, &e);
+		if (e) {
+			logerrx("failed to convert start_jobs %s", arg);
+			return -1;
+		}
+		break;
+	case O_CONTROL_QUEUE:
+		ARG_REQUIRED;
+		ctx->control_queue_max =
+		    (size_t)strtou(arg, NULL, 0, 0, UINT_MAX, &e);
+		if (e) {
+			logerrx("failed to convert control_queue %s", arg);
+			return -1;
+		}
+		break;
+	case O_ROUTE_DELAY:
+		ARG_REQUIRED;
+		ctx->route_delay =
+		    (unsigned int)strtou(arg, NULL, 0, 0, UINT_MAX, &e);
+		if (e) {
+			logerrx("failed to convert route_delay %s", arg);
+			return -1;
+		}
+		break;
+	case O_SCRIPT_WORKER:
+		ifo->options |= DHCPCD_SCRIPT_WORKER;
+		break;
+	case O_SCRIPT_JOBS:
+		ARG_REQUIRED;
+		ctx->script_jobs_max =
+		    (unsigned int)strtou(arg, NULL, 0, 1, UINT_MAX, &e);
+		if (e) {
+			logerrx("failed to convert script_jobs %s", arg);
+			return -1;
+		}
+		break;
+	case O_BUILTIN_HOOKS:
+		ARG_REQUIRED;
+		fp = np = strdup(arg);
+		if (fp == NULL) {
+			logerr(__func__);
+			return -1;
+		}
+		while ((p = strsep(&np, ", ")) != NULL) {
+			if (*p == '\0')
+				continue;
+			if (hooks_find(p) == 0) {
+				logerrx("unknown builtin hook: %s", p);
+				free(fp);
+				return -1;
+			}
+			/* The script must not run them as well. */
+			dl = strlen("builtin_hooks=") + strlen(p) + 1;
+			bp = malloc(dl);
+			if (bp == NULL) {
+				logerr(__func__);
+				free(fp);
+				return -1;
+			}
+			snprintf(bp, dl, "builtin_hooks=%s", p);
+			add_environ(&ifo->environ, bp, 0);
+			snprintf(bp, dl, "skip_hooks=%s", p);
+			add_environ(&ifo->environ, bp, 0);
+			free(bp);
+		}
+		free(fp);
+		break;
 	case O_CONFIGURE:
 		ifo->options |= DHCPCD_CONFIGURE;
 		break;
 	case O_NOCONFIGURE:
 		ifo->options &= ~DHCPCD_CONFIGURE;
 		break;
+	case O_POLL:
+		ARG_REQUIRED;
+		for (dl = 0; (cp = eloop_backend_name(dl)) != NULL; dl++) {
+			if (strcmp(cp, arg) == 0)
+				break;
+		}
+		if (cp == NULL) {
+			logerrx("%s: unknown polling mechanism", arg);
+			return -1;
+		}
+		free(ctx->poll);
+		if ((ctx->poll = strdup(arg)) == NULL) {
+			logerr(__func__);
+			return -1;
+		}
+		break;
+	case O_BPF_POOL:
+		ARG_REQUIRED;
+		u = (uint32_t)strtou(arg, NULL, 0, 0, UINT16_MAX, &e);
+		if (e) {
+			logerrx("failed to convert bpf_pool %s", arg);
+			return -1;
+		}
+#if defined(PRIVSEP) && defined(INET)
+		ctx->ps_bpf_poolsize = (unsigned int)u;
+#endif
+		break;
+	case O_BPF_SHARED:
+#if defined(PRIVSEP) && defined(INET)
+		ctx->ps_bpf_shared = true;
+#endif
+		break;
+	case O_CBSTATS:
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("callback_stats is global only");
+			return -1;
+		}
+		ctx->cbstats = true;
+		break;
+	case O_LOGRATELIMIT:
+		ARG_REQUIRED;
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("logratelimit is global only");
+			return -1;
+		}
+		u = (unsigned long)strtou(arg, NULL, 0, 0, UINT_MAX, &e);
+		if (e) {
+			logerrx("failed to convert logratelimit %s", arg);
+			return -1;
+		}
+		if (logsetratelimit((unsigned int)u) == -1) {
+			logerr("%s: logratelimit", __func__);
+			return -1;
+		}
+		break;
 	default:
 		return 0;
 	}
@@ -2284,30 +2517,137 @@ arg_required:
 #endif
 }
 
+static int
+find_config_option(const char *opt)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(cf_options) / sizeof(cf_options[0]); i++) {
+		if (cf_options[i].name != NULL &&
+		    strcmp(cf_options[i].name, opt) == 0)
+			return (int)i;
+	}
+	return -1;
+}
+
+static int
+parse_config_option(struct dhcpcd_ctx *ctx, const char *ifname,
+    struct if_options *ifo, int idx, const char *opt, char *line,
+    struct dhcp_opt **ldop, struct dhcp_opt **edop)
+{
+
+	if (idx == -1) {
+		if (!(ctx->options & DHCPCD_PRINT_PIDFILE))
+			logerrx("unknown option: %s", opt);
+		return -1;
+	}
+
+	if (cf_options[idx].has_arg == required_argument && !line) {
+		logerrx("option requires an argument -- %s", opt);
+		return -1;
+	}
+
+	return parse_option(ctx, ifname, ifo, cf_options[idx].val, line,
+	    ldop, edop);
+}
+
+#ifdef EMBEDDED_CONFIG
 static int
 parse_config_line(struct dhcpcd_ctx *ctx, const char *ifname,
     struct if_options *ifo, const char *opt, char *line,
     struct dhcp_opt **ldop, struct dhcp_opt **edop)
 {
-	unsigned int i;
 
-	for (i = 0; i < sizeof(cf_options) / sizeof(cf_options[0]); i++) {
-		if (!cf_options[i].name ||
-		    strcmp(cf_options[i].name, opt) != 0)
-			continue;
+	return parse_config_option(ctx, ifname, ifo, find_config_option(opt),
+	    opt, line, ldop, edop);
+}
+#endif
 
-		if (cf_options[i].has_arg == required_argument && !line) {
-			logerrx("option requires an argument -- %s", opt);
-			return -1;
-		}
+void
+free_config_cache(struct dhcpcd_ctx *ctx)
+{
+	struct cf_cache *cc = ctx->cf_cache;
+
+	if (cc == NULL)
+		return;
+	free(cc->cc_buf);
+	free(cc->cc_lines);
+	free(cc);
+	ctx->cf_cache = NULL;
+}
+
+/*
+ * Split dhcpcd.conf into lines unless the cached copy is current.
+ * It is always read again for the global options as that happens
+ * on reload. buf is for reading into and must be UDPLEN_MAX.
+ */
+static struct cf_cache *
+config_cache(struct dhcpcd_ctx *ctx, bool reload, char *buf, time_t *mtime)
+{
+	struct cf_cache *cc = ctx->cf_cache;
+	struct cf_line *cl, *nl;
+	char *bp, *line, *option, *p;
+	ssize_t buflen;
+	size_t nlines = 0, maxlines = 0;
+
+	if (dhcp_filemtime(ctx, ctx->cffile, mtime) == -1)
+		*mtime = 0;
+	if (cc != NULL && !reload && *mtime != 0 && cc->cc_mtime == *mtime)
+		return cc;
 
-		return parse_option(ctx, ifname, ifo, cf_options[i].val, line,
-		    ldop, edop);
+	free_config_cache(ctx);
+	buflen = dhcp_readfile(ctx, ctx->cffile, buf, UDPLEN_MAX);
+	if (buflen == -1)
+		return NULL;
+	if (buflen == 0 || buf[buflen - 1] != '\0') {
+		if ((size_t)buflen < UDPLEN_MAX - 1)
+			buflen++;
+		buf[buflen - 1] = '\0';
 	}
 
-	if (!(ctx->options & DHCPCD_PRINT_PIDFILE))
-		logerrx("unknown option: %s", opt);
-	return -1;
+	if ((cc = calloc(1, sizeof(*cc))) == NULL)
+		return NULL;
+	cc->cc_mtime = *mtime;
+	cc->cc_buflen = (size_t)buflen;
+
+	bp = buf;
+	while ((line = get_line(&bp, &buflen)) != NULL) {
+		option = strsep(&line, " \t");
+		if (line)
+			line = strskipwhite(line);
+		/* Trim trailing whitespace */
+		if (line) {
+			p = line + strlen(line) - 1;
+			while (p != line &&
+			    (*p == ' ' || *p == '\t') &&
+			    *(p - 1) != '\\')
+				*p-- = '\0';
+		}
+
+		if (nlines == maxlines) {
+			maxlines = maxlines == 0 ? 32 : maxlines * 2;
+			nl = reallocarray(cc->cc_lines, maxlines, sizeof(*nl));
+			if (nl == NULL)
+				goto err;
+			cc->cc_lines = nl;
+		}
+		cl = &cc->cc_lines[nlines++];
+		cl->cl_opt = (size_t)(option - buf);
+		cl->cl_arg = line == NULL ? SIZE_MAX : (size_t)(line - buf);
+		cl->cl_idx = find_config_option(option);
+	}
+	cc->cc_nlines = nlines;
+
+	if ((cc->cc_buf = malloc(cc->cc_buflen)) == NULL)
+		goto err;
+	memcpy(cc->cc_buf, buf, cc->cc_buflen);
+	ctx->cf_cache = cc;
+	return cc;
+
+err:
+	free(cc->cc_lines);
+	free(cc);
+	return NULL;
 }
 
 static void
@@ -2338,6 +2678,12 @@ finish_config(struct if_options *ifo)
 	if (!(ifo->options & DHCPCD_IPV6RS))
 		ifo->options &=
 		    ~(DHCPCD_IPV6RA_AUTOCONF | DHCPCD_IPV6RA_REQRDNSS);
+
+	/* The overrides are final now. */
+	dhcp_optmap_build(&ifo->dhcp_override_map,
+	    ifo->dhcp_override, ifo->dhcp_override_len);
+	dhcp_optmap_build(&ifo->dhcp6_override_map,
+	    ifo->dhcp6_override, ifo->dhcp6_override_len);
 }
 
 struct if_options *
@@ -2376,16 +2722,24 @@ read_config(struct dhcpcd_ctx *ctx,
     const char *ifname, const char *ssid, const char *profile)
 {
 	struct if_options *ifo;
-	char buf[UDPLEN_MAX], *bp; /* 64k max config file size */
-	char *line, *option, *p;
-	ssize_t buflen;
+	char buf[UDPLEN_MAX]; /* 64k max config file size */
+	char *line, *option;
 	size_t vlen;
 	int skip, have_profile, new_block, had_block;
+#ifdef EMBEDDED_CONFIG
+	char *bp, *p;
+	ssize_t buflen;
 #if !defined(INET) || !defined(INET6)
 	size_t i;
 	struct dhcp_opt *opt;
+#endif
 #endif
 	struct dhcp_opt *ldop, *edop;
+	struct cf_cache *cc;
+	struct cf_line *cl;
+
+	/* Anything rendered from the old options is now stale. */
+	ctx->config_gen++;
 
 	/* Seed our default options */
 	if ((ifo = default_config(ctx)) == NULL)
@@ -2425,8 +2779,15 @@ read_config(struct dhcpcd_ctx *ctx,
 	/* Reset route order */
 	ctx->rt_order = 0;
 
+	/* So removing these and reloading turns them off. */
+	if (ifname == NULL) {
+		logsetratelimit(0);
+		ctx->cbstats = false;
+	}
+
 	/* Parse our embedded options file */
 	if (ifname == NULL && !(ctx->options & DHCPCD_PRINT_PIDFILE)) {
+#ifdef EMBEDDED_CONFIG
 		/* Space for initial estimates */
 #if defined(INET) && defined(INITDEFINES)
 		ifo->dhcp_override =
@@ -2455,26 +2816,16 @@ read_config(struct dhcpcd_ctx *ctx,
 #endif
 
 		/* Now load our embedded config */
-#ifdef EMBEDDED_CONFIG
 		buflen = dhcp_readfile(ctx, EMBEDDED_CONFIG, buf, sizeof(buf));
 		if (buflen == -1) {
 			logerr("%s: %s", __func__, EMBEDDED_CONFIG);
 			return ifo;
 		}
-		if (buf[buflen - 1] != '\0') {
+		if (buflen == 0 || buf[buflen - 1] != '\0') {
 			if ((size_t)buflen < sizeof(buf) - 1)
 				buflen++;
 			buf[buflen - 1] = '\0';
 		}
-#else
-		buflen = (ssize_t)strlcpy(buf, dhcpcd_embedded_conf,
-		    sizeof(buf));
-		if ((size_t)buflen >= sizeof(buf)) {
-			logerrx("%s: embedded config too big", __func__);
-			return ifo;
-		}
-		/* Our embedded config is NULL terminated */
-#endif
 		bp = buf;
 		while ((line = get_line(&bp, &buflen)) != NULL) {
 			option = strsep(&line, " \t");
@@ -2495,6 +2846,8 @@ read_config(struct dhcpcd_ctx *ctx,
 #ifdef INET
 		ctx->dhcp_opts = ifo->dhcp_override;
 		ctx->dhcp_opts_len = ifo->dhcp_override_len;
+		dhcp_optmap_build(&ctx->dhcp_optmap,
+		    ctx->dhcp_opts, ctx->dhcp_opts_len);
 #else
 		for (i = 0, opt = ifo->dhcp_override;
 		    i < ifo->dhcp_override_len;
@@ -2511,6 +2864,8 @@ read_config(struct dhcpcd_ctx *ctx,
 #ifdef DHCP6
 		ctx->dhcp6_opts = ifo->dhcp6_override;
 		ctx->dhcp6_opts_len = ifo->dhcp6_override_len;
+		dhcp_optmap_build(&ctx->dhcp6_optmap,
+		    ctx->dhcp6_opts, ctx->dhcp6_opts_len);
 #endif
 #else
 		for (i = 0, opt = ifo->nd_override;
@@ -2533,39 +2888,46 @@ read_config(struct dhcpcd_ctx *ctx,
 		ctx->vivso_len = ifo->vivso_override_len;
 		ifo->vivso_override = NULL;
 		ifo->vivso_override_len = 0;
+#else
+		/* Our embedded config is compiled into static tables
+		 * which must not be freed. */
+#ifdef INET
+		ctx->dhcp_opts = dhcpcd_embedded_dhcp;
+		ctx->dhcp_opts_len = dhcpcd_embedded_dhcp_len;
+		dhcp_optmap_build(&ctx->dhcp_optmap,
+		    ctx->dhcp_opts, ctx->dhcp_opts_len);
+#endif
+#ifdef INET6
+		ctx->nd_opts = dhcpcd_embedded_nd;
+		ctx->nd_opts_len = dhcpcd_embedded_nd_len;
+#ifdef DHCP6
+		ctx->dhcp6_opts = dhcpcd_embedded_dhcp6;
+		ctx->dhcp6_opts_len = dhcpcd_embedded_dhcp6_len;
+		dhcp_optmap_build(&ctx->dhcp6_optmap,
+		    ctx->dhcp6_opts, ctx->dhcp6_opts_len);
+#endif
+#endif
+		ctx->vivso = dhcpcd_embedded_vivso;
+		ctx->vivso_len = dhcpcd_embedded_vivso_len;
+#endif
 	}
 
 	/* Parse our options file */
-	buflen = dhcp_readfile(ctx, ctx->cffile, buf, sizeof(buf));
-	if (buflen == -1) {
+	if ((cc = config_cache(ctx, ifname == NULL, buf, &ifo->mtime)) == NULL)
+	{
 		/* dhcpcd can continue without it, but no DNS options
 		 * would be requested ... */
 		logerr("%s: %s", __func__, ctx->cffile);
 		return ifo;
 	}
-	if (buf[buflen - 1] != '\0') {
-		if ((size_t)buflen < sizeof(buf) - 1)
-			buflen++;
-		buf[buflen - 1] = '\0';
-	}
-	dhcp_filemtime(ctx, ctx->cffile, &ifo->mtime);
+	memcpy(buf, cc->cc_buf, cc->cc_buflen);
 
 	ldop = edop = NULL;
 	skip = have_profile = new_block = 0;
 	had_block = ifname == NULL ? 1 : 0;
-	bp = buf;
-	while ((line = get_line(&bp, &buflen)) != NULL) {
-		option = strsep(&line, " \t");
-		if (line)
-			line = strskipwhite(line);
-		/* Trim trailing whitespace */
-		if (line) {
-			p = line + strlen(line) - 1;
-			while (p != line &&
-			    (*p == ' ' || *p == '\t') &&
-			    *(p - 1) != '\\')
-				*p-- = '\0';
-		}
+	for (cl = cc->cc_lines; cl < cc->cc_lines + cc->cc_nlines; cl++) {
+		option = buf + cl->cl_opt;
+		line = cl->cl_arg == SIZE_MAX ? NULL : buf + cl->cl_arg;
 		if (skip == 0 && new_block) {
 			had_block = 1;
 			new_block = 0;
@@ -2631,7 +2993,8 @@ read_config(struct dhcpcd_ctx *ctx,
 		if (skip)
 			continue;
 
-		parse_config_line(ctx, ifname, ifo, option, line, &ldop, &edop);
+		parse_config_option(ctx, ifname, ifo, cl->cl_idx,
+		    option, line, &ldop, &edop);
 	}
 
 	if (profile && !have_profile) {
@@ -2684,10 +3047,6 @@ void
 free_options(struct dhcpcd_ctx *ctx, struct if_options *ifo)
 {
 	size_t i;
-#ifdef RT_FREE_ROUTE_TABLE
-	struct interface *ifp;
-	struct rt *rt;
-#endif
 	struct dhcp_opt *opt;
 	struct vivco *vo;
 #ifdef AUTH
@@ -2710,24 +3069,18 @@ free_options(struct dhcpcd_ctx *ctx, struct if_options *ifo)
 		free(ifo->config);
 	}
 
-#ifdef RT_FREE_ROUTE_TABLE
-	/* Stupidly, we don't know the interface when creating the options.
-	 * As such, make sure each route has one so they can goto the
-	 * free list. */
-	ifp = ctx->ifaces != NULL ? TAILQ_FIRST(ctx->ifaces) : NULL;
-	if (ifp != NULL) {
-		RB_TREE_FOREACH(rt, &ifo->routes) {
-			if (rt->rt_ifp == NULL)
-				rt->rt_ifp = ifp;
-		}
-	}
-#endif
 	rt_headclear0(ctx, &ifo->routes, AF_UNSPEC);
 
 	free(ifo->arping);
 	free(ifo->blacklist);
 	free(ifo->fallback);
+	free(ifo->requestmask6);
+	free(ifo->requiremask6);
+	free(ifo->nomask6);
+	free(ifo->rejectmask6);
 
+	dhcp_optmap_free(&ifo->dhcp_override_map);
+	dhcp_optmap_free(&ifo->dhcp6_override_map);
 	for (opt = ifo->dhcp_override;
 	    ifo->dhcp_override_len > 0;
 	    opt++, ifo->dhcp_override_len--)
@@ -2771,3 +3124,89 @@ free_options(struct dhcpcd_ctx *ctx, struct if_options *ifo)
 #endif
 	free(ifo);
 }
+
+uint8_t *
+if_optionmask6(uint8_t **mask)
+{
+
+	if (*mask == NULL)
+		*mask = calloc(1, OPTION_MASK6_LEN);
+	return *mask;
+}
+
+static size_t
+if_options_optsize(const struct dhcp_opt *opts, size_t len)
+{
+	const struct dhcp_opt *opt;
+	size_t size = len * sizeof(*opts);
+
+	for (opt = opts; len > 0; opt++, len--) {
+		if (opt->var != NULL)
+			size += strlen(opt->var) + 1;
+		size += if_options_optsize(opt->embopts, opt->embopts_len);
+		size += if_options_optsize(opt->encopts, opt->encopts_len);
+	}
+	return size;
+}
+
+/* What ifo holds on the heap, not counting allocator overhead. */
+size_t
+if_options_memsize(struct if_options *ifo)
+{
+	size_t size = sizeof(*ifo), i;
+	char **sp;
+	struct rt *rt;
+#ifdef AUTH
+	const struct token *token;
+#endif
+
+	if (ifo->requestmask6 != NULL)
+		size += OPTION_MASK6_LEN;
+	if (ifo->requiremask6 != NULL)
+		size += OPTION_MASK6_LEN;
+	if (ifo->nomask6 != NULL)
+		size += OPTION_MASK6_LEN;
+	if (ifo->rejectmask6 != NULL)
+		size += OPTION_MASK6_LEN;
+
+	for (sp = ifo->config; sp != NULL && *sp != NULL; sp++)
+		size += sizeof(*sp) + strlen(*sp) + 1;
+	for (sp = ifo->environ; sp != NULL && *sp != NULL; sp++)
+		size += sizeof(*sp) + strlen(*sp) + 1;
+	RB_TREE_FOREACH(rt, &ifo->routes) {
+		size += sizeof(*rt);
+	}
+
+	size += ifo->blacklist_len * sizeof(*ifo->blacklist);
+	size += ifo->whitelist_len * sizeof(*ifo->whitelist);
+	if (ifo->arping_len > 0)
+		size += (size_t)ifo->arping_len * sizeof(*ifo->arping);
+	if (ifo->fallback != NULL)
+		size += strlen(ifo->fallback) + 1;
+	size += ifo->ia_len * sizeof(*ifo->ia);
+#if defined(INET6) && !defined(SMALL)
+	for (i = 0; i < ifo->ia_len; i++)
+		size += ifo->ia[i].sla_len * sizeof(*ifo->ia[i].sla);
+#endif
+
+	size += if_options_optsize(ifo->dhcp_override,
+	    ifo->dhcp_override_len);
+	size += if_options_optsize(ifo->nd_override, ifo->nd_override_len);
+	size += if_options_optsize(ifo->dhcp6_override,
+	    ifo->dhcp6_override_len);
+	size += if_options_optsize(ifo->vivso_override,
+	    ifo->vivso_override_len);
+	size += ifo->dhcp_override_map.om_len *
+	    sizeof(*ifo->dhcp_override_map.om_opts);
+	size += ifo->dhcp6_override_map.om_len *
+	    sizeof(*ifo->dhcp6_override_map.om_opts);
+	for (i = 0; i < ifo->vivco_len; i++)
+		size += sizeof(*ifo->vivco) + ifo->vivco[i].len;
+
+#ifdef AUTH
+	TAILQ_FOREACH(token, &ifo->auth.tokens, next) {
+		size += sizeof(*token) + token->realm_len + token->key_len;
+	}
+#endif
+	return size;
+}
@@ -58,6 +58,7 @@
 #define USERCLASS_MAX_LEN	255
 #define VENDOR_MAX_LEN		255
 #define	MUDURL_MAX_LEN		255
+#define OPTION_MASK6_LEN	((UINT16_MAX + 1) / NBBY)
 
 #define DHCPCD_ARP			(1ULL << 0)
 #define DHCPCD_RELEASE			(1ULL << 1)
@@ -65,12 +66,14 @@
 #define DHCPCD_GATEWAY			(1ULL << 3)
 #define DHCPCD_STATIC			(1ULL << 4)
 #define DHCPCD_DEBUG			(1ULL << 5)
+#define DHCPCD_IPV6RA_MULTIPATH		(1ULL << 6)
 #define DHCPCD_LASTLEASE		(1ULL << 7)
 #define DHCPCD_INFORM			(1ULL << 8)
 #define DHCPCD_REQUEST			(1ULL << 9)
 #define DHCPCD_IPV4LL			(1ULL << 10)
 #define DHCPCD_DUID			(1ULL << 11)
 #define DHCPCD_PERSISTENT		(1ULL << 12)
+#define DHCPCD_SCRIPT_WORKER		(1ULL << 13)
 #define DHCPCD_DAEMONISE		(1ULL << 14)
 #define DHCPCD_DAEMONISED		(1ULL << 15)
 #define DHCPCD_TEST			(1ULL << 16)
@@ -183,6 +186,27 @@
 #define O_CONFIGURE		O_BASE + 50
 #define O_NOCONFIGURE		O_BASE + 51
 #define O_RANDOMISE_HWADDR	O_BASE + 52
+#define O_POLL			O_BASE + 53
+#define O_DUMPSTATS		O_BASE + 54
+#define O_BPF_POOL		O_BASE + 55
+#define O_BPF_SHARED		O_BASE + 56
+#define O_LINK_RCVBUF_MAX	O_BASE + 57
+#define O_LEASE_WRITE_DELAY	O_BASE + 58
+#define O_LEASE_DATABASE	O_BASE + 59
+#define O_START_RATE		O_BASE + 60
+#define O_ROUTE_DELAY		O_BASE + 61
+#define O_IPV6RA_MULTIPATH	O_BASE + 62
+#define O_SCRIPT_WORKER		O_BASE + 63
+#define O_SCRIPT_JOBS		O_BASE + 64
+#define O_BUILTIN_HOOKS		O_BASE + 65
+#define O_DUMPSTATE		O_BASE + 66
+#define O_LOGRATELIMIT		O_BASE + 67
+#define O_ARP_OPTIMISTIC	O_BASE + 68
+#define O_START_JOBS		O_BASE + 69
+#define O_DUMPMEM		O_BASE + 70
+#define O_RESTART		O_BASE + 71
+#define O_CBSTATS		O_BASE + 72
+#define O_CONTROL_QUEUE		O_BASE + 73
 
 extern const struct option cf_options[];
 
@@ -194,6 +218,12 @@ struct if_sla {
 	bool sla_set;
 };
 
+/* Option code to definition, see dhcp_optmap_build */
+struct dhcp_optmap {
+	struct dhcp_opt **om_opts;
+	size_t om_len;			/* highest code + 1 */
+};
+
 struct if_ia {
 	uint8_t iaid[4];
 #ifdef INET6
@@ -223,19 +253,23 @@ struct if_options {
 	uint8_t nomask[256 / NBBY];
 	uint8_t rejectmask[256 / NBBY];
 	uint8_t dstmask[256 / NBBY];
-	uint8_t requestmasknd[(UINT16_MAX + 1) / NBBY];
-	uint8_t requiremasknd[(UINT16_MAX + 1) / NBBY];
-	uint8_t nomasknd[(UINT16_MAX + 1) / NBBY];
-	uint8_t rejectmasknd[(UINT16_MAX + 1) / NBBY];
-	uint8_t requestmask6[(UINT16_MAX + 1) / NBBY];
-	uint8_t requiremask6[(UINT16_MAX + 1) / NBBY];
-	uint8_t nomask6[(UINT16_MAX + 1) / NBBY];
-	uint8_t rejectmask6[(UINT16_MAX + 1) / NBBY];
+	/* ND option types are a single octet. */
+	uint8_t requestmasknd[256 / NBBY];
+	uint8_t requiremasknd[256 / NBBY];
+	uint8_t nomasknd[256 / NBBY];
+	uint8_t rejectmasknd[256 / NBBY];
+	/* DHCPv6 option codes are 16 bits, so these are only allocated
+	 * by if_optionmask6 when needed and NULL is an empty mask. */
+	uint8_t *requestmask6;
+	uint8_t *requiremask6;
+	uint8_t *nomask6;
+	uint8_t *rejectmask6;
 	uint32_t leasetime;
 	uint32_t timeout;
 	uint32_t reboot;
 	unsigned long long options;
 	bool randomise_hwaddr;
+	bool arp_optimistic;
 
 	struct in_addr req_addr;
 	struct in_addr req_mask;
@@ -269,10 +303,12 @@ struct if_options {
 
 	struct dhcp_opt *dhcp_override;
 	size_t dhcp_override_len;
+	struct dhcp_optmap dhcp_override_map;
 	struct dhcp_opt *nd_override;
 	size_t nd_override_len;
 	struct dhcp_opt *dhcp6_override;
 	size_t dhcp6_override_len;
+	struct dhcp_optmap dhcp6_override_map;
 	uint32_t vivco_en;
 	struct vivco *vivco;
 	size_t vivco_len;
@@ -289,5 +325,8 @@ int add_options(struct dhcpcd_ctx *, const char *,
     struct if_options *, int, char **);
 void free_dhcp_opt_embenc(struct dhcp_opt *);
 void free_options(struct dhcpcd_ctx *, struct if_options *);
+uint8_t *if_optionmask6(uint8_t **);
+size_t if_options_memsize(struct if_options *);
+void free_config_cache(struct dhcpcd_ctx *);
 
 #endif
@@ -812,6 +812,7 @@ if_finishrt(struct dhcpcd_ctx *ctx, struct rt *rt)
 	if (rt->rt_mtu == (unsigned int)mtu)
 		rt->rt_mtu = 0;
 
+	rt_setkey(rt);
 	return 0;
 }
 
@@ -1106,6 +1107,9 @@ if_handlelink(struct dhcpcd_ctx *ctx)
 		return -1;
 	if (len == 0)
 		return 0;
+#ifndef SMALL
+	ctx->link_msgs++;
+#endif
 	if ((size_t)len < sizeof(rtm.hdr.rtm_msglen) ||
 	    len != rtm.hdr.rtm_msglen)
 	{
@@ -1609,6 +1613,15 @@ if_initrt(struct dhcpcd_ctx *ctx, rb_tree_t *routes, int af)
 	return 0;
 }
 
+/* dhcpcd_linkoverflow will learn everything again. */
+int
+if_resync(__unused struct dhcpcd_ctx *ctx)
+{
+
+	errno = ENOTSUP;
+	return -1;
+}
+
 
 #ifdef INET
 /* XXX We should fix this to write via the BPF interface. */
@@ -1752,6 +1765,12 @@ if_setup_inet6(__unused const struct interface *ifp)
 
 }
 
+void
+if_restore_inet6(__unused const struct interface *ifp)
+{
+
+}
+
 int
 ip6_forwarding(__unused const char *ifname)
 {
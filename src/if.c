@@ -76,14 +76,270 @@
 #include "ipv4ll.h"
 #include "ipv6nd.h"
 #include "logerr.h"
+#include "pace.h"
 #include "privsep.h"
 
+/*
+ * ctx->ifaces is also kept in trees by name and by index as every
+ * kernel message and received packet has to find its interface.
+ * Only the first interface in the list with a name or index is
+ * in the tree, as that is the one walking the list would find.
+ */
+static int
+if_cmpname(__unused void *context, const void *node, const void *key)
+{
+	const struct interface *ifp = node;
+
+	return strcmp(ifp->name, key);
+}
+
+static int
+if_cmpnamenode(void *context, const void *node1, const void *node2)
+{
+	const struct interface *ifp2 = node2;
+
+	return if_cmpname(context, node1, ifp2->name);
+}
+
+static const rb_tree_ops_t if_name_ops = {
+	.rbto_compare_nodes = if_cmpnamenode,
+	.rbto_compare_key = if_cmpname,
+	.rbto_node_offset = offsetof(struct interface, name_tree),
+	.rbto_context = NULL
+};
+
+static int
+if_cmpindex(__unused void *context, const void *node, const void *key)
+{
+	const struct interface *ifp = node;
+	const unsigned int *idx = key;
+
+	if (ifp->index < *idx)
+		return -1;
+	if (ifp->index > *idx)
+		return 1;
+	return 0;
+}
+
+static int
+if_cmpindexnode(void *context, const void *node1, const void *node2)
+{
+	const struct interface *ifp2 = node2;
+
+	return if_cmpindex(context, node1, &ifp2->index);
+}
+
+static const rb_tree_ops_t if_index_ops = {
+	.rbto_compare_nodes = if_cmpindexnode,
+	.rbto_compare_key = if_cmpindex,
+	.rbto_node_offset = offsetof(struct interface, index_tree),
+	.rbto_context = NULL
+};
+
+/*
+ * IAIDs by type and value, the DHCP IAID having a type of 0.
+ * Interfaces can share an IAID so the interface is part of the key.
+ */
+struct if_iaid {
+	rb_node_t tree;
+	struct interface *ifp;	/* NULL if a duplicate and not in the tree */
+	uint16_t ia_type;
+	uint8_t iaid[4];
+};
+
+static int
+if_cmpiaid(__unused void *context, const void *node1, const void *node2)
+{
+	const struct if_iaid *ia1 = node1, *ia2 = node2;
+	int c;
+
+	if (ia1->ia_type != ia2->ia_type)
+		return ia1->ia_type < ia2->ia_type ? -1 : 1;
+	c = memcmp(ia1->iaid, ia2->iaid, sizeof(ia1->iaid));
+	if (c != 0)
+		return c;
+	if (ia1->ifp == ia2->ifp)
+		return 0;
+	return (uintptr_t)ia1->ifp < (uintptr_t)ia2->ifp ? -1 : 1;
+}
+
+static const rb_tree_ops_t if_iaid_ops = {
+	.rbto_compare_nodes = if_cmpiaid,
+	.rbto_compare_key = if_cmpiaid,
+	.rbto_node_offset = offsetof(struct if_iaid, tree),
+	.rbto_context = NULL
+};
+
+void
+if_initifaces(struct dhcpcd_ctx *ctx)
+{
+
+	rb_tree_init(&ctx->if_names, &if_name_ops);
+	rb_tree_init(&ctx->if_indexes, &if_index_ops);
+	rb_tree_init(&ctx->if_iaids, &if_iaid_ops);
+}
+
+static void
+if_addtrees(struct interface *ifp)
+{
+
+	rb_tree_insert_node(&ifp->ctx->if_names, ifp);
+	rb_tree_insert_node(&ifp->ctx->if_indexes, ifp);
+}
+
+/* Indexes ctx->ifaces after it has been set from if_discover. */
+void
+if_indexifaces(struct dhcpcd_ctx *ctx)
+{
+	struct interface *ifp;
+
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		if_addtrees(ifp);
+	}
+	ctx->ifaces_gen++;
+}
+
+void
+if_insert(struct interface *ifp)
+{
+
+	TAILQ_INSERT_TAIL(ifp->ctx->ifaces, ifp, next);
+	if_addtrees(ifp);
+	ifp->ctx->ifaces_gen++;
+}
+
+void
+if_remove(struct interface *ifp)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct interface *ifn;
+	bool byname = false, byindex = false;
+
+	TAILQ_REMOVE(ctx->ifaces, ifp, next);
+	ctx->ifaces_gen++;
+	if (rb_tree_find_node(&ctx->if_names, ifp->name) == ifp) {
+		rb_tree_remove_node(&ctx->if_names, ifp);
+		byname = true;
+	}
+	if (rb_tree_find_node(&ctx->if_indexes, &ifp->index) == ifp) {
+		rb_tree_remove_node(&ctx->if_indexes, ifp);
+		byindex = true;
+	}
+	if (!byname && !byindex)
+		return;
+
+	/* Index the next interface with the same name or index. */
+	TAILQ_FOREACH(ifn, ctx->ifaces, next) {
+		if (byname && strcmp(ifn->name, ifp->name) == 0) {
+			rb_tree_insert_node(&ctx->if_names, ifn);
+			byname = false;
+		}
+		if (byindex && ifn->index == ifp->index) {
+			rb_tree_insert_node(&ctx->if_indexes, ifn);
+			byindex = false;
+		}
+		if (!byname && !byindex)
+			break;
+	}
+}
+
+static void
+if_addiaid(struct interface *ifp, struct if_iaid *ia, uint16_t ia_type,
+    const uint8_t *iaid)
+{
+
+	ia->ifp = ifp;
+	ia->ia_type = ia_type;
+	memcpy(ia->iaid, iaid, sizeof(ia->iaid));
+	/* The same IA can be configured twice. */
+	if (rb_tree_insert_node(&ifp->ctx->if_iaids, ia) != ia)
+		ia->ifp = NULL;
+}
+
+/* Indexes the IAIDs configure_interface1 worked out. */
+int
+if_setiaids(struct interface *ifp)
+{
+	struct if_options *ifo = ifp->options;
+	struct if_iaid *ia;
+	size_t n;
+#ifdef INET6
+	size_t i;
+#endif
+
+	if_freeiaids(ifp);
+	if (ifo == NULL || ifo->options & DHCPCD_ANONYMOUS)
+		return 0;
+
+	n = 1;
+#ifdef INET6
+	n += ifo->ia_len;
+#endif
+	ia = malloc(sizeof(*ia) * n);
+	if (ia == NULL)
+		return -1;
+	ifp->iaids = ia;
+	ifp->iaids_len = n;
+
+	if_addiaid(ifp, ia, 0, ifo->iaid);
+#ifdef INET6
+	for (i = 0; i < ifo->ia_len; i++)
+		if_addiaid(ifp, ++ia, ifo->ia[i].ia_type, ifo->ia[i].iaid);
+#endif
+	return 0;
+}
+
+void
+if_freeiaids(struct interface *ifp)
+{
+	size_t i;
+
+	for (i = 0; i < ifp->iaids_len; i++) {
+		if (ifp->iaids[i].ifp != NULL)
+			rb_tree_remove_node(&ifp->ctx->if_iaids,
+			    &ifp->iaids[i]);
+	}
+	free(ifp->iaids);
+	ifp->iaids = NULL;
+	ifp->iaids_len = 0;
+}
+
+/* Returns another active interface using the IAID. */
+struct interface *
+if_findiaid(struct interface *ifp, uint16_t ia_type, const uint8_t *iaid)
+{
+	rb_tree_t *tree = &ifp->ctx->if_iaids;
+	struct if_iaid key = { .ifp = NULL, .ia_type = ia_type }, *ia;
+
+	memcpy(key.iaid, iaid, sizeof(key.iaid));
+	for (ia = rb_tree_find_node_geq(tree, &key);
+	    ia != NULL;
+	    ia = rb_tree_iterate(tree, ia, RB_DIR_RIGHT))
+	{
+		if (ia->ia_type != ia_type ||
+		    memcmp(ia->iaid, iaid, sizeof(ia->iaid)) != 0)
+			break;
+		if (ia->ifp != ifp && ia->ifp->active)
+			return ia->ifp;
+	}
+	return NULL;
+}
+
+size_t
+if_iaids_memsize(const struct interface *ifp)
+{
+
+	return sizeof(*ifp->iaids) * ifp->iaids_len;
+}
+
 void
 if_free(struct interface *ifp)
 {
 
 	if (ifp == NULL)
 		return;
+	if_freeiaids(ifp);
+	pace_delete(ifp, NULL);
 #ifdef IPV4LL
 	ipv4ll_free(ifp);
 #endif
@@ -270,6 +526,48 @@ if_markaddrsstale(struct if_head *ifs)
 	}
 }
 
+void
+if_freeifaddrs(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs)
+{
+#ifdef __linux__
+	struct ifaddrs *ifa;
+
+	UNUSED(ctx);
+	/* Each link from if_getlinks is its own allocation. */
+	while ((ifa = *ifaddrs) != NULL) {
+		*ifaddrs = ifa->ifa_next;
+		free(ifa);
+	}
+#else
+	if (*ifaddrs == NULL)
+		return;
+#ifdef PRIVSEP_GETIFADDRS
+	if (IN_PRIVSEP(ctx))
+		free(*ifaddrs);
+	else
+#endif
+		freeifaddrs(*ifaddrs);
+	*ifaddrs = NULL;
+#endif
+}
+
+#ifdef __linux__
+void
+if_learnaddrs(struct dhcpcd_ctx *ctx, __unused struct if_head *ifs,
+    struct ifaddrs **ifaddrs)
+{
+
+	/*
+	 * Only links are in the list, so ask for the addresses on
+	 * the links if_discover found.
+	 */
+	if (*ifaddrs == NULL)
+		return;
+	if (if_getaddrs(ctx, *ifaddrs) == -1)
+		logerr("%s: if_getaddrs", __func__);
+	if_freeifaddrs(ctx, ifaddrs);
+}
+#else
 void
 if_learnaddrs(struct dhcpcd_ctx *ctx, struct if_head *ifs,
     struct ifaddrs **ifaddrs)
@@ -357,14 +655,9 @@ if_learnaddrs(struct dhcpcd_ctx *ctx, struct if_head *ifs,
 		}
 	}
 
-#ifdef PRIVSEP_GETIFADDRS
-	if (IN_PRIVSEP(ctx))
-		free(*ifaddrs);
-	else
-#endif
-		freeifaddrs(*ifaddrs);
-	*ifaddrs = NULL;
+	if_freeifaddrs(ctx, ifaddrs);
 }
+#endif
 
 void
 if_deletestaleaddrs(struct if_head *ifs)
@@ -466,6 +759,13 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 	}
 	TAILQ_INIT(ifs);
 
+#ifdef __linux__
+	if (if_getlinks(ctx, ifaddrs, argc < 0 ? -argc : 0, argv) == -1) {
+		logerr("if_getlinks");
+		free(ifs);
+		return NULL;
+	}
+#else
 #ifdef PRIVSEP_GETIFADDRS
 	if (ctx->options & DHCPCD_PRIVSEP) {
 		if (ps_root_getifaddrs(ctx, ifaddrs) == -1) {
@@ -480,6 +780,7 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 		free(ifs);
 		return NULL;
 	}
+#endif
 
 	for (ifa = *ifaddrs; ifa; ifa = ifa->ifa_next) {
 		if (ifa->ifa_addr != NULL) {
@@ -510,10 +811,14 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 			}
 			active = (i == argc) ? IF_INACTIVE : IF_ACTIVE_USER;
 		} else {
-			/* -1 means we're discovering against a specific
-			 * interface, but we still need the below rules
+			/* -n means we're discovering against n specific
+			 * interfaces, but we still need the below rules
 			 * to apply. */
-			if (argc == -1 && strcmp(argv[0], spec.devname) != 0)
+			for (i = 0; i < -argc; i++) {
+				if (strcmp(argv[i], spec.devname) == 0)
+					break;
+			}
+			if (argc < 0 && i == -argc)
 				continue;
 			active = ctx->options & DHCPCD_INACTIVE ?
 			    IF_INACTIVE: IF_ACTIVE_USER;
@@ -552,7 +857,7 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 			continue;
 		}
 
-		if_noconf = ((argc == 0 || argc == -1) && ctx->ifac == 0 &&
+		if_noconf = (argc <= 0 && ctx->ifac == 0 &&
 		    !if_hasconf(ctx, spec.devname));
 
 		/* Don't allow some reserved interface names unless explicit. */
@@ -659,24 +964,6 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 			active = if_check_arphrd(ifp, active, if_noconf);
 #endif
 		}
-#ifdef __linux__
-		else {
-			struct ifreq ifr = { .ifr_flags = 0 };
-
-			/* This is a huge bug in getifaddrs(3) as there
-			 * is no reason why this can't be returned in
-			 * ifa_addr. */
-			strlcpy(ifr.ifr_name, ifa->ifa_name,
-			    sizeof(ifr.ifr_name));
-			if (ioctl(ctx->pf_inet_fd, SIOCGIFHWADDR, &ifr) == -1)
-				logerr("%s: SIOCGIFHWADDR", ifa->ifa_name);
-			ifp->hwtype = ifr.ifr_hwaddr.sa_family;
-			if (ioctl(ctx->pf_inet_fd, SIOCGIFINDEX, &ifr) == -1)
-				logerr("%s: SIOCGIFINDEX", ifa->ifa_name);
-			ifp->index = (unsigned int)ifr.ifr_ifindex;
-			if_check_arphrd(ifp, active, if_noconf);
-		}
-#endif
 
 		if (!(ctx->options & (DHCPCD_DUMPLEASE | DHCPCD_TEST))) {
 			/* Handle any platform init for the interface */
@@ -796,21 +1083,37 @@ if_nametospec(const char *ifname, struct if_spec *spec)
 static struct interface *
 if_findindexname(struct if_head *ifaces, unsigned int idx, const char *name)
 {
+	struct interface *ifp;
+	struct if_spec spec;
 
-	if (ifaces != NULL) {
-		struct if_spec spec;
-		struct interface *ifp;
+	if (ifaces == NULL || (ifp = TAILQ_FIRST(ifaces)) == NULL)
+		goto notfound;
 
-		if (name && if_nametospec(name, &spec) == -1)
+	/* Only an alias needs parsing to find the interface name. */
+	if (name != NULL && strchr(name, ':') != NULL) {
+		if (if_nametospec(name, &spec) == -1)
 			return NULL;
+		name = spec.devname;
+	}
 
-		TAILQ_FOREACH(ifp, ifaces, next) {
-			if ((name && strcmp(ifp->name, spec.devname) == 0) ||
-			    (!name && ifp->index == idx))
-				return ifp;
-		}
+	/* Lists from if_discover are not indexed. */
+	if (ifaces == ifp->ctx->ifaces) {
+		if (name != NULL)
+			ifp = rb_tree_find_node(&ifp->ctx->if_names, name);
+		else
+			ifp = rb_tree_find_node(&ifp->ctx->if_indexes, &idx);
+		if (ifp != NULL)
+			return ifp;
+		goto notfound;
+	}
+
+	TAILQ_FOREACH(ifp, ifaces, next) {
+		if ((name && strcmp(ifp->name, name) == 0) ||
+		    (!name && ifp->index == idx))
+			return ifp;
 	}
 
+notfound:
 	errno = ENXIO;
 	return NULL;
 }
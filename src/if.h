@@ -144,7 +144,16 @@ struct if_head *if_discover(struct dhcpcd_ctx *, struct ifaddrs **,
     int, char * const *);
 void if_markaddrsstale(struct if_head *);
 void if_learnaddrs(struct dhcpcd_ctx *, struct if_head *, struct ifaddrs **);
+void if_freeifaddrs(struct dhcpcd_ctx *, struct ifaddrs **);
 void if_deletestaleaddrs(struct if_head *);
+void if_initifaces(struct dhcpcd_ctx *);
+void if_indexifaces(struct dhcpcd_ctx *);
+void if_insert(struct interface *);
+void if_remove(struct interface *);
+int if_setiaids(struct interface *);
+void if_freeiaids(struct interface *);
+struct interface *if_findiaid(struct interface *, uint16_t, const uint8_t *);
+size_t if_iaids_memsize(const struct interface *);
 struct interface *if_find(struct if_head *, const char *);
 struct interface *if_findindex(struct if_head *, unsigned int);
 struct interface *if_loopback(struct dhcpcd_ctx *);
@@ -224,6 +233,7 @@ int xsocketpair(int, int, int, int[2]);
 
 int if_route(unsigned char, const struct rt *rt);
 int if_initrt(struct dhcpcd_ctx *, rb_tree_t *, int);
+int if_resync(struct dhcpcd_ctx *);
 
 int if_missfilter(struct interface *, struct sockaddr *);
 int if_missfilter_apply(struct dhcpcd_ctx *);
@@ -238,6 +248,7 @@ int if_addrflags(const struct interface *, const struct in_addr *,
 #ifdef INET6
 void if_disable_rtadv(void);
 void if_setup_inet6(const struct interface *);
+void if_restore_inet6(const struct interface *);
 int ip6_forwarding(const char *ifname);
 
 struct ra;
@@ -261,5 +272,7 @@ struct interface *if_findifpfromcmsg(struct dhcpcd_ctx *,
 int if_linksocket(struct sockaddr_nl *, int, int);
 int if_getnetlink(struct dhcpcd_ctx *, struct iovec *, int, int,
     int (*)(struct dhcpcd_ctx *, void *, struct nlmsghdr *), void *);
+int if_getlinks(struct dhcpcd_ctx *, struct ifaddrs **, int, char * const *);
+int if_getaddrs(struct dhcpcd_ctx *, const struct ifaddrs *);
 #endif
 #endif
@@ -778,7 +778,7 @@ ipv4_applyaddr(void *arg)
 		{
 			if (state->added) {
 				delete_address(ifp);
-				rt_build(ifp->ctx, AF_INET);
+				rt_schedule(ifp->ctx, AF_INET);
 #ifdef ARP
 				/* Announce the preferred address to
 				 * kick ARP caches. */
@@ -841,7 +841,7 @@ ipv4_applyaddr(void *arg)
 	state->addr = ia;
 	state->added = STATE_ADDED;
 
-	rt_build(ifp->ctx, AF_INET);
+	rt_schedule(ifp->ctx, AF_INET);
 
 #ifdef ARP
 	arp_announceaddr(ifp->ctx, &state->addr->addr);
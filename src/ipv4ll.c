@@ -57,6 +57,105 @@ static const struct in_addr inaddr_llbcast = {
 	.s_addr = HTONL(LINKLOCAL_BCAST)
 };
 
+/*
+ * The last address that worked and the addresses which conflicted
+ * are remembered so a restart can try the good one first
+ * and not probe the bad ones again.
+ * A bloom filter is enough as a false positive just skips an address.
+ */
+#define	IPV4LL_BLOOM_HASHES	3
+
+static unsigned int
+ipv4ll_bloomhash(const struct in_addr *addr, unsigned int n)
+{
+	uint32_t h;
+
+	h = ntohl(addr->s_addr) * 0x9e3779b1U + n * 0x85ebca6bU;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6dU;
+	h ^= h >> 12;
+	return h % (IPV4LL_BLOOM_LEN * NBBY);
+}
+
+static bool
+ipv4ll_conflicted(const struct ipv4ll_state *state,
+    const struct in_addr *addr)
+{
+	unsigned int n, bit;
+
+	for (n = 0; n < IPV4LL_BLOOM_HASHES; n++) {
+		bit = ipv4ll_bloomhash(addr, n);
+		if (!(state->history.bloom[bit / NBBY] & (1U << (bit % NBBY))))
+			return false;
+	}
+	return true;
+}
+
+static void
+ipv4ll_loadhistory(struct interface *ifp)
+{
+	struct ipv4ll_state *state = IPV4LL_STATE(ifp);
+	char ssid[DHCP_SSIDFILE_LEN];
+	char file[sizeof(state->historyfile)];
+	/* One more byte so readfile can tell a longer file is wrong. */
+	uint8_t buf[sizeof(state->history) + 1];
+	ssize_t bytes;
+
+	dhcp_set_ssidfile(ssid, sizeof(ssid), ifp);
+	snprintf(file, sizeof(file), IPV4LLFILE, ifp->name, ssid);
+	if (strcmp(file, state->historyfile) == 0)
+		return;
+	strlcpy(state->historyfile, file, sizeof(state->historyfile));
+
+	bytes = dhcp_readfile(ifp->ctx, state->historyfile, buf, sizeof(buf));
+	if (bytes == sizeof(state->history))
+		memcpy(&state->history, buf, sizeof(state->history));
+	else {
+		if (bytes == -1 && errno != ENOENT)
+			logerr("%s: %s", __func__, state->historyfile);
+		memset(&state->history, 0, sizeof(state->history));
+	}
+	if (!IN_LINKLOCAL(ntohl(state->history.addr.s_addr)))
+		state->history.addr.s_addr = INADDR_ANY;
+}
+
+static void
+ipv4ll_savehistory(struct interface *ifp)
+{
+	struct ipv4ll_state *state = IPV4LL_STATE(ifp);
+
+	if (ifp->ctx->options & DHCPCD_TEST || state->historyfile[0] == '\0')
+		return;
+	if (dhcp_writefile(ifp->ctx, state->historyfile, 0640,
+	    &state->history, sizeof(state->history)) == -1)
+		logerr("%s: %s", __func__, state->historyfile);
+}
+
+static void
+ipv4ll_addconflict(struct interface *ifp, const struct in_addr *addr)
+{
+	struct ipv4ll_state *state = IPV4LL_STATE(ifp);
+	unsigned int n, bit, set;
+	uint8_t b;
+
+	/* Once half full it skips too many good addresses, so start again. */
+	set = 0;
+	for (n = 0; n < sizeof(state->history.bloom); n++) {
+		for (b = state->history.bloom[n]; b != 0; b &= (uint8_t)(b - 1))
+			set++;
+	}
+	if (set > IPV4LL_BLOOM_LEN * NBBY / 2)
+		memset(state->history.bloom, 0, sizeof(state->history.bloom));
+
+	for (n = 0; n < IPV4LL_BLOOM_HASHES; n++) {
+		bit = ipv4ll_bloomhash(addr, n);
+		state->history.bloom[bit / NBBY] |= (uint8_t)(1U << (bit % NBBY));
+	}
+	if (IN_ARE_ADDR_EQUAL(&state->history.addr, addr))
+		state->history.addr.s_addr = INADDR_ANY;
+	ipv4ll_savehistory(ifp);
+}
+
 static void
 ipv4ll_pickaddr(struct interface *ifp)
 {
@@ -79,7 +178,8 @@ again:
 		    ((uint32_t)(r % 0xFD00) + 0x0100));
 
 		/* No point using a failed address */
-		if (IN_ARE_ADDR_EQUAL(&addr, &state->pickedaddr))
+		if (IN_ARE_ADDR_EQUAL(&addr, &state->pickedaddr) ||
+		    ipv4ll_conflicted(state, &addr))
 			goto again;
 		/* Ensure we don't have the address on another interface */
 	} while (ipv4_findaddr(ifp->ctx, &addr) != NULL);
@@ -255,6 +355,10 @@ test:
 	}
 	rt_build(ifp->ctx, AF_INET);
 run:
+	if (!IN_ARE_ADDR_EQUAL(&state->history.addr, &state->pickedaddr)) {
+		state->history.addr = state->pickedaddr;
+		ipv4ll_savehistory(ifp);
+	}
 	astate = arp_announceaddr(ifp->ctx, &ia->addr);
 	if (astate != NULL)
 		astate->announced_cb = ipv4ll_announced_arp;
@@ -268,6 +372,7 @@ ipv4ll_found(struct interface *ifp)
 	struct ipv4ll_state *state = IPV4LL_STATE(ifp);
 
 	ipv4ll_freearp(ifp);
+	ipv4ll_addconflict(ifp, &state->pickedaddr);
 	if (++state->conflicts == MAX_CONFLICTS)
 		logerrx("%s: failed to acquire an IPv4LL address",
 		    ifp->name);
@@ -312,6 +417,7 @@ static void
 ipv4ll_defend_failed_arp(struct arp_state *astate)
 {
 
+	ipv4ll_addconflict(astate->iface, &astate->addr);
 	ipv4ll_defend_failed(astate->iface);
 }
 #endif
@@ -361,6 +467,7 @@ ipv4ll_start(void *arg)
 		setstate(ifp->ctx->randomstate);
 		state->seeded = true;
 	}
+	ipv4ll_loadhistory(ifp);
 
 	/* Find the previosuly used address. */
 	if (state->pickedaddr.s_addr != INADDR_ANY)
@@ -399,7 +506,12 @@ ipv4ll_start(void *arg)
 #endif
 	} else {
 		loginfox("%s: probing for an IPv4LL address", ifp->name);
-		if (repick || state->pickedaddr.s_addr == INADDR_ANY)
+		if (!repick && state->pickedaddr.s_addr == INADDR_ANY &&
+		    state->history.addr.s_addr != INADDR_ANY &&
+		    !ipv4ll_conflicted(state, &state->history.addr) &&
+		    ipv4_findaddr(ifp->ctx, &state->history.addr) == NULL)
+			state->pickedaddr = state->history.addr;
+		else if (repick || state->pickedaddr.s_addr == INADDR_ANY)
 			ipv4ll_pickaddr(ifp);
 	}
 
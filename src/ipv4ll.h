@@ -40,6 +40,13 @@
 #ifdef IPV4LL
 #include "arp.h"
 
+/* Saved per interface and SSID. */
+#define	IPV4LL_BLOOM_LEN	32
+struct ipv4ll_history {
+	struct in_addr addr;			/* last address that worked */
+	uint8_t bloom[IPV4LL_BLOOM_LEN];	/* addresses that conflicted */
+};
+
 struct ipv4ll_state {
 	struct in_addr pickedaddr;
 	struct ipv4_addr *addr;
@@ -47,6 +54,8 @@ struct ipv4ll_state {
 	bool seeded;
 	bool down;
 	size_t conflicts;
+	struct ipv4ll_history history;
+	char historyfile[sizeof(IPV4LLFILE) + IF_NAMESIZE + (IF_SSIDLEN * 4)];
 #ifndef KERNEL_RFC5227
 	struct arp_state *arp;
 #endif
@@ -55,6 +55,7 @@
 #include <errno.h>
 #include <ifaddrs.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
@@ -136,6 +137,7 @@ ipv6_init(struct dhcpcd_ctx *ctx)
 	if (ctx->ra_routers == NULL)
 		return -1;
 	TAILQ_INIT(ctx->ra_routers);
+	ipv6nd_initrouters(ctx);
 
 #ifndef __sun
 	ctx->nd_fd = -1;
@@ -147,6 +149,147 @@ ipv6_init(struct dhcpcd_ctx *ctx)
 	return 0;
 }
 
+/*
+ * The addresses on each interface are also kept in one tree,
+ * ordered by address and then interface, so that address events
+ * don't have to walk the list of every interface.
+ */
+struct ipv6_addrkey {
+	struct in6_addr addr;
+	const struct interface *iface;
+};
+
+static int
+ipv6_cmpaddr(__unused void *context, const void *node, const void *key)
+{
+	const struct ipv6_addr *ia = node;
+	const struct ipv6_addrkey *iak = key;
+	int r;
+
+	r = memcmp(&ia->addr, &iak->addr, sizeof(ia->addr));
+	if (r != 0)
+		return r;
+	if ((uintptr_t)ia->iface < (uintptr_t)iak->iface)
+		return -1;
+	if ((uintptr_t)ia->iface > (uintptr_t)iak->iface)
+		return 1;
+	return 0;
+}
+
+static int
+ipv6_cmpaddrnode(void *context, const void *node1, const void *node2)
+{
+	const struct ipv6_addr *ia2 = node2;
+	struct ipv6_addrkey iak = { .addr = ia2->addr, .iface = ia2->iface };
+
+	return ipv6_cmpaddr(context, node1, &iak);
+}
+
+static const rb_tree_ops_t ipv6_addr_ops = {
+	.rbto_compare_nodes = ipv6_cmpaddrnode,
+	.rbto_compare_key = ipv6_cmpaddr,
+	.rbto_node_offset = offsetof(struct ipv6_addr, tree),
+	.rbto_context = NULL
+};
+
+void
+ipv6_initaddrs(struct dhcpcd_ctx *ctx)
+{
+
+	rb_tree_init(&ctx->ipv6_addrs, &ipv6_addr_ops);
+}
+
+static void
+ipv6_insertaddr(struct ipv6_state *state, struct ipv6_addr *ia)
+{
+
+	TAILQ_INSERT_TAIL(&state->addrs, ia, next);
+	ia->indexed =
+	    rb_tree_insert_node(&ia->iface->ctx->ipv6_addrs, ia) == ia;
+}
+
+/* Removes ia from addrs, which may be any address list. */
+static void
+ipv6_removeaddr(struct ipv6_addrhead *addrs, struct ipv6_addr *ia)
+{
+
+	TAILQ_REMOVE(addrs, ia, next);
+	if (ia->indexed) {
+		rb_tree_remove_node(&ia->iface->ctx->ipv6_addrs, ia);
+		ia->indexed = false;
+	}
+}
+
+static struct ipv6_addr *
+ipv6_lookupaddr(const struct interface *ifp, const struct in6_addr *addr)
+{
+	struct ipv6_addrkey iak = { .addr = *addr, .iface = ifp };
+
+	return rb_tree_find_node(&ifp->ctx->ipv6_addrs, &iak);
+}
+
+/*
+ * RFC 7217 addresses only depend on the secret and what we hash,
+ * so they are kept until the secret is read again.
+ */
+#define	IPV6_STABLEPRIVATE_MAX	256
+
+struct ipv6_spkey {
+	struct in6_addr prefix;
+	int prefix_len;
+	uint32_t dad_counter;
+	unsigned short vlanid;
+	uint8_t netiface_len;
+	uint8_t netid_len;
+	unsigned char netiface[HWADDR_LEN];
+	unsigned char netid[IF_SSIDLEN];
+};
+
+struct ipv6_stableprivate {
+	rb_node_t isp_tree;
+	struct ipv6_spkey isp_key;
+	struct in6_addr isp_addr;
+	uint32_t isp_dad_counter;	/* after skipping reserved ids */
+};
+
+static int
+ipv6_cmpstableprivate(__unused void *context,
+    const void *node, const void *key)
+{
+	const struct ipv6_stableprivate *isp = node;
+
+	return memcmp(&isp->isp_key, key, sizeof(isp->isp_key));
+}
+
+static int
+ipv6_cmpstableprivatenode(void *context, const void *node1, const void *node2)
+{
+	const struct ipv6_stableprivate *isp2 = node2;
+
+	return ipv6_cmpstableprivate(context, node1, &isp2->isp_key);
+}
+
+static const rb_tree_ops_t ipv6_stableprivate_ops = {
+	.rbto_compare_nodes = ipv6_cmpstableprivatenode,
+	.rbto_compare_key = ipv6_cmpstableprivate,
+	.rbto_node_offset = offsetof(struct ipv6_stableprivate, isp_tree),
+	.rbto_context = NULL
+};
+
+static void
+ipv6_freestableprivate(struct dhcpcd_ctx *ctx)
+{
+	struct ipv6_stableprivate *isp;
+
+	if (ctx->stableprivate_len == 0)
+		return;
+	while ((isp = RB_TREE_MIN(&ctx->stableprivate)) != NULL) {
+		rb_tree_remove_node(&ctx->stableprivate, isp);
+		free(isp);
+	}
+	ctx->stableprivate_len = 0;
+}
+
 static ssize_t
 ipv6_readsecret(struct dhcpcd_ctx *ctx)
 {
@@ -155,6 +298,9 @@ ipv6_readsecret(struct dhcpcd_ctx *ctx)
 	size_t len;
 	uint32_t r;
 
+	ipv6_freestableprivate(ctx);
+	rb_tree_init(&ctx->stableprivate, &ipv6_stableprivate_ops);
+
 	ctx->secret_len = dhcp_read_hwaddr_aton(ctx, &ctx->secret, SECRET);
 	if (ctx->secret_len != 0)
 		return (ssize_t)ctx->secret_len;
@@ -240,6 +386,9 @@ ipv6_makestableprivate1(struct dhcpcd_ctx *ctx,
 	unsigned char buf[2048], *p, digest[SHA256_DIGEST_LENGTH];
 	size_t len, l;
 	SHA256_CTX sha_ctx;
+	struct ipv6_spkey key;
+	struct ipv6_stableprivate *isp;
+	bool cache;
 
 	if (prefix_len < 0 || prefix_len > 120) {
 		errno = EINVAL;
@@ -252,6 +401,27 @@ ipv6_makestableprivate1(struct dhcpcd_ctx *ctx,
 	}
 
 	l = (size_t)(ROUNDUP8(prefix_len) / NBBY);
+
+	cache = netiface_len <= sizeof(key.netiface) &&
+	    netid_len <= sizeof(key.netid);
+	if (cache) {
+		memset(&key, 0, sizeof(key));
+		memcpy(&key.prefix, prefix, l);
+		key.prefix_len = prefix_len;
+		key.dad_counter = *dad_counter;
+		key.vlanid = vlanid;
+		key.netiface_len = (uint8_t)netiface_len;
+		key.netid_len = (uint8_t)netid_len;
+		memcpy(key.netiface, netiface, netiface_len);
+		memcpy(key.netid, netid, netid_len);
+		isp = rb_tree_find_node(&ctx->stableprivate, &key);
+		if (isp != NULL) {
+			*addr = isp->isp_addr;
+			*dad_counter = isp->isp_dad_counter;
+			return 0;
+		}
+	}
+
 	len = l + netiface_len + netid_len + sizeof(*dad_counter) +
 	    ctx->secret_len;
 	if (vlanid != 0)
@@ -304,6 +474,21 @@ ipv6_makestableprivate1(struct dhcpcd_ctx *ctx,
 			break;
 	}
 
+	if (!cache)
+		return 0;
+	if (ctx->stableprivate_len == IPV6_STABLEPRIVATE_MAX) {
+		isp = RB_TREE_MIN(&ctx->stableprivate);
+		rb_tree_remove_node(&ctx->stableprivate, isp);
+		ctx->stableprivate_len--;
+	} else
+		isp = malloc(sizeof(*isp));
+	if (isp == NULL)
+		return 0;
+	isp->isp_key = key;
+	isp->isp_addr = *addr;
+	isp->isp_dad_counter = *dad_counter;
+	rb_tree_insert_node(&ctx->stableprivate, isp);
+	ctx->stableprivate_len++;
 	return 0;
 }
 
@@ -628,12 +813,10 @@ ipv6_deleteaddr(struct ipv6_addr *ia)
 	ipv6_deletedaddr(ia);
 
 	state = IPV6_STATE(ia->iface);
-	TAILQ_FOREACH(ap, &state->addrs, next) {
-		if (IN6_ARE_ADDR_EQUAL(&ap->addr, &ia->addr)) {
-			TAILQ_REMOVE(&state->addrs, ap, next);
-			ipv6_freeaddr(ap);
-			break;
-		}
+	ap = ipv6_lookupaddr(ia->iface, &ia->addr);
+	if (ap != NULL) {
+		ipv6_removeaddr(&state->addrs, ap);
+		ipv6_freeaddr(ap);
 	}
 
 #ifdef ND6_ADVERTISE
@@ -642,6 +825,61 @@ ipv6_deleteaddr(struct ipv6_addr *ia)
 #endif
 }
 
+#ifdef PRIVSEP
+/*
+ * ipv6_addaddrs sends the additions for a list to the privileged
+ * proxy in one batch which it pipelines to the kernel.
+ * The results come back once the batch is sent, so each addition is
+ * recorded to undo it if it failed.
+ * Advertisements wait for the batch as they need the proxy as well.
+ */
+struct ipv6_batchaddr {
+	struct ipv6_addr *iba_ia;
+	unsigned int iba_flags;		/* before it was added */
+	bool iba_advertise;
+	bool iba_failed;
+};
+
+struct ipv6_batch {
+	struct ipv6_batchaddr *ib_addrs;
+	size_t ib_len;
+	size_t ib_size;
+	size_t ib_next;			/* next to get a result */
+};
+
+static struct ipv6_batchaddr *
+ipv6_batchaddr(struct dhcpcd_ctx *ctx, struct ipv6_addr *ia,
+    unsigned int flags)
+{
+	struct ipv6_batch *ib = ctx->ipv6_batch;
+	struct ipv6_batchaddr *iba;
+
+	if (ib == NULL || ib->ib_len == ib->ib_size)
+		return NULL;
+	iba = &ib->ib_addrs[ib->ib_len++];
+	iba->iba_ia = ia;
+	iba->iba_flags = flags;
+	iba->iba_advertise = iba->iba_failed = false;
+	return iba;
+}
+
+static void
+ipv6_addaddrscb(void *arg, ssize_t result)
+{
+	struct ipv6_batch *ib = arg;
+	struct ipv6_batchaddr *iba;
+
+	if (ib->ib_next == ib->ib_len)
+		return;
+	iba = &ib->ib_addrs[ib->ib_next++];
+	if (result != -1)
+		return;
+	logerr("%s: %s", __func__, iba->iba_ia->saddr);
+	iba->iba_ia->flags = iba->iba_flags;
+	iba->iba_failed = true;
+}
+#endif
+
 static int
 ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 {
@@ -651,6 +889,12 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 #ifdef ND6_ADVERTISE
 	bool vltime_was_zero = ia->prefix_vltime == 0;
 #endif
+#if defined(PRIVSEP) && defined(ND6_ADVERTISE)
+	struct ipv6_batchaddr *iba = NULL;
+#endif
+#ifdef PRIVSEP
+	unsigned int flags;
+#endif
 #ifdef __sun
 	struct ipv6_state *state;
 	struct ipv6_addr *ia2;
@@ -737,6 +981,9 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 		    " seconds",
 		    ifp->name, ia->prefix_pltime, ia->prefix_vltime);
 
+#ifdef PRIVSEP
+	flags = ia->flags;
+#endif
 	if (if_address6(RTM_NEWADDR, ia) == -1) {
 		logerr(__func__);
 		/* Restore real pltime and vltime */
@@ -744,6 +991,11 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 		ia->prefix_vltime = vltime;
 		return -1;
 	}
+#if defined(PRIVSEP) && defined(ND6_ADVERTISE)
+	iba = ipv6_batchaddr(ifp->ctx, ia, flags);
+#elif defined(PRIVSEP)
+	ipv6_batchaddr(ifp->ctx, ia, flags);
+#endif
 
 #ifdef IPV6_MANAGETEMPADDR
 	/* RFC4941 Section 3.4 */
@@ -783,17 +1035,14 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 	 * address during DaD. */
 
 	state = IPV6_STATE(ifp);
-	TAILQ_FOREACH(ia2, &state->addrs, next) {
-		if (IN6_ARE_ADDR_EQUAL(&ia2->addr, &ia->addr))
-			break;
-	}
+	ia2 = ipv6_lookupaddr(ifp, &ia->addr);
 	if (ia2 == NULL) {
 		if ((ia2 = malloc(sizeof(*ia2))) == NULL) {
 			logerr(__func__);
 			return 0; /* Well, we did add the address */
 		}
 		memcpy(ia2, ia, sizeof(*ia2));
-		TAILQ_INSERT_TAIL(&state->addrs, ia2, next);
+		ipv6_insertaddr(state, ia2);
 	}
 #endif
 
@@ -802,8 +1051,14 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 advertise:
 #endif
 	/* Re-advertise the preferred address to be safe. */
-	if (!vltime_was_zero)
+	if (!vltime_was_zero) {
+#ifdef PRIVSEP
+		if (iba != NULL)
+			iba->iba_advertise = true;
+		else
+#endif
 		ipv6nd_advertise(ia);
+	}
 #endif
 
 	return 0;
@@ -892,7 +1147,7 @@ ipv6_addaddr(struct ipv6_addr *ia, const struct timespec *now)
 			struct ipv6_state *state;
 
 			state = IPV6_STATE(ia->iface);
-			TAILQ_REMOVE(&state->addrs, replaced_ia, next);
+			ipv6_removeaddr(&state->addrs, replaced_ia);
 			ipv6_freeaddr(replaced_ia);
 		}
 #endif
@@ -958,6 +1213,9 @@ ipv6_doaddr(struct ipv6_addr *ia, struct timespec *now)
 		    ELOOP_QUEUE_ALL, NULL, ia);
 		if (ia->flags & IPV6_AF_REQUEST) {
 			ia->flags &= ~IPV6_AF_ADDED;
+#ifdef DHCP6
+			dhcp6_dadforget(ia);
+#endif
 			return 0;
 		}
 		return -1;
@@ -973,6 +1231,76 @@ ipv6_doaddr(struct ipv6_addr *ia, struct timespec *now)
 	return ia->flags & IPV6_AF_NEW ? 1 : 0;
 }
 
+#ifdef PRIVSEP
+static ssize_t
+ipv6_addaddrsbatch(struct dhcpcd_ctx *ctx, struct ipv6_addrhead *iaddrs)
+{
+	struct ipv6_batch ib = { .ib_len = 0, .ib_next = 0 }, *ibp;
+	struct ipv6_batchaddr *iba;
+	struct timespec now;
+	struct ipv6_addr *ia, *ian;
+	size_t n = 0;
+	ssize_t i = 0, r;
+	bool batch = false;
+
+	TAILQ_FOREACH(ia, iaddrs, next)
+		n++;
+	ib.ib_addrs = reallocarray(NULL, n, sizeof(*ib.ib_addrs));
+	if (ib.ib_addrs == NULL)
+		return -1;
+	ib.ib_size = n;
+
+	/* Deletions are done first and not batched as
+	 * ipv6_deleteaddr needs the result. */
+	timespecclear(&now);
+	TAILQ_FOREACH_SAFE(ia, iaddrs, next, ian) {
+		if (ia->prefix_vltime != 0)
+			continue;
+		r = ipv6_doaddr(ia, &now);
+		if (r != 0)
+			i++;
+		if (r == -1) {
+			ipv6_removeaddr(iaddrs, ia);
+			ipv6_freeaddr(ia);
+		}
+	}
+
+	/* This may be nested in a batch the caller has open. */
+	ibp = ctx->ipv6_batch;
+	if (ps_root_batch_start(ctx, ipv6_addaddrscb, &ib) == -1)
+		logerr("%s: ps_root_batch_start", __func__);
+	else {
+		ctx->ipv6_batch = &ib;
+		batch = true;
+	}
+
+	TAILQ_FOREACH(ia, iaddrs, next) {
+		if (ia->prefix_vltime != 0 && ipv6_doaddr(ia, &now) != 0)
+			i++;
+	}
+
+	if (batch) {
+		if (ps_root_batch_end(ctx) == -1)
+			logerr("%s: ps_root_batch_end", __func__);
+		ctx->ipv6_batch = ibp;
+	}
+
+	for (iba = ib.ib_addrs; iba < ib.ib_addrs + ib.ib_len; iba++) {
+		if (iba->iba_failed) {
+			if (iba->iba_ia->flags & IPV6_AF_NEW)
+				i++;
+			continue;
+		}
+#ifdef ND6_ADVERTISE
+		if (iba->iba_advertise)
+			ipv6nd_advertise(iba->iba_ia);
+#endif
+	}
+	free(ib.ib_addrs);
+	return i;
+}
+#endif
+
 ssize_t
 ipv6_addaddrs(struct ipv6_addrhead *iaddrs)
 {
@@ -980,6 +1308,13 @@ ipv6_addaddrs(struct ipv6_addrhead *iaddrs)
 	struct ipv6_addr *ia, *ian;
 	ssize_t i, r;
 
+#ifdef PRIVSEP
+	ia = TAILQ_FIRST(iaddrs);
+	if (ia != NULL && IN_PRIVSEP_SE(ia->iface->ctx) &&
+	    (i = ipv6_addaddrsbatch(ia->iface->ctx, iaddrs)) != -1)
+		return i;
+#endif
+
 	i = 0;
 	timespecclear(&now);
 	TAILQ_FOREACH_SAFE(ia, iaddrs, next, ian) {
@@ -987,7 +1322,7 @@ ipv6_addaddrs(struct ipv6_addrhead *iaddrs)
 		if (r != 0)
 			i++;
 		if (r == -1) {
-			TAILQ_REMOVE(iaddrs, ia, next);
+			ipv6_removeaddr(iaddrs, ia);
 			ipv6_freeaddr(ia);
 		}
 	}
@@ -1015,6 +1350,9 @@ ipv6_freeaddr(struct ipv6_addr *ia)
 		close(ia->dhcp6_fd);
 		eloop_event_delete(eloop, ia->dhcp6_fd);
 	}
+#ifdef DHCP6
+	dhcp6_dadforget(ia);
+#endif
 
 	eloop_q_timeout_delete(eloop, ELOOP_QUEUE_ALL, NULL, ia);
 	free(ia->na);
@@ -1040,7 +1378,7 @@ ipv6_freedrop_addrs(struct ipv6_addrhead *addrs, int drop,
 			continue;
 #endif
 		if (drop != 2)
-			TAILQ_REMOVE(addrs, ap, next);
+			ipv6_removeaddr(addrs, ap);
 		if (drop && ap->flags & IPV6_AF_ADDED &&
 		    (ap->iface->options->options &
 		    (DHCPCD_EXITING | DHCPCD_PERSISTENT)) !=
@@ -1051,7 +1389,7 @@ ipv6_freedrop_addrs(struct ipv6_addrhead *addrs, int drop,
 			    CAN_DROP_LLADDR(ap->iface))
 			{
 				if (drop == 2)
-					TAILQ_REMOVE(addrs, ap, next);
+					ipv6_removeaddr(addrs, ap);
 				/* Find the same address somewhere else */
 				apf = ipv6_findaddr(ap->iface->ctx, &ap->addr,
 				    0);
@@ -1180,15 +1518,12 @@ ipv6_handleifa(struct dhcpcd_ctx *ctx,
 		return;
 	anyglobal = ipv6_anyglobal(ifp) != NULL;
 
-	TAILQ_FOREACH(ia, &state->addrs, next) {
-		if (IN6_ARE_ADDR_EQUAL(&ia->addr, addr))
-			break;
-	}
+	ia = ipv6_lookupaddr(ifp, addr);
 
 	switch (cmd) {
 	case RTM_DELADDR:
 		if (ia != NULL) {
-			TAILQ_REMOVE(&state->addrs, ia, next);
+			ipv6_removeaddr(&state->addrs, ia);
 #ifdef ND6_ADVERTISE
 			/* Advertise the address if it exists on
 			 * another interface. */
@@ -1227,7 +1562,7 @@ ipv6_handleifa(struct dhcpcd_ctx *ctx,
 			 * generate a new temporary address on
 			 * restart. */
 			ia->acquired = ia->created;
-			TAILQ_INSERT_TAIL(&state->addrs, ia, next);
+			ipv6_insertaddr(state, ia);
 		}
 		ia->addr_flags = addrflags;
 		ia->flags &= ~IPV6_AF_STALE;
@@ -1291,7 +1626,7 @@ ipv6_handleifa(struct dhcpcd_ctx *ctx,
 	     (ifp->options == NULL && ctx->options & DHCPCD_IPV6)) &&
 	    !(ctx->options & DHCPCD_RTBUILD) &&
 	    (ipv6_anyglobal(ifp) != NULL) != anyglobal)
-		rt_build(ctx, AF_INET6);
+		rt_schedule(ctx, AF_INET6);
 }
 
 int
@@ -1315,18 +1650,21 @@ ipv6_iffindaddr(struct interface *ifp, const struct in6_addr *addr,
 	struct ipv6_addr *ap;
 
 	state = IPV6_STATE(ifp);
-	if (state) {
-		TAILQ_FOREACH(ap, &state->addrs, next) {
-			if (addr == NULL) {
-				if (IN6_IS_ADDR_LINKLOCAL(&ap->addr) &&
-				    (!revflags || !(ap->addr_flags & revflags)))
-					return ap;
-			} else {
-				if (IN6_ARE_ADDR_EQUAL(&ap->addr, addr) &&
-				    (!revflags || !(ap->addr_flags & revflags)))
-					return ap;
-			}
-		}
+	if (state == NULL)
+		return NULL;
+
+	if (addr != NULL) {
+		ap = ipv6_lookupaddr(ifp, addr);
+		if (ap != NULL &&
+		    (!revflags || !(ap->addr_flags & revflags)))
+			return ap;
+		return NULL;
+	}
+
+	TAILQ_FOREACH(ap, &state->addrs, next) {
+		if (IN6_IS_ADDR_LINKLOCAL(&ap->addr) &&
+		    (!revflags || !(ap->addr_flags & revflags)))
+			return ap;
 	}
 	return NULL;
 }
@@ -1492,30 +1830,27 @@ nextslaacprivate:
 	}
 
 	/* Do we already have this address? */
-	TAILQ_FOREACH(ap2, &state->addrs, next) {
-		if (IN6_ARE_ADDR_EQUAL(&ap->addr, &ap2->addr)) {
-			if (ap2->addr_flags & IN6_IFF_DUPLICATED) {
-				if (ifp->options->options &
-				    DHCPCD_SLAACPRIVATE)
-				{
-					dadcounter++;
-					goto nextslaacprivate;
-				}
-				free(ap);
-				errno = EADDRNOTAVAIL;
-				return -1;
+	ap2 = ipv6_lookupaddr(ifp, &ap->addr);
+	if (ap2 != NULL) {
+		if (ap2->addr_flags & IN6_IFF_DUPLICATED) {
+			if (ifp->options->options & DHCPCD_SLAACPRIVATE) {
+				dadcounter++;
+				goto nextslaacprivate;
 			}
-
-			logwarnx("%s: waiting for %s to complete",
-			    ap2->iface->name, ap2->saddr);
 			free(ap);
-			errno =	EEXIST;
-			return 0;
+			errno = EADDRNOTAVAIL;
+			return -1;
 		}
+
+		logwarnx("%s: waiting for %s to complete",
+		    ap2->iface->name, ap2->saddr);
+		free(ap);
+		errno =	EEXIST;
+		return 0;
 	}
 
 	inet_ntop(AF_INET6, &ap->addr, ap->saddr, sizeof(ap->saddr));
-	TAILQ_INSERT_TAIL(&state->addrs, ap, next);
+	ipv6_insertaddr(state, ap);
 	ipv6_addaddr(ap, NULL);
 	return 1;
 }
@@ -1775,7 +2110,7 @@ ipv6_startstatic(struct interface *ifp)
 		if (ia == NULL)
 			return -1;
 		state = IPV6_STATE(ifp);
-		TAILQ_INSERT_TAIL(&state->addrs, ia, next);
+		ipv6_insertaddr(state, ia);
 		run_script = 0;
 	} else
 		run_script = 1;
@@ -1859,6 +2194,7 @@ ipv6_ctxfree(struct dhcpcd_ctx *ctx)
 
 	free(ctx->ra_routers);
 	free(ctx->secret);
+	ipv6_freestableprivate(ctx);
 }
 
 int
@@ -1884,9 +2220,12 @@ ipv6_handleifa_addrs(int cmd,
 				    ia->iface->name, pid, ia->saddr);
 				ia->flags &= ~IPV6_AF_ADDED;
 			}
+#ifdef DHCP6
+			dhcp6_dadforget(ia);
+#endif
 			ipv6_deletedaddr(ia);
 			if (ia->flags & IPV6_AF_DELEGATED) {
-				TAILQ_REMOVE(addrs, ia, next);
+				ipv6_removeaddr(addrs, ia);
 				ipv6_freeaddr(ia);
 			}
 			break;
@@ -1931,7 +2270,8 @@ ipv6_regen_desync(struct interface *ifp, bool force)
 		state->desync_factor =
 		    arc4random_uniform(MIN(MAX_DESYNC_FACTOR, max));
 	max = TEMP_PREFERRED_LIFETIME - state->desync_factor - REGEN_ADVANCE;
-	eloop_timeout_add_sec(ifp->ctx->eloop, max, ipv6_regentempaddrs, ifp);
+	eloop_timeout_add_slack(ifp->ctx->eloop, max, REGEN_SLACK,
+	    ipv6_regentempaddrs, ifp);
 }
 
 /* RFC4941 Section 3.3.7 */
@@ -1991,7 +2331,7 @@ ipv6_createtempaddr(struct ipv6_addr *ia0, const struct timespec *now)
 		return NULL;
 	}
 
-	TAILQ_INSERT_TAIL(&state->addrs, ia, next);
+	ipv6_insertaddr(state, ia);
 	return ia;
 }
 
@@ -2296,6 +2636,32 @@ inet6_staticroutes(rb_tree_t *routes, struct dhcpcd_ctx *ctx)
 	return 0;
 }
 
+#ifdef HAVE_ROUTE_MULTIPATH
+/* Make rt another next hop of a default route already built for
+ * an equally preferred router on the interface. */
+static bool
+inet6_rapath(rb_tree_t *routes, struct rt *rt)
+{
+	struct rt *r;
+
+	RB_TREE_FOREACH(r, routes) {
+		if (r->rt_ifp != rt->rt_ifp ||
+		    !(r->rt_dflags & RTDF_RA) ||
+		    !rt_is_default(r))
+			continue;
+#ifdef HAVE_ROUTE_PREF
+		if (r->rt_pref != rt->rt_pref)
+			continue;
+#endif
+		if (rt_addpath(r, &rt->rt_gateway) == -1)
+			return false;
+		rt_free(rt);
+		return true;
+	}
+	return false;
+}
+#endif
+
 static int
 inet6_raroutes(rb_tree_t *routes, struct dhcpcd_ctx *ctx)
 {
@@ -2331,6 +2697,11 @@ inet6_raroutes(rb_tree_t *routes, struct dhcpcd_ctx *ctx)
 		rt->rt_dflags |= RTDF_RA;
 #ifdef HAVE_ROUTE_PREF
 		rt->rt_pref = ipv6nd_rtpref(rap);
+#endif
+#ifdef HAVE_ROUTE_MULTIPATH
+		if (rap->iface->options->options & DHCPCD_IPV6RA_MULTIPATH &&
+		    inet6_rapath(routes, rt))
+			continue;
 #endif
 		rt_proto_add(routes, rt);
 	}
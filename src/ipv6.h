@@ -60,6 +60,8 @@
 #define REGEN_ADVANCE		5	/* seconds */
 #define MAX_DESYNC_FACTOR	600	/* 10 minutes */
 #define TEMP_IDGEN_RETRIES	3
+/* Regeneration can be a little late, well inside REGEN_ADVANCE. */
+#define REGEN_SLACK		1000	/* msec */
 
 /* RFC7217 constants */
 #define IDGEN_RETRIES	3
@@ -175,6 +177,8 @@
 TAILQ_HEAD(ipv6_addrhead, ipv6_addr);
 struct ipv6_addr {
 	TAILQ_ENTRY(ipv6_addr) next;
+	rb_node_t tree;		/* in ctx->ipv6_addrs when indexed */
+	bool indexed;
 	struct interface *iface;
 	struct in6_addr prefix;
 	uint8_t prefix_len;
@@ -222,7 +226,6 @@ struct ipv6_addr {
 #define	IPV6_AF_NOREJECT	(1U << 8)
 #define	IPV6_AF_REQUEST		(1U << 9)
 #define	IPV6_AF_STATIC		(1U << 10)
-#define	IPV6_AF_DELEGATEDLOG	(1U << 11)
 #define	IPV6_AF_RAPFX		(1U << 12)
 #define	IPV6_AF_EXTENDED	(1U << 13)
 #define	IPV6_AF_REGEN		(1U << 14)
@@ -230,6 +233,7 @@ struct ipv6_addr {
 #ifdef IPV6_MANAGETEMPADDR
 #define	IPV6_AF_TEMPORARY	(1U << 16)
 #endif
+#define	IPV6_AF_DADPENDING	(1U << 17)	/* counted in dad_pending */
 
 struct ll_callback {
 	TAILQ_ENTRY(ll_callback) next;
@@ -255,6 +259,7 @@ struct ipv6_state {
 
 
 int ipv6_init(struct dhcpcd_ctx *);
+void ipv6_initaddrs(struct dhcpcd_ctx *);
 int ipv6_makestableprivate(struct in6_addr *,
     const struct in6_addr *, int, const struct interface *, int *);
 int ipv6_makeaddr(struct in6_addr *, struct interface *,
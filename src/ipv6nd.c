@@ -54,7 +54,9 @@
 #include "ipv6.h"
 #include "ipv6nd.h"
 #include "logerr.h"
+#include "pace.h"
 #include "privsep.h"
+#include "probe.h"
 #include "route.h"
 #include "script.h"
 
@@ -95,6 +97,10 @@ struct nd_opt_dnssl {		/* DNSSL option RFC 6106 */
 __CTASSERT(sizeof(struct nd_opt_rdnss) == 8);
 #endif
 
+#ifndef ND_OPT_ROUTE_INFO
+#define ND_OPT_ROUTE_INFO		24
+#endif
+
 /* Impossible options, so we can easily add extras */
 #define _ND_OPT_PREFIX_ADDR	255 + 1
 
@@ -132,6 +138,7 @@ __CTASSERT(sizeof(struct nd_opt_rdnss) == 8);
 //
 
 static void ipv6nd_handledata(void *, unsigned short);
+static void ipv6nd_startrs1(void *);
 
 /*
  * Android ships buggy ICMP6 filter headers.
@@ -173,6 +180,365 @@ static void ipv6nd_handledata(void *, unsigned short);
 #define ipv6nd_free_ra(ra) ipv6nd_freedrop_ra((ra),  0)
 #define ipv6nd_drop_ra(ra) ipv6nd_freedrop_ra((ra),  1)
 
+static struct ipv6_addr *ipv6nd_rapfindprefix(struct ra *,
+    const struct in6_addr *, uint8_t);
+
+/*
+ * Routers are kept in ctx->ra_routers in preference order and in
+ * ctx->ra_tree by interface and source address to find the sender of an RA.
+ * The interface pointer is used as the index can change under a router.
+ */
+static int
+ipv6nd_cmpra(__unused void *context, const void *node1, const void *node2)
+{
+	const struct ra *ra1 = node1, *ra2 = node2;
+
+	if (ra1->iface != ra2->iface)
+		return (uintptr_t)ra1->iface < (uintptr_t)ra2->iface ? -1 : 1;
+	return memcmp(&ra1->from, &ra2->from, sizeof(ra1->from));
+}
+
+static const rb_tree_ops_t ipv6nd_ra_ops = {
+	.rbto_compare_nodes = ipv6nd_cmpra,
+	.rbto_compare_key = ipv6nd_cmpra,
+	.rbto_node_offset = offsetof(struct ra, tree),
+	.rbto_context = NULL
+};
+
+void
+ipv6nd_initrouters(struct dhcpcd_ctx *ctx)
+{
+
+	rb_tree_init(&ctx->ra_tree, &ipv6nd_ra_ops);
+}
+
+static struct ra *
+ipv6nd_findra(struct dhcpcd_ctx *ctx, struct interface *ifp,
+    const struct in6_addr *from)
+{
+	struct ra key = { .iface = ifp, .from = *from };
+
+	return rb_tree_find_node(&ctx->ra_tree, &key);
+}
+
+/*
+ * Each router is also kept in rs_state->ra_expire by when the next
+ * part of it expires so ipv6nd_expirera only looks at routers
+ * which have something to expire.
+ */
+static int
+ipv6nd_cmpexpire(__unused void *context, const void *node1, const void *node2)
+{
+	const struct ra *ra1 = node1, *ra2 = node2;
+
+	if (timespeccmp(&ra1->expire, &ra2->expire, <))
+		return -1;
+	if (timespeccmp(&ra1->expire, &ra2->expire, >))
+		return 1;
+	if (ra1 != ra2)
+		return (uintptr_t)ra1 < (uintptr_t)ra2 ? -1 : 1;
+	return 0;
+}
+
+static const rb_tree_ops_t ipv6nd_expire_ops = {
+	.rbto_compare_nodes = ipv6nd_cmpexpire,
+	.rbto_compare_key = ipv6nd_cmpexpire,
+	.rbto_node_offset = offsetof(struct ra, expire_tree),
+	.rbto_context = NULL
+};
+
+static void
+ipv6nd_deadline(int *r, struct timespec *deadline,
+    const struct timespec *acquired, uint32_t ltime,
+    const struct timespec *now)
+{
+	struct timespec ts;
+
+	if (ltime == 0)
+		return;
+	if (ltime == ND6_INFINITE_LIFETIME) {
+		if (*r == -1)
+			*r = 0;
+		return;
+	}
+	ts = *acquired;
+	ts.tv_sec += (time_t)ltime;
+	/* Already expired. */
+	if (!timespeccmp(&ts, now, >))
+		return;
+	if (*r != 1 || timespeccmp(&ts, deadline, <))
+		*deadline = ts;
+	*r = 1;
+}
+
+/*
+ * Work out when the next part of an RA expires, as ipv6nd_expirera does.
+ * Returns 1 if something will expire, 0 if nothing will
+ * and -1 if nothing is left.
+ */
+static int
+ipv6nd_radeadline(const struct ra *rap, const struct timespec *now,
+    struct timespec *deadline)
+{
+	const struct ipv6_addr *ia;
+	struct nd_opt_hdr ndo;
+	struct nd_opt_dnssl dnssl;
+	struct nd_opt_rdnss rdnss;
+	const uint8_t *p;
+	size_t len, olen;
+	uint32_t ltime;
+	int r = -1;
+
+	if (rap->doexpire)
+		return -1;
+
+	ipv6nd_deadline(&r, deadline, &rap->acquired, rap->lifetime, now);
+	TAILQ_FOREACH(ia, &rap->addrs, next) {
+		ipv6nd_deadline(&r, deadline, &ia->acquired,
+		    ia->prefix_vltime, now);
+	}
+
+	len = rap->data_len - sizeof(struct nd_router_advert);
+	for (p = rap->data + sizeof(struct nd_router_advert);
+	    len >= sizeof(ndo);
+	    p += olen, len -= olen)
+	{
+		memcpy(&ndo, p, sizeof(ndo));
+		olen = (size_t)(ndo.nd_opt_len * 8);
+		if (olen == 0 || olen > len)
+			break;
+
+		if (has_option_mask(rap->iface->options->nomasknd,
+		    ndo.nd_opt_type))
+			continue;
+
+		switch (ndo.nd_opt_type) {
+		case ND_OPT_DNSSL:
+			if (len < sizeof(dnssl))
+				continue;
+			memcpy(&dnssl, p, sizeof(dnssl));
+			ltime = dnssl.nd_opt_dnssl_lifetime;
+			break;
+		case ND_OPT_RDNSS:
+			if (len < sizeof(rdnss))
+				continue;
+			memcpy(&rdnss, p, sizeof(rdnss));
+			ltime = rdnss.nd_opt_rdnss_lifetime;
+			break;
+		default:
+			continue;
+		}
+		ipv6nd_deadline(&r, deadline, &rap->acquired, ntohl(ltime), now);
+	}
+	return r;
+}
+
+/* If immediate, a router with nothing left is expired on the next pass. */
+static void
+ipv6nd_raindex(struct ra *rap, const struct timespec *now, bool immediate)
+{
+	struct interface *ifp = rap->iface;
+	struct rs_state *state = RS_STATE(ifp);
+	int r;
+
+	if (state == NULL)
+		return;
+	if (rap->expire_indexed) {
+		rb_tree_remove_node(&state->ra_expire, rap);
+		rap->expire_indexed = false;
+	}
+	if (rap->expired)
+		return;
+
+	r = ipv6nd_radeadline(rap, now, &rap->expire);
+	if (r == 0 || (r == -1 && !immediate))
+		return;
+	if (r == -1)
+		rap->expire = *now;
+	rb_tree_insert_node(&state->ra_expire, rap);
+	rap->expire_indexed = true;
+}
+
+/*
+ * While reading the prefix options of an RA, the prefixes the router
+ * already has are indexed so each option does not walk them all.
+ * Only prefixes with a valid lifetime are found, as with
+ * ipv6nd_rapfindprefix.
+ */
+struct ra_pfx {
+	rb_node_t rp_tree;
+	struct ipv6_addr *rp_ia;
+};
+
+struct ra_pfxindex {
+	rb_tree_t rpi_tree;
+	struct ra_pfx *rpi_pfx;
+	size_t rpi_len;
+	size_t rpi_size;
+};
+
+static int
+ipv6nd_cmppfx(__unused void *context, const void *node, const void *key)
+{
+	const struct ipv6_addr *ia1 = ((const struct ra_pfx *)node)->rp_ia;
+	const struct ipv6_addr *ia2 = key;
+
+	if (ia1->prefix_len != ia2->prefix_len)
+		return ia1->prefix_len < ia2->prefix_len ? -1 : 1;
+	return memcmp(&ia1->prefix, &ia2->prefix, sizeof(ia1->prefix));
+}
+
+static int
+ipv6nd_cmppfxnode(void *context, const void *node1, const void *node2)
+{
+	const struct ra_pfx *rp2 = node2;
+
+	return ipv6nd_cmppfx(context, node1, rp2->rp_ia);
+}
+
+static const rb_tree_ops_t ipv6nd_pfx_ops = {
+	.rbto_compare_nodes = ipv6nd_cmppfxnode,
+	.rbto_compare_key = ipv6nd_cmppfx,
+	.rbto_node_offset = offsetof(struct ra_pfx, rp_tree),
+	.rbto_context = NULL
+};
+
+static int
+ipv6nd_pfxindex_add(struct ra_pfxindex *rpi, struct ipv6_addr *ia)
+{
+	struct ra_pfx *rp, *orp;
+
+	if (rpi->rpi_len == rpi->rpi_size) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	rp = &rpi->rpi_pfx[rpi->rpi_len];
+	rp->rp_ia = ia;
+	orp = rb_tree_insert_node(&rpi->rpi_tree, rp);
+	if (orp == rp)
+		rpi->rpi_len++;
+	else if (orp->rp_ia->prefix_vltime == 0)
+		orp->rp_ia = ia;
+	/* Otherwise the first valid prefix wins, as in the list. */
+	return 0;
+}
+
+static int
+ipv6nd_pfxindex_init(struct ra_pfxindex *rpi, struct ra *rap, size_t len)
+{
+	struct ipv6_addr *ia;
+	size_t n;
+
+	rb_tree_init(&rpi->rpi_tree, &ipv6nd_pfx_ops);
+	rpi->rpi_len = 0;
+	/* Room for the prefixes we have and any left in the RA. */
+	n = len / sizeof(struct nd_opt_prefix_info) + 1;
+	TAILQ_FOREACH(ia, &rap->addrs, next)
+		n++;
+	rpi->rpi_pfx = reallocarray(NULL, n, sizeof(*rpi->rpi_pfx));
+	if (rpi->rpi_pfx == NULL) {
+		rpi->rpi_size = 0;
+		return -1;
+	}
+	rpi->rpi_size = n;
+	TAILQ_FOREACH(ia, &rap->addrs, next) {
+		if (ia->prefix_vltime != 0)
+			ipv6nd_pfxindex_add(rpi, ia);
+	}
+	return 0;
+}
+
+static struct ipv6_addr *
+ipv6nd_pfxindex_find(struct ra_pfxindex *rpi, struct ra *rap,
+    const struct in6_addr *pfx, uint8_t pfxlen)
+{
+	struct ipv6_addr key = { .prefix = *pfx, .prefix_len = pfxlen };
+	struct ra_pfx *rp;
+
+	if (rpi->rpi_pfx == NULL)
+		return ipv6nd_rapfindprefix(rap, pfx, pfxlen);
+	rp = rb_tree_find_node(&rpi->rpi_tree, &key);
+	if (rp == NULL || rp->rp_ia->prefix_vltime == 0)
+		return NULL;
+	return rp->rp_ia;
+}
+
+/*
+ * Most RAs repeat the last one apart from lifetimes which some routers
+ * count down. Compare two RAs of the same length with each lifetime
+ * reduced to whether it is zero, finite or infinite so we can tell
+ * when only lifetimes changed.
+ */
+static uint8_t
+ipv6nd_ltclass(const uint8_t *p)
+{
+	uint32_t ltime;
+
+	memcpy(&ltime, p, sizeof(ltime));
+	if (ltime == 0)
+		return 0;
+	if (ltime == ND6_INFINITE_LIFETIME)
+		return 2;
+	return 1;
+}
+
+static bool
+ipv6nd_rasame(const uint8_t *a, const uint8_t *b, size_t len)
+{
+	const struct nd_router_advert *ra = (const void *)a;
+	const struct nd_router_advert *rb = (const void *)b;
+	size_t olen;
+
+	/* Skip the checksum as it covers the lifetimes. */
+	if (memcmp(a, b, offsetof(struct icmp6_hdr, icmp6_cksum)) != 0 ||
+	    ra->nd_ra_curhoplimit != rb->nd_ra_curhoplimit ||
+	    ra->nd_ra_flags_reserved != rb->nd_ra_flags_reserved ||
+	    (ra->nd_ra_router_lifetime == 0) !=
+	    (rb->nd_ra_router_lifetime == 0) ||
+	    ra->nd_ra_reachable != rb->nd_ra_reachable ||
+	    ra->nd_ra_retransmit != rb->nd_ra_retransmit)
+		return false;
+
+	/* The type and length are compared first,
+	 * so both walk the same options. */
+	a += sizeof(*ra);
+	b += sizeof(*rb);
+	len -= sizeof(*ra);
+	for (; len >= sizeof(struct nd_opt_hdr);
+	    a += olen, b += olen, len -= olen)
+	{
+		olen = (size_t)a[1] * 8;
+		if (olen == 0 || olen > len)
+			break;
+		switch (a[0]) {
+		case ND_OPT_PREFIX_INFORMATION:
+			if (olen < sizeof(struct nd_opt_prefix_info))
+				break;
+			/* Valid and preferred lifetimes. */
+			if (memcmp(a, b, 4) != 0 ||
+			    ipv6nd_ltclass(a + 4) != ipv6nd_ltclass(b + 4) ||
+			    ipv6nd_ltclass(a + 8) != ipv6nd_ltclass(b + 8) ||
+			    memcmp(a + 12, b + 12, olen - 12) != 0)
+				return false;
+			continue;
+		case ND_OPT_ROUTE_INFO:
+		case ND_OPT_RDNSS:
+		case ND_OPT_DNSSL:
+			if (olen < 8)
+				break;
+			if (memcmp(a, b, 4) != 0 ||
+			    ipv6nd_ltclass(a + 4) != ipv6nd_ltclass(b + 4) ||
+			    memcmp(a + 8, b + 8, olen - 8) != 0)
+				return false;
+			continue;
+		}
+		if (memcmp(a, b, olen) != 0)
+			return false;
+	}
+	/* Anything we could not walk. */
+	return memcmp(a, b, len) == 0;
+}
+
 void
 ipv6nd_printoptions(const struct dhcpcd_ctx *ctx,
     const struct dhcp_opt *opts, size_t opts_len)
@@ -281,7 +647,7 @@ ipv6nd_openif(struct interface *ifp)
 		return -1;
 	}
 
-	if (eloop_event_add(ifp->ctx->eloop, fd, ELE_READ,
+	if (eloop_p_event_add(ifp->ctx->eloop, ELOOP_PRIO_HIGH, fd, ELE_READ,
 	    ipv6nd_handledata, ifp) == -1)
 	{
 		close(fd);
@@ -394,8 +760,8 @@ ipv6nd_sendrsprobe(void *arg)
 			logerr(__func__);
 			return;
 		}
-		if (eloop_event_add(ctx->eloop, ctx->nd_fd, ELE_READ,
-		    ipv6nd_handledata, ctx) == -1)
+		if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH,
+		    ctx->nd_fd, ELE_READ, ipv6nd_handledata, ctx) == -1)
 			logerr("%s: eloop_event_add", __func__);
 	}
 	s = ifp->ctx->nd_fd;
@@ -411,6 +777,9 @@ ipv6nd_sendrsprobe(void *arg)
 #ifdef PRIVSEP
 sent:
 #endif
+	IF_STAT(ifp, IFS_RA, tx);
+	if (state->rsprobes != 0)
+		IF_STAT(ifp, IFS_RA, retrans);
 	if (state->rsprobes++ < MAX_RTR_SOLICITATIONS)
 		eloop_timeout_add_sec(ifp->ctx->eloop,
 		    RTR_SOLICITATION_INTERVAL, ipv6nd_sendrsprobe, ifp);
@@ -496,7 +865,6 @@ ipv6nd_advertise(struct ipv6_addr *ia)
 {
 	struct dhcpcd_ctx *ctx;
 	struct interface *ifp;
-	struct ipv6_state *state;
 	struct ipv6_addr *iap, *iaf;
 	struct nd_neighbor_advert *na;
 
@@ -512,27 +880,24 @@ ipv6nd_advertise(struct ipv6_addr *ia)
 	/* Find the most preferred address to advertise. */
 	iaf = NULL;
 	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
-		state = IPV6_STATE(ifp);
-		if (state == NULL || !if_is_link_up(ifp))
+		if (!if_is_link_up(ifp))
+			continue;
+		iap = ipv6_iffindaddr(ifp, &ia->addr, 0);
+		if (iap == NULL)
 			continue;
 
-		TAILQ_FOREACH(iap, &state->addrs, next) {
-			if (!IN6_ARE_ADDR_EQUAL(&iap->addr, &ia->addr))
-				continue;
-
-			/* Cancel any current advertisement. */
-			eloop_timeout_delete(ctx->eloop,
-			    ipv6nd_sendadvertisement, iap);
+		/* Cancel any current advertisement. */
+		eloop_timeout_delete(ctx->eloop,
+		    ipv6nd_sendadvertisement, iap);
 
-			/* Don't advertise what we can't use. */
-			if (iap->prefix_vltime == 0 ||
-			    iap->addr_flags & IN6_IFF_NOTUSEABLE)
-				continue;
+		/* Don't advertise what we can't use. */
+		if (iap->prefix_vltime == 0 ||
+		    iap->addr_flags & IN6_IFF_NOTUSEABLE)
+			continue;
 
-			if (iaf == NULL ||
-			    iaf->iface->metric > iap->iface->metric)
-				iaf = iap;
-		}
+		if (iaf == NULL ||
+		    iaf->iface->metric > iap->iface->metric)
+			iaf = iap;
 	}
 	if (iaf == NULL)
 		return;
@@ -584,13 +949,17 @@ ipv6nd_expire(void *arg)
 {
 	struct interface *ifp = arg;
 	struct ra *rap;
+	struct timespec now;
 
 	if (ifp->ctx->ra_routers == NULL)
 		return;
 
+	clock_gettime(CLOCK_MONOTONIC, &now);
 	TAILQ_FOREACH(rap, ifp->ctx->ra_routers, next) {
-		if (rap->iface == ifp && rap->willexpire)
+		if (rap->iface == ifp && rap->willexpire) {
 			rap->doexpire = true;
+			ipv6nd_raindex(rap, &now, true);
+		}
 	}
 	ipv6nd_expirera(ifp);
 }
@@ -607,8 +976,8 @@ ipv6nd_startexpire(struct interface *ifp)
 		if (rap->iface == ifp)
 			rap->willexpire = true;
 	}
-	eloop_q_timeout_add_sec(ifp->ctx->eloop, ELOOP_IPV6RA_EXPIRE,
-	    RTR_CARRIER_EXPIRE, ipv6nd_expire, ifp);
+	eloop_q_timeout_add_slack(ifp->ctx->eloop, ELOOP_IPV6RA_EXPIRE,
+	    RTR_CARRIER_EXPIRE, RTR_CARRIER_EXPIRE_SLACK, ipv6nd_expire, ifp);
 }
 
 int
@@ -630,6 +999,26 @@ ipv6nd_rtpref(struct ra *rap)
 	/* NOTREACHED */
 }
 
+/* Does ra1 sort before ra2 in ctx->ra_routers? */
+static bool
+ipv6nd_rabefore(struct ra *ra1, struct ra *ra2)
+{
+
+	if (ra1->iface->metric > ra2->iface->metric)
+		return false;
+	if (ra1->expired && !ra2->expired)
+		return false;
+	if (ra1->willexpire && !ra2->willexpire)
+		return false;
+	if (ra1->lifetime == 0 && ra2->lifetime != 0)
+		return false;
+	if (!ra1->isreachable && ra2->reachable)
+		return false;
+	if (ipv6nd_rtpref(ra1) <= ipv6nd_rtpref(ra2))
+		return false;
+	return true;
+}
+
 static void
 ipv6nd_sortrouters(struct dhcpcd_ctx *ctx)
 {
@@ -639,17 +1028,7 @@ ipv6nd_sortrouters(struct dhcpcd_ctx *ctx)
 	while ((ra1 = TAILQ_FIRST(ctx->ra_routers)) != NULL) {
 		TAILQ_REMOVE(ctx->ra_routers, ra1, next);
 		TAILQ_FOREACH(ra2, &sorted_routers, next) {
-			if (ra1->iface->metric > ra2->iface->metric)
-				continue;
-			if (ra1->expired && !ra2->expired)
-				continue;
-			if (ra1->willexpire && !ra2->willexpire)
-				continue;
-			if (ra1->lifetime == 0 && ra2->lifetime != 0)
-				continue;
-			if (!ra1->isreachable && ra2->reachable)
-				continue;
-			if (ipv6nd_rtpref(ra1) <= ipv6nd_rtpref(ra2))
+			if (!ipv6nd_rabefore(ra1, ra2))
 				continue;
 			/* All things being equal, prefer older routers. */
 			/* We don't need to check time, becase newer
@@ -665,6 +1044,22 @@ ipv6nd_sortrouters(struct dhcpcd_ctx *ctx)
 	TAILQ_CONCAT(ctx->ra_routers, &sorted_routers, next);
 }
 
+/* Only rap has changed, so move it rather than sort them all. */
+static void
+ipv6nd_sortrouter(struct dhcpcd_ctx *ctx, struct ra *rap)
+{
+	struct ra *ra2;
+
+	TAILQ_REMOVE(ctx->ra_routers, rap, next);
+	TAILQ_FOREACH(ra2, ctx->ra_routers, next) {
+		if (ipv6nd_rabefore(rap, ra2)) {
+			TAILQ_INSERT_BEFORE(ra2, rap, next);
+			return;
+		}
+	}
+	TAILQ_INSERT_TAIL(ctx->ra_routers, rap, next);
+}
+
 static void
 ipv6nd_applyra(struct interface *ifp)
 {
@@ -727,7 +1122,7 @@ ipv6nd_neighbour(struct dhcpcd_ctx *ctx, struct in6_addr *addr, bool reachable)
 	/* See if we can install a reachable default router. */
 	ipv6nd_sortrouters(ctx);
 	ipv6nd_applyra(rap->iface);
-	rt_build(ctx, AF_INET6);
+	rt_schedule(ctx, AF_INET6);
 
 	if (reachable)
 		return;
@@ -824,8 +1219,15 @@ ipv6nd_removefreedrop_ra(struct ra *rap, int remove_ra, int drop_ra)
 
 	eloop_timeout_delete(rap->iface->ctx->eloop, NULL, rap->iface);
 	eloop_timeout_delete(rap->iface->ctx->eloop, NULL, rap);
-	if (remove_ra)
+	if (remove_ra) {
 		TAILQ_REMOVE(rap->iface->ctx->ra_routers, rap, next);
+		rb_tree_remove_node(&rap->iface->ctx->ra_tree, rap);
+	}
+	if (rap->expire_indexed) {
+		struct interface *ifp = rap->iface;
+
+		rb_tree_remove_node(&RS_STATE(ifp)->ra_expire, rap);
+	}
 	ipv6_freedrop_addrs(&rap->addrs, drop_ra, NULL);
 	free(rap->data);
 	free(rap);
@@ -855,9 +1257,6 @@ ipv6nd_free(struct interface *ifp)
 	eloop_event_delete(ctx->eloop, state->nd_fd);
 	close(state->nd_fd);
 #endif
-	free(state->rs);
-	free(state);
-	ifp->if_data[IF_DATA_IPV6ND] = NULL;
 	n = 0;
 	TAILQ_FOREACH_SAFE(rap, ifp->ctx->ra_routers, next, ran) {
 		if (rap->iface == ifp) {
@@ -865,6 +1264,9 @@ ipv6nd_free(struct interface *ifp)
 			n++;
 		}
 	}
+	free(state->rs);
+	free(state);
+	ifp->if_data[IF_DATA_IPV6ND] = NULL;
 
 #ifndef __sun
 	/* If we don't have any more IPv6 enabled interfaces,
@@ -1094,6 +1496,115 @@ dhcp6_start(__unused struct interface *ifp, __unused enum DH6S init_state)
 }
 #endif
 
+/* Is the lifetime the kernel has left worth refreshing? */
+static bool
+ipv6nd_ltrefresh(uint32_t ltime, uint32_t elapsed, uint32_t advertised)
+{
+	uint32_t left;
+
+	if (ltime == ND6_INFINITE_LIFETIME)
+		return advertised != ND6_INFINITE_LIFETIME;
+	left = elapsed >= ltime ? 0 : ltime - elapsed;
+	return left < advertised / 2 || left > advertised;
+}
+
+/* Can this RA just refresh lifetimes? */
+static bool
+ipv6nd_raunchanged(const struct ra *rap, const uint8_t *data, size_t len)
+{
+	const struct interface *ifp = rap->iface;
+	const struct ipv6_addr *ia;
+
+	if (rap->data_len != len ||
+	    rap->expired || rap->willexpire || !rap->isreachable ||
+	    !ipv6nd_rasame(rap->data, data, len))
+		return false;
+	if (ifp->ctx->options & DHCPCD_TEST)
+		return false;
+#ifdef IPV6_MANAGETEMPADDR
+	/* Temporary addresses are extended by each RA. */
+	if (ifp->options->options & DHCPCD_SLAACTEMP)
+		return false;
+#endif
+
+	/* Until every address is added and has completed DAD
+	 * let the RA be handled in full. */
+	if (!(ifp->options->options & DHCPCD_CONFIGURE))
+		return true;
+	TAILQ_FOREACH(ia, &rap->addrs, next) {
+		if (ia->prefix_vltime == 0 || !(ia->flags & IPV6_AF_AUTOCONF))
+			continue;
+		if ((ia->flags & (IPV6_AF_ADDED | IPV6_AF_DADCOMPLETED)) !=
+		    (IPV6_AF_ADDED | IPV6_AF_DADCOMPLETED))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * The RA only differs from the last one in lifetimes.
+ * Addresses are only given to the kernel again when the lifetime it
+ * has left drifts too far from what was advertised.
+ */
+static void
+ipv6nd_refreshra(struct ra *rap, struct icmp6_hdr *icp, size_t len)
+{
+	struct interface *ifp = rap->iface;
+	struct nd_router_advert *nd_ra = (struct nd_router_advert *)icp;
+	struct nd_opt_prefix_info pi;
+	struct in6_addr pi_prefix;
+	struct ra_pfxindex rpi = { .rpi_pfx = NULL };
+	struct ipv6_addr *ia;
+	uint32_t vltime, pltime, elapsed;
+	uint8_t *p;
+	size_t olen;
+	bool pfxindexed = false;
+
+	memcpy(rap->data, icp, len);
+	clock_gettime(CLOCK_MONOTONIC, &rap->acquired);
+	rap->lifetime = ntohs(nd_ra->nd_ra_router_lifetime);
+
+	p = rap->data + sizeof(*nd_ra);
+	len -= sizeof(*nd_ra);
+	for (; len >= sizeof(struct nd_opt_hdr); p += olen, len -= olen) {
+		olen = (size_t)p[1] * 8;
+		if (olen == 0 || olen > len)
+			break;
+		if (p[0] != ND_OPT_PREFIX_INFORMATION || p[1] != 4 ||
+		    has_option_mask(ifp->options->nomasknd, p[0]))
+			continue;
+		memcpy(&pi, p, sizeof(pi));
+		vltime = ntohl(pi.nd_opt_pi_valid_time);
+		pltime = ntohl(pi.nd_opt_pi_preferred_time);
+		/* Ignored by ipv6nd_handlera as well. */
+		if (pltime > vltime)
+			continue;
+
+		if (!pfxindexed) {
+			if (ipv6nd_pfxindex_init(&rpi, rap, len) == -1)
+				logerr("%s: ipv6nd_pfxindex_init", __func__);
+			pfxindexed = true;
+		}
+		memcpy(&pi_prefix, &pi.nd_opt_pi_prefix, sizeof(pi_prefix));
+		ia = ipv6nd_pfxindex_find(&rpi, rap,
+		    &pi_prefix, pi.nd_opt_pi_prefix_len);
+		if (ia == NULL)
+			continue;
+
+		elapsed = (uint32_t)eloop_timespec_diff(&rap->acquired,
+		    &ia->acquired, NULL);
+		if (!ipv6nd_ltrefresh(ia->prefix_vltime, elapsed, vltime) &&
+		    !ipv6nd_ltrefresh(ia->prefix_pltime, elapsed, pltime))
+			continue;
+		ia->acquired = rap->acquired;
+		ia->prefix_vltime = vltime;
+		ia->prefix_pltime = pltime;
+		if (ia->flags & IPV6_AF_ADDED)
+			ipv6_doaddr(ia, &rap->acquired);
+	}
+	free(rpi.rpi_pfx);
+}
+
 static void
 ipv6nd_handlera(struct dhcpcd_ctx *ctx,
     const struct sockaddr_in6 *from, const char *sfrom,
@@ -1115,6 +1626,8 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 	int ifmtu;
 	int loglevel;
 	unsigned int flags;
+	struct ra_pfxindex rpi = { .rpi_pfx = NULL };
+	bool pfxindexed = false;
 #ifdef IPV6_MANAGETEMPADDR
 	bool new_ia;
 #endif
@@ -1126,26 +1639,28 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 		return;
 	}
 
+	IF_STAT(ifp, IFS_RA, rx);
+	PROBE2(ipv6nd_handlera, ifp->name, len);
 	if (len < sizeof(struct nd_router_advert)) {
 		logerrx("IPv6 RA packet too short from %s", sfrom);
-		return;
+		goto drop;
 	}
 
 	/* RFC 4861 7.1.2 */
 	if (hoplimit != 255) {
 		logerrx("invalid hoplimit(%d) in RA from %s", hoplimit, sfrom);
-		return;
+		goto drop;
 	}
 	if (!IN6_IS_ADDR_LINKLOCAL(&from->sin6_addr)) {
 		logerrx("RA from non local address %s", sfrom);
-		return;
+		goto drop;
 	}
 
 	if (!(ifp->options->options & DHCPCD_IPV6RS)) {
 #ifdef DEBUG_RS
 		logerrx("%s: unexpected RA from %s", ifp->name, sfrom);
 #endif
-		return;
+		goto drop;
 	}
 
 	/* We could receive a RA before we sent a RS*/
@@ -1154,13 +1669,13 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 		logdebugx("%s: received RA from %s (no link-local)",
 		    ifp->name, sfrom);
 #endif
-		return;
+		goto drop;
 	}
 
 	if (ipv6_iffindaddr(ifp, &from->sin6_addr, IN6_IFF_TENTATIVE)) {
 		logdebugx("%s: ignoring RA from ourself %s",
 		    ifp->name, sfrom);
-		return;
+		goto drop;
 	}
 
 	/*
@@ -1176,14 +1691,18 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 	if (rap != NULL && rap->willexpire)
 		ipv6nd_applyra(ifp);
 
-	TAILQ_FOREACH(rap, ctx->ra_routers, next) {
-		if (ifp == rap->iface &&
-		    IN6_ARE_ADDR_EQUAL(&rap->from, &from->sin6_addr))
-			break;
-	}
+	rap = ipv6nd_findra(ctx, ifp, &from->sin6_addr);
 
 	nd_ra = (struct nd_router_advert *)icp;
 
+	if (rap != NULL && ipv6nd_raunchanged(rap, (uint8_t *)icp, len)) {
+		logdebugx("%s: Router Advertisement from %s",
+		    ifp->name, rap->sfrom);
+		ipv6nd_refreshra(rap, icp, len);
+		new_data = false;
+		goto unchanged;
+	}
+
 	/* We don't want to spam the log with the fact we got an RA every
 	 * 30 seconds or so, so only spam the log if it's different. */
 	if (rap == NULL || (rap->data_len != len ||
@@ -1302,6 +1821,7 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 			else
 				logwarnx("%s: reject RA (option %d) from %s",
 				    ifp->name, ndo.nd_opt_type, rap->sfrom);
+			free(rpi.rpi_pfx);
 			if (new_rap)
 				ipv6nd_removefreedrop_ra(rap, 0, 0);
 			else
@@ -1357,7 +1877,14 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 			if (pi.nd_opt_pi_flags_reserved & ND_OPT_PI_FLAG_ROUTER)
 				flags |= IPV6_AF_ROUTER;
 
-			ia = ipv6nd_rapfindprefix(rap,
+			/* Index the prefixes on the first prefix option. */
+			if (!pfxindexed) {
+				if (ipv6nd_pfxindex_init(&rpi, rap, len) == -1)
+					logerr("%s: ipv6nd_pfxindex_init",
+					    __func__);
+				pfxindexed = true;
+			}
+			ia = ipv6nd_pfxindex_find(&rpi, rap,
 			    &pi_prefix, pi.nd_opt_pi_prefix_len);
 			if (ia == NULL) {
 				ia = ipv6_newaddr(rap->iface,
@@ -1369,6 +1896,13 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 					ia->dadcallback = ipv6nd_dadcallback;
 				ia->created = ia->acquired = rap->acquired;
 				TAILQ_INSERT_TAIL(&rap->addrs, ia, next);
+				if (rpi.rpi_pfx != NULL &&
+				    ipv6nd_pfxindex_add(&rpi, ia) == -1)
+				{
+					/* Can't happen, but fall back. */
+					free(rpi.rpi_pfx);
+					rpi.rpi_pfx = NULL;
+				}
 
 #ifdef IPV6_MANAGETEMPADDR
 				/* New address to dhcpcd RA handling.
@@ -1456,6 +1990,7 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 			continue;
 		}
 	}
+	free(rpi.rpi_pfx);
 
 	for (i = 0, dho = ctx->nd_opts;
 	    i < ctx->nd_opts_len;
@@ -1491,10 +2026,12 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 		logwarnx("%s: no global addresses for default route",
 		    ifp->name);
 
-	if (new_rap)
+	if (new_rap) {
 		TAILQ_INSERT_TAIL(ctx->ra_routers, rap, next);
+		rb_tree_insert_node(&ctx->ra_tree, rap);
+	}
 	if (new_data)
-		ipv6nd_sortrouters(ifp->ctx);
+		ipv6nd_sortrouter(ifp->ctx, rap);
 
 	if (ifp->ctx->options & DHCPCD_TEST) {
 		script_runreason(ifp, "TEST");
@@ -1509,11 +2046,12 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 #ifdef IPV6_MANAGETEMPADDR
 	ipv6_addtempaddrs(ifp, &rap->acquired);
 #endif
-	rt_build(ifp->ctx, AF_INET6);
+	rt_schedule(ifp->ctx, AF_INET6);
 
 run:
 	ipv6nd_scriptrun(rap);
 
+unchanged:
 	eloop_timeout_delete(ifp->ctx->eloop, NULL, ifp);
 	eloop_timeout_delete(ifp->ctx->eloop, NULL, rap); /* reachable timer */
 
@@ -1545,7 +2083,12 @@ nodhcp6:
 	}
 
 	/* Expire should be called last as the rap object could be destroyed */
+	ipv6nd_raindex(rap, &rap->acquired, true);
 	ipv6nd_expirera(ifp);
+	return;
+
+drop:
+	IF_STAT(ifp, IFS_RA, drop);
 }
 
 bool
@@ -1680,7 +2223,7 @@ ipv6nd_env(FILE *fp, const struct interface *ifp)
 		{
 			memcpy(&ndo, p, sizeof(ndo));
 			olen = (size_t)(ndo.nd_opt_len * 8);
-			if (olen > len) {
+			if (olen == 0 || olen > len) {
 				errno =	EINVAL;
 				break;
 			}
@@ -1749,7 +2292,8 @@ void
 ipv6nd_expirera(void *arg)
 {
 	struct interface *ifp;
-	struct ra *rap, *ran;
+	struct rs_state *state;
+	struct ra *rap;
 	struct timespec now;
 	uint32_t elapsed;
 	bool expired, valid;
@@ -1762,16 +2306,23 @@ ipv6nd_expirera(void *arg)
 #endif
 	struct nd_opt_dnssl dnssl;
 	struct nd_opt_rdnss rdnss;
-	unsigned int next = 0, ltime;
+	unsigned int ltime, nsec;
+	unsigned long long next;
 	size_t nexpired = 0;
 
 	ifp = arg;
+	state = RS_STATE(ifp);
+	if (state == NULL)
+		return;
 	clock_gettime(CLOCK_MONOTONIC, &now);
 	expired = false;
 
-	TAILQ_FOREACH_SAFE(rap, ifp->ctx->ra_routers, next, ran) {
-		if (rap->iface != ifp || rap->expired)
-			continue;
+	/* Only routers with something due to expire. */
+	while ((rap = RB_TREE_MIN(&state->ra_expire)) != NULL &&
+	    timespeccmp(&rap->expire, &now, <=))
+	{
+		rb_tree_remove_node(&state->ra_expire, rap);
+		rap->expire_indexed = false;
 		valid = false;
 		if (rap->lifetime) {
 			elapsed = (uint32_t)eloop_timespec_diff(&now,
@@ -1783,12 +2334,8 @@ ipv6nd_expirera(void *arg)
 					rap->lifetime = 0;
 					expired = true;
 				}
-			} else {
+			} else
 				valid = true;
-				ltime = rap->lifetime - elapsed;
-				if (next == 0 || ltime < next)
-					next = ltime;
-			}
 		}
 
 		/* Not every prefix is tied to an address which
@@ -1821,12 +2368,8 @@ ipv6nd_expirera(void *arg)
 				ia->flags &=
 				    ~(IPV6_AF_ADDED | IPV6_AF_DADCOMPLETED);
 				expired = true;
-			} else {
+			} else
 				valid = true;
-				ltime = ia->prefix_vltime - elapsed;
-				if (next == 0 || ltime < next)
-					next = ltime;
-			}
 		}
 
 		/* Work out expiry for ND options */
@@ -1839,7 +2382,7 @@ ipv6nd_expirera(void *arg)
 		{
 			memcpy(&ndo, p, sizeof(ndo));
 			olen = (size_t)(ndo.nd_opt_len * 8);
-			if (olen > len) {
+			if (olen == 0 || olen > len) {
 				errno =	EINVAL;
 				break;
 			}
@@ -1892,13 +2435,12 @@ ipv6nd_expirera(void *arg)
 			}
 
 			valid = true;
-			ltime -= elapsed;
-			if (next == 0 || ltime < next)
-				next = ltime;
 		}
 
-		if (valid)
+		if (valid) {
+			ipv6nd_raindex(rap, &now, false);
 			continue;
+		}
 
 		/* Router has expired. Let's not keep a lot of them. */
 		rap->expired = true;
@@ -1906,15 +2448,20 @@ ipv6nd_expirera(void *arg)
 			ipv6nd_free_ra(rap);
 	}
 
-	if (next != 0)
+	rap = RB_TREE_MIN(&state->ra_expire);
+	if (rap != NULL) {
+		next = eloop_timespec_diff(&rap->expire, &now, &nsec);
+		if (nsec != 0)
+			next++;
 		eloop_timeout_add_sec(ifp->ctx->eloop,
-		    next, ipv6nd_expirera, ifp);
+		    (unsigned int)next, ipv6nd_expirera, ifp);
+	}
 	if (expired) {
 		logwarnx("%s: part of a Router Advertisement expired",
 		    ifp->name);
 		ipv6nd_sortrouters(ifp->ctx);
 		ipv6nd_applyra(ifp);
-		rt_build(ifp->ctx, AF_INET6);
+		rt_schedule(ifp->ctx, AF_INET6);
 		script_runreason(ifp, "ROUTERADVERT");
 	}
 }
@@ -1925,6 +2472,7 @@ ipv6nd_drop(struct interface *ifp)
 	struct ra *rap, *ran;
 	bool expired = false;
 
+	pace_delete(ifp, ipv6nd_startrs1);
 	if (ifp->ctx->ra_routers == NULL)
 		return;
 
@@ -2041,6 +2589,9 @@ ipv6nd_startrs1(void *arg)
 	struct interface *ifp = arg;
 	struct rs_state *state;
 
+	if (!pace_start(ifp, ipv6nd_startrs1))
+		return;
+
 	loginfox("%s: soliciting an IPv6 router", ifp->name);
 	state = RS_STATE(ifp);
 	if (state == NULL) {
@@ -2050,6 +2601,7 @@ ipv6nd_startrs1(void *arg)
 			logerr(__func__);
 			return;
 		}
+		rb_tree_init(&state->ra_expire, &ipv6nd_expire_ops);
 #ifdef __sun
 		state->nd_fd = -1;
 #endif
@@ -2074,6 +2626,7 @@ ipv6nd_startrs(struct interface *ifp)
 	unsigned int delay;
 
 	eloop_timeout_delete(ifp->ctx->eloop, NULL, ifp);
+	pace_delete(ifp, ipv6nd_startrs1);
 	if (!(ifp->options->options & DHCPCD_INITIAL_DELAY)) {
 		ipv6nd_startrs1(ifp);
 		return;
@@ -39,6 +39,7 @@
 
 struct ra {
 	TAILQ_ENTRY(ra) next;
+	rb_node_t tree;		/* ctx->ra_tree by iface and from */
 	struct interface *iface;
 	struct in6_addr from;
 	char sfrom[INET6_ADDRSTRLEN];
@@ -57,6 +58,9 @@ struct ra {
 	bool willexpire;
 	bool doexpire;
 	bool isreachable;
+	rb_node_t expire_tree;	/* rs_state->ra_expire by expire */
+	struct timespec expire;	/* when the next part expires */
+	bool expire_indexed;
 };
 
 TAILQ_HEAD(ra_head, ra);
@@ -66,6 +70,7 @@ struct rs_state {
 	size_t rslen;
 	int rsprobes;
 	uint32_t retrans;
+	rb_tree_t ra_expire;	/* routers by when they next expire */
 #ifdef __sun
 	int nd_fd;
 #endif
@@ -92,12 +97,15 @@ struct rs_state {
     (MAX_RTR_SOLICITATION_DELAY +	\
     (MAX_RTR_SOLICITATIONS + 1) *	\
     RTR_SOLICITATION_INTERVAL)
+/* For the carrier expiry timer, see eloop_q_timeout_add_slack. */
+#define RTR_CARRIER_EXPIRE_SLACK	500	/* msec */
 
 #define	MAX_REACHABLE_TIME		3600000	/* milliseconds */
 #define	REACHABLE_TIME			30000	/* milliseconds */
 #define	RETRANS_TIMER			1000	/* milliseconds */
 #define	DELAY_FIRST_PROBE_TIME		5	/* seconds */
 
+void ipv6nd_initrouters(struct dhcpcd_ctx *);
 int ipv6nd_open(bool);
 #ifdef __sun
 int ipv6nd_openif(struct interface *);
@@ -0,0 +1,534 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "leasedb.h"
+#include "logerr.h"
+
+/*
+ * All lease files kept in one file, so starting with many interfaces
+ * is one open and mmap rather than a few syscalls per lease.
+ * The file is a log of records, each replacing or deleting the lease
+ * named by its key.  A record which does not check out ends the log,
+ * so a torn write at the end loses only that lease.
+ * When the log is mostly dead records it is rewritten.
+ */
+#define	LEASEDB_MAGIC		"dhcpcdL1"
+#define	LEASEDB_MAGICLEN	(sizeof(LEASEDB_MAGIC) - 1)
+#define	LEASEDB_COMPACT		(64 * 1024)
+
+#define	LDR_DELETED		0x0001U
+
+struct leasedb_rec {
+	uint32_t ldr_len;		/* key + data */
+	uint16_t ldr_keylen;		/* includes the NUL */
+	uint16_t ldr_flags;
+	int64_t ldr_mtime;
+	uint32_t ldr_sum;
+	uint32_t ldr_pad;
+};
+
+struct leasedb_ent {
+	rb_node_t lde_tree;
+	char *lde_key;
+	size_t lde_off;			/* of the record */
+	size_t lde_len;			/* of the data */
+	time_t lde_mtime;
+};
+
+struct leasedb {
+	int ldb_fd;
+	void *ldb_map;
+	size_t ldb_maplen;
+	size_t ldb_size;
+	size_t ldb_live;
+	rb_tree_t ldb_ents;
+};
+
+static int
+leasedb_cmpent(__unused void *context, const void *node, const void *key)
+{
+	const struct leasedb_ent *lde = node;
+
+	return strcmp(lde->lde_key, key);
+}
+
+static int
+leasedb_cmpentnode(void *context, const void *node1, const void *node2)
+{
+	const struct leasedb_ent *lde2 = node2;
+
+	return leasedb_cmpent(context, node1, lde2->lde_key);
+}
+
+static const rb_tree_ops_t leasedb_ent_ops = {
+	.rbto_compare_nodes = leasedb_cmpentnode,
+	.rbto_compare_key = leasedb_cmpent,
+	.rbto_node_offset = offsetof(struct leasedb_ent, lde_tree),
+	.rbto_context = NULL
+};
+
+/* FNV-1a, enough to spot a torn or stale record. */
+static uint32_t
+leasedb_sum(uint32_t sum, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len-- != 0) {
+		sum ^= *p++;
+		sum *= 16777619U;
+	}
+	return sum;
+}
+
+static uint32_t
+leasedb_recsum(const struct leasedb_rec *rec, const void *key,
+    const void *data, size_t len)
+{
+	uint32_t sum = 2166136261U;
+
+	sum = leasedb_sum(sum, rec, offsetof(struct leasedb_rec, ldr_sum));
+	sum = leasedb_sum(sum, key, rec->ldr_keylen);
+	return leasedb_sum(sum, data, len);
+}
+
+static size_t
+leasedb_reclen(const struct leasedb_ent *lde)
+{
+
+	return sizeof(struct leasedb_rec) + strlen(lde->lde_key) + 1 +
+	    lde->lde_len;
+}
+
+static void
+leasedb_freeent(struct leasedb *ldb, struct leasedb_ent *lde)
+{
+
+	ldb->ldb_live -= leasedb_reclen(lde);
+	rb_tree_remove_node(&ldb->ldb_ents, lde);
+	free(lde->lde_key);
+	free(lde);
+}
+
+static void
+leasedb_unmap(struct leasedb *ldb)
+{
+
+	if (ldb->ldb_map != NULL) {
+		munmap(ldb->ldb_map, ldb->ldb_maplen);
+		ldb->ldb_map = NULL;
+		ldb->ldb_maplen = 0;
+	}
+}
+
+static int
+leasedb_map(struct leasedb *ldb)
+{
+	void *map;
+
+	leasedb_unmap(ldb);
+	map = mmap(NULL, ldb->ldb_size, PROT_READ, MAP_SHARED, ldb->ldb_fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	ldb->ldb_map = map;
+	ldb->ldb_maplen = ldb->ldb_size;
+	return 0;
+}
+
+/* Apply one record to the index. */
+static int
+leasedb_index(struct leasedb *ldb, const struct leasedb_rec *rec,
+    const char *key, size_t off)
+{
+	struct leasedb_ent *lde;
+
+	lde = rb_tree_find_node(&ldb->ldb_ents, key);
+	if (rec->ldr_flags & LDR_DELETED) {
+		if (lde != NULL)
+			leasedb_freeent(ldb, lde);
+		return 0;
+	}
+	if (lde == NULL) {
+		lde = malloc(sizeof(*lde));
+		if (lde == NULL || (lde->lde_key = strdup(key)) == NULL) {
+			free(lde);
+			return -1;
+		}
+		rb_tree_insert_node(&ldb->ldb_ents, lde);
+	} else
+		ldb->ldb_live -= leasedb_reclen(lde);
+	lde->lde_off = off;
+	lde->lde_len = rec->ldr_len - rec->ldr_keylen;
+	lde->lde_mtime = (time_t)rec->ldr_mtime;
+	ldb->ldb_live += leasedb_reclen(lde);
+	return 0;
+}
+
+/* Returns the length of the log which checks out. */
+static ssize_t
+leasedb_load(struct leasedb *ldb)
+{
+	const uint8_t *map = ldb->ldb_map;
+	struct leasedb_rec rec;
+	const char *key;
+	size_t off, end;
+
+	if (ldb->ldb_size < LEASEDB_MAGICLEN ||
+	    memcmp(map, LEASEDB_MAGIC, LEASEDB_MAGICLEN) != 0)
+		return 0;
+
+	for (off = LEASEDB_MAGICLEN;
+	    ldb->ldb_size - off >= sizeof(rec);
+	    off = end)
+	{
+		memcpy(&rec, map + off, sizeof(rec));
+		if (rec.ldr_keylen == 0 || rec.ldr_keylen > rec.ldr_len ||
+		    rec.ldr_len > ldb->ldb_size - off - sizeof(rec))
+			break;
+		end = off + sizeof(rec) + rec.ldr_len;
+		key = (const char *)map + off + sizeof(rec);
+		if (key[rec.ldr_keylen - 1] != '\0' ||
+		    strlen(key) + 1 != rec.ldr_keylen ||
+		    leasedb_recsum(&rec, key, key + rec.ldr_keylen,
+		    rec.ldr_len - rec.ldr_keylen) != rec.ldr_sum)
+			break;
+		if (leasedb_index(ldb, &rec, key, off) == -1)
+			return -1;
+	}
+	return (ssize_t)off;
+}
+
+static void
+leasedb_free(struct leasedb *ldb)
+{
+	struct leasedb_ent *lde;
+
+	while ((lde = RB_TREE_MIN(&ldb->ldb_ents)) != NULL)
+		leasedb_freeent(ldb, lde);
+	leasedb_unmap(ldb);
+	if (ldb->ldb_fd != -1)
+		close(ldb->ldb_fd);
+	free(ldb);
+}
+
+static struct leasedb *
+leasedb_open(void)
+{
+	struct leasedb *ldb;
+	struct stat st;
+	ssize_t len;
+
+	ldb = calloc(1, sizeof(*ldb));
+	if (ldb == NULL)
+		return NULL;
+	rb_tree_init(&ldb->ldb_ents, &leasedb_ent_ops);
+	ldb->ldb_fd = open(LEASEDB, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+	if (ldb->ldb_fd == -1)
+		goto err;
+	/* Another dhcpcd owns it, so stay with lease files. */
+	if (flock(ldb->ldb_fd, LOCK_EX | LOCK_NB) == -1)
+		goto err;
+	if (fstat(ldb->ldb_fd, &st) == -1)
+		goto err;
+	ldb->ldb_size = (size_t)st.st_size;
+
+	if (ldb->ldb_size == 0)
+		len = 0;
+	else {
+		if (leasedb_map(ldb) == -1)
+			goto err;
+		if ((len = leasedb_load(ldb)) == -1)
+			goto err;
+	}
+
+	if (len == 0) {
+		if (ldb->ldb_size != 0)
+			logwarnx("%s: not a lease database, starting again",
+			    LEASEDB);
+		if (ftruncate(ldb->ldb_fd, 0) == -1 ||
+		    pwrite(ldb->ldb_fd, LEASEDB_MAGIC, LEASEDB_MAGICLEN, 0) !=
+		    (ssize_t)LEASEDB_MAGICLEN)
+			goto err;
+		len = LEASEDB_MAGICLEN;
+	} else if ((size_t)len != ldb->ldb_size) {
+		logwarnx("%s: discarding %zu bytes of torn records",
+		    LEASEDB, ldb->ldb_size - (size_t)len);
+		if (ftruncate(ldb->ldb_fd, len) == -1)
+			goto err;
+	}
+	ldb->ldb_size = (size_t)len;
+	return ldb;
+
+err:
+	leasedb_free(ldb);
+	return NULL;
+}
+
+/*
+ * Is file a lease which lives in the database?
+ * The database is opened here on first use.
+ */
+bool
+leasedb_match(struct dhcpcd_ctx *ctx, const char *file)
+{
+	const char *p;
+	size_t len;
+
+	if (!ctx->lease_database)
+		return false;
+	if (strncmp(file, DBDIR "/", sizeof(DBDIR)) != 0)
+		return false;
+	p = file + sizeof(DBDIR);
+	if (strchr(p, '/') != NULL)
+		return false;
+	len = strlen(p);
+	if (!(len > 6 && strcmp(p + len - 6, ".lease") == 0) &&
+	    !(len > 7 && strcmp(p + len - 7, ".lease6") == 0))
+		return false;
+
+	if (ctx->leasedb == NULL) {
+		ctx->leasedb = leasedb_open();
+		if (ctx->leasedb == NULL) {
+			logerr("%s: %s", __func__, LEASEDB);
+			ctx->lease_database = false;
+			return false;
+		}
+	}
+	return true;
+}
+
+ssize_t
+leasedb_read(struct dhcpcd_ctx *ctx, const char *file, void *data, size_t len)
+{
+	struct leasedb *ldb = ctx->leasedb;
+	struct leasedb_ent *lde;
+	size_t off;
+
+	lde = rb_tree_find_node(&ldb->ldb_ents, file);
+	if (lde == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	/* Like readfile, a buffer it fills may have been too small. */
+	if (lde->lde_len >= len) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	off = lde->lde_off + leasedb_reclen(lde) - lde->lde_len;
+	if (off + lde->lde_len > ldb->ldb_maplen && leasedb_map(ldb) == -1)
+		return -1;
+	memcpy(data, (const uint8_t *)ldb->ldb_map + off, lde->lde_len);
+	return (ssize_t)lde->lde_len;
+}
+
+int
+leasedb_mtime(struct dhcpcd_ctx *ctx, const char *file, time_t *time)
+{
+	struct leasedb_ent *lde;
+
+	lde = rb_tree_find_node(&ctx->leasedb->ldb_ents, file);
+	if (lde == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	*time = lde->lde_mtime;
+	return 0;
+}
+
+static ssize_t
+leasedb_writerec(int fd, size_t off, const char *file, int flags,
+    const void *data, size_t len, time_t mtime)
+{
+	size_t keylen = strlen(file) + 1;
+	struct leasedb_rec rec = {
+		.ldr_keylen = (uint16_t)keylen,
+		.ldr_flags = (uint16_t)flags,
+		.ldr_mtime = mtime,
+	};
+	struct iovec iov[] = {
+		{ .iov_base = &rec, .iov_len = sizeof(rec) },
+		{ .iov_base = UNCONST(file), .iov_len = keylen },
+		{ .iov_base = UNCONST(data), .iov_len = len },
+	};
+	size_t reclen = sizeof(rec) + keylen + len;
+	ssize_t bytes;
+
+	if (keylen > UINT16_MAX || len > UINT32_MAX - keylen) {
+		errno = EINVAL;
+		return -1;
+	}
+	rec.ldr_len = (uint32_t)(rec.ldr_keylen + len);
+	rec.ldr_sum = leasedb_recsum(&rec, file, data, len);
+
+	if (lseek(fd, (off_t)off, SEEK_SET) == -1)
+		return -1;
+	bytes = writev(fd, iov, __arraycount(iov));
+	if (bytes != -1 && (size_t)bytes != reclen) {
+		errno = EIO;
+		bytes = -1;
+	}
+	return bytes;
+}
+
+/* Write the live records to a new file and swap it in. */
+static int
+leasedb_compact(struct leasedb *ldb)
+{
+	const uint8_t *map = ldb->ldb_map;
+	struct leasedb_ent *lde;
+	int fd, serrno;
+	size_t off;
+	ssize_t bytes;
+
+	fd = open(LEASEDB ".new", O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+	    0640);
+	if (fd == -1)
+		return -1;
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1 ||
+	    write(fd, LEASEDB_MAGIC, LEASEDB_MAGICLEN) !=
+	    (ssize_t)LEASEDB_MAGICLEN)
+		goto err;
+
+	off = LEASEDB_MAGICLEN;
+	RB_TREE_FOREACH(lde, &ldb->ldb_ents) {
+		bytes = leasedb_writerec(fd, off, lde->lde_key, 0,
+		    map + lde->lde_off + leasedb_reclen(lde) - lde->lde_len,
+		    lde->lde_len, lde->lde_mtime);
+		if (bytes == -1)
+			goto err;
+		off += (size_t)bytes;
+	}
+	if (fsync(fd) == -1 || rename(LEASEDB ".new", LEASEDB) == -1)
+		goto err;
+
+	/* Records went out in tree order, so walk it again for offsets. */
+	off = LEASEDB_MAGICLEN;
+	RB_TREE_FOREACH(lde, &ldb->ldb_ents) {
+		lde->lde_off = off;
+		off += leasedb_reclen(lde);
+	}
+	leasedb_unmap(ldb);
+	close(ldb->ldb_fd);
+	ldb->ldb_fd = fd;
+	ldb->ldb_size = off;
+	return 0;
+
+err:
+	serrno = errno;
+	close(fd);
+	unlink(LEASEDB ".new");
+	errno = serrno;
+	return -1;
+}
+
+static ssize_t
+leasedb_append(struct leasedb *ldb, const char *file, int flags,
+    const void *data, size_t len, time_t mtime)
+{
+	struct leasedb_rec rec;
+	ssize_t bytes;
+	size_t off = ldb->ldb_size;
+
+	bytes = leasedb_writerec(ldb->ldb_fd, off, file, flags,
+	    data, len, mtime);
+	if (bytes == -1 || fsync(ldb->ldb_fd) == -1) {
+		/* Don't leave a partial record for the next one to follow. */
+		if (ftruncate(ldb->ldb_fd, (off_t)off) == -1)
+			logerr("%s: ftruncate", __func__);
+		return -1;
+	}
+	ldb->ldb_size += (size_t)bytes;
+
+	rec.ldr_len = (uint32_t)(strlen(file) + 1 + len);
+	rec.ldr_keylen = (uint16_t)(strlen(file) + 1);
+	rec.ldr_flags = (uint16_t)flags;
+	rec.ldr_mtime = mtime;
+	if (leasedb_index(ldb, &rec, file, off) == -1)
+		return -1;
+
+	if (ldb->ldb_size > LEASEDB_COMPACT &&
+	    ldb->ldb_size - ldb->ldb_live > ldb->ldb_live)
+	{
+		if ((ldb->ldb_maplen < ldb->ldb_size &&
+		    leasedb_map(ldb) == -1) ||
+		    leasedb_compact(ldb) == -1)
+			logerr("%s: compact", __func__);
+	}
+	return (ssize_t)len;
+}
+
+ssize_t
+leasedb_write(struct dhcpcd_ctx *ctx, const char *file,
+    const void *data, size_t len, time_t mtime)
+{
+
+	if (mtime == 0)
+		mtime = time(NULL);
+	return leasedb_append(ctx->leasedb, file, 0, data, len, mtime);
+}
+
+int
+leasedb_unlink(struct dhcpcd_ctx *ctx, const char *file)
+{
+	struct leasedb *ldb = ctx->leasedb;
+
+	if (rb_tree_find_node(&ldb->ldb_ents, file) == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (leasedb_append(ldb, file, LDR_DELETED, NULL, 0, 0) == -1)
+		return -1;
+	return 0;
+}
+
+void
+leasedb_close(struct dhcpcd_ctx *ctx)
+{
+
+	if (ctx->leasedb == NULL)
+		return;
+	leasedb_free(ctx->leasedb);
+	ctx->leasedb = NULL;
+}
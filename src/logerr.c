@@ -28,8 +28,10 @@
 
 #include <sys/time.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -52,6 +54,43 @@
 
 #define UNUSED(a)		(void)(a)
 
+/* Debug messages are only written with LOGERR_DEBUG,
+ * so don't format or send them anywhere otherwise. */
+#ifdef LOGERR_NODEBUG
+#define	LOGERR_SKIP(ctx, pri)	((pri) == LOG_DEBUG)
+#else
+#define	LOGERR_SKIP(ctx, pri)	\
+	((pri) == LOG_DEBUG && !((ctx)->log_opts & LOGERR_DEBUG))
+#endif
+
+#ifndef SMALL
+/*
+ * With LOGERR_BUFFER, whole lines are held until logflush() so each
+ * destination gets one write per batch.
+ * No more than PIPE_BUF so a batch is not split by other writers.
+ */
+#define	LOGERR_BUFSIZ		PIPE_BUF
+struct logbuf {
+	char		*lb_buf;
+	size_t		 lb_len;
+};
+
+/*
+ * Rate limiting is per call site, keyed on the file and line.
+ * Sites which hash to the same slot just take it over.
+ */
+#define	LOGERR_RLSITES		61	/* prime to spread string addresses */
+struct logrl {
+	const char	*rl_file;
+	int		 rl_line;
+	time_t		 rl_sec;
+	unsigned int	 rl_count;
+	unsigned int	 rl_dropped;
+	int		 rl_pri;
+	char		 rl_text[128];	/* first dropped message */
+};
+#endif
+
 struct logctx {
 	char		 log_buf[BUFSIZ];
 	unsigned int	 log_opts;
@@ -62,6 +101,14 @@ struct logctx {
 #ifdef LOGERR_TAG
 	const char	*log_tag;
 #endif
+	time_t		 log_datesec;	/* log_date is for this second */
+	char		 log_date[32];
+	struct logbuf	 log_errbuf;
+	struct logbuf	 log_filebuf;
+	struct logbuf	 log_fdbuf;
+	unsigned int	 log_ratelimit;	/* per site, per second */
+	unsigned int	 log_rlpending;	/* sites with a summary to log */
+	struct logrl	*log_rl;
 #endif
 };
 
@@ -102,82 +149,213 @@ getprogname(void)
 #endif
 
 #ifndef SMALL
-/* Write the time, syslog style. month day time - */
-static int
-logprintdate(FILE *stream)
+/* The time, syslog style. month day time -
+ * Only formatted again when the second changes. */
+static const char *
+logdate(struct logctx *ctx)
 {
 	struct timeval tv;
-	time_t now;
 	struct tm tmnow;
-	char buf[32];
 
 	if (gettimeofday(&tv, NULL) == -1)
-		return -1;
+		return NULL;
+	if (tv.tv_sec == ctx->log_datesec && ctx->log_date[0] != '\0')
+		return ctx->log_date;
 
-	now = tv.tv_sec;
-	if (localtime_r(&now, &tmnow) == NULL)
-		return -1;
-	if (strftime(buf, sizeof(buf), "%b %d %T ", &tmnow) == 0)
-		return -1;
-	return fprintf(stream, "%s", buf);
+	if (localtime_r(&tv.tv_sec, &tmnow) == NULL ||
+	    strftime(ctx->log_date, sizeof(ctx->log_date),
+	    "%b %d %T ", &tmnow) == 0)
+	{
+		ctx->log_date[0] = '\0';
+		return NULL;
+	}
+	ctx->log_datesec = tv.tv_sec;
+	return ctx->log_date;
 }
-#endif
 
-__printflike(3, 0) static int
-vlogprintf_r(struct logctx *ctx, FILE *stream, const char *fmt, va_list args)
+/* Write the date, tag and pid to buf, returning the length. */
+static int
+logprefix(struct logctx *ctx, bool err, char *buf, size_t buflen)
 {
-	int len = 0, e;
-	va_list a;
-#ifndef SMALL
+	const char *date;
 	bool log_pid;
+	size_t len = 0;
+	int e;
 #ifdef LOGERR_TAG
 	bool log_tag;
 #endif
 
-	if ((stream == stderr && ctx->log_opts & LOGERR_ERR_DATE) ||
-	    (stream != stderr && ctx->log_opts & LOGERR_LOG_DATE))
-	{
-		if ((e = logprintdate(stream)) == -1)
+	buf[0] = '\0';
+	if (ctx->log_opts & (err ? LOGERR_ERR_DATE : LOGERR_LOG_DATE)) {
+		if ((date = logdate(ctx)) == NULL)
 			return -1;
-		len += e;
+		len = strlen(date);
+		if (len >= buflen) {
+			errno = ENOBUFS;
+			return -1;
+		}
+		memcpy(buf, date, len + 1);
 	}
 
 #ifdef LOGERR_TAG
-	log_tag = ((stream == stderr && ctx->log_opts & LOGERR_ERR_TAG) ||
-	    (stream != stderr && ctx->log_opts & LOGERR_LOG_TAG));
+	log_tag = ctx->log_opts & (err ? LOGERR_ERR_TAG : LOGERR_LOG_TAG);
 	if (log_tag) {
 		if (ctx->log_tag == NULL)
 			ctx->log_tag = getprogname();
-		if ((e = fprintf(stream, "%s", ctx->log_tag)) == -1)
+		if ((e = snprintf(buf + len, buflen - len, "%s",
+		    ctx->log_tag)) == -1)
 			return -1;
-		len += e;
+		len += (size_t)e;
 	}
 #endif
 
-	log_pid = ((stream == stderr && ctx->log_opts & LOGERR_ERR_PID) ||
-	    (stream != stderr && ctx->log_opts & LOGERR_LOG_PID));
-	if (log_pid) {
+	log_pid = ctx->log_opts & (err ? LOGERR_ERR_PID : LOGERR_LOG_PID);
+	if (log_pid && len < buflen) {
 		pid_t pid;
 
 		if (ctx->log_pid == 0)
 			pid = getpid();
 		else
 			pid = ctx->log_pid;
-		if ((e = fprintf(stream, "[%d]", pid)) == -1)
+		if ((e = snprintf(buf + len, buflen - len, "[%d]", pid)) == -1)
 			return -1;
-		len += e;
+		len += (size_t)e;
 	}
 
 #ifdef LOGERR_TAG
-	if (log_tag || log_pid)
+	if ((log_tag || log_pid) && len < buflen)
 #else
-	if (log_pid)
+	if (log_pid && len < buflen)
 #endif
 	{
-		if ((e = fprintf(stream, ": ")) == -1)
+		if ((e = snprintf(buf + len, buflen - len, ": ")) == -1)
+			return -1;
+		len += (size_t)e;
+	}
+
+	if (len >= buflen) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	return (int)len;
+}
+
+/* Write out as much of the buffer as fd will take. */
+static int
+logbuf_flush(struct logbuf *lb, int fd)
+{
+	ssize_t n;
+
+	while (lb->lb_len != 0) {
+		n = write(fd, lb->lb_buf, lb->lb_len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			/* Keep it for next time if fd is just busy. */
+			if (errno != EAGAIN)
+				lb->lb_len = 0;
+			return -1;
+		}
+		if ((size_t)n < lb->lb_len)
+			memmove(lb->lb_buf, lb->lb_buf + n,
+			    lb->lb_len - (size_t)n);
+		lb->lb_len -= (size_t)n;
+	}
+	return 0;
+}
+
+/* Add data to the buffer, writing it out first if there's no room.
+ * Returns 1 if data can never fit. */
+static int
+logbuf_add(struct logbuf *lb, int fd, const void *data, size_t len)
+{
+
+	if (len > LOGERR_BUFSIZ)
+		return 1;
+	if (lb->lb_buf == NULL &&
+	    (lb->lb_buf = malloc(LOGERR_BUFSIZ)) == NULL)
+		return -1;
+	if (LOGERR_BUFSIZ - lb->lb_len < len &&
+	    logbuf_flush(lb, fd) == -1)
+		return -1;
+	memcpy(lb->lb_buf + lb->lb_len, data, len);
+	lb->lb_len += len;
+	return 0;
+}
+
+static void
+logbuf_flushall(struct logctx *ctx)
+{
+
+	if (ctx->log_errbuf.lb_len != 0)
+		logbuf_flush(&ctx->log_errbuf, fileno(stderr));
+	if (ctx->log_filebuf.lb_len != 0 && ctx->log_file != NULL)
+		logbuf_flush(&ctx->log_filebuf, fileno(ctx->log_file));
+	if (ctx->log_fdbuf.lb_len != 0 && ctx->log_fd != -1)
+		logbuf_flush(&ctx->log_fdbuf, ctx->log_fd);
+}
+
+static void
+logbuf_free(struct logbuf *lb)
+{
+
+	free(lb->lb_buf);
+	lb->lb_buf = NULL;
+	lb->lb_len = 0;
+}
+
+__printflike(4, 0) static int
+vlogbuf_printf(struct logbuf *lb, int fd, const char *prefix,
+    const char *fmt, va_list args)
+{
+	char line[LOGERR_BUFSIZ];
+	int len, e;
+	va_list a;
+
+	len = snprintf(line, sizeof(line), "%s", prefix);
+	if (len == -1 || (size_t)len >= sizeof(line))
+		return 1;
+	va_copy(a, args);
+	e = vsnprintf(line + len, sizeof(line) - (size_t)len, fmt, a);
+	va_end(a);
+	if (e == -1)
+		return -1;
+	len += e;
+	/* Room for the newline, the NUL is not written. */
+	if ((size_t)len >= sizeof(line) - 1)
+		return 1;
+	line[len++] = '\n';
+
+	e = logbuf_add(lb, fd, line, (size_t)len);
+	return e == 0 ? len : e;
+}
+#endif
+
+__printflike(3, 0) static int
+vlogprintf_r(struct logctx *ctx, FILE *stream, const char *fmt, va_list args)
+{
+	int len = 0, e;
+	va_list a;
+#ifndef SMALL
+	char prefix[128];
+	struct logbuf *lb;
+
+	if ((len = logprefix(ctx, stream == stderr,
+	    prefix, sizeof(prefix))) == -1)
+		return -1;
+
+	if (ctx->log_opts & LOGERR_BUFFER) {
+		lb = stream == stderr ? &ctx->log_errbuf : &ctx->log_filebuf;
+		e = vlogbuf_printf(lb, fileno(stream), prefix, fmt, args);
+		if (e != 1)
+			return e;
+		/* Too long to buffer, so keep it in order. */
+		if (logbuf_flush(lb, fileno(stream)) == -1)
 			return -1;
-		len += e;
 	}
+
+	if (len != 0 && fputs(prefix, stream) == EOF)
+		return -1;
 #else
 	UNUSED(ctx);
 #endif
@@ -209,7 +387,7 @@ vlogprintf_r(struct logctx *ctx, FILE *stream, const char *fmt, va_list args)
 #pragma GCC diagnostic ignored "-Wmissing-format-attribute"
 #endif
 __printflike(2, 0) static int
-vlogmessage(int pri, const char *fmt, va_list args)
+vlogmessage_r(int pri, const char *fmt, va_list args)
 {
 	struct logctx *ctx = &_logctx;
 	int len = 0;
@@ -224,10 +402,24 @@ vlogmessage(int pri, const char *fmt, va_list args)
 		len = vsnprintf(buf + sizeof(pri) + sizeof(pid),
 		    sizeof(buf) - sizeof(pri) - sizeof(pid),
 		    fmt, args);
-		if (len != -1)
-			len = (int)write(ctx->log_fd, buf,
-			    ((size_t)++len) + sizeof(pri) + sizeof(pid));
-		return len;
+		if (len == -1)
+			return -1;
+		/* vsnprintf may have truncated */
+		if ((size_t)len >= sizeof(buf) - sizeof(pri) - sizeof(pid))
+			len = (int)(sizeof(buf) - sizeof(pri) - sizeof(pid)) - 1;
+		len += 1 + (int)(sizeof(pri) + sizeof(pid));
+#ifndef SMALL
+		/* Several records can go to logreadfd in one message. */
+		if (ctx->log_opts & LOGERR_BUFFER) {
+			if (logbuf_add(&ctx->log_fdbuf, ctx->log_fd,
+			    buf, (size_t)len) == -1)
+				return -1;
+			if (pri <= LOG_ERR)
+				logbuf_flush(&ctx->log_fdbuf, ctx->log_fd);
+			return len;
+		}
+#endif
+		return (int)write(ctx->log_fd, buf, (size_t)len);
 	}
 
 	if (ctx->log_opts & LOGERR_ERR &&
@@ -245,120 +437,249 @@ vlogmessage(int pri, const char *fmt, va_list args)
 	if (ctx->log_opts & LOGERR_LOG)
 		vsyslog(pri, fmt, args);
 
+#ifndef SMALL
+	/* Don't hold back errors. */
+	if (pri <= LOG_ERR && ctx->log_opts & LOGERR_BUFFER)
+		logbuf_flushall(ctx);
+#endif
+
 	return len;
 }
 #if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ > 5))
 #pragma GCC diagnostic pop
 #endif
 
-__printflike(2, 3) void
-logmessage(int pri, const char *fmt, ...)
+/* Logs without rate limiting. */
+__printflike(2, 3) static void
+logmessage_r(int pri, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vlogmessage(pri, fmt, args);
+	vlogmessage_r(pri, fmt, args);
 	va_end(args);
 }
 
-__printflike(2, 0) static void
-vlogerrmessage(int pri, const char *fmt, va_list args)
+#ifndef SMALL
+static void
+logrl_summary(struct logctx *ctx, struct logrl *rl)
+{
+	unsigned int dropped = rl->rl_dropped;
+
+	/* Cleared first as logging may flush other summaries. */
+	rl->rl_dropped = 0;
+	ctx->log_rlpending--;
+	logmessage_r(rl->rl_pri, "suppressed %u messages like: %s",
+	    dropped, rl->rl_text);
+}
+
+/* Log a summary for each site whose second is up, or all of them. */
+static void
+logrl_expire(struct logctx *ctx, bool all)
+{
+	struct timespec ts;
+	struct logrl *rl;
+	size_t i;
+
+	if (ctx->log_rlpending == 0)
+		return;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		all = true;
+
+	for (i = 0; i < LOGERR_RLSITES && ctx->log_rlpending != 0; i++) {
+		rl = &ctx->log_rl[i];
+		if (rl->rl_dropped != 0 && (all || rl->rl_sec != ts.tv_sec))
+			logrl_summary(ctx, rl);
+	}
+}
+
+/*
+ * Returns true if this call site has already logged log_ratelimit
+ * messages this second.
+ * Only the first dropped message is formatted, for the summary.
+ */
+__printflike(6, 0) static bool
+logratelimited(struct logctx *ctx, const char *file, int line,
+    int pri, int err, const char *fmt, va_list args)
+{
+	struct timespec ts;
+	struct logrl *rl;
+	va_list a;
+	int len;
+
+	if (ctx->log_ratelimit == 0 ||
+	    clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return false;
+
+	rl = &ctx->log_rl[((uintptr_t)file + (unsigned int)line) %
+	    LOGERR_RLSITES];
+	if (rl->rl_file != file || rl->rl_line != line ||
+	    rl->rl_sec != ts.tv_sec)
+	{
+		if (rl->rl_dropped != 0)
+			logrl_summary(ctx, rl);
+		rl->rl_file = file;
+		rl->rl_line = line;
+		rl->rl_sec = ts.tv_sec;
+		rl->rl_count = 0;
+	}
+	if (rl->rl_count < ctx->log_ratelimit) {
+		rl->rl_count++;
+		return false;
+	}
+
+	if (rl->rl_dropped++ == 0) {
+		ctx->log_rlpending++;
+		rl->rl_pri = pri;
+		va_copy(a, args);
+		len = vsnprintf(rl->rl_text, sizeof(rl->rl_text), fmt, a);
+		va_end(a);
+		if (err != 0 && len != -1 && (size_t)len < sizeof(rl->rl_text))
+			snprintf(rl->rl_text + len,
+			    sizeof(rl->rl_text) - (size_t)len,
+			    ": %s", strerror(err));
+	}
+	return true;
+}
+#endif
+
+__printflike(4, 0) static int
+vlogmessage(const char *file, int line, int pri, const char *fmt,
+    va_list args)
+{
+
+	if (LOGERR_SKIP(&_logctx, pri))
+		return 0;
+#ifndef SMALL
+	if (logratelimited(&_logctx, file, line, pri, 0, fmt, args))
+		return 0;
+#else
+	UNUSED(file);
+	UNUSED(line);
+#endif
+	return vlogmessage_r(pri, fmt, args);
+}
+
+__printflike(4, 5) void
+log_message(const char *file, int line, int pri, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vlogmessage(file, line, pri, fmt, args);
+	va_end(args);
+}
+
+__printflike(4, 0) static void
+vlogerrmessage(const char *file, int line, int pri, const char *fmt,
+    va_list args)
 {
 	int _errno = errno;
 	char buf[1024];
 
+	if (LOGERR_SKIP(&_logctx, pri))
+		return;
+#ifndef SMALL
+	if (logratelimited(&_logctx, file, line, pri, _errno, fmt, args)) {
+		errno = _errno;
+		return;
+	}
+#else
+	UNUSED(file);
+	UNUSED(line);
+#endif
 	vsnprintf(buf, sizeof(buf), fmt, args);
-	logmessage(pri, "%s: %s", buf, strerror(_errno));
+	logmessage_r(pri, "%s: %s", buf, strerror(_errno));
 	errno = _errno;
 }
 
-__printflike(2, 3) void
-logerrmessage(int pri, const char *fmt, ...)
+__printflike(4, 5) void
+log_errmessage(const char *file, int line, int pri, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vlogerrmessage(pri, fmt, args);
+	vlogerrmessage(file, line, pri, fmt, args);
 	va_end(args);
 }
 
 void
-log_debug(const char *fmt, ...)
+log_debug(const char *file, int line, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vlogerrmessage(LOG_DEBUG, fmt, args);
+	vlogerrmessage(file, line, LOG_DEBUG, fmt, args);
 	va_end(args);
 }
 
 void
-log_debugx(const char *fmt, ...)
+log_debugx(const char *file, int line, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vlogmessage(LOG_DEBUG, fmt, args);
+	vlogmessage(file, line, LOG_DEBUG, fmt, args);
 	va_end(args);
 }
 
 void
-log_info(const char *fmt, ...)
+log_info(const char *file, int line, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vlogerrmessage(LOG_INFO, fmt, args);
+	vlogerrmessage(file, line, LOG_INFO, fmt, args);
 	va_end(args);
 }
 
 void
-log_infox(const char *fmt, ...)
+log_infox(const char *file, int line, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vlogmessage(LOG_INFO, fmt, args);
+	vlogmessage(file, line, LOG_INFO, fmt, args);
 	va_end(args);
 }
 
 void
-log_warn(const char *fmt, ...)
+log_warn(const char *file, int line, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vlogerrmessage(LOG_WARNING, fmt, args);
+	vlogerrmessage(file, line, LOG_WARNING, fmt, args);
 	va_end(args);
 }
 
 void
-log_warnx(const char *fmt, ...)
+log_warnx(const char *file, int line, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vlogmessage(LOG_WARNING, fmt, args);
+	vlogmessage(file, line, LOG_WARNING, fmt, args);
 	va_end(args);
 }
 
 void
-log_err(const char *fmt, ...)
+log_err(const char *file, int line, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vlogerrmessage(LOG_ERR, fmt, args);
+	vlogerrmessage(file, line, LOG_ERR, fmt, args);
 	va_end(args);
 }
 
 void
-log_errx(const char *fmt, ...)
+log_errx(const char *file, int line, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vlogmessage(LOG_ERR, fmt, args);
+	vlogmessage(file, line, LOG_ERR, fmt, args);
 	va_end(args);
 }
 
@@ -375,6 +696,7 @@ logsetfd(int fd)
 {
 	struct logctx *ctx = &_logctx;
 
+	logflush();
 	ctx->log_fd = fd;
 #ifndef SMALL
 	if (fd != -1 && ctx->log_file != NULL) {
@@ -388,24 +710,36 @@ int
 logreadfd(int fd)
 {
 	struct logctx *ctx = &_logctx;
+#ifndef SMALL
+	char buf[LOGERR_BUFSIZ];
+#else
 	char buf[LOGERR_SYSLOGBUF];
+#endif
+	char *p, *msg, *end;
 	int len, pri;
+	size_t hdrlen = sizeof(pri) + sizeof(ctx->log_pid);
 
 	len = (int)read(fd, buf, sizeof(buf));
 	if (len == -1)
 		return -1;
 
-	/* Ensure we have pri, pid and a terminator */
-	if (len < (int)(sizeof(pri) + sizeof(pid_t) + 1) ||
-	    buf[len - 1] != '\0')
-	{
+	/* Ensure we have pri, pid and a terminator for each record */
+	if (len < (int)(hdrlen + 1) || buf[len - 1] != '\0') {
 		errno = EINVAL;
 		return -1;
 	}
 
-	memcpy(&pri, buf, sizeof(pri));
-	memcpy(&ctx->log_pid, buf + sizeof(pri), sizeof(ctx->log_pid));
-	logmessage(pri, "%s", buf + sizeof(pri) + sizeof(ctx->log_pid));
+	for (p = buf, end = buf + len; p < end; p = msg + strlen(msg) + 1) {
+		if ((size_t)(end - p) < hdrlen + 1) {
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(&pri, p, sizeof(pri));
+		memcpy(&ctx->log_pid, p + sizeof(pri), sizeof(ctx->log_pid));
+		msg = p + hdrlen;
+		/* Already rate limited by the sender. */
+		logmessage_r(pri, "%s", msg);
+	}
 	ctx->log_pid = 0;
 	return len;
 }
@@ -423,10 +757,42 @@ logsetopts(unsigned int opts)
 {
 	struct logctx *ctx = &_logctx;
 
+	logflush();
 	ctx->log_opts = opts;
 	setlogmask(LOG_UPTO(opts & LOGERR_DEBUG ? LOG_DEBUG : LOG_INFO));
 }
 
+void
+logflush(void)
+{
+#ifndef SMALL
+	struct logctx *ctx = &_logctx;
+
+	logrl_expire(ctx, false);
+	logbuf_flushall(ctx);
+#endif
+}
+
+int
+logsetratelimit(unsigned int limit)
+{
+#ifndef SMALL
+	struct logctx *ctx = &_logctx;
+
+	if (limit != 0 && ctx->log_rl == NULL &&
+	    (ctx->log_rl = calloc(LOGERR_RLSITES, sizeof(*ctx->log_rl))) == NULL)
+		return -1;
+	logrl_expire(ctx, true);
+	ctx->log_ratelimit = limit;
+	return 0;
+#else
+	if (limit == 0)
+		return 0;
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
 #ifdef LOGERR_TAG
 void
 logsettag(const char *tag)
@@ -454,6 +820,7 @@ logopen(const char *path)
 
 #ifndef SMALL
 	if (ctx->log_file != NULL) {
+		logflush();
 		fclose(ctx->log_file);
 		ctx->log_file = NULL;
 	}
@@ -481,6 +848,17 @@ logclose(void)
 {
 #ifndef SMALL
 	struct logctx *ctx = &_logctx;
+
+	/* Anything logged from now on is written at once. */
+	logrl_expire(ctx, true);
+	ctx->log_ratelimit = 0;
+	free(ctx->log_rl);
+	ctx->log_rl = NULL;
+	logbuf_flushall(ctx);
+	ctx->log_opts &= ~LOGERR_BUFFER;
+	logbuf_free(&ctx->log_errbuf);
+	logbuf_free(&ctx->log_filebuf);
+	logbuf_free(&ctx->log_fdbuf);
 #endif
 
 	closelog();
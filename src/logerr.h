@@ -39,19 +39,24 @@
 #endif
 #endif /* !__printflike */
 
+/* The call site, which messages are rate limited by. */
+#define	LOGERR_SITE	__FILE__, __LINE__
+
 /* Please do not call log_* functions directly, use macros below */
-__printflike(1, 2) void log_debug(const char *, ...);
-__printflike(1, 2) void log_debugx(const char *, ...);
-__printflike(1, 2) void log_info(const char *, ...);
-__printflike(1, 2) void log_infox(const char *, ...);
-__printflike(1, 2) void log_warn(const char *, ...);
-__printflike(1, 2) void log_warnx(const char *, ...);
-__printflike(1, 2) void log_err(const char *, ...);
-__printflike(1, 2) void log_errx(const char *, ...);
+__printflike(3, 4) void log_debug(const char *, int, const char *, ...);
+__printflike(3, 4) void log_debugx(const char *, int, const char *, ...);
+__printflike(3, 4) void log_info(const char *, int, const char *, ...);
+__printflike(3, 4) void log_infox(const char *, int, const char *, ...);
+__printflike(3, 4) void log_warn(const char *, int, const char *, ...);
+__printflike(3, 4) void log_warnx(const char *, int, const char *, ...);
+__printflike(3, 4) void log_err(const char *, int, const char *, ...);
+__printflike(3, 4) void log_errx(const char *, int, const char *, ...);
 #define	LOGERROR	logerr("%s: %d", __FILE__, __LINE__)
 
-__printflike(2, 3) void logmessage(int pri, const char *fmt, ...);
-__printflike(2, 3) void logerrmessage(int pri, const char *fmt, ...);
+__printflike(4, 5) void log_message(const char *, int,
+    int pri, const char *fmt, ...);
+__printflike(4, 5) void log_errmessage(const char *, int,
+    int pri, const char *fmt, ...);
 
 /*
  * These are macros to prevent taking address of them so
@@ -67,14 +72,33 @@ __printflike(2, 3) void logerrmessage(int pri, const char *fmt, ...);
  * The solution is to put fmt into __VA_ARGS__.
  * It's not pretty but it's 100% portable.
  */
-#define logdebug(...)	log_debug(__VA_ARGS__)
-#define logdebugx(...)	log_debugx(__VA_ARGS__)
-#define loginfo(...)	log_info(__VA_ARGS__)
-#define loginfox(...)	log_infox(__VA_ARGS__)
-#define logwarn(...)	log_warn(__VA_ARGS__)
-#define logwarnx(...)	log_warnx(__VA_ARGS__)
-#define logerr(...)	log_err(__VA_ARGS__)
-#define logerrx(...)	log_errx(__VA_ARGS__)
+#define logdebug(...)	do {						\
+	if (logdebugenabled())						\
+		log_debug(LOGERR_SITE, __VA_ARGS__);			\
+} while (0 /* CONSTCOND */)
+#define logdebugx(...)	do {						\
+	if (logdebugenabled())						\
+		log_debugx(LOGERR_SITE, __VA_ARGS__);			\
+} while (0 /* CONSTCOND */)
+#define loginfo(...)	log_info(LOGERR_SITE, __VA_ARGS__)
+#define loginfox(...)	log_infox(LOGERR_SITE, __VA_ARGS__)
+#define logwarn(...)	log_warn(LOGERR_SITE, __VA_ARGS__)
+#define logwarnx(...)	log_warnx(LOGERR_SITE, __VA_ARGS__)
+#define logerr(...)	log_err(LOGERR_SITE, __VA_ARGS__)
+#define logerrx(...)	log_errx(LOGERR_SITE, __VA_ARGS__)
+#define logmessage(...)	log_message(LOGERR_SITE, __VA_ARGS__)
+#define logerrmessage(...)	log_errmessage(LOGERR_SITE, __VA_ARGS__)
+
+/*
+ * Test this before building anything only needed for a debug message.
+ * The logdebug macros test it before evaluating their arguments.
+ * LOGERR_NODEBUG (configure --disable-logdebug) compiles them out.
+ */
+#ifdef LOGERR_NODEBUG
+#define	logdebugenabled()	(0)
+#else
+#define	logdebugenabled()	(loggetopts() & LOGERR_DEBUG)
+#endif
 
 /* For logging in a chroot */
 int loggetfd(void);
@@ -83,8 +107,13 @@ int logreadfd(int);
 
 unsigned int loggetopts(void);
 void logsetopts(unsigned int);
+/* Write out buffered lines, errors are never held. */
+void logflush(void);
+/* Messages per call site per second, 0 for no limit. */
+int logsetratelimit(unsigned int);
 #define	LOGERR_DEBUG	(1U << 6)
 #define	LOGERR_QUIET	(1U << 7)
+#define	LOGERR_BUFFER	(1U << 8)	/* hold lines until logflush */
 #define	LOGERR_LOG	(1U << 11)
 #define	LOGERR_LOG_DATE	(1U << 12)
 #define	LOGERR_LOG_HOST	(1U << 13)
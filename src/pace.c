@@ -0,0 +1,273 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "common.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "logerr.h"
+#include "pace.h"
+
+/*
+ * When start_rate is set, solicitations and DHCP starts are held to that
+ * many per second, with up to a second's worth allowed at once.
+ * Starts held back are queued by interface metric so the preferred
+ * interfaces get configured first.
+ */
+struct pace {
+	TAILQ_ENTRY(pace) next;
+	struct interface *ifp;
+	void (*callback)(void *);
+};
+
+static unsigned long long
+pace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * NSEC_PER_SEC +
+	    (unsigned long long)ts.tv_nsec;
+}
+
+/* Each start moves pace_tat on by one interval and is allowed
+ * while pace_tat is no more than a second ahead of now. */
+static bool
+pace_take(struct dhcpcd_ctx *ctx, unsigned long long *wait)
+{
+	unsigned long long now, interval, burst;
+
+	now = pace_now();
+	interval = NSEC_PER_SEC / ctx->start_rate;
+	if (interval == 0)
+		interval = 1;
+	burst = NSEC_PER_SEC - interval;
+
+	if (ctx->pace_tat < now)
+		ctx->pace_tat = now;
+	if (ctx->pace_tat - now > burst) {
+		*wait = ctx->pace_tat - now - burst;
+		return false;
+	}
+	ctx->pace_tat += interval;
+	return true;
+}
+
+static void pace_run(void *);
+
+static void
+pace_wait(struct dhcpcd_ctx *ctx, unsigned long long wait)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)(wait / NSEC_PER_SEC);
+	ts.tv_nsec = (long)(wait % NSEC_PER_SEC);
+	if (eloop_timeout_add_tv(ctx->eloop, &ts, pace_run, ctx) == -1)
+		logerr(__func__);
+}
+
+static void
+pace_run(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct pace *p;
+	struct interface *ifp;
+	void (*callback)(void *);
+	unsigned long long wait;
+
+	while ((p = TAILQ_FIRST(&ctx->pace_queue)) != NULL) {
+		if (!pace_take(ctx, &wait)) {
+			pace_wait(ctx, wait);
+			return;
+		}
+		TAILQ_REMOVE(&ctx->pace_queue, p, next);
+		ifp = p->ifp;
+		callback = p->callback;
+		free(p);
+
+		/* The callback asks pace_start again, so let it through. */
+		ctx->pace_ifp = ifp;
+		ctx->pace_cb = callback;
+		callback(ifp);
+		ctx->pace_ifp = NULL;
+		ctx->pace_cb = NULL;
+	}
+}
+
+/*
+ * Returns true if the start can go ahead now.
+ * Otherwise callback is called with ifp when it can.
+ */
+bool
+pace_start(struct interface *ifp, void (*callback)(void *))
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct pace *p, *pn;
+	unsigned long long wait;
+
+	if (ctx->start_rate == 0)
+		return true;
+
+	if (ctx->pace_ifp == ifp && ctx->pace_cb == callback) {
+		ctx->pace_ifp = NULL;
+		ctx->pace_cb = NULL;
+		return true;
+	}
+
+	TAILQ_FOREACH(p, &ctx->pace_queue, next) {
+		if (p->ifp == ifp && p->callback == callback)
+			return false;
+	}
+
+	if (TAILQ_FIRST(&ctx->pace_queue) == NULL && pace_take(ctx, &wait))
+		return true;
+
+	if ((p = malloc(sizeof(*p))) == NULL) {
+		logerr(__func__);
+		return true;
+	}
+	p->ifp = ifp;
+	p->callback = callback;
+
+	TAILQ_FOREACH(pn, &ctx->pace_queue, next) {
+		if (pn->ifp->metric > ifp->metric)
+			break;
+	}
+	if (pn != NULL)
+		TAILQ_INSERT_BEFORE(pn, p, next);
+	else {
+		if (TAILQ_FIRST(&ctx->pace_queue) == NULL)
+			pace_wait(ctx, wait);
+		TAILQ_INSERT_TAIL(&ctx->pace_queue, p, next);
+	}
+
+	logdebugx("%s: pacing start", ifp->name);
+	return false;
+}
+
+/*
+ * Interface starts are run start_jobs at a time, then the event loop
+ * polls before the next lot so that replies, script exits and privsep
+ * results for the interfaces already started are not held up by the
+ * ones still to start.
+ */
+static void
+pace_runstarts(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct pace *p;
+	unsigned int n;
+
+	for (n = 0; ctx->start_jobs == 0 || n < ctx->start_jobs; n++) {
+		if ((p = TAILQ_FIRST(&ctx->start_queue)) == NULL)
+			return;
+		TAILQ_REMOVE(&ctx->start_queue, p, next);
+		p->callback(p->ifp);
+		free(p);
+	}
+
+	/* A zero timeout would run before the next poll. */
+	if (TAILQ_FIRST(&ctx->start_queue) != NULL &&
+	    eloop_timeout_add_msec(ctx->eloop, 1, pace_runstarts, ctx) == -1)
+		logerr(__func__);
+}
+
+/* Queue callback to start ifp from the event loop. */
+void
+pace_queuestart(struct interface *ifp, void (*callback)(void *))
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct pace *p;
+
+	TAILQ_FOREACH(p, &ctx->start_queue, next) {
+		if (p->ifp == ifp && p->callback == callback)
+			return;
+	}
+
+	if ((p = malloc(sizeof(*p))) == NULL) {
+		logerr(__func__);
+		return;
+	}
+	p->ifp = ifp;
+	p->callback = callback;
+	if (TAILQ_FIRST(&ctx->start_queue) == NULL &&
+	    eloop_timeout_add_sec(ctx->eloop, 0, pace_runstarts, ctx) == -1)
+	{
+		logerr(__func__);
+		free(p);
+		return;
+	}
+	TAILQ_INSERT_TAIL(&ctx->start_queue, p, next);
+}
+
+/* Forget a start held back for ifp, or all of them if callback is NULL. */
+void
+pace_delete(struct interface *ifp, void (*callback)(void *))
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct pace *p, *pn;
+
+	TAILQ_FOREACH_SAFE(p, &ctx->pace_queue, next, pn) {
+		if (p->ifp == ifp &&
+		    (callback == NULL || p->callback == callback))
+		{
+			TAILQ_REMOVE(&ctx->pace_queue, p, next);
+			free(p);
+		}
+	}
+	if (TAILQ_FIRST(&ctx->pace_queue) == NULL && ctx->eloop != NULL)
+		eloop_timeout_delete(ctx->eloop, pace_run, ctx);
+
+	TAILQ_FOREACH_SAFE(p, &ctx->start_queue, next, pn) {
+		if (p->ifp == ifp &&
+		    (callback == NULL || p->callback == callback))
+		{
+			TAILQ_REMOVE(&ctx->start_queue, p, next);
+			free(p);
+		}
+	}
+	if (TAILQ_FIRST(&ctx->start_queue) == NULL && ctx->eloop != NULL)
+		eloop_timeout_delete(ctx->eloop, pace_runstarts, ctx);
+}
+
+void
+pace_free(struct dhcpcd_ctx *ctx)
+{
+	struct pace *p;
+
+	while ((p = TAILQ_FIRST(&ctx->pace_queue)) != NULL) {
+		TAILQ_REMOVE(&ctx->pace_queue, p, next);
+		free(p);
+	}
+	while ((p = TAILQ_FIRST(&ctx->start_queue)) != NULL) {
+		TAILQ_REMOVE(&ctx->start_queue, p, next);
+		free(p);
+	}
+}
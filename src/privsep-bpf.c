@@ -40,6 +40,7 @@
 #include <assert.h>
 #include <pwd.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -53,46 +54,48 @@
 #include "logerr.h"
 #include "privsep.h"
 
+/* Forward each frame read from *bpfp to the manager.
+ * If the interface departs, *bpfp is closed and set to NULL. */
 static void
-ps_bpf_recvbpf(void *arg, unsigned short events)
+ps_bpf_readbpf(struct dhcpcd_ctx *ctx, const struct ps_id *psid,
+    const char *ifname, struct bpf **bpfp)
 {
-	struct ps_process *psp = arg;
-	struct bpf *bpf = psp->psp_bpf;
-	uint8_t buf[FRAMELEN_MAX];
+	struct bpf *bpf = *bpfp;
+	const void *frame;
 	ssize_t len;
 	struct ps_msghdr psm = {
-		.ps_id = psp->psp_id,
-		.ps_cmd = psp->psp_id.psi_cmd,
+		.ps_id = *psid,
+		.ps_cmd = psid->psi_cmd,
 	};
 
-	if (events != ELE_READ)
-		logerrx("%s: unexpected event 0x%04x", __func__, events);
-
 	bpf->bpf_flags &= ~BPF_EOF;
 	/* A BPF read can read more than one filtered packet at time.
 	 * This mechanism allows us to read each packet from the buffer. */
 	while (!(bpf->bpf_flags & BPF_EOF)) {
-		len = bpf_read(bpf, buf, sizeof(buf));
+		/* Send straight from the BPF buffer to save a copy. */
+		len = bpf_readframe(bpf, &frame);
 		if (len == -1) {
 			int error = errno;
 
 			if (errno != ENETDOWN)
-				logerr("%s: %s", psp->psp_ifname, __func__);
+				logerr("%s: %s", ifname, __func__);
 			if (error != ENXIO)
 				break;
 			/* If the interface has departed, close the BPF
 			 * socket. This stops log spam if RTM_IFANNOUNCE is
 			 * delayed in announcing the departing interface. */
-			eloop_event_delete(psp->psp_ctx->eloop, bpf->bpf_fd);
+			eloop_event_delete(ctx->eloop, bpf->bpf_fd);
 			bpf_close(bpf);
-			psp->psp_bpf = NULL;
+			*bpfp = NULL;
 			break;
 		}
 		if (len == 0)
 			break;
+		if ((size_t)len > FRAMELEN_MAX)
+			len = FRAMELEN_MAX;
 		psm.ps_flags = bpf->bpf_flags;
-		len = ps_sendpsmdata(psp->psp_ctx, psp->psp_ctx->ps_data_fd,
-		    &psm, buf, (size_t)len);
+		len = ps_sendpsmdata(ctx, ctx->ps_data_fd,
+		    &psm, frame, (size_t)len);
 		if (len == -1)
 			logerr(__func__);
 		if (len == -1 || len == 0)
@@ -100,6 +103,18 @@ ps_bpf_recvbpf(void *arg, unsigned short events)
 	}
 }
 
+static void
+ps_bpf_recvbpf(void *arg, unsigned short events)
+{
+	struct ps_process *psp = arg;
+
+	if (events != ELE_READ)
+		logerrx("%s: unexpected event 0x%04x", __func__, events);
+
+	ps_bpf_readbpf(psp->psp_ctx, &psp->psp_id, psp->psp_ifname,
+	    &psp->psp_bpf);
+}
+
 static ssize_t
 ps_bpf_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 {
@@ -143,31 +158,41 @@ ps_bpf_recvmsg(void *arg, unsigned short events)
 		logerr(__func__);
 }
 
-static int
-ps_bpf_start_bpf(struct ps_process *psp)
+static void
+ps_bpf_settitle(struct ps_process *psp)
 {
-	struct dhcpcd_ctx *ctx = psp->psp_ctx;
-	char *addr;
 	struct in_addr *ia = &psp->psp_id.psi_addr.psa_in_addr;
+	char *addr;
 
-	if (ia->s_addr == INADDR_ANY) {
-		ia = NULL;
+	if (ia->s_addr == INADDR_ANY)
 		addr = NULL;
-	} else
+	else
 		addr = inet_ntoa(*ia);
 	setproctitle("[BPF %s] %s%s%s", psp->psp_protostr, psp->psp_ifname,
 	    addr != NULL ? " " : "", addr != NULL ? addr : "");
+}
+
+static int
+ps_bpf_start_bpf(struct ps_process *psp)
+{
+	struct dhcpcd_ctx *ctx = psp->psp_ctx;
+	struct in_addr *ia = &psp->psp_id.psi_addr.psa_in_addr;
+
+	ps_bpf_settitle(psp);
 	ps_freeprocesses(ctx, psp);
 
-	psp->psp_bpf = bpf_open(&psp->psp_ifp, psp->psp_filter, ia);
+	psp->psp_bpf = bpf_open(&psp->psp_ifp, psp->psp_filter,
+	    ia->s_addr == INADDR_ANY ? NULL : ia);
 	if (psp->psp_bpf == NULL)
 		logerr("%s: bpf_open",__func__);
+	else if (bpf_lock(psp->psp_bpf) == -1)
+		logerr("%s: bpf_lock", __func__);
 #ifdef PRIVSEP_RIGHTS
 	else if (ps_rights_limit_fd(psp->psp_bpf->bpf_fd) == -1)
 		logerr("%s: ps_rights_limit_fd", __func__);
 #endif
-	else if (eloop_event_add(ctx->eloop, psp->psp_bpf->bpf_fd, ELE_READ,
-	    ps_bpf_recvbpf, psp) == -1)
+	else if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH,
+	    psp->psp_bpf->bpf_fd, ELE_READ, ps_bpf_recvbpf, psp) == -1)
 		logerr("%s: eloop_event_add", __func__);
 	else {
 		psp->psp_work_fd = psp->psp_bpf->bpf_fd;
@@ -178,16 +203,547 @@ ps_bpf_start_bpf(struct ps_process *psp)
 	return -1;
 }
 
+/* Opens a BPF for a process which has dropped privileges. */
+static struct bpf *
+ps_bpf_openfor(struct interface *ifp,
+    int (*filter)(const struct bpf *, const struct in_addr *),
+    struct in_addr *ia)
+{
+	struct bpf *bpf;
+
+	bpf = bpf_open(ifp, filter, ia->s_addr == INADDR_ANY ? NULL : ia);
+	if (bpf == NULL || bpf_lock(bpf) == -1) {
+		logerr("%s: %s: bpf_open", __func__, ifp->name);
+		if (bpf != NULL)
+			bpf_close(bpf);
+		return NULL;
+	}
+#ifdef PRIVSEP_RIGHTS
+	if (ps_rights_limit_fd(bpf->bpf_fd) == -1)
+		logerr("%s: ps_rights_limit_fd", __func__);
+#endif
+	return bpf;
+}
+
+static void
+ps_bpf_copyifp(struct dhcpcd_ctx *ctx, struct interface *ifp,
+    struct msghdr *msg)
+{
+	struct iovec *iov = msg->msg_iov;
+
+	assert(msg->msg_iovlen == 1);
+	assert(iov->iov_len == sizeof(*ifp));
+	memcpy(ifp, iov->iov_base, sizeof(*ifp));
+	ifp->ctx = ctx;
+	ifp->options = NULL;
+	ifp->iaids = NULL;
+	ifp->iaids_len = 0;
+	memset(ifp->if_data, 0, sizeof(ifp->if_data));
+}
+
+static void
+ps_bpf_proto(uint16_t cmd, uint16_t *proto, const char **protostr,
+    int (**filter)(const struct bpf *, const struct in_addr *))
+{
+
+	switch (cmd) {
+#ifdef ARP
+	case PS_BPF_ARP:
+		*proto = ETHERTYPE_ARP;
+		*protostr = "ARP";
+		*filter = bpf_arp;
+		break;
+#endif
+	case PS_BPF_BOOTP:
+		*proto = ETHERTYPE_IP;
+		*protostr = "BOOTP";
+		*filter = bpf_bootp;
+		break;
+	default:	/* callers have checked cmd */
+		*proto = 0;
+		*protostr = "unknown";
+		*filter = NULL;
+		break;
+	}
+}
+
+static void
+ps_bpf_name(char *name, size_t namelen, const char *protostr,
+    const struct ps_id *psid)
+{
+	const struct in_addr *ia = &psid->psi_addr.psa_in_addr;
+	const char *addr;
+
+	if (ia->s_addr == INADDR_ANY)
+		addr = NULL;
+	else
+		addr = inet_ntoa(*ia);
+	snprintf(name, namelen, "BPF %s%s%s", protostr,
+	    addr != NULL ? " " : "", addr != NULL ? addr : "");
+}
+
+static void
+ps_bpf_setup(struct ps_process *psp, uint16_t cmd, struct msghdr *msg)
+{
+
+	ps_bpf_copyifp(psp->psp_ctx, &psp->psp_ifp, msg);
+	memcpy(psp->psp_ifname, psp->psp_ifp.name, sizeof(psp->psp_ifname));
+	ps_bpf_proto(cmd, &psp->psp_proto, &psp->psp_protostr,
+	    &psp->psp_filter);
+	ps_bpf_name(psp->psp_name, sizeof(psp->psp_name), psp->psp_protostr,
+	    &psp->psp_id);
+}
+
+/* A message with the BPF descriptor, if any, passed with it. */
+struct ps_bpf_fdmsg {
+	struct ps_process *psp;
+	int fd;
+};
+
+/*
+ * A pooled process is forked by the privileged proxy before it's needed
+ * and waits, sandboxed, to be given the BPF the proxy opened for it.
+ */
+static ssize_t
+ps_bpf_poolrecvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
+{
+	struct ps_bpf_fdmsg *pm = arg;
+	struct ps_process *psp = pm->psp;
+	struct dhcpcd_ctx *ctx = psp->psp_ctx;
+	uint16_t cmd;
+
+	cmd = (uint16_t)(psm->ps_cmd & ~(PS_START | PS_STOP));
+	switch (cmd) {
+#ifdef ARP
+	case PS_BPF_ARP:	/* FALLTHROUGH */
+#endif
+	case PS_BPF_BOOTP:
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if (!(psm->ps_cmd & PS_START) || pm->fd == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ps_setprocessid(psp, &psm->ps_id);
+	ps_bpf_setup(psp, cmd, msg);
+	ps_bpf_settitle(psp);
+	psp->psp_bpf = bpf_fdopen(&psp->psp_ifp, pm->fd, (size_t)psm->ps_flags);
+	if (psp->psp_bpf == NULL) {
+		logerr("%s: bpf_fdopen", __func__);
+		goto fail;
+	}
+	pm->fd = -1;
+	if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH,
+	    psp->psp_bpf->bpf_fd, ELE_READ, ps_bpf_recvbpf, psp) == -1 ||
+	    eloop_event_add(ctx->eloop, psp->psp_fd, ELE_READ,
+	    ps_bpf_recvmsg, psp) == -1)
+	{
+		logerr("%s: eloop_event_add", __func__);
+		goto fail;
+	}
+	psp->psp_work_fd = psp->psp_bpf->bpf_fd;
+	return 0;
+
+fail:
+	eloop_exit(ctx->eloop, EXIT_FAILURE);
+	return -1;
+}
+
+static void
+ps_bpf_poolrecvmsg(void *arg, unsigned short events)
+{
+	struct ps_bpf_fdmsg pm = { .psp = arg, .fd = -1 };
+
+	if (ps_recvpsmsgfd(pm.psp->psp_ctx, pm.psp->psp_fd, events,
+	    ps_bpf_poolrecvmsgcb, &pm, &pm.fd) == -1)
+		logerr(__func__);
+	if (pm.fd != -1)
+		close(pm.fd);
+}
+
+static int
+ps_bpf_start_pool(struct ps_process *psp)
+{
+	struct dhcpcd_ctx *ctx = psp->psp_ctx;
+
+	setproctitle("[BPF pool]");
+	ps_freeprocesses(ctx, psp);
+	/* Idle unprivileged, the BPF is opened for us. */
+	if (ps_dropprivs(ctx) == -1) {
+		logerr("%s: ps_dropprivs", __func__);
+		return -1;
+	}
+	return 0;
+}
+
+void
+ps_bpf_fillpool(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct ps_id id = { .psi_cmd = PS_BPF_POOL };
+	struct ps_process *psp;
+	pid_t pid;
+
+	while (ctx->ps_bpf_npool < ctx->ps_bpf_poolsize &&
+	    !(ctx->options & DHCPCD_EXITING))
+	{
+		id.psi_ifindex = ++ctx->ps_bpf_poolid;
+		psp = ps_newprocess(ctx, &id);
+		if (psp == NULL) {
+			logerr(__func__);
+			return;
+		}
+		strlcpy(psp->psp_name, "BPF pool", sizeof(psp->psp_name));
+		pid = ps_startprocess(psp, ps_bpf_poolrecvmsg, NULL,
+		    ps_bpf_start_pool, NULL, 0);
+		switch (pid) {
+		case -1:
+			ps_freeprocess(psp);
+			return;
+		case 0:
+			if (ps_entersandbox("stdio recvfd", NULL) == -1 &&
+			    errno != ENOSYS)
+			{
+				logerr("%s: ps_entersandbox", __func__);
+				eloop_exit(ctx->eloop, EXIT_FAILURE);
+			}
+			return;
+		}
+		logdebugx("%s%sspawned %s on PID %d",
+		    psp->psp_ifname, psp->psp_ifname[0] != '\0' ? ": " : "",
+		    psp->psp_name, pid);
+		TAILQ_INSERT_TAIL(&ctx->ps_bpf_pool, psp, psp_poolnext);
+		psp->psp_pooled = true;
+		ctx->ps_bpf_npool++;
+	}
+}
+
+static struct ps_process *
+ps_bpf_takepool(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm,
+    struct msghdr *msg)
+{
+	struct ps_process *psp;
+	uint16_t cmd = (uint16_t)(psm->ps_cmd & ~(PS_START | PS_STOP));
+	struct iovec *iov = msg->msg_iov;
+	struct bpf *bpf;
+	ssize_t err;
+
+	psp = TAILQ_FIRST(&ctx->ps_bpf_pool);
+	if (psp == NULL || ctx->options & DHCPCD_EXITING)
+		return NULL;
+
+	TAILQ_REMOVE(&ctx->ps_bpf_pool, psp, psp_poolnext);
+	psp->psp_pooled = false;
+	ctx->ps_bpf_npool--;
+	/* Top the pool up again once we're idle. */
+	eloop_timeout_add_sec(ctx->eloop, 0, ps_bpf_fillpool, ctx);
+
+	ps_setprocessid(psp, &psm->ps_id);
+	ps_bpf_setup(psp, cmd, msg);
+	bpf = ps_bpf_openfor(&psp->psp_ifp, psp->psp_filter,
+	    &psp->psp_id.psi_addr.psa_in_addr);
+	if (bpf == NULL) {
+		ps_freeprocess(psp);
+		return NULL;
+	}
+	psm->ps_flags = (unsigned long)bpf->bpf_size;
+	err = ps_sendpsmdatafd(ctx, psp->psp_fd, psm,
+	    iov->iov_base, iov->iov_len, bpf->bpf_fd);
+	bpf_close(bpf);
+	if (err == -1) {
+		logerr("%s: %s", __func__, psp->psp_name);
+		ps_freeprocess(psp);
+		return NULL;
+	}
+	logdebugx("%s: using pooled %s on PID %d",
+	    psp->psp_ifname, psp->psp_name, psp->psp_pid);
+	return psp;
+}
+
+/*
+ * With bpf_shared, one process holds the BPF for every interface.
+ * It cannot open BPF once it has dropped privileges, so the privileged
+ * proxy opens each one and passes the descriptor over.
+ * Both sides track what is open in ctx->ps_bpf_ents.
+ */
+struct ps_bpf_ent {
+	rb_node_t pbe_tree;
+	struct ps_id pbe_id;
+	struct interface pbe_ifp;
+	struct bpf *pbe_bpf;
+	uint16_t pbe_proto;
+	char pbe_name[PSP_NAMESIZE];
+};
+
+static int
+ps_bpf_ent_cmp(__unused void *context, const void *n1, const void *n2)
+{
+
+	return memcmp(&((const struct ps_bpf_ent *)n1)->pbe_id, n2,
+	    sizeof(struct ps_id));
+}
+
+static int
+ps_bpf_ent_cmpnode(void *context, const void *n1, const void *n2)
+{
+
+	return ps_bpf_ent_cmp(context, n1,
+	    &((const struct ps_bpf_ent *)n2)->pbe_id);
+}
+
+static const rb_tree_ops_t ps_bpf_ent_ops = {
+	.rbto_compare_nodes = ps_bpf_ent_cmpnode,
+	.rbto_compare_key = ps_bpf_ent_cmp,
+	.rbto_node_offset = offsetof(struct ps_bpf_ent, pbe_tree),
+	.rbto_context = NULL
+};
+
+void
+ps_bpf_initshared(struct dhcpcd_ctx *ctx)
+{
+
+	rb_tree_init(&ctx->ps_bpf_ents, &ps_bpf_ent_ops);
+}
+
+static struct ps_bpf_ent *
+ps_bpf_newent(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm,
+    struct msghdr *msg, int (**filter)(const struct bpf *,
+    const struct in_addr *))
+{
+	struct ps_bpf_ent *ent;
+	const char *protostr;
+	uint16_t cmd = (uint16_t)(psm->ps_cmd & ~(PS_START | PS_STOP));
+
+	ent = calloc(1, sizeof(*ent));
+	if (ent == NULL)
+		return NULL;
+	ent->pbe_id = psm->ps_id;
+	ps_bpf_copyifp(ctx, &ent->pbe_ifp, msg);
+	ps_bpf_proto(cmd, &ent->pbe_proto, &protostr, filter);
+	ps_bpf_name(ent->pbe_name, sizeof(ent->pbe_name), protostr,
+	    &ent->pbe_id);
+	return ent;
+}
+
+static void
+ps_bpf_freeent(struct dhcpcd_ctx *ctx, struct ps_bpf_ent *ent)
+{
+
+	rb_tree_remove_node(&ctx->ps_bpf_ents, ent);
+	if (ent->pbe_bpf != NULL) {
+		eloop_event_delete(ctx->eloop, ent->pbe_bpf->bpf_fd);
+		bpf_close(ent->pbe_bpf);
+	}
+	free(ent);
+}
+
+void
+ps_bpf_freeshared(struct dhcpcd_ctx *ctx)
+{
+	struct ps_bpf_ent *ent;
+
+	while ((ent = RB_TREE_MIN(&ctx->ps_bpf_ents)) != NULL)
+		ps_bpf_freeent(ctx, ent);
+}
+
+static void
+ps_bpf_sharedrecvbpf(void *arg, unsigned short events)
+{
+	struct ps_bpf_ent *ent = arg;
+
+	if (events != ELE_READ)
+		logerrx("%s: unexpected event 0x%04x", __func__, events);
+
+	ps_bpf_readbpf(ent->pbe_ifp.ctx, &ent->pbe_id, ent->pbe_ifp.name,
+	    &ent->pbe_bpf);
+}
+
+static ssize_t
+ps_bpf_sharedrecvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
+{
+	struct ps_bpf_fdmsg *psbm = arg;
+	struct dhcpcd_ctx *ctx = psbm->psp->psp_ctx;
+	struct ps_bpf_ent *ent;
+	struct iovec *iov = msg->msg_iov;
+	int (*filter)(const struct bpf *, const struct in_addr *);
+
+	ent = rb_tree_find_node(&ctx->ps_bpf_ents, &psm->ps_id);
+
+	if (psm->ps_cmd & PS_START) {
+		if (psbm->fd == -1) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (ent != NULL)
+			ps_bpf_freeent(ctx, ent);
+		ent = ps_bpf_newent(ctx, psm, msg, &filter);
+		if (ent == NULL)
+			return -1;
+		ent->pbe_bpf = bpf_fdopen(&ent->pbe_ifp, psbm->fd,
+		    (size_t)psm->ps_flags);
+		if (ent->pbe_bpf == NULL) {
+			free(ent);
+			return -1;
+		}
+		psbm->fd = -1;
+		rb_tree_insert_node(&ctx->ps_bpf_ents, ent);
+		if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH,
+		    ent->pbe_bpf->bpf_fd, ELE_READ,
+		    ps_bpf_sharedrecvbpf, ent) == -1)
+		{
+			logerr("%s: eloop_event_add", __func__);
+			ps_bpf_freeent(ctx, ent);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (ent == NULL) {
+		errno = ESRCH;
+		return -1;
+	}
+	if (psm->ps_cmd & PS_STOP) {
+		ps_bpf_freeent(ctx, ent);
+		return 0;
+	}
+	/* We might have had an earlier ENXIO error. */
+	if (ent->pbe_bpf == NULL) {
+		errno = ENXIO;
+		return -1;
+	}
+	return bpf_send(ent->pbe_bpf, ent->pbe_proto,
+	    iov->iov_base, iov->iov_len);
+}
+
+static void
+ps_bpf_sharedrecvmsg(void *arg, unsigned short events)
+{
+	struct ps_bpf_fdmsg psbm = { .psp = arg, .fd = -1 };
+
+	if (ps_recvpsmsgfd(psbm.psp->psp_ctx, psbm.psp->psp_fd, events,
+	    ps_bpf_sharedrecvmsgcb, &psbm, &psbm.fd) == -1)
+		logerr(__func__);
+	if (psbm.fd != -1)
+		close(psbm.fd);
+}
+
+static int
+ps_bpf_start_shared(struct ps_process *psp)
+{
+	struct dhcpcd_ctx *ctx = psp->psp_ctx;
+
+	setproctitle("[BPF]");
+	ps_freeprocesses(ctx, psp);
+	/* Anything open belongs to a previous shared process. */
+	ps_bpf_freeshared(ctx);
+	return 0;
+}
+
+static pid_t
+ps_bpf_startshared(struct dhcpcd_ctx *ctx)
+{
+	struct ps_id id = { .psi_cmd = PS_BPF_SHARED };
+	struct ps_process *psp;
+	pid_t pid;
+
+	psp = ctx->ps_bpf = ps_newprocess(ctx, &id);
+	if (psp == NULL)
+		return -1;
+	strlcpy(psp->psp_name, "shared BPF", sizeof(psp->psp_name));
+	pid = ps_startprocess(psp, ps_bpf_sharedrecvmsg, NULL,
+	    ps_bpf_start_shared, NULL, PSF_DROPPRIVS);
+	switch (pid) {
+	case -1:
+		ps_freeprocess(psp);
+		return -1;
+	case 0:
+		ps_entersandbox("stdio recvfd", NULL);
+		break;
+	default:
+		logdebugx("%s%sspawned %s on PID %d",
+		    psp->psp_ifname, psp->psp_ifname[0] != '\0' ? ": " : "",
+		    psp->psp_name, pid);
+		break;
+	}
+	return pid;
+}
+
+ssize_t
+ps_bpf_sharedcmd(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm,
+    struct msghdr *msg)
+{
+	struct ps_bpf_ent *ent;
+	struct bpf *bpf;
+	struct iovec *iov = msg->msg_iov;
+	int (*filter)(const struct bpf *, const struct in_addr *);
+	struct in_addr *ia = &psm->ps_id.psi_addr.psa_in_addr;
+	ssize_t err;
+
+	ent = rb_tree_find_node(&ctx->ps_bpf_ents, &psm->ps_id);
+
+	if (psm->ps_cmd & PS_STOP) {
+		if (ent == NULL)
+			return 0;
+		ps_bpf_freeent(ctx, ent);
+		if (ps_sendpsmmsg(ctx, ctx->ps_bpf->psp_fd, psm, msg) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (!(psm->ps_cmd & PS_START)) {
+		if (ent == NULL) {
+			errno = EINVAL;
+			return -1;
+		}
+		return ps_sendpsmmsg(ctx, ctx->ps_bpf->psp_fd, psm, msg);
+	}
+
+	if (ent != NULL)
+		return 1;
+
+	if (ctx->ps_bpf == NULL) {
+		switch (ps_bpf_startshared(ctx)) {
+		case -1:
+			return -1;
+		case 0:
+			return 0;
+		}
+	}
+
+	ent = ps_bpf_newent(ctx, psm, msg, &filter);
+	if (ent == NULL)
+		return -1;
+	bpf = ps_bpf_openfor(&ent->pbe_ifp, filter, ia);
+	if (bpf == NULL) {
+		free(ent);
+		return -1;
+	}
+	psm->ps_flags = (unsigned long)bpf->bpf_size;
+	err = ps_sendpsmdatafd(ctx, ctx->ps_bpf->psp_fd, psm,
+	    iov->iov_base, iov->iov_len, bpf->bpf_fd);
+	bpf_close(bpf);
+	if (err == -1) {
+		logerr("%s: %s", __func__, ctx->ps_bpf->psp_name);
+		free(ent);
+		return -1;
+	}
+	rb_tree_insert_node(&ctx->ps_bpf_ents, ent);
+	logdebugx("%s: opened %s in %s on PID %d",
+	    ent->pbe_ifp.name, ent->pbe_name,
+	    ctx->ps_bpf->psp_name, ctx->ps_bpf->psp_pid);
+	return 1;
+}
+
 ssize_t
 ps_bpf_cmd(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm, struct msghdr *msg)
 {
 	uint16_t cmd;
 	struct ps_process *psp;
 	pid_t start;
-	struct iovec *iov = msg->msg_iov;
-	struct interface *ifp;
-	struct in_addr *ia = &psm->ps_id.psi_addr.psa_in_addr;
-	const char *addr;
 
 	cmd = (uint16_t)(psm->ps_cmd & ~(PS_START | PS_STOP));
 	psp = ps_findprocess(ctx, &psm->ps_id);
@@ -216,42 +772,13 @@ ps_bpf_cmd(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm, struct msghdr *msg)
 	if (psp != NULL)
 		return 1;
 
+	if ((psp = ps_bpf_takepool(ctx, psm, msg)) != NULL)
+		return psp->psp_pid;
+
 	psp = ps_newprocess(ctx, &psm->ps_id);
 	if (psp == NULL)
 		return -1;
-
-	ifp = &psp->psp_ifp;
-	assert(msg->msg_iovlen == 1);
-	assert(iov->iov_len == sizeof(*ifp));
-	memcpy(ifp, iov->iov_base, sizeof(*ifp));
-	ifp->ctx = psp->psp_ctx;
-	ifp->options = NULL;
-	memset(ifp->if_data, 0, sizeof(ifp->if_data));
-
-	memcpy(psp->psp_ifname, ifp->name, sizeof(psp->psp_ifname));
-
-	switch (cmd) {
-#ifdef ARP
-	case PS_BPF_ARP:
-		psp->psp_proto = ETHERTYPE_ARP;
-		psp->psp_protostr = "ARP";
-		psp->psp_filter = bpf_arp;
-		break;
-#endif
-	case PS_BPF_BOOTP:
-		psp->psp_proto = ETHERTYPE_IP;
-		psp->psp_protostr = "BOOTP";
-		psp->psp_filter = bpf_bootp;
-		break;
-	}
-
-	if (ia->s_addr == INADDR_ANY)
-		addr = NULL;
-	else
-		addr = inet_ntoa(*ia);
-	snprintf(psp->psp_name, sizeof(psp->psp_name), "BPF %s%s%s",
-	    psp->psp_protostr,
-	    addr != NULL ? " " : "", addr != NULL ? addr : "");
+	ps_bpf_setup(psp, cmd, msg);
 
 	start = ps_startprocess(psp, ps_bpf_recvmsg, NULL,
 	    ps_bpf_start_bpf, NULL, PSF_DROPPRIVS);
@@ -29,6 +29,11 @@
 #ifndef PRIVSEP_BPF_H
 #define PRIVSEP_BPF_H
 
+void ps_bpf_fillpool(void *);
+void ps_bpf_initshared(struct dhcpcd_ctx *);
+void ps_bpf_freeshared(struct dhcpcd_ctx *);
+ssize_t ps_bpf_sharedcmd(struct dhcpcd_ctx *,
+    struct ps_msghdr *, struct msghdr *);
 ssize_t ps_bpf_cmd(struct dhcpcd_ctx *,
     struct ps_msghdr *, struct msghdr *);
 ssize_t ps_bpf_dispatch(struct dhcpcd_ctx *,
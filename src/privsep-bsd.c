@@ -172,7 +172,7 @@ ps_root_doifignoregroup(void *data, size_t len)
 #endif
 
 ssize_t
-ps_root_os(struct ps_msghdr *psm, struct msghdr *msg,
+ps_root_os(struct ps_msghdr *psm, struct msghdr *msg, __unused int fd,
     void **rdata, size_t *rlen)
 {
 	struct iovec *iov = msg->msg_iov;
@@ -241,6 +241,8 @@ ssize_t
 ps_root_route(struct dhcpcd_ctx *ctx, void *data, size_t len)
 {
 
+	if (ctx->ps_root_batch != NULL)
+		return ps_root_batch_cmd(ctx, PS_ROUTE, 0, data, len);
 	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_ROUTE, 0, data, len) == -1)
 		return -1;
 	return ps_root_readerror(ctx, data, len);
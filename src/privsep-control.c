@@ -103,8 +103,25 @@ ps_ctl_handleargs(struct fd_list *fd, char *data, size_t len)
 		    strlen(fd->ctx->cffile) + 1);
 	} else if (strncmp(data, "--listen",
 	    MIN(strlen("--listen"), len)) == 0) {
-		fd->flags |= FD_LISTEN;
-		return 0;
+		char *argv[32], *p, *e;
+		int argc = 0;
+
+		/* Each argument is NUL terminated, the last one by \n too */
+		for (p = data; len != 0 && argc < (int)__arraycount(argv);) {
+			e = memchr(p, '\0', len);
+			if (e == NULL)
+				break;
+			if (e != p && *(e - 1) == '\n')
+				*(e - 1) = '\0';
+			argv[argc++] = p;
+			len -= (size_t)(e - p) + 1;
+			p = e + 1;
+		}
+		if (argc == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		return control_listen(fd, argc - 1, argv + 1);
 	}
 
 	if (fd->ctx->ps_control_client != NULL &&
@@ -197,29 +214,68 @@ static void
 ps_ctl_listen(void *arg, unsigned short events)
 {
 	struct dhcpcd_ctx *ctx = arg;
-	char buf[BUFSIZ];
-	ssize_t len;
-	struct fd_list *fd;
+	char *buf;
+	size_t len, dlen;
+	ssize_t nread;
+	struct fd_list *fd, *fdn;
+	struct fd_event fe;
 
 	if (!(events & ELE_READ))
 		logerrx("%s: unexpected event 0x%04x", __func__, events);
 
-	len = read(ctx->ps_control->fd, buf, sizeof(buf));
-	if (len == 0)
+	if (ctx->ps_control_bufsize - ctx->ps_control_buflen < BUFSIZ) {
+		buf = realloc(ctx->ps_control_buf,
+		    ctx->ps_control_bufsize + BUFSIZ);
+		if (buf == NULL) {
+			logerr("%s: realloc", __func__);
+			return;
+		}
+		ctx->ps_control_buf = buf;
+		ctx->ps_control_bufsize += BUFSIZ;
+	}
+
+	nread = read(ctx->ps_control->fd,
+	    ctx->ps_control_buf + ctx->ps_control_buflen,
+	    ctx->ps_control_bufsize - ctx->ps_control_buflen);
+	if (nread == 0)
 		return;
-	if (len == -1) {
+	if (nread == -1) {
 		logerr("%s: read", __func__);
 		eloop_exit(ctx->eloop, EXIT_FAILURE);
 		return;
 	}
-
-	/* Send to our listeners */
-	TAILQ_FOREACH(fd, &ctx->control_fds, next) {
-		if (!(fd->flags & FD_LISTEN))
-			continue;
-		if (control_queue(fd, buf, (size_t)len)== -1)
-			logerr("%s: control_queue", __func__);
+	ctx->ps_control_buflen += (size_t)nread;
+
+	/*
+	 * Each event is prefixed by its length.
+	 * Split them out so each listener can filter and format them.
+	 */
+	buf = ctx->ps_control_buf;
+	len = ctx->ps_control_buflen;
+	while (len >= sizeof(dlen)) {
+		memcpy(&dlen, buf, sizeof(dlen));
+		if (len - sizeof(dlen) < dlen)
+			break;
+		buf += sizeof(dlen);
+		len -= sizeof(dlen);
+
+		/* Send to our listeners */
+		fe.fe_env = buf;
+		fe.fe_len = dlen;
+		fe.fe_env_buf = fe.fe_tlv_buf = NULL;
+		fe.fe_flags = FD_SENDLEN;
+		TAILQ_FOREACH_SAFE(fd, &ctx->control_fds, next, fdn) {
+			if (!(fd->flags & FD_LISTEN))
+				continue;
+			if (control_queue_event(fd, &fe) == -1)
+				logerr("%s: control_queue_event", __func__);
+		}
+		control_event_free(&fe);
+		buf += dlen;
+		len -= dlen;
 	}
+	memmove(ctx->ps_control_buf, buf, len);
+	ctx->ps_control_buflen = len;
 }
 
 pid_t
@@ -245,7 +301,7 @@ ps_ctl_start(struct dhcpcd_ctx *ctx)
 	psp = ctx->ps_ctl = ps_newprocess(ctx, &id);
 	strlcpy(psp->psp_name, "control proxy", sizeof(psp->psp_name));
 	pid = ps_startprocess(psp, ps_ctl_recvmsg, ps_ctl_dodispatch,
-	    ps_ctl_startcb, NULL, PSF_DROPPRIVS);
+	    ps_ctl_startcb, NULL, PSF_DROPPRIVS | PSF_LOWPRIO);
 
 	if (pid == -1)
 		return -1;
@@ -262,16 +318,16 @@ ps_ctl_start(struct dhcpcd_ctx *ctx)
 
 	psp->psp_work_fd = data_fd[0];
 	close(data_fd[1]);
-	if (eloop_event_add(ctx->eloop, psp->psp_work_fd, ELE_READ,
-	    ps_ctl_recv, ctx) == -1)
+	if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_LOW, psp->psp_work_fd,
+	    ELE_READ, ps_ctl_recv, ctx) == -1)
 		return -1;
 
 	ctx->ps_control = control_new(ctx, listen_fd[0], 0);
 	close(listen_fd[1]);
 	if (ctx->ps_control == NULL)
 		return -1;
-	if (eloop_event_add(ctx->eloop, ctx->ps_control->fd, ELE_READ,
-	    ps_ctl_listen, ctx) == -1)
+	if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_LOW,
+	    ctx->ps_control->fd, ELE_READ, ps_ctl_listen, ctx) == -1)
 		return -1;
 
 	ps_entersandbox("stdio inet", NULL);
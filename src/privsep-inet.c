@@ -149,8 +149,8 @@ ps_inet_startcb(struct ps_process *psp)
 			ctx->udp_rfd = -1;
 		}
 #endif
-		else if (eloop_event_add(ctx->eloop, ctx->udp_rfd, ELE_READ,
-		    ps_inet_recvbootp, ctx) == -1)
+		else if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH,
+		    ctx->udp_rfd, ELE_READ, ps_inet_recvbootp, ctx) == -1)
 		{
 			logerr("%s: eloop_event_add DHCP", __func__);
 			close(ctx->udp_rfd);
@@ -171,8 +171,8 @@ ps_inet_startcb(struct ps_process *psp)
 			ctx->nd_fd = -1;
 		}
 #endif
-		else if (eloop_event_add(ctx->eloop, ctx->nd_fd, ELE_READ,
-		    ps_inet_recvra, ctx) == -1)
+		else if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH,
+		    ctx->nd_fd, ELE_READ, ps_inet_recvra, ctx) == -1)
 		{
 			logerr("%s: eloop_event_add RA", __func__);
 			close(ctx->nd_fd);
@@ -195,8 +195,8 @@ ps_inet_startcb(struct ps_process *psp)
 			ctx->dhcp6_rfd = -1;
 		}
 #endif
-		else if (eloop_event_add(ctx->eloop, ctx->dhcp6_rfd, ELE_READ,
-		    ps_inet_recvdhcp6, ctx) == -1)
+		else if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH,
+		    ctx->dhcp6_rfd, ELE_READ, ps_inet_recvdhcp6, ctx) == -1)
 		{
 			logerr("%s: eloop_event_add DHCP6", __func__);
 			close(ctx->dhcp6_rfd);
@@ -414,8 +414,8 @@ ps_inet_listenin(struct ps_process *psp)
 	}
 #endif
 
-	if (eloop_event_add(psp->psp_ctx->eloop, psp->psp_work_fd, ELE_READ,
-	    ps_inet_recvinbootp, psp) == -1)
+	if (eloop_p_event_add(psp->psp_ctx->eloop, ELOOP_PRIO_HIGH,
+	    psp->psp_work_fd, ELE_READ, ps_inet_recvinbootp, psp) == -1)
 	{
 		logerr("%s: eloop_event_add DHCP", __func__);
 		return -1;
@@ -454,8 +454,8 @@ ps_inet_listennd(struct ps_process *psp)
 	}
 #endif
 
-	if (eloop_event_add(psp->psp_ctx->eloop, psp->psp_work_fd,
-	    ps_inet_recvin6nd, psp) == -1)
+	if (eloop_p_event_add(psp->psp_ctx->eloop, ELOOP_PRIO_HIGH,
+	    psp->psp_work_fd, ELE_READ, ps_inet_recvin6nd, psp) == -1)
 	{
 		logerr(__func__);
 		return -1;
@@ -497,8 +497,8 @@ ps_inet_listenin6(struct ps_process *psp)
 	}
 #endif
 
-	if (eloop_event_add(psp->psp_ctx->eloop, psp->psp_work_fd, ELE_READ,
-	    ps_inet_recvin6dhcp6, psp) == -1)
+	if (eloop_p_event_add(psp->psp_ctx->eloop, ELOOP_PRIO_HIGH,
+	    psp->psp_work_fd, ELE_READ, ps_inet_recvin6dhcp6, psp) == -1)
 	{
 		logerr("%s: eloop_event_add DHCP", __func__);
 		return -1;
@@ -35,6 +35,7 @@
 #include <linux/audit.h>
 #include <linux/filter.h>
 #include <linux/net.h>
+#include <linux/netlink.h>
 #include <linux/seccomp.h>
 #include <linux/sockios.h>
 
@@ -59,40 +60,242 @@
  */
 //#define SECCOMP_FILTER_DEBUG
 
-static ssize_t
-ps_root_dosendnetlink(int protocol, struct msghdr *msg)
+/* Requests sent in one datagram.
+ * Each ACK is queued on the socket until we read it. */
+#define	PS_NLBATCH	64
+
+/* Read the ACK for each request, matching them by sequence number. */
+static void
+ps_root_nlacks(int s, const struct iovec *reqs, size_t n,
+    ssize_t *results, int *errnos)
 {
-	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
-	int s;
 	unsigned char buf[16 * 1024];
-	struct iovec riov = {
-		.iov_base = buf,
-		.iov_len = sizeof(buf),
+	ssize_t len;
+	size_t i, left = 0;
+	struct nlmsghdr *nlm;
+	struct nlmsgerr *err;
+	const struct nlmsghdr *req;
+
+	for (i = 0; i < n; i++) {
+		if (errnos[i] == -1)
+			left++;
+	}
+
+	while (left != 0) {
+		len = recv(s, buf, sizeof(buf), 0);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			/* Every request still waiting has failed. */
+			for (i = 0; i < n; i++) {
+				if (errnos[i] == -1) {
+					results[i] = -1;
+					errnos[i] = errno;
+				}
+			}
+			return;
+		}
+
+		for (nlm = (struct nlmsghdr *)buf;
+		     NLMSG_OK(nlm, (size_t)len);
+		     nlm = NLMSG_NEXT(nlm, len))
+		{
+			if (nlm->nlmsg_type != NLMSG_ERROR ||
+			    nlm->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+				continue;
+			err = NLMSG_DATA(nlm);
+			for (i = 0; i < n; i++) {
+				req = reqs[i].iov_base;
+				if (errnos[i] == -1 &&
+				    req->nlmsg_seq == err->msg.nlmsg_seq)
+					break;
+			}
+			/* Not ours, maybe stale. */
+			if (i == n)
+				continue;
+			results[i] = err->error == 0 ? 0 : -1;
+			errnos[i] = -err->error;
+			left--;
+		}
+	}
+}
+
+/*
+ * Send n netlink requests, PS_NLBATCH at a time in one datagram,
+ * on one socket.
+ * The kernel runs each request in turn and ACKs each one,
+ * so a failed request doesn't stop the ones after it.
+ */
+ssize_t
+ps_root_dosendnetlinkv(int protocol, struct iovec *reqs, size_t n,
+    ssize_t *results, int *errnos)
+{
+	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
+	static const uint8_t pad[NLMSG_ALIGNTO];
+	struct iovec iov[PS_NLBATCH * 2];
+	struct msghdr msg = {
+	    .msg_name = &snl, .msg_namelen = sizeof(snl),
+	    .msg_iov = iov,
 	};
-	ssize_t retval;
+	struct nlmsghdr *req;
+	size_t i, j, nreq;
+	int s;
+#ifdef NETLINK_CAP_ACK
+	int on = 1;
+#endif
 
 	if ((s = if_linksocket(&snl, protocol, 0)) == -1)
 		return -1;
+#ifdef NETLINK_CAP_ACK
+	/* We only need the header of a failed request back. */
+	if (setsockopt(s, SOL_NETLINK, NETLINK_CAP_ACK,
+	    &on, sizeof(on)) == -1 && errno != ENOPROTOOPT)
+		logerr("%s: NETLINK_CAP_ACK", __func__);
+#endif
+	/* The kernel, not the address we bound to. */
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+
+	for (i = 0; i < n; i += nreq) {
+		nreq = MIN(n - i, PS_NLBATCH);
+		msg.msg_iovlen = 0;
+		for (j = i; j < i + nreq; j++) {
+			req = reqs[j].iov_base;
+			if (reqs[j].iov_len < sizeof(*req) ||
+			    req->nlmsg_len != reqs[j].iov_len) {
+				results[j] = -1;
+				errnos[j] = EINVAL;
+				continue;
+			}
+			/* We wait for an ACK for each one. */
+			req->nlmsg_flags |= NLM_F_ACK;
+			results[j] = 0;
+			errnos[j] = -1;
+			iov[msg.msg_iovlen++] = reqs[j];
+			if (NLMSG_ALIGN(req->nlmsg_len) != req->nlmsg_len) {
+				iov[msg.msg_iovlen].iov_base = UNCONST(pad);
+				iov[msg.msg_iovlen++].iov_len =
+				    NLMSG_ALIGN(req->nlmsg_len) -
+				    req->nlmsg_len;
+			}
+		}
+		if (msg.msg_iovlen == 0)
+			continue;
 
-	if (sendmsg(s, msg, 0) == -1) {
-		retval = -1;
-		goto out;
+		if (sendmsg(s, &msg, 0) == -1) {
+			for (j = i; j < i + nreq; j++) {
+				if (errnos[j] == -1) {
+					results[j] = -1;
+					errnos[j] = errno;
+				}
+			}
+			continue;
+		}
+		ps_root_nlacks(s, reqs + i, nreq, results + i, errnos + i);
 	}
 
-	retval = if_getnetlink(NULL, &riov, s, 0, NULL, NULL);
-out:
 	close(s);
-	return retval;
+	return 0;
+}
+
+static ssize_t
+ps_root_dosendnetlink(int protocol, struct msghdr *msg)
+{
+	ssize_t result;
+	int error;
+
+	if (msg->msg_iovlen != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (ps_root_dosendnetlinkv(protocol, msg->msg_iov, 1,
+	    &result, &error) == -1)
+		return -1;
+	errno = error;
+	return result;
+}
+
+/* Only a route socket can be passed to us to change. */
+static int
+ps_root_linkfd(int fd)
+{
+	int domain, protocol;
+	socklen_t len;
+
+	if (fd == -1) {
+		errno = EBADF;
+		return -1;
+	}
+	len = sizeof(domain);
+	if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) == -1)
+		return -1;
+	len = sizeof(protocol);
+	if (getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &len) == -1)
+		return -1;
+	if (domain != AF_NETLINK || protocol != NETLINK_ROUTE) {
+		errno = EPERM;
+		return -1;
+	}
+	return 0;
+}
+
+static ssize_t
+ps_root_dolinkrcvbuf(int fd, struct msghdr *msg)
+{
+	struct iovec *iov = msg->msg_iov;
+	int rcvbuf;
+
+	if (msg->msg_iovlen != 1 || iov->iov_len != sizeof(rcvbuf)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (ps_root_linkfd(fd) == -1)
+		return -1;
+	memcpy(&rcvbuf, iov->iov_base, sizeof(rcvbuf));
+
+#ifdef SO_RCVBUFFORCE
+	/* Root can go past net.core.rmem_max. */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE,
+	    &rcvbuf, sizeof(rcvbuf)) == 0)
+		return 0;
+#endif
+	return setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+}
+
+static ssize_t
+ps_root_dolinkfilter(int fd, struct msghdr *msg)
+{
+	struct iovec *iov = msg->msg_iov;
+	struct sock_fprog pf;
+
+	if (msg->msg_iovlen != 1 || iov->iov_len == 0 ||
+	    iov->iov_len % sizeof(*pf.filter) != 0 ||
+	    iov->iov_len / sizeof(*pf.filter) > BPF_MAXINSNS)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (ps_root_linkfd(fd) == -1)
+		return -1;
+
+	/* The kernel checks the program when it is attached. */
+	pf.len = (unsigned short)(iov->iov_len / sizeof(*pf.filter));
+	pf.filter = iov->iov_base;
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &pf, sizeof(pf));
 }
 
 ssize_t
-ps_root_os(struct ps_msghdr *psm, struct msghdr *msg,
+ps_root_os(struct ps_msghdr *psm, struct msghdr *msg, int fd,
     __unused void **rdata, __unused size_t *rlen)
 {
 
 	switch (psm->ps_cmd) {
 	case PS_ROUTE:
 		return ps_root_dosendnetlink((int)psm->ps_flags, msg);
+	case PS_LINKRCVBUF:
+		return ps_root_dolinkrcvbuf(fd, msg);
+	case PS_LINKFILTER:
+		return ps_root_dolinkfilter(fd, msg);
 	default:
 		errno = ENOTSUP;
 		return -1;
@@ -103,12 +306,40 @@ ssize_t
 ps_root_sendnetlink(struct dhcpcd_ctx *ctx, int protocol, struct msghdr *msg)
 {
 
+	if (ctx->ps_root_batch != NULL)
+		return ps_root_batch_msg(ctx, PS_ROUTE,
+		    (unsigned long)protocol, msg);
 	if (ps_sendmsg(ctx, ctx->ps_root->psp_fd, PS_ROUTE,
 	    (unsigned long)protocol, msg) == -1)
 		return -1;
 	return ps_root_readerror(ctx, NULL, 0);
 }
 
+/* The route socket is ours, but growing it is done as root. */
+ssize_t
+ps_root_setlinkrcvbuf(struct dhcpcd_ctx *ctx, int rcvbuf)
+{
+	struct ps_msghdr psm = { .ps_cmd = PS_LINKRCVBUF };
+
+	if (ps_sendpsmdatafd(ctx, ctx->ps_root->psp_fd, &psm,
+	    &rcvbuf, sizeof(rcvbuf), ctx->link_fd) == -1)
+		return -1;
+	return ps_root_readerror(ctx, NULL, 0);
+}
+
+/* Like the buffer, the filter is attached as root. */
+ssize_t
+ps_root_setlinkfilter(struct dhcpcd_ctx *ctx,
+    const struct sock_filter *filter, size_t len)
+{
+	struct ps_msghdr psm = { .ps_cmd = PS_LINKFILTER };
+
+	if (ps_sendpsmdatafd(ctx, ctx->ps_root->psp_fd, &psm,
+	    filter, len * sizeof(*filter), ctx->link_fd) == -1)
+		return -1;
+	return ps_root_readerror(ctx, NULL, 0);
+}
+
 #if (BYTE_ORDER == LITTLE_ENDIAN)
 # define SECCOMP_ARG_LO	0
 # define SECCOMP_ARG_HI	sizeof(uint32_t)
@@ -271,6 +502,39 @@ static struct sock_filter ps_seccomp_filter[] = {
 	/* Allow syscalls */
 	BPF_STMT(BPF_LD + BPF_W + BPF_ABS,
 		offsetof(struct seccomp_data, nr)),
+	/* Checked in order, so the syscalls each helper makes for every
+	 * message come first and the rest are alphabetical. */
+#ifdef __NR_epoll_pwait
+	SECCOMP_ALLOW(__NR_epoll_pwait),
+#endif
+#ifdef __NR_epoll_wait
+	SECCOMP_ALLOW(__NR_epoll_wait),
+#endif
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_enter)
+	/* eloop restricts the ring to poll requests. */
+	SECCOMP_ALLOW(__NR_io_uring_enter),
+#endif
+#ifdef __NR_recvmsg
+	SECCOMP_ALLOW(__NR_recvmsg),
+#endif
+#ifdef __NR_sendmsg
+	SECCOMP_ALLOW(__NR_sendmsg),
+#endif
+#ifdef __NR_read
+	SECCOMP_ALLOW(__NR_read),
+#endif
+#ifdef __NR_write
+	SECCOMP_ALLOW(__NR_write),
+#endif
+#ifdef __NR_writev
+	SECCOMP_ALLOW(__NR_writev),
+#endif
+#ifdef __NR_recvfrom
+	SECCOMP_ALLOW(__NR_recvfrom),
+#endif
+#ifdef __NR_sendto
+	SECCOMP_ALLOW(__NR_sendto),
+#endif
 #ifdef __NR_accept
 	SECCOMP_ALLOW(__NR_accept),
 #endif
@@ -292,12 +556,6 @@ static struct sock_filter ps_seccomp_filter[] = {
 #ifdef __NR_epoll_ctl
 	SECCOMP_ALLOW(__NR_epoll_ctl),
 #endif
-#ifdef __NR_epoll_wait
-	SECCOMP_ALLOW(__NR_epoll_wait),
-#endif
-#ifdef __NR_epoll_pwait
-	SECCOMP_ALLOW(__NR_epoll_pwait),
-#endif
 #ifdef __NR_exit_group
 	SECCOMP_ALLOW(__NR_exit_group),
 #endif
@@ -323,6 +581,8 @@ static struct sock_filter ps_seccomp_filter[] = {
 	/* For route socket overflow */
 	SECCOMP_ALLOW_ARG(__NR_getsockopt, 1, SOL_SOCKET),
 	SECCOMP_ALLOW_ARG(__NR_getsockopt, 2, SO_RCVBUF),
+	/* For a shared BPF process to find the ring */
+	SECCOMP_ALLOW_ARG(__NR_getsockopt, 1, SOL_PACKET),
 #endif
 #ifdef __NR_ioctl
 	SECCOMP_ALLOW_ARG(__NR_ioctl, 1, SIOCGIFFLAGS),
@@ -356,33 +616,18 @@ static struct sock_filter ps_seccomp_filter[] = {
 #ifdef __NR_pselect6_time64
 	SECCOMP_ALLOW(__NR_pselect6_time64),
 #endif
-#ifdef __NR_read
-	SECCOMP_ALLOW(__NR_read),
-#endif
 #ifdef __NR_readv
 	SECCOMP_ALLOW(__NR_readv),
 #endif
 #ifdef __NR_recv
 	SECCOMP_ALLOW(__NR_recv),
 #endif
-#ifdef __NR_recvfrom
-	SECCOMP_ALLOW(__NR_recvfrom),
-#endif
-#ifdef __NR_recvmsg
-	SECCOMP_ALLOW(__NR_recvmsg),
-#endif
 #ifdef __NR_rt_sigreturn
 	SECCOMP_ALLOW(__NR_rt_sigreturn),
 #endif
 #ifdef __NR_send
 	SECCOMP_ALLOW(__NR_send),
 #endif
-#ifdef __NR_sendmsg
-	SECCOMP_ALLOW(__NR_sendmsg),
-#endif
-#ifdef __NR_sendto
-	SECCOMP_ALLOW(__NR_sendto),
-#endif
 #ifdef __NR_socketcall
 	/* i386 needs this and demonstrates why SECCOMP
 	 * is poor compared to OpenBSD pledge(2) and FreeBSD capsicum(4)
@@ -412,12 +657,6 @@ static struct sock_filter ps_seccomp_filter[] = {
 #ifdef __NR_waitpid
 	SECCOMP_ALLOW(__NR_waitpid),
 #endif
-#ifdef __NR_write
-	SECCOMP_ALLOW(__NR_write),
-#endif
-#ifdef __NR_writev
-	SECCOMP_ALLOW(__NR_writev),
-#endif
 #ifdef __NR_uname
 	SECCOMP_ALLOW(__NR_uname),
 #endif
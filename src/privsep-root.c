@@ -41,6 +41,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "auth.h"
@@ -51,6 +52,7 @@
 #include "eloop.h"
 #include "if.h"
 #include "ipv6nd.h"
+#include "leasedb.h"
 #include "logerr.h"
 #include "privsep.h"
 #include "sa.h"
@@ -58,21 +60,175 @@
 
 __CTASSERT(sizeof(ioctl_request_t) <= sizeof(unsigned long));
 
+/* Batched records are aligned for the structures within. */
+#define	PSB_ALIGN(len)		\
+	(((len) + sizeof(unsigned long) - 1) & ~(sizeof(unsigned long) - 1))
+
 struct psr_error
 {
 	ssize_t psr_result;
 	int psr_errno;
-	char psr_pad[sizeof(ssize_t) - sizeof(int)];
+	unsigned int psr_seq;	/* ps_seq of the request */
 	size_t psr_datalen;
 };
 
 struct psr_ctx {
 	struct dhcpcd_ctx *psr_ctx;
 	struct psr_error psr_error;
+	uint16_t psr_seq;
+	size_t psr_prefixlen;
+	void *psr_prefix;
 	size_t psr_datalen;
 	void *psr_data;
 };
 
+/* An asynchronous request to the privileged proxy. */
+struct psr_req {
+	TAILQ_ENTRY(psr_req) next;
+	uint16_t psr_seq;
+	bool psr_done;
+	struct psr_error psr_error;
+	void *psr_data;
+	void (*psr_cb)(void *, ssize_t, void *, size_t);
+	void *psr_cbarg;
+};
+
+static void
+ps_root_freereq(struct psr_req *req)
+{
+
+	free(req->psr_data);
+	free(req);
+}
+
+/* Read the reply to an asynchronous request.
+ * Completions are dispatched later by ps_root_dispatchreqs. */
+static int
+ps_root_readasync(struct dhcpcd_ctx *ctx, const struct psr_error *psr)
+{
+	struct psr_req *req;
+	struct psr_error discard;
+	struct iovec iov[] = {
+		{ .iov_base = NULL, .iov_len = sizeof(struct psr_error) },
+		{ .iov_base = NULL, .iov_len = 0 },
+	};
+	ssize_t len;
+
+	TAILQ_FOREACH(req, &ctx->ps_root_reqs, next) {
+		if (!req->psr_done && req->psr_seq == psr->psr_seq)
+			break;
+	}
+	if (req == NULL) {
+		/* Short read on a SOCK_SEQPACKET discards the record. */
+		if (read(ctx->ps_root->psp_fd, &discard, sizeof(discard)) == -1)
+			return -1;
+		errno = ESRCH;
+		return -1;
+	}
+
+	iov[0].iov_base = &req->psr_error;
+	if (psr->psr_datalen > SSIZE_MAX) {
+		errno = ENOBUFS;
+		goto err;
+	} else if (psr->psr_datalen != 0) {
+		req->psr_data = malloc(psr->psr_datalen);
+		if (req->psr_data == NULL)
+			goto err;
+		iov[1].iov_base = req->psr_data;
+		iov[1].iov_len = psr->psr_datalen;
+	}
+
+	len = readv(ctx->ps_root->psp_fd, iov, __arraycount(iov));
+	if (len == -1)
+		goto err;
+	if ((size_t)len != sizeof(*psr) + psr->psr_datalen) {
+		errno = EINVAL;
+		goto err;
+	}
+	req->psr_done = true;
+	return 0;
+
+err:
+	/* Still complete the request so the caller knows. */
+	req->psr_error.psr_result = -1;
+	req->psr_error.psr_errno = errno;
+	req->psr_error.psr_datalen = 0;
+	free(req->psr_data);
+	req->psr_data = NULL;
+	req->psr_done = true;
+	return -1;
+}
+
+static void ps_root_asynccb(void *, unsigned short);
+
+/* Replies arrive in the order requests were sent, so only
+ * completed requests at the head of the queue are dispatched. */
+static void
+ps_root_dispatchreqs(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct psr_req *req;
+
+	while ((req = TAILQ_FIRST(&ctx->ps_root_reqs)) != NULL &&
+	    req->psr_done)
+	{
+		TAILQ_REMOVE(&ctx->ps_root_reqs, req, next);
+		if (req->psr_cb != NULL) {
+			errno = req->psr_error.psr_errno;
+			req->psr_cb(req->psr_cbarg, req->psr_error.psr_result,
+			    req->psr_data, req->psr_error.psr_datalen);
+		}
+		ps_root_freereq(req);
+	}
+
+	/* Stop listening if nothing is in flight.
+	 * The callback may have stopped privsep. */
+	if (TAILQ_FIRST(&ctx->ps_root_reqs) == NULL && ctx->ps_root != NULL)
+		eloop_event_delete(ctx->eloop, ctx->ps_root->psp_fd);
+}
+
+static void
+ps_root_asynccb(void *arg, unsigned short events)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct psr_error psr;
+	ssize_t len;
+
+	if (events != ELE_READ)
+		logerrx("%s: unexpected event 0x%04x", __func__, events);
+
+	len = recv(ctx->ps_root->psp_fd, &psr, sizeof(psr), MSG_PEEK);
+	if (len == -1 || (size_t)len < sizeof(psr)) {
+		if (len != -1)
+			errno = EINVAL;
+		logerr(__func__);
+		/* Don't spin on a broken socket. */
+		eloop_event_delete(ctx->eloop, ctx->ps_root->psp_fd);
+		return;
+	}
+	if (ps_root_readasync(ctx, &psr) == -1)
+		logerr(__func__);
+	ps_root_dispatchreqs(ctx);
+}
+
+/* A synchronous read may find replies to asynchronous requests
+ * first. Those are read and their callbacks run once we
+ * are back in the main loop. */
+static bool
+ps_root_readother(struct psr_ctx *psr_ctx, struct psr_error *psr)
+{
+	struct dhcpcd_ctx *ctx = psr_ctx->psr_ctx;
+
+	if (psr->psr_seq == psr_ctx->psr_seq)
+		return false;
+	if (ps_root_readasync(ctx, psr) == -1)
+		logerr(__func__);
+	if (eloop_timeout_add_sec(ctx->eloop, 0,
+	    ps_root_dispatchreqs, ctx) == -1)
+		logerr(__func__);
+	return true;
+}
+
 static void
 ps_root_readerrorcb(void *arg, unsigned short events)
 {
@@ -81,6 +237,8 @@ ps_root_readerrorcb(void *arg, unsigned short events)
 	struct psr_error *psr_error = &psr_ctx->psr_error;
 	struct iovec iov[] = {
 		{ .iov_base = psr_error, .iov_len = sizeof(*psr_error) },
+		{ .iov_base = psr_ctx->psr_prefix,
+		  .iov_len = psr_ctx->psr_prefixlen },
 		{ .iov_base = psr_ctx->psr_data,
 		  .iov_len = psr_ctx->psr_datalen },
 	};
@@ -97,6 +255,17 @@ ps_root_readerrorcb(void *arg, unsigned short events)
 		goto out;			\
 	} while (0 /* CONSTCOND */)
 
+	if (TAILQ_FIRST(&ctx->ps_root_reqs) != NULL) {
+		len = recv(ctx->ps_root->psp_fd,
+		    psr_error, sizeof(*psr_error), MSG_PEEK);
+		if (len == -1)
+			PSR_ERROR(errno);
+		else if ((size_t)len < sizeof(*psr_error))
+			PSR_ERROR(EINVAL);
+		if (ps_root_readother(psr_ctx, psr_error))
+			return;
+	}
+
 	len = readv(ctx->ps_root->psp_fd, iov, __arraycount(iov));
 	if (len == -1)
 		PSR_ERROR(errno);
@@ -108,26 +277,284 @@ out:
 	eloop_exit(ctx->ps_eloop, exit_code);
 }
 
-ssize_t
-ps_root_readerror(struct dhcpcd_ctx *ctx, void *data, size_t len)
+/* Run the privsep loop until cb has read the reply. */
+static int
+ps_root_waitreply(struct dhcpcd_ctx *ctx,
+    void (*cb)(void *, unsigned short), struct psr_ctx *psr_ctx)
 {
-	struct psr_ctx psr_ctx = {
-	    .psr_ctx = ctx,
-	    .psr_data = data, .psr_datalen = len,
-	};
+#ifndef SMALL
+	struct timespec start, end;
+	unsigned long long ns;
+#endif
 
 	if (eloop_event_add(ctx->ps_eloop, ctx->ps_root->psp_fd, ELE_READ,
-	    ps_root_readerrorcb, &psr_ctx) == -1)
+	    cb, psr_ctx) == -1)
 		return -1;
 
+#ifndef SMALL
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
 	eloop_enter(ctx->ps_eloop);
 	eloop_start(ctx->ps_eloop, &ctx->sigset);
 	eloop_event_delete(ctx->ps_eloop, ctx->ps_root->psp_fd);
+#ifndef SMALL
+	if (clock_gettime(CLOCK_MONOTONIC, &end) == 0) {
+		ns = (unsigned long long)(end.tv_sec - start.tv_sec) *
+		    NSEC_PER_SEC +
+		    (unsigned long long)end.tv_nsec -
+		    (unsigned long long)start.tv_nsec;
+		ctx->ps_root_sync++;
+		ctx->ps_root_sync_ns += ns;
+		if (ns > ctx->ps_root_sync_ns_max)
+			ctx->ps_root_sync_ns_max = ns;
+	}
+#endif
+	return 0;
+}
+
+/* The reply data is split between prefix and data. */
+static ssize_t
+ps_root_readerrorprefix(struct dhcpcd_ctx *ctx, void *prefix, size_t plen,
+    void *data, size_t len)
+{
+	struct psr_ctx psr_ctx = {
+	    .psr_ctx = ctx,
+	    .psr_seq = ctx->ps_root_seq,
+	    .psr_prefix = prefix, .psr_prefixlen = plen,
+	    .psr_data = data, .psr_datalen = len,
+	};
+
+	if (ps_root_waitreply(ctx, ps_root_readerrorcb, &psr_ctx) == -1)
+		return -1;
 
 	errno = psr_ctx.psr_error.psr_errno;
 	return psr_ctx.psr_error.psr_result;
 }
 
+ssize_t
+ps_root_readerror(struct dhcpcd_ctx *ctx, void *data, size_t len)
+{
+
+	return ps_root_readerrorprefix(ctx, NULL, 0, data, len);
+}
+
+/*
+ * Send a command to the privileged proxy without waiting for the reply.
+ * cb is called from the main loop with the result, errno and any
+ * data returned, in the order the commands were sent.
+ */
+int
+ps_root_sendasync(struct dhcpcd_ctx *ctx, uint16_t cmd, unsigned long flags,
+    const void *data, size_t len,
+    void (*cb)(void *, ssize_t, void *, size_t), void *cbarg)
+{
+	struct psr_req *req;
+
+	req = calloc(1, sizeof(*req));
+	if (req == NULL)
+		return -1;
+	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, cmd, flags,
+	    data, len) == -1)
+	{
+		free(req);
+		return -1;
+	}
+	req->psr_seq = ctx->ps_root_seq;
+#ifndef SMALL
+	ctx->ps_root_async++;
+#endif
+	req->psr_cb = cb;
+	req->psr_cbarg = cbarg;
+	TAILQ_INSERT_TAIL(&ctx->ps_root_reqs, req, next);
+
+	if (eloop_event_add(ctx->eloop, ctx->ps_root->psp_fd, ELE_READ,
+	    ps_root_asynccb, ctx) == -1)
+	{
+		/* Any reply is discarded as it no longer matches. */
+		TAILQ_REMOVE(&ctx->ps_root_reqs, req, next);
+		ps_root_freereq(req);
+		return -1;
+	}
+	return 0;
+}
+
+void
+ps_root_freereqs(struct dhcpcd_ctx *ctx)
+{
+	struct psr_req *req;
+
+	while ((req = TAILQ_FIRST(&ctx->ps_root_reqs)) != NULL) {
+		TAILQ_REMOVE(&ctx->ps_root_reqs, req, next);
+		ps_root_freereq(req);
+	}
+}
+
+struct ps_batch {
+	struct ps_batch *psb_prev;	/* batch this one is nested in */
+	void (*psb_cb)(void *, ssize_t);
+	void *psb_cbarg;
+	size_t psb_n;
+	size_t psb_len;
+	uint8_t psb_buf[PS_BUFLEN - sizeof(struct ps_msghdr)];
+};
+
+/*
+ * While a batch is open, PS_ROUTE and PS_WRITEFILE_ATOMIC messages are
+ * queued and sent to the privileged proxy in one message when it is
+ * flushed or ended.
+ * cb is then called with the result and errno of each one in order.
+ * Any other request flushes the batch first to keep ordering.
+ * A batch started while another is open flushes that one and is
+ * nested in it, so each callback only sees the results of the
+ * commands queued while its batch was innermost.
+ */
+int
+ps_root_batch_start(struct dhcpcd_ctx *ctx,
+    void (*cb)(void *, ssize_t), void *cbarg)
+{
+	struct ps_batch *psb;
+
+	if (ps_root_batch_flush(ctx) == -1)
+		return -1;
+	psb = malloc(sizeof(*psb));
+	if (psb == NULL)
+		return -1;
+	psb->psb_prev = ctx->ps_root_batch;
+	psb->psb_cb = cb;
+	psb->psb_cbarg = cbarg;
+	psb->psb_n = psb->psb_len = 0;
+	ctx->ps_root_batch = psb;
+	return 0;
+}
+
+int
+ps_root_batch_flush(struct dhcpcd_ctx *ctx)
+{
+	struct ps_batch *psb = ctx->ps_root_batch;
+	struct psr_error *psr, *psrp;
+	size_t n, nrecs;
+	ssize_t err;
+
+	if (psb == NULL || psb->psb_n == 0)
+		return 0;
+
+	nrecs = psb->psb_n;
+	psr = calloc(nrecs, sizeof(*psr));
+	if (psr == NULL)
+		return -1;
+
+	/* Detach the batch so sending it doesn't flush it again. */
+	ctx->ps_root_batch = NULL;
+	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_BATCH, 0,
+	    psb->psb_buf, psb->psb_len) == -1)
+		err = -1;
+	else
+		err = ps_root_readerror(ctx, psr, nrecs * sizeof(*psr));
+	ctx->ps_root_batch = psb;
+	psb->psb_n = psb->psb_len = 0;
+
+	if (err == -1) {
+		int serrno = errno;
+
+		/* Every command failed as far as the caller knows. */
+		for (n = 0; n < nrecs; n++) {
+			psr[n].psr_result = -1;
+			psr[n].psr_errno = serrno;
+		}
+		err = (ssize_t)nrecs;
+	}
+
+	if (psb->psb_cb != NULL) {
+		for (n = 0, psrp = psr; n < (size_t)err && n < nrecs;
+		    n++, psrp++)
+		{
+			errno = psrp->psr_errno;
+			psb->psb_cb(psb->psb_cbarg, psrp->psr_result);
+		}
+	}
+
+	free(psr);
+	return 0;
+}
+
+/* Ends the innermost batch, the one it was nested in carries on. */
+int
+ps_root_batch_end(struct dhcpcd_ctx *ctx)
+{
+	struct ps_batch *psb = ctx->ps_root_batch;
+	int err;
+
+	if (psb == NULL)
+		return 0;
+	err = ps_root_batch_flush(ctx);
+	ctx->ps_root_batch = psb->psb_prev;
+	free(psb);
+	return err;
+}
+
+/* Queue a message in the open batch. */
+ssize_t
+ps_root_batch_msg(struct dhcpcd_ctx *ctx, uint16_t cmd, unsigned long flags,
+    const struct msghdr *msg)
+{
+	struct ps_batch *psb = ctx->ps_root_batch;
+	struct ps_msghdr psm = {
+		.ps_cmd = cmd,
+		.ps_flags = flags,
+		.ps_namelen = msg->msg_namelen,
+		.ps_controllen = (socklen_t)msg->msg_controllen,
+	};
+	size_t i, len;
+	uint8_t *p;
+
+	/* Batched messages don't have any. */
+	if (msg->msg_controllen != 0) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	len = msg->msg_namelen;
+	for (i = 0; i < (size_t)msg->msg_iovlen; i++)
+		len += msg->msg_iov[i].iov_len;
+	psm.ps_datalen = len;
+
+	if (sizeof(psm) + PSB_ALIGN(len) > sizeof(psb->psb_buf)) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	if (psb->psb_len + sizeof(psm) + PSB_ALIGN(len) >
+	    sizeof(psb->psb_buf) &&
+	    ps_root_batch_flush(ctx) == -1)
+		return -1;
+
+	p = psb->psb_buf + psb->psb_len;
+	memcpy(p, &psm, sizeof(psm));
+	p += sizeof(psm);
+	if (msg->msg_namelen != 0) {
+		memcpy(p, msg->msg_name, msg->msg_namelen);
+		p += msg->msg_namelen;
+	}
+	for (i = 0; i < (size_t)msg->msg_iovlen; i++) {
+		memcpy(p, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+		p += msg->msg_iov[i].iov_len;
+	}
+	memset(p, 0, PSB_ALIGN(len) - len);
+
+	psb->psb_len += sizeof(psm) + PSB_ALIGN(len);
+	psb->psb_n++;
+	return 0;
+}
+
+ssize_t
+ps_root_batch_cmd(struct dhcpcd_ctx *ctx, uint16_t cmd, unsigned long flags,
+    void *data, size_t len)
+{
+	struct iovec iov = { .iov_base = data, .iov_len = len };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	return ps_root_batch_msg(ctx, cmd, flags, &msg);
+}
+
 #ifdef PRIVSEP_GETIFADDRS
 static void
 ps_root_mreaderrorcb(void *arg, unsigned short events)
@@ -151,6 +578,8 @@ ps_root_mreaderrorcb(void *arg, unsigned short events)
 		PSR_ERROR(errno);
 	else if ((size_t)len < sizeof(*psr_error))
 		PSR_ERROR(EINVAL);
+	if (ps_root_readother(psr_ctx, psr_error))
+		return;
 
 	if (psr_error->psr_datalen > SSIZE_MAX)
 		PSR_ERROR(ENOBUFS);
@@ -179,16 +608,12 @@ ps_root_mreaderror(struct dhcpcd_ctx *ctx, void **data, size_t *len)
 {
 	struct psr_ctx psr_ctx = {
 	    .psr_ctx = ctx,
+	    .psr_seq = ctx->ps_root_seq,
 	};
 
-	if (eloop_event_add(ctx->ps_eloop, ctx->ps_root->psp_fd, ELE_READ,
-	    ps_root_mreaderrorcb, &psr_ctx) == -1)
+	if (ps_root_waitreply(ctx, ps_root_mreaderrorcb, &psr_ctx) == -1)
 		return -1;
 
-	eloop_enter(ctx->ps_eloop);
-	eloop_start(ctx->ps_eloop, &ctx->sigset);
-	eloop_event_delete(ctx->ps_eloop, ctx->ps_root->psp_fd);
-
 	errno = psr_ctx.psr_error.psr_errno;
 	*data = psr_ctx.psr_data;
 	*len = psr_ctx.psr_datalen;
@@ -197,12 +622,13 @@ ps_root_mreaderror(struct dhcpcd_ctx *ctx, void **data, size_t *len)
 #endif
 
 static ssize_t
-ps_root_writeerror(struct dhcpcd_ctx *ctx, ssize_t result,
-    void *data, size_t len)
+ps_root_writeerror(struct dhcpcd_ctx *ctx, const struct ps_msghdr *psm,
+    ssize_t result, void *data, size_t len)
 {
 	struct psr_error psr = {
 		.psr_result = result,
 		.psr_errno = errno,
+		.psr_seq = psm->ps_seq,
 		.psr_datalen = len,
 	};
 	struct iovec iov[] = {
@@ -262,35 +688,6 @@ ps_root_doioctl(unsigned long req, void *data, size_t len)
 	return err;
 }
 
-static ssize_t
-ps_root_run_script(struct dhcpcd_ctx *ctx, const void *data, size_t len)
-{
-	const char *envbuf = data;
-	char * const argv[] = { ctx->script, NULL };
-	pid_t pid;
-	int status;
-
-	if (len == 0)
-		return 0;
-
-	if (script_buftoenv(ctx, UNCONST(envbuf), len) == NULL)
-		return -1;
-
-	pid = script_exec(argv, ctx->script_env);
-	if (pid == -1)
-		return -1;
-
-	/* Wait for the script to finish */
-	while (waitpid(pid, &status, 0) == -1) {
-		if (errno != EINTR) {
-			logerr(__func__);
-			status = 0;
-			break;
-		}
-	}
-	return status;
-}
-
 static bool
 ps_root_validpath(const struct dhcpcd_ctx *ctx, uint16_t cmd, const char *path)
 {
@@ -324,11 +721,225 @@ ps_root_validpath(const struct dhcpcd_ctx *ctx, uint16_t cmd, const char *path)
 	return false;
 }
 
+/*
+ * Lease, DUID and secret files plus the config file are read each time
+ * an interface starts or we reconfigure.
+ * Keep them until they are written or unlinked through us, or stat(2)
+ * says they changed.
+ * Once PSR_NFILES are kept the least recently read is dropped.
+ */
+#define	PSR_NFILES	32
+
+struct psr_file {
+	rb_node_t psf_tree;
+	TAILQ_ENTRY(psr_file) psf_next;	/* least recently read first */
+	char *psf_path;
+	dev_t psf_dev;
+	ino_t psf_ino;
+	off_t psf_size;
+	struct timespec psf_mtim;
+	struct timespec psf_ctim;
+	size_t psf_len;
+	uint8_t psf_data[];
+};
+
+static int
+ps_root_cmpfile(__unused void *context, const void *node, const void *key)
+{
+	const struct psr_file *psf = node;
+
+	return strcmp(psf->psf_path, key);
+}
+
+static int
+ps_root_cmpfilenode(void *context, const void *node1, const void *node2)
+{
+	const struct psr_file *psf2 = node2;
+
+	return ps_root_cmpfile(context, node1, psf2->psf_path);
+}
+
+static const rb_tree_ops_t ps_root_file_ops = {
+	.rbto_compare_nodes = ps_root_cmpfilenode,
+	.rbto_compare_key = ps_root_cmpfile,
+	.rbto_node_offset = offsetof(struct psr_file, psf_tree),
+	.rbto_context = NULL
+};
+
+void
+ps_root_initcache(struct dhcpcd_ctx *ctx)
+{
+
+	rb_tree_init(&ctx->ps_root_files, &ps_root_file_ops);
+	TAILQ_INIT(&ctx->ps_root_filelru);
+	ctx->ps_root_nfiles = 0;
+}
+
+static void
+ps_root_freefile(struct dhcpcd_ctx *ctx, struct psr_file *psf)
+{
+
+	rb_tree_remove_node(&ctx->ps_root_files, psf);
+	TAILQ_REMOVE(&ctx->ps_root_filelru, psf, psf_next);
+	ctx->ps_root_nfiles--;
+	free(psf->psf_path);
+	free(psf);
+}
+
+static void
+ps_root_uncachefile(struct dhcpcd_ctx *ctx, const char *path)
+{
+	struct psr_file *psf;
+
+	psf = rb_tree_find_node(&ctx->ps_root_files, path);
+	if (psf != NULL)
+		ps_root_freefile(ctx, psf);
+}
+
+void
+ps_root_freecache(struct dhcpcd_ctx *ctx)
+{
+	struct psr_file *psf;
+
+	while ((psf = TAILQ_FIRST(&ctx->ps_root_filelru)) != NULL)
+		ps_root_freefile(ctx, psf);
+}
+
+static bool
+ps_root_samefile(const struct psr_file *psf, const struct stat *st)
+{
+
+	return psf->psf_dev == st->st_dev && psf->psf_ino == st->st_ino &&
+	    psf->psf_size == st->st_size &&
+	    timespeccmp(&psf->psf_mtim, &st->st_mtim, ==) &&
+	    timespeccmp(&psf->psf_ctim, &st->st_ctim, ==);
+}
+
+/* Files in /proc and /sys change without stat(2) telling us. */
+static bool
+ps_root_cachefileok(const struct dhcpcd_ctx *ctx, const char *path)
+{
+
+	if (strcmp(ctx->cffile, path) == 0)
+		return true;
+	return strncmp(DBDIR, path, strlen(DBDIR)) == 0;
+}
+
+static void
+ps_root_cachefile(struct dhcpcd_ctx *ctx, const char *path,
+    const struct stat *st, const void *data, size_t len)
+{
+	struct psr_file *psf;
+
+	if (ctx->ps_root_nfiles >= PSR_NFILES)
+		ps_root_freefile(ctx, TAILQ_FIRST(&ctx->ps_root_filelru));
+	psf = malloc(sizeof(*psf) + len);
+	if (psf == NULL)
+		return;
+	psf->psf_path = strdup(path);
+	if (psf->psf_path == NULL) {
+		free(psf);
+		return;
+	}
+	psf->psf_dev = st->st_dev;
+	psf->psf_ino = st->st_ino;
+	psf->psf_size = st->st_size;
+	psf->psf_mtim = st->st_mtim;
+	psf->psf_ctim = st->st_ctim;
+	psf->psf_len = len;
+	memcpy(psf->psf_data, data, len);
+	rb_tree_insert_node(&ctx->ps_root_files, psf);
+	TAILQ_INSERT_TAIL(&ctx->ps_root_filelru, psf, psf_next);
+	ctx->ps_root_nfiles++;
+}
+
+/* rdata is set to the cached file or buf. */
+static ssize_t
+ps_root_doreadfile(struct dhcpcd_ctx *ctx, const char *path,
+    void *buf, size_t len, void **rdata)
+{
+	struct psr_file *psf;
+	struct stat st;
+	ssize_t bytes;
+
+	*rdata = buf;
+	if (leasedb_match(ctx, path))
+		return leasedb_read(ctx, path, buf, len);
+	if (!ps_root_cachefileok(ctx, path))
+		return readfile(path, buf, len);
+	if (stat(path, &st) == -1) {
+		ps_root_uncachefile(ctx, path);
+		return readfile(path, buf, len);
+	}
+
+	psf = rb_tree_find_node(&ctx->ps_root_files, path);
+	if (psf != NULL) {
+		if (ps_root_samefile(psf, &st)) {
+			/* Like readfile, a buffer it fills may have
+			 * been too small. */
+			if (psf->psf_len >= len) {
+				errno = ENOBUFS;
+				return -1;
+			}
+			TAILQ_REMOVE(&ctx->ps_root_filelru, psf, psf_next);
+			TAILQ_INSERT_TAIL(&ctx->ps_root_filelru, psf, psf_next);
+			*rdata = psf->psf_data;
+			return (ssize_t)psf->psf_len;
+		}
+		ps_root_uncachefile(ctx, path);
+	}
+
+	bytes = readfile(path, buf, len);
+	if (bytes != -1)
+		ps_root_cachefile(ctx, path, &st, buf, (size_t)bytes);
+	return bytes;
+}
+
+/* PS_READLEASE replies with the lease mtime followed by the lease. */
 static ssize_t
-ps_root_dowritefile(const struct dhcpcd_ctx *ctx,
+ps_root_doreadlease(struct dhcpcd_ctx *ctx, const char *path,
+    uint8_t *buf, size_t len)
+{
+	time_t mtime;
+	void *rdata;
+	ssize_t bytes;
+	int err;
+
+	len -= sizeof(mtime);
+	bytes = ps_root_doreadfile(ctx, path, buf + sizeof(mtime), len,
+	    &rdata);
+	if (bytes == -1)
+		return -1;
+	if (rdata != buf + sizeof(mtime))
+		memcpy(buf + sizeof(mtime), rdata, (size_t)bytes);
+
+	if (leasedb_match(ctx, path))
+		err = leasedb_mtime(ctx, path, &mtime);
+	else
+		err = filemtime(path, &mtime);
+	if (err == -1)
+		return -1;
+	memcpy(buf, &mtime, sizeof(mtime));
+	return bytes;
+}
+
+/* PS_WRITEFILE_ATOMIC prefixes the file name with the mtime to set. */
+static ssize_t
+ps_root_dowritefile(struct dhcpcd_ctx *ctx, uint16_t cmd,
     mode_t mode, void *data, size_t len)
 {
 	char *file = data, *nc;
+	time_t mtime = 0;
+
+	if (cmd == PS_WRITEFILE_ATOMIC) {
+		if (len < sizeof(mtime)) {
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(&mtime, data, sizeof(mtime));
+		file += sizeof(mtime);
+		len -= sizeof(mtime);
+	}
 
 	nc = memchr(file, '\0', len);
 	if (nc == NULL) {
@@ -338,8 +949,14 @@ ps_root_dowritefile(const struct dhcpcd_ctx *ctx,
 
 	if (!ps_root_validpath(ctx, PS_WRITEFILE, file))
 		return -1;
+	ps_root_uncachefile(ctx, file);
 	nc++;
-	return writefile(file, mode, nc, len - (size_t)(nc - file));
+	len -= (size_t)(nc - file);
+	if (leasedb_match(ctx, file))
+		return leasedb_write(ctx, file, nc, len, mtime);
+	if (cmd == PS_WRITEFILE_ATOMIC)
+		return writefile_atomic(file, mode, nc, len, mtime);
+	return writefile(file, mode, nc, len);
 }
 
 #ifdef AUTH
@@ -456,10 +1073,141 @@ ps_root_dogetifaddrs(void **rdata, size_t *rlen)
 }
 #endif
 
+#ifdef __linux__
+/* Send a run of netlink requests for the same protocol together. */
+static size_t
+ps_root_dobatchnetlink(struct ps_msghdr *psm, struct iovec *iov,
+    size_t n, struct psr_error *psr)
+{
+	ssize_t results[64];
+	int errnos[__arraycount(results)];
+	size_t i, nreq;
+
+	if (n > __arraycount(results))
+		n = __arraycount(results);
+	for (nreq = 1; nreq < n; nreq++) {
+		if (psm[nreq].ps_cmd != PS_ROUTE ||
+		    psm[nreq].ps_flags != psm[0].ps_flags)
+			break;
+	}
+
+	if (ps_root_dosendnetlinkv((int)psm[0].ps_flags, iov, nreq,
+	    results, errnos) == -1)
+	{
+		for (i = 0; i < nreq; i++) {
+			results[i] = -1;
+			errnos[i] = errno;
+		}
+	}
+	for (i = 0; i < nreq; i++) {
+		psr[i].psr_result = results[i];
+		psr[i].psr_errno = errnos[i];
+	}
+	return nreq;
+}
+#endif
+
+/*
+ * Run each command in a batch in order.
+ * Only PS_ROUTE and PS_WRITEFILE_ATOMIC can be batched, which covers
+ * route and address changes on Linux and lease files.
+ * The reply is a psr_error for each command.
+ */
+static ssize_t
+ps_root_dobatch(struct dhcpcd_ctx *ctx, void *data, size_t len,
+    void **rdata, size_t *rlen)
+{
+	uint8_t *p = data, *ep = p + len;
+	struct ps_msghdr *psm;
+	struct iovec *iov;
+	struct msghdr *msg;
+	struct psr_error *psr;
+#ifndef __linux__
+	void *odata;
+	size_t olen;
+#endif
+	size_t n, i, nrecs;
+	ssize_t err;
+
+	/* Each record is at least a header. */
+	nrecs = len / sizeof(*psm) + 1;
+	psr = calloc(nrecs, sizeof(*psr));
+	psm = calloc(nrecs, sizeof(*psm));
+	iov = calloc(nrecs, sizeof(*iov));
+	msg = calloc(nrecs, sizeof(*msg));
+	if (psr == NULL || psm == NULL || iov == NULL || msg == NULL)
+		goto err;
+
+	for (n = 0; p < ep; n++) {
+		if ((size_t)(ep - p) < sizeof(*psm))
+			goto einval;
+		memcpy(&psm[n], p, sizeof(*psm));
+		p += sizeof(*psm);
+		msg[n].msg_iov = &iov[n];
+		if (psm[n].ps_datalen > (size_t)(ep - p) ||
+		    ps_unrollmsg(&msg[n], &psm[n], p, psm[n].ps_datalen) == -1)
+			goto einval;
+		psr[n].psr_seq = psm[n].ps_seq;
+		p += PSB_ALIGN(psm[n].ps_datalen);
+	}
+
+	for (i = 0; i < n; i++) {
+		errno = 0;
+		switch (psm[i].ps_cmd) {
+		case PS_ROUTE:
+#ifdef __linux__
+			/* Only the data, which is the netlink request,
+			 * is used so they can go in one datagram. */
+			i += ps_root_dobatchnetlink(&psm[i], &iov[i],
+			    n - i, &psr[i]) - 1;
+			continue;
+#else
+			err = ps_root_os(&psm[i], &msg[i], -1,
+			    &odata, &olen);
+			break;
+#endif
+		case PS_WRITEFILE_ATOMIC:
+			err = ps_root_dowritefile(ctx, psm[i].ps_cmd,
+			    (mode_t)psm[i].ps_flags,
+			    iov[i].iov_base, iov[i].iov_len);
+			break;
+		default:
+			errno = ENOTSUP;
+			err = -1;
+			break;
+		}
+		psr[i].psr_result = err;
+		psr[i].psr_errno = errno;
+	}
+
+	free(psm);
+	free(iov);
+	free(msg);
+	*rdata = psr;
+	*rlen = n * sizeof(*psr);
+	return (ssize_t)n;
+
+einval:
+	errno = EINVAL;
+err:
+	free(psr);
+	free(psm);
+	free(iov);
+	free(msg);
+	return -1;
+}
+
+/* A command and the descriptor, if any, sent with it. */
+struct ps_root_msg {
+	struct dhcpcd_ctx *ctx;
+	int fd;
+};
+
 static ssize_t
 ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 {
-	struct dhcpcd_ctx *ctx = arg;
+	struct ps_root_msg *rm = arg;
+	struct dhcpcd_ctx *ctx = rm->ctx;
 	uint16_t cmd;
 	struct ps_process *psp;
 	struct iovec *iov = msg->msg_iov;
@@ -467,6 +1215,9 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 	size_t len = iov->iov_len, rlen = 0;
 	uint8_t buf[PS_BUFLEN];
 	time_t mtime;
+#ifndef SMALL
+	unsigned long long sst[3];
+#endif
 	ssize_t err;
 	bool free_rdata = false;
 
@@ -498,6 +1249,18 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 		return 0;
 	}
 
+#ifdef INET
+	if (ctx->ps_bpf_shared) {
+		switch (cmd) {
+#ifdef ARP
+		case PS_BPF_ARP:	/* FALLTHROUGH */
+#endif
+		case PS_BPF_BOOTP:
+			return ps_bpf_sharedcmd(ctx, psm, msg);
+		}
+	}
+#endif
+
 	if (psm->ps_cmd & PS_STOP && psp == NULL)
 		return 0;
 
@@ -538,8 +1301,18 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 		}
 		break;
 	case PS_SCRIPT:
-		err = ps_root_run_script(ctx, data, len);
+		err = script_queue(ctx, data, len);
 		break;
+#ifndef SMALL
+	case PS_SCRIPTSTATS:
+		sst[0] = ctx->script_runs;
+		sst[1] = ctx->script_ns;
+		sst[2] = ctx->script_ns_max;
+		rdata = sst;
+		rlen = sizeof(sst);
+		err = 0;
+		break;
+#endif
 	case PS_STOPPROCS:
 		ctx->options |= DHCPCD_EXITING;
 		TAILQ_FOREACH(psp, &ctx->ps_processes, next) {
@@ -553,25 +1326,42 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 			err = -1;
 			break;
 		}
-		err = unlink(data);
+		ps_root_uncachefile(ctx, data);
+		if (leasedb_match(ctx, data))
+			err = leasedb_unlink(ctx, data);
+		else
+			err = unlink(data);
 		break;
 	case PS_READFILE:
 		if (!ps_root_validpath(ctx, psm->ps_cmd, data)) {
 			err = -1;
 			break;
 		}
-		err = readfile(data, buf, sizeof(buf));
+		err = ps_root_doreadfile(ctx, data, buf, sizeof(buf), &rdata);
+		if (err != -1)
+			rlen = (size_t)err;
+		break;
+	case PS_READLEASE:
+		if (!ps_root_validpath(ctx, psm->ps_cmd, data)) {
+			err = -1;
+			break;
+		}
+		err = ps_root_doreadlease(ctx, data, buf, sizeof(buf));
 		if (err != -1) {
 			rdata = buf;
-			rlen = (size_t)err;
+			rlen = sizeof(mtime) + (size_t)err;
 		}
 		break;
 	case PS_WRITEFILE:
-		err = ps_root_dowritefile(ctx, (mode_t)psm->ps_flags,
-		    data, len);
+	case PS_WRITEFILE_ATOMIC:
+		err = ps_root_dowritefile(ctx, psm->ps_cmd,
+		    (mode_t)psm->ps_flags, data, len);
 		break;
 	case PS_FILEMTIME:
-		err = filemtime(data, &mtime);
+		if (leasedb_match(ctx, data))
+			err = leasedb_mtime(ctx, data, &mtime);
+		else
+			err = filemtime(data, &mtime);
 		if (err != -1) {
 			rdata = &mtime;
 			rlen = sizeof(mtime);
@@ -595,6 +1385,10 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 		free_rdata = true;
 		break;
 #endif
+	case PS_BATCH:
+		err = ps_root_dobatch(ctx, data, len, &rdata, &rlen);
+		free_rdata = true;
+		break;
 #if defined(INET6) && (defined(__linux__) || defined(HAVE_PLEDGE))
 	case PS_IP6FORWARDING:
 		 err = ip6_forwarding(data);
@@ -609,11 +1403,11 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 		break;
 #endif
 	default:
-		err = ps_root_os(psm, msg, &rdata, &rlen);
+		err = ps_root_os(psm, msg, rm->fd, &rdata, &rlen);
 		break;
 	}
 
-	err = ps_root_writeerror(ctx, err, rlen != 0 ? rdata : 0, rlen);
+	err = ps_root_writeerror(ctx, psm, err, rlen != 0 ? rdata : 0, rlen);
 	if (free_rdata)
 		free(rdata);
 	return err;
@@ -624,10 +1418,14 @@ static void
 ps_root_recvmsg(void *arg, unsigned short events)
 {
 	struct ps_process *psp = arg;
+	struct ps_root_msg rm = { .ctx = psp->psp_ctx, .fd = -1 };
 
-	if (ps_recvpsmsg(psp->psp_ctx, psp->psp_fd, events,
-	    ps_root_recvmsgcb, psp->psp_ctx) == -1)
+	/* Some commands act on a descriptor sent with them. */
+	if (ps_recvpsmsgfd(psp->psp_ctx, psp->psp_fd, events,
+	    ps_root_recvmsgcb, &rm, &rm.fd) == -1)
 		logerr(__func__);
+	if (rm.fd != -1)
+		close(rm.fd);
 }
 
 #ifdef PLUGIN_DEV
@@ -651,6 +1449,40 @@ ps_root_handleinterface(void *arg, int action, const char *ifname)
 	return (int)ps_sendcmd(ctx, ctx->ps_data_fd, PS_DEV_IFCMD,
 	    flag, ifname, strlen(ifname) + 1);
 }
+
+/* Added interfaces are sent as NUL terminated names, many to a message. */
+static int
+ps_root_handleinterfaces(void *arg, int argc, char * const *argv)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	char *buf;
+	size_t len, nlen;
+	int i;
+
+	if ((buf = malloc(PS_DEV_IFBATCH)) == NULL)
+		return -1;
+	len = 0;
+	for (i = 0; i < argc; i++) {
+		nlen = strlen(argv[i]) + 1;
+		if (len + nlen > PS_DEV_IFBATCH) {
+			if (ps_sendcmd(ctx, ctx->ps_data_fd, PS_DEV_IFCMD,
+			    PS_DEV_IFADDED, buf, len) == -1)
+				goto err;
+			len = 0;
+		}
+		memcpy(buf + len, argv[i], nlen);
+		len += nlen;
+	}
+	if (len != 0 && ps_sendcmd(ctx, ctx->ps_data_fd, PS_DEV_IFCMD,
+	    PS_DEV_IFADDED, buf, len) == -1)
+		goto err;
+	free(buf);
+	return argc;
+
+err:
+	free(buf);
+	return -1;
+}
 #endif
 
 static int
@@ -718,7 +1550,8 @@ ps_root_startcb(struct ps_process *psp)
 	 * change the interface name provided by the kernel */
 	if ((ctx->options & (DHCPCD_MANAGER | DHCPCD_DEV)) ==
 	    (DHCPCD_MANAGER | DHCPCD_DEV))
-		dev_start(ctx, ps_root_handleinterface);
+		dev_start(ctx, ps_root_handleinterface,
+		    ps_root_handleinterfaces);
 #endif
 	return 0;
 }
@@ -736,6 +1569,8 @@ ps_root_signalcb(int sig, void *arg)
 		return;
 
 	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		if (script_reaped(ctx, pid, status))
+			continue;
 		psp = ps_findprocesspid(ctx, pid);
 		if (psp != NULL) {
 			ifname = psp->psp_ifname;
@@ -776,6 +1611,32 @@ ps_root_signalcb(int sig, void *arg)
 int (*handle_interface)(void *, int, const char *);
 
 #ifdef PLUGIN_DEV
+static ssize_t
+ps_root_devadded(struct dhcpcd_ctx *ctx, char *buf, size_t len)
+{
+	char **argv, *p;
+	int argc;
+	ssize_t n;
+
+	if (len == 0 || buf[len - 1] != '\0') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	argc = 0;
+	for (p = buf; p < buf + len; p += strlen(p) + 1)
+		argc++;
+	if ((argv = calloc((size_t)argc, sizeof(*argv))) == NULL)
+		return -1;
+	argc = 0;
+	for (p = buf; p < buf + len; p += strlen(p) + 1)
+		argv[argc++] = p;
+
+	n = dhcpcd_handleinterfaces(ctx, argc, argv);
+	free(argv);
+	return n;
+}
+
 static ssize_t
 ps_root_devcb(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm, struct msghdr *msg)
 {
@@ -789,8 +1650,7 @@ ps_root_devcb(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm, struct msghdr *msg)
 
 	switch(psm->ps_flags) {
 	case PS_DEV_IFADDED:
-		action = 1;
-		break;
+		return ps_root_devadded(ctx, iov->iov_base, iov->iov_len);
 	case PS_DEV_IFREMOVED:
 		action = -1;
 		break;
@@ -890,6 +1750,11 @@ ps_root_start(struct dhcpcd_ctx *ctx)
 			return -1;
 		ctx->ps_data_fd = datafd[1];
 		close(datafd[0]);
+#ifdef INET
+		if (ctx->ps_bpf_poolsize != 0 && !ctx->ps_bpf_shared)
+			eloop_timeout_add_sec(ctx->eloop, 0,
+			    ps_bpf_fillpool, ctx);
+#endif
 		return 0;
 	} else if (pid == -1)
 		return -1;
@@ -899,8 +1764,9 @@ ps_root_start(struct dhcpcd_ctx *ctx)
 
 	ctx->ps_data_fd = datafd[0];
 	close(datafd[1]);
-	if (eloop_event_add(ctx->eloop, ctx->ps_data_fd, ELE_READ,
-	    ps_root_dispatch, ctx) == -1)
+	/* BPF and network proxies send us their packets here. */
+	if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_HIGH, ctx->ps_data_fd,
+	    ELE_READ, ps_root_dispatch, ctx) == -1)
 		return 1;
 
 	return pid;
@@ -909,6 +1775,7 @@ ps_root_start(struct dhcpcd_ctx *ctx)
 int
 ps_root_stop(struct dhcpcd_ctx *ctx)
 {
+	struct ps_batch *psb;
 
 	/* If we are the root process, ensure the log fd is fully drained. */
 	if (ctx->options & DHCPCD_PRIVSEPROOT && ctx->ps_log_fd != -1) {
@@ -922,6 +1789,15 @@ ps_root_stop(struct dhcpcd_ctx *ctx)
 	    ctx->eloop == NULL)
 		return 0;
 
+	/* Anything in flight is answered before the proxy stops,
+	 * but we won't be reading it. */
+	eloop_timeout_delete(ctx->eloop, ps_root_dispatchreqs, ctx);
+	ps_root_freereqs(ctx);
+	while ((psb = ctx->ps_root_batch) != NULL) {
+		ctx->ps_root_batch = psb->psb_prev;
+		free(psb);
+	}
+
 	if (ps_stopprocess(ctx->ps_root) == -1)
 		return -1;
 	ctx->ps_root = NULL;
@@ -941,14 +1817,23 @@ ps_root_stopprocesses(struct dhcpcd_ctx *ctx)
 	return ps_root_readerror(ctx, NULL, 0);
 }
 
+static void
+ps_root_scriptcb(__unused void *arg, ssize_t result,
+    __unused void *data, __unused size_t len)
+{
+
+	if (result == -1)
+		logerr(__func__);
+}
+
+/* Scripts can take a while and nothing needs their exit status,
+ * so don't block the manager waiting for them. */
 ssize_t
 ps_root_script(struct dhcpcd_ctx *ctx, const void *data, size_t len)
 {
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_SCRIPT,
-	    0, data, len) == -1)
-		return -1;
-	return ps_root_readerror(ctx, NULL, 0);
+	return ps_root_sendasync(ctx, PS_SCRIPT, 0, data, len,
+	    ps_root_scriptcb, NULL);
 }
 
 ssize_t
@@ -989,23 +1874,73 @@ ps_root_readfile(struct dhcpcd_ctx *ctx, const char *file,
 	return ps_root_readerror(ctx, data, len);
 }
 
+ssize_t
+ps_root_readlease(struct dhcpcd_ctx *ctx, const char *file,
+    void *data, size_t len, time_t *mtime)
+{
+	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_READLEASE, 0,
+	    file, strlen(file) + 1) == -1)
+		return -1;
+	return ps_root_readerrorprefix(ctx, mtime, sizeof(*mtime), data, len);
+}
+
 ssize_t
 ps_root_writefile(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
     const void *data, size_t len)
 {
-	char buf[PS_BUFLEN];
-	size_t flen;
+	size_t flen = strlen(file) + 1;
+	struct iovec iov[] = {
+		{ .iov_base = UNCONST(file), .iov_len = flen },
+		{ .iov_base = UNCONST(data), .iov_len = len },
+	};
+	struct msghdr msg = {
+		.msg_iov = iov, .msg_iovlen = __arraycount(iov),
+	};
+
+	/* The root process reads at most PS_BUFLEN. */
+	if (flen > PS_BUFLEN || len > PS_BUFLEN - flen) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	if (ps_sendmsg(ctx, ctx->ps_root->psp_fd, PS_WRITEFILE, mode,
+	    &msg) == -1)
+		return -1;
+	return ps_root_readerror(ctx, NULL, 0);
+}
+
+/* If a batch is open the write is queued in it and the result
+ * is given to the batch callback. */
+ssize_t
+ps_root_writefile_atomic(struct dhcpcd_ctx *ctx, const char *file,
+    mode_t mode, const void *data, size_t len, time_t mtime)
+{
+	size_t flen = strlen(file) + 1;
+	struct iovec iov[] = {
+		{ .iov_base = &mtime, .iov_len = sizeof(mtime) },
+		{ .iov_base = UNCONST(file), .iov_len = flen },
+		{ .iov_base = UNCONST(data), .iov_len = len },
+	};
+	struct msghdr msg = {
+		.msg_iov = iov, .msg_iovlen = __arraycount(iov),
+	};
 
-	flen = strlcpy(buf, file, sizeof(buf));
-	flen += 1;
-	if (flen > sizeof(buf) || flen + len > sizeof(buf)) {
+	/* The root process reads at most PS_BUFLEN. */
+	if (flen > PS_BUFLEN - sizeof(mtime) ||
+	    len > PS_BUFLEN - sizeof(mtime) - flen)
+	{
 		errno = ENOBUFS;
 		return -1;
 	}
-	memcpy(buf + flen, data, len);
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_WRITEFILE, mode,
-	    buf, flen + len) == -1)
+	if (ctx->ps_root_batch != NULL) {
+		if (ps_root_batch_msg(ctx, PS_WRITEFILE_ATOMIC, mode,
+		    &msg) == -1)
+			return -1;
+		return (ssize_t)len;
+	}
+	if (ps_sendmsg(ctx, ctx->ps_root->psp_fd, PS_WRITEFILE_ATOMIC, mode,
+	    &msg) == -1)
 		return -1;
 	return ps_root_readerror(ctx, NULL, 0);
 }
@@ -1123,6 +2058,24 @@ ps_root_ip6forwarding(struct dhcpcd_ctx *ctx, const char *ifname)
 }
 #endif
 
+#ifndef SMALL
+/* Scripts run in the privileged proxy, so it keeps the counts. */
+int
+ps_root_scriptstats(struct dhcpcd_ctx *ctx)
+{
+	unsigned long long sst[3];
+
+	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_SCRIPTSTATS, 0,
+	    NULL, 0) == -1 ||
+	    ps_root_readerror(ctx, sst, sizeof(sst)) == -1)
+		return -1;
+	ctx->script_runs = sst[0];
+	ctx->script_ns = sst[1];
+	ctx->script_ns_max = sst[2];
+	return 0;
+}
+#endif
+
 #ifdef AUTH
 int
 ps_root_getauthrdm(struct dhcpcd_ctx *ctx, uint64_t *rdm)
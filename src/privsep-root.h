@@ -31,32 +31,58 @@
 
 #include "if.h"
 
-#if defined(PRIVSEP) && (defined(HAVE_CAPSICUM) || defined(__linux__))
+/* Linux reads links and addresses from netlink, see if_getlinks. */
+#if defined(PRIVSEP) && defined(HAVE_CAPSICUM)
 #define PRIVSEP_GETIFADDRS
 #endif
 
+struct psr_req;
+TAILQ_HEAD(psr_req_head, psr_req);
+struct ps_batch;
+
 pid_t ps_root_start(struct dhcpcd_ctx *ctx);
 int ps_root_stop(struct dhcpcd_ctx *ctx);
+void ps_root_initcache(struct dhcpcd_ctx *);
+void ps_root_freecache(struct dhcpcd_ctx *);
 void ps_root_signalcb(int, void *);
 
 ssize_t ps_root_readerror(struct dhcpcd_ctx *, void *, size_t);
 ssize_t ps_root_mreaderror(struct dhcpcd_ctx *, void **, size_t *);
+int ps_root_sendasync(struct dhcpcd_ctx *, uint16_t, unsigned long,
+    const void *, size_t, void (*)(void *, ssize_t, void *, size_t), void *);
+void ps_root_freereqs(struct dhcpcd_ctx *);
+int ps_root_batch_start(struct dhcpcd_ctx *, void (*)(void *, ssize_t),
+    void *);
+int ps_root_batch_flush(struct dhcpcd_ctx *);
+int ps_root_batch_end(struct dhcpcd_ctx *);
+ssize_t ps_root_batch_msg(struct dhcpcd_ctx *, uint16_t, unsigned long,
+    const struct msghdr *);
+ssize_t ps_root_batch_cmd(struct dhcpcd_ctx *, uint16_t, unsigned long,
+    void *, size_t);
 ssize_t ps_root_ioctl(struct dhcpcd_ctx *, ioctl_request_t, void *, size_t);
 ssize_t ps_root_ip6forwarding(struct dhcpcd_ctx *, const char *);
 ssize_t ps_root_unlink(struct dhcpcd_ctx *, const char *);
 ssize_t ps_root_filemtime(struct dhcpcd_ctx *, const char *, time_t *);
 ssize_t ps_root_readfile(struct dhcpcd_ctx *, const char *, void *, size_t);
+ssize_t ps_root_readlease(struct dhcpcd_ctx *, const char *, void *, size_t,
+    time_t *);
 ssize_t ps_root_writefile(struct dhcpcd_ctx *, const char *, mode_t,
     const void *, size_t);
+ssize_t ps_root_writefile_atomic(struct dhcpcd_ctx *, const char *, mode_t,
+    const void *, size_t, time_t);
 ssize_t ps_root_logreopen(struct dhcpcd_ctx *);
 ssize_t ps_root_script(struct dhcpcd_ctx *, const void *, size_t);
 ssize_t ps_root_stopprocesses(struct dhcpcd_ctx *);
+#ifndef SMALL
+int ps_root_scriptstats(struct dhcpcd_ctx *);
+#endif
 int ps_root_getauthrdm(struct dhcpcd_ctx *, uint64_t *);
 #ifdef PRIVSEP_GETIFADDRS
 int ps_root_getifaddrs(struct dhcpcd_ctx *, struct ifaddrs **);
 #endif
 
-ssize_t ps_root_os(struct ps_msghdr *, struct msghdr *, void **, size_t *);
+ssize_t ps_root_os(struct ps_msghdr *, struct msghdr *, int,
+    void **, size_t *);
 #if defined(BSD) || defined(__sun)
 ssize_t ps_root_route(struct dhcpcd_ctx *, void *, size_t);
 ssize_t ps_root_ioctllink(struct dhcpcd_ctx *, unsigned long, void *, size_t);
@@ -67,6 +93,12 @@ ssize_t ps_root_ifignoregroup(struct dhcpcd_ctx *, const char *);
 #endif
 #ifdef __linux__
 ssize_t ps_root_sendnetlink(struct dhcpcd_ctx *, int, struct msghdr *);
+ssize_t ps_root_setlinkrcvbuf(struct dhcpcd_ctx *, int);
+struct sock_filter;
+ssize_t ps_root_setlinkfilter(struct dhcpcd_ctx *,
+    const struct sock_filter *, size_t);
+ssize_t ps_root_dosendnetlinkv(int, struct iovec *, size_t,
+    ssize_t *, int *);
 #endif
 
 #ifdef PLUGIN_DEV
@@ -76,7 +76,7 @@ ps_root_doroute(void *data, size_t len)
 }
 
 ssize_t
-ps_root_os(struct ps_msghdr *psm, struct msghdr *msg,
+ps_root_os(struct ps_msghdr *psm, struct msghdr *msg, __unused int fd,
     void **rdata, size_t *rlen)
 {
 	struct iovec *iov = msg->msg_iov;
@@ -72,6 +72,7 @@
 #include "ipv6nd.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "probe.h"
 
 #ifdef HAVE_CAPSICUM
 #include <sys/capsicum.h>
@@ -91,6 +92,92 @@
 #define CALC_CMSG_PADLEN(has_cmsg, pos) \
     ((has_cmsg) ? (socklen_t)(CMSG_ALIGN((pos)) - (pos)) : 0)
 
+/* Processes are indexed by ps_id and by pid so we don't
+ * have to walk the list for every message. */
+static int
+ps_process_cmpid(__unused void *context, const void *n1, const void *n2)
+{
+
+	return memcmp(&((const struct ps_process *)n1)->psp_id, n2,
+	    sizeof(struct ps_id));
+}
+
+static int
+ps_process_cmpidnode(void *context, const void *n1, const void *n2)
+{
+
+	return ps_process_cmpid(context, n1,
+	    &((const struct ps_process *)n2)->psp_id);
+}
+
+static int
+ps_process_cmppid(__unused void *context, const void *n1, const void *n2)
+{
+	pid_t p1 = ((const struct ps_process *)n1)->psp_pid;
+	pid_t p2 = *(const pid_t *)n2;
+
+	if (p1 < p2)
+		return -1;
+	if (p1 > p2)
+		return 1;
+	return 0;
+}
+
+static int
+ps_process_cmppidnode(void *context, const void *n1, const void *n2)
+{
+
+	return ps_process_cmppid(context, n1,
+	    &((const struct ps_process *)n2)->psp_pid);
+}
+
+static const rb_tree_ops_t ps_process_id_ops = {
+	.rbto_compare_nodes = ps_process_cmpidnode,
+	.rbto_compare_key = ps_process_cmpid,
+	.rbto_node_offset = offsetof(struct ps_process, psp_idtree),
+	.rbto_context = NULL
+};
+
+static const rb_tree_ops_t ps_process_pid_ops = {
+	.rbto_compare_nodes = ps_process_cmppidnode,
+	.rbto_compare_key = ps_process_cmppid,
+	.rbto_node_offset = offsetof(struct ps_process, psp_pidtree),
+	.rbto_context = NULL
+};
+
+void
+ps_initprocesses(struct dhcpcd_ctx *ctx)
+{
+
+	TAILQ_INIT(&ctx->ps_processes);
+	rb_tree_init(&ctx->ps_processids, &ps_process_id_ops);
+	rb_tree_init(&ctx->ps_processpids, &ps_process_pid_ops);
+	ps_root_initcache(ctx);
+#ifdef INET
+	TAILQ_INIT(&ctx->ps_bpf_pool);
+	ps_bpf_initshared(ctx);
+#endif
+}
+
+void
+ps_setprocessid(struct ps_process *psp, struct ps_id *psid)
+{
+	struct dhcpcd_ctx *ctx = psp->psp_ctx;
+
+	if (rb_tree_find_node(&ctx->ps_processids, &psp->psp_id) == psp)
+		rb_tree_remove_node(&ctx->ps_processids, psp);
+	memcpy(&psp->psp_id, psid, sizeof(psp->psp_id));
+	rb_tree_insert_node(&ctx->ps_processids, psp);
+}
+
+static void
+ps_setprocesspid(struct ps_process *psp, pid_t pid)
+{
+
+	psp->psp_pid = pid;
+	rb_tree_insert_node(&psp->psp_ctx->ps_processpids, psp);
+}
+
 int
 ps_init(struct dhcpcd_ctx *ctx)
 {
@@ -121,7 +208,7 @@ ps_init(struct dhcpcd_ctx *ctx)
 	return 0;
 }
 
-static int
+int
 ps_dropprivs(struct dhcpcd_ctx *ctx)
 {
 	struct passwd *pw = ctx->ps_user;
@@ -152,20 +239,27 @@ ps_dropprivs(struct dhcpcd_ctx *ctx)
 	 * Sadly, this is a POSIX limitation and most platforms adhere to it.
 	 * However, some are not that strict and are whitelisted below.
 	 * Also, if we're not using poll then we can be restrictive.
+	 * The polling mechanism is chosen at runtime, so check which one.
 	 *
 	 * For the non whitelisted platforms there should be a sandbox to
 	 * fallback to where we don't allow new files, etc:
 	 *      Linux:seccomp, FreeBSD:capsicum, OpenBSD:pledge
 	 * Solaris users are sadly out of luck on both counts.
 	 */
-#if defined(__NetBSD__) || defined(__DragonFly__) || \
-    defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
+#if defined(__NetBSD__) || defined(__DragonFly__)
+	bool nofile = true;
+#else
+	const char *poll = eloop_backend(ctx->eloop);
+	bool nofile = strcmp(poll, "kqueue") == 0 || strcmp(poll, "epoll") == 0;
+#endif
+
 	/* The control proxy *does* need to create new fd's via accept(2). */
-	if (ctx->ps_ctl == NULL || ctx->ps_ctl->psp_pid != getpid()) {
+	if (nofile &&
+	    (ctx->ps_ctl == NULL || ctx->ps_ctl->psp_pid != getpid()))
+	{
 		if (setrlimit(RLIMIT_NOFILE, &rzero) == -1)
 			logerr("setrlimit RLIMIT_NOFILE");
 	}
-#endif
 
 #define DHC_NOCHKIO	(DHCPCD_STARTED | DHCPCD_DAEMONISE)
 	/* Prohibit writing to files.
@@ -368,6 +462,8 @@ ps_startprocess(struct ps_process *psp,
 	}
 #endif
 
+	/* Or the child would write out our buffered log lines too. */
+	logflush();
 #ifdef HAVE_CAPSICUM
 	pid = pdfork(&psp->psp_pfd, PD_CLOEXEC);
 #else
@@ -382,18 +478,19 @@ ps_startprocess(struct ps_process *psp,
 #endif
 		return -1;
 	case 0:
-		psp->psp_pid = getpid();
+		ps_setprocesspid(psp, getpid());
 		psp->psp_fd = fd[1];
 		close(fd[0]);
 		break;
 	default:
-		psp->psp_pid = pid;
+		ps_setprocesspid(psp, pid);
 		psp->psp_fd = fd[0];
 		close(fd[1]);
 		if (recv_unpriv_msg == NULL)
 			;
-		else if (eloop_event_add(ctx->eloop, psp->psp_fd, ELE_READ,
-		    recv_unpriv_msg, psp) == -1)
+		else if (eloop_p_event_add(ctx->eloop,
+		    flags & PSF_LOWPRIO ? ELOOP_PRIO_LOW : ELOOP_PRIO_NORMAL,
+		    psp->psp_fd, ELE_READ, recv_unpriv_msg, psp) == -1)
 		{
 			logerr("%s: eloop_event_add fd %d",
 			    __func__, psp->psp_fd);
@@ -429,6 +526,12 @@ ps_startprocess(struct ps_process *psp,
 		close(ctx->fork_fd);
 		ctx->fork_fd = -1;
 	}
+	if (ctx->script_worker_fd != -1) {
+		/* The script worker belongs to our parent. */
+		close(ctx->script_worker_fd);
+		ctx->script_worker_fd = -1;
+		ctx->script_worker_pid = 0;
+	}
 
 	/* This process has no need of the blocking inner eloop. */
 	if (!(flags & PSF_ELOOP)) {
@@ -543,11 +646,14 @@ ps_start(struct dhcpcd_ctx *ctx)
 {
 	pid_t pid;
 
-	TAILQ_INIT(&ctx->ps_processes);
+	ps_initprocesses(ctx);
+	TAILQ_INIT(&ctx->ps_root_reqs);
 
 	/* We need an inner eloop to block with. */
 	if ((ctx->ps_eloop = eloop_new()) == NULL)
 		return -1;
+	if (eloop_set_backend(ctx->ps_eloop, eloop_backend(ctx->eloop)) == -1)
+		logerr("%s: eloop_set_backend", __func__);
 	eloop_signal_set_cb(ctx->ps_eloop,
 	    dhcpcd_signals, dhcpcd_signals_len,
 	    dhcpcd_signal_cb, ctx);
@@ -770,6 +876,18 @@ ps_freeprocess(struct ps_process *psp)
 	struct dhcpcd_ctx *ctx = psp->psp_ctx;
 
 	TAILQ_REMOVE(&ctx->ps_processes, psp, next);
+	/* Only remove ourself should a duplicate key have been refused. */
+	if (rb_tree_find_node(&ctx->ps_processids, &psp->psp_id) == psp)
+		rb_tree_remove_node(&ctx->ps_processids, psp);
+	if (psp->psp_pid != 0 &&
+	    rb_tree_find_node(&ctx->ps_processpids, &psp->psp_pid) == psp)
+		rb_tree_remove_node(&ctx->ps_processpids, psp);
+#ifdef INET
+	if (psp->psp_pooled) {
+		TAILQ_REMOVE(&ctx->ps_bpf_pool, psp, psp_poolnext);
+		ctx->ps_bpf_npool--;
+	}
+#endif
 
 	if (psp->psp_fd != -1) {
 		eloop_event_delete(ctx->eloop, psp->psp_fd);
@@ -794,6 +912,10 @@ ps_freeprocess(struct ps_process *psp)
 	if (ctx->ps_ctl == psp)
 		ctx->ps_ctl = NULL;
 #ifdef INET
+	if (ctx->ps_bpf == psp) {
+		ctx->ps_bpf = NULL;
+		ps_bpf_freeshared(ctx);
+	}
 	if (psp->psp_bpf != NULL)
 		bpf_close(psp->psp_bpf);
 #endif
@@ -822,6 +944,7 @@ ps_free(struct dhcpcd_ctx *ctx)
 			ps_stopprocess(psp);
 		ps_freeprocess(psp);
 	}
+	ps_root_freecache(ctx);
 }
 
 int
@@ -870,60 +993,85 @@ ps_unrollmsg(struct msghdr *msg, struct ps_msghdr *psm,
 	return 0;
 }
 
-ssize_t
-ps_sendpsmmsg(struct dhcpcd_ctx *ctx, int fd,
-    struct ps_msghdr *psm, const struct msghdr *msg)
+/* Payload iovecs we can send without allocating. */
+#define	PS_IOVLEN	8
+
+/* Send psm and msg to fd, optionally passing sfd as well.
+ * msg may carry any number of iovecs which are sent as is. */
+static ssize_t
+ps_sendpsmmsg1(struct dhcpcd_ctx *ctx, int fd,
+    struct ps_msghdr *psm, const struct msghdr *msg, int sfd)
 {
 	long padding[1] = { 0 };
-	struct iovec iov[] = {
-		{ .iov_base = UNCONST(psm), .iov_len = sizeof(*psm) },
-		{ .iov_base = NULL, },	/* name */
-		{ .iov_base = NULL, },	/* control padding */
-		{ .iov_base = NULL, },	/* control */
-		{ .iov_base = NULL, },	/* payload 1 */
-		{ .iov_base = NULL, },	/* payload 2 */
-		{ .iov_base = NULL, },	/* payload 3 */
-	};
-	int iovlen;
+	struct iovec iovbuf[4 + PS_IOVLEN], *iov = iovbuf;
+	union {
+		struct cmsghdr hdr;
+		uint8_t buf[CMSG_SPACE(sizeof(int))];
+	} cmsgbuf = { .buf = { 0 } };
+	struct msghdr smsg = { .msg_name = NULL };
+	struct cmsghdr *cmsg;
+	size_t iovlen;
 	ssize_t len;
 
+	if (ctx->ps_root != NULL && fd == ctx->ps_root->psp_fd) {
+		/* Batched commands must run first. */
+		if (ctx->ps_root_batch != NULL &&
+		    ps_root_batch_flush(ctx) == -1)
+			return -1;
+		/* Lets replies from the root process be matched. */
+		psm->ps_seq = ++ctx->ps_root_seq;
+	}
+
+	if (msg != NULL && (size_t)msg->msg_iovlen > PS_IOVLEN) {
+		iov = reallocarray(NULL, 4 + (size_t)msg->msg_iovlen,
+		    sizeof(*iov));
+		if (iov == NULL)
+			return -1;
+	}
+
+	iov[0].iov_base = UNCONST(psm);
+	iov[0].iov_len = sizeof(*psm);
 	if (msg != NULL) {
-		struct iovec *iovp = &iov[1];
-		int i;
 		socklen_t cmsg_padlen;
+		size_t i;
 
 		psm->ps_namelen = msg->msg_namelen;
 		psm->ps_controllen = (socklen_t)msg->msg_controllen;
 
-		iovp->iov_base = msg->msg_name;
-		iovp->iov_len = msg->msg_namelen;
-		iovp++;
+		iov[1].iov_base = msg->msg_name;
+		iov[1].iov_len = msg->msg_namelen;
 
 		cmsg_padlen =
 		    CALC_CMSG_PADLEN(msg->msg_controllen, msg->msg_namelen);
 		assert(cmsg_padlen <= sizeof(padding));
-		iovp->iov_len = cmsg_padlen;
-		iovp->iov_base = cmsg_padlen != 0 ? padding : NULL;
-		iovp++;
-
-		iovp->iov_base = msg->msg_control;
-		iovp->iov_len = msg->msg_controllen;
-		iovlen = 4;
-
-		for (i = 0; i < (int)msg->msg_iovlen; i++) {
-			if ((size_t)(iovlen + i) > __arraycount(iov)) {
-				errno =	ENOBUFS;
-				return -1;
-			}
-			iovp++;
-			iovp->iov_base = msg->msg_iov[i].iov_base;
-			iovp->iov_len = msg->msg_iov[i].iov_len;
-		}
-		iovlen += i;
+		iov[2].iov_len = cmsg_padlen;
+		iov[2].iov_base = cmsg_padlen != 0 ? padding : NULL;
+
+		iov[3].iov_base = msg->msg_control;
+		iov[3].iov_len = msg->msg_controllen;
+
+		for (i = 0; i < (size_t)msg->msg_iovlen; i++)
+			iov[4 + i] = msg->msg_iov[i];
+		iovlen = 4 + i;
 	} else
 		iovlen = 1;
 
-	len = writev(fd, iov, iovlen);
+	smsg.msg_iov = iov;
+	smsg.msg_iovlen = iovlen;
+	if (sfd != -1) {
+		smsg.msg_control = cmsgbuf.buf;
+		smsg.msg_controllen = sizeof(cmsgbuf.buf);
+		cmsg = CMSG_FIRSTHDR(&smsg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &sfd, sizeof(sfd));
+	}
+
+	len = sendmsg(fd, &smsg, 0);
+	PROBE3(ps_sendpsmmsg, psm->ps_cmd, psm->ps_seq, len);
+	if (iov != iovbuf)
+		free(iov);
 	if (len == -1) {
 		if (ctx->options & DHCPCD_FORKED &&
 		    !(ctx->options & DHCPCD_PRIVSEPROOT))
@@ -932,6 +1080,23 @@ ps_sendpsmmsg(struct dhcpcd_ctx *ctx, int fd,
 	return len;
 }
 
+ssize_t
+ps_sendpsmmsg(struct dhcpcd_ctx *ctx, int fd,
+    struct ps_msghdr *psm, const struct msghdr *msg)
+{
+
+	return ps_sendpsmmsg1(ctx, fd, psm, msg, -1);
+}
+
+/* As above, also passing sfd to the receiver. */
+ssize_t
+ps_sendpsmmsgfd(struct dhcpcd_ctx *ctx, int fd,
+    struct ps_msghdr *psm, const struct msghdr *msg, int sfd)
+{
+
+	return ps_sendpsmmsg1(ctx, fd, psm, msg, sfd);
+}
+
 ssize_t
 ps_sendpsmdata(struct dhcpcd_ctx *ctx, int fd,
     struct ps_msghdr *psm, const void *data, size_t len)
@@ -946,6 +1111,19 @@ ps_sendpsmdata(struct dhcpcd_ctx *ctx, int fd,
 	return ps_sendpsmmsg(ctx, fd, psm, &msg);
 }
 
+ssize_t
+ps_sendpsmdatafd(struct dhcpcd_ctx *ctx, int fd,
+    struct ps_msghdr *psm, const void *data, size_t len, int sfd)
+{
+	struct iovec iov[] = {
+		{ .iov_base = UNCONST(data), .iov_len = len },
+	};
+	struct msghdr msg = {
+		.msg_iov = iov, .msg_iovlen = 1,
+	};
+
+	return ps_sendpsmmsgfd(ctx, fd, psm, &msg, sfd);
+}
 
 ssize_t
 ps_sendmsg(struct dhcpcd_ctx *ctx, int fd, uint16_t cmd, unsigned long flags,
@@ -1099,10 +1277,12 @@ ps_recvmsg(struct dhcpcd_ctx *ctx, int rfd, unsigned short events,
 	return len;
 }
 
-ssize_t
-ps_recvpsmsg(struct dhcpcd_ctx *ctx, int fd, unsigned short events,
+/* If rfd is not NULL, a descriptor passed with the message is returned
+ * there before callback is called, otherwise it's -1. */
+static ssize_t
+ps_recvpsmsg1(struct dhcpcd_ctx *ctx, int fd, unsigned short events,
     ssize_t (*callback)(void *, struct ps_msghdr *, struct msghdr *),
-    void *cbctx)
+    void *cbctx, int *rfd)
 {
 	struct ps_msg psm;
 	ssize_t len;
@@ -1114,7 +1294,30 @@ ps_recvpsmsg(struct dhcpcd_ctx *ctx, int fd, unsigned short events,
 	if (!(events & ELE_READ))
 		logerrx("%s: unexpected event 0x%04x", __func__, events);
 
-	len = read(fd, &psm, sizeof(psm));
+	if (rfd != NULL) {
+		union {
+			struct cmsghdr hdr;
+			uint8_t buf[CMSG_SPACE(sizeof(int))];
+		} cmsgbuf = { .buf = { 0 } };
+		struct iovec riov = {
+			.iov_base = &psm, .iov_len = sizeof(psm),
+		};
+		struct msghdr rmsg = {
+			.msg_iov = &riov, .msg_iovlen = 1,
+			.msg_control = cmsgbuf.buf,
+			.msg_controllen = sizeof(cmsgbuf.buf),
+		};
+		struct cmsghdr *cmsg;
+
+		*rfd = -1;
+		len = recvmsg(fd, &rmsg, 0);
+		cmsg = len > 0 ? CMSG_FIRSTHDR(&rmsg) : NULL;
+		if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			memcpy(rfd, CMSG_DATA(cmsg), sizeof(*rfd));
+	} else
+		len = read(fd, &psm, sizeof(psm));
 #ifdef PRIVSEP_DEBUG
 	logdebugx("%s: %zd", __func__, len);
 #endif
@@ -1158,17 +1361,34 @@ ps_recvpsmsg(struct dhcpcd_ctx *ctx, int fd, unsigned short events,
 	return callback(cbctx, &psm.psm_hdr, &msg);
 }
 
+ssize_t
+ps_recvpsmsg(struct dhcpcd_ctx *ctx, int fd, unsigned short events,
+    ssize_t (*callback)(void *, struct ps_msghdr *, struct msghdr *),
+    void *cbctx)
+{
+
+	return ps_recvpsmsg1(ctx, fd, events, callback, cbctx, NULL);
+}
+
+/* The caller owns any descriptor returned in rfd. */
+ssize_t
+ps_recvpsmsgfd(struct dhcpcd_ctx *ctx, int fd, unsigned short events,
+    ssize_t (*callback)(void *, struct ps_msghdr *, struct msghdr *),
+    void *cbctx, int *rfd)
+{
+
+	return ps_recvpsmsg1(ctx, fd, events, callback, cbctx, rfd);
+}
+
 struct ps_process *
 ps_findprocess(struct dhcpcd_ctx *ctx, struct ps_id *psid)
 {
 	struct ps_process *psp;
 
-	TAILQ_FOREACH(psp, &ctx->ps_processes, next) {
-		if (memcmp(&psp->psp_id, psid, sizeof(psp->psp_id)) == 0)
-			return psp;
-	}
-	errno = ESRCH;
-	return NULL;
+	psp = rb_tree_find_node(&ctx->ps_processids, psid);
+	if (psp == NULL)
+		errno = ESRCH;
+	return psp;
 }
 
 struct ps_process *
@@ -1176,12 +1396,10 @@ ps_findprocesspid(struct dhcpcd_ctx *ctx, pid_t pid)
 {
 	struct ps_process *psp;
 
-	TAILQ_FOREACH(psp, &ctx->ps_processes, next) {
-		if (psp->psp_pid == pid)
-			return psp;
-	}
-	errno = ESRCH;
-	return NULL;
+	psp = rb_tree_find_node(&ctx->ps_processpids, &pid);
+	if (psp == NULL)
+		errno = ESRCH;
+	return psp;
 }
 
 struct ps_process *
@@ -1202,6 +1420,7 @@ ps_newprocess(struct dhcpcd_ctx *ctx, struct ps_id *psid)
 	if (!(ctx->options & DHCPCD_MANAGER))
 		strlcpy(psp->psp_ifname, ctx->ifv[0], sizeof(psp->psp_name));
 	TAILQ_INSERT_TAIL(&ctx->ps_processes, psp, next);
+	rb_tree_insert_node(&ctx->ps_processids, psp);
 	return psp;
 }
 
@@ -34,6 +34,7 @@
 /* Start flags */
 #define	PSF_DROPPRIVS		0x01
 #define	PSF_ELOOP		0x02
+#define	PSF_LOWPRIO		0x04	/* parent reads at low priority */
 
 /* Protocols */
 #define	PS_BOOTP		0x0001
@@ -41,6 +42,8 @@
 #define	PS_DHCP6		0x0003
 #define	PS_BPF_BOOTP		0x0004
 #define	PS_BPF_ARP		0x0005
+#define	PS_BPF_POOL		0x0006	/* forked BPF, not yet assigned */
+#define	PS_BPF_SHARED		0x0007	/* BPF for all interfaces */
 
 /* Generic commands */
 #define	PS_IOCTL		0x0010
@@ -55,6 +58,10 @@
 #define	PS_CTL_EOF		0x0019
 #define	PS_LOGREOPEN		0x0020
 #define	PS_STOPPROCS		0x0021
+#define	PS_BATCH		0x0022
+#define	PS_WRITEFILE_ATOMIC	0x0023
+#define	PS_READLEASE		0x0024
+#define	PS_SCRIPTSTATS		0x0025
 
 /* Domains */
 #define	PS_ROOT			0x0101
@@ -69,6 +76,10 @@
 #define	PS_GETIFADDRS		0x0205
 #define	PS_IFIGNOREGRP		0x0206
 
+/* Linux Commands */
+#define	PS_LINKRCVBUF		0x0207
+#define	PS_LINKFILTER		0x0208
+
 /* Dev Commands */
 #define	PS_DEV_LISTENING	0x1001
 #define	PS_DEV_INITTED		0x1002
@@ -78,6 +89,8 @@
 #define	PS_DEV_IFADDED		0x0001
 #define	PS_DEV_IFREMOVED	0x0002
 #define	PS_DEV_IFUPDATED	0x0003
+/* PS_DEV_IFADDED carries up to this many bytes of names */
+#define	PS_DEV_IFBATCH		(32 * 1024)
 
 /* Control Type (via flags) */
 #define	PS_CTL_PRIV		0x0004
@@ -149,7 +162,8 @@ struct ps_id {
 
 struct ps_msghdr {
 	uint16_t ps_cmd;
-	uint8_t ps_pad[sizeof(unsigned long) - sizeof(uint16_t)];
+	uint16_t ps_seq;	/* echoed in replies from the root process */
+	uint8_t ps_pad[sizeof(unsigned long) - (sizeof(uint16_t) * 2)];
 	unsigned long ps_flags;
 	struct ps_id ps_id;
 	socklen_t ps_namelen;
@@ -166,6 +180,8 @@ struct ps_msg {
 struct bpf;
 struct ps_process {
 	TAILQ_ENTRY(ps_process) next;
+	rb_node_t psp_idtree;
+	rb_node_t psp_pidtree;
 	struct dhcpcd_ctx *psp_ctx;
 	struct ps_id psp_id;
 	pid_t psp_pid;
@@ -181,6 +197,8 @@ struct ps_process {
 	int (*psp_filter)(const struct bpf *, const struct in_addr *);
 	struct interface psp_ifp; /* Move BPF gubbins elsewhere */
 	struct bpf *psp_bpf;
+	TAILQ_ENTRY(ps_process) psp_poolnext;
+	bool psp_pooled;
 #endif
 
 #ifdef HAVE_CAPSICUM
@@ -200,6 +218,7 @@ int ps_init(struct dhcpcd_ctx *);
 int ps_start(struct dhcpcd_ctx *);
 int ps_stop(struct dhcpcd_ctx *);
 int ps_stopwait(struct dhcpcd_ctx *);
+int ps_dropprivs(struct dhcpcd_ctx *);
 int ps_entersandbox(const char *, const char **);
 int ps_managersandbox(struct dhcpcd_ctx *, const char *);
 
@@ -208,6 +227,10 @@ ssize_t ps_sendpsmmsg(struct dhcpcd_ctx *, int,
     struct ps_msghdr *, const struct msghdr *);
 ssize_t ps_sendpsmdata(struct dhcpcd_ctx *, int,
     struct ps_msghdr *, const void *, size_t);
+ssize_t ps_sendpsmmsgfd(struct dhcpcd_ctx *, int,
+    struct ps_msghdr *, const struct msghdr *, int);
+ssize_t ps_sendpsmdatafd(struct dhcpcd_ctx *, int,
+    struct ps_msghdr *, const void *, size_t, int);
 ssize_t ps_sendmsg(struct dhcpcd_ctx *, int, uint16_t, unsigned long,
     const struct msghdr *);
 ssize_t ps_sendcmd(struct dhcpcd_ctx *, int, uint16_t, unsigned long,
@@ -215,6 +238,8 @@ ssize_t ps_sendcmd(struct dhcpcd_ctx *, int, uint16_t, unsigned long,
 ssize_t ps_recvmsg(struct dhcpcd_ctx *, int, unsigned short, uint16_t, int);
 ssize_t ps_recvpsmsg(struct dhcpcd_ctx *, int, unsigned short,
     ssize_t (*callback)(void *, struct ps_msghdr *, struct msghdr *), void *);
+ssize_t ps_recvpsmsgfd(struct dhcpcd_ctx *, int, unsigned short,
+    ssize_t (*)(void *, struct ps_msghdr *, struct msghdr *), void *, int *);
 
 /* Internal privsep functions. */
 int ps_setbuf_fdpair(int []);
@@ -240,6 +265,8 @@ pid_t ps_startprocess(struct ps_process *,
 int ps_stopprocess(struct ps_process *);
 struct ps_process *ps_findprocess(struct dhcpcd_ctx *, struct ps_id *);
 struct ps_process *ps_findprocesspid(struct dhcpcd_ctx *, pid_t);
+void ps_initprocesses(struct dhcpcd_ctx *);
+void ps_setprocessid(struct ps_process *, struct ps_id *);
 struct ps_process *ps_newprocess(struct dhcpcd_ctx *, struct ps_id *);
 void ps_process_timeout(void *);
 void ps_freeprocess(struct ps_process *);
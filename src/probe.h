@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include "config.h"
+
+/*
+ * Static probes in the dhcpcd provider for bpftrace, perf or dtrace.
+ * Each is a single nop until a tracer attaches to it.
+ * Arguments are evaluated regardless so must be cheap.
+ * Pointer arguments are only valid for the duration of the probe.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define	PROBE0(n)		DTRACE_PROBE(dhcpcd, n)
+#define	PROBE1(n, a)		DTRACE_PROBE1(dhcpcd, n, a)
+#define	PROBE2(n, a, b)		DTRACE_PROBE2(dhcpcd, n, a, b)
+#define	PROBE3(n, a, b, c)	DTRACE_PROBE3(dhcpcd, n, a, b, c)
+#else
+#define	PROBE0(n)		do { } while (0 /* CONSTCOND */)
+#define	PROBE1(n, a)		do { } while (0 /* CONSTCOND */)
+#define	PROBE2(n, a, b)		do { } while (0 /* CONSTCOND */)
+#define	PROBE3(n, a, b, c)	do { } while (0 /* CONSTCOND */)
+#endif
+
+#endif
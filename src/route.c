@@ -31,19 +31,23 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "config.h"
 #include "common.h"
 #include "dhcpcd.h"
+#include "eloop.h"
 #include "if.h"
 #include "if-options.h"
 #include "ipv4.h"
 #include "ipv4ll.h"
 #include "ipv6.h"
 #include "logerr.h"
+#include "probe.h"
 #include "route.h"
 #include "sa.h"
 
@@ -127,6 +131,43 @@ rt_cmp_dest(const struct rt *rt1, const struct rt *rt2)
 	return rt_cmp_netmask(rt1, rt2);
 }
 
+/*
+ * Work out the key rt_compare_os sorts on.
+ * This must be called once the destination, netmask and flags are set
+ * and before the route is used with ctx->routes or ctx->kroutes.
+ */
+void
+rt_setkey(struct rt *rt)
+{
+	struct rt_key *rk = &rt->rt_key;
+	const uint8_t *addr, *mask;
+	socklen_t off, len, mlen, i;
+
+	memset(rk, 0, sizeof(*rk));
+	rk->rk_family = (uint8_t)rt->rt_dest.sa_family;
+	len = sa_addrlen(&rt->rt_dest);
+	if (len == 0 || len > sizeof(rk->rk_dest))
+		return;
+	off = sa_addroffset(&rt->rt_dest);
+	addr = (const uint8_t *)&rt->rt_dest + off;
+	mask = (const uint8_t *)&rt->rt_netmask + off;
+
+	/* Mask the destination the same way as rt_maskedaddr. */
+	if (sa_is_unspecified(&rt->rt_netmask)) {
+		memcpy(rk->rk_dest, addr, len);
+	} else {
+		mlen = sa_len(&rt->rt_netmask);
+		mlen = mlen > off ? MIN(mlen - off, len) : 0;
+		for (i = 0; i < mlen; i++) {
+			rk->rk_dest[i] = addr[i] & mask[i];
+			rk->rk_netmask[i] = mask[i];
+		}
+	}
+
+	if (rt->rt_flags & RTF_HOST)
+		memset(rk->rk_netmask, 0xff, len);
+}
+
 static int
 rt_compare_os(__unused void *context, const void *node1, const void *node2)
 {
@@ -134,7 +175,7 @@ rt_compare_os(__unused void *context, const void *node1, const void *node2)
 	int c;
 
 	/* Sort by masked destination. */
-	c = rt_cmp_dest(rt1, rt2);
+	c = memcmp(&rt1->rt_key, &rt2->rt_key, sizeof(rt1->rt_key));
 	if (c != 0)
 		return c;
 
@@ -221,19 +262,59 @@ const rb_tree_ops_t rt_compare_proto_ops = {
 };
 
 #ifdef RT_FREE_ROUTE_TABLE
-static int
-rt_compare_free(__unused void *context, const void *node1, const void *node2)
-{
+/*
+ * Routes are carved from slabs aligned to their size, so rt_free can
+ * find the slab, and from that the context, from the route alone.
+ * Free routes go on a list in the context, so recycling one costs no
+ * more than a pointer swap. The slabs themselves are kept until
+ * rt_dispose.
+ */
+#define	RT_SLAB_SIZE	4096
 
-	return node1 == node2 ? 0 : node1 < node2 ? -1 : 1;
-}
+struct rt_slab {
+	struct rt_slab *rs_next;
+	struct dhcpcd_ctx *rs_ctx;
+};
 
-static const rb_tree_ops_t rt_compare_free_ops = {
-	.rbto_compare_nodes = rt_compare_free,
-	.rbto_compare_key = rt_compare_free,
-	.rbto_node_offset = offsetof(struct rt, rt_tree),
-	.rbto_context = NULL
+struct rt_freeslot {
+	struct rt_freeslot *next;
 };
+
+#define	RT_SLAB_HDRLEN	((sizeof(struct rt_slab) + 15) & ~(size_t)15)
+#define	RT_SLAB_ROUTES	((RT_SLAB_SIZE - RT_SLAB_HDRLEN) / sizeof(struct rt))
+
+static int
+rt_slab_new(struct dhcpcd_ctx *ctx)
+{
+	struct rt_slab *rs;
+	struct rt_freeslot *fs;
+	void *p;
+	size_t i;
+	int err;
+
+	/* A non-zero return is an errno, not -1. */
+	if ((err = posix_memalign(&p, RT_SLAB_SIZE, RT_SLAB_SIZE)) != 0) {
+		errno = err;
+		return -1;
+	}
+	rs = p;
+	rs->rs_ctx = ctx;
+	rs->rs_next = ctx->rt_slabs;
+	ctx->rt_slabs = rs;
+
+	/* Push in reverse so the routes are handed out in order. */
+	for (i = RT_SLAB_ROUTES; i-- > 0; ) {
+		fs = (void *)((char *)rs + RT_SLAB_HDRLEN + i * sizeof(struct rt));
+		fs->next = ctx->rt_free;
+		ctx->rt_free = fs;
+	}
+#ifdef RT_FREE_ROUTE_TABLE_STATS
+	croutes += RT_SLAB_ROUTES;
+	if (croutes > mroutes)
+		mroutes = croutes;
+#endif
+	return 0;
+}
 #endif
 
 void
@@ -241,9 +322,7 @@ rt_init(struct dhcpcd_ctx *ctx)
 {
 
 	rb_tree_init(&ctx->routes, &rt_compare_os_ops);
-#ifdef RT_FREE_ROUTE_TABLE
-	rb_tree_init(&ctx->froutes, &rt_compare_free_ops);
-#endif
+	rb_tree_init(&ctx->kroutes, &rt_compare_os_ops);
 }
 
 bool
@@ -257,7 +336,13 @@ rt_is_default(const struct rt *rt)
 static void
 rt_desc(const char *cmd, const struct rt *rt)
 {
-	char dest[INET_MAX_ADDRSTRLEN], gateway[INET_MAX_ADDRSTRLEN];
+	char dest[INET_MAX_ADDRSTRLEN];
+#ifdef HAVE_ROUTE_MULTIPATH
+	char gateway[(INET_MAX_ADDRSTRLEN + 2) * (RT_MAXPATH + 1)];
+	size_t i, len;
+#else
+	char gateway[INET_MAX_ADDRSTRLEN];
+#endif
 	int prefix;
 	const char *ifname;
 	bool gateway_unspec;
@@ -268,6 +353,15 @@ rt_desc(const char *cmd, const struct rt *rt)
 	sa_addrtop(&rt->rt_dest, dest, sizeof(dest));
 	prefix = sa_toprefix(&rt->rt_netmask);
 	sa_addrtop(&rt->rt_gateway, gateway, sizeof(gateway));
+#ifdef HAVE_ROUTE_MULTIPATH
+	for (i = 0; i < rt->rt_npath; i++) {
+		len = strlen(gateway);
+		gateway[len++] = ',';
+		gateway[len++] = ' ';
+		sa_addrtop(&rt->rt_ss_mpath[i].sa, gateway + len,
+		    (socklen_t)(sizeof(gateway) - len));
+	}
+#endif
 	gateway_unspec = sa_is_unspecified(&rt->rt_gateway);
 	ifname = rt->rt_ifp == NULL ? "(null)" : rt->rt_ifp->name;
 
@@ -305,8 +399,18 @@ rt_headclear0(struct dhcpcd_ctx *ctx, rb_tree_t *rts, int af)
 	if (rts == NULL)
 		return;
 	assert(ctx != NULL);
+
 #ifdef RT_FREE_ROUTE_TABLE
-	assert(&ctx->froutes != rts);
+	/* The whole tree goes, so don't rebalance it node by node.
+	 * A free route keeps its tree node as rt_free only writes over
+	 * the start of it, so the walk can carry on through it. */
+	if (af == AF_UNSPEC) {
+		RB_TREE_FOREACH_SAFE(rt, rts, rtn) {
+			rt_free(rt);
+		}
+		rb_tree_init(rts, rts->rbt_ops);
+		return;
+	}
 #endif
 
 	RB_TREE_FOREACH_SAFE(rt, rts, rtn) {
@@ -329,6 +433,7 @@ rt_headclear(rb_tree_t *rts, int af)
 	rt_headclear0(rt->rt_ifp->ctx, rts, af);
 }
 
+#ifndef RT_FREE_ROUTE_TABLE
 static void
 rt_headfree(rb_tree_t *rts)
 {
@@ -336,24 +441,71 @@ rt_headfree(rb_tree_t *rts)
 
 	while ((rt = RB_TREE_MIN(rts)) != NULL) {
 		rb_tree_remove_node(rts, rt);
-		free(rt);
+		rt_free(rt);
 	}
 }
+#endif
 
 void
 rt_dispose(struct dhcpcd_ctx *ctx)
 {
+#ifdef RT_FREE_ROUTE_TABLE
+	struct rt_slab *rs;
+#endif
 
 	assert(ctx != NULL);
-	rt_headfree(&ctx->routes);
 #ifdef RT_FREE_ROUTE_TABLE
-	rt_headfree(&ctx->froutes);
+	/* Every route lives in a slab, but next hops do not. */
+	rt_headclear0(ctx, &ctx->routes, AF_UNSPEC);
+	rt_headclear0(ctx, &ctx->kroutes, AF_UNSPEC);
+	while ((rs = ctx->rt_slabs) != NULL) {
+		ctx->rt_slabs = rs->rs_next;
+		free(rs);
+	}
+	ctx->rt_free = NULL;
 #ifdef RT_FREE_ROUTE_TABLE_STATS
 	logdebugx("free route list used %zu times", froutes);
 	logdebugx("new routes from route free list %zu", nroutes);
 	logdebugx("maximum route free list size %zu", mroutes);
 #endif
+#else
+	rt_headfree(&ctx->routes);
+	rt_headfree(&ctx->kroutes);
+#endif
+}
+
+/* Bytes held for routes, including free ones kept for re-use. */
+size_t
+rt_memsize(struct dhcpcd_ctx *ctx)
+{
+	size_t size = 0;
+#if !defined(RT_FREE_ROUTE_TABLE) || defined(HAVE_ROUTE_MULTIPATH)
+	struct rt *rt;
+#endif
+#ifdef RT_FREE_ROUTE_TABLE
+	const struct rt_slab *rs;
+
+	for (rs = ctx->rt_slabs; rs != NULL; rs = rs->rs_next)
+		size += RT_SLAB_SIZE;
+#else
+	RB_TREE_FOREACH(rt, &ctx->routes) {
+		size += sizeof(*rt);
+	}
+	RB_TREE_FOREACH(rt, &ctx->kroutes) {
+		size += sizeof(*rt);
+	}
+#endif
+#ifdef HAVE_ROUTE_MULTIPATH
+	RB_TREE_FOREACH(rt, &ctx->routes) {
+		if (rt->rt_ss_mpath != NULL)
+			size += sizeof(*rt->rt_ss_mpath) * RT_MAXPATH;
+	}
+	RB_TREE_FOREACH(rt, &ctx->kroutes) {
+		if (rt->rt_ss_mpath != NULL)
+			size += sizeof(*rt->rt_ss_mpath) * RT_MAXPATH;
+	}
 #endif
+	return size;
 }
 
 struct rt *
@@ -363,18 +515,22 @@ rt_new0(struct dhcpcd_ctx *ctx)
 
 	assert(ctx != NULL);
 #ifdef RT_FREE_ROUTE_TABLE
-	if ((rt = RB_TREE_MIN(&ctx->froutes)) != NULL) {
-		rb_tree_remove_node(&ctx->froutes, rt);
+	if (ctx->rt_free == NULL && rt_slab_new(ctx) == -1) {
+		logerr(__func__);
+		return NULL;
+	}
+	rt = (void *)ctx->rt_free;
+	ctx->rt_free = ctx->rt_free->next;
 #ifdef RT_FREE_ROUTE_TABLE_STATS
-		croutes--;
-		nroutes++;
-#endif
-	} else
+	croutes--;
+	nroutes++;
 #endif
+#else
 	if ((rt = malloc(sizeof(*rt))) == NULL) {
 		logerr(__func__);
 		return NULL;
 	}
+#endif
 	memset(rt, 0, sizeof(*rt));
 	return rt;
 }
@@ -426,20 +582,43 @@ rt_proto_add(rb_tree_t *tree, struct rt *rt)
 	return rt_proto_add_ctx(tree, rt, rt->rt_ifp->ctx);
 }
 
+/* Copy src over dst, which must not have next hops of its own. */
+int
+rt_copy(struct rt *dst, const struct rt *src)
+{
+
+	memcpy(dst, src, sizeof(*dst));
+#ifdef HAVE_ROUTE_MULTIPATH
+	if (src->rt_ss_mpath == NULL)
+		return 0;
+	dst->rt_ss_mpath = malloc(sizeof(*dst->rt_ss_mpath) * RT_MAXPATH);
+	if (dst->rt_ss_mpath == NULL) {
+		dst->rt_npath = 0;
+		return -1;
+	}
+	memcpy(dst->rt_ss_mpath, src->rt_ss_mpath,
+	    sizeof(*dst->rt_ss_mpath) * src->rt_npath);
+#endif
+	return 0;
+}
+
 void
 rt_free(struct rt *rt)
 {
 #ifdef RT_FREE_ROUTE_TABLE
-	struct dhcpcd_ctx *ctx;
+	struct rt_slab *rs;
+	struct rt_freeslot *fs;
+#endif
 
 	assert(rt != NULL);
-	if (rt->rt_ifp == NULL) {
-		free(rt);
-		return;
-	}
-
-	ctx = rt->rt_ifp->ctx;
-	rb_tree_insert_node(&ctx->froutes, rt);
+#ifdef HAVE_ROUTE_MULTIPATH
+	free(rt->rt_ss_mpath);
+#endif
+#ifdef RT_FREE_ROUTE_TABLE
+	rs = (void *)((uintptr_t)rt & ~(uintptr_t)(RT_SLAB_SIZE - 1));
+	fs = (void *)rt;
+	fs->next = rs->rs_ctx->rt_free;
+	rs->rs_ctx->rt_free = fs;
 #ifdef RT_FREE_ROUTE_TABLE_STATS
 	croutes++;
 	froutes++;
@@ -466,6 +645,160 @@ rt_freeif(struct interface *ifp)
 			rt_free(rt);
 		}
 	}
+	RB_TREE_FOREACH_SAFE(rt, &ctx->kroutes, rtn) {
+		if (rt->rt_ifp == ifp) {
+			rb_tree_remove_node(&ctx->kroutes, rt);
+			rt_free(rt);
+		}
+	}
+}
+
+#ifdef HAVE_ROUTE_MULTIPATH
+/* Add gw as another next hop of rt. */
+int
+rt_addpath(struct rt *rt, const struct sockaddr *gw)
+{
+	size_t i;
+
+	if (sa_cmp(&rt->rt_gateway, gw) == 0)
+		return 0;
+	for (i = 0; i < rt->rt_npath; i++) {
+		if (sa_cmp(&rt->rt_ss_mpath[i].sa, gw) == 0)
+			return 0;
+	}
+	if (rt->rt_npath == RT_MAXPATH) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	/* Few routes have a second hop, so don't grow them all. */
+	if (rt->rt_ss_mpath == NULL) {
+		rt->rt_ss_mpath = malloc(sizeof(*rt->rt_ss_mpath) * RT_MAXPATH);
+		if (rt->rt_ss_mpath == NULL)
+			return -1;
+	}
+	memcpy(&rt->rt_ss_mpath[rt->rt_npath++], gw, sa_len(gw));
+	return 0;
+}
+
+/* Free the next hops of a route which does not come from rt_new. */
+void
+rt_freepath(struct rt *rt)
+{
+
+	free(rt->rt_ss_mpath);
+	rt->rt_ss_mpath = NULL;
+	rt->rt_npath = 0;
+}
+
+static bool
+rt_haspath(const struct rt *rt, const struct sockaddr *gw)
+{
+	size_t i;
+
+	if (sa_cmp(&rt->rt_gateway, gw) == 0)
+		return true;
+	for (i = 0; i < rt->rt_npath; i++) {
+		if (sa_cmp(&rt->rt_ss_mpath[i].sa, gw) == 0)
+			return true;
+	}
+	return false;
+}
+#endif
+
+/* Next hops are a set, the kernel may not keep our order. */
+static bool
+rt_cmpgateway(const struct rt *r1, const struct rt *r2)
+{
+#ifdef HAVE_ROUTE_MULTIPATH
+	size_t i;
+
+	if (r1->rt_npath != r2->rt_npath ||
+	    !rt_haspath(r2, &r1->rt_gateway))
+		return false;
+	for (i = 0; i < r1->rt_npath; i++) {
+		if (!rt_haspath(r2, &r1->rt_ss_mpath[i].sa))
+			return false;
+	}
+	return true;
+#else
+	return sa_cmp(&r1->rt_gateway, &r2->rt_gateway) == 0;
+#endif
+}
+
+static bool
+rt_cmp(const struct rt *r1, const struct rt *r2)
+{
+
+	return (r1->rt_ifp == r2->rt_ifp &&
+#ifdef HAVE_ROUTE_METRIC
+	    r1->rt_metric == r2->rt_metric &&
+#endif
+	    rt_cmpgateway(r1, r2));
+}
+
+/*
+ * ctx->kroutes mirrors the kernel routes on our interfaces.
+ * It's loaded once and then kept up to date by route events and
+ * by the changes we make ourselves, which the kernel doesn't tell
+ * us about.
+ * Only one route per key is kept, the last one we heard about.
+ */
+static void
+rt_kroute_add(struct dhcpcd_ctx *ctx, const struct rt *rt)
+{
+	struct rt *krt;
+
+	krt = rb_tree_find_node(&ctx->kroutes, rt);
+	if (krt != NULL) {
+		rb_tree_remove_node(&ctx->kroutes, krt);
+#ifdef HAVE_ROUTE_MULTIPATH
+		rt_freepath(krt);
+#endif
+	} else if ((krt = rt_new0(ctx)) == NULL) {
+		ctx->kroutes_valid = false;
+		return;
+	}
+	if (rt_copy(krt, rt) == -1) {
+		rt_free(krt);
+		ctx->kroutes_valid = false;
+		return;
+	}
+	rb_tree_insert_node(&ctx->kroutes, krt);
+}
+
+static void
+rt_kroute_delete(struct dhcpcd_ctx *ctx, const struct rt *rt)
+{
+	struct rt *krt;
+
+	krt = rb_tree_find_node(&ctx->kroutes, rt);
+	if (krt == NULL || !rt_cmp(krt, rt))
+		return;
+	rb_tree_remove_node(&ctx->kroutes, krt);
+	rt_free(krt);
+}
+
+/* Load the kernel routes if we have lost track of them. */
+static rb_tree_t *
+rt_kroutes(struct dhcpcd_ctx *ctx)
+{
+
+	if (!ctx->kroutes_valid) {
+		rt_headclear0(ctx, &ctx->kroutes, AF_UNSPEC);
+		if (if_initrt(ctx, &ctx->kroutes, AF_UNSPEC) == -1)
+			logerr("%s: if_initrt", __func__);
+		else
+			ctx->kroutes_valid = true;
+	}
+	return &ctx->kroutes;
+}
+
+/* Something we can't follow happened, so load them again next time. */
+void
+rt_invalidate(struct dhcpcd_ctx *ctx)
+{
+
+	ctx->kroutes_valid = false;
 }
 
 /* If something other than dhcpcd removes a route,
@@ -483,7 +816,12 @@ rt_recvrt(int cmd, const struct rt *rt, pid_t pid)
 	ctx = rt->rt_ifp->ctx;
 
 	switch(cmd) {
+	case RTM_ADD:
+	case RTM_CHANGE:
+		rt_kroute_add(ctx, rt);
+		break;
 	case RTM_DELETE:
+		rt_kroute_delete(ctx, rt);
 		f = rb_tree_find_node(&ctx->routes, rt);
 		if (f != NULL) {
 			char buf[32];
@@ -506,7 +844,7 @@ static bool
 rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 {
 	struct dhcpcd_ctx *ctx;
-	bool change, kroute, result;
+	bool change, result;
 
 	assert(nrt != NULL);
 	ctx = nrt->rt_ifp->ctx;
@@ -528,7 +866,7 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 
 	rt_desc(ort == NULL ? "adding" : "changing", nrt);
 
-	change = kroute = result = false;
+	change = result = false;
 	if (ort == NULL) {
 		ort = rb_tree_find_node(kroutes, nrt);
 		if (ort != NULL &&
@@ -538,12 +876,11 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 #ifdef HAVE_ROUTE_METRIC
 		    ort->rt_metric == nrt->rt_metric &&
 #endif
-		    sa_cmp(&ort->rt_gateway, &nrt->rt_gateway) == 0)))
+		    rt_cmpgateway(ort, nrt))))
 		{
 			if (ort->rt_mtu == nrt->rt_mtu)
 				return true;
 			change = true;
-			kroute = true;
 		}
 	} else if (ort->rt_dflags & RTDF_FAKE &&
 	    !(nrt->rt_dflags & RTDF_FAKE) &&
@@ -553,13 +890,20 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 #endif
 	    sa_cmp(&ort->rt_dest, &nrt->rt_dest) == 0 &&
 	    rt_cmp_netmask(ort, nrt) == 0 &&
-	    sa_cmp(&ort->rt_gateway, &nrt->rt_gateway) == 0)
+	    rt_cmpgateway(ort, nrt))
 	{
 		if (ort->rt_mtu == nrt->rt_mtu)
 			return true;
 		change = true;
 	}
 
+#ifdef HAVE_ROUTE_REPLACE
+	/* The kernel sees this as the same route, so replace it rather
+	 * than delete it and leave nothing there until the add. */
+	if (!change && ort != NULL && ort->rt_metric == nrt->rt_metric)
+		change = true;
+#endif
+
 #ifdef RTF_CLONING
 	/* BSD can set routes to be cloning routes.
 	 * Cloned routes inherit the parent flags.
@@ -590,6 +934,17 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 		goto out;
 	}
 
+#ifdef HAVE_ROUTE_REPLACE
+	/* Routes from routing daemons are not mirrored, so one can
+	 * clash with ours without us knowing. Replace it. */
+	if (errno == EEXIST && ort == NULL &&
+	    if_route(RTM_CHANGE, nrt) != -1)
+	{
+		result = true;
+		goto out;
+	}
+#endif
+
 	/* If the kernel claims the route exists we need to rip out the
 	 * old one first. */
 	if (errno != EEXIST || ort == NULL)
@@ -604,8 +959,6 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 	if (ort != NULL) {
 		if (if_route(RTM_DELETE, ort) == -1 && errno != ESRCH)
 			logerr("if_route (DEL)");
-		else
-			kroute = false;
 	}
 #ifdef ROUTE_PER_GATEWAY
 	/* The OS allows many routes to the same dest with different gateways.
@@ -632,10 +985,11 @@ logerr:
 	logerr("if_route (ADD)");
 
 out:
-	if (kroute) {
-		rb_tree_remove_node(kroutes, ort);
-		rt_free(ort);
-	}
+	/* ort has the same key, so this replaces it. */
+	if (result)
+		rt_kroute_add(ctx, nrt);
+	else
+		rt_invalidate(ctx);
 	return result;
 }
 
@@ -645,22 +999,27 @@ rt_delete(struct rt *rt)
 	int retval;
 
 	rt_desc("deleting", rt);
+	rt_kroute_delete(rt->rt_ifp->ctx, rt);
 	retval = if_route(RTM_DELETE, rt) == -1 ? false : true;
-	if (!retval && errno != ENOENT && errno != ESRCH)
+	if (!retval && errno != ENOENT && errno != ESRCH) {
 		logerr(__func__);
+		rt_invalidate(rt->rt_ifp->ctx);
+	}
 	return retval;
 }
 
-static bool
-rt_cmp(const struct rt *r1, const struct rt *r2)
+#ifdef PRIVSEP
+static void
+rt_deletecb(void *arg, ssize_t result)
 {
+	struct dhcpcd_ctx *ctx = arg;
 
-	return (r1->rt_ifp == r2->rt_ifp &&
-#ifdef HAVE_ROUTE_METRIC
-	    r1->rt_metric == r2->rt_metric &&
-#endif
-	    sa_cmp(&r1->rt_gateway, &r2->rt_gateway) == 0);
+	if (result == -1 && errno != ENOENT && errno != ESRCH) {
+		logerr("rt_delete");
+		rt_invalidate(ctx);
+	}
 }
+#endif
 
 static bool
 rt_doroute(rb_tree_t *kroutes, struct rt *rt)
@@ -672,17 +1031,17 @@ rt_doroute(rb_tree_t *kroutes, struct rt *rt)
 	/* Do we already manage it? */
 	or = rb_tree_find_node(&ctx->routes, rt);
 	if (or != NULL) {
-		if (rt->rt_dflags & RTDF_FAKE)
-			return true;
-		if (or->rt_dflags & RTDF_FAKE ||
+		if (!(rt->rt_dflags & RTDF_FAKE) &&
+		    (or->rt_dflags & RTDF_FAKE ||
 		    !rt_cmp(rt, or) ||
 		    (rt->rt_ifa.sa_family != AF_UNSPEC &&
 		    sa_cmp(&or->rt_ifa, &rt->rt_ifa) != 0) ||
-		    or->rt_mtu != rt->rt_mtu)
+		    or->rt_mtu != rt->rt_mtu))
 		{
 			if (!rt_add(kroutes, rt, or))
 				return false;
 		}
+		/* rt replaces it in our table. */
 		rb_tree_remove_node(&ctx->routes, or);
 		rt_free(or);
 	} else {
@@ -701,17 +1060,140 @@ rt_doroute(rb_tree_t *kroutes, struct rt *rt)
 	return true;
 }
 
+/*
+ * Forget any route we manage which the kernel no longer has and put
+ * it back. The route socket overflowing can lose the deletion.
+ */
 void
-rt_build(struct dhcpcd_ctx *ctx, int af)
+rt_resync(struct dhcpcd_ctx *ctx)
 {
-	rb_tree_t routes, added, kroutes;
+	rb_tree_t *kroutes;
 	struct rt *rt, *rtn;
+#ifdef INET
+	bool lost = false;
+#endif
+#ifdef INET6
+	bool lost6 = false;
+#endif
+
+	/* Route events may have been lost as well. */
+	rt_invalidate(ctx);
+	kroutes = rt_kroutes(ctx);
+	if (!ctx->kroutes_valid)
+		return;
+
+	RB_TREE_FOREACH_SAFE(rt, &ctx->routes, rtn) {
+		if (rt->rt_dflags & RTDF_FAKE ||
+		    rb_tree_find_node(kroutes, rt) != NULL)
+			continue;
+		rt_desc("lost", rt);
+		switch (rt->rt_dest.sa_family) {
+#ifdef INET
+		case AF_INET:
+			lost = true;
+			break;
+#endif
+#ifdef INET6
+		case AF_INET6:
+			lost6 = true;
+			break;
+#endif
+		}
+		rb_tree_remove_node(&ctx->routes, rt);
+		rt_free(rt);
+	}
+
+#ifdef INET
+	if (lost)
+		rt_build(ctx, AF_INET);
+#endif
+#ifdef INET6
+	if (lost6)
+		rt_build(ctx, AF_INET6);
+#endif
+}
+
+#define	RT_PENDING_INET		0x01
+#define	RT_PENDING_INET6	0x02
+
+static unsigned int
+rt_pendingaf(int af)
+{
+
+	switch (af) {
+	case AF_INET:
+		return RT_PENDING_INET;
+	case AF_INET6:
+		return RT_PENDING_INET6;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Events often change more than one source of routes, each of which
+ * would rebuild the table.
+ * Instead the rebuild is done once when the events have been handled,
+ * or route_delay msec later, and before any script runs.
+ */
+void
+rt_schedule(struct dhcpcd_ctx *ctx, int af)
+{
+	unsigned int pending;
+
+	pending = ctx->rt_pending;
+	if (af == AF_UNSPEC)
+		ctx->rt_pending |= RT_PENDING_INET | RT_PENDING_INET6;
+	else
+		ctx->rt_pending |= rt_pendingaf(af);
+	/* Tell ipv6_handleifa a build is on the way. */
+	ctx->options |= DHCPCD_RTBUILD;
+
+	if (pending != 0)
+		return;
+	if (eloop_timeout_add_msec(ctx->eloop, ctx->route_delay,
+	    rt_flush, ctx) == -1)
+	{
+		logerr(__func__);
+		rt_flush(ctx);
+	}
+}
+
+void
+rt_flush(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+
+	if (ctx->rt_pending & RT_PENDING_INET)
+		rt_build(ctx, AF_INET);
+	if (ctx->rt_pending & RT_PENDING_INET6)
+		rt_build(ctx, AF_INET6);
+}
+
+void
+rt_build(struct dhcpcd_ctx *ctx, int af)
+{
+	rb_tree_t routes, *kroutes;
+	struct rt *rt, *rtn, *or;
 	unsigned long long o;
+#ifdef PRIVSEP
+	bool batch = false;
+#endif
+#ifndef SMALL
+	struct timespec started, now;
+	unsigned long long ns;
+	bool timed = clock_gettime(CLOCK_MONOTONIC, &started) == 0;
+#endif
+
+	PROBE1(rt_build, af);
+	if (ctx->rt_pending & rt_pendingaf(af)) {
+		ctx->rt_pending &= ~rt_pendingaf(af);
+		if (ctx->rt_pending == 0)
+			eloop_timeout_delete(ctx->eloop, rt_flush, ctx);
+	}
 
 	rb_tree_init(&routes, &rt_compare_proto_ops);
-	rb_tree_init(&added, &rt_compare_os_ops);
-	rb_tree_init(&kroutes, &rt_compare_os_ops);
-	if_initrt(ctx, &kroutes, af);
+	kroutes = rt_kroutes(ctx);
 	ctx->rt_order = 0;
 	ctx->options |= DHCPCD_RTBUILD;
 
@@ -745,12 +1227,17 @@ rt_build(struct dhcpcd_ctx *ctx, int af)
 		    (rt->rt_gateway.sa_family != af &&
 		    rt->rt_gateway.sa_family != AF_UNSPEC))
 			continue;
+		rt_setkey(rt);
 		/* Is this route already in our table? */
-		if (rb_tree_find_node(&added, rt) != NULL)
+		or = rb_tree_find_node(&ctx->routes, rt);
+		if (or != NULL && or->rt_dflags & RTDF_BUILT)
 			continue;
-		if (rt_doroute(&kroutes, rt)) {
+		/* Routes we add go straight into our table, marked so
+		 * the old routes left there can be told apart. */
+		if (rt_doroute(kroutes, rt)) {
 			rb_tree_remove_node(&routes, rt);
-			if (rb_tree_insert_node(&added, rt) != rt) {
+			rt->rt_dflags |= RTDF_BUILT;
+			if (rb_tree_insert_node(&ctx->routes, rt) != rt) {
 				errno = EEXIST;
 				logerr(__func__);
 				rt_free(rt);
@@ -763,6 +1250,17 @@ rt_build(struct dhcpcd_ctx *ctx, int af)
 		logerr("if_missfilter_apply");
 #endif
 
+#ifdef PRIVSEP
+	/* Nothing needs to know if a delete worked, so send them
+	 * to the privileged proxy in one go. */
+	if (IN_PRIVSEP_SE(ctx)) {
+		if (ps_root_batch_start(ctx, rt_deletecb, ctx) == -1)
+			logerr("%s: ps_root_batch_start", __func__);
+		else
+			batch = true;
+	}
+#endif
+
 	/* Remove old routes we used to manage. */
 	RB_TREE_FOREACH_REVERSE_SAFE(rt, &ctx->routes, rtn) {
 		if ((rt->rt_dest.sa_family != af &&
@@ -770,30 +1268,38 @@ rt_build(struct dhcpcd_ctx *ctx, int af)
 		    (rt->rt_gateway.sa_family != af &&
 		    rt->rt_gateway.sa_family != AF_UNSPEC))
 			continue;
-		rb_tree_remove_node(&ctx->routes, rt);
-		if (rb_tree_find_node(&added, rt) == NULL) {
-			o = rt->rt_ifp->options ?
-			    rt->rt_ifp->options->options :
-			    ctx->options;
-			if ((o &
-				(DHCPCD_EXITING | DHCPCD_PERSISTENT)) !=
-				(DHCPCD_EXITING | DHCPCD_PERSISTENT))
-				rt_delete(rt);
+		if (rt->rt_dflags & RTDF_BUILT) {
+			rt->rt_dflags &= ~RTDF_BUILT;
+			continue;
 		}
+		rb_tree_remove_node(&ctx->routes, rt);
+		o = rt->rt_ifp->options ?
+		    rt->rt_ifp->options->options :
+		    ctx->options;
+		if ((o &
+			(DHCPCD_EXITING | DHCPCD_PERSISTENT)) !=
+			(DHCPCD_EXITING | DHCPCD_PERSISTENT))
+			rt_delete(rt);
 		rt_free(rt);
 	}
 
-	/* XXX This needs to be optimised. */
-	while ((rt = RB_TREE_MIN(&added)) != NULL) {
-		rb_tree_remove_node(&added, rt);
-		if (rb_tree_insert_node(&ctx->routes, rt) != rt) {
-			errno = EEXIST;
-			logerr(__func__);
-			rt_free(rt);
-		}
-	}
+#ifdef PRIVSEP
+	if (batch && ps_root_batch_end(ctx) == -1)
+		logerr("%s: ps_root_batch_end", __func__);
+#endif
 
 getfail:
 	rt_headclear(&routes, AF_UNSPEC);
-	rt_headclear(&kroutes, AF_UNSPEC);
+	PROBE1(rt_build_done, af);
+#ifndef SMALL
+	if (timed && clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+		ns = (unsigned long long)(now.tv_sec - started.tv_sec) *
+		    NSEC_PER_SEC + (unsigned long long)now.tv_nsec -
+		    (unsigned long long)started.tv_nsec;
+		ctx->rt_builds++;
+		ctx->rt_build_ns += ns;
+		if (ns > ctx->rt_build_ns_max)
+			ctx->rt_build_ns_max = ns;
+	}
+#endif
 }
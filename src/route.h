@@ -37,6 +37,7 @@
 #include <net/route.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "dhcpcd.h"
 #include "sa.h"
@@ -60,6 +61,18 @@
 # endif
 #endif
 
+/* Linux can replace a route with the same destination and metric
+ * in one step. */
+#if defined(__linux__) && defined(HAVE_ROUTE_METRIC)
+# define HAVE_ROUTE_REPLACE
+#endif
+
+/* Linux can install one route with a next hop for each gateway. */
+#ifdef __linux__
+# define HAVE_ROUTE_MULTIPATH
+# define RT_MAXPATH		4	/* next hops besides rt_gateway */
+#endif
+
 #ifdef __linux__
 # include <linux/version.h> /* RTA_PREF is only an enum.... */
 # if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
@@ -78,6 +91,17 @@
 #undef rt_mtu
 #endif
 
+/*
+ * The destination of a route, packed so that routes sort with one memcmp.
+ * Host routes get an all-ones netmask, as they are the same route
+ * whether the kernel reports a netmask or not.
+ */
+struct rt_key {
+	uint8_t			rk_family;
+	uint8_t			rk_dest[16];
+	uint8_t			rk_netmask[16];
+};
+
 struct rt {
 	union sa_ss		rt_ss_dest;
 #define rt_dest			rt_ss_dest.sa
@@ -85,6 +109,10 @@ struct rt {
 #define rt_netmask		rt_ss_netmask.sa
 	union sa_ss		rt_ss_gateway;
 #define rt_gateway		rt_ss_gateway.sa
+#ifdef HAVE_ROUTE_MULTIPATH
+	union sa_ss		*rt_ss_mpath;	/* RT_MAXPATH, out of line */
+	size_t			rt_npath;
+#endif
 	struct interface	*rt_ifp;
 	union sa_ss		rt_ss_ifa;
 #define rt_ifa			rt_ss_ifa.sa
@@ -111,14 +139,16 @@ struct rt {
 #define RTPREF_RESERVED	(-2)
 #define RTPREF_INVALID	(-3)	/* internal */
 	unsigned int		rt_dflags;
-#define	RTDF_IFA_ROUTE		0x01		/* Address generated route */
-#define	RTDF_FAKE		0x02		/* Maybe us on lease reboot */
-#define	RTDF_IPV4LL		0x04		/* IPv4LL route */
-#define	RTDF_RA			0x08		/* Router Advertisement */
-#define	RTDF_DHCP		0x10		/* DHCP route */
-#define	RTDF_STATIC		0x20		/* Configured in dhcpcd */
-#define	RTDF_GATELINK		0x40		/* Gateway is on link */
+#define	RTDF_IFA_ROUTE		0x01U		/* Address generated route */
+#define	RTDF_FAKE		0x02U		/* Maybe us on lease reboot */
+#define	RTDF_IPV4LL		0x04U		/* IPv4LL route */
+#define	RTDF_RA			0x08U		/* Router Advertisement */
+#define	RTDF_DHCP		0x10U		/* DHCP route */
+#define	RTDF_STATIC		0x20U		/* Configured in dhcpcd */
+#define	RTDF_GATELINK		0x40U		/* Gateway is on link */
+#define	RTDF_BUILT		0x80U		/* Added by this rt_build */
 	size_t			rt_order;
+	struct rt_key		rt_key;
 	rb_node_t		rt_tree;
 };
 
@@ -127,6 +157,7 @@ extern const rb_tree_ops_t rt_compare_proto_ops;
 
 void rt_init(struct dhcpcd_ctx *);
 void rt_dispose(struct dhcpcd_ctx *);
+size_t rt_memsize(struct dhcpcd_ctx *);
 void rt_free(struct rt *);
 void rt_freeif(struct interface *);
 bool rt_is_default(const struct rt *);
@@ -139,7 +170,17 @@ struct rt * rt_new(struct interface *);
 struct rt * rt_proto_add_ctx(rb_tree_t *, struct rt *, struct dhcpcd_ctx *);
 struct rt * rt_proto_add(rb_tree_t *, struct rt *);
 int rt_cmp_dest(const struct rt *, const struct rt *);
+void rt_setkey(struct rt *);
+#ifdef HAVE_ROUTE_MULTIPATH
+int rt_addpath(struct rt *, const struct sockaddr *);
+void rt_freepath(struct rt *);
+#endif
+int rt_copy(struct rt *, const struct rt *);
 void rt_recvrt(int, const struct rt *, pid_t);
 void rt_build(struct dhcpcd_ctx *, int);
+void rt_schedule(struct dhcpcd_ctx *, int);
+void rt_flush(void *);
+void rt_resync(struct dhcpcd_ctx *);
+void rt_invalidate(struct dhcpcd_ctx *);
 
 #endif
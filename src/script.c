@@ -36,12 +36,15 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pwd.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "config.h"
@@ -49,12 +52,15 @@
 #include "dhcp.h"
 #include "dhcp6.h"
 #include "eloop.h"
+#include "hooks.h"
 #include "if.h"
 #include "if-options.h"
 #include "ipv4ll.h"
 #include "ipv6nd.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "probe.h"
+#include "route.h"
 #include "script.h"
 
 #define DEFAULT_PATH	"/usr/bin:/usr/sbin:/bin:/sbin"
@@ -86,11 +92,15 @@ if_printoptions(void)
 		printf(" -  %s\n", *p);
 }
 
-pid_t
-script_exec(char *const *argv, char *const *env)
+#define	SCRIPT_WORKER_FD	3
+#define	SCRIPT_REASONLEN	24
+
+static pid_t
+script_spawn(char *const *argv, char *const *env, int fd)
 {
 	pid_t pid = 0;
 	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t fa, *fap = NULL;
 	int r;
 #ifdef USE_SIGNALS
 	size_t i;
@@ -100,10 +110,26 @@ script_exec(char *const *argv, char *const *env)
 	UNUSED(ctx);
 #endif
 
+	/* Hand fd over as SCRIPT_WORKER_FD. */
+	if (fd != -1) {
+		if (posix_spawn_file_actions_init(&fa) != 0)
+			return -1;
+		fap = &fa;
+		if (posix_spawn_file_actions_adddup2(fap, fd,
+		    SCRIPT_WORKER_FD) != 0)
+		{
+			posix_spawn_file_actions_destroy(fap);
+			return -1;
+		}
+	}
+
 	/* posix_spawn is a safe way of executing another image
 	 * and changing signals back to how they should be. */
-	if (posix_spawnattr_init(&attr) == -1)
+	if (posix_spawnattr_init(&attr) == -1) {
+		if (fap != NULL)
+			posix_spawn_file_actions_destroy(fap);
 		return -1;
+	}
 #ifdef USE_SIGNALS
 	flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
 	posix_spawnattr_setflags(&attr, flags);
@@ -116,8 +142,10 @@ script_exec(char *const *argv, char *const *env)
 	posix_spawnattr_setsigdefault(&attr, &defsigs);
 #endif
 	errno = 0;
-	r = posix_spawn(&pid, argv[0], NULL, &attr, argv, env);
+	r = posix_spawn(&pid, argv[0], fap, &attr, argv, env);
 	posix_spawnattr_destroy(&attr);
+	if (fap != NULL)
+		posix_spawn_file_actions_destroy(fap);
 	if (r) {
 		errno = r;
 		return -1;
@@ -125,6 +153,217 @@ script_exec(char *const *argv, char *const *env)
 	return pid;
 }
 
+pid_t
+script_exec(char *const *argv, char *const *env)
+{
+
+	return script_spawn(argv, env, -1);
+}
+
+/*
+ * With script_worker the script is started once as
+ * "script --worker envfile" and kept running.
+ * For each event the environment is written to envfile as shell
+ * assignments and a line is sent on SCRIPT_WORKER_FD.
+ * The worker runs the hooks in a subshell and replies with their
+ * exit status, which saves a fork and exec of dhcpcd and the start
+ * of a new shell per event.
+ */
+static void script_worker_cb(void *, unsigned short);
+
+static int
+script_worker_start(struct dhcpcd_ctx *ctx)
+{
+	int fd[2], cfd;
+	char *argv[4], *env[2];
+	const char *path;
+	pid_t pid;
+
+	if (ctx->script_worker_env[0] == '\0')
+		snprintf(ctx->script_worker_env,
+		    sizeof(ctx->script_worker_env),
+		    RUNDIR "/hook-env.%d", (int)getpid());
+
+	/* Only PATH, the rest comes from envfile. */
+	path = getenv("PATH");
+	if (asprintf(&env[0], "PATH=%s",
+	    path == NULL ? DEFAULT_PATH : path) == -1)
+		return -1;
+	env[1] = NULL;
+
+	if (xsocketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fd) == -1) {
+		free(env[0]);
+		return -1;
+	}
+	/* dup2 would not clear FD_CLOEXEC if it's already there. */
+	if (fd[1] == SCRIPT_WORKER_FD) {
+		cfd = fcntl(fd[1], F_DUPFD_CLOEXEC, SCRIPT_WORKER_FD + 1);
+		close(fd[1]);
+		fd[1] = cfd;
+	}
+
+	argv[0] = ctx->script;
+	argv[1] = UNCONST("--worker");
+	argv[2] = ctx->script_worker_env;
+	argv[3] = NULL;
+	pid = fd[1] == -1 ? -1 : script_spawn(argv, env, fd[1]);
+	free(env[0]);
+	if (fd[1] != -1)
+		close(fd[1]);
+	if (pid == -1) {
+		close(fd[0]);
+		return -1;
+	}
+
+	logdebugx("spawned script worker on PID %d", (int)pid);
+	ctx->script_worker_fd = fd[0];
+	ctx->script_worker_pid = pid;
+	if (eloop_p_event_add(ctx->eloop, ELOOP_PRIO_LOW, fd[0], ELE_READ,
+	    script_worker_cb, ctx) == -1)
+		logerr("%s: eloop_event_add", __func__);
+	return 0;
+}
+
+void
+script_worker_stop(struct dhcpcd_ctx *ctx)
+{
+
+	pid_t pid;
+	int status;
+
+	if (ctx->script_worker_fd == -1)
+		return;
+	/* The worker exits when it reads EOF. */
+	eloop_event_delete(ctx->eloop, ctx->script_worker_fd);
+	close(ctx->script_worker_fd);
+	ctx->script_worker_fd = -1;
+	unlink(ctx->script_worker_env);
+
+	/* Don't wait for the hooks it's running. */
+	if ((pid = ctx->script_worker_pid) == 0)
+		return;
+	ctx->script_worker_pid = 0;
+	if (kill(pid, SIGTERM) == -1 && errno != ESRCH)
+		logerr("%s: kill", __func__);
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			/* Already reaped. */
+			if (errno != ECHILD)
+				logerr("%s: waitpid", __func__);
+			break;
+		}
+	}
+}
+
+/* Write NAME=value as an exported, single quoted assignment. */
+static void
+script_worker_putenv(FILE *fp, const char *var)
+{
+	const char *p;
+
+	if (!isalpha((unsigned char)*var) && *var != '_')
+		return;
+	for (p = var; *p != '='; p++) {
+		if (!isalnum((unsigned char)*p) && *p != '_')
+			return;
+	}
+
+	fprintf(fp, "export %.*s='", (int)(p - var), var);
+	for (p++; *p != '\0'; p++) {
+		if (*p == '\'')
+			fputs("'\\''", fp);
+		else
+			fputc(*p, fp);
+	}
+	fputs("'\n", fp);
+}
+
+static int
+script_worker_writeenv(struct dhcpcd_ctx *ctx, char *const *env)
+{
+	int fd;
+	FILE *fp;
+	char *const *envp;
+
+	fd = open(ctx->script_worker_env, O_WRONLY | O_CREAT | O_TRUNC,
+	    0600);
+	if (fd == -1)
+		return -1;
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		return -1;
+	}
+	for (envp = env; *envp != NULL; envp++)
+		script_worker_putenv(fp, *envp);
+	if (ferror(fp)) {
+		fclose(fp);
+		errno = EIO;
+		return -1;
+	}
+	return fclose(fp) == EOF ? -1 : 0;
+}
+
+/* Hand the event to the worker, starting it if need be. */
+static int
+script_worker_send(struct dhcpcd_ctx *ctx, char *const *env)
+{
+	int tries;
+
+	for (tries = 0; ; tries++) {
+		if (ctx->script_worker_fd == -1 &&
+		    script_worker_start(ctx) == -1)
+		{
+			logerr("%s: %s", __func__, ctx->script);
+			return -1;
+		}
+		if (script_worker_writeenv(ctx, env) == -1) {
+			logerr("%s: %s", __func__, ctx->script_worker_env);
+			return -1;
+		}
+		if (write(ctx->script_worker_fd, "\n", 1) == 1)
+			return 0;
+		/* The worker has gone, so start another one. */
+		script_worker_stop(ctx);
+		if (tries != 0) {
+			logerr("%s: write", __func__);
+			return -1;
+		}
+	}
+}
+
+/* Returns the exit status the worker replies with. */
+static int
+script_worker_recv(struct dhcpcd_ctx *ctx)
+{
+	char buf[16];
+	size_t pos;
+	ssize_t len;
+
+	/* The hooks are running now, so don't run them again,
+	 * whatever happens. */
+	pos = 0;
+	for (;;) {
+		len = read(ctx->script_worker_fd, buf + pos,
+		    sizeof(buf) - pos - 1);
+		if (len == -1 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			if (len == 0)
+				logerrx("%s: %s exited", __func__,
+				    ctx->script);
+			else
+				logerr("%s: read", __func__);
+			script_worker_stop(ctx);
+			return EXIT_FAILURE;
+		}
+		pos += (size_t)len;
+		if (buf[pos - 1] == '\n' || pos == sizeof(buf) - 1)
+			break;
+	}
+	buf[pos] = '\0';
+	return (int)strtol(buf, NULL, 10);
+}
+
 #ifdef INET
 static int
 append_config(FILE *fp, const char *prefix, const char *const *config)
@@ -144,6 +383,225 @@ append_config(FILE *fp, const char *prefix, const char *const *config)
 
 #endif
 
+void
+script_freeenvcache(struct script_envcache *sec, size_t n)
+{
+	size_t i;
+
+	if (sec == NULL)
+		return;
+	for (i = 0; i < n; i++) {
+		free(sec[i].sec_key);
+		free(sec[i].sec_buf);
+	}
+	free(sec);
+}
+
+size_t
+script_envcache_memsize(const struct script_envcache *sec, size_t n)
+{
+	size_t i, size;
+
+	if (sec == NULL)
+		return 0;
+	size = n * sizeof(*sec);
+	for (i = 0; i < n; i++) {
+		if (sec[i].sec_key != NULL)
+			size += sec[i].sec_keylen;
+		if (sec[i].sec_buf != NULL)
+			size += sec[i].sec_len;
+	}
+	return size;
+}
+
+#if (defined(INET) || defined(DHCP6)) && defined(HAVE_OPEN_MEMSTREAM)
+/*
+ * Rendering a lease walks every option definition, but RENEW and
+ * REBIND normally bring the same lease back.
+ * Returns 1 if the cached rendering was written to fp.
+ */
+static int
+script_envcache_write(FILE *fp, const struct script_envcache *sec,
+    unsigned int gen, const void *key, size_t keylen)
+{
+
+	if (sec->sec_buf == NULL || sec->sec_gen != gen ||
+	    sec->sec_keylen != keylen || memcmp(sec->sec_key, key, keylen))
+		return 0;
+	if (fwrite(sec->sec_buf, 1, sec->sec_len, fp) != sec->sec_len)
+		return -1;
+	return 1;
+}
+
+/* Keep what was rendered to the memstream since pos. */
+static void
+script_envcache_set(struct dhcpcd_ctx *ctx, FILE *fp,
+    struct script_envcache *sec, unsigned int gen, long pos,
+    const void *key, size_t keylen)
+{
+	long end;
+	size_t len;
+	void *nkey;
+	char *nbuf;
+
+	if (fflush(fp) == EOF || (end = ftell(fp)) == -1 || end < pos)
+		return;
+	len = (size_t)(end - pos);
+	nkey = malloc(keylen);
+	nbuf = malloc(len);
+	if (nkey == NULL || nbuf == NULL) {
+		free(nkey);
+		free(nbuf);
+		return;
+	}
+	memcpy(nkey, key, keylen);
+	memcpy(nbuf, ctx->script_buf + pos, len);
+	free(sec->sec_key);
+	free(sec->sec_buf);
+	sec->sec_gen = gen;
+	sec->sec_key = nkey;
+	sec->sec_keylen = keylen;
+	sec->sec_buf = nbuf;
+	sec->sec_len = len;
+}
+#endif
+
+#ifdef INET
+/*
+ * The xid, secs and flags change on every exchange and a renewal
+ * is acked with our ciaddr, which is only rendered without yiaddr.
+ * The rest is the lease.
+ */
+static int
+script_dhcp_env(struct dhcpcd_ctx *ctx, FILE *fp, const char *prefix,
+    const struct interface *ifp, const struct bootp *bootp, size_t len,
+    struct script_envcache *sec)
+{
+	const struct if_options *ifo = ifp->options;
+#ifdef HAVE_OPEN_MEMSTREAM
+	const void *key = NULL;
+	size_t keylen = 0;
+	long pos = -1;
+
+	if (len < offsetof(struct bootp, vend))
+		sec = NULL;
+	else if (bootp->yiaddr != INADDR_ANY) {
+		key = &bootp->yiaddr;
+		keylen = len - offsetof(struct bootp, yiaddr);
+	} else {
+		key = &bootp->ciaddr;
+		keylen = len - offsetof(struct bootp, ciaddr);
+	}
+	if (sec != NULL) {
+		switch (script_envcache_write(fp, sec, ctx->config_gen,
+		    key, keylen)) {
+		case 1:
+			return 0;
+		case -1:
+			return -1;
+		}
+		if (fflush(fp) == EOF || (pos = ftell(fp)) == -1)
+			return -1;
+	}
+#else
+	UNUSED(ctx);
+	UNUSED(sec);
+#endif
+
+	if (dhcp_env(fp, prefix, ifp, bootp, len) == -1)
+		return -1;
+	if (append_config(fp, prefix, (const char *const *)ifo->config) == -1)
+		return -1;
+
+#ifdef HAVE_OPEN_MEMSTREAM
+	if (sec != NULL)
+		script_envcache_set(ctx, fp, sec, ctx->config_gen, pos,
+		    key, keylen);
+#endif
+	return 0;
+}
+
+static struct script_envcache *
+script_dhcp_envcache(const struct interface *ifp, int slot)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+
+	if (state->envcache == NULL) {
+		state->envcache = calloc(ENVCACHE_LEN,
+		    sizeof(*state->envcache));
+		if (state->envcache == NULL)
+			return NULL;
+	}
+	return &state->envcache[slot];
+}
+#endif
+
+#ifdef DHCP6
+/*
+ * The type and xid change on every exchange, the options are the lease.
+ * Delegated prefixes come from our state, so are always rendered.
+ */
+static int
+script_dhcp6_env(struct dhcpcd_ctx *ctx, FILE *fp, const char *prefix,
+    const struct interface *ifp, const struct dhcp6_message *m, size_t len,
+    struct script_envcache *sec)
+{
+#ifdef HAVE_OPEN_MEMSTREAM
+	const void *key = NULL;
+	size_t keylen = 0;
+	long pos = -1;
+
+	if (len < DHCP6_HDR_LEN)
+		sec = NULL;
+	else {
+		key = (const uint8_t *)m + DHCP6_HDR_LEN;
+		keylen = len - DHCP6_HDR_LEN;
+	}
+	if (sec != NULL) {
+		switch (script_envcache_write(fp, sec, ctx->config_gen,
+		    key, keylen)) {
+		case 1:
+			goto delegated;
+		case -1:
+			return -1;
+		}
+		if (fflush(fp) == EOF || (pos = ftell(fp)) == -1)
+			return -1;
+	}
+#else
+	UNUSED(ctx);
+	UNUSED(sec);
+#endif
+
+	if (dhcp6_envopts(fp, prefix, ifp, m, len) == -1)
+		return -1;
+
+#ifdef HAVE_OPEN_MEMSTREAM
+	if (sec != NULL)
+		script_envcache_set(ctx, fp, sec, ctx->config_gen, pos,
+		    key, keylen);
+delegated:
+#endif
+	if (dhcp6_envdelegated(fp, prefix, ifp) == -1)
+		return -1;
+	return 0;
+}
+
+static struct script_envcache *
+script_dhcp6_envcache(const struct interface *ifp, int slot)
+{
+	struct dhcp6_state *state = D6_STATE(ifp);
+
+	if (state->envcache == NULL) {
+		state->envcache = calloc(ENVCACHE_LEN,
+		    sizeof(*state->envcache));
+		if (state->envcache == NULL)
+			return NULL;
+	}
+	return &state->envcache[slot];
+}
+#endif
+
 #define	PROTO_LINK	0
 #define	PROTO_DHCP	1
 #define	PROTO_IPV4LL	2
@@ -477,18 +935,17 @@ make_env(struct dhcpcd_ctx *ctx, const struct interface *ifp,
 	}
 #ifdef INET
 	if (protocol == PROTO_DHCP && state && state->old) {
-		if (dhcp_env(fp, "old", ifp,
-		    state->old, state->old_len) == -1)
-			goto eexit;
-		if (append_config(fp, "old",
-		    (const char *const *)ifo->config) == -1)
+		if (script_dhcp_env(ctx, fp, "old", ifp,
+		    state->old, state->old_len,
+		    script_dhcp_envcache(ifp, ENVCACHE_OLD)) == -1)
 			goto eexit;
 	}
 #endif
 #ifdef DHCP6
 	if (protocol == PROTO_DHCP6 && d6_state && d6_state->old) {
-		if (dhcp6_env(fp, "old", ifp,
-		    d6_state->old, d6_state->old_len) == -1)
+		if (script_dhcp6_env(ctx, fp, "old", ifp,
+		    d6_state->old, d6_state->old_len,
+		    script_dhcp6_envcache(ifp, ENVCACHE_OLD)) == -1)
 			goto eexit;
 	}
 #endif
@@ -502,11 +959,9 @@ dumplease:
 	}
 #endif
 	if (protocol == PROTO_DHCP && state && state->new) {
-		if (dhcp_env(fp, "new", ifp,
-		    state->new, state->new_len) == -1)
-			goto eexit;
-		if (append_config(fp, "new",
-		    (const char *const *)ifo->config) == -1)
+		if (script_dhcp_env(ctx, fp, "new", ifp,
+		    state->new, state->new_len,
+		    script_dhcp_envcache(ifp, ENVCACHE_NEW)) == -1)
 			goto eexit;
 	}
 #endif
@@ -517,8 +972,12 @@ dumplease:
 	}
 #ifdef DHCP6
 	if (protocol == PROTO_DHCP6 && D6_STATE_RUNNING(ifp)) {
-		if (dhcp6_env(fp, "new", ifp,
-		    d6_state->new, d6_state->new_len) == -1)
+		if (d6_state->new == NULL) {
+			if (dhcp6_envdelegated(fp, "new", ifp) == -1)
+				goto eexit;
+		} else if (script_dhcp6_env(ctx, fp, "new", ifp,
+		    d6_state->new, d6_state->new_len,
+		    script_dhcp6_envcache(ifp, ENVCACHE_NEW)) == -1)
 			goto eexit;
 	}
 #endif
@@ -681,34 +1140,349 @@ send_interface(struct fd_list *fd, const struct interface *ifp, int af)
 	return retval;
 }
 
-static int
-script_run(struct dhcpcd_ctx *ctx, char **argv)
+/*
+ * Scripts run in the background from a queue.
+ * Events for an interface run one at a time in the order they happened,
+ * events for different interfaces run together up to script_jobs.
+ * A queued RENEW and the like is replaced by a newer one for the
+ * same interface as only the latest state matters to the hooks.
+ */
+struct script_job {
+	TAILQ_ENTRY(script_job) sj_next;
+	char sj_ifname[IF_NAMESIZE];
+	char sj_reason[SCRIPT_REASONLEN];
+	char *sj_env;
+	size_t sj_len;
+	pid_t sj_pid;		/* 0 when queued, -1 on the worker */
+#ifndef SMALL
+	struct timespec sj_started;
+#endif
+};
+
+static const char *const script_coalesce_reasons[] = {
+	"RENEW", "REBIND", "RENEW6", "REBIND6", "ROUTERADVERT", "INFORM6",
+	NULL
+};
+
+static bool
+script_coalesce(const char *reason)
 {
-	pid_t pid;
-	int status = 0;
+	const char *const *r;
+
+	for (r = script_coalesce_reasons; *r != NULL; r++) {
+		if (strcmp(*r, reason) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void
+script_envget(const char *env, size_t len, const char *var,
+    char *buf, size_t buflen)
+{
+	const char *ep = env + len;
+	size_t varlen = strlen(var);
 
-	pid = script_exec(argv, ctx->script_env);
-	if (pid == -1)
-		logerr("%s: %s", __func__, argv[0]);
-	else if (pid != 0) {
-		/* Wait for the script to finish */
-		while (waitpid(pid, &status, 0) == -1) {
+	*buf = '\0';
+	for (; env < ep; env += strlen(env) + 1) {
+		if (strncmp(env, var, varlen) == 0) {
+			strlcpy(buf, env + varlen, buflen);
+			return;
+		}
+	}
+}
+
+static void
+script_logstatus(const char *script, int status)
+{
+
+	if (WIFEXITED(status)) {
+		if (WEXITSTATUS(status))
+			logerrx("%s: WEXITSTATUS %d",
+			    script, WEXITSTATUS(status));
+	} else if (WIFSIGNALED(status))
+		logerrx("%s: %s", script, strsignal(WTERMSIG(status)));
+}
+
+static void
+script_job_free(struct dhcpcd_ctx *ctx, struct script_job *sj)
+{
+#ifndef SMALL
+	struct timespec now;
+	unsigned long long ns;
+#endif
+
+	if (sj->sj_pid != 0) {
+		ctx->script_jobs_running--;
+		PROBE3(script_done, sj->sj_ifname, sj->sj_reason, sj->sj_pid);
+#ifndef SMALL
+		if (clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+			ns = (unsigned long long)(now.tv_sec -
+			    sj->sj_started.tv_sec) * NSEC_PER_SEC +
+			    (unsigned long long)now.tv_nsec -
+			    (unsigned long long)sj->sj_started.tv_nsec;
+			ctx->script_runs++;
+			ctx->script_ns += ns;
+			if (ns > ctx->script_ns_max)
+				ctx->script_ns_max = ns;
+		}
+#endif
+	}
+	TAILQ_REMOVE(&ctx->script_jobs, sj, sj_next);
+	free(sj->sj_env);
+	free(sj);
+}
+
+/* Block until the job has finished. */
+static void
+script_job_wait(struct dhcpcd_ctx *ctx, struct script_job *sj)
+{
+	int status;
+
+	if (sj->sj_pid == -1) {
+		status = script_worker_recv(ctx);
+		if (status != 0)
+			logerrx("%s: WEXITSTATUS %d", ctx->script, status);
+	} else {
+		while (waitpid(sj->sj_pid, &status, 0) == -1) {
 			if (errno != EINTR) {
-				logerr("%s: waitpid", __func__);
+				/* Already reaped. */
+				if (errno != ECHILD)
+					logerr("%s: waitpid", __func__);
 				status = 0;
 				break;
 			}
 		}
-		if (WIFEXITED(status)) {
-			if (WEXITSTATUS(status))
-				logerrx("%s: %s: WEXITSTATUS %d",
-				    __func__, argv[0], WEXITSTATUS(status));
-		} else if (WIFSIGNALED(status))
-			logerrx("%s: %s: %s",
-			    __func__, argv[0], strsignal(WTERMSIG(status)));
+		script_logstatus(ctx->script, status);
 	}
+	script_job_free(ctx, sj);
+}
 
-	return WEXITSTATUS(status);
+/* Set NAME=value in an environment made by script_buftoenv. */
+static char **
+script_setenv(struct dhcpcd_ctx *ctx, char **env, char *var)
+{
+	size_t len = strcspn(var, "=") + 1, nenv;
+	char **envp;
+
+	for (nenv = 0; env[nenv] != NULL; nenv++) {
+		if (strncmp(env[nenv], var, len) == 0) {
+			env[nenv] = var;
+			return env;
+		}
+	}
+	if (ctx->script_envlen < nenv + 1) {
+		envp = reallocarray(ctx->script_env, nenv + 2, sizeof(*envp));
+		if (envp == NULL)
+			return NULL;
+		ctx->script_env = env = envp;
+		ctx->script_envlen = nenv + 1;
+	}
+	env[nenv] = var;
+	env[nenv + 1] = NULL;
+	return env;
+}
+
+/* Returns 1 if there was nothing for the script to do. */
+static int
+script_job_start(struct dhcpcd_ctx *ctx, struct script_job *sj)
+{
+	char *argv[] = { ctx->script, NULL };
+	char **env;
+	struct script_job *wj;
+
+	env = script_buftoenv(ctx, sj->sj_env, sj->sj_len);
+	if (env == NULL)
+		return -1;
+	if (!hooks_run(ctx, env))
+		return 1;
+	if (ctx->hook_skip != NULL &&
+	    (env = script_setenv(ctx, env, ctx->hook_skip)) == NULL)
+		return -1;
+
+	/* The worker takes one event at a time. */
+	if (ctx->options & DHCPCD_SCRIPT_WORKER) {
+		TAILQ_FOREACH(wj, &ctx->script_jobs, sj_next) {
+			if (wj->sj_pid == -1)
+				break;
+		}
+		if (wj == NULL && script_worker_send(ctx, env) == 0) {
+			sj->sj_pid = -1;
+			goto started;
+		}
+	}
+
+	sj->sj_pid = script_exec(argv, env);
+	if (sj->sj_pid == -1) {
+		sj->sj_pid = 0;
+		return -1;
+	}
+
+started:
+	ctx->script_jobs_running++;
+	PROBE3(script_run, sj->sj_ifname, sj->sj_reason, sj->sj_pid);
+#ifndef SMALL
+	clock_gettime(CLOCK_MONOTONIC, &sj->sj_started);
+#endif
+#ifndef USE_SIGNALS
+	script_job_wait(ctx, sj);
+#endif
+	return 0;
+}
+
+static void
+script_jobs_run(struct dhcpcd_ctx *ctx)
+{
+	struct script_job *sj, *sjn, *sjp;
+	unsigned int max;
+
+	max = ctx->script_jobs_max == 0 ? 1 : ctx->script_jobs_max;
+	TAILQ_FOREACH_SAFE(sj, &ctx->script_jobs, sj_next, sjn) {
+		if (ctx->script_jobs_running >= max)
+			break;
+		if (sj->sj_pid != 0)
+			continue;
+		/* Keep the order of events for the interface. */
+		for (sjp = TAILQ_PREV(sj, script_jobq, sj_next);
+		    sjp != NULL;
+		    sjp = TAILQ_PREV(sjp, script_jobq, sj_next))
+		{
+			if (strcmp(sjp->sj_ifname, sj->sj_ifname) == 0)
+				break;
+		}
+		if (sjp != NULL)
+			continue;
+		switch (script_job_start(ctx, sj)) {
+		case -1:
+			logerr("%s: %s", __func__, ctx->script);
+			/* FALLTHROUGH */
+		case 1:
+			script_job_free(ctx, sj);
+			break;
+		}
+	}
+}
+
+int
+script_queue(struct dhcpcd_ctx *ctx, const void *data, size_t len)
+{
+	struct script_job *sj;
+	char ifname[IF_NAMESIZE], reason[SCRIPT_REASONLEN];
+	void *env;
+
+	if (len == 0)
+		return 0;
+	if (((const char *)data)[len - 1] != '\0') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((env = malloc(len)) == NULL)
+		return -1;
+	memcpy(env, data, len);
+
+	script_envget(data, len, "interface=", ifname, sizeof(ifname));
+	script_envget(data, len, "reason=", reason, sizeof(reason));
+
+	TAILQ_FOREACH_REVERSE(sj, &ctx->script_jobs, script_jobq, sj_next) {
+		if (strcmp(sj->sj_ifname, ifname) == 0)
+			break;
+	}
+	if (sj != NULL && sj->sj_pid == 0 &&
+	    strcmp(sj->sj_reason, reason) == 0 && script_coalesce(reason))
+	{
+		logdebugx("%s: %s replaces the queued one", ifname, reason);
+		free(sj->sj_env);
+		sj->sj_env = env;
+		sj->sj_len = len;
+		return 0;
+	}
+
+	if ((sj = malloc(sizeof(*sj))) == NULL) {
+		free(env);
+		return -1;
+	}
+	strlcpy(sj->sj_ifname, ifname, sizeof(sj->sj_ifname));
+	strlcpy(sj->sj_reason, reason, sizeof(sj->sj_reason));
+	sj->sj_env = env;
+	sj->sj_len = len;
+	sj->sj_pid = 0;
+	TAILQ_INSERT_TAIL(&ctx->script_jobs, sj, sj_next);
+	script_jobs_run(ctx);
+	return 0;
+}
+
+/* Called for every child reaped, returns true if it was a script. */
+bool
+script_reaped(struct dhcpcd_ctx *ctx, pid_t pid, int status)
+{
+	struct script_job *sj;
+
+	/* script_worker_cb sees the socket close and fails its job. */
+	if (pid == ctx->script_worker_pid) {
+		ctx->script_worker_pid = 0;
+		script_logstatus(ctx->script, status);
+		return true;
+	}
+
+	TAILQ_FOREACH(sj, &ctx->script_jobs, sj_next) {
+		if (sj->sj_pid == pid)
+			break;
+	}
+	if (sj == NULL)
+		return false;
+
+	script_logstatus(ctx->script, status);
+	script_job_free(ctx, sj);
+	script_jobs_run(ctx);
+	return true;
+}
+
+static void
+script_worker_cb(void *arg, unsigned short events)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct script_job *sj;
+	int status;
+
+	if (!(events & (ELE_READ | ELE_HANGUP)))
+		logerrx("%s: unexpected event 0x%04x", __func__, events);
+
+	status = script_worker_recv(ctx);
+	TAILQ_FOREACH(sj, &ctx->script_jobs, sj_next) {
+		if (sj->sj_pid == -1)
+			break;
+	}
+	if (sj == NULL)
+		return;
+
+	if (status != 0)
+		logerrx("%s: WEXITSTATUS %d", ctx->script, status);
+	script_job_free(ctx, sj);
+	script_jobs_run(ctx);
+}
+
+/* Run everything left in the queue before exiting. */
+void
+script_drain(struct dhcpcd_ctx *ctx)
+{
+	struct script_job *sj;
+
+	while ((sj = TAILQ_FIRST(&ctx->script_jobs)) != NULL) {
+		if (sj->sj_pid == 0) {
+			switch (script_job_start(ctx, sj)) {
+			case -1:
+				logerr("%s: %s", __func__, ctx->script);
+				/* FALLTHROUGH */
+			case 1:
+				script_job_free(ctx, sj);
+				continue;
+			}
+		}
+#ifdef USE_SIGNALS
+		script_job_wait(ctx, sj);
+#endif
+	}
 }
 
 int
@@ -736,14 +1510,20 @@ int
 script_runreason(const struct interface *ifp, const char *reason)
 {
 	struct dhcpcd_ctx *ctx = ifp->ctx;
-	char *argv[2];
 	int status = 0;
-	struct fd_list *fd;
+	struct fd_list *fd, *fdn;
+	struct fd_event fe;
 	long buflen;
 
 	if (ctx->script == NULL &&
 	    TAILQ_FIRST(&ifp->ctx->control_fds) == NULL)
 		return 0;
+	/* Stopping for --restart changes nothing to tell anyone. */
+	if (ctx->restarting)
+		return 0;
+
+	/* Let the script see the routes the event made. */
+	rt_flush(ctx);
 
 	/* Make our env */
 	if ((buflen = make_env(ifp->ctx, ifp, reason)) == -1) {
@@ -757,9 +1537,7 @@ script_runreason(const struct interface *ifp, const char *reason)
 	if (ctx->script == NULL)
 		goto send_listeners;
 
-	argv[0] = ctx->script;
-	argv[1] = NULL;
-	logdebugx("%s: executing: %s %s", ifp->name, argv[0], reason);
+	logdebugx("%s: executing: %s %s", ifp->name, ctx->script, reason);
 
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP) {
@@ -770,19 +1548,29 @@ script_runreason(const struct interface *ifp, const char *reason)
 	}
 #endif
 
-	script_run(ctx, argv);
+	if (script_queue(ctx, ctx->script_buf, ctx->script_buflen) == -1)
+		logerr(__func__);
 
 send_listeners:
 	/* Send to our listeners */
 	status = 0;
-	TAILQ_FOREACH(fd, &ctx->control_fds, next) {
+	fe.fe_env = ctx->script_buf;
+	fe.fe_len = ctx->script_buflen;
+	fe.fe_env_buf = fe.fe_tlv_buf = NULL;
+	fe.fe_flags = 0;
+	TAILQ_FOREACH_SAFE(fd, &ctx->control_fds, next, fdn) {
 		if (!(fd->flags & FD_LISTEN))
 			continue;
-		if (control_queue(fd, ctx->script_buf, ctx->script_buflen)== -1)
-			logerr("%s: control_queue", __func__);
-		else
+		switch (control_queue_event(fd, &fe)) {
+		case -1:
+			logerr("%s: control_queue_event", __func__);
+			break;
+		case 0:
 			status = 1;
+			break;
+		}
 	}
+	control_event_free(&fe);
 
 	return status;
 }
@@ -31,11 +31,29 @@
 
 #include "control.h"
 
+/* Part of the environment as rendered from a copy of its source. */
+struct script_envcache {
+	unsigned int sec_gen;		/* ctx->config_gen when rendered */
+	void *sec_key;
+	size_t sec_keylen;
+	char *sec_buf;
+	size_t sec_len;
+};
+#define	ENVCACHE_OLD	0
+#define	ENVCACHE_NEW	1
+#define	ENVCACHE_LEN	2
+
 __printflike(2, 3) int efprintf(FILE *, const char *, ...);
 void if_printoptions(void);
 char ** script_buftoenv(struct dhcpcd_ctx *, char *, size_t);
 pid_t script_exec(char *const *, char *const *);
+void script_worker_stop(struct dhcpcd_ctx *);
+int script_queue(struct dhcpcd_ctx *, const void *, size_t);
+bool script_reaped(struct dhcpcd_ctx *, pid_t, int);
+void script_drain(struct dhcpcd_ctx *);
 int send_interface(struct fd_list *, const struct interface *, int);
 int script_dump(const char *, size_t);
 int script_runreason(const struct interface *, const char *);
+void script_freeenvcache(struct script_envcache *, size_t);
+size_t script_envcache_memsize(const struct script_envcache *, size_t);
 #endif
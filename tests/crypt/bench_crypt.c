@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "test.h"
+
+#ifdef HAVE_MD5_H
+#include <md5.h>
+#endif
+#ifdef SHA2_H
+#include SHA2_H
+#endif
+#ifdef HAVE_HMAC_H
+#include <hmac.h>
+#endif
+
+/* Each size is hashed for about this long */
+#define	BENCH_NSEC	250000000ULL
+
+static unsigned long long
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL +
+	    (unsigned long long)ts.tv_nsec;
+}
+
+static void
+bench_md5(const uint8_t *buf, size_t len, uint8_t *d)
+{
+	MD5_CTX ctx;
+
+	MD5Init(&ctx);
+	MD5Update(&ctx, buf, (unsigned int)len);
+	MD5Final(d, &ctx);
+}
+
+static void
+bench_hmac_md5(const uint8_t *buf, size_t len, uint8_t *d)
+{
+	static const uint8_t key[16] = { 0x0b };
+
+	hmac("md5", key, sizeof(key), buf, len, d, 16);
+}
+
+static void
+bench_sha256(const uint8_t *buf, size_t len, uint8_t *d)
+{
+	SHA256_CTX ctx;
+
+	SHA256_Init(&ctx);
+	SHA256_Update(&ctx, buf, len);
+	SHA256_Final(d, &ctx);
+}
+
+/* 300 bytes is a DHCP message, 1500 a full frame. */
+static void
+bench(const char *name, void (*fn)(const uint8_t *, size_t, uint8_t *))
+{
+	const size_t sizes[] = { 64, 300, 1500, 16384 };
+	uint8_t buf[16384], d[32];
+	unsigned long long start, ns, n;
+	size_t i;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = (uint8_t)i;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		start = bench_now();
+		n = 0;
+		do {
+			fn(buf, sizes[i], d);
+			n++;
+		} while ((ns = bench_now() - start) < BENCH_NSEC);
+		printf("%-16s %6zu bytes %8.0f ns %9.1f MB/s\n",
+		    name, sizes[i], (double)ns / (double)n,
+		    (double)(sizes[i] * n) * 1000.0 / (double)ns);
+	}
+}
+
+int
+bench_crypt(void)
+{
+#ifdef SHA256_BACKENDS
+	const char *backends[] = { "c", "sha-ni" };
+	char name[32];
+	size_t i;
+#endif
+
+	printf("Starting hash throughput benchmarks...\n\n");
+	bench("md5", bench_md5);
+	bench("hmac-md5", bench_hmac_md5);
+#ifdef SHA256_BACKENDS
+	for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		if (SHA256_SetBackend(backends[i]) == -1)
+			continue;
+		snprintf(name, sizeof(name), "sha256 %s", backends[i]);
+		bench(name, bench_sha256);
+	}
+	SHA256_SetBackend(NULL);
+#else
+	bench("sha256", bench_sha256);
+#endif
+	return 0;
+}
@@ -25,14 +25,23 @@
  * SUCH DAMAGE.
  */
 
+#include <string.h>
+
 #include "test.h"
 
-int main(void)
+int main(int argc, char **argv)
 {
 	int r = 0;
 
+	if (argc > 1 && strcmp(argv[1], "-b") == 0)
+		return bench_crypt();
+
 	if (test_hmac_md5())
 		r = -1;
+	if (test_cksum())
+		r = -1;
+	if (test_sha256())
+		r = -1;
 
 	return r;
 }
@@ -28,5 +28,8 @@
 #ifndef TEST_H
 
 int test_hmac_md5(void);
+int test_cksum(void);
+int test_sha256(void);
+int bench_crypt(void);
 
 #endif
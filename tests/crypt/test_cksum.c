@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "cksum.h"
+#include "test.h"
+
+/* The straightforward version in_cksum must agree with. */
+static uint16_t
+ref_cksum(const void *data, size_t len, uint32_t *isum)
+{
+	const uint8_t *p = data;
+	uint32_t sum = isum != NULL ? *isum : 0;
+	uint16_t word;
+
+	for (; len > 1; len -= sizeof(word), p += sizeof(word)) {
+		memcpy(&word, p, sizeof(word));
+		sum += word;
+	}
+
+	if (len == 1)
+		sum += htons((uint16_t)(*p << 8));
+
+	if (isum != NULL)
+		*isum = sum;
+
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+
+	return (uint16_t)~sum;
+}
+
+static void
+cksum_fail(const char *test, size_t off, size_t len,
+    uint16_t got, uint16_t want)
+{
+
+	fprintf(stderr, "FAILED!\n%s offset %zu length %zu: "
+	    "got 0x%04x expected 0x%04x\n", test, off, len, got, want);
+	exit(EXIT_FAILURE);
+}
+
+/* RFC 1071 section 3 */
+static void
+cksum_test1(void)
+{
+	const uint8_t data[] = {
+	    0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7,
+	};
+	uint16_t sum;
+
+	printf("Checksum Test 1:\t\t");
+	sum = ntohs(in_cksum(data, sizeof(data), NULL));
+	if (sum != 0x220d)
+		cksum_fail("RFC 1071", 0, sizeof(data), sum, 0x220d);
+	printf("0x%04x\n", sum);
+}
+
+/* Every length and alignment a frame could have. */
+static void
+cksum_test2(void)
+{
+	uint8_t buf[1600 + 8];
+	uint32_t seed = 1;
+	size_t i, off, len;
+	uint16_t got, want;
+
+	printf("Checksum Test 2:\t\t");
+	for (i = 0; i < sizeof(buf); i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t)(seed >> 16);
+	}
+	for (off = 0; off < 8; off++) {
+		for (len = 0; len <= 1600; len++) {
+			got = in_cksum(buf + off, len, NULL);
+			want = ref_cksum(buf + off, len, NULL);
+			if (got != want)
+				cksum_fail("random", off, len, got, want);
+		}
+	}
+	printf("pass\n");
+}
+
+/* All zeros and all ones are where 0x0000 and 0xffff differ. */
+static void
+cksum_test3(void)
+{
+	uint8_t buf[1600];
+	size_t len;
+	uint16_t got, want;
+	int c;
+
+	printf("Checksum Test 3:\t\t");
+	for (c = 0; c < 0x100; c += 0xff) {
+		memset(buf, c, sizeof(buf));
+		for (len = 0; len <= sizeof(buf); len++) {
+			got = in_cksum(buf, len, NULL);
+			want = ref_cksum(buf, len, NULL);
+			if (got != want)
+				cksum_fail(c ? "ones" : "zeros", 0, len,
+				    got, want);
+		}
+	}
+	printf("pass\n");
+}
+
+/* A pseudo header carried into the packet, as for UDP. */
+static void
+cksum_test4(void)
+{
+	uint8_t buf[1600];
+	uint32_t seed = 2, isum, rsum;
+	size_t i, len;
+	uint16_t got, want;
+
+	printf("Checksum Test 4:\t\t");
+	for (i = 0; i < sizeof(buf); i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t)(seed >> 16);
+	}
+	for (len = 0; len <= sizeof(buf) - 12; len++) {
+		isum = rsum = 0;
+		in_cksum(buf, 12, &isum);
+		ref_cksum(buf, 12, &rsum);
+		got = in_cksum(buf + 12, len, &isum);
+		want = ref_cksum(buf + 12, len, &rsum);
+		if (got != want)
+			cksum_fail("pseudo header", 12, len, got, want);
+	}
+	printf("pass\n");
+}
+
+int test_cksum(void)
+{
+
+	printf ("Starting Internet checksum tests...\n\n");
+	cksum_test1();
+	cksum_test2();
+	cksum_test3();
+	cksum_test4();
+	printf("\nAll tests pass.\n");
+	return 0;
+}
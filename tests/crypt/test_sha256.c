@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "test.h"
+
+#ifdef SHA2_H
+#include SHA2_H
+#endif
+
+static void
+print_sha256(FILE *stream, const uint8_t *d)
+{
+	int i;
+
+	fprintf(stream, "digest = 0x");
+	for (i = 0; i < 32; i++)
+		fprintf(stream, "%02x", *d++);
+	fprintf(stream, "\n");
+}
+
+static void
+test_sha256_digest(const uint8_t *d, const uint8_t *tst)
+{
+
+	if (memcmp(d, tst, 32) == 0)
+		return;
+	fprintf(stderr, "FAILED!\nGot\t\t\t");
+	print_sha256(stderr, d);
+	fprintf(stderr, "Expected\t\t");
+	print_sha256(stderr, tst);
+	exit(EXIT_FAILURE);
+}
+
+/* Hash text in chunks of step bytes to cover partial and multi-block
+ * updates. */
+static void
+sha256_chunks(const uint8_t *text, size_t len, size_t step, uint8_t *d)
+{
+	SHA256_CTX ctx;
+	size_t n;
+
+	SHA256_Init(&ctx);
+	for (; len != 0; len -= n, text += n) {
+		n = len < step ? len : step;
+		SHA256_Update(&ctx, text, n);
+	}
+	SHA256_Final(d, &ctx);
+}
+
+/* FIPS 180-2 appendix B */
+static void
+sha256_fips(void)
+{
+	const uint8_t abc[] = "abc";
+	const uint8_t abc_d[32] = {
+	    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+	    0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+	    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+	    0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+	};
+	const uint8_t two[] =
+	    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	const uint8_t two_d[32] = {
+	    0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8,
+	    0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+	    0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67,
+	    0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1,
+	};
+	const uint8_t million_d[32] = {
+	    0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92,
+	    0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+	    0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e,
+	    0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0,
+	};
+	const size_t steps[] = { 1, 63, 64, 65, 1000, 1000000 };
+	uint8_t *million, d[32];
+	size_t i;
+
+	sha256_chunks(abc, sizeof(abc) - 1, sizeof(abc), d);
+	test_sha256_digest(d, abc_d);
+	sha256_chunks(two, sizeof(two) - 1, sizeof(two), d);
+	test_sha256_digest(d, two_d);
+
+	if ((million = malloc(1000000)) == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(million, 'a', 1000000);
+	for (i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		sha256_chunks(million, 1000000, steps[i], d);
+		test_sha256_digest(d, million_d);
+	}
+	free(million);
+}
+
+int
+test_sha256(void)
+{
+#ifdef SHA256_BACKENDS
+	const char *backends[] = { "c", "sha-ni" };
+	size_t i;
+#endif
+
+	printf("Starting FIPS 180-2 SHA-256 tests...\n\n");
+#ifdef SHA256_BACKENDS
+	for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		printf("SHA256 %s:\t\t\t", backends[i]);
+		if (SHA256_SetBackend(backends[i]) == -1) {
+			printf("not supported\n");
+			continue;
+		}
+		sha256_fips();
+		printf("pass\n");
+	}
+	SHA256_SetBackend(NULL);
+#else
+	printf("SHA256:\t\t\t\t");
+	sha256_fips();
+	printf("pass\n");
+#endif
+	printf("\nAll tests pass.\n");
+	return 0;
+}
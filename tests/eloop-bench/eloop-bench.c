@@ -25,12 +25,15 @@
  * SUCH DAMAGE.
  */
 
+
 #include <sys/resource.h>
 
 #include <err.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -48,14 +51,131 @@
         } while (/* CONSTCOND */ 0)
 #endif
 
+#ifndef __arraycount
+#define __arraycount(__x)	(sizeof(__x) / sizeof(__x[0]))
+#endif
+#ifndef __unused
+#define __unused		__attribute__((__unused__))
+#endif
+
+#define NSEC_PER_USEC		1000
+
 struct pipe {
 	int fd[2];
 };
 
+/* Latencies in nanoseconds, sorted when reported. */
+struct samples {
+	unsigned long long *v;
+	size_t n;
+	size_t len;
+};
+
+struct timer {
+	unsigned long long when;
+	size_t next;
+};
+
+enum format { FMT_TEXT, FMT_CSV, FMT_JSON };
+
 static size_t good, bad, writes, fired;
 static size_t npipes = 100, nwrites = 100, nactive = 1;
 static struct pipe *pipes;
 static struct eloop *e;
+static enum format format = FMT_TEXT;
+static size_t nreports;
+
+static struct samples s_timer_late, s_timer_rearm, s_churn, s_signal;
+static struct samples s_busy_late, s_busy_packet;
+static struct timer *timers;
+static struct pipe churn;
+static unsigned long long churn_added, signal_sent, packet_sent, tick_when;
+static int busy_prio = ELOOP_PRIO_LOW;
+static const int bench_signals[] = { SIGUSR1 };
+
+static unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return (unsigned long long)ts.tv_sec * NSEC_PER_SEC +
+	    (unsigned long long)ts.tv_nsec;
+}
+
+static void
+sample_add(struct samples *s, unsigned long long ns)
+{
+
+	if (s->n == s->len) {
+		size_t len = s->len == 0 ? 1024 : s->len * 2;
+		unsigned long long *v;
+
+		v = realloc(s->v, len * sizeof(*v));
+		if (v == NULL)
+			err(EXIT_FAILURE, "realloc");
+		s->v = v;
+		s->len = len;
+	}
+	s->v[s->n++] = ns;
+}
+
+static int
+sample_cmp(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Nearest rank */
+static unsigned long long
+sample_pct(const struct samples *s, unsigned int pct)
+{
+	size_t i;
+
+	i = (s->n * pct + 99) / 100;
+	return s->v[i == 0 ? 0 : i - 1];
+}
+
+static void
+report(const char *backend, const char *scenario, const char *metric,
+    struct samples *s)
+{
+	unsigned long long min, p50, p90, p99, max;
+
+	if (s->n == 0)
+		return;
+	qsort(s->v, s->n, sizeof(*s->v), sample_cmp);
+	min = s->v[0];
+	p50 = sample_pct(s, 50);
+	p90 = sample_pct(s, 90);
+	p99 = sample_pct(s, 99);
+	max = s->v[s->n - 1];
+
+	switch (format) {
+	case FMT_CSV:
+		printf("%s,%s,%s,%zu,%llu,%llu,%llu,%llu,%llu\n",
+		    backend, scenario, metric, s->n, min, p50, p90, p99, max);
+		break;
+	case FMT_JSON:
+		printf("%s{\"backend\":\"%s\",\"scenario\":\"%s\","
+		    "\"metric\":\"%s\",\"count\":%zu,\"min\":%llu,"
+		    "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}",
+		    nreports == 0 ? "\n" : ",\n",
+		    backend, scenario, metric, s->n, min, p50, p90, p99, max);
+		break;
+	default:
+		printf("%s %s %s: count %zu, min %llu, p50 %llu, p90 %llu, "
+		    "p99 %llu, max %llu ns\n",
+		    backend, scenario, metric, s->n, min, p50, p90, p99, max);
+		break;
+	}
+	nreports++;
+	s->n = 0;
+}
 
 static void
 read_cb(void *arg, unsigned short events)
@@ -89,11 +209,11 @@ read_cb(void *arg, unsigned short events)
 }
 
 static int
-runone(struct timespec *t)
+run_pipe(struct samples *s)
 {
 	size_t i;
 	struct pipe *p;
-	struct timespec ts, te;
+	unsigned long long start;
 	int result;
 
 	writes = nwrites;
@@ -106,35 +226,420 @@ runone(struct timespec *t)
 		fired++;
 	}
 
-	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
-		err(EXIT_FAILURE, "clock_gettime");
+	start = now_ns();
+	eloop_enter(e);
 	result = eloop_start(e, NULL);
-	if (clock_gettime(CLOCK_MONOTONIC, &te) == -1)
-		err(EXIT_FAILURE, "clock_gettime");
+	sample_add(s, now_ns() - start);
+	return result;
+}
+
+/*
+ * Every pipe has a timer which fires in 1 to 10 msec.
+ * When it fires it re-arms itself and pushes back the next one
+ * which is still pending, like dhcpcd does when a packet arrives.
+ */
+static void
+timer_cb(void *arg)
+{
+	struct timer *t = arg, *nt;
+	unsigned long long now, start, msec;
+
+	now = now_ns();
+	sample_add(&s_timer_late, now > t->when ? now - t->when : 0);
+	if (++fired == nwrites) {
+		eloop_exit(e, EXIT_SUCCESS);
+		return;
+	}
+
+	msec = (fired % 10) + 1;
+	t->when = now + msec * NSEC_PER_MSEC;
+	if (eloop_timeout_add_msec(e, (unsigned long)msec, timer_cb, t) == -1)
+		err(EXIT_FAILURE, "eloop_timeout_add_msec");
+
+	nt = &timers[t->next];
+	if (nt == t)
+		return;
+	msec = ((fired + 5) % 10) + 1;
+	start = now_ns();
+	nt->when = start + msec * NSEC_PER_MSEC;
+	if (eloop_timeout_add_msec(e, (unsigned long)msec, timer_cb, nt) == -1)
+		err(EXIT_FAILURE, "eloop_timeout_add_msec");
+	sample_add(&s_timer_rearm, now_ns() - start);
+}
+
+static int
+run_timer(struct samples *s)
+{
+	size_t i;
+	unsigned long long start, msec;
+	int result;
+
+	fired = 0;
+	start = now_ns();
+	for (i = 0; i < npipes; i++) {
+		msec = (i % 10) + 1;
+		timers[i].when = start + msec * NSEC_PER_MSEC;
+		timers[i].next = (i + 1) % npipes;
+		if (eloop_timeout_add_msec(e, (unsigned long)msec,
+		    timer_cb, &timers[i]) == -1)
+			err(EXIT_FAILURE, "eloop_timeout_add_msec");
+	}
+
+	eloop_enter(e);
+	result = eloop_start(e, NULL);
+	sample_add(s, now_ns() - start);
+
+	for (i = 0; i < npipes; i++)
+		eloop_timeout_delete(e, timer_cb, &timers[i]);
+	return result;
+}
+
+static void churn_cb(void *, unsigned short);
+
+static void
+churn_open(void)
+{
+
+	if (pipe2(churn.fd, O_CLOEXEC | O_NONBLOCK) == -1)
+		err(EXIT_FAILURE, "pipe");
+	if (write(churn.fd[1], "e", 1) != 1)
+		err(EXIT_FAILURE, "send");
+	churn_added = now_ns();
+	if (eloop_event_add(e, churn.fd[0], ELE_READ, churn_cb, &churn) == -1)
+		err(EXIT_FAILURE, "eloop_event_add");
+}
+
+/*
+ * A descriptor is added and then deleted once it's read,
+ * like dhcpcd opening a socket for a new lease or route query.
+ * The other pipes are idle.
+ */
+static void
+churn_cb(void *arg, unsigned short events)
+{
+	struct pipe *p = arg;
+
+	sample_add(&s_churn, now_ns() - churn_added);
+	if (events != ELE_READ)
+		warn("%s: unexpected events 0x%04x", __func__, events);
+	if (eloop_event_delete(e, p->fd[0]) == -1)
+		err(EXIT_FAILURE, "eloop_event_delete");
+	close(p->fd[0]);
+	close(p->fd[1]);
+
+	if (++fired == nwrites) {
+		eloop_exit(e, EXIT_SUCCESS);
+		return;
+	}
+	churn_open();
+}
+
+static int
+run_churn(struct samples *s)
+{
+	unsigned long long start;
+	int result;
+
+	fired = 0;
+	start = now_ns();
+	churn_open();
+	eloop_enter(e);
+	result = eloop_start(e, NULL);
+	sample_add(s, now_ns() - start);
+	return result;
+}
+
+/* The time from kill(2) to our callback being run. */
+static void signal_send(void *);
+
+static void
+signal_cb(int sig, void *arg)
+{
+
+	sample_add(&s_signal, now_ns() - signal_sent);
+	if (sig != SIGUSR1)
+		warnx("%s: unexpected signal %d", __func__, sig);
+	if (++fired == nwrites) {
+		eloop_exit(e, EXIT_SUCCESS);
+		return;
+	}
+	if (eloop_timeout_add_msec(e, 0, signal_send, arg) == -1)
+		err(EXIT_FAILURE, "eloop_timeout_add_msec");
+}
+
+static void
+signal_send(__unused void *arg)
+{
+
+	signal_sent = now_ns();
+	if (kill(getpid(), SIGUSR1) == -1)
+		err(EXIT_FAILURE, "kill");
+}
+
+static int
+run_signal(struct samples *s)
+{
+	sigset_t oldset;
+	unsigned long long start;
+	int result;
+
+	if (eloop_signal_set_cb(e, bench_signals, __arraycount(bench_signals),
+	    signal_cb, e) == -1)
+		err(EXIT_FAILURE, "eloop_signal_set_cb");
+	if (eloop_signal_mask(e, &oldset) == -1)
+		err(EXIT_FAILURE, "eloop_signal_mask");
 
-	timespecsub(&te, &ts, t);
+	fired = 0;
+	start = now_ns();
+	if (eloop_timeout_add_msec(e, 0, signal_send, e) == -1)
+		err(EXIT_FAILURE, "eloop_timeout_add_msec");
+	eloop_enter(e);
+	result = eloop_start(e, &oldset);
+	sample_add(s, now_ns() - start);
+
+	if (sigprocmask(SIG_SETMASK, &oldset, NULL) == -1)
+		err(EXIT_FAILURE, "sigprocmask");
+	eloop_signal_set_cb(e, NULL, 0, NULL, NULL);
 	return result;
 }
 
+/*
+ * Busy pipes are never read so they are always ready and their
+ * callbacks take 100 usec, like a flood of control clients.
+ * A 1 msec timeout writes to a high priority pipe,
+ * like a packet arriving which has to be answered.
+ */
+static void
+busy_cb(__unused void *arg, __unused unsigned short events)
+{
+	unsigned long long end;
+
+	for (end = now_ns() + 100 * NSEC_PER_USEC; now_ns() < end;)
+		;
+}
+
+static void
+packet_cb(void *arg, __unused unsigned short events)
+{
+	struct pipe *p = arg;
+	unsigned char buf[1];
+
+	sample_add(&s_busy_packet, now_ns() - packet_sent);
+	if (read(p->fd[0], buf, 1) != 1)
+		err(EXIT_FAILURE, "read");
+}
+
+static void
+tick_cb(void *arg)
+{
+	struct pipe *p = arg;
+	unsigned long long now;
+
+	now = now_ns();
+	sample_add(&s_busy_late, now > tick_when ? now - tick_when : 0);
+	if (++fired == nwrites) {
+		eloop_exit(e, EXIT_SUCCESS);
+		return;
+	}
+	packet_sent = now_ns();
+	if (write(p->fd[1], "e", 1) != 1)
+		err(EXIT_FAILURE, "send");
+	tick_when = now + NSEC_PER_MSEC;
+	if (eloop_timeout_add_msec(e, 1, tick_cb, arg) == -1)
+		err(EXIT_FAILURE, "eloop_timeout_add_msec");
+}
+
+static int
+run_busy(struct samples *s)
+{
+	size_t i, nbusy;
+	struct pipe *p, *pp;
+	unsigned char buf[1];
+	unsigned long long start;
+	int result;
+
+	/* The last pipe carries the packets. */
+	nbusy = nactive < npipes ? nactive : npipes - 1;
+	pp = &pipes[npipes - 1];
+	if (eloop_p_event_add(e, ELOOP_PRIO_HIGH, pp->fd[0], ELE_READ,
+	    packet_cb, pp) == -1)
+		err(EXIT_FAILURE, "eloop_p_event_add");
+	for (i = 0, p = pipes; i < nbusy; i++, p++) {
+		if (write(p->fd[1], "e", 1) != 1)
+			err(EXIT_FAILURE, "send");
+		if (eloop_p_event_add(e, busy_prio, p->fd[0], ELE_READ,
+		    busy_cb, p) == -1)
+			err(EXIT_FAILURE, "eloop_p_event_add");
+	}
+
+	fired = 0;
+	start = now_ns();
+	tick_when = start + NSEC_PER_MSEC;
+	if (eloop_timeout_add_msec(e, 1, tick_cb, pp) == -1)
+		err(EXIT_FAILURE, "eloop_timeout_add_msec");
+	eloop_enter(e);
+	result = eloop_start(e, NULL);
+	sample_add(s, now_ns() - start);
+
+	for (i = 0, p = pipes; i < nbusy; i++, p++) {
+		if (read(p->fd[0], buf, 1) != 1)
+			err(EXIT_FAILURE, "read");
+		if (eloop_event_add(e, p->fd[0], ELE_READ, read_cb, p) == -1)
+			err(EXIT_FAILURE, "eloop_event_add");
+	}
+	while (read(pp->fd[0], buf, 1) == 1)
+		;
+	if (eloop_event_add(e, pp->fd[0], ELE_READ, read_cb, pp) == -1)
+		err(EXIT_FAILURE, "eloop_event_add");
+	return result;
+}
+
+static const struct scenario {
+	const char *name;
+	int (*run)(struct samples *);
+	const char *metric;
+	struct samples *samples;
+} scenarios[] = {
+	{ "pipe",	run_pipe,	NULL,		NULL },
+	{ "timer",	run_timer,	"late",		&s_timer_late },
+	{ "timer",	NULL,		"rearm",	&s_timer_rearm },
+	{ "churn",	run_churn,	"add",		&s_churn },
+	{ "signal",	run_signal,	"deliver",	&s_signal },
+	{ "busy",	run_busy,	"late",		&s_busy_late },
+	{ "busy",	NULL,		"packet",	&s_busy_packet },
+};
+
+static int
+bench(const char *backend, const struct scenario *sc, size_t nruns,
+    unsigned int batch)
+{
+	int result, exit_code;
+	size_t i;
+	struct pipe *p;
+	struct samples runs = { NULL, 0, 0 };
+	const struct scenario *scm;
+	const struct eloop_stats *es;
+
+	if ((e = eloop_new()) == NULL)
+		err(EXIT_FAILURE, "eloop_init");
+	if (backend != NULL && eloop_set_backend(e, backend) == -1)
+		err(EXIT_FAILURE, "eloop_set_backend: %s", backend);
+	eloop_set_batch(e, batch);
+	backend = eloop_backend(e);
+
+	pipes = calloc(npipes, sizeof(*p));
+	if (pipes == NULL)
+		err(EXIT_FAILURE, "malloc");
+	timers = calloc(npipes, sizeof(*timers));
+	if (timers == NULL)
+		err(EXIT_FAILURE, "malloc");
+
+	for (i = 0, p = pipes; i < npipes; i++, p++) {
+		if (pipe2(p->fd, O_CLOEXEC | O_NONBLOCK) == -1)
+			err(EXIT_FAILURE, "pipe");
+		if (eloop_event_add(e, p->fd[0], ELE_READ, read_cb, p) == -1)
+			err(EXIT_FAILURE, "eloop_event_add");
+	}
+
+	if (format == FMT_TEXT)
+		printf("%s %s: active = %zu, pipes = %zu, runs = %zu, "
+		    "writes = %zu\n", backend, sc->name,
+		    nactive, npipes, nruns, nwrites);
+
+	exit_code = EXIT_SUCCESS;
+	for (i = 0; i < nruns; i++) {
+		result = sc->run(&runs);
+		if (result != EXIT_SUCCESS)
+			exit_code = result;
+		if (format == FMT_TEXT)
+			printf("run %zu took %llu.%.9llu seconds, result %d\n",
+			    i + 1, runs.v[i] / NSEC_PER_SEC,
+			    runs.v[i] % NSEC_PER_SEC, result);
+	}
+
+	/* A scenario can report more than one metric. */
+	for (scm = sc; scm < scenarios + __arraycount(scenarios) &&
+	    strcmp(scm->name, sc->name) == 0; scm++)
+	{
+		if (scm->samples != NULL)
+			report(backend, scm->name, scm->metric, scm->samples);
+	}
+	report(backend, sc->name, "run", &runs);
+	free(runs.v);
+
+	es = eloop_stats(e);
+	if (format == FMT_TEXT)
+		printf("wakeups %llu, rounds %llu, events %llu, "
+		    "max events per wakeup %llu, "
+		    "callbacks %llu.%.9llu seconds\n",
+		    es->wakeups, es->rounds, es->events, es->events_max,
+		    es->callback_ns / NSEC_PER_SEC,
+		    es->callback_ns % NSEC_PER_SEC);
+
+	/* eloop_free closes the read side for us. */
+	for (i = 0, p = pipes; i < npipes; i++, p++)
+		close(p->fd[1]);
+	eloop_free(e);
+	e = NULL;
+	free(pipes);
+	pipes = NULL;
+	free(timers);
+	timers = NULL;
+	return exit_code;
+}
+
 int
 main(int argc, char **argv)
 {
 	int c, result, exit_code;
-	size_t i, nruns = 25;
-	struct pipe *p;
+	size_t i, j, nruns = 25;
+	unsigned int batch = 0;
+	const char *backend = NULL, *scenario = NULL, *name;
+	const struct scenario *sc;
 	struct timespec ts, te, t;
 
-	while ((c = getopt(argc, argv, "a:n:r:w:")) != -1) {
+	while ((c = getopt(argc, argv, "a:b:e:n:o:p:r:s:w:")) != -1) {
 		switch (c) {
 		case 'a':
 			nactive = (size_t)atoi(optarg);
 			break;
+		case 'b':
+			batch = (unsigned int)atoi(optarg);
+			break;
+		case 'e':
+			backend = optarg;
+			break;
 		case 'n':
 			npipes = (size_t)atoi(optarg);
 			break;
+		case 'o':
+			if (strcmp(optarg, "text") == 0)
+				format = FMT_TEXT;
+			else if (strcmp(optarg, "csv") == 0)
+				format = FMT_CSV;
+			else if (strcmp(optarg, "json") == 0)
+				format = FMT_JSON;
+			else
+				errx(EXIT_FAILURE, "unknown format `%s'",
+				    optarg);
+			break;
+		case 'p':
+			if (strcmp(optarg, "high") == 0)
+				busy_prio = ELOOP_PRIO_HIGH;
+			else if (strcmp(optarg, "normal") == 0)
+				busy_prio = ELOOP_PRIO_NORMAL;
+			else if (strcmp(optarg, "low") == 0)
+				busy_prio = ELOOP_PRIO_LOW;
+			else
+				errx(EXIT_FAILURE, "unknown priority `%s'",
+				    optarg);
+			break;
 		case 'r':
 			nruns = (size_t)atoi(optarg);
 			break;
+		case 's':
+			scenario = optarg;
+			break;
 		case 'w':
 			nwrites = (size_t)atoi(optarg);
 			break;
@@ -143,45 +648,57 @@ main(int argc, char **argv)
 		}
 	}
 
-	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
-		err(EXIT_FAILURE, "clock_gettime");
-
-	if ((e = eloop_new()) == NULL)
-		err(EXIT_FAILURE, "eloop_init");
-
+	if (npipes < 2)
+		errx(EXIT_FAILURE, "need at least two pipes");
 	if (nactive > npipes)
 		nactive = npipes;
-
-	pipes = calloc(npipes, sizeof(*p));
-	if (pipes == NULL)
-		err(EXIT_FAILURE, "malloc");
-
-	for (i = 0, p = pipes; i < npipes; i++, p++) {
-		if (pipe2(p->fd, O_CLOEXEC | O_NONBLOCK) == -1)
-			err(EXIT_FAILURE, "pipe");
-		if (eloop_event_add(e, p->fd[0], ELE_READ, read_cb, p) == -1)
-			err(EXIT_FAILURE, "eloop_event_add");
+	if (scenario != NULL) {
+		for (i = 0; i < __arraycount(scenarios); i++) {
+			if (strcmp(scenarios[i].name, scenario) == 0)
+				break;
+		}
+		if (i == __arraycount(scenarios))
+			errx(EXIT_FAILURE, "unknown scenario `%s'", scenario);
 	}
 
-	printf("active = %zu, pipes = %zu, runs = %zu, writes = %zu\n",
-	    nactive, npipes, nruns, nwrites);
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+
+	if (format == FMT_CSV)
+		printf("backend,scenario,metric,count,min,p50,p90,p99,max\n");
+	else if (format == FMT_JSON)
+		printf("[");
 
+	/* Without -e, compare every polling mechanism compiled in.
+	 * Without -s, run every scenario. */
 	exit_code = EXIT_SUCCESS;
-	for (i = 0; i < nruns; i++) {
-		result = runone(&t);
-		if (result != EXIT_SUCCESS)
-			exit_code = result;
-		printf("run %zu took %lld.%.9ld seconds, result %d\n",
-		    i + 1, (long long)t.tv_sec, t.tv_nsec, result);
+	for (i = 0; ; i++) {
+		if (backend != NULL)
+			name = i == 0 ? backend : NULL;
+		else
+			name = eloop_backend_name(i);
+		if (name == NULL)
+			break;
+		for (j = 0, sc = scenarios; j < __arraycount(scenarios);
+		    j++, sc++)
+		{
+			if (sc->run == NULL ||
+			    (scenario != NULL && strcmp(sc->name, scenario) != 0))
+				continue;
+			result = bench(name, sc, nruns, batch);
+			if (result != EXIT_SUCCESS)
+				exit_code = result;
+		}
 	}
 
-	eloop_free(e);
-	free(pipes);
+	if (format == FMT_JSON)
+		printf("\n]\n");
 
 	if (clock_gettime(CLOCK_MONOTONIC, &te) == -1)
 		err(EXIT_FAILURE, "clock_gettime");
 	timespecsub(&te, &ts, &t);
-	printf("total %lld.%.9ld seconds, result %d\n",
-	    (long long)t.tv_sec, t.tv_nsec, exit_code);
+	if (format == FMT_TEXT)
+		printf("total %lld.%.9ld seconds, result %d\n",
+		    (long long)t.tv_sec, t.tv_nsec, exit_code);
 	exit(exit_code);
 }
@@ -0,0 +1,80 @@
+/*
+ * dhcpcd option parser fuzzing harness
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * dhcp-common.c is built into the harness here instead of being linked
+ * so the targets can reach print_option.
+ */
+#include "dhcp-common.c"
+#include "fuzz.h"
+
+/*
+ * The input is a definition followed by the option data to print.
+ * The first octet picks DHCP, DHCPv6 or ND definitions and the next two
+ * the option code in network order.
+ */
+void
+fuzz_print(uint8_t *data, size_t len)
+{
+	struct dhcpcd_ctx *ctx = fuzz_ctx;
+	const struct dhcp_opt *opt = NULL;
+	unsigned int code;
+#ifdef INET6
+	size_t i;
+#endif
+
+	if (len < 3)
+		return;
+	code = (unsigned int)(data[1] << 8 | data[2]);
+	switch (data[0] % 3) {
+#ifdef INET
+	case 0:
+		opt = dhcp_optmap_find(&ctx->dhcp_optmap, code);
+		break;
+#endif
+#ifdef DHCP6
+	case 1:
+		opt = dhcp_optmap_find(&ctx->dhcp6_optmap, code);
+		break;
+#endif
+#ifdef INET6
+	case 2:
+		for (i = 0; i < ctx->nd_opts_len; i++) {
+			if (ctx->nd_opts[i].option == code) {
+				opt = &ctx->nd_opts[i];
+				break;
+			}
+		}
+		break;
+#endif
+	}
+	if (opt == NULL)
+		return;
+	print_option(fuzz_fp, "fuzz", opt, 1, data + 3, len - 3, "fz0");
+	/* Each option is a string of its own. */
+	fputc('\0', fuzz_fp);
+}
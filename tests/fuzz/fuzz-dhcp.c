@@ -0,0 +1,118 @@
+/*
+ * dhcpcd option parser fuzzing harness
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * dhcp.c is built into the harness here instead of being linked
+ * so the targets can reach get_option and decode_rfc3442_rt.
+ */
+#include "config.h"
+
+#ifdef INET
+#include "dhcp.c"
+#include "fuzz.h"
+
+struct fuzz_dhcpopt {
+	size_t off;
+	size_t len;
+	bool found;
+	int error;
+};
+
+/*
+ * Every option is looked up by walking the message as get_option does
+ * and again from the index dhcp_env and get_lease build, which must
+ * agree as to what each option holds.
+ */
+void
+fuzz_dhcp(uint8_t *data, size_t len)
+{
+	struct dhcpcd_ctx *ctx = fuzz_ctx;
+	const struct bootp *bootp = (const struct bootp *)data;
+	struct fuzz_dhcpopt opts[UINT8_MAX + 1], *fo;
+	const uint8_t *p;
+	uint8_t *scan;
+	size_t off, ol;
+	unsigned int opt;
+
+	/* Each byte belongs to one option at most. */
+	if ((scan = malloc(len + 1)) == NULL)
+		fuzz_fail("malloc: %s", strerror(errno));
+
+	dhcp_unindexoptions(ctx);
+	off = 0;
+	for (opt = 0; opt <= UINT8_MAX; opt++) {
+		fo = &opts[opt];
+		errno = 0;
+		p = get_option(ctx, bootp, len, opt, &ol);
+		fo->found = p != NULL;
+		fo->error = errno;
+		if (!fo->found)
+			continue;
+		if (off + ol > len)
+			fuzz_fail("option %u: %zu bytes of a %zu byte message",
+			    opt, off + ol, len);
+		memcpy(scan + off, p, ol);
+		fo->off = off;
+		fo->len = ol;
+		off += ol;
+	}
+
+	dhcp_indexoptions(ctx, bootp, len);
+	for (opt = 0; opt <= UINT8_MAX; opt++) {
+		fo = &opts[opt];
+		errno = 0;
+		p = get_option(ctx, bootp, len, opt, &ol);
+		if (p == NULL) {
+			if (fo->found)
+				fuzz_fail("option %u: not in the index", opt);
+			if (errno != fo->error)
+				fuzz_fail("option %u: index error %d, "
+				    "scan error %d", opt, errno, fo->error);
+			continue;
+		}
+		if (!fo->found)
+			fuzz_fail("option %u: only in the index", opt);
+		if (ol != fo->len || memcmp(p, scan + fo->off, ol) != 0)
+			fuzz_fail("option %u: index and scan differ", opt);
+	}
+	dhcp_unindexoptions(ctx);
+	free(scan);
+}
+
+/* The classless static routes option is decoded and printed. */
+void
+fuzz_rfc3442(uint8_t *data, size_t len)
+{
+	static const struct bootp bootp;
+	rb_tree_t routes;
+
+	rb_tree_init(&routes, &rt_compare_proto_ops);
+	decode_rfc3442_rt(&routes, fuzz_ifp, data, len, &bootp);
+	rt_headclear(&routes, AF_UNSPEC);
+	print_rfc3442(fuzz_fp, data, len);
+}
+#endif
@@ -0,0 +1,99 @@
+/*
+ * dhcpcd option parser fuzzing harness
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * dhcp6.c is built into the harness here instead of being linked
+ * so the targets can reach dhcp6_findoption and the option index.
+ */
+#include "config.h"
+
+#ifdef DHCP6
+#include "dhcp6.c"
+#include "fuzz.h"
+
+static void
+fuzz_dhcp6_find(const struct dhcp6_optindex *idx,
+    const struct dhcp6_optent *parent, uint8_t *d, size_t l, uint16_t code)
+{
+	uint8_t *o, *io;
+	uint16_t ol, iol;
+
+	/* A truncated option only hides those after it, so the errors
+	 * differ but not what is found. */
+	o = dhcp6_findoption(d, l, code, &ol);
+	io = dhcp6_optfind(idx, parent, code, &iol);
+	if (o != io)
+		fuzz_fail("option %u: found at %td, indexed at %td", code,
+		    o == NULL ? -1 : o - d, io == NULL ? -1 : io - d);
+	if (o != NULL && ol != iol)
+		fuzz_fail("option %u: %u bytes, indexed as %u", code, ol, iol);
+}
+
+/* Compares every code under parent, then the options nested in it. */
+static void
+fuzz_dhcp6_cmp(const struct dhcp6_optindex *idx,
+    const struct dhcp6_optent *parent, uint8_t *d, size_t l,
+    unsigned int depth)
+{
+	const struct dhcp6_optent *oe;
+	unsigned int code;
+	size_t hl;
+
+	for (code = 1; code <= UINT8_MAX; code++)
+		fuzz_dhcp6_find(idx, parent, d, l, (uint16_t)code);
+
+	for (oe = dhcp6_optnext(idx, parent, NULL, 0);
+	    oe != NULL;
+	    oe = dhcp6_optnext(idx, parent, oe, 0))
+	{
+		if (oe->code > UINT8_MAX)
+			fuzz_dhcp6_find(idx, parent, d, l, oe->code);
+		hl = dhcp6_optnested(oe->code, depth);
+		if (hl != 0 && oe->len >= hl)
+			fuzz_dhcp6_cmp(idx, oe, oe->data + hl, oe->len - hl,
+			    depth + 1);
+	}
+}
+
+/*
+ * The input is a DHCPv6 message.
+ * Every option and those nested in IAs are looked up by walking the
+ * message with dhcp6_findoption and again from the index replies are
+ * read with, which must agree.
+ */
+void
+fuzz_dhcp6(uint8_t *data, size_t len)
+{
+	struct dhcp6_optindex idx;
+	struct dhcp6_message *m = (struct dhcp6_message *)data;
+
+	if (dhcp6_optindex_init(&idx, m, len) == -1)
+		return;
+	fuzz_dhcp6_cmp(&idx, NULL, data + sizeof(*m), len - sizeof(*m), 0);
+	dhcp6_optindex_free(&idx);
+}
+#endif
@@ -0,0 +1,72 @@
+/*
+ * dhcpcd option parser fuzzing harness
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * ipv6nd.c is built into the harness here instead of being linked
+ * so the targets can reach ipv6nd_handlera.
+ */
+#include "config.h"
+
+#ifdef INET6
+#include "ipv6nd.c"
+#endif
+#include "fuzz.h"
+
+/* RAs are only taken once the interface has a link-local address. */
+bool
+fuzz_ra_ready(void)
+{
+
+#ifdef INET6
+	struct interface *ifp = fuzz_ifp;
+
+	return ifp != NULL && RS_STATE(ifp) != NULL &&
+	    ipv6_linklocal(ifp) != NULL;
+#else
+	return true;
+#endif
+}
+
+#ifdef INET6
+/*
+ * The input is an RA from the ICMPv6 header on, as a socket reads it.
+ * Each one is from the same router to an interface which has not heard
+ * from it before, so every RA is parsed in full.
+ */
+void
+fuzz_ra(uint8_t *data, size_t len)
+{
+	static const struct sockaddr_in6 from = {
+		.sin6_family = AF_INET6,
+		.sin6_addr.s6_addr = { 0xfe, 0x80, [15] = 0x01 },
+	};
+
+	ipv6nd_handlera(fuzz_ctx, &from, "fe80::1", fuzz_ifp,
+	    (struct icmp6_hdr *)data, len, 255);
+	ipv6nd_drop(fuzz_ifp);
+}
+#endif
@@ -0,0 +1,941 @@
+/*
+ * dhcpcd option parser fuzzing harness
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "dhcp.h"
+#include "dhcp6.h"
+#include "eloop.h"
+#include "if.h"
+#include "if-options.h"
+#include "logerr.h"
+#include "route.h"
+#include "replay.h"
+#include "fuzz.h"
+
+#ifndef __unused
+#define __unused		__attribute__((__unused__))
+#endif
+
+struct dhcpcd_ctx *fuzz_ctx;
+struct interface *fuzz_ifp;
+FILE *fuzz_fp;
+
+void
+fuzz_fail(const char *fmt, ...)
+{
+	va_list va;
+
+	va_start(va, fmt);
+	vwarnx(fmt, va);
+	va_end(va);
+	abort();
+}
+
+#if defined(PRIVSEP) && defined(__linux__)
+/* Latencies in nanoseconds or rates, sorted when reported. */
+struct samples {
+	unsigned long long *v;
+	size_t n;
+	size_t len;
+};
+
+enum format { FMT_TEXT, FMT_CSV };
+
+struct input {
+	char *name;
+	uint8_t *data;
+	size_t len;
+};
+
+struct corpus {
+	struct input *inputs;
+	size_t ninputs;
+	size_t len;
+	size_t bytes;
+};
+
+/* A seed is written into a buffer of FUZZ_SEEDLEN octets. */
+#define	FUZZ_SEEDLEN		1500
+
+struct target {
+	const char *name;
+	void (*run)(uint8_t *, size_t);
+	size_t (*seed)(uint8_t *, unsigned int);
+};
+
+static enum format format = FMT_TEXT;
+
+static unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return (unsigned long long)ts.tv_sec * NSEC_PER_SEC +
+	    (unsigned long long)ts.tv_nsec;
+}
+
+static void
+sample_add(struct samples *s, unsigned long long v)
+{
+
+	if (s->n == s->len) {
+		size_t len = s->len == 0 ? 1024 : s->len * 2;
+		unsigned long long *nv;
+
+		nv = realloc(s->v, len * sizeof(*nv));
+		if (nv == NULL)
+			err(EXIT_FAILURE, "realloc");
+		s->v = nv;
+		s->len = len;
+	}
+	s->v[s->n++] = v;
+}
+
+static int
+sample_cmp(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Nearest rank */
+static unsigned long long
+sample_pct(const struct samples *s, unsigned int pct)
+{
+	size_t i;
+
+	i = (s->n * pct + 99) / 100;
+	return s->v[i == 0 ? 0 : i - 1];
+}
+
+static void
+report(const char *target, const char *what, const char *unit,
+    struct samples *s)
+{
+	unsigned long long min, p50, p90, p99, max;
+
+	if (s->n == 0)
+		return;
+	qsort(s->v, s->n, sizeof(*s->v), sample_cmp);
+	min = s->v[0];
+	p50 = sample_pct(s, 50);
+	p90 = sample_pct(s, 90);
+	p99 = sample_pct(s, 99);
+	max = s->v[s->n - 1];
+
+	switch (format) {
+	case FMT_CSV:
+		printf("%s,%s,%s,%zu,%llu,%llu,%llu,%llu,%llu\n",
+		    target, what, unit, s->n, min, p50, p90, p99, max);
+		break;
+	default:
+		printf("%s %s: count %zu, min %llu, p50 %llu, p90 %llu, "
+		    "p99 %llu, max %llu %s\n",
+		    target, what, s->n, min, p50, p90, p99, max, unit);
+		break;
+	}
+	s->n = 0;
+}
+
+#ifdef INET6
+static void
+put16(uint8_t *p, uint16_t v)
+{
+
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)v;
+}
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+
+	put16(p, (uint16_t)(v >> 16));
+	put16(p + 2, (uint16_t)v);
+}
+#endif
+
+/* Copies one of the seeds given as arrays. */
+static size_t
+seed_copy(uint8_t *buf, const uint8_t *data, size_t len)
+{
+
+	memcpy(buf, data, len);
+	return len;
+}
+#define	SEED(seed)	seed_copy(buf, (seed), sizeof(seed))
+
+/*
+ * The built in seeds are both well formed messages and the edge cases
+ * the parsers have to reject, so the benchmark covers both.
+ */
+#ifdef INET
+static size_t
+gen_opt(uint8_t *p, uint8_t code, const void *data, size_t len)
+{
+
+	p[0] = code;
+	p[1] = (uint8_t)len;
+	memcpy(p + 2, data, len);
+	return len + 2;
+}
+
+static const uint8_t rfc3442_default[] = { 0, 192, 0, 2, 1 };
+static const uint8_t rfc3442_routes[] = {
+	24, 10, 1, 2, 192, 0, 2, 1,
+	32, 10, 9, 9, 9, 10, 9, 9, 9,
+	0, 192, 0, 2, 1,
+};
+static const uint8_t rfc3442_truncated[] = { 24, 10, 1, 2, 192, 0 };
+static const uint8_t rfc3442_badcidr[] = { 33, 10, 1, 2, 3, 4, 192, 0, 2, 1 };
+/* example.com and example.net, the second as a pointer. */
+static const uint8_t rfc1035_search[] = {
+	7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0,
+	7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'n', 'e', 't', 0,
+	3, 'l', 'a', 'b', 0xc0, 0x00,
+};
+
+/*
+ * 0: an ACK for a typical lease
+ * 1: the same with the routes split in two and more options overloaded
+ *    into the file and sname fields
+ * 2: an option running past the end
+ * 3: BOOTP without the magic cookie
+ */
+static size_t
+seed_dhcp(uint8_t *buf, unsigned int i)
+{
+	struct bootp *bootp = (struct bootp *)buf;
+	static const uint8_t cookie[] = { 0x63, 0x82, 0x53, 0x63 };
+	static const uint8_t server[] = { 192, 0, 2, 1 };
+	static const uint8_t mask[] = { 255, 255, 255, 0 };
+	static const uint8_t dns[] = { 192, 0, 2, 53, 192, 0, 2, 54 };
+	static const uint8_t lease[] = { 0, 0, 0x0e, 0x10 };
+	static const uint8_t ack = DHCP_ACK, overload = 3;
+	uint8_t *p;
+
+	if (i > 3)
+		return 0;
+	memset(buf, 0, sizeof(*bootp));
+	bootp->op = BOOTREPLY;
+	bootp->htype = 1;
+	bootp->hlen = 6;
+	memcpy(&bootp->xid, "fuzz", sizeof(bootp->xid));
+	memcpy(&bootp->yiaddr, (const uint8_t[]){ 192, 0, 2, 100 },
+	    sizeof(bootp->yiaddr));
+	memcpy(bootp->chaddr, replay_link.hwaddr, sizeof(replay_link.hwaddr));
+	p = bootp->vend;
+	if (i != 3) {
+		memcpy(p, cookie, sizeof(cookie));
+		p += sizeof(cookie);
+	}
+	p += gen_opt(p, DHO_MESSAGETYPE, &ack, sizeof(ack));
+	p += gen_opt(p, DHO_SERVERID, server, sizeof(server));
+	p += gen_opt(p, DHO_LEASETIME, lease, sizeof(lease));
+	p += gen_opt(p, DHO_SUBNETMASK, mask, sizeof(mask));
+	p += gen_opt(p, DHO_ROUTER, server, sizeof(server));
+	p += gen_opt(p, DHO_DNSSERVER, dns, sizeof(dns));
+	if (i == 1) {
+		p += gen_opt(p, DHO_OPTSOVERLOADED, &overload,
+		    sizeof(overload));
+		p += gen_opt(p, DHO_CSR, rfc3442_routes, 8);
+		p += gen_opt(p, DHO_CSR, rfc3442_routes + 8,
+		    sizeof(rfc3442_routes) - 8);
+		bootp->file[gen_opt(bootp->file, DHO_HOSTNAME,
+		    "fuzz", 4)] = DHO_END;
+		bootp->sname[gen_opt(bootp->sname, DHO_DNSDOMAIN,
+		    "example.com", 11)] = DHO_END;
+	} else {
+		p += gen_opt(p, DHO_CSR, rfc3442_routes,
+		    sizeof(rfc3442_routes));
+		p += gen_opt(p, DHO_DNSSEARCH, rfc1035_search,
+		    sizeof(rfc1035_search));
+	}
+	if (i == 2) {
+		p += gen_opt(p, DHO_DNSDOMAIN, "example.com", 11);
+		return (size_t)(p - buf) - 4;
+	}
+	*p++ = DHO_END;
+	return (size_t)(p - buf);
+}
+
+static size_t
+seed_rfc3442(uint8_t *buf, unsigned int i)
+{
+
+	switch (i) {
+	case 0:
+		return SEED(rfc3442_default);
+	case 1:
+		return SEED(rfc3442_routes);
+	case 2:
+		return SEED(rfc3442_truncated);
+	case 3:
+		return SEED(rfc3442_badcidr);
+	}
+	return 0;
+}
+#endif
+
+#ifdef DHCP6
+static size_t
+gen_opt6(uint8_t *p, uint16_t code, const void *data, size_t len)
+{
+
+	put16(p, code);
+	put16(p + 2, (uint16_t)len);
+	if (data != NULL)
+		memcpy(p + 4, data, len);
+	return len + 4;
+}
+
+/*
+ * 0: a REPLY with an address, a delegated prefix and DNS
+ * 1: the same with a truncated address nested in the IA_NA
+ *    and a truncated option at the end
+ */
+static size_t
+seed_dhcp6(uint8_t *buf, unsigned int i)
+{
+	static const uint8_t duid[] = { 0, 3, 0, 1, 2, 0, 0x5e, 0x10, 0, 2 };
+	static const uint8_t addr[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+	static const uint8_t status[] = { 0, 0, 'o', 'k' };
+	static const uint8_t domain[] = {
+		7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0,
+	};
+	uint8_t *p = buf, *ia, *iaa;
+
+	if (i > 1)
+		return 0;
+	*p++ = DHCP6_REPLY;
+	memcpy(p, "fzz", 3);
+	p += 3;
+	p += gen_opt6(p, D6_OPTION_CLIENTID, duid, sizeof(duid));
+	p += gen_opt6(p, D6_OPTION_SERVERID, duid, sizeof(duid));
+
+	/* IA_NA with an address, which has a status of its own */
+	ia = p;
+	p += 4;
+	memcpy(p, "fz00", 4);
+	put32(p + 4, 1800);
+	put32(p + 8, 2880);
+	p += 12;
+	iaa = p;
+	p += 4;
+	memcpy(p, addr, sizeof(addr));
+	put32(p + 16, 3600);
+	put32(p + 20, 7200);
+	p += 24;
+	p += gen_opt6(p, D6_OPTION_STATUS_CODE, status, sizeof(status));
+	gen_opt6(iaa, D6_OPTION_IA_ADDR, NULL, (size_t)(p - iaa) - 4);
+	if (i == 1) {
+		/* Claims more than the IA_NA holds. */
+		p += gen_opt6(p, D6_OPTION_IA_ADDR, addr, sizeof(addr));
+		put16(p - sizeof(addr) - 2, 40);
+	}
+	gen_opt6(ia, D6_OPTION_IA_NA, NULL, (size_t)(p - ia) - 4);
+
+	/* IA_PD with a prefix */
+	ia = p;
+	p += 4;
+	memcpy(p, "fz01", 4);
+	put32(p + 4, 1800);
+	put32(p + 8, 2880);
+	p += 12;
+	iaa = p;
+	p += 4;
+	put32(p, 3600);
+	put32(p + 4, 7200);
+	p[8] = 56;
+	memcpy(p + 9, addr, sizeof(addr));
+	p += 25;
+	gen_opt6(iaa, D6_OPTION_IAPREFIX, NULL, (size_t)(p - iaa) - 4);
+	gen_opt6(ia, D6_OPTION_IA_PD, NULL, (size_t)(p - ia) - 4);
+
+	p += gen_opt6(p, D6_OPTION_DNS_SERVERS, addr, sizeof(addr));
+	p += gen_opt6(p, D6_OPTION_DOMAIN_LIST, domain, sizeof(domain));
+	p += gen_opt6(p, D6_OPTION_STATUS_CODE, status, sizeof(status));
+	if (i == 1) {
+		p += gen_opt6(p, D6_OPTION_DNS_SERVERS, addr, sizeof(addr));
+		p -= 4;
+	}
+	return (size_t)(p - buf);
+}
+#endif
+
+#ifdef INET6
+/*
+ * 0: an RA with the usual options
+ * 1: two prefixes, a route and a DNS search list
+ * 2: a zero length option which makes the RA invalid
+ * 3: an option running past the end
+ */
+static size_t
+seed_ra(uint8_t *buf, unsigned int i)
+{
+	static const uint8_t prefix[16] = { 0x20, 0x01, 0x0d, 0xb8, 0, 1 };
+	static const uint8_t search[] = {
+		7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0,
+	};
+	uint8_t *p = buf;
+
+	if (i > 3)
+		return 0;
+	memset(buf, 0, FUZZ_SEEDLEN);
+	p[0] = ND_ROUTER_ADVERT;
+	p[4] = 64;				/* cur hop limit */
+	put16(p + 6, 1800);			/* router lifetime */
+	p += 16;
+
+	p[0] = ND_OPT_SOURCE_LINKADDR;
+	p[1] = 1;
+	memcpy(p + 2, (const uint8_t[]){ 2, 0, 0x5e, 0x10, 0, 2 }, 6);
+	p += 8;
+
+	p[0] = ND_OPT_MTU;
+	p[1] = 1;
+	put32(p + 4, 1500);
+	p += 8;
+
+	p[0] = ND_OPT_PREFIX_INFORMATION;
+	p[1] = 4;
+	p[2] = 64;
+	p[3] = ND_OPT_PI_FLAG_ONLINK | ND_OPT_PI_FLAG_AUTO;
+	put32(p + 4, 86400);
+	put32(p + 8, 14400);
+	memcpy(p + 16, prefix, sizeof(prefix));
+	p += 32;
+
+	/* RDNSS */
+	p[0] = 25;
+	p[1] = 3;
+	put32(p + 4, 1800);
+	memcpy(p + 8, prefix, sizeof(prefix));
+	p[23] = 1;
+	p += 24;
+
+	switch (i) {
+	case 1:
+		memcpy(p, p - 56, 32);
+		p[21] = 2;
+		p += 32;
+		/* Route information */
+		p[0] = 24;
+		p[1] = 3;
+		p[2] = 48;
+		put32(p + 4, 1800);
+		memcpy(p + 8, prefix, sizeof(prefix));
+		p[13] = 9;
+		p += 24;
+		/* DNSSL */
+		p[0] = 31;
+		p[1] = 3;
+		put32(p + 4, 1800);
+		memcpy(p + 8, search, sizeof(search));
+		p += 24;
+		break;
+	case 2:
+		p[0] = ND_OPT_MTU;
+		p += 8;
+		break;
+	case 3:
+		p[0] = ND_OPT_PREFIX_INFORMATION;
+		p[1] = 4;
+		p += 16;
+		break;
+	}
+	return (size_t)(p - buf);
+}
+#endif
+
+/*
+ * The definition comes first, see fuzz_print.
+ * 0: DHCP domain name servers
+ * 1: DHCP domain search
+ * 2: DHCP classless static routes
+ * 3: DHCP vendor class, which is nested
+ * 4: DHCPv6 DNS servers
+ * 5: a domain with a bad label
+ */
+static const uint8_t print_dns[] = { 0, 0, 6, 192, 0, 2, 53, 192, 0, 2, 54 };
+static const uint8_t print_vivco[] = {
+	0, 0, 124, 0, 0, 0x01, 0x37, 6, 5, 'f', 'u', 'z', 'z', '!',
+};
+static const uint8_t print_dns6[] = {
+	1, 0, 23, 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 1,
+};
+static const uint8_t print_badlabel[] = {
+	0, 0, 119, 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0xc0, 0x20,
+};
+
+static size_t
+seed_print(uint8_t *buf, unsigned int i)
+{
+
+	switch (i) {
+	case 0:
+		return SEED(print_dns);
+	case 1:
+	case 2:
+#ifdef INET
+		buf[0] = 0;
+		buf[1] = 0;
+		if (i == 1) {
+			buf[2] = DHO_DNSSEARCH;
+			memcpy(buf + 3, rfc1035_search, sizeof(rfc1035_search));
+			return 3 + sizeof(rfc1035_search);
+		}
+		buf[2] = DHO_CSR;
+		memcpy(buf + 3, rfc3442_routes, sizeof(rfc3442_routes));
+		return 3 + sizeof(rfc3442_routes);
+#else
+		return SEED(print_dns);
+#endif
+	case 3:
+		return SEED(print_vivco);
+	case 4:
+		return SEED(print_dns6);
+	case 5:
+		return SEED(print_badlabel);
+	}
+	return 0;
+}
+
+static const struct target targets[] = {
+#ifdef INET
+	{ "dhcp",	fuzz_dhcp,	seed_dhcp },
+	{ "rfc3442",	fuzz_rfc3442,	seed_rfc3442 },
+#endif
+#ifdef DHCP6
+	{ "dhcp6",	fuzz_dhcp6,	seed_dhcp6 },
+#endif
+#ifdef INET6
+	{ "ra",		fuzz_ra,	seed_ra },
+#endif
+	{ "print",	fuzz_print,	seed_print },
+};
+
+static const struct target *
+target_find(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < __arraycount(targets); i++) {
+		if (strcmp(targets[i].name, name) == 0)
+			return &targets[i];
+	}
+	return NULL;
+}
+
+/* Each run gets a copy just the size of the input so overreads show. */
+static unsigned long long
+target_run(const struct target *t, const uint8_t *data, size_t len)
+{
+	uint8_t *buf;
+	unsigned long long start, end;
+
+	if ((buf = malloc(len == 0 ? 1 : len)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memcpy(buf, data, len);
+	start = now_ns();
+	t->run(buf, len);
+	end = now_ns();
+	free(buf);
+	return end - start;
+}
+
+static void
+corpus_add(struct corpus *c, const char *name, const uint8_t *data,
+    size_t len)
+{
+	struct input *in;
+
+	if (c->ninputs == c->len) {
+		size_t nlen = c->len == 0 ? 64 : c->len * 2;
+
+		in = reallocarray(c->inputs, nlen, sizeof(*in));
+		if (in == NULL)
+			err(EXIT_FAILURE, "realloc");
+		c->inputs = in;
+		c->len = nlen;
+	}
+	in = &c->inputs[c->ninputs++];
+	if ((in->name = strdup(name)) == NULL ||
+	    (in->data = malloc(len == 0 ? 1 : len)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memcpy(in->data, data, len);
+	in->len = len;
+	c->bytes += len;
+}
+
+static void
+corpus_seed(struct corpus *c, const struct target *t)
+{
+	uint8_t buf[FUZZ_SEEDLEN];
+	char name[32];
+	unsigned int i;
+	size_t len;
+
+	for (i = 0; (len = t->seed(buf, i)) != 0; i++) {
+		snprintf(name, sizeof(name), "seed-%u", i);
+		corpus_add(c, name, buf, len);
+	}
+}
+
+static void
+corpus_readfile(struct corpus *c, const char *file)
+{
+	uint8_t *buf;
+	ssize_t len;
+
+	/* Larger inputs are no use to any of the parsers. */
+	if ((buf = malloc(UINT16_MAX)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	len = readfile(file, buf, UINT16_MAX);
+	if (len == -1)
+		err(EXIT_FAILURE, "%s", file);
+	corpus_add(c, file, buf, (size_t)len);
+	free(buf);
+}
+
+/* A directory is read as a libFuzzer or AFL corpus. */
+static void
+corpus_read(struct corpus *c, const char *path)
+{
+	DIR *dp;
+	struct dirent *d;
+	struct stat st;
+	char file[PATH_MAX];
+
+	if (stat(path, &st) == -1)
+		err(EXIT_FAILURE, "%s", path);
+	if (!S_ISDIR(st.st_mode)) {
+		corpus_readfile(c, path);
+		return;
+	}
+	if ((dp = opendir(path)) == NULL)
+		err(EXIT_FAILURE, "%s", path);
+	while ((d = readdir(dp)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		snprintf(file, sizeof(file), "%s/%s", path, d->d_name);
+		if (stat(file, &st) == -1)
+			err(EXIT_FAILURE, "%s", file);
+		if (S_ISREG(st.st_mode))
+			corpus_readfile(c, file);
+	}
+	closedir(dp);
+}
+
+static void
+corpus_free(struct corpus *c)
+{
+	size_t i;
+
+	for (i = 0; i < c->ninputs; i++) {
+		free(c->inputs[i].name);
+		free(c->inputs[i].data);
+	}
+	free(c->inputs);
+	memset(c, 0, sizeof(*c));
+}
+
+/* Writes the seeds out as dir/target/seed-N to start fuzzing from. */
+static void
+corpus_write(const char *dir)
+{
+	struct corpus c = { .inputs = NULL };
+	char path[PATH_MAX];
+	size_t i, j;
+	int fd;
+
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+		err(EXIT_FAILURE, "%s", dir);
+	for (i = 0; i < __arraycount(targets); i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, targets[i].name);
+		if (mkdir(path, 0755) == -1 && errno != EEXIST)
+			err(EXIT_FAILURE, "%s", path);
+		corpus_seed(&c, &targets[i]);
+		for (j = 0; j < c.ninputs; j++) {
+			snprintf(path, sizeof(path), "%s/%s/%s", dir,
+			    targets[i].name, c.inputs[j].name);
+			fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd == -1 ||
+			    write(fd, c.inputs[j].data, c.inputs[j].len) !=
+			    (ssize_t)c.inputs[j].len)
+				err(EXIT_FAILURE, "%s", path);
+			close(fd);
+		}
+		corpus_free(&c);
+	}
+}
+
+/* Runs the corpus nruns times, timing each input and each run. */
+static void
+bench(const struct target *t, const struct corpus *c, size_t nruns)
+{
+	struct samples lat = { .v = NULL }, rate = { .v = NULL };
+	unsigned long long ns, busy;
+	size_t i, j;
+
+	for (i = 0; i < nruns; i++) {
+		busy = 0;
+		for (j = 0; j < c->ninputs; j++) {
+			ns = target_run(t, c->inputs[j].data, c->inputs[j].len);
+			sample_add(&lat, ns);
+			busy += ns;
+		}
+		if (busy != 0)
+			sample_add(&rate, c->bytes * NSEC_PER_SEC / busy);
+	}
+
+	if (format == FMT_TEXT)
+		printf("%s: %zu inputs, %zu bytes, %zu runs\n",
+		    t->name, c->ninputs, c->bytes, nruns);
+	report(t->name, "input", "ns", &lat);
+	report(t->name, "rate", "bytes/s", &rate);
+	free(lat.v);
+	free(rate.v);
+}
+
+/* Options applied to the interface RAs arrive on. */
+static char arg0[] = "fuzz", arg1[] = "--nodelay";
+#ifdef INET6
+static char arg2[] = "--ipv6only", arg3[] = "--nodhcp6";
+#endif
+static char *fuzz_argv[] = {
+	arg0, arg1,
+#ifdef INET6
+	arg2, arg3,
+#endif
+	NULL
+};
+
+static void
+fuzz_wait(void *arg)
+{
+	static unsigned int tries;
+	struct dhcpcd_ctx *ctx = arg;
+
+	fuzz_ifp = if_find(ctx->ifaces, replay_link.name);
+	if (fuzz_ra_ready() || ++tries == 100)
+		eloop_exit(ctx->eloop, EXIT_SUCCESS);
+	else
+		eloop_timeout_add_msec(ctx->eloop, 10, fuzz_wait, ctx);
+}
+
+/*
+ * dhcpcd runs as a privsep manager with no processes behind it as it
+ * does for replay, with one interface up to take RAs.
+ */
+static void
+fuzz_setup(struct dhcpcd_ctx *ctx, bool debug)
+{
+	struct if_options *ifo;
+
+	/* Rejecting input is what the parsers are for, so it is quiet. */
+	logsetopts(debug ? LOGERR_ERR | LOGERR_DEBUG : 0);
+
+	dhcpcd_initctx(ctx);
+	ctx->options |= DHCPCD_PRIVSEP;
+	ctx->cffile = "/dev/null";
+	ctx->argv = fuzz_argv;
+	ctx->argc = __arraycount(fuzz_argv) - 1;
+
+	rt_init(ctx);
+	if ((ifo = read_config(ctx, NULL, NULL, NULL)) == NULL)
+		errx(EXIT_FAILURE, "failed to read the definitions");
+	if (add_options(ctx, NULL, ifo, ctx->argc, ctx->argv) != 1)
+		errx(EXIT_FAILURE, "failed to add options");
+	ctx->options |= ifo->options;
+	ctx->options &= ~DHCPCD_DAEMONISE;
+	if (debug)
+		ctx->options |= DHCPCD_DEBUG;
+	free_options(ctx, ifo);
+
+	if ((ctx->eloop = eloop_new()) == NULL)
+		err(EXIT_FAILURE, "eloop_new");
+	if ((ctx->ifaces = malloc(sizeof(*ctx->ifaces))) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	TAILQ_INIT(ctx->ifaces);
+	if ((fuzz_fp = fopen("/dev/null", "w")) == NULL)
+		err(EXIT_FAILURE, "/dev/null");
+
+	if (dhcpcd_handleinterface(ctx, 1, replay_link.name) == -1)
+		err(EXIT_FAILURE, "%s", replay_link.name);
+	eloop_enter(ctx->eloop);
+	eloop_timeout_add_sec(ctx->eloop, 0, fuzz_wait, ctx);
+	if (eloop_start(ctx->eloop, NULL) == -1)
+		err(EXIT_FAILURE, "eloop_start");
+	if (fuzz_ifp == NULL || !fuzz_ra_ready())
+		errx(EXIT_FAILURE, "%s: not ready for RAs", replay_link.name);
+	fuzz_ctx = ctx;
+}
+
+#ifdef LIBFUZZER
+static const struct target *fuzz_target;
+
+int LLVMFuzzerInitialize(int *, char ***);
+int LLVMFuzzerTestOneInput(const uint8_t *, size_t);
+
+/* libFuzzer has no arguments of ours, so the target is taken from
+ * the environment instead of -t. */
+int
+LLVMFuzzerInitialize(__unused int *argc, __unused char ***argv)
+{
+	static struct dhcpcd_ctx ctx;
+	const char *name;
+
+	if ((name = getenv("FUZZ_TARGET")) == NULL)
+		errx(EXIT_FAILURE, "FUZZ_TARGET is not set");
+	if ((fuzz_target = target_find(name)) == NULL)
+		errx(EXIT_FAILURE, "unknown target `%s'", name);
+	fuzz_setup(&ctx, getenv("FUZZ_DEBUG") != NULL);
+	return 0;
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t len)
+{
+
+	target_run(fuzz_target, data, len);
+	return 0;
+}
+#else
+int
+main(int argc, char **argv)
+{
+	struct dhcpcd_ctx ctx;
+	struct corpus c = { .inputs = NULL };
+	const struct target *t, *target = NULL;
+	const char *wdir = NULL;
+	bool debug = false;
+	size_t i, k, nruns = 0;
+	int ch, first, j;
+
+	while ((ch = getopt(argc, argv, "do:r:t:w:")) != -1) {
+		switch (ch) {
+		case 'd':
+			debug = true;
+			break;
+		case 'o':
+			if (strcmp(optarg, "text") == 0)
+				format = FMT_TEXT;
+			else if (strcmp(optarg, "csv") == 0)
+				format = FMT_CSV;
+			else
+				errx(EXIT_FAILURE, "unknown format `%s'",
+				    optarg);
+			break;
+		case 'r':
+			nruns = (size_t)atoi(optarg);
+			break;
+		case 't':
+			if ((target = target_find(optarg)) == NULL)
+				errx(EXIT_FAILURE, "unknown target `%s'",
+				    optarg);
+			break;
+		case 'w':
+			wdir = optarg;
+			break;
+		default:
+			errx(EXIT_FAILURE, "illegal argument `%c'", ch);
+		}
+	}
+
+	if (wdir != NULL) {
+		corpus_write(wdir);
+		exit(EXIT_SUCCESS);
+	}
+	if (optind < argc && target == NULL)
+		errx(EXIT_FAILURE, "a corpus needs a target");
+
+	/* add_options uses getopt as well. */
+	first = optind;
+	fuzz_setup(&ctx, debug);
+
+	if (format == FMT_CSV && nruns != 0)
+		printf("target,metric,unit,count,min,p50,p90,p99,max\n");
+
+	/* Without a corpus, each target runs its seeds. */
+	for (i = 0; i < __arraycount(targets); i++) {
+		t = &targets[i];
+		if (target != NULL && t != target)
+			continue;
+		if (first == argc)
+			corpus_seed(&c, t);
+		for (j = first; j < argc; j++)
+			corpus_read(&c, argv[j]);
+		if (nruns == 0) {
+			for (k = 0; k < c.ninputs; k++)
+				target_run(t, c.inputs[k].data,
+				    c.inputs[k].len);
+			if (format == FMT_TEXT)
+				printf("%s: %zu inputs\n", t->name,
+				    c.ninputs);
+		} else
+			bench(t, &c, nruns);
+		corpus_free(&c);
+	}
+	exit(EXIT_SUCCESS);
+}
+#endif
+#else
+int
+main(void)
+{
+
+	printf("fuzz needs privsep on Linux\n");
+	exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,58 @@
+/*
+ * dhcpcd option parser fuzzing harness
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Each target is given a private copy of the input, suitably aligned,
+ * as dhcpcd is allowed to write to what it reads.
+ * A target which finds dhcpcd disagreeing with itself calls fuzz_fail.
+ */
+struct dhcpcd_ctx;
+struct interface;
+
+extern struct dhcpcd_ctx *fuzz_ctx;
+extern struct interface *fuzz_ifp;	/* the interface RAs arrive on */
+extern FILE *fuzz_fp;			/* where options are printed to */
+
+void fuzz_fail(const char *, ...) __attribute__((__format__(printf, 1, 2)))
+    __attribute__((__noreturn__));
+
+void fuzz_dhcp(uint8_t *, size_t);
+void fuzz_rfc3442(uint8_t *, size_t);
+void fuzz_dhcp6(uint8_t *, size_t);
+bool fuzz_ra_ready(void);
+void fuzz_ra(uint8_t *, size_t);
+void fuzz_print(uint8_t *, size_t);
+
+#endif
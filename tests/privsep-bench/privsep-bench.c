@@ -0,0 +1,701 @@
+/*
+ * privsep IPC benchmark
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <netinet/in.h>
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "if.h"
+#include "logerr.h"
+#include "privsep.h"
+#ifdef INET
+#include "bpf.h"
+#endif
+
+#ifndef __unused
+#define __unused		__attribute__((__unused__))
+#endif
+
+#ifdef PRIVSEP
+/* Latencies in nanoseconds or rates, sorted when reported. */
+struct samples {
+	unsigned long long *v;
+	size_t n;
+	size_t len;
+};
+
+enum format { FMT_TEXT, FMT_CSV };
+
+struct scenario {
+	const char *name;
+	uint16_t cmd;
+	size_t size;
+	int (*run)(const struct scenario *, struct samples *,
+	    struct samples *);
+	const char *helper;
+	const char *metric;
+};
+
+/* The helper side. */
+struct helper {
+	struct dhcpcd_ctx *ctx;
+	int fd;
+	unsigned long count;
+};
+
+static struct dhcpcd_ctx ctx;
+static int fd = -1;
+static pid_t pid;
+static size_t nmsgs = 1000;
+static enum format format = FMT_TEXT;
+static const char *script = "/bin/sh";
+static uint8_t payload[1514];
+static char envbuf[2048];
+static size_t envlen;
+
+static unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return (unsigned long long)ts.tv_sec * NSEC_PER_SEC +
+	    (unsigned long long)ts.tv_nsec;
+}
+
+static void
+sample_add(struct samples *s, unsigned long long v)
+{
+
+	if (s->n == s->len) {
+		size_t len = s->len == 0 ? 1024 : s->len * 2;
+		unsigned long long *nv;
+
+		nv = realloc(s->v, len * sizeof(*nv));
+		if (nv == NULL)
+			err(EXIT_FAILURE, "realloc");
+		s->v = nv;
+		s->len = len;
+	}
+	s->v[s->n++] = v;
+}
+
+static int
+sample_cmp(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Nearest rank */
+static unsigned long long
+sample_pct(const struct samples *s, unsigned int pct)
+{
+	size_t i;
+
+	i = (s->n * pct + 99) / 100;
+	return s->v[i == 0 ? 0 : i - 1];
+}
+
+static size_t
+scenario_size(const struct scenario *sc)
+{
+
+	return sc->cmd == PS_SCRIPT ? envlen : sc->size;
+}
+
+static void
+report(const struct scenario *sc, const char *metric, const char *unit,
+    struct samples *s)
+{
+	unsigned long long min, p50, p90, p99, max;
+
+	if (s->n == 0)
+		return;
+	qsort(s->v, s->n, sizeof(*s->v), sample_cmp);
+	min = s->v[0];
+	p50 = sample_pct(s, 50);
+	p90 = sample_pct(s, 90);
+	p99 = sample_pct(s, 99);
+	max = s->v[s->n - 1];
+
+	switch (format) {
+	case FMT_CSV:
+		printf("%s,%s,%zu,%s,%s,%zu,%llu,%llu,%llu,%llu,%llu\n",
+		    sc->name, sc->helper, scenario_size(sc), metric, unit,
+		    s->n, min, p50, p90, p99, max);
+		break;
+	default:
+		printf("%s %s: count %zu, min %llu, p50 %llu, p90 %llu, "
+		    "p99 %llu, max %llu %s\n",
+		    sc->name, metric, s->n, min, p50, p90, p99, max, unit);
+		break;
+	}
+	s->n = 0;
+}
+
+/* Like script_buftoenv and ps_root_run_script. */
+static unsigned long long
+helper_script(struct msghdr *msg)
+{
+	char *buf = msg->msg_iov[0].iov_base, *bufp, *endp;
+	char *env[64], **envp = env;
+	char *argv[] = { UNCONST(script), UNCONST("-c"), UNCONST(":"), NULL };
+	unsigned long long start;
+	pid_t spid;
+	int r, status;
+
+	start = now_ns();
+	endp = buf + msg->msg_iov[0].iov_len;
+	*envp++ = buf;
+	for (bufp = buf; bufp < endp - 1; bufp++) {
+		if (*bufp == '\0' && envp < env + __arraycount(env) - 1)
+			*envp++ = bufp + 1;
+	}
+	*envp = NULL;
+
+	/* Only a shell gets the -c argument. */
+	if (strcmp(script, "/bin/sh") != 0)
+		argv[1] = NULL;
+	r = posix_spawn(&spid, script, NULL, NULL, argv, env);
+	if (r != 0) {
+		errno = r;
+		logerr("%s: posix_spawn: %s", __func__, script);
+		return 0;
+	}
+	while (waitpid(spid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			logerr("%s: waitpid", __func__);
+			break;
+		}
+	}
+	return now_ns() - start;
+}
+
+static ssize_t
+helper_dispatch(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
+{
+	struct helper *h = arg;
+	struct ps_msghdr rpsm = { .ps_cmd = psm->ps_cmd };
+	unsigned long long ns;
+	unsigned long i;
+
+	switch (psm->ps_cmd) {
+	case PS_BOOTP:
+		/* One way from the manager, acknowledge the last. */
+		if (++h->count != psm->ps_flags)
+			return 0;
+		h->count = 0;
+		return ps_sendpsmdata(h->ctx, h->fd, &rpsm, NULL, 0);
+	case PS_BPF_BOOTP:
+		/* One way to the manager, like frames read from BPF. */
+		for (i = 0; i < psm->ps_flags; i++) {
+			if (ps_sendpsmdata(h->ctx, h->fd, &rpsm,
+			    payload, sizeof(payload)) == -1)
+				return -1;
+		}
+		return 0;
+	case PS_SCRIPT:
+		ns = helper_script(msg);
+		return ps_sendpsmdata(h->ctx, h->fd, &rpsm, &ns, sizeof(ns));
+	default:
+		/* An ioctl, route or file write result. */
+		rpsm.ps_flags = msg->msg_iov[0].iov_len;
+		return ps_sendpsmdata(h->ctx, h->fd, &rpsm,
+		    &rpsm.ps_flags, sizeof(rpsm.ps_flags));
+	}
+}
+
+static void
+helper_recvmsg(void *arg, unsigned short events)
+{
+	struct helper *h = arg;
+
+	if (ps_recvpsmsg(h->ctx, h->fd, events, helper_dispatch, h) == -1)
+		logerr(__func__);
+}
+
+/* The root, inet or BPF process, which runs until the manager
+ * closes its end. */
+static void
+helper_start(void)
+{
+	int fds[2];
+	struct helper h = { .ctx = &ctx, .count = 0 };
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1)
+		err(EXIT_FAILURE, "socketpair");
+	if (ps_setbuf_fdpair(fds) == -1)
+		err(EXIT_FAILURE, "ps_setbuf_fdpair");
+
+	switch (pid = fork()) {
+	case -1:
+		err(EXIT_FAILURE, "fork");
+	case 0:
+		close(fds[0]);
+		h.fd = fds[1];
+		if ((ctx.eloop = eloop_new()) == NULL)
+			err(EXIT_FAILURE, "eloop_new");
+		if (eloop_event_add(ctx.eloop, h.fd, ELE_READ,
+		    helper_recvmsg, &h) == -1)
+			err(EXIT_FAILURE, "eloop_event_add");
+		_exit(eloop_start(ctx.eloop, NULL));
+	default:
+		close(fds[1]);
+		fd = fds[0];
+		break;
+	}
+}
+
+static int
+helper_stop(void)
+{
+	int status;
+
+	close(fd);
+	fd = -1;
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR)
+			err(EXIT_FAILURE, "waitpid");
+	}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
+
+static ssize_t
+manager_reply(void *arg, __unused struct ps_msghdr *psm, struct msghdr *msg)
+{
+	unsigned long long *ns = arg;
+
+	if (ns != NULL && msg->msg_iov[0].iov_len == sizeof(*ns))
+		memcpy(ns, msg->msg_iov[0].iov_base, sizeof(*ns));
+	return 1;
+}
+
+static int
+manager_readreply(unsigned long long *ns)
+{
+
+	if (ps_recvpsmsg(&ctx, fd, ELE_READ, manager_reply, ns) != 1) {
+		warnx("%s: no reply", __func__);
+		return -1;
+	}
+	return 0;
+}
+
+/* A command to the privileged proxy and waiting for the result,
+ * like ps_root_ioctl, ps_root_route and ps_root_writefile do. */
+static int
+run_cmd(const struct scenario *sc, struct samples *s,
+    __unused struct samples *unused)
+{
+	unsigned long long start;
+	size_t i;
+
+	for (i = 0; i < nmsgs; i++) {
+		start = now_ns();
+		if (ps_sendcmd(&ctx, fd, sc->cmd, 0, payload, sc->size) == -1)
+			err(EXIT_FAILURE, "ps_sendcmd");
+		if (manager_readreply(NULL) == -1)
+			return EXIT_FAILURE;
+		sample_add(s, now_ns() - start);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* DHCP messages to the network proxy, like ps_inet_sendbootp. */
+static int
+run_inet(const struct scenario *sc, struct samples *s,
+    __unused struct samples *unused)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(67),
+		.sin_addr.s_addr = htonl(INADDR_BROADCAST),
+	};
+	struct iovec iov[] = {
+		{ .iov_base = payload, .iov_len = sc->size },
+	};
+	struct msghdr msg = {
+		.msg_name = &sin, .msg_namelen = sizeof(sin),
+		.msg_iov = iov, .msg_iovlen = 1,
+	};
+	unsigned long long start;
+	size_t i;
+
+	start = now_ns();
+	for (i = 0; i < nmsgs; i++) {
+		if (ps_sendmsg(&ctx, fd, sc->cmd, nmsgs, &msg) == -1)
+			err(EXIT_FAILURE, "ps_sendmsg");
+	}
+	if (manager_readreply(NULL) == -1)
+		return EXIT_FAILURE;
+	sample_add(s, nmsgs * NSEC_PER_SEC / (now_ns() - start));
+	return EXIT_SUCCESS;
+}
+
+/* Frames from a BPF process, as ps_bpf_recvbpf sends them. */
+static int
+run_bpf(const struct scenario *sc, struct samples *s,
+    __unused struct samples *unused)
+{
+	unsigned long long start;
+	size_t i;
+
+	start = now_ns();
+	if (ps_sendcmd(&ctx, fd, sc->cmd, nmsgs, NULL, 0) == -1)
+		err(EXIT_FAILURE, "ps_sendcmd");
+	for (i = 0; i < nmsgs; i++) {
+		if (manager_readreply(NULL) == -1)
+			return EXIT_FAILURE;
+	}
+	sample_add(s, nmsgs * NSEC_PER_SEC / (now_ns() - start));
+	return EXIT_SUCCESS;
+}
+
+/* A script environment to the privileged proxy, which runs the
+ * script and waits for it, like ps_root_script.
+ * Spawning dominates so a tenth as many are sent. */
+static int
+run_script(__unused const struct scenario *sc, struct samples *s,
+    struct samples *spawn)
+{
+	unsigned long long start, ns;
+	size_t i, n = nmsgs / 10 == 0 ? 1 : nmsgs / 10;
+
+	for (i = 0; i < n; i++) {
+		start = now_ns();
+		if (ps_sendcmd(&ctx, fd, PS_SCRIPT, 0, envbuf, envlen) == -1)
+			err(EXIT_FAILURE, "ps_sendcmd");
+		ns = 0;
+		if (manager_readreply(&ns) == -1)
+			return EXIT_FAILURE;
+		sample_add(s, now_ns() - start);
+		sample_add(spawn, ns);
+	}
+	return EXIT_SUCCESS;
+}
+
+static const struct scenario scenarios[] = {
+	{ "ioctl",	PS_IOCTL,	40,	run_cmd,	"root",	"rtt" },
+	{ "route",	PS_ROUTE,	256,	run_cmd,	"root",	"rtt" },
+	{ "writefile",	PS_WRITEFILE,	1024,	run_cmd,	"root",	"rtt" },
+	{ "inet",	PS_BOOTP,	548,	run_inet,	"inet",	"rate" },
+	{ "bpf",	PS_BPF_BOOTP,	1514,	run_bpf,	"bpf",	"rate" },
+	{ "script",	PS_SCRIPT,	0,	run_script,	"root",	"rtt" },
+};
+
+/* The environment for a BOUND script run with a simple lease. */
+static void
+envbuf_init(void)
+{
+	static const char *env[] = {
+		"PATH=/usr/bin:/usr/sbin:/bin:/sbin",
+		"interface=eth0", "pid=1234", "reason=BOUND",
+		"protocol=dhcp", "ifcarrier=up", "ifflags=69699",
+		"ifmetric=1002", "ifmtu=1500", "ifwireless=0",
+		"interface_order=lo eth0", "if_up=true", "if_down=false",
+		"new_ip_address=192.168.1.100",
+		"new_network_number=192.168.1.0",
+		"new_subnet_cidr=24", "new_subnet_mask=255.255.255.0",
+		"new_broadcast_address=192.168.1.255",
+		"new_routers=192.168.1.1",
+		"new_domain_name_servers=192.168.1.1 192.168.1.2",
+		"new_domain_name=example.org",
+		"new_domain_search=example.org example.net",
+		"new_dhcp_lease_time=86400", "new_dhcp_renewal_time=43200",
+		"new_dhcp_rebinding_time=75600",
+		"new_dhcp_server_identifier=192.168.1.1",
+		"new_dhcp_message_type=5", "new_host_name=bench",
+		"new_ntp_servers=192.168.1.1",
+		"new_classless_static_routes=0.0.0.0/0 192.168.1.1",
+		"new_interface_mtu=1500",
+		"new_vendor_encapsulated_options=0104c0a80101",
+	};
+	size_t i, len;
+	char *p = envbuf;
+
+	for (i = 0; i < __arraycount(env); i++) {
+		len = strlen(env[i]) + 1;
+		if (len > sizeof(envbuf) - (size_t)(p - envbuf))
+			break;
+		memcpy(p, env[i], len);
+		p += len;
+	}
+	envlen = (size_t)(p - envbuf);
+}
+
+static int
+bench(const struct scenario *sc, size_t nruns)
+{
+	struct samples s = { NULL, 0, 0 }, spawn = { NULL, 0, 0 };
+	size_t i;
+	int result, exit_code;
+
+	if (format == FMT_TEXT)
+		printf("%s: %s process, %zu byte payload, runs = %zu, "
+		    "messages = %zu\n", sc->name, sc->helper,
+		    scenario_size(sc), nruns, nmsgs);
+
+	helper_start();
+	exit_code = EXIT_SUCCESS;
+	for (i = 0; i < nruns; i++) {
+		result = sc->run(sc, &s, &spawn);
+		if (result != EXIT_SUCCESS)
+			exit_code = result;
+	}
+	result = helper_stop();
+	if (result != EXIT_SUCCESS)
+		exit_code = result;
+
+	if (strcmp(sc->metric, "rate") == 0)
+		report(sc, sc->metric, "msg/s", &s);
+	else
+		report(sc, sc->metric, "ns", &s);
+	report(sc, "spawn", "ns", &spawn);
+	free(s.v);
+	free(spawn.v);
+	return exit_code;
+}
+
+int
+main(int argc, char **argv)
+{
+	int c, result, exit_code;
+	size_t i, nruns = 5;
+	const char *scenario = NULL;
+	const struct scenario *sc;
+
+	while ((c = getopt(argc, argv, "n:o:r:s:x:")) != -1) {
+		switch (c) {
+		case 'n':
+			nmsgs = (size_t)atoi(optarg);
+			break;
+		case 'o':
+			if (strcmp(optarg, "text") == 0)
+				format = FMT_TEXT;
+			else if (strcmp(optarg, "csv") == 0)
+				format = FMT_CSV;
+			else
+				errx(EXIT_FAILURE, "unknown format `%s'",
+				    optarg);
+			break;
+		case 'r':
+			nruns = (size_t)atoi(optarg);
+			break;
+		case 's':
+			scenario = optarg;
+			break;
+		case 'x':
+			script = optarg;
+			break;
+		default:
+			errx(EXIT_FAILURE, "illegal argument `%c'", c);
+		}
+	}
+
+	if (nmsgs == 0)
+		errx(EXIT_FAILURE, "need at least one message");
+	if (scenario != NULL) {
+		for (i = 0; i < __arraycount(scenarios); i++) {
+			if (strcmp(scenarios[i].name, scenario) == 0)
+				break;
+		}
+		if (i == __arraycount(scenarios))
+			errx(EXIT_FAILURE, "unknown scenario `%s'", scenario);
+	}
+
+	/* The helpers stop when the manager closes its end. */
+	signal(SIGPIPE, SIG_IGN);
+	ps_initprocesses(&ctx);
+	memset(payload, 0xaa, sizeof(payload));
+	envbuf_init();
+
+	if (format == FMT_CSV)
+		printf("scenario,process,size,metric,unit,"
+		    "count,min,p50,p90,p99,max\n");
+
+	exit_code = EXIT_SUCCESS;
+	for (i = 0, sc = scenarios; i < __arraycount(scenarios); i++, sc++) {
+		if (scenario != NULL && strcmp(sc->name, scenario) != 0)
+			continue;
+		result = bench(sc, nruns);
+		if (result != EXIT_SUCCESS)
+			exit_code = result;
+	}
+	exit(exit_code);
+}
+
+/*
+ * privsep.c calls into the rest of dhcpcd to start and stop the
+ * real processes. None of that is used here.
+ */
+const int dhcpcd_signals[] = { SIGTERM };
+const size_t dhcpcd_signals_len = __arraycount(dhcpcd_signals);
+
+void
+dhcpcd_signal_cb(__unused int sig, __unused void *arg)
+{
+}
+
+int
+xsocketpair(int domain, int type, int protocol, int fds[2])
+{
+
+	return socketpair(domain, type & ~SOCK_NONBLOCK, protocol, fds);
+}
+
+pid_t
+ps_root_start(__unused struct dhcpcd_ctx *c)
+{
+
+	errno = ENOSYS;
+	return -1;
+}
+
+void
+ps_root_initcache(__unused struct dhcpcd_ctx *c)
+{
+}
+
+void
+ps_root_freecache(__unused struct dhcpcd_ctx *c)
+{
+}
+
+int
+ps_root_batch_flush(__unused struct dhcpcd_ctx *c)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_root_stopprocesses(__unused struct dhcpcd_ctx *c)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_root_unlink(__unused struct dhcpcd_ctx *c, __unused const char *path)
+{
+
+	errno = ENOSYS;
+	return -1;
+}
+
+pid_t
+ps_ctl_start(__unused struct dhcpcd_ctx *c)
+{
+
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+ps_ctl_stop(__unused struct dhcpcd_ctx *c)
+{
+
+	return 0;
+}
+
+bool
+ps_inet_canstart(__unused const struct dhcpcd_ctx *c)
+{
+
+	return false;
+}
+
+pid_t
+ps_inet_start(__unused struct dhcpcd_ctx *c)
+{
+
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+ps_inet_stop(__unused struct dhcpcd_ctx *c)
+{
+
+	return 0;
+}
+
+#ifdef INET
+void
+ps_bpf_initshared(__unused struct dhcpcd_ctx *c)
+{
+}
+
+void
+ps_bpf_freeshared(__unused struct dhcpcd_ctx *c)
+{
+}
+
+void
+bpf_close(__unused struct bpf *bpf)
+{
+}
+#endif
+
+#ifdef HAVE_SECCOMP
+int
+ps_seccomp_enter(void)
+{
+
+	return 0;
+}
+#endif
+
+#else
+int
+main(void)
+{
+
+	printf("privsep is not enabled\n");
+	return 0;
+}
+#endif
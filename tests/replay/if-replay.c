@@ -0,0 +1,869 @@
+/*
+ * mock platform layer for the replay harness
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * This stands in for if-linux.c and the privileged separation processes.
+ * The harness runs dhcpcd as a privsep manager with nothing behind it:
+ * everything sent is counted and dropped, files do not exist and
+ * the kernel accepts every address and route, announcing addresses
+ * back from the event loop as it would over a netlink socket.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <linux/if_packet.h>
+#include <net/if_arp.h>
+#endif
+
+#include <errno.h>
+#include <ifaddrs.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "if.h"
+#include "ipv4.h"
+#include "ipv6.h"
+#include "logerr.h"
+#include "route.h"
+#include "privsep.h"
+#include "replay.h"
+
+#ifndef __unused
+#define __unused		__attribute__((__unused__))
+#endif
+
+struct replay_link replay_link = {
+	.name = "rp0",
+	.index = 1,
+	.hwaddr = { 0x02, 0x00, 0x5e, 0x10, 0x00, 0x01 },
+	.mtu = 1500,
+};
+
+struct replay_counts replay_counts;
+unsigned int replay_ndownstream;
+unsigned int replay_batch_depth;
+
+/* Address changes the kernel has yet to announce. */
+struct mock_ifa {
+	TAILQ_ENTRY(mock_ifa) next;
+	struct dhcpcd_ctx *ctx;
+	int cmd;
+	sa_family_t family;
+	char ifname[IF_NAMESIZE];
+	struct in_addr addr, mask, brd;
+	struct in6_addr addr6;
+	uint8_t prefix_len;
+};
+static TAILQ_HEAD(, mock_ifa) mock_ifas = TAILQ_HEAD_INITIALIZER(mock_ifas);
+
+static void
+mock_announce(void *arg)
+{
+	struct mock_ifa *mi;
+
+	UNUSED(arg);
+	while ((mi = TAILQ_FIRST(&mock_ifas)) != NULL) {
+		TAILQ_REMOVE(&mock_ifas, mi, next);
+		switch (mi->family) {
+#ifdef INET
+		case AF_INET:
+			ipv4_handleifa(mi->ctx, mi->cmd, NULL, mi->ifname,
+			    &mi->addr, &mi->mask, &mi->brd, 0, getpid());
+			break;
+#endif
+#ifdef INET6
+		case AF_INET6:
+			ipv6_handleifa(mi->ctx, mi->cmd, NULL, mi->ifname,
+			    &mi->addr6, mi->prefix_len, 0, getpid());
+			break;
+#endif
+		}
+		free(mi);
+	}
+}
+
+static struct mock_ifa *
+mock_queueifa(struct dhcpcd_ctx *ctx, int cmd, const char *ifname)
+{
+	struct mock_ifa *mi;
+
+	if ((mi = calloc(1, sizeof(*mi))) == NULL)
+		return NULL;
+	if (TAILQ_FIRST(&mock_ifas) == NULL &&
+	    eloop_timeout_add_sec(ctx->eloop, 0, mock_announce, NULL) == -1)
+	{
+		free(mi);
+		return NULL;
+	}
+	mi->ctx = ctx;
+	mi->cmd = cmd;
+	strlcpy(mi->ifname, ifname, sizeof(mi->ifname));
+	TAILQ_INSERT_TAIL(&mock_ifas, mi, next);
+	return mi;
+}
+
+/* Drops anything not yet announced, the interface is going. */
+void
+mock_flush(void)
+{
+	struct mock_ifa *mi;
+
+	while ((mi = TAILQ_FIRST(&mock_ifas)) != NULL) {
+		TAILQ_REMOVE(&mock_ifas, mi, next);
+		free(mi);
+	}
+}
+
+int
+os_init(void)
+{
+
+	return 0;
+}
+
+int
+if_opensockets_os(__unused struct dhcpcd_ctx *ctx)
+{
+
+	return 0;
+}
+
+void
+if_closesockets_os(__unused struct dhcpcd_ctx *ctx)
+{
+
+}
+
+int
+if_handlelink(__unused struct dhcpcd_ctx *ctx)
+{
+
+	return 0;
+}
+
+int
+if_resync(__unused struct dhcpcd_ctx *ctx)
+{
+
+	return 0;
+}
+
+int
+if_conf(__unused struct interface *ifp)
+{
+
+	return 0;
+}
+
+int
+if_init(__unused struct interface *ifp)
+{
+
+	return 0;
+}
+
+int
+if_getssid(__unused struct interface *ifp)
+{
+
+	/* Wired */
+	errno = EINVAL;
+	return -1;
+}
+
+bool
+if_ignore(__unused struct dhcpcd_ctx *ctx, __unused const char *ifname)
+{
+
+	return false;
+}
+
+int
+if_vimaster(__unused struct dhcpcd_ctx *ctx, __unused const char *ifname)
+{
+
+	return 0;
+}
+
+unsigned short
+if_vlanid(__unused const struct interface *ifp)
+{
+
+	return 0;
+}
+
+int
+if_setmac(__unused struct interface *ifp, __unused void *mac,
+    __unused uint8_t maclen)
+{
+
+	errno = ENOTSUP;
+	return -1;
+}
+
+int
+if_carrier(struct interface *ifp, __unused const void *ifadata)
+{
+
+	return ifp->flags & IFF_RUNNING ? LINK_UP : LINK_DOWN;
+}
+
+bool
+if_roaming(__unused struct interface *ifp)
+{
+
+	return false;
+}
+
+int
+if_machinearch(char *str, size_t len)
+{
+
+	return snprintf(str, len, "replay");
+}
+
+#ifdef __linux__
+/* Link n is replay_link, the rest are downstream of it. */
+static void
+mock_link(unsigned int n, char *name, unsigned int *index, uint8_t *hwaddr)
+{
+
+	if (n == 0)
+		strlcpy(name, replay_link.name, IF_NAMESIZE);
+	else
+		snprintf(name, IF_NAMESIZE, "rp%u", n);
+	*index = replay_link.index + n;
+	memcpy(hwaddr, replay_link.hwaddr, sizeof(replay_link.hwaddr));
+	hwaddr[sizeof(replay_link.hwaddr) - 1] = (uint8_t)
+	    (hwaddr[sizeof(replay_link.hwaddr) - 1] + n);
+}
+
+static bool
+mock_findlink(const char *ifname, unsigned int *index, uint8_t *hwaddr)
+{
+	char name[IF_NAMESIZE];
+	unsigned int n;
+
+	for (n = 0; n <= replay_ndownstream; n++) {
+		mock_link(n, name, index, hwaddr);
+		if (strcmp(name, ifname) == 0)
+			return true;
+	}
+	return false;
+}
+
+struct mock_link {
+	struct ifaddrs ifa;
+	struct sockaddr_ll sll;
+	char name[IF_NAMESIZE];
+};
+
+int
+if_getlinks(__unused struct dhcpcd_ctx *ctx, struct ifaddrs **ifap,
+    int argc, char * const *argv)
+{
+	struct mock_link *ml;
+	struct ifaddrs **ifnext = ifap;
+	char name[IF_NAMESIZE];
+	uint8_t hwaddr[sizeof(replay_link.hwaddr)];
+	unsigned int n, index;
+	int i;
+
+	*ifap = NULL;
+	for (n = 0; n <= replay_ndownstream; n++) {
+		mock_link(n, name, &index, hwaddr);
+		for (i = 0; i < argc; i++) {
+			if (strcmp(argv[i], name) == 0)
+				break;
+		}
+		if (argc != 0 && i == argc)
+			continue;
+
+		if ((ml = calloc(1, sizeof(*ml))) == NULL)
+			return -1;
+		strlcpy(ml->name, name, sizeof(ml->name));
+		ml->ifa.ifa_name = ml->name;
+		ml->ifa.ifa_flags = IFF_UP | IFF_BROADCAST | IFF_RUNNING |
+		    IFF_MULTICAST;
+		ml->ifa.ifa_addr = (struct sockaddr *)&ml->sll;
+		ml->sll.sll_family = AF_PACKET;
+		ml->sll.sll_ifindex = (int)index;
+		ml->sll.sll_hatype = ARPHRD_ETHER;
+		ml->sll.sll_halen = sizeof(hwaddr);
+		memcpy(ml->sll.sll_addr, hwaddr, sizeof(hwaddr));
+		*ifnext = &ml->ifa;
+		ifnext = &ml->ifa.ifa_next;
+	}
+	return 0;
+}
+
+/* if.c asks the kernel about the link directly for some things. */
+int
+ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	struct ifreq *ifr;
+	unsigned int index;
+	uint8_t hwaddr[sizeof(replay_link.hwaddr)];
+
+	va_start(ap, request);
+	ifr = va_arg(ap, struct ifreq *);
+	va_end(ap);
+
+	if ((request == SIOCGIFMTU || request == SIOCGIFFLAGS) &&
+	    mock_findlink(ifr->ifr_name, &index, hwaddr))
+	{
+		if (request == SIOCGIFMTU)
+			ifr->ifr_mtu = (int)replay_link.mtu;
+		else
+			ifr->ifr_flags = IFF_UP | IFF_BROADCAST |
+			    IFF_RUNNING | IFF_MULTICAST;
+		return 0;
+	}
+	return (int)syscall(SYS_ioctl, fd, request, ifr);
+}
+
+/* Each link comes up with just its EUI-64 link-local address. */
+int
+if_getaddrs(struct dhcpcd_ctx *ctx, const struct ifaddrs *links)
+{
+#ifdef INET6
+	const struct ifaddrs *ifa;
+	struct in6_addr ll;
+	unsigned int index;
+	uint8_t hw[sizeof(replay_link.hwaddr)];
+
+	for (ifa = links; ifa != NULL; ifa = ifa->ifa_next) {
+		if (!mock_findlink(ifa->ifa_name, &index, hw))
+			continue;
+		memset(&ll, 0, sizeof(ll));
+		ll.s6_addr[0] = 0xfe;
+		ll.s6_addr[1] = 0x80;
+		ll.s6_addr[8] = hw[0] ^ 0x02;
+		ll.s6_addr[9] = hw[1];
+		ll.s6_addr[10] = hw[2];
+		ll.s6_addr[11] = 0xff;
+		ll.s6_addr[12] = 0xfe;
+		ll.s6_addr[13] = hw[3];
+		ll.s6_addr[14] = hw[4];
+		ll.s6_addr[15] = hw[5];
+		ipv6_handleifa(ctx, RTM_NEWADDR, NULL, ifa->ifa_name,
+		    &ll, 64, 0, 0);
+	}
+#else
+	UNUSED(ctx);
+	UNUSED(links);
+#endif
+	return 0;
+}
+#endif
+
+int
+if_route(__unused unsigned char cmd, __unused const struct rt *rt)
+{
+
+	replay_counts.routes++;
+	return 0;
+}
+
+int
+if_initrt(__unused struct dhcpcd_ctx *ctx, __unused rb_tree_t *kroutes,
+    __unused int af)
+{
+
+	return 0;
+}
+
+#ifdef INET
+int
+if_address(unsigned char cmd, const struct ipv4_addr *ia)
+{
+	struct mock_ifa *mi;
+
+	replay_counts.addrs++;
+	mi = mock_queueifa(ia->iface->ctx, cmd == RTM_DELADDR ?
+	    RTM_DELADDR : RTM_NEWADDR, ia->iface->name);
+	if (mi == NULL)
+		return -1;
+	mi->family = AF_INET;
+	mi->addr = ia->addr;
+	mi->mask = ia->mask;
+	mi->brd = ia->brd;
+	return 0;
+}
+
+#ifdef __linux__
+/* if-linux.c has the BPF backend. The manager never opens one as the
+ * BPF processes would, frames are handed straight to dhcpcd instead. */
+const char *bpf_name = "replay";
+
+struct bpf *
+bpf_open(__unused const struct interface *ifp,
+    __unused int (*filter)(const struct bpf *, const struct in_addr *),
+    __unused const struct in_addr *ia)
+{
+
+	errno = ENOSYS;
+	return NULL;
+}
+
+void
+bpf_close(__unused struct bpf *bpf)
+{
+
+}
+
+size_t
+bpf_ringsize(void)
+{
+
+	return 0;
+}
+
+int
+bpf_attach(__unused int s, __unused void *filter,
+    __unused unsigned int filter_len)
+{
+
+	errno = ENOSYS;
+	return -1;
+}
+
+ssize_t
+bpf_readframe(__unused struct bpf *bpf, __unused const void **data)
+{
+
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+#endif
+
+#ifdef INET6
+void
+if_setup_inet6(__unused const struct interface *ifp)
+{
+
+}
+
+void
+if_restore_inet6(__unused const struct interface *ifp)
+{
+
+}
+
+int
+ip6_forwarding(__unused const char *ifname)
+{
+
+	return 0;
+}
+
+int
+if_applyra(__unused const struct ra *rap)
+{
+
+	return 0;
+}
+
+int
+if_address6(unsigned char cmd, const struct ipv6_addr *ia)
+{
+	struct mock_ifa *mi;
+
+	replay_counts.addrs++;
+	mi = mock_queueifa(ia->iface->ctx, cmd == RTM_DELADDR ?
+	    RTM_DELADDR : RTM_NEWADDR, ia->iface->name);
+	if (mi == NULL)
+		return -1;
+	mi->family = AF_INET6;
+#ifdef PRIVSEP
+	/* Otherwise ipv6_addaddrs could not batch them. */
+	if (cmd != RTM_DELADDR && ia->iface->ctx->ipv6_batch == NULL)
+		replay_counts.unbatched6++;
+#endif
+	mi->addr6 = ia->addr;
+	mi->prefix_len = ia->prefix_len;
+	return 0;
+}
+
+int
+if_getlifetime6(__unused struct ipv6_addr *ia)
+{
+
+	errno = ENOTSUP;
+	return -1;
+}
+#endif
+
+#ifdef PRIVSEP
+static ssize_t
+mock_msglen(const struct msghdr *msg)
+{
+	size_t i, len = 0;
+
+	for (i = 0; i < (size_t)msg->msg_iovlen; i++)
+		len += msg->msg_iov[i].iov_len;
+	return (ssize_t)len;
+}
+
+void
+ps_initprocesses(struct dhcpcd_ctx *ctx)
+{
+
+	TAILQ_INIT(&ctx->ps_processes);
+}
+
+int
+ps_init(__unused struct dhcpcd_ctx *ctx)
+{
+
+	return 0;
+}
+
+int
+ps_start(__unused struct dhcpcd_ctx *ctx)
+{
+
+	return 0;
+}
+
+int
+ps_stop(__unused struct dhcpcd_ctx *ctx)
+{
+
+	return 0;
+}
+
+int
+ps_stopwait(__unused struct dhcpcd_ctx *ctx)
+{
+
+	return EXIT_SUCCESS;
+}
+
+int
+ps_managersandbox(__unused struct dhcpcd_ctx *ctx,
+    __unused const char *pledge)
+{
+
+	return 0;
+}
+
+int
+ps_root_stop(__unused struct dhcpcd_ctx *ctx)
+{
+
+	return 0;
+}
+
+void
+ps_root_signalcb(__unused int sig, __unused void *arg)
+{
+
+}
+
+ssize_t
+ps_root_logreopen(__unused struct dhcpcd_ctx *ctx)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_root_ioctl(__unused struct dhcpcd_ctx *ctx, __unused ioctl_request_t req,
+    __unused void *data, __unused size_t len)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_root_ip6forwarding(__unused struct dhcpcd_ctx *ctx,
+    __unused const char *ifname)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_root_setlinkrcvbuf(__unused struct dhcpcd_ctx *ctx, __unused int rcvbuf)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_root_script(__unused struct dhcpcd_ctx *ctx, __unused const void *data,
+    size_t len)
+{
+
+	replay_counts.scripts++;
+	return (ssize_t)len;
+}
+
+/* Nothing is queued, but batches must nest and be ended. */
+int
+ps_root_batch_start(__unused struct dhcpcd_ctx *ctx,
+    __unused void (*cb)(void *, ssize_t), __unused void *cbarg)
+{
+
+	replay_counts.batches++;
+	replay_batch_depth++;
+	return 0;
+}
+
+int
+ps_root_batch_end(__unused struct dhcpcd_ctx *ctx)
+{
+
+	if (replay_batch_depth == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	replay_batch_depth--;
+	return 0;
+}
+
+/* Only the configuration exists, every run starts without a lease. */
+ssize_t
+ps_root_readfile(struct dhcpcd_ctx *ctx, const char *file, void *data,
+    size_t len)
+{
+
+	if (strcmp(file, ctx->cffile) == 0)
+		return readfile(file, data, len);
+	errno = ENOENT;
+	return -1;
+}
+
+ssize_t
+ps_root_readlease(__unused struct dhcpcd_ctx *ctx, __unused const char *file,
+    __unused void *data, __unused size_t len, __unused time_t *mtime)
+{
+
+	errno = ENOENT;
+	return -1;
+}
+
+ssize_t
+ps_root_filemtime(struct dhcpcd_ctx *ctx, const char *file, time_t *time)
+{
+
+	if (strcmp(file, ctx->cffile) == 0)
+		return filemtime(file, time);
+	errno = ENOENT;
+	return -1;
+}
+
+ssize_t
+ps_root_writefile(__unused struct dhcpcd_ctx *ctx, __unused const char *file,
+    __unused mode_t mode, __unused const void *data, size_t len)
+{
+
+	replay_counts.writes++;
+	return (ssize_t)len;
+}
+
+ssize_t
+ps_root_writefile_atomic(__unused struct dhcpcd_ctx *ctx,
+    __unused const char *file, __unused mode_t mode,
+    __unused const void *data, size_t len, __unused time_t mtime)
+{
+
+	replay_counts.writes++;
+	return (ssize_t)len;
+}
+
+ssize_t
+ps_root_unlink(__unused struct dhcpcd_ctx *ctx, __unused const char *file)
+{
+
+	return 0;
+}
+
+int
+ps_root_scriptstats(__unused struct dhcpcd_ctx *ctx)
+{
+
+	return 0;
+}
+
+int
+ps_root_getauthrdm(__unused struct dhcpcd_ctx *ctx, uint64_t *rdm)
+{
+
+	*rdm = 0;
+	return 0;
+}
+
+ssize_t
+ps_ctl_handleargs(__unused struct fd_list *fd, __unused char *data,
+    __unused size_t len)
+{
+
+	errno = ENOTSUP;
+	return -1;
+}
+
+ssize_t
+ps_ctl_sendargs(__unused struct fd_list *fd, __unused void *data, size_t len)
+{
+
+	return (ssize_t)len;
+}
+
+ssize_t
+ps_ctl_sendeof(__unused struct fd_list *fd)
+{
+
+	return 0;
+}
+
+#ifdef INET
+ssize_t
+ps_bpf_openbootp(__unused const struct interface *ifp)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_bpf_closebootp(__unused const struct interface *ifp)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_bpf_sendbootp(__unused const struct interface *ifp,
+    __unused const void *data, size_t len)
+{
+
+	replay_counts.bootp_tx++;
+	return (ssize_t)len;
+}
+
+ssize_t
+ps_bpf_openarp(__unused const struct interface *ifp,
+    __unused const struct in_addr *addr)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_bpf_closearp(__unused const struct interface *ifp,
+    __unused const struct in_addr *addr)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_bpf_sendarp(__unused const struct interface *ifp,
+    __unused const struct in_addr *addr, __unused const void *data,
+    size_t len)
+{
+
+	replay_counts.arp_tx++;
+	return (ssize_t)len;
+}
+
+ssize_t
+ps_inet_openbootp(__unused struct ipv4_addr *ia)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_inet_closebootp(__unused struct ipv4_addr *ia)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_inet_sendbootp(__unused struct interface *ifp, const struct msghdr *msg)
+{
+
+	replay_counts.bootp_tx++;
+	return mock_msglen(msg);
+}
+#endif
+
+#ifdef INET6
+ssize_t
+ps_inet_sendnd(__unused struct interface *ifp, const struct msghdr *msg)
+{
+
+	replay_counts.nd_tx++;
+	return mock_msglen(msg);
+}
+#endif
+
+#ifdef DHCP6
+ssize_t
+ps_inet_opendhcp6(__unused struct ipv6_addr *ia)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_inet_closedhcp6(__unused struct ipv6_addr *ia)
+{
+
+	return 0;
+}
+
+ssize_t
+ps_inet_senddhcp6(__unused struct interface *ifp, const struct msghdr *msg)
+{
+
+	replay_counts.dhcp6_tx++;
+	return mock_msglen(msg);
+}
+#endif
+#endif
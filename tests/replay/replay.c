@@ -0,0 +1,1331 @@
+/*
+ * dhcpcd packet replay harness
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/if_ether.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <netinet/udp.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "arp.h"
+#include "common.h"
+#include "cksum.h"
+#include "dhcpcd.h"
+#include "dhcp.h"
+#include "dhcp-common.h"
+#include "dhcp6.h"
+#include "duid.h"
+#include "eloop.h"
+#include "if.h"
+#include "if-options.h"
+#include "ipv6nd.h"
+#include "logerr.h"
+#include "route.h"
+#include "replay.h"
+
+#ifndef __unused
+#define __unused		__attribute__((__unused__))
+#endif
+
+#if defined(PRIVSEP) && defined(__linux__)
+/* Latencies in nanoseconds or rates, sorted when reported. */
+struct samples {
+	unsigned long long *v;
+	size_t n;
+	size_t len;
+};
+
+enum format { FMT_TEXT, FMT_CSV };
+
+/* What a recorded frame is fed to. */
+enum proto {
+	P_BOOTP,
+	P_DHCP6,
+	P_RA,
+	P_ARP,
+	P_MAX,
+	P_SKIP = P_MAX,
+};
+
+static const char * const proto_names[P_MAX] = {
+	"dhcp", "dhcp6", "ra", "arp",
+};
+
+struct frame {
+	unsigned long long ts;		/* nsec since the first frame */
+	enum proto proto;
+	size_t len;
+	uint8_t *data;
+};
+
+struct trace {
+	const char *name;
+	struct frame *frames;
+	size_t nframes;
+	size_t len;
+};
+
+struct run {
+	struct dhcpcd_ctx *ctx;
+	const struct trace *trace;
+	size_t next;
+	unsigned long long start;
+	unsigned long long busy;	/* nsec inside the entry points */
+	size_t replayed;
+	struct samples *lat;
+};
+
+#define	ETHER_ALEN		6
+#define	ETHER_HLEN		14
+#define	ETHERTYPE_IP_		0x0800
+#define	ETHERTYPE_ARP_		0x0806
+#define	ETHERTYPE_IPV6_		0x86dd
+
+#define	PCAP_MAGIC		0xa1b2c3d4U
+#define	PCAP_MAGIC_NSEC		0xa1b23c4dU
+#define	PCAP_DLT_EN10MB		1
+#define	PCAP_SNAPLEN		65535
+
+struct pcap_filehdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_pkthdr {
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+static enum format format = FMT_TEXT;
+static bool timed;
+static uint8_t pktbuf[PCAP_SNAPLEN];
+#ifdef INET6
+/* What a socket would read, aligned as the kernel would copy it. */
+static union {
+	uint64_t align;
+	uint8_t buf[PCAP_SNAPLEN];
+} l4buf;
+#endif
+
+static unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return (unsigned long long)ts.tv_sec * NSEC_PER_SEC +
+	    (unsigned long long)ts.tv_nsec;
+}
+
+static void
+sample_add(struct samples *s, unsigned long long v)
+{
+
+	if (s->n == s->len) {
+		size_t len = s->len == 0 ? 1024 : s->len * 2;
+		unsigned long long *nv;
+
+		nv = realloc(s->v, len * sizeof(*nv));
+		if (nv == NULL)
+			err(EXIT_FAILURE, "realloc");
+		s->v = nv;
+		s->len = len;
+	}
+	s->v[s->n++] = v;
+}
+
+static int
+sample_cmp(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Nearest rank */
+static unsigned long long
+sample_pct(const struct samples *s, unsigned int pct)
+{
+	size_t i;
+
+	i = (s->n * pct + 99) / 100;
+	return s->v[i == 0 ? 0 : i - 1];
+}
+
+static void
+report(const char *trace, const char *what, const char *unit,
+    struct samples *s)
+{
+	unsigned long long min, p50, p90, p99, max;
+
+	if (s->n == 0)
+		return;
+	qsort(s->v, s->n, sizeof(*s->v), sample_cmp);
+	min = s->v[0];
+	p50 = sample_pct(s, 50);
+	p90 = sample_pct(s, 90);
+	p99 = sample_pct(s, 99);
+	max = s->v[s->n - 1];
+
+	switch (format) {
+	case FMT_CSV:
+		printf("%s,%s,%s,%zu,%llu,%llu,%llu,%llu,%llu\n",
+		    trace, what, unit, s->n, min, p50, p90, p99, max);
+		break;
+	default:
+		printf("%s: count %zu, min %llu, p50 %llu, p90 %llu, "
+		    "p99 %llu, max %llu %s\n",
+		    what, s->n, min, p50, p90, p99, max, unit);
+		break;
+	}
+	s->n = 0;
+}
+
+static uint16_t
+get16(const uint8_t *p)
+{
+
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static void
+put16(uint8_t *p, uint16_t v)
+{
+
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)v;
+}
+
+/*
+ * Works out what a frame is for dhcpcd.
+ * Anything the client itself sent is skipped as is anything
+ * dhcpcd would never read.
+ */
+static enum proto
+frame_classify(const uint8_t *data, size_t len)
+{
+	size_t hlen;
+	const uint8_t *l4;
+
+	if (len < ETHER_HLEN)
+		return P_SKIP;
+	switch (get16(data + 12)) {
+	case ETHERTYPE_ARP_:
+		return P_ARP;
+	case ETHERTYPE_IP_:
+		data += ETHER_HLEN;
+		len -= ETHER_HLEN;
+		if (len < sizeof(struct ip) || (data[0] >> 4) != 4)
+			return P_SKIP;
+		hlen = (size_t)(data[0] & 0x0f) * 4;
+		if (data[9] != IPPROTO_UDP || len < hlen + sizeof(struct udphdr))
+			return P_SKIP;
+		l4 = data + hlen;
+		if (get16(l4 + 2) != BOOTPC)
+			return P_SKIP;
+		return P_BOOTP;
+	case ETHERTYPE_IPV6_:
+		data += ETHER_HLEN;
+		len -= ETHER_HLEN;
+		if (len < sizeof(struct ip6_hdr) || (data[0] >> 4) != 6)
+			return P_SKIP;
+		l4 = data + sizeof(struct ip6_hdr);
+		len -= sizeof(struct ip6_hdr);
+		switch (data[6]) {
+		case IPPROTO_UDP:
+			if (len < sizeof(struct udphdr) ||
+			    get16(l4 + 2) != DHCP6_CLIENT_PORT)
+				return P_SKIP;
+			return P_DHCP6;
+		case IPPROTO_ICMPV6:
+			if (len < sizeof(struct icmp6_hdr) ||
+			    l4[0] != ND_ROUTER_ADVERT)
+				return P_SKIP;
+			return P_RA;
+		}
+		break;
+	}
+	return P_SKIP;
+}
+
+static void
+trace_add(struct trace *t, unsigned long long ts, const uint8_t *data,
+    size_t len)
+{
+	struct frame *f;
+
+	if (t->nframes == t->len) {
+		size_t n = t->len == 0 ? 64 : t->len * 2;
+
+		f = realloc(t->frames, n * sizeof(*f));
+		if (f == NULL)
+			err(EXIT_FAILURE, "realloc");
+		t->frames = f;
+		t->len = n;
+	}
+	f = &t->frames[t->nframes++];
+	f->ts = ts;
+	f->len = len;
+	f->proto = frame_classify(data, len);
+	if ((f->data = malloc(len)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memcpy(f->data, data, len);
+}
+
+static void
+trace_free(struct trace *t)
+{
+	size_t i;
+
+	for (i = 0; i < t->nframes; i++)
+		free(t->frames[i].data);
+	free(t->frames);
+}
+
+static uint32_t
+swap32(uint32_t v, bool swap)
+{
+
+	if (!swap)
+		return v;
+	return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) |
+	    (v << 24);
+}
+
+static void
+trace_read(struct trace *t, const char *file)
+{
+	FILE *fp;
+	struct pcap_filehdr fh;
+	struct pcap_pkthdr ph;
+	bool swap, nsec;
+	unsigned long long ts, first = 0;
+	uint32_t caplen;
+
+	memset(t, 0, sizeof(*t));
+	t->name = file;
+	if ((fp = fopen(file, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+	if (fread(&fh, sizeof(fh), 1, fp) != 1)
+		errx(EXIT_FAILURE, "%s: not a pcap file", file);
+	switch (fh.magic) {
+	case PCAP_MAGIC:
+		swap = nsec = false;
+		break;
+	case PCAP_MAGIC_NSEC:
+		swap = false;
+		nsec = true;
+		break;
+	default:
+		swap = true;
+		if (swap32(fh.magic, swap) == PCAP_MAGIC)
+			nsec = false;
+		else if (swap32(fh.magic, swap) == PCAP_MAGIC_NSEC)
+			nsec = true;
+		else
+			errx(EXIT_FAILURE, "%s: not a pcap file", file);
+	}
+	if (swap32(fh.linktype, swap) != PCAP_DLT_EN10MB)
+		errx(EXIT_FAILURE, "%s: only ethernet captures are supported",
+		    file);
+
+	while (fread(&ph, sizeof(ph), 1, fp) == 1) {
+		caplen = swap32(ph.caplen, swap);
+		if (caplen > sizeof(pktbuf))
+			errx(EXIT_FAILURE, "%s: frame too big", file);
+		if (fread(pktbuf, caplen, 1, fp) != 1)
+			errx(EXIT_FAILURE, "%s: truncated", file);
+		ts = (unsigned long long)swap32(ph.ts_sec, swap) * NSEC_PER_SEC +
+		    (unsigned long long)swap32(ph.ts_frac, swap) *
+		    (nsec ? 1 : 1000);
+		if (t->nframes == 0)
+			first = ts;
+		trace_add(t, ts < first ? 0 : ts - first, pktbuf, caplen);
+	}
+	if (ferror(fp))
+		err(EXIT_FAILURE, "%s", file);
+	fclose(fp);
+}
+
+static void
+trace_write(const struct trace *t, const char *file)
+{
+	FILE *fp;
+	struct pcap_filehdr fh = {
+		.magic = PCAP_MAGIC,
+		.version_major = 2,
+		.version_minor = 4,
+		.snaplen = PCAP_SNAPLEN,
+		.linktype = PCAP_DLT_EN10MB,
+	};
+	struct pcap_pkthdr ph;
+	const struct frame *f;
+	size_t i;
+
+	if ((fp = fopen(file, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+	if (fwrite(&fh, sizeof(fh), 1, fp) != 1)
+		err(EXIT_FAILURE, "%s", file);
+	for (i = 0, f = t->frames; i < t->nframes; i++, f++) {
+		ph.ts_sec = (uint32_t)(f->ts / NSEC_PER_SEC);
+		ph.ts_frac = (uint32_t)(f->ts % NSEC_PER_SEC / 1000);
+		ph.caplen = ph.len = (uint32_t)f->len;
+		if (fwrite(&ph, sizeof(ph), 1, fp) != 1 ||
+		    fwrite(f->data, f->len, 1, fp) != 1)
+			err(EXIT_FAILURE, "%s", file);
+	}
+	if (fclose(fp) == EOF)
+		err(EXIT_FAILURE, "%s", file);
+}
+
+/*
+ * The built in trace is what a server and router say to one client
+ * bringing up IPv4 and IPv6 on an ethernet.
+ */
+static const uint8_t srv_hw[ETHER_ALEN] = { 0x02, 0x00, 0x5e, 0x10, 0x00, 0xfe };
+#ifdef INET
+static const uint8_t bcast_hw[ETHER_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+#endif
+#ifdef INET6
+static const uint8_t allnodes_hw[ETHER_ALEN] = { 0x33, 0x33, 0, 0, 0, 1 };
+#endif
+
+static size_t
+gen_ether(uint8_t *p, const uint8_t *dst, const uint8_t *src, uint16_t type)
+{
+
+	memcpy(p, dst, ETHER_ALEN);
+	memcpy(p + ETHER_ALEN, src, ETHER_ALEN);
+	put16(p + 12, type);
+	return ETHER_HLEN;
+}
+
+#ifdef INET
+static size_t
+gen_opt(uint8_t *p, uint8_t code, const void *data, size_t len)
+{
+
+	p[0] = code;
+	p[1] = (uint8_t)len;
+	memcpy(p + 2, data, len);
+	return len + 2;
+}
+#endif
+
+#ifdef INET6
+static size_t
+gen_opt6(uint8_t *p, uint16_t code, const void *data, size_t len)
+{
+
+	put16(p, code);
+	put16(p + 2, (uint16_t)len);
+	memcpy(p + 4, data, len);
+	return len + 4;
+}
+#endif
+
+#ifdef INET
+static size_t
+gen_bootp(uint8_t *p, uint8_t type)
+{
+	static const uint8_t cookie[] = { 99, 130, 83, 99 };
+	static const uint8_t sid[] = { 10, 0, 0, 1 };
+	static const uint8_t mask[] = { 255, 255, 255, 0 };
+	static const uint8_t brd[] = { 10, 0, 0, 255 };
+	static const uint8_t lease[] = { 0, 0, 0x0e, 0x10 };
+	static const uint8_t t1[] = { 0, 0, 0x07, 0x08 };
+	static const uint8_t t2[] = { 0, 0, 0x0c, 0x4e };
+	static const uint8_t csr[] = { 24, 192, 168, 5, 10, 0, 0, 1,
+	    0, 10, 0, 0, 1 };
+	uint8_t *ip, *udp, *bootp, *o, sum[2];
+	uint16_t ulen, c;
+	uint32_t csum;
+
+	p += gen_ether(p, bcast_hw, srv_hw, ETHERTYPE_IP_);
+	ip = p;
+	udp = ip + 20;
+	bootp = udp + 8;
+	memset(ip, 0, 20 + 8 + 240);
+	bootp[0] = BOOTREPLY;
+	bootp[1] = 1;
+	bootp[2] = ETHER_ALEN;
+	memcpy(bootp + 16, (const uint8_t[]){ 10, 0, 0, 50 }, 4);
+	memcpy(bootp + 28, replay_link.hwaddr, ETHER_ALEN);
+	memcpy(bootp + 236, cookie, sizeof(cookie));
+	o = bootp + 240;
+	o += gen_opt(o, DHO_MESSAGETYPE, &type, 1);
+	o += gen_opt(o, DHO_SERVERID, sid, sizeof(sid));
+	o += gen_opt(o, DHO_LEASETIME, lease, sizeof(lease));
+	o += gen_opt(o, DHO_RENEWALTIME, t1, sizeof(t1));
+	o += gen_opt(o, DHO_REBINDTIME, t2, sizeof(t2));
+	o += gen_opt(o, DHO_SUBNETMASK, mask, sizeof(mask));
+	o += gen_opt(o, DHO_BROADCAST, brd, sizeof(brd));
+	o += gen_opt(o, DHO_ROUTER, sid, sizeof(sid));
+	o += gen_opt(o, DHO_DNSSERVER, sid, sizeof(sid));
+	o += gen_opt(o, DHO_DNSDOMAIN, "example.org", 11);
+	o += gen_opt(o, DHO_CSR, csr, sizeof(csr));
+	*o++ = DHO_END;
+	/* Pad to the BOOTP minimum like most servers. */
+	while (o - bootp < 300)
+		*o++ = DHO_PAD;
+
+	ulen = (uint16_t)(o - udp);
+	ip[0] = 0x45;
+	put16(ip + 2, (uint16_t)(ulen + 20));
+	ip[8] = 64;
+	ip[9] = IPPROTO_UDP;
+	memcpy(ip + 12, sid, 4);
+	memset(ip + 16, 0xff, 4);
+	c = in_cksum(ip, 20, NULL);
+	memcpy(ip + 10, &c, sizeof(c));
+	put16(udp, BOOTPS);
+	put16(udp + 2, BOOTPC);
+	put16(udp + 4, ulen);
+
+	/* Pseudo header then UDP. */
+	csum = 0;
+	in_cksum(ip + 12, 8, &csum);
+	put16(sum, IPPROTO_UDP);
+	in_cksum(sum, sizeof(sum), &csum);
+	in_cksum(udp + 4, 2, &csum);
+	c = in_cksum(udp, ulen, &csum);
+	memcpy(udp + 6, &c, sizeof(c));
+	return ETHER_HLEN + 20 + ulen;
+}
+
+static size_t
+gen_arp(uint8_t *p, uint16_t op, const uint8_t *tha, const uint8_t *tip)
+{
+	static const uint8_t sip[] = { 10, 0, 0, 1 };
+	const uint8_t *dst = op == ARPOP_REQUEST ? bcast_hw : tha;
+
+	p += gen_ether(p, dst, srv_hw, ETHERTYPE_ARP_);
+	put16(p, ARPHRD_ETHER);
+	put16(p + 2, ETHERTYPE_IP_);
+	p[4] = ETHER_ALEN;
+	p[5] = 4;
+	put16(p + 6, op);
+	memcpy(p + 8, srv_hw, ETHER_ALEN);
+	memcpy(p + 14, sip, 4);
+	memcpy(p + 18, tha, ETHER_ALEN);
+	memcpy(p + 24, tip, 4);
+	return ETHER_HLEN + 28;
+}
+#endif
+
+#ifdef INET6
+static const struct in6_addr router_ll = {
+	.s6_addr = { 0xfe, 0x80, [8] = 0x00, 0x00, 0x5e, 0xff, 0xfe, 0x10,
+	    0x00, 0xfe }
+};
+static const uint8_t prefix6[] = { 0x20, 0x01, 0x0d, 0xb8, 0, 1 };
+/* Delegated as a /56 with -p. */
+static const uint8_t pdprefix6[] = { 0x20, 0x01, 0x0d, 0xb8, 0, 2 };
+
+/* Fills in the IPv6 header and transport checksum. */
+static size_t
+gen_ip6(uint8_t *ip6, const uint8_t *dst, uint8_t nxt, uint8_t hlim,
+    size_t plen, size_t sumoff)
+{
+	uint8_t *l4 = ip6 + sizeof(struct ip6_hdr), ph[8];
+	uint32_t csum;
+	uint16_t c;
+
+	memset(ip6, 0, sizeof(struct ip6_hdr));
+	ip6[0] = 0x60;
+	put16(ip6 + 4, (uint16_t)plen);
+	ip6[6] = nxt;
+	ip6[7] = hlim;
+	memcpy(ip6 + 8, &router_ll, sizeof(router_ll));
+	memcpy(ip6 + 24, dst, 16);
+
+	memset(ph, 0, sizeof(ph));
+	put16(ph + 2, (uint16_t)plen);
+	ph[7] = nxt;
+	csum = 0;
+	in_cksum(ip6 + 8, 32, &csum);
+	in_cksum(ph, sizeof(ph), &csum);
+	c = in_cksum(l4, plen, &csum);
+	memcpy(l4 + sumoff, &c, sizeof(c));
+	return ETHER_HLEN + sizeof(struct ip6_hdr) + plen;
+}
+
+static size_t
+gen_ra(uint8_t *p)
+{
+	static const uint8_t allnodes[16] = { 0xff, 0x02, [15] = 1 };
+	uint8_t *ip6, *ra, *o;
+
+	p += gen_ether(p, allnodes_hw, srv_hw, ETHERTYPE_IPV6_);
+	ip6 = p;
+	ra = o = ip6 + sizeof(struct ip6_hdr);
+	memset(ra, 0, 16);
+	ra[0] = ND_ROUTER_ADVERT;
+	ra[4] = 64;				/* cur hop limit */
+	ra[5] = ND_RA_FLAG_MANAGED | ND_RA_FLAG_OTHER;
+	put16(ra + 6, 1800);			/* router lifetime */
+	o += 16;
+
+	/* Source link-layer address */
+	o[0] = ND_OPT_SOURCE_LINKADDR;
+	o[1] = 1;
+	memcpy(o + 2, srv_hw, ETHER_ALEN);
+	o += 8;
+
+	/* MTU */
+	memset(o, 0, 8);
+	o[0] = ND_OPT_MTU;
+	o[1] = 1;
+	put16(o + 6, 1500);
+	o += 8;
+
+	/* Prefix information */
+	memset(o, 0, 32);
+	o[0] = ND_OPT_PREFIX_INFORMATION;
+	o[1] = 4;
+	o[2] = 64;
+	o[3] = ND_OPT_PI_FLAG_ONLINK | ND_OPT_PI_FLAG_AUTO;
+	put16(o + 6, 0x5180);			/* valid 86400 */
+	o[5] = 1;
+	put16(o + 10, 0x3840);			/* preferred 14400 */
+	memcpy(o + 16, prefix6, sizeof(prefix6));
+	o += 32;
+
+	/* RDNSS */
+	memset(o, 0, 24);
+	o[0] = 25;
+	o[1] = 3;
+	put16(o + 6, 1800);
+	memcpy(o + 8, prefix6, sizeof(prefix6));
+	o[23] = 1;
+	o += 24;
+
+	return gen_ip6(ip6, allnodes, IPPROTO_ICMPV6, 255,
+	    (size_t)(o - ra), 2);
+}
+
+#ifdef DHCP6
+static size_t
+gen_dhcp6(uint8_t *p, uint8_t type)
+{
+	uint8_t *ip6, *udp, *m, *o, duid[10], ia[40], pd[41];
+	uint8_t dns[16] = { [15] = 1 };
+	uint8_t ll[16] = { 0xfe, 0x80 };
+	uint8_t pref = 255;
+	size_t plen;
+
+	memcpy(dns, prefix6, sizeof(prefix6));
+	ll[8] = replay_link.hwaddr[0] ^ 0x02;
+	ll[9] = replay_link.hwaddr[1];
+	ll[10] = replay_link.hwaddr[2];
+	ll[11] = 0xff;
+	ll[12] = 0xfe;
+	memcpy(ll + 13, replay_link.hwaddr + 3, 3);
+
+	p += gen_ether(p, replay_link.hwaddr, srv_hw, ETHERTYPE_IPV6_);
+	ip6 = p;
+	udp = ip6 + sizeof(struct ip6_hdr);
+	m = udp + 8;
+	m[0] = type;
+	m[1] = m[2] = m[3] = 0;
+	o = m + 4;
+
+	/* The client's DUID-LL, replaced with dhcpcd's own on replay. */
+	put16(duid, DUID_LL);
+	put16(duid + 2, ARPHRD_ETHER);
+	memcpy(duid + 4, replay_link.hwaddr, ETHER_ALEN);
+	o += gen_opt6(o, D6_OPTION_CLIENTID, duid, sizeof(duid));
+	memcpy(duid + 4, srv_hw, ETHER_ALEN);
+	o += gen_opt6(o, D6_OPTION_SERVERID, duid, sizeof(duid));
+
+	/* IA_NA with one address, IAID replaced on replay. */
+	memset(ia, 0, sizeof(ia));
+	put16(ia + 6, 1800);				/* T1 */
+	put16(ia + 10, 2880);				/* T2 */
+	put16(ia + 12, D6_OPTION_IA_ADDR);
+	put16(ia + 14, 24);
+	memcpy(ia + 16, prefix6, sizeof(prefix6));
+	ia[31] = 0x50;
+	put16(ia + 34, 3600);				/* preferred */
+	put16(ia + 38, 7200);				/* valid */
+	o += gen_opt6(o, D6_OPTION_IA_NA, ia, sizeof(ia));
+	if (replay_ndownstream != 0) {
+		/* IA_PD with one prefix, IAID replaced on replay. */
+		memset(pd, 0, sizeof(pd));
+		put16(pd + 6, 1800);			/* T1 */
+		put16(pd + 10, 2880);			/* T2 */
+		put16(pd + 12, D6_OPTION_IAPREFIX);
+		put16(pd + 14, 25);
+		put16(pd + 18, 3600);			/* preferred */
+		put16(pd + 22, 7200);			/* valid */
+		pd[24] = 56;
+		memcpy(pd + 25, pdprefix6, sizeof(pdprefix6));
+		o += gen_opt6(o, D6_OPTION_IA_PD, pd, sizeof(pd));
+	}
+	o += gen_opt6(o, D6_OPTION_DNS_SERVERS, dns, sizeof(dns));
+	if (type == DHCP6_ADVERTISE)
+		o += gen_opt6(o, D6_OPTION_PREFERENCE, &pref, 1);
+
+	plen = (size_t)(o - udp);
+	put16(udp, DHCP6_SERVER_PORT);
+	put16(udp + 2, DHCP6_CLIENT_PORT);
+	put16(udp + 4, (uint16_t)plen);
+	udp[6] = udp[7] = 0;
+	return gen_ip6(ip6, ll, IPPROTO_UDP, 64, plen, 6);
+}
+#endif
+#endif
+
+static void
+trace_generate(struct trace *t)
+{
+	uint8_t frame[1514];
+	unsigned long long ts = 0;
+#ifdef INET
+	static const uint8_t other[] = { 10, 0, 0, 99 };
+	static const uint8_t leased[] = { 10, 0, 0, 50 };
+#endif
+
+	memset(t, 0, sizeof(*t));
+	t->name = "builtin";
+#define	FRAME(len)	trace_add(t, ts, frame, (len)); ts += 50 * NSEC_PER_MSEC
+#ifdef INET6
+	FRAME(gen_ra(frame));
+#endif
+#ifdef INET
+	FRAME(gen_bootp(frame, DHCP_OFFER));
+	FRAME(gen_arp(frame, ARPOP_REQUEST, bcast_hw, other));
+	FRAME(gen_bootp(frame, DHCP_ACK));
+	FRAME(gen_arp(frame, ARPOP_REPLY, replay_link.hwaddr, leased));
+#endif
+#ifdef DHCP6
+	FRAME(gen_dhcp6(frame, DHCP6_ADVERTISE));
+	FRAME(gen_dhcp6(frame, DHCP6_REPLY));
+#endif
+#undef FRAME
+}
+
+#ifdef INET
+/* Points a server reply at the transaction dhcpcd has running. */
+static unsigned int
+replay_bootp(struct interface *ifp, uint8_t *data, size_t len)
+{
+	const struct dhcp_state *state = D_CSTATE(ifp);
+	uint8_t *ip = data + ETHER_HLEN, *udp, *bootp, sum[2];
+	size_t hlen;
+	uint16_t ulen, c;
+	uint32_t csum, xid;
+
+	hlen = (size_t)(ip[0] & 0x0f) * 4;
+	udp = ip + hlen;
+	bootp = udp + 8;
+	ulen = get16(udp + 4);
+	if (ETHER_HLEN + hlen + ulen > len ||
+	    ulen < 8 + offsetof(struct bootp, chaddr) + ETHER_ALEN)
+		return 0;
+
+	if (memcmp(data, bcast_hw, ETHER_ALEN) != 0)
+		memcpy(data, ifp->hwaddr, ETHER_ALEN);
+	if (state != NULL) {
+		xid = htonl(state->xid);
+		memcpy(bootp + offsetof(struct bootp, xid), &xid, sizeof(xid));
+	}
+	memcpy(bootp + offsetof(struct bootp, chaddr), ifp->hwaddr,
+	    ifp->hwlen);
+
+	if (udp[6] != 0 || udp[7] != 0) {
+		udp[6] = udp[7] = 0;
+		csum = 0;
+		in_cksum(ip + 12, 8, &csum);
+		put16(sum, IPPROTO_UDP);
+		in_cksum(sum, sizeof(sum), &csum);
+		in_cksum(udp + 4, 2, &csum);
+		c = in_cksum(udp, ulen, &csum);
+		memcpy(udp + 6, &c, sizeof(c));
+	}
+	return memcmp(data, bcast_hw, ETHER_ALEN) == 0 ? BPF_BCAST : 0;
+}
+#endif
+
+#ifdef DHCP6
+/*
+ * Swaps the client's DUID, IAIDs and xid for dhcpcd's own.
+ * Returns the new message length.
+ */
+static size_t
+replay_dhcp6(struct interface *ifp, const uint8_t *m, size_t len)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	const struct dhcp6_state *state = D6_CSTATE(ifp);
+	const struct if_options *ifo = ifp->options;
+	uint8_t *o = l4buf.buf;
+	const uint8_t *p = m + 4, *e = m + len;
+	uint16_t code, ol;
+	size_t i;
+
+	memcpy(o, m, 4);
+	if (state != NULL && state->send != NULL)
+		/* The xid follows the message type. */
+		memcpy(o + 1, (const uint8_t *)state->send + 1, 3);
+	o += 4;
+	while (p + 4 <= e) {
+		code = get16(p);
+		ol = get16(p + 2);
+		if (p + 4 + ol > e)
+			break;
+		if (code == D6_OPTION_CLIENTID && ctx->duid != NULL) {
+			o += gen_opt6(o, code, ctx->duid, ctx->duid_len);
+		} else {
+			memcpy(o, p, (size_t)ol + 4);
+			if ((code == D6_OPTION_IA_NA ||
+			    code == D6_OPTION_IA_TA ||
+			    code == D6_OPTION_IA_PD) &&
+			    ol >= sizeof(ifo->iaid))
+			{
+				for (i = 0; i < ifo->ia_len; i++) {
+					if (ifo->ia[i].ia_type == code)
+						break;
+				}
+				if (i == ifo->ia_len)
+					i = 0;
+				if (i < ifo->ia_len)
+					memcpy(o + 4, ifo->ia[i].iaid,
+					    sizeof(ifo->ia[i].iaid));
+			}
+			o += ol + 4;
+		}
+		p += ol + 4;
+	}
+	return (size_t)(o - l4buf.buf);
+}
+#endif
+
+#ifdef INET6
+union replay_cmsg {
+	struct cmsghdr hdr;
+	uint8_t buf[CMSG_SPACE(sizeof(struct in6_pktinfo)) +
+	    CMSG_SPACE(sizeof(int))];
+};
+
+/* The socket dhcpcd reads from would say where and how it arrived. */
+static void
+replay_msghdr(struct msghdr *msg, struct iovec *iov, struct sockaddr_in6 *from,
+    union replay_cmsg *cbuf, const struct interface *ifp, const uint8_t *ip6)
+{
+	struct cmsghdr *cm;
+	struct in6_pktinfo pi = { .ipi6_ifindex = ifp->index };
+	int hlim = ip6[7];
+
+	memset(from, 0, sizeof(*from));
+	from->sin6_family = AF_INET6;
+	memcpy(&from->sin6_addr, ip6 + 8, sizeof(from->sin6_addr));
+	if (IN6_IS_ADDR_LINKLOCAL(&from->sin6_addr))
+		from->sin6_scope_id = ifp->index;
+	memcpy(&pi.ipi6_addr, ip6 + 24, sizeof(pi.ipi6_addr));
+
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_name = from;
+	msg->msg_namelen = sizeof(*from);
+	msg->msg_iov = iov;
+	msg->msg_iovlen = 1;
+	msg->msg_control = cbuf->buf;
+	msg->msg_controllen = sizeof(cbuf->buf);
+
+	cm = CMSG_FIRSTHDR(msg);
+	cm->cmsg_level = IPPROTO_IPV6;
+	cm->cmsg_type = IPV6_PKTINFO;
+	cm->cmsg_len = CMSG_LEN(sizeof(pi));
+	memcpy(CMSG_DATA(cm), &pi, sizeof(pi));
+	cm = CMSG_NXTHDR(msg, cm);
+	cm->cmsg_level = IPPROTO_IPV6;
+	cm->cmsg_type = IPV6_HOPLIMIT;
+	cm->cmsg_len = CMSG_LEN(sizeof(hlim));
+	memcpy(CMSG_DATA(cm), &hlim, sizeof(hlim));
+}
+#endif
+
+/* Feeds one frame to dhcpcd, returning how long it took in nsec. */
+static unsigned long long
+replay_frame(struct interface *ifp, const struct frame *f)
+{
+	unsigned long long start, end;
+	uint8_t *data = pktbuf;
+	size_t len = f->len;
+#ifdef INET
+	unsigned int flags;
+#endif
+#ifdef INET6
+	struct msghdr msg;
+	struct iovec iov;
+	struct sockaddr_in6 from;
+	union replay_cmsg cbuf;
+	const uint8_t *ip6 = data + ETHER_HLEN;
+	uint8_t *l4 = data + ETHER_HLEN + sizeof(struct ip6_hdr);
+#endif
+
+	/* dhcpcd is allowed to write to what it reads. */
+	memcpy(data, f->data, len);
+
+	switch (f->proto) {
+#ifdef INET
+	case P_BOOTP:
+		flags = replay_bootp(ifp, data, len);
+		start = now_ns();
+		dhcp_packet(ifp, data, len, flags);
+		break;
+#ifdef ARP
+	case P_ARP:
+		flags = memcmp(data, bcast_hw, ETHER_ALEN) == 0 ? BPF_BCAST : 0;
+		start = now_ns();
+		arp_packet(ifp, data, len, flags);
+		break;
+#endif
+#endif
+#ifdef INET6
+	case P_RA:
+		iov.iov_base = l4buf.buf;
+		iov.iov_len = MIN(get16(ip6 + 4),
+		    len - ETHER_HLEN - sizeof(struct ip6_hdr));
+		memcpy(l4buf.buf, l4, iov.iov_len);
+		replay_msghdr(&msg, &iov, &from, &cbuf, ifp, ip6);
+		start = now_ns();
+		ipv6nd_recvmsg(ifp->ctx, &msg);
+		break;
+#ifdef DHCP6
+	case P_DHCP6:
+		if (get16(l4 + 4) < 8 || (size_t)(l4 - data) + get16(l4 + 4) > len)
+			return 0;
+		iov.iov_base = l4buf.buf;
+		iov.iov_len = replay_dhcp6(ifp, l4 + 8,
+		    (size_t)get16(l4 + 4) - 8);
+		replay_msghdr(&msg, &iov, &from, &cbuf, ifp, ip6);
+		from.sin6_port = htons(get16(l4));
+		start = now_ns();
+		dhcp6_recvmsg(ifp->ctx, &msg, NULL);
+		break;
+#endif
+#endif
+	default:
+		return 0;
+	}
+	end = now_ns();
+	return end - start;
+}
+
+#ifdef ARP
+/* Nothing else answers on the link, so a probe is done once sent. */
+static void
+replay_arpprobed(struct interface *ifp)
+{
+	struct iarp_state *state = ARP_STATE(ifp);
+	struct arp_state *astate;
+
+	if (state == NULL)
+		return;
+again:
+	TAILQ_FOREACH(astate, &state->arp_states, next) {
+		if (!astate->probing)
+			continue;
+		eloop_q_timeout_delete(ifp->ctx->eloop, 0, NULL, astate);
+		timespecclear(&astate->defend);
+		astate->probing = false;
+		/* This can free any of the states. */
+		astate->not_found_cb(astate);
+		goto again;
+	}
+}
+#endif
+
+static void
+replay_next(void *arg)
+{
+	struct run *r = arg;
+	const struct trace *t = r->trace;
+	const struct frame *f;
+	struct interface *ifp;
+	struct timespec ts;
+	unsigned long long ns, due, now;
+
+	ifp = if_find(r->ctx->ifaces, replay_link.name);
+	for (; r->next < t->nframes; r->next++) {
+		f = &t->frames[r->next];
+		if (f->proto == P_SKIP)
+			continue;
+
+		if (timed) {
+			now = now_ns() - r->start;
+			if (f->ts > now) {
+				due = f->ts - now;
+				ts.tv_sec = (time_t)(due / NSEC_PER_SEC);
+				ts.tv_nsec = (long)(due % NSEC_PER_SEC);
+				eloop_timeout_add_tv(r->ctx->eloop, &ts,
+				    replay_next, r);
+				return;
+			}
+		}
+
+		ns = replay_frame(ifp, f);
+		sample_add(&r->lat[f->proto], ns);
+		r->busy += ns;
+		r->replayed++;
+		r->next++;
+#ifdef ARP
+		replay_arpprobed(ifp);
+#endif
+		/* Let dhcpcd see what the kernel says back. */
+		if (r->next < t->nframes) {
+			eloop_timeout_add_sec(r->ctx->eloop, 0, replay_next, r);
+			return;
+		}
+		break;
+	}
+	eloop_exit(r->ctx->eloop, EXIT_SUCCESS);
+}
+
+#ifdef DHCP6
+/* Whether an address from the delegated prefix was added to ifname. */
+static bool
+replay_delegated(struct dhcpcd_ctx *ctx, const char *ifname)
+{
+	struct interface *ifp;
+	const struct dhcp6_state *state;
+	const struct ipv6_addr *ia;
+
+	ifp = if_find(ctx->ifaces, ifname);
+	if (ifp == NULL || (state = D6_CSTATE(ifp)) == NULL)
+		return false;
+	TAILQ_FOREACH(ia, &state->addrs, next) {
+		if (ia->flags & IPV6_AF_ADDED &&
+		    memcmp(&ia->addr, pdprefix6, sizeof(pdprefix6)) == 0)
+			return true;
+	}
+	return false;
+}
+#endif
+
+/* Each run starts the interface from scratch and stops it at the end. */
+static int
+replay_run(struct dhcpcd_ctx *ctx, const struct trace *t,
+    struct samples *lat, struct samples *rate
+#ifndef SMALL
+    , struct if_stats *stats
+#endif
+    )
+{
+	struct run r = { .ctx = ctx, .trace = t, .lat = lat };
+#ifndef SMALL
+	struct interface *ifp;
+	size_t i;
+#endif
+	char name[IF_NAMESIZE];
+	unsigned int n;
+	unsigned long long unbatched6 = replay_counts.unbatched6;
+	int err = 0;
+
+	/* Downstream first, so they are there to delegate to. */
+	for (n = 1; n <= replay_ndownstream; n++) {
+		snprintf(name, sizeof(name), "rp%u", n);
+		if (dhcpcd_handleinterface(ctx, 1, name) == -1) {
+			warn("%s: %s", t->name, name);
+			return -1;
+		}
+	}
+	if (dhcpcd_handleinterface(ctx, 1, replay_link.name) == -1) {
+		warn("%s: %s", t->name, replay_link.name);
+		return -1;
+	}
+
+	r.start = now_ns();
+	eloop_enter(ctx->eloop);
+	eloop_timeout_add_sec(ctx->eloop, 0, replay_next, &r);
+	if (eloop_start(ctx->eloop, NULL) == -1) {
+		warn("%s: eloop_start", t->name);
+		return -1;
+	}
+
+#ifndef SMALL
+	ifp = if_find(ctx->ifaces, replay_link.name);
+	for (i = 0; ifp != NULL && i < IFS_MAX; i++) {
+		stats[i].rx += ifp->stats[i].rx;
+		stats[i].drop += ifp->stats[i].drop;
+		stats[i].cksum += ifp->stats[i].cksum;
+		stats[i].xid += ifp->stats[i].xid;
+	}
+#endif
+
+	if (replay_batch_depth != 0) {
+		warnx("%s: %u batches left open", t->name, replay_batch_depth);
+		err = -1;
+	}
+#ifdef DHCP6
+	for (n = 1; n <= replay_ndownstream; n++) {
+		snprintf(name, sizeof(name), "rp%u", n);
+		if (!replay_delegated(ctx, name)) {
+			warnx("%s: %s: no delegated address", t->name, name);
+			err = -1;
+		}
+	}
+	/* Each downstream interface needs its own rollback. */
+	if (replay_ndownstream != 0 && replay_counts.unbatched6 != unbatched6) {
+		warnx("%s: %llu addresses not batched", t->name,
+		    replay_counts.unbatched6 - unbatched6);
+		err = -1;
+	}
+#endif
+
+	dhcpcd_handleinterface(ctx, -1, replay_link.name);
+	for (n = 1; n <= replay_ndownstream; n++) {
+		snprintf(name, sizeof(name), "rp%u", n);
+		dhcpcd_handleinterface(ctx, -1, name);
+	}
+	dhcp_flushleases(ctx);
+	mock_flush();
+	if (r.busy != 0)
+		sample_add(rate, r.replayed * NSEC_PER_SEC / r.busy);
+	return err;
+}
+
+static int
+bench(struct dhcpcd_ctx *ctx, const struct trace *t, size_t nruns)
+{
+	struct samples lat[P_MAX], rate;
+#ifndef SMALL
+	struct if_stats stats[IFS_MAX];
+#endif
+	struct replay_counts counts;
+	size_t i;
+	int result = EXIT_SUCCESS;
+
+	memset(lat, 0, sizeof(lat));
+	memset(&rate, 0, sizeof(rate));
+#ifndef SMALL
+	memset(stats, 0, sizeof(stats));
+#endif
+	memcpy(&counts, &replay_counts, sizeof(counts));
+
+	for (i = 0; i < nruns; i++) {
+		if (replay_run(ctx, t, lat, &rate
+#ifndef SMALL
+		    , stats
+#endif
+		    ) == -1)
+		{
+			result = EXIT_FAILURE;
+			break;
+		}
+	}
+
+	if (format == FMT_TEXT)
+		printf("%s: %zu frames, %zu runs\n", t->name, t->nframes, i);
+	for (i = 0; i < P_MAX; i++) {
+		if (lat[i].n != 0)
+			report(t->name, proto_names[i], "ns", &lat[i]);
+	}
+	report(t->name, "rate", "msg/s", &rate);
+
+	if (format == FMT_TEXT) {
+#ifndef SMALL
+		for (i = 0; i < IFS_MAX; i++) {
+			if (stats[i].rx == 0)
+				continue;
+			printf("%s: rx %llu, dropped %llu, "
+			    "bad checksum %llu, bad xid %llu\n",
+			    proto_names[i], stats[i].rx, stats[i].drop,
+			    stats[i].cksum, stats[i].xid);
+		}
+#endif
+		printf("sent: bootp %llu, arp %llu, dhcp6 %llu, nd %llu\n",
+		    replay_counts.bootp_tx - counts.bootp_tx,
+		    replay_counts.arp_tx - counts.arp_tx,
+		    replay_counts.dhcp6_tx - counts.dhcp6_tx,
+		    replay_counts.nd_tx - counts.nd_tx);
+		printf("applied: addresses %llu, routes %llu, "
+		    "scripts %llu, writes %llu, batches %llu\n",
+		    replay_counts.addrs - counts.addrs,
+		    replay_counts.routes - counts.routes,
+		    replay_counts.scripts - counts.scripts,
+		    replay_counts.writes - counts.writes,
+		    replay_counts.batches - counts.batches);
+		printf("unbatched: ipv6 addresses %llu\n",
+		    replay_counts.unbatched6 - counts.unbatched6);
+	}
+
+	for (i = 0; i < P_MAX; i++)
+		free(lat[i].v);
+	free(rate.v);
+	return result;
+}
+
+/* Options applied to the replayed interface, the last one is -A. */
+static char arg0[] = "replay", arg1[] = "--nodelay", arg2[] = "--noarp";
+static char *replay_argv[] = { arg0, arg1, arg2, NULL };
+
+static void
+replay_setup(struct dhcpcd_ctx *ctx, const char *cffile, bool noarp,
+    bool debug)
+{
+	struct if_options *ifo;
+
+	logsetopts(LOGERR_ERR | (debug ? LOGERR_DEBUG : LOGERR_QUIET));
+
+	dhcpcd_initctx(ctx);
+	/* Everything privileged is sent to the mock privsep layer. */
+	ctx->options |= DHCPCD_PRIVSEP;
+	ctx->cffile = cffile;
+	ctx->argv = replay_argv;
+	ctx->argc = noarp ? 3 : 2;
+
+	rt_init(ctx);
+	if ((ifo = read_config(ctx, NULL, NULL, NULL)) == NULL)
+		errx(EXIT_FAILURE, "%s: failed to read", cffile);
+	if (add_options(ctx, NULL, ifo, ctx->argc, ctx->argv) != 1)
+		errx(EXIT_FAILURE, "failed to add options");
+	ctx->options |= ifo->options;
+	ctx->options &= ~DHCPCD_DAEMONISE;
+	if (debug)
+		ctx->options |= DHCPCD_DEBUG;
+	free_options(ctx, ifo);
+
+	if ((ctx->eloop = eloop_new()) == NULL)
+		err(EXIT_FAILURE, "eloop_new");
+	if ((ctx->ifaces = malloc(sizeof(*ctx->ifaces))) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	TAILQ_INIT(ctx->ifaces);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct dhcpcd_ctx ctx;
+	struct trace t;
+	const char *cffile = "/dev/null", *wfile = NULL;
+	bool noarp = false, debug = false;
+	size_t nruns = 100;
+	int c, i, first, exit_code;
+
+	while ((c = getopt(argc, argv, "Adf:o:p:r:tw:")) != -1) {
+		switch (c) {
+		case 'A':
+			noarp = true;
+			break;
+		case 'd':
+			debug = true;
+			break;
+		case 'f':
+			cffile = optarg;
+			break;
+		case 'o':
+			if (strcmp(optarg, "text") == 0)
+				format = FMT_TEXT;
+			else if (strcmp(optarg, "csv") == 0)
+				format = FMT_CSV;
+			else
+				errx(EXIT_FAILURE, "unknown format `%s'",
+				    optarg);
+			break;
+		case 'p':
+			replay_ndownstream = (unsigned int)atoi(optarg);
+			break;
+		case 'r':
+			nruns = (size_t)atoi(optarg);
+			break;
+		case 't':
+			timed = true;
+			break;
+		case 'w':
+			wfile = optarg;
+			break;
+		default:
+			errx(EXIT_FAILURE, "illegal argument `%c'", c);
+		}
+	}
+
+	if (wfile != NULL) {
+		trace_generate(&t);
+		trace_write(&t, wfile);
+		trace_free(&t);
+		exit(EXIT_SUCCESS);
+	}
+	if (nruns == 0)
+		errx(EXIT_FAILURE, "need at least one run");
+
+	/* add_options uses getopt as well. */
+	first = optind;
+	replay_setup(&ctx, cffile, noarp, debug);
+
+	if (format == FMT_CSV)
+		printf("trace,metric,unit,count,min,p50,p90,p99,max\n");
+
+	exit_code = EXIT_SUCCESS;
+	for (i = first; i < argc || i == first; i++) {
+		if (i < argc)
+			trace_read(&t, argv[i]);
+		else
+			trace_generate(&t);
+		if (bench(&ctx, &t, nruns) != EXIT_SUCCESS)
+			exit_code = EXIT_FAILURE;
+		trace_free(&t);
+	}
+	exit(exit_code);
+}
+#else
+int
+main(void)
+{
+
+	printf("replay needs privsep on Linux\n");
+	exit(EXIT_SUCCESS);
+}
+#endif
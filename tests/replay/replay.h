@@ -0,0 +1,66 @@
+/*
+ * dhcpcd packet replay harness
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <net/if.h>
+
+#include <stdint.h>
+
+/* The interface if-replay.c pretends the kernel has. */
+struct replay_link {
+	char name[IF_NAMESIZE];
+	unsigned int index;
+	uint8_t hwaddr[6];
+	unsigned int mtu;
+};
+
+/* What dhcpcd asked the mock layers to do. */
+struct replay_counts {
+	unsigned long long bootp_tx;
+	unsigned long long arp_tx;
+	unsigned long long dhcp6_tx;
+	unsigned long long nd_tx;
+	unsigned long long addrs;
+	unsigned long long routes;
+	unsigned long long scripts;
+	unsigned long long writes;
+	unsigned long long batches;
+	unsigned long long unbatched6;	/* IPv6 addresses added alone */
+};
+
+extern struct replay_link replay_link;
+extern struct replay_counts replay_counts;
+/* Links rp1 .. rpN, which a delegated prefix is given to. */
+extern unsigned int replay_ndownstream;
+/* Batches started and not yet ended. */
+extern unsigned int replay_batch_depth;
+
+void mock_flush(void);
+
+#endif
@@ -0,0 +1,14 @@
+# Shared by the harnesses which link dhcpcd against if-replay.c.
+# Include this once OBJS is complete.
+
+# The real dhcpcd.c without its main.
+OBJS+=		replay-dhcpcd.o
+
+.c.o:
+	${CC} ${CFLAGS} ${CPPFLAGS} -c $< -o $@
+
+${OBJS}: Makefile ${TOP}/tests/replay/replay.mk
+
+replay-dhcpcd.o: ${TOP}/tests/replay/replay-dhcpcd.c ${TOP}/src/dhcpcd.c
+	${CC} ${CFLAGS} ${CPPFLAGS} -c ${TOP}/tests/replay/replay-dhcpcd.c \
+	    -o $@
@@ -0,0 +1,436 @@
+/*
+ * dhcpcd interface scale benchmark DHCP server
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * A DHCP server which gives every client the next free address on the
+ * subnet of the interface it was heard on.
+ * It only does what scale.sh needs and is not meant for anything else.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#define	BOOTPS			67
+#define	BOOTPC			68
+#define	BOOTP_HLEN		236
+#define	BOOTP_CHADDR		16
+#define	BOOTP_MAXLEN		576
+
+#define	DHO_PAD			0
+#define	DHO_SUBNETMASK		1
+#define	DHO_ROUTER		3
+#define	DHO_DNSSERVER		6
+#define	DHO_IPADDRESS		50
+#define	DHO_LEASETIME		51
+#define	DHO_MESSAGETYPE		53
+#define	DHO_SERVERID		54
+#define	DHO_END			255
+
+#define	DHCP_DISCOVER		1
+#define	DHCP_OFFER		2
+#define	DHCP_REQUEST		3
+#define	DHCP_ACK		5
+#define	DHCP_NAK		6
+
+static const uint8_t magic_cookie[] = { 99, 130, 83, 99 };
+
+struct lease {
+	unsigned int ifindex;
+	uint8_t hlen;
+	uint8_t chaddr[BOOTP_CHADDR];
+	struct in_addr addr;
+};
+
+/* Where to find the subnet an interface serves. */
+struct link {
+	unsigned int ifindex;
+	struct in_addr addr;
+	struct in_addr mask;
+	uint32_t next;			/* host part of the next lease */
+};
+
+static struct lease *leases;
+static size_t nleases, leases_len;
+static struct link *links;
+static size_t nlinks;
+static uint32_t lease_time = 3600;
+static unsigned long long offers, acks, naks;
+
+static void
+links_load(void)
+{
+	struct ifaddrs *ifaddrs, *ifa;
+	const struct sockaddr_in *sin;
+	struct link *l;
+	size_t n;
+
+	if (getifaddrs(&ifaddrs) == -1)
+		err(EXIT_FAILURE, "getifaddrs");
+	n = 0;
+	for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next)
+		n++;
+	free(links);
+	if ((links = calloc(n, sizeof(*links))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	nlinks = 0;
+	for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
+		if (ifa->ifa_addr == NULL ||
+		    ifa->ifa_addr->sa_family != AF_INET ||
+		    ifa->ifa_flags & IFF_LOOPBACK)
+			continue;
+		l = &links[nlinks++];
+		l->ifindex = if_nametoindex(ifa->ifa_name);
+		sin = (const void *)ifa->ifa_addr;
+		l->addr = sin->sin_addr;
+		sin = (const void *)ifa->ifa_netmask;
+		l->mask = sin->sin_addr;
+		l->next = 1;
+	}
+	freeifaddrs(ifaddrs);
+}
+
+static struct link *
+link_find(unsigned int ifindex)
+{
+	size_t i;
+
+	for (i = 0; i < nlinks; i++) {
+		if (links[i].ifindex == ifindex)
+			return &links[i];
+	}
+	return NULL;
+}
+
+static struct lease *
+lease_find(struct link *l, const uint8_t *bootp, bool create)
+{
+	struct lease *le;
+	uint32_t net, host, bcast;
+	uint8_t hlen = bootp[2];
+	size_t i;
+
+	if (hlen > BOOTP_CHADDR)
+		return NULL;
+	for (i = 0; i < nleases; i++) {
+		le = &leases[i];
+		if (le->ifindex == l->ifindex && le->hlen == hlen &&
+		    memcmp(le->chaddr, bootp + 28, hlen) == 0)
+			return le;
+	}
+	if (!create)
+		return NULL;
+
+	net = ntohl(l->addr.s_addr & l->mask.s_addr);
+	bcast = net | ~ntohl(l->mask.s_addr);
+	host = net + l->next;
+	/* Skip our own address. */
+	if (host == ntohl(l->addr.s_addr))
+		host++;
+	if (host >= bcast)
+		return NULL;
+	l->next = host - net + 1;
+
+	if (nleases == leases_len) {
+		size_t len = leases_len == 0 ? 64 : leases_len * 2;
+		struct lease *nl;
+
+		nl = realloc(leases, len * sizeof(*nl));
+		if (nl == NULL)
+			err(EXIT_FAILURE, "realloc");
+		leases = nl;
+		leases_len = len;
+	}
+	le = &leases[nleases++];
+	le->ifindex = l->ifindex;
+	le->hlen = hlen;
+	memcpy(le->chaddr, bootp + 28, hlen);
+	le->addr.s_addr = htonl(host);
+	return le;
+}
+
+/* Returns the option, or NULL if not found. */
+static const uint8_t *
+option_find(const uint8_t *bootp, size_t len, uint8_t code, uint8_t *olen)
+{
+	const uint8_t *p = bootp + BOOTP_HLEN + sizeof(magic_cookie);
+	const uint8_t *e = bootp + len;
+
+	while (p < e) {
+		if (*p == DHO_PAD) {
+			p++;
+			continue;
+		}
+		if (*p == DHO_END || p + 2 > e || p + 2 + p[1] > e)
+			break;
+		if (*p == code) {
+			*olen = p[1];
+			return p + 2;
+		}
+		p += 2 + p[1];
+	}
+	return NULL;
+}
+
+static uint8_t *
+option_add(uint8_t *p, uint8_t code, const void *data, uint8_t len)
+{
+
+	*p++ = code;
+	*p++ = len;
+	memcpy(p, data, len);
+	return p + len;
+}
+
+static void
+reply(int s, const struct link *l, const uint8_t *bootp, uint8_t type,
+    const struct in_addr *yiaddr)
+{
+	uint8_t buf[BOOTP_MAXLEN], *p;
+	uint32_t lt = htonl(lease_time);
+	struct sockaddr_in to = {
+		.sin_family = AF_INET,
+		.sin_port = htons(BOOTPC),
+		.sin_addr.s_addr = INADDR_BROADCAST,
+	};
+	union {
+		struct cmsghdr hdr;
+		uint8_t buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+	} cbuf;
+	struct in_pktinfo pi = {
+		.ipi_ifindex = (int)l->ifindex,
+		.ipi_spec_dst = l->addr,
+	};
+	struct iovec iov = { .iov_base = buf };
+	struct msghdr msg = {
+		.msg_name = &to,
+		.msg_namelen = sizeof(to),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf.buf,
+		.msg_controllen = sizeof(cbuf.buf),
+	};
+	struct cmsghdr *cm;
+
+	memset(buf, 0, sizeof(buf));
+	buf[0] = 2;			/* BOOTREPLY */
+	memcpy(buf + 1, bootp + 1, 2);	/* htype, hlen */
+	memcpy(buf + 4, bootp + 4, 4);	/* xid */
+	memcpy(buf + 10, bootp + 10, 2);	/* flags */
+	if (yiaddr != NULL)
+		memcpy(buf + 16, yiaddr, sizeof(*yiaddr));
+	memcpy(buf + 28, bootp + 28, BOOTP_CHADDR);
+	memcpy(buf + BOOTP_HLEN, magic_cookie, sizeof(magic_cookie));
+
+	p = buf + BOOTP_HLEN + sizeof(magic_cookie);
+	p = option_add(p, DHO_MESSAGETYPE, &type, 1);
+	p = option_add(p, DHO_SERVERID, &l->addr, sizeof(l->addr));
+	if (type != DHCP_NAK) {
+		p = option_add(p, DHO_LEASETIME, &lt, sizeof(lt));
+		p = option_add(p, DHO_SUBNETMASK, &l->mask, sizeof(l->mask));
+		p = option_add(p, DHO_ROUTER, &l->addr, sizeof(l->addr));
+		p = option_add(p, DHO_DNSSERVER, &l->addr, sizeof(l->addr));
+	}
+	*p++ = DHO_END;
+	/* Pad to the minimum BOOTP message size. */
+	iov.iov_len = (size_t)(p - buf) < 300 ? 300 : (size_t)(p - buf);
+
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = IPPROTO_IP;
+	cm->cmsg_type = IP_PKTINFO;
+	cm->cmsg_len = CMSG_LEN(sizeof(pi));
+	memcpy(CMSG_DATA(cm), &pi, sizeof(pi));
+
+	if (sendmsg(s, &msg, 0) == -1)
+		warn("sendmsg");
+}
+
+static void
+handle(int s, const uint8_t *bootp, size_t len, unsigned int ifindex)
+{
+	struct link *l;
+	struct lease *le;
+	const uint8_t *type, *ip;
+	uint8_t olen;
+	struct in_addr want;
+
+	if (len < BOOTP_HLEN + sizeof(magic_cookie) || bootp[0] != 1 ||
+	    memcmp(bootp + BOOTP_HLEN, magic_cookie, sizeof(magic_cookie)) != 0)
+		return;
+	if ((type = option_find(bootp, len, DHO_MESSAGETYPE, &olen)) == NULL ||
+	    olen != 1)
+		return;
+
+	/* Interfaces come and go as scale.sh sets up. */
+	if ((l = link_find(ifindex)) == NULL) {
+		links_load();
+		if ((l = link_find(ifindex)) == NULL)
+			return;
+	}
+
+	switch (*type) {
+	case DHCP_DISCOVER:
+		if ((le = lease_find(l, bootp, true)) == NULL)
+			return;
+		reply(s, l, bootp, DHCP_OFFER, &le->addr);
+		offers++;
+		break;
+	case DHCP_REQUEST:
+		if ((ip = option_find(bootp, len, DHO_IPADDRESS, &olen)) != NULL &&
+		    olen == sizeof(want))
+			memcpy(&want, ip, sizeof(want));
+		else
+			memcpy(&want, bootp + 12, sizeof(want));	/* ciaddr */
+		le = lease_find(l, bootp, true);
+		if (le == NULL || le->addr.s_addr != want.s_addr) {
+			reply(s, l, bootp, DHCP_NAK, NULL);
+			naks++;
+			return;
+		}
+		reply(s, l, bootp, DHCP_ACK, &le->addr);
+		acks++;
+		break;
+	}
+}
+
+static volatile sig_atomic_t done;
+
+static void
+sig_done(__attribute__((__unused__)) int sig)
+{
+
+	done = 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction sa = { .sa_handler = sig_done };
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(BOOTPS),
+		.sin_addr.s_addr = INADDR_ANY,
+	};
+	uint8_t buf[1500];
+	union {
+		struct cmsghdr hdr;
+		uint8_t buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+	} cbuf;
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+	struct cmsghdr *cm;
+	struct in_pktinfo pi;
+	const char *ready = NULL;
+	unsigned int ifindex;
+	ssize_t len;
+	int c, s, on = 1, fd;
+
+	while ((c = getopt(argc, argv, "l:r:")) != -1) {
+		switch (c) {
+		case 'l':
+			lease_time = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			ready = optarg;
+			break;
+		default:
+			errx(EXIT_FAILURE, "illegal argument `%c'", c);
+		}
+	}
+
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	if ((s = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1)
+		err(EXIT_FAILURE, "socket");
+	if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+	    setsockopt(s, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on)) == -1 ||
+	    setsockopt(s, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) == -1)
+		err(EXIT_FAILURE, "setsockopt");
+	if (bind(s, (struct sockaddr *)&sin, sizeof(sin)) == -1)
+		err(EXIT_FAILURE, "bind");
+	links_load();
+
+	/* Tell scale.sh we are listening. */
+	if (ready != NULL) {
+		if ((fd = open(ready, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+			err(EXIT_FAILURE, "%s", ready);
+		close(fd);
+	}
+
+	while (!done) {
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof(cbuf.buf);
+		if ((len = recvmsg(s, &msg, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "recvmsg");
+		}
+		ifindex = 0;
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+		    cm = CMSG_NXTHDR(&msg, cm))
+		{
+			if (cm->cmsg_level == IPPROTO_IP &&
+			    cm->cmsg_type == IP_PKTINFO)
+			{
+				memcpy(&pi, CMSG_DATA(cm), sizeof(pi));
+				ifindex = (unsigned int)pi.ipi_ifindex;
+			}
+		}
+		if (ifindex != 0)
+			handle(s, buf, (size_t)len, ifindex);
+	}
+
+	printf("offers %llu, acks %llu, naks %llu\n", offers, acks, naks);
+	exit(EXIT_SUCCESS);
+}
+#else
+int
+main(void)
+{
+
+	printf("scale-server only runs on Linux\n");
+	exit(EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,338 @@
+#!/bin/sh
+# Starts dhcpcd as a manager on lots of interfaces in a network namespace
+# and reports how long they took to bind and what it cost.
+
+usage()
+{
+	cat <<EOF >&2
+usage: scale.sh [-aq] [-c file] [-f format] [-l lease] [-n count]
+                [-t veth|macvlan|dummy] [-w timeout] [dhcpcd ...]
+EOF
+	exit 1
+}
+
+: ${RUNDIR:=/var/run/dhcpcd}
+: ${DBDIR:=/var/db/dhcpcd}
+: ${IP:=ip}
+
+arp=false
+quiet=false
+extra=
+format=text
+lease=3600
+count=64
+type=veth
+timeout=60
+while getopts ac:f:l:n:qt:w: opt; do
+	case "$opt" in
+	a)	arp=true;;
+	c)	extra="$OPTARG";;
+	f)	format="$OPTARG";;
+	l)	lease="$OPTARG";;
+	n)	count="$OPTARG";;
+	q)	quiet=true;;
+	t)	type="$OPTARG";;
+	w)	timeout="$OPTARG";;
+	*)	usage;;
+	esac
+done
+shift $(($OPTIND - 1))
+[ $# -eq 0 ] && set -- ../../src/dhcpcd
+
+case "$type" in
+veth|macvlan|dummy);;
+*)	usage;;
+esac
+case "$format" in
+text|csv);;
+*)	usage;;
+esac
+
+# The make test target only tries when it can.
+skip()
+{
+	if $quiet; then
+		echo "scale.sh: $*, skipping"
+		exit 0
+	fi
+	echo "scale.sh: $*" >&2
+	exit 1
+}
+[ "$(uname -s)" = Linux ] || skip "network namespaces need Linux"
+[ "$(id -u)" = 0 ] || skip "creating interfaces needs root"
+for x in "$IP" unshare nsenter; do
+	command -v "$x" >/dev/null 2>&1 || skip "$x is not installed"
+done
+
+here=$(cd "$(dirname "$0")" && pwd)
+server="$here/scale-server"
+[ -x "$server" ] || skip "$server is not built"
+
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/dhcpcd-scale.XXXXXX") || exit 1
+srv=dhcpcd-scale-srv-$$
+cli=dhcpcd-scale-cli-$$
+dhcpcd_pid=
+server_pid=
+
+cleanup()
+{
+	[ -n "$dhcpcd_pid" ] && kill "$dhcpcd_pid" 2>/dev/null
+	[ -n "$server_pid" ] && kill "$server_pid" 2>/dev/null
+	wait 2>/dev/null
+	"$IP" netns del $cli 2>/dev/null
+	"$IP" netns del $srv 2>/dev/null
+	rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# Each link n serves 10.x.y.0/24, macvlans share one /16.
+subnet()
+{
+	echo "10.$(($1 / 256 % 256)).$(($1 % 256))"
+}
+
+setup()
+{
+	"$IP" netns add $srv || exit 1
+	"$IP" netns add $cli || exit 1
+	"$IP" -n $srv link set lo up
+	"$IP" -n $cli link set lo up
+
+	i=1
+	case "$type" in
+	veth)
+		while [ $i -le $count ]; do
+			echo "link add sc$i netns $cli type veth" \
+			    "peer name ss$i netns $srv"
+			i=$(($i + 1))
+		done | "$IP" -batch - || exit 1
+		i=1
+		while [ $i -le $count ]; do
+			echo "addr add $(subnet $i).1/24 dev ss$i"
+			echo "link set ss$i up"
+			i=$(($i + 1))
+		done | "$IP" -n $srv -batch - || exit 1
+		;;
+	macvlan)
+		"$IP" link add sp0 netns $cli type veth \
+		    peer name ss0 netns $srv || exit 1
+		"$IP" -n $srv addr add 10.0.0.1/16 dev ss0
+		"$IP" -n $srv link set ss0 up
+		"$IP" -n $cli link set sp0 up
+		while [ $i -le $count ]; do
+			echo "link add sc$i link sp0 type macvlan mode bridge"
+			i=$(($i + 1))
+		done | "$IP" -n $cli -batch - || exit 1
+		;;
+	dummy)
+		while [ $i -le $count ]; do
+			echo "link add sc$i type dummy"
+			i=$(($i + 1))
+		done | "$IP" -n $cli -batch - || exit 1
+		;;
+	esac
+	i=1
+	while [ $i -le $count ]; do
+		echo "link set sc$i up"
+		i=$(($i + 1))
+	done | "$IP" -n $cli -batch - || exit 1
+}
+
+config()
+{
+	cat <<EOF
+allowinterfaces sc*
+ipv4only
+nodelay
+noipv4ll
+script $tmp/hook
+EOF
+	$arp || echo noarp
+	# Nothing would answer a dummy, so bind from the configuration.
+	if [ "$type" = dummy ]; then
+		i=1
+		while [ $i -le $count ]; do
+			echo "interface sc$i"
+			echo "static ip_address=$(subnet $i).2/24"
+			echo "static routers=$(subnet $i).1"
+			i=$(($i + 1))
+		done
+	fi
+	[ -n "$extra" ] && cat "$extra"
+}
+
+# dhcpcd and its privsep processes, not the scripts they run.
+pids()
+{
+	ps -e -o pid= -o ppid= -o comm= | awk -v top="$1" '
+	{ ppid[$1] = $2; comm[$1] = $3 }
+	END {
+		for (p in ppid) {
+			for (q = p; q != "" && q != top && q > 1; q = ppid[q])
+				;
+			if (q == top && comm[p] == "dhcpcd")
+				print p
+		}
+	}'
+}
+
+# count min p50 p90 p99 max of numbers, one per line.
+stats()
+{
+	sort -n | awk '
+	{ v[++n] = $1 }
+	function pct(p,	i) {
+		i = int((n * p + 99) / 100)
+		return v[i < 1 ? 1 : i]
+	}
+	END {
+		if (n == 0)
+			print 0, 0, 0, 0, 0, 0
+		else
+			print n, v[1], pct(50), pct(90), pct(99), v[n]
+	}'
+}
+
+report()
+{
+	case "$format" in
+	csv)	echo "$name,$privsep,$type,$count,$1,$2,$3";;
+	*)	printf "%s: %s %s\n" "$1" "$3" "$2";;
+	esac
+}
+
+# Percentiles are reported as one line of text or a metric each.
+report_stats()
+{
+	metric=$1
+	unit=$2
+	shift 2
+	case "$format" in
+	csv)
+		report ${metric}_count $unit $1
+		report ${metric}_min $unit $2
+		report ${metric}_p50 $unit $3
+		report ${metric}_p90 $unit $4
+		report ${metric}_p99 $unit $5
+		report ${metric}_max $unit $6
+		;;
+	*)	printf "%s: count %s, min %s, p50 %s, p90 %s, p99 %s, max %s %s\n" \
+		    $metric "$@" $unit;;
+	esac
+}
+
+bench()
+{
+	dhcpcd=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+	name="$1"
+	[ -x "$dhcpcd" ] || { echo "$1: not executable" >&2; return 1; }
+
+	setup
+	: >"$tmp/events"
+	cat <<EOF >"$tmp/hook"
+#!/bin/sh
+echo "\$interface \$reason \$(date +%s%N)" >>"$tmp/events"
+EOF
+	chmod +x "$tmp/hook"
+	config >"$tmp/dhcpcd.conf"
+
+	if [ "$type" != dummy ]; then
+		rm -f "$tmp/ready"
+		"$IP" netns exec $srv "$server" -l "$lease" -r "$tmp/ready" \
+		    >"$tmp/server.log" &
+		server_pid=$!
+		n=0
+		while [ ! -e "$tmp/ready" ]; do
+			n=$(($n + 1))
+			[ $n -gt 100 ] && { echo "server did not start" >&2; exit 1; }
+			sleep 0.05
+		done
+	fi
+
+	# Leases and the control socket are private to this run.
+	started=$(date +%s%N)
+	"$IP" netns exec $cli unshare -m sh -c '
+	    mount --make-rprivate / &&
+	    mkdir -p "$1" "$2" &&
+	    mount -t tmpfs none "$1" &&
+	    mount -t tmpfs none "$2" &&
+	    exec "$3" -B -f "$4" -j "$5"' sh \
+	    "$RUNDIR" "$DBDIR" "$dhcpcd" "$tmp/dhcpcd.conf" "$tmp/dhcpcd.log" \
+	    >/dev/null 2>&1 &
+	dhcpcd_pid=$!
+
+	deadline=$(($(date +%s) + $timeout))
+	bound=0
+	while [ $bound -lt $count ] && [ $(date +%s) -lt $deadline ]; do
+		sleep 0.1
+		kill -0 $dhcpcd_pid 2>/dev/null || break
+		bound=$(awk '$2 == "BOUND" || $2 == "STATIC" { b[$1] = 1 }
+		    END { print length(b) }' "$tmp/events")
+	done
+	all=$(($(date +%s%N) - $started))
+
+	# unshare and sh exec, so this is the manager.
+	procs=$(pids $dhcpcd_pid)
+	[ -n "$procs" ] || procs=$dhcpcd_pid
+	nprocs=$(echo $procs | wc -w)
+	privsep=noprivsep
+	[ $nprocs -gt 1 ] && privsep=privsep
+
+	hz=$(getconf CLK_TCK)
+	cpu=$(for p in $procs; do cat /proc/$p/stat; done 2>/dev/null | awk -v hz=$hz '
+	    { sub(/^.*\) /, ""); u += $12; s += $13 }
+	    END { printf("%d %d\n", u * 1000 / hz, s * 1000 / hz) }')
+	rss=$(for p in $procs; do cat /proc/$p/status; done 2>/dev/null | awk '
+	    $1 == "VmRSS:" { r += $2 } END { print r + 0 }')
+	# Only builds with --dumpstats support report these.
+	rt=$(nsenter -t $dhcpcd_pid -m -n "$dhcpcd" --dumpstats 2>/dev/null |
+	    tr '\0' '\n' | awk -F= '
+	    BEGIN { n = t = m = "-" }
+	    $1 == "rt_builds" { n = $2 }
+	    $1 == "rt_build_ns" { t = $2 }
+	    $1 == "rt_build_ns_max" { m = $2 }
+	    END { print n, t, m }')
+
+	[ "$format" = text ] &&
+	    echo "$name ($privsep), $count $type interfaces"
+	report bound interfaces $bound
+	report all_bound ms $(($all / 1000000))
+	report_stats time_to_bound ms $(awk -v start=$started '
+	    ($2 == "BOUND" || $2 == "STATIC") && !($1 in b) {
+	        b[$1] = 1; print int(($3 - start) / 1000000) }' \
+	    "$tmp/events" | stats)
+	set -- $cpu
+	report cpu_user ms $1
+	report cpu_system ms $2
+	report rss kB $rss
+	report processes processes $nprocs
+	set -- $rt
+	report rt_builds builds $1
+	report rt_build_ns ns $2
+	report rt_build_ns_max ns $3
+
+	kill $dhcpcd_pid 2>/dev/null
+	wait $dhcpcd_pid 2>/dev/null
+	dhcpcd_pid=
+	if [ -n "$server_pid" ]; then
+		kill $server_pid 2>/dev/null
+		wait $server_pid 2>/dev/null
+		server_pid=
+	fi
+	"$IP" netns del $cli
+	"$IP" netns del $srv
+
+	[ $bound -eq $count ] || {
+		echo "$name: only $bound of $count bound" >&2
+		tail -n 20 "$tmp/dhcpcd.log" >&2
+		return 1
+	}
+}
+
+[ "$format" = csv ] && echo "dhcpcd,privsep,type,interfaces,metric,unit,value"
+status=0
+for x; do
+	bench "$x" || status=1
+done
+exit $status